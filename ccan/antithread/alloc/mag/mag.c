@@ -0,0 +1,396 @@
+/* Licensed under LGPLv2.1+ - see LICENSE file for details */
+#include <ccan/antithread/alloc/mag/mag.h>
+#include <ccan/antithread/alloc/alloc.h>
+#include <ccan/ilog/ilog.h>
+#include <ccan/short_types/short_types.h>
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Small objects come from slabs: SLAB_SIZE-aligned chunks of the
+ * underlying pool, each given over to one size class.  A bitmap in the
+ * header says which chunks of the pool are slabs, so we can tell a small
+ * object from a large one (and find its class in the slab header) when
+ * it's freed.  Slabs are never given back.
+ *
+ * The free objects in each class are a list (linked through their first
+ * bytes, by offset) in the header; caches take and give back a batch of
+ * them at a time, under the header's lock.
+ */
+#define SLAB_BITS 16
+#define SLAB_SIZE (1UL << SLAB_BITS)
+#define SLAB_HEADER 64
+#define BATCH (ALLOC_MAG_SIZE / 2)
+
+struct class_state {
+	/* Offset of the first free object, or 0. */
+	u64 free;
+	u64 num_free;
+	u64 slabs;
+};
+
+struct mag_header {
+	_Atomic(u32) lock;
+	u32 map_words;
+	/* Where the underlying pool starts, and its size. */
+	unsigned long sub_offset, sub_size;
+	struct class_state cs[ALLOC_MAG_CLASSES];
+	/* One bit per SLAB_SIZE chunk of the underlying pool. */
+	_Atomic(u64) slab_map[];
+};
+
+struct slab_header {
+	u32 class;
+	u32 num;
+};
+
+static const u16 class_sizes[ALLOC_MAG_CLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* 16 bytes apart up to 128, then four classes per power of 2. */
+static unsigned int size_to_class(unsigned long size)
+{
+	unsigned int b;
+
+	if (size <= 128)
+		return size ? (size - 1) / 16 : 0;
+	b = ilog32(size - 1);
+	return 8 + (b - 8) * 4 + ((size - 1) >> (b - 3)) - 4;
+}
+
+static unsigned long objs_per_slab(unsigned int class)
+{
+	return (SLAB_SIZE - SLAB_HEADER) / class_sizes[class];
+}
+
+static void lock(struct mag_header *head)
+{
+	unsigned int spins = 0;
+
+	while (atomic_exchange_explicit(&head->lock, 1, memory_order_acquire))
+		if (++spins % 128 == 0)
+			sched_yield();
+}
+
+static void unlock(struct mag_header *head)
+{
+	atomic_store_explicit(&head->lock, 0, memory_order_release);
+}
+
+static void *sub_pool(void *pool)
+{
+	return (char *)pool + ((struct mag_header *)pool)->sub_offset;
+}
+
+static unsigned long sub_size(void *pool)
+{
+	return ((struct mag_header *)pool)->sub_size;
+}
+
+static void *from_off(void *pool, u64 off)
+{
+	return (char *)pool + off;
+}
+
+static u64 to_off(void *pool, void *p)
+{
+	return (char *)p - (char *)pool;
+}
+
+/* Which slab-sized chunk of the underlying pool is this? */
+static unsigned long chunk_of(void *pool, const void *p)
+{
+	return ((const char *)p - (const char *)sub_pool(pool)) >> SLAB_BITS;
+}
+
+static bool is_slab(const struct mag_header *head, unsigned long chunk)
+{
+	return atomic_load_explicit(&head->slab_map[chunk / 64],
+				    memory_order_relaxed)
+		& (1ULL << (chunk % 64));
+}
+
+static struct slab_header *slab_of(void *pool, void *p)
+{
+	unsigned long off = (char *)p - (char *)sub_pool(pool);
+
+	return (struct slab_header *)((char *)sub_pool(pool)
+				      + (off & ~(SLAB_SIZE - 1)));
+}
+
+/*
+ * alloc carves all but tiny pools into 256 large pages (a power of 2 in
+ * size), and alloc_check() trips over a partial one at the end: so give
+ * it whole ones, at the cost of at most one large page.
+ */
+static unsigned long trim_pool(unsigned long size)
+{
+	unsigned long large;
+
+	if (size < 1024 * 1024)
+		return size;
+	large = 1UL << (ilog64(size / 8192 - 1) + 5);
+	return size & ~(large - 1);
+}
+
+void alloc_mag_init(void *pool, unsigned long poolsize)
+{
+	struct mag_header *head = pool;
+	unsigned long words = (poolsize >> SLAB_BITS) / 64 + 1;
+	unsigned long hsize = sizeof(*head) + words * sizeof(head->slab_map[0]);
+	unsigned int i;
+
+	/* Keep objects 16-byte aligned (and the lock in its own line). */
+	hsize = (hsize + 63) & ~63UL;
+	assert(poolsize > hsize);
+
+	atomic_init(&head->lock, 0);
+	head->map_words = words;
+	head->sub_offset = hsize;
+	head->sub_size = trim_pool(poolsize - hsize);
+	for (i = 0; i < ALLOC_MAG_CLASSES; i++) {
+		head->cs[i].free = 0;
+		head->cs[i].num_free = 0;
+		head->cs[i].slabs = 0;
+	}
+	for (i = 0; i < words; i++)
+		atomic_init(&head->slab_map[i], 0);
+	alloc_init(sub_pool(pool), sub_size(pool));
+}
+
+void alloc_mag_cache_init(struct alloc_mag_cache *cache,
+			  void *pool, unsigned long poolsize)
+{
+	unsigned int i;
+
+	cache->pool = pool;
+	cache->poolsize = poolsize;
+	for (i = 0; i < ALLOC_MAG_CLASSES; i++)
+		cache->mag[i].num = 0;
+}
+
+static void push_free(void *pool, struct class_state *cs, void *obj)
+{
+	memcpy(obj, &cs->free, sizeof(cs->free));
+	cs->free = to_off(pool, obj);
+	cs->num_free++;
+}
+
+static void *pop_free(void *pool, struct class_state *cs)
+{
+	void *obj = from_off(pool, cs->free);
+
+	memcpy(&cs->free, obj, sizeof(cs->free));
+	cs->num_free--;
+	return obj;
+}
+
+/* Called with the lock held: carve a new slab onto the free list. */
+static bool new_slab(void *pool, unsigned int class)
+{
+	struct mag_header *head = pool;
+	struct slab_header *slab;
+	unsigned long i, chunk;
+	char *first;
+
+	slab = alloc_get(sub_pool(pool), sub_size(pool),
+			 SLAB_SIZE, SLAB_SIZE);
+	if (!slab)
+		return false;
+
+	slab->class = class;
+	slab->num = objs_per_slab(class);
+	chunk = chunk_of(pool, slab);
+	atomic_fetch_or(&head->slab_map[chunk / 64], 1ULL << (chunk % 64));
+	head->cs[class].slabs++;
+
+	/* Backwards, so they come off the list in address order. */
+	first = (char *)slab + SLAB_HEADER;
+	for (i = slab->num; i > 0; i--)
+		push_free(pool, &head->cs[class], first
+			  + (i - 1) * class_sizes[class]);
+	return true;
+}
+
+static void refill(struct alloc_mag_cache *cache, unsigned int class)
+{
+	struct mag_header *head = cache->pool;
+	struct class_state *cs = &head->cs[class];
+	struct alloc_mag *mag = &cache->mag[class];
+
+	lock(head);
+	while (mag->num < BATCH) {
+		if (!cs->num_free
+		    && !new_slab(cache->pool, class))
+			break;
+		mag->obj[mag->num++] = pop_free(cache->pool, cs);
+	}
+	unlock(head);
+}
+
+static void give_back(struct alloc_mag_cache *cache, unsigned int class,
+		      unsigned int num)
+{
+	struct mag_header *head = cache->pool;
+	struct alloc_mag *mag = &cache->mag[class];
+
+	lock(head);
+	while (num--)
+		push_free(cache->pool, &head->cs[class], mag->obj[--mag->num]);
+	unlock(head);
+}
+
+void *alloc_mag_get(struct alloc_mag_cache *cache, unsigned long size)
+{
+	struct mag_header *head = cache->pool;
+	struct alloc_mag *mag;
+	unsigned int class;
+	void *p;
+
+	if (size > ALLOC_MAG_MAX_SIZE) {
+		lock(head);
+		p = alloc_get(sub_pool(cache->pool),
+			      sub_size(cache->pool), size, 16);
+		unlock(head);
+		return p;
+	}
+
+	class = size_to_class(size);
+	mag = &cache->mag[class];
+	if (!mag->num) {
+		refill(cache, class);
+		if (!mag->num)
+			return NULL;
+	}
+	return mag->obj[--mag->num];
+}
+
+void alloc_mag_free(struct alloc_mag_cache *cache, void *p)
+{
+	struct mag_header *head = cache->pool;
+	struct alloc_mag *mag;
+
+	if (!p)
+		return;
+
+	if (!is_slab(head, chunk_of(cache->pool, p))) {
+		lock(head);
+		alloc_free(sub_pool(cache->pool),
+			   sub_size(cache->pool), p);
+		unlock(head);
+		return;
+	}
+
+	mag = &cache->mag[slab_of(cache->pool, p)->class];
+	if (mag->num == ALLOC_MAG_SIZE)
+		give_back(cache, mag - cache->mag, BATCH);
+	mag->obj[mag->num++] = p;
+}
+
+unsigned long alloc_mag_size(struct alloc_mag_cache *cache, void *p)
+{
+	struct mag_header *head = cache->pool;
+	unsigned long size;
+
+	if (is_slab(head, chunk_of(cache->pool, p)))
+		return class_sizes[slab_of(cache->pool, p)->class];
+
+	lock(head);
+	size = alloc_size(sub_pool(cache->pool),
+			  sub_size(cache->pool), p);
+	unlock(head);
+	return size;
+}
+
+void alloc_mag_cache_flush(struct alloc_mag_cache *cache)
+{
+	unsigned int i;
+
+	for (i = 0; i < ALLOC_MAG_CLASSES; i++)
+		if (cache->mag[i].num)
+			give_back(cache, i, cache->mag[i].num);
+}
+
+static bool mag_check_fail(void)
+{
+	/* A good place to put a breakpoint. */
+	return false;
+}
+
+bool alloc_mag_check(void *pool, unsigned long poolsize)
+{
+	struct mag_header *head = pool;
+	unsigned int i;
+
+	if (head->sub_offset + head->sub_size > poolsize)
+		return mag_check_fail();
+	if (!alloc_check(sub_pool(pool), sub_size(pool)))
+		return mag_check_fail();
+
+	for (i = 0; i < ALLOC_MAG_CLASSES; i++) {
+		const struct class_state *cs = &head->cs[i];
+		u64 off, num = 0;
+
+		for (off = cs->free; off; num++) {
+			void *obj = from_off(pool, off);
+			struct slab_header *slab;
+			unsigned long n;
+
+			if (num >= cs->slabs * objs_per_slab(i))
+				return mag_check_fail();
+			if (off < head->sub_offset || off + class_sizes[i]
+			    > head->sub_offset + head->sub_size)
+				return mag_check_fail();
+			if (!is_slab(head, chunk_of(pool, obj)))
+				return mag_check_fail();
+			slab = slab_of(pool, obj);
+			if (slab->class != i || slab->num != objs_per_slab(i))
+				return mag_check_fail();
+			n = (char *)obj - ((char *)slab + SLAB_HEADER);
+			if (n % class_sizes[i] || n / class_sizes[i] >= slab->num)
+				return mag_check_fail();
+			memcpy(&off, obj, sizeof(off));
+		}
+		if (num != cs->num_free)
+			return mag_check_fail();
+	}
+	return true;
+}
+
+void alloc_mag_visualize(FILE *out, void *pool, unsigned long poolsize)
+{
+	struct mag_header *head = pool;
+	unsigned long overhead = 0;
+	unsigned int i;
+
+	fprintf(out, "Magazine pool %p size %lu: header %lu bytes,"
+		" %lu byte slabs\n", pool, poolsize, head->sub_offset, SLAB_SIZE);
+	for (i = 0; i < ALLOC_MAG_CLASSES; i++) {
+		const struct class_state *cs = &head->cs[i];
+		unsigned long objs = cs->slabs * objs_per_slab(i), waste;
+
+		if (!cs->slabs)
+			continue;
+		/* Slab headers, and the space after the last object. */
+		waste = cs->slabs * (SLAB_SIZE - objs_per_slab(i)
+				     * class_sizes[i]);
+		overhead += waste;
+		fprintf(out, "Class %u (%u bytes): %llu slabs, %lu objects:"
+			" %llu free, %llu in caches or used (%.3g%%),"
+			" %lu bytes overhead\n",
+			i, class_sizes[i], (long long)cs->slabs, objs,
+			(long long)cs->num_free,
+			(long long)(objs - cs->num_free),
+			100.0 * (objs - cs->num_free) / objs, waste);
+	}
+	fprintf(out, "Overhead (slabs): %lu bytes (%.3g%%), %lu bytes unused"
+		" at end\n", overhead, 100.0 * overhead / poolsize,
+		poolsize - head->sub_offset - head->sub_size);
+	alloc_visualize(out, sub_pool(pool), sub_size(pool));
+}
@@ -0,0 +1,149 @@
+/* Licensed under LGPLv2.1+ - see LICENSE file for details */
+#ifndef ALLOC_MAG_H
+#define ALLOC_MAG_H
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Objects each cache holds per size class, before it gives some back. */
+#define ALLOC_MAG_SIZE 64
+
+/* Size classes: 16 to 2048 bytes, four per power of 2. */
+#define ALLOC_MAG_CLASSES 24
+
+/* Larger allocations go straight to alloc_get(). */
+#define ALLOC_MAG_MAX_SIZE 2048
+
+/**
+ * struct alloc_mag_cache - one thread's (or process's) cache of objects.
+ *
+ * This lives in private memory, not the pool: each thread which
+ * allocates from the pool keeps one, and initializes it with
+ * alloc_mag_cache_init().  For each size class it holds a magazine of up
+ * to ALLOC_MAG_SIZE free objects, so most allocations and frees never
+ * touch the shared pool at all.
+ */
+struct alloc_mag_cache {
+	void *pool;
+	unsigned long poolsize;
+	struct alloc_mag {
+		unsigned int num;
+		void *obj[ALLOC_MAG_SIZE];
+	} mag[ALLOC_MAG_CLASSES];
+};
+
+/**
+ * alloc_mag_init - initialize a pool of memory for the allocator.
+ * @pool: the contiguous bytes for the allocator to use
+ * @poolsize: the size of the pool
+ *
+ * This is alloc_init() with a small header in front, which holds a lock
+ * and the central free list of each size class.  Like alloc_init(), all
+ * state is kept within @pool, as offsets, so it can be shared between
+ * processes which map it at different addresses.
+ *
+ * The pool must be at least 4096 bytes, and should be a megabyte or
+ * more: every size class takes a 64k slab at a time.
+ *
+ * Example:
+ *	#include <sys/mman.h>
+ *	...
+ *	void *pool = mmap(NULL, 32*1024*1024, PROT_READ|PROT_WRITE,
+ *			  MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+ *	if (pool == MAP_FAILED)
+ *		err(1, "Failed to map 32MB");
+ *	alloc_mag_init(pool, 32*1024*1024);
+ */
+void alloc_mag_init(void *pool, unsigned long poolsize);
+
+/**
+ * alloc_mag_cache_init - set up a thread's cache for a pool.
+ * @cache: the cache (in private memory)
+ * @pool: the pool initialized by alloc_mag_init()
+ * @poolsize: the size of the pool
+ *
+ * Example:
+ *	struct alloc_mag_cache cache;
+ *
+ *	alloc_mag_cache_init(&cache, pool, 32*1024*1024);
+ */
+void alloc_mag_cache_init(struct alloc_mag_cache *cache,
+			  void *pool, unsigned long poolsize);
+
+/**
+ * alloc_mag_get - allocate some memory from the pool
+ * @cache: this thread's cache
+ * @size: the size of the desired allocation
+ *
+ * This is "malloc" within the pool.  Sizes up to ALLOC_MAG_MAX_SIZE are
+ * rounded up to a size class, and come from this thread's magazine:
+ * when that's empty, it takes half a magazine's worth from the pool at
+ * once, under the pool's lock.  Larger sizes take the lock and call
+ * alloc_get().
+ *
+ * The result is 16-byte aligned (relative to the start of the pool).
+ * Returns NULL if there is no room.
+ *
+ * Example:
+ *	double *d = alloc_mag_get(&cache, sizeof(*d));
+ *	if (!d)
+ *		err(1, "Failed to allocate a double");
+ */
+void *alloc_mag_get(struct alloc_mag_cache *cache, unsigned long size);
+
+/**
+ * alloc_mag_free - free some allocated memory from the pool
+ * @cache: this thread's cache
+ * @p: the pointer returned from alloc_mag_get() (or NULL).
+ *
+ * @p can have been allocated by any thread or process using the pool.
+ * Small objects go into this thread's magazine: when that's full, half
+ * of it goes back to the pool at once.
+ *
+ * Example:
+ *	alloc_mag_free(&cache, d);
+ */
+void alloc_mag_free(struct alloc_mag_cache *cache, void *p);
+
+/**
+ * alloc_mag_size - get the actual size allocated by alloc_mag_get
+ * @cache: this thread's cache
+ * @p: the non-NULL pointer returned from alloc_mag_get.
+ *
+ * The return value will always be at least the @size passed to
+ * alloc_mag_get(), and you may use all of it.
+ */
+unsigned long alloc_mag_size(struct alloc_mag_cache *cache, void *p);
+
+/**
+ * alloc_mag_cache_flush - give back every object a cache holds
+ * @cache: this thread's cache
+ *
+ * Call this before a thread exits, so other threads can use them.
+ */
+void alloc_mag_cache_flush(struct alloc_mag_cache *cache);
+
+/**
+ * alloc_mag_check - check the integrity of the allocation pool
+ * @pool: the pool initialized by alloc_mag_init()
+ * @poolsize: the size of the pool
+ *
+ * This checks the underlying pool with alloc_check(), and each size
+ * class's free list.  No thread may be allocating meanwhile.
+ */
+bool alloc_mag_check(void *pool, unsigned long poolsize);
+
+/**
+ * alloc_mag_visualize - dump information about the allocation pool
+ * @out: the FILE to dump to
+ * @pool: the pool initialized by alloc_mag_init()
+ * @poolsize: the size of the pool
+ *
+ * For each size class this prints how many slabs it holds, how many of
+ * their objects are on the central free list and how many are out in
+ * caches or in use, and the space lost to slab headers and the tail of
+ * each slab.  Then it calls alloc_visualize() on the underlying pool.  Objects held in caches count as used: call
+ * alloc_mag_cache_flush() first for exact figures.
+ */
+void alloc_mag_visualize(FILE *out, void *pool, unsigned long poolsize);
+#endif /* ALLOC_MAG_H */
@@ -0,0 +1,90 @@
+#include <ccan/antithread/alloc/mag/mag.h>
+#include <ccan/tap/tap.h>
+#include <ccan/antithread/alloc/mag/mag.c>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define POOL_SIZE (32*1024*1024)
+#define PROCS 4
+#define LIVE 1000
+#define ROUNDS 200000
+
+/* Each process keeps LIVE objects, each filled with its own byte. */
+static bool hammer(void *pool, unsigned int seed)
+{
+	struct alloc_mag_cache cache;
+	unsigned char *p[LIVE] = { NULL };
+	unsigned long len[LIVE];
+	unsigned int i, n;
+
+	alloc_mag_cache_init(&cache, pool, POOL_SIZE);
+	srandom(seed);
+	for (i = 0; i < ROUNDS; i++) {
+		n = random() % LIVE;
+		if (p[n]) {
+			if (p[n][0] != (unsigned char)n
+			    || p[n][len[n]-1] != (unsigned char)n)
+				return false;
+			alloc_mag_free(&cache, p[n]);
+		}
+		/* Mostly small, a few big ones. */
+		len[n] = random() % 16 ? random() % 512 + 1
+			: random() % 8192 + 1;
+		p[n] = alloc_mag_get(&cache, len[n]);
+		if (!p[n])
+			return false;
+		memset(p[n], n, len[n]);
+	}
+	for (n = 0; n < LIVE; n++)
+		alloc_mag_free(&cache, p[n]);
+	alloc_mag_cache_flush(&cache);
+	return true;
+}
+
+int main(void)
+{
+	void *pool;
+	unsigned int i, bad = 0;
+	int status;
+
+	plan_tests(4);
+
+	pool = mmap(NULL, POOL_SIZE, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (pool == MAP_FAILED)
+		err(1, "mmap");
+	alloc_mag_init(pool, POOL_SIZE);
+
+	for (i = 0; i < PROCS; i++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			_exit(hammer(pool, i) ? 0 : 1);
+		}
+	}
+	for (i = 0; i < PROCS; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status)
+		    || WEXITSTATUS(status) != 0)
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+
+	/* Everything came back. */
+	for (i = 0; i < ALLOC_MAG_CLASSES; i++) {
+		struct mag_header *head = pool;
+		if (head->cs[i].num_free != head->cs[i].slabs * objs_per_slab(i))
+			break;
+	}
+	ok1(i == ALLOC_MAG_CLASSES);
+
+	/* And the parent can use the pool too. */
+	ok1(hammer(pool, PROCS));
+
+	munmap(pool, POOL_SIZE);
+	return exit_status();
+}
@@ -0,0 +1,186 @@
+#include <ccan/antithread/alloc/mag/mag.h>
+#include <ccan/tap/tap.h>
+#include <ccan/antithread/alloc/mag/mag.c>
+#include <stdlib.h>
+#include <err.h>
+
+#define POOL_SIZE (16*1024*1024)
+#define NUM 10000
+
+static void *p[NUM];
+
+/* The smallest class which fits, the slow way. */
+static bool classes_ok(void)
+{
+	unsigned long size;
+	unsigned int c;
+
+	for (size = 0; size <= ALLOC_MAG_MAX_SIZE; size++) {
+		c = size_to_class(size);
+		if (c >= ALLOC_MAG_CLASSES || class_sizes[c] < size)
+			return false;
+		if (c > 0 && class_sizes[c-1] >= size)
+			return false;
+	}
+	for (c = 1; c < ALLOC_MAG_CLASSES; c++)
+		if (class_sizes[c] % 16 || class_sizes[c] <= class_sizes[c-1])
+			return false;
+	return class_sizes[ALLOC_MAG_CLASSES-1] == ALLOC_MAG_MAX_SIZE;
+}
+
+static bool all_fit(struct alloc_mag_cache *cache, unsigned long size)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM; i++) {
+		if (!p[i] || (unsigned long)p[i] % 16)
+			return false;
+		if (alloc_mag_size(cache, p[i]) < size)
+			return false;
+		memset(p[i], i, size);
+	}
+	for (i = 0; i < NUM; i++) {
+		unsigned char *c = p[i];
+		if (size && (c[0] != (unsigned char)i
+			     || c[size-1] != (unsigned char)i))
+			return false;
+	}
+	return true;
+}
+
+static int addr_cmp(const void *a, const void *b)
+{
+	const char *pa = *(void **)a, *pb = *(void **)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+static bool unique(unsigned int num)
+{
+	unsigned int i;
+
+	qsort(p, num, sizeof(p[0]), addr_cmp);
+	for (i = 1; i < num; i++)
+		if (p[i] == p[i-1])
+			return false;
+	return true;
+}
+
+int main(void)
+{
+	struct alloc_mag_cache cache, other;
+	struct mag_header *head;
+	void *pool, *big, *tiny[16];
+	unsigned int i, c;
+	FILE *out;
+
+	plan_tests(33);
+
+	ok1(classes_ok());
+
+	pool = malloc(POOL_SIZE);
+	head = pool;
+	alloc_mag_init(pool, POOL_SIZE);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+	alloc_mag_cache_init(&cache, pool, POOL_SIZE);
+	alloc_mag_cache_init(&other, pool, POOL_SIZE);
+
+	/* Small objects, all from one class. */
+	for (i = 0; i < NUM; i++)
+		p[i] = alloc_mag_get(&cache, 40);
+	ok1(all_fit(&cache, 40));
+	ok1(alloc_mag_size(&cache, p[0]) == 48);
+	c = size_to_class(40);
+	ok1(head->cs[c].slabs == (NUM + objs_per_slab(c) - 1)
+	    / objs_per_slab(c));
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+	ok1(unique(NUM));
+
+	/* Frees go to the magazine, and half of it goes back when full. */
+	for (i = 0; i < NUM; i++)
+		alloc_mag_free(&cache, p[i]);
+	ok1(cache.mag[c].num <= ALLOC_MAG_SIZE);
+	ok1(cache.mag[c].num > 0);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+
+	/* Reusing them doesn't need any more slabs. */
+	for (i = 0; i < NUM; i++)
+		p[i] = alloc_mag_get(&cache, 48);
+	ok1(all_fit(&cache, 48));
+	ok1(head->cs[c].slabs == (NUM + objs_per_slab(c) - 1)
+	    / objs_per_slab(c));
+	ok1(unique(NUM));
+
+	/* Another cache can free them, and they're still good. */
+	for (i = 0; i < NUM; i++)
+		alloc_mag_free(&other, p[i]);
+	alloc_mag_cache_flush(&other);
+	alloc_mag_cache_flush(&cache);
+	ok1(other.mag[c].num == 0 && cache.mag[c].num == 0);
+	ok1(head->cs[c].num_free == head->cs[c].slabs * objs_per_slab(c));
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+
+	/* Every size up to the maximum. */
+	for (i = 0; i < NUM; i++)
+		p[i] = alloc_mag_get(&cache, i % (ALLOC_MAG_MAX_SIZE + 1));
+	for (i = 0; i < NUM; i++)
+		if (!p[i] || alloc_mag_size(&cache, p[i])
+		    < i % (ALLOC_MAG_MAX_SIZE + 1))
+			break;
+	ok1(i == NUM);
+	ok1(unique(NUM));
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+	for (i = 0; i < NUM; i++)
+		alloc_mag_free(&cache, p[i]);
+	alloc_mag_cache_flush(&cache);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+
+	/* Big ones go to alloc_get(). */
+	big = alloc_mag_get(&cache, 100000);
+	ok1(big);
+	ok1(!is_slab(head, chunk_of(pool, big)));
+	ok1(alloc_mag_size(&cache, big) >= 100000);
+	memset(big, 0xFF, 100000);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+	alloc_mag_free(&cache, big);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+	alloc_mag_free(&cache, NULL);
+
+	/* Filling the pool fails cleanly. */
+	for (i = 0; i < NUM; i++) {
+		p[i] = alloc_mag_get(&cache, ALLOC_MAG_MAX_SIZE);
+		if (!p[i])
+			break;
+	}
+	diag("%u 2k objects fit", i);
+	ok1(i < NUM && i > 1000);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+	while (i > 0)
+		alloc_mag_free(&cache, p[--i]);
+	alloc_mag_cache_flush(&cache);
+	ok1(alloc_mag_check(pool, POOL_SIZE));
+
+	out = fopen("/dev/null", "w");
+	alloc_mag_visualize(out, pool, POOL_SIZE);
+	fclose(out);
+
+	/* A pool too small for even one slab. */
+	alloc_mag_init(pool, 32768);
+	alloc_mag_cache_init(&cache, pool, 32768);
+	ok1(alloc_mag_check(pool, 32768));
+	ok1(!alloc_mag_get(&cache, 16));
+
+	/* Big allocations still work from a tiny pool. */
+	alloc_mag_init(pool, 4096);
+	alloc_mag_cache_init(&cache, pool, 4096);
+	for (i = 0; i < 16; i++)
+		tiny[i] = alloc_mag_get(&cache, 2049 + i);
+	ok1(tiny[0]);
+	ok1(alloc_mag_check(pool, 4096));
+	for (i = 0; i < 16; i++)
+		alloc_mag_free(&cache, tiny[i]);
+	ok1(alloc_mag_check(pool, 4096));
+
+	free(pool);
+	return exit_status();
+}
@@ -0,0 +1,162 @@
+/*
+ * Multi-process speed test: antithread/alloc/mag against plain
+ * antithread/alloc behind a spinlock in the shared pool.
+ *
+ * Each process keeps a working set of small objects (mostly under 256
+ * bytes, some up to 2k), and replaces a random one each time round.
+ *
+ * Usage: speed [ops-per-process] [max-processes] [--report]
+ *
+ * --report dumps alloc_mag_visualize() after a last run, with half of
+ * each process's objects left allocated.
+ */
+#include <ccan/antithread/alloc/mag/mag.h>
+#include <ccan/antithread/alloc/alloc.h>
+#include <ccan/time/time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define POOL_SIZE (256*1024*1024UL)
+#define LIVE 1024
+
+enum kind { MAGAZINES, LOCKED_ALLOC };
+
+/* For LOCKED_ALLOC: a lock at the start, the pool after it. */
+#define LOCKED_HEADER 64
+
+static unsigned long num;
+static void *pool;
+
+static unsigned long next_size(unsigned long long *r)
+{
+	*r = *r * 6364136223846793005ULL + 1442695040888963407ULL;
+	if ((*r >> 61) == 0)
+		return (*r >> 33) % 2048 + 1;
+	return (*r >> 33) % 256 + 1;
+}
+
+static void spin_lock(_Atomic(unsigned int) *lock)
+{
+	unsigned int spins = 0;
+
+	while (atomic_exchange_explicit(lock, 1, memory_order_acquire))
+		if (++spins % 128 == 0)
+			sched_yield();
+}
+
+static void spin_unlock(_Atomic(unsigned int) *lock)
+{
+	atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+static void run(enum kind kind, unsigned int seed)
+{
+	struct alloc_mag_cache cache;
+	_Atomic(unsigned int) *lock = pool;
+	void *sub = (char *)pool + LOCKED_HEADER;
+	unsigned long subsize = POOL_SIZE - LOCKED_HEADER;
+	void *p[LIVE] = { NULL };
+	unsigned long long r = seed;
+	unsigned long i;
+
+	alloc_mag_cache_init(&cache, pool, POOL_SIZE);
+	for (i = 0; i < num; i++) {
+		unsigned int n = i % LIVE;
+		unsigned long size = next_size(&r);
+
+		if (kind == MAGAZINES) {
+			alloc_mag_free(&cache, p[n]);
+			p[n] = alloc_mag_get(&cache, size);
+		} else {
+			spin_lock(lock);
+			if (p[n])
+				alloc_free(sub, subsize, p[n]);
+			p[n] = alloc_get(sub, subsize, size, 16);
+			spin_unlock(lock);
+		}
+		if (!p[n])
+			errx(1, "Out of memory");
+		*(char *)p[n] = n;
+	}
+
+	/* Leave behind half, so the report has something to show. */
+	if (kind == MAGAZINES) {
+		for (i = 0; i < LIVE; i += 2)
+			alloc_mag_free(&cache, p[i]);
+		alloc_mag_cache_flush(&cache);
+	}
+}
+
+static double bench(enum kind kind, unsigned int procs)
+{
+	struct timeabs start;
+	unsigned int i;
+	int status;
+
+	if (kind == MAGAZINES)
+		alloc_mag_init(pool, POOL_SIZE);
+	else {
+		atomic_init((_Atomic(unsigned int) *)pool, 0);
+		alloc_init((char *)pool + LOCKED_HEADER,
+			   POOL_SIZE - LOCKED_HEADER);
+	}
+
+	start = time_now();
+	for (i = 0; i < procs; i++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			run(kind, i);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < procs; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status)
+		    || WEXITSTATUS(status) != 0)
+			errx(1, "Child failed");
+	}
+	return (double)num * procs
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int procs, max_procs = 4;
+	bool report = false;
+
+	num = 10000000;
+	if (argc > 1)
+		num = atol(argv[1]);
+	if (argc > 2)
+		max_procs = atoi(argv[2]);
+	if (argc > 3 && strcmp(argv[3], "--report") == 0)
+		report = true;
+
+	pool = mmap(NULL, POOL_SIZE, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (pool == MAP_FAILED)
+		err(1, "mmap");
+
+	printf("%lu alloc+free per process (Mops/sec):\n", num);
+	printf("procs\tmagazines\tlocked alloc\n");
+	for (procs = 1; procs <= max_procs; procs *= 2) {
+		double mag = bench(MAGAZINES, procs);
+		double locked = bench(LOCKED_ALLOC, procs);
+
+		printf("%u\t%.1f\t\t%.1f\n", procs, mag, locked);
+	}
+
+	if (report) {
+		bench(MAGAZINES, max_procs);
+		alloc_mag_visualize(stdout, pool, POOL_SIZE);
+	}
+	return 0;
+}
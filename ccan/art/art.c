@@ -0,0 +1,240 @@
+/* CC0 license (public domain) - see LICENSE file for details */
+#include <ccan/art/art.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum children of each node type. */
+static const unsigned int max_children[] = { 4, 16, 48, 256 };
+
+/* Hysteresis: shrink well below the smaller node's capacity. */
+static const unsigned int shrink_at[] = { 0, 3, 12, 37 };
+
+static void *child_array(struct art_node *n)
+{
+	switch (n->type) {
+	case ART_NODE4:
+		return ((struct art_node4 *)n)->child;
+	case ART_NODE16:
+		return ((struct art_node16 *)n)->child;
+	case ART_NODE48:
+		return ((struct art_node48 *)n)->child;
+	default:
+		return ((struct art_node256 *)n)->child;
+	}
+}
+
+static void *child_at(struct art_node *n, unsigned int i, size_t csize)
+{
+	return (char *)child_array(n) + i * csize;
+}
+
+static struct art_node *new_node(enum art_type type, size_t depth,
+				 size_t csize)
+{
+	size_t size;
+	struct art_node *n;
+
+	switch (type) {
+	case ART_NODE4:
+		size = sizeof(struct art_node4) + 4 * csize;
+		break;
+	case ART_NODE16:
+		size = sizeof(struct art_node16) + 16 * csize;
+		break;
+	case ART_NODE48:
+		size = sizeof(struct art_node48) + 48 * csize;
+		break;
+	default:
+		size = sizeof(struct art_node256) + 256 * csize;
+		break;
+	}
+
+	/* Node48 and node256 rely on zeroed slots / children. */
+	if (type >= ART_NODE48)
+		n = calloc(1, size);
+	else
+		n = malloc(size);
+	if (!n)
+		return NULL;
+	n->nul_byte = '\0';
+	n->type = type;
+	n->num = 0;
+	n->depth = depth;
+	return n;
+}
+
+struct art_node *art_new(size_t depth, size_t csize)
+{
+	return new_node(ART_NODE4, depth, csize);
+}
+
+/* Children of a node4 or node16 are kept sorted. */
+static uint8_t *sorted_keys(struct art_node *n)
+{
+	if (n->type == ART_NODE4)
+		return ((struct art_node4 *)n)->keys;
+	return ((struct art_node16 *)n)->keys;
+}
+
+void *art_next_child(const struct art_node *n, int c, uint8_t *key,
+		     size_t csize)
+{
+	struct art_node *node = (struct art_node *)n;
+	int i;
+
+	switch (n->type) {
+	case ART_NODE4:
+	case ART_NODE16: {
+		const uint8_t *keys = sorted_keys(node);
+		for (i = 0; i < n->num; i++) {
+			if (keys[i] > c) {
+				*key = keys[i];
+				return child_at(node, i, csize);
+			}
+		}
+		return NULL;
+	}
+	case ART_NODE48: {
+		const struct art_node48 *n48 = (const struct art_node48 *)n;
+		for (i = c + 1; i < 256; i++) {
+			if (n48->slot[i]) {
+				*key = i;
+				return child_at(node, n48->slot[i] - 1, csize);
+			}
+		}
+		return NULL;
+	}
+	default:
+		for (i = c + 1; i < 256; i++) {
+			void **child = child_at(node, i, csize);
+			if (*child) {
+				*key = i;
+				return child;
+			}
+		}
+		return NULL;
+	}
+}
+
+/* Replace n by a node of another size with the same children. */
+static struct art_node *resize(struct art_node *n, enum art_type type,
+			       size_t csize)
+{
+	struct art_node *newn;
+	unsigned int i, j;
+	uint8_t key;
+	int c = -1;
+	void *child;
+
+	newn = new_node(type, n->depth, csize);
+	if (!newn)
+		return NULL;
+
+	/* Children of a node48 are packed at the front. */
+	for (j = 0; (child = art_next_child(n, c, &key, csize)) != NULL; j++) {
+		switch (type) {
+		case ART_NODE4:
+		case ART_NODE16:
+			sorted_keys(newn)[j] = key;
+			i = j;
+			break;
+		case ART_NODE48:
+			((struct art_node48 *)newn)->slot[key] = j + 1;
+			i = j;
+			break;
+		default:
+			i = key;
+			break;
+		}
+		memcpy(child_at(newn, i, csize), child, csize);
+		c = key;
+	}
+	newn->num = n->num;
+	free(n);
+	return newn;
+}
+
+bool art_add_child(struct art_node **np, uint8_t c, const void *child,
+		   size_t csize)
+{
+	struct art_node *n = *np;
+	unsigned int i;
+
+	assert(!art_find_child(n, c, csize));
+	if (n->num == max_children[n->type]) {
+		n = resize(n, n->type + 1, csize);
+		if (!n)
+			return false;
+		*np = n;
+	}
+
+	switch (n->type) {
+	case ART_NODE4:
+	case ART_NODE16: {
+		uint8_t *keys = sorted_keys(n);
+		for (i = 0; i < n->num; i++)
+			if (keys[i] > c)
+				break;
+		memmove(keys + i + 1, keys + i, n->num - i);
+		memmove(child_at(n, i + 1, csize), child_at(n, i, csize),
+			(n->num - i) * csize);
+		keys[i] = c;
+		break;
+	}
+	case ART_NODE48:
+		/* Children are kept packed, so the next one is free. */
+		i = n->num;
+		((struct art_node48 *)n)->slot[c] = i + 1;
+		break;
+	default:
+		i = c;
+		break;
+	}
+	memcpy(child_at(n, i, csize), child, csize);
+	n->num++;
+	return true;
+}
+
+void art_remove_child(struct art_node **np, uint8_t c, void *child,
+		      size_t csize)
+{
+	struct art_node *n = *np, *newn;
+	unsigned int i, last;
+
+	switch (n->type) {
+	case ART_NODE4:
+	case ART_NODE16: {
+		uint8_t *keys = sorted_keys(n);
+		i = ((char *)child - (char *)child_array(n)) / csize;
+		memmove(keys + i, keys + i + 1, n->num - i - 1);
+		memmove(child, child_at(n, i + 1, csize),
+			(n->num - i - 1) * csize);
+		break;
+	}
+	case ART_NODE48: {
+		struct art_node48 *n48 = (struct art_node48 *)n;
+		/* Keep children packed: move the last into the hole. */
+		last = n->num - 1;
+		n48->slot[c] = 0;
+		if (child != child_at(n, last, csize)) {
+			for (i = 0; n48->slot[i] != last + 1; i++);
+			n48->slot[i] = ((char *)child - (char *)n48->child)
+				/ csize + 1;
+			memcpy(child, child_at(n, last, csize), csize);
+		}
+		break;
+	}
+	default:
+		memset(child, 0, csize);
+		break;
+	}
+	n->num--;
+
+	if (n->num == shrink_at[n->type] && n->type != ART_NODE4) {
+		newn = resize(n, n->type - 1, csize);
+		/* If that fails, we simply stay larger. */
+		if (newn)
+			*np = newn;
+	}
+}
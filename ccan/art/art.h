@@ -0,0 +1,155 @@
+/* CC0 license (public domain) - see LICENSE file for details */
+#ifndef CCAN_ART_H
+#define CCAN_ART_H
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * enum art_type - the four sizes of node.
+ */
+enum art_type {
+	ART_NODE4,
+	ART_NODE16,
+	ART_NODE48,
+	ART_NODE256
+};
+
+/**
+ * struct art_node - common header of every node.
+ * @nul_byte: always '\0', so a node pointer reads as an empty string.
+ * @type: the enum art_type of this node.
+ * @num: how many children the node has.
+ * @depth: the byte this node branches on; the caller decides what that
+ *	means, and the art routines never look at it.
+ *
+ * Children are the caller's own fixed-size type, of csize bytes, which must
+ * start with a pointer: a zero pointer marks an unused child.
+ */
+struct art_node {
+	char nul_byte;
+	uint8_t type;
+	uint16_t num;
+	size_t depth;
+};
+
+/* Layouts, used to find the children: callers shouldn't need these. */
+struct art_node4 {
+	struct art_node n;
+	uint8_t keys[4];
+	void *child[];
+};
+
+struct art_node16 {
+	struct art_node n;
+	uint8_t keys[16];
+	void *child[];
+};
+
+/* slot[] is 1 + offset into child[], or 0 if there's no child. */
+struct art_node48 {
+	struct art_node n;
+	uint8_t slot[256];
+	void *child[];
+};
+
+struct art_node256 {
+	struct art_node n;
+	void *child[];
+};
+
+/**
+ * art_new - allocate an empty node4.
+ * @depth: the node's depth.
+ * @csize: the size of a child.
+ *
+ * Returns NULL on allocation failure.  Free it with free().
+ *
+ * Example:
+ *	struct art_node *root = art_new(0, sizeof(void *));
+ *	if (!root)
+ *		abort();
+ */
+struct art_node *art_new(size_t depth, size_t csize);
+
+/**
+ * art_find_child - find the child with a given key byte.
+ * @n: the node.
+ * @c: the key byte.
+ * @csize: the size of a child.
+ *
+ * Returns a pointer to the child, or NULL if there is none.
+ */
+static inline void *art_find_child(const struct art_node *n, uint8_t c,
+				   size_t csize)
+{
+	unsigned int i;
+
+	switch (n->type) {
+	case ART_NODE4: {
+		const struct art_node4 *n4 = (const struct art_node4 *)n;
+		for (i = 0; i < n->num; i++)
+			if (n4->keys[i] == c)
+				return (char *)n4->child + i * csize;
+		return NULL;
+	}
+	case ART_NODE16: {
+		const struct art_node16 *n16 = (const struct art_node16 *)n;
+		for (i = 0; i < n->num; i++)
+			if (n16->keys[i] == c)
+				return (char *)n16->child + i * csize;
+		return NULL;
+	}
+	case ART_NODE48: {
+		const struct art_node48 *n48 = (const struct art_node48 *)n;
+		if (!n48->slot[c])
+			return NULL;
+		return (char *)n48->child + (n48->slot[c] - 1) * csize;
+	}
+	default: {
+		const struct art_node256 *n256 = (const struct art_node256 *)n;
+		void **child = (void **)((char *)n256->child + c * csize);
+		return *child ? child : NULL;
+	}
+	}
+}
+
+/**
+ * art_next_child - find the next child in key order.
+ * @n: the node.
+ * @c: the key byte to look after, or -1 for the first child.
+ * @key: set to the key byte of the child found.
+ * @csize: the size of a child.
+ *
+ * Returns a pointer to the first child with key byte greater than @c, or
+ * NULL if there is none.
+ */
+void *art_next_child(const struct art_node *n, int c, uint8_t *key,
+		     size_t csize);
+
+/**
+ * art_add_child - add a child to a node, growing the node if required.
+ * @np: pointer to the node, which is updated if it grows.
+ * @c: the new child's key byte, which must not already be present.
+ * @child: the new child (csize bytes are copied).
+ * @csize: the size of a child.
+ *
+ * Returns false (and leaves the node alone) on allocation failure.
+ */
+bool art_add_child(struct art_node **np, uint8_t c, const void *child,
+		   size_t csize);
+
+/**
+ * art_remove_child - remove a child from a node, shrinking it if worthwhile.
+ * @np: pointer to the node, which is updated if it shrinks.
+ * @c: the child's key byte.
+ * @child: the child, as returned by art_find_child().
+ * @csize: the size of a child.
+ *
+ * A node4 is never freed, even when empty: callers decide whether a node
+ * with one or no children left can be removed.
+ */
+void art_remove_child(struct art_node **np, uint8_t c, void *child,
+		      size_t csize);
+#endif /* CCAN_ART_H */
@@ -0,0 +1,97 @@
+#include <ccan/art/art.h>
+#include <ccan/art/art.c>
+#include <ccan/tap/tap.h>
+
+/* A child bigger than a pointer, as ccan/strmap uses. */
+struct pair {
+	const char *s;
+	uintptr_t v;
+};
+
+static char bytes[256];
+
+/* Are exactly the children in want[] present, in order? */
+static bool check(const struct art_node *n, const bool want[256])
+{
+	unsigned int num = 0;
+	int c = -1, i;
+	uint8_t key;
+	struct pair *p;
+
+	while ((p = art_next_child(n, c, &key, sizeof(*p))) != NULL) {
+		if (key <= c || !want[key])
+			return false;
+		if (p->s != &bytes[key] || p->v != key + 1U)
+			return false;
+		if (art_find_child(n, key, sizeof(*p)) != p)
+			return false;
+		c = key;
+		num++;
+	}
+	for (i = 0; i < 256; i++)
+		if (!want[i] && art_find_child(n, i, sizeof(*p)))
+			return false;
+	return num == n->num;
+}
+
+int main(void)
+{
+	struct art_node *n;
+	bool want[256] = { false };
+	bool ok = true;
+	unsigned int i, c, max_type = 0;
+	struct pair p;
+
+	/* This is how many tests you plan to run */
+	plan_tests(8);
+
+	n = art_new(7, sizeof(p));
+	ok1(n && n->type == ART_NODE4 && n->num == 0 && n->depth == 7);
+	ok1(n->nul_byte == '\0');
+
+	/* Add every byte, in a scrambled order. */
+	for (i = 0; i < 256; i++) {
+		c = (i * 37 + 11) % 256;
+		p.s = &bytes[c];
+		p.v = c + 1;
+		ok &= art_add_child(&n, c, &p, sizeof(p));
+		want[c] = true;
+		if (n->type > max_type)
+			max_type = n->type;
+		if (i == 3 || i == 15 || i == 47 || i == 255)
+			ok &= check(n, want);
+	}
+	ok1(ok);
+	ok1(max_type == ART_NODE256 && n->num == 256);
+	ok1(n->depth == 7);
+
+	/* Now remove them again, in another order. */
+	for (i = 0; i < 256; i++) {
+		c = (i * 101 + 3) % 256;
+		art_remove_child(&n, c, art_find_child(n, c, sizeof(p)),
+				 sizeof(p));
+		want[c] = false;
+		if (i % 7 == 0 || i > 240)
+			ok &= check(n, want);
+	}
+	ok1(ok);
+	ok1(n->type == ART_NODE4 && n->num == 0);
+
+	/* Removing from the middle of a node48 keeps the rest. */
+	for (i = 0; i < 30; i++) {
+		p.s = &bytes[i * 5];
+		p.v = i * 5 + 1;
+		art_add_child(&n, i * 5, &p, sizeof(p));
+		want[i * 5] = true;
+	}
+	for (i = 0; i < 30; i += 3) {
+		art_remove_child(&n, i * 5, art_find_child(n, i * 5, sizeof(p)),
+				 sizeof(p));
+		want[i * 5] = false;
+	}
+	ok1(n->type == ART_NODE48 && check(n, want));
+	free(n);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,354 @@
+/* CC0 license (public domain) - see LICENSE file for details */
+/* This code is based on ccan/intmap.c. */
+#include <ccan/artmap/artmap.h>
+#include <ccan/art/art.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/ilog/ilog.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define KEY_BYTES sizeof(artmap_index_t)
+
+/* Leaves are tagged with the bottom bit in child pointers. */
+struct leaf {
+	artmap_index_t index;
+	void *v;
+};
+
+/* Children are void *: a node, or a tagged leaf. */
+#define CSIZE sizeof(void *)
+
+static inline bool is_leaf(const void *p)
+{
+	return (uintptr_t)p & 1;
+}
+
+static inline struct leaf *to_leaf(const void *p)
+{
+	return (struct leaf *)((uintptr_t)p - 1);
+}
+
+static inline void *tag_leaf(struct leaf *l)
+{
+	return (void *)((uintptr_t)l + 1);
+}
+
+static inline u8 key_byte(artmap_index_t index, unsigned int depth)
+{
+	return index >> ((KEY_BYTES - 1 - depth) * 8);
+}
+
+/* First byte (from the top) which is set in this non-zero value. */
+static unsigned int first_diff_byte(artmap_index_t diff)
+{
+	return KEY_BYTES - 1 - (ilog64(diff) - 1) / 8;
+}
+
+static void **find_child(const struct art_node *n, u8 c)
+{
+	return art_find_child(n, c, CSIZE);
+}
+
+/* First child with key greater than c (-1 for first), or NULL. */
+static void *next_child(const struct art_node *n, int c)
+{
+	u8 key;
+	void **child = art_next_child(n, c, &key, CSIZE);
+
+	return child ? *child : NULL;
+}
+
+/* Remove child c from *ref (which is n), shrinking it if worthwhile. */
+static void remove_child(void **ref, struct art_node *n, u8 c, void **child)
+{
+	art_remove_child(&n, c, child, CSIZE);
+	/* Only one child left?  It can replace us (it has its own bytes) */
+	if (n->num == 1) {
+		*ref = next_child(n, -1);
+		free(n);
+	} else
+		*ref = n;
+}
+
+static struct leaf *new_leaf(artmap_index_t index, const void *value)
+{
+	struct leaf *l = malloc(sizeof(*l));
+
+	if (l) {
+		l->index = index;
+		l->v = (void *)value;
+	}
+	return l;
+}
+
+/* Replace *ref with a node4 holding it and a new leaf. */
+static bool split(void **ref, unsigned int depth, artmap_index_t existing,
+		  artmap_index_t index, const void *value)
+{
+	struct art_node *n;
+	struct leaf *l;
+	void *leaf;
+
+	l = new_leaf(index, value);
+	if (!l)
+		goto nomem;
+	n = art_new(depth, CSIZE);
+	if (!n) {
+		free(l);
+		goto nomem;
+	}
+	/* A node4 has room for both, so these can't fail. */
+	leaf = tag_leaf(l);
+	art_add_child(&n, key_byte(existing, depth), ref, CSIZE);
+	art_add_child(&n, key_byte(index, depth), &leaf, CSIZE);
+	*ref = n;
+	return true;
+
+nomem:
+	errno = ENOMEM;
+	return false;
+}
+
+/* Lowest leaf under this (non-NULL) pointer. */
+static const struct leaf *min_leaf(const void *p)
+{
+	while (!is_leaf(p))
+		p = next_child(p, -1);
+	return to_leaf(p);
+}
+
+/* Closest leaf to index under this (non-NULL) pointer: it shares at least
+ * as many leading bytes with index as any other. */
+static const struct leaf *closest(const void *p, artmap_index_t index)
+{
+	while (!is_leaf(p)) {
+		const struct art_node *n = p;
+		void **child = find_child(n, key_byte(index, n->depth));
+		/* If we can't follow, any leaf below here is as close. */
+		if (!child)
+			return min_leaf(n);
+		p = *child;
+	}
+	return to_leaf(p);
+}
+
+void *artmap_get_(const struct artmap *map, artmap_index_t index)
+{
+	void *p = map->root;
+
+	/* We don't check prefixes on the way down: the leaf has the
+	 * whole index, so we simply check that at the end. */
+	while (p && !is_leaf(p)) {
+		const struct art_node *n = p;
+		void **child = find_child(n, key_byte(index, n->depth));
+		if (!child)
+			goto fail;
+		p = *child;
+	}
+
+	if (p && to_leaf(p)->index == index)
+		return to_leaf(p)->v;
+fail:
+	errno = ENOENT;
+	return NULL;
+}
+
+bool artmap_add_(struct artmap *map, artmap_index_t index, const void *value)
+{
+	void **ref = &map->root;
+	artmap_index_t existing;
+	unsigned int depth;
+	struct leaf *l;
+	void *leaf;
+
+	assert(value);
+
+	/* Empty map? */
+	if (!map->root) {
+		l = new_leaf(index, value);
+		if (!l)
+			goto nomem;
+		map->root = tag_leaf(l);
+		return true;
+	}
+
+	/* Find closest existing index, and where we differ. */
+	existing = closest(map->root, index)->index;
+	if (existing == index) {
+		errno = EEXIST;
+		return false;
+	}
+	depth = first_diff_byte(existing ^ index);
+
+	/* Find where to insert: first node which doesn't branch above that.
+	 * Everything down here shares existing's bytes above depth. */
+	while (!is_leaf(*ref) && ((struct art_node *)*ref)->depth < depth) {
+		struct art_node *n = *ref;
+		ref = find_child(n, key_byte(index, n->depth));
+	}
+
+	if (is_leaf(*ref) || ((struct art_node *)*ref)->depth != depth)
+		return split(ref, depth, existing, index, value);
+
+	l = new_leaf(index, value);
+	if (!l)
+		goto nomem;
+	leaf = tag_leaf(l);
+	if (!art_add_child((struct art_node **)ref, key_byte(index, depth),
+			   &leaf, CSIZE)) {
+		free(l);
+		goto nomem;
+	}
+	return true;
+
+nomem:
+	errno = ENOMEM;
+	return false;
+}
+
+void *artmap_del_(struct artmap *map, artmap_index_t index)
+{
+	void **ref = &map->root, **parent_ref = NULL;
+	struct art_node *parent = NULL;
+	struct leaf *l;
+	void *value;
+
+	while (*ref && !is_leaf(*ref)) {
+		struct art_node *n = *ref;
+		void **child;
+
+		child = find_child(n, key_byte(index, n->depth));
+		if (!child)
+			goto fail;
+		parent_ref = ref;
+		parent = n;
+		ref = child;
+	}
+
+	/* Did we find it? */
+	if (!*ref || to_leaf(*ref)->index != index)
+		goto fail;
+
+	l = to_leaf(*ref);
+	value = l->v;
+	free(l);
+
+	if (!parent) {
+		/* We deleted last node. */
+		artmap_init_(map);
+	} else
+		remove_child(parent_ref, parent,
+			     key_byte(index, parent->depth), ref);
+	errno = 0;
+	return value;
+
+fail:
+	errno = ENOENT;
+	return NULL;
+}
+
+/* Lowest leaf > index under this (non-NULL) pointer, or NULL.  Everything
+ * in the map shares index's bytes above diff (the first byte where index
+ * differs from the closest leaf, or KEY_BYTES if it's equal); greater says
+ * whether the closest leaf is greater than index. */
+static const struct leaf *after(const void *p, artmap_index_t index,
+				unsigned int diff, bool greater)
+{
+	const struct art_node *n;
+	const struct leaf *l;
+	void **child;
+	u8 c;
+
+	if (is_leaf(p)) {
+		l = to_leaf(p);
+		return l->index > index ? l : NULL;
+	}
+
+	n = p;
+	/* If we branch below diff, we're either all greater or all less. */
+	if (n->depth > diff)
+		return greater ? min_leaf(n) : NULL;
+
+	c = key_byte(index, n->depth);
+	child = find_child(n, c);
+	if (child) {
+		l = after(*child, index, diff, greater);
+		if (l)
+			return l;
+	}
+
+	p = next_child(n, c);
+	if (!p)
+		return NULL;
+	return min_leaf(p);
+}
+
+void *artmap_first_(const struct artmap *map, artmap_index_t *indexp)
+{
+	const struct leaf *l;
+
+	if (artmap_empty_(map)) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	l = min_leaf(map->root);
+	errno = 0;
+	*indexp = l->index;
+	return l->v;
+}
+
+void *artmap_after_(const struct artmap *map, artmap_index_t *indexp)
+{
+	const struct leaf *l;
+	artmap_index_t existing;
+	unsigned int diff;
+
+	/* Special case of empty map */
+	if (artmap_empty_(map)) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	existing = closest(map->root, *indexp)->index;
+	if (existing == *indexp)
+		diff = KEY_BYTES;
+	else
+		diff = first_diff_byte(existing ^ *indexp);
+
+	l = after(map->root, *indexp, diff, existing > *indexp);
+	if (!l) {
+		errno = ENOENT;
+		return NULL;
+	}
+	errno = 0;
+	*indexp = l->index;
+	return l->v;
+}
+
+static void clear(void *p)
+{
+	void *child;
+	int c = -1;
+	u8 key;
+
+	if (is_leaf(p)) {
+		free(to_leaf(p));
+		return;
+	}
+
+	while ((child = art_next_child(p, c, &key, CSIZE)) != NULL) {
+		clear(*(void **)child);
+		c = key;
+	}
+	free(p);
+}
+
+void artmap_clear_(struct artmap *map)
+{
+	if (!artmap_empty_(map))
+		clear(map->root);
+	artmap_init_(map);
+}
@@ -0,0 +1,336 @@
+/* CC0 license (public domain) - see LICENSE file for details */
+#ifndef CCAN_ARTMAP_H
+#define CCAN_ARTMAP_H
+#include "config.h"
+#include <ccan/tcon/tcon.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Must be an unsigned type. */
+#ifndef artmap_index_t
+#define artmap_index_t uint64_t
+#define sartmap_index_t int64_t
+#endif
+
+/**
+ * struct artmap - representation of an adaptive radix tree integer map
+ *
+ * It's exposed here to allow you to embed it and so we can inline the
+ * trivial functions.  The root is either NULL, a leaf or an inner node
+ * (leaves are tagged in the bottom bit).
+ */
+struct artmap {
+	void *root;
+};
+
+/**
+ * UARTMAP - declare a type-specific artmap (for unsigned integers)
+ * @membertype: type for this map's values, or void * for any pointer.
+ *
+ * You use this to create your own typed artmap for a particular
+ * (non-NULL) pointer type.
+ *
+ * Example:
+ *	UARTMAP(int *) uint_artmap;
+ *	uartmap_init(&uint_artmap);
+ */
+#define UARTMAP(membertype)					\
+	TCON_WRAP(struct artmap, membertype uartmap_canary)
+
+/**
+ * SARTMAP - declare a type-specific artmap (for signed integers)
+ * @membertype: type for this map's values, or void * for any pointer.
+ *
+ * You use this to create your own typed artmap for a particular type.
+ * You can use an integer type as membertype, *but* remember you can't
+ * use "0" as a value!
+ *
+ * This is different from UARTMAP because we want it to sort into
+ * least (most negative) to largest order.
+ *
+ * Example:
+ *	SARTMAP(int *) sint_artmap;
+ *	sartmap_init(&sint_artmap);
+ */
+#define SARTMAP(membertype)					\
+	TCON_WRAP(struct artmap, membertype sartmap_canary)
+
+/**
+ * uartmap_init - initialize an unsigned integer map (empty)
+ * @umap: the typed artmap to initialize.
+ *
+ * For completeness; if you've arranged for it to be NULL already you don't
+ * need this.
+ *
+ * Example:
+ *	UARTMAP(int *) uint_artmap;
+ *
+ *	uartmap_init(&uint_artmap);
+ */
+#define uartmap_init(umap) artmap_init_(uartmap_unwrap_(umap))
+
+/**
+ * sartmap_init - initialize a signed integer map (empty)
+ * @smap: the typed artmap to initialize.
+ *
+ * For completeness; if you've arranged for it to be NULL already you don't
+ * need this.
+ *
+ * Example:
+ *	SARTMAP(int *) sint_artmap;
+ *
+ *	sartmap_init(&sint_artmap);
+ */
+#define sartmap_init(smap) artmap_init_(sartmap_unwrap_(smap))
+
+static inline void artmap_init_(struct artmap *map)
+{
+	map->root = NULL;
+}
+
+/**
+ * uartmap_empty - is this unsigned integer map empty?
+ * @umap: the typed artmap to check.
+ *
+ * Example:
+ *	if (!uartmap_empty(&uint_artmap))
+ *		abort();
+ */
+#define uartmap_empty(umap) artmap_empty_(uartmap_unwrap_(umap))
+
+/**
+ * sartmap_empty - is this signed integer map empty?
+ * @smap: the typed artmap to check.
+ *
+ * Example:
+ *	if (!sartmap_empty(&sint_artmap))
+ *		abort();
+ */
+#define sartmap_empty(smap) artmap_empty_(sartmap_unwrap_(smap))
+
+static inline bool artmap_empty_(const struct artmap *map)
+{
+	return map->root == NULL;
+}
+
+/**
+ * uartmap_get - get a value from an unsigned integer map
+ * @umap: the typed artmap to search.
+ * @index: the unsigned index to search for.
+ *
+ * Returns the value, or NULL if it isn't in the map (and sets errno = ENOENT).
+ *
+ * Example:
+ *	int *val = uartmap_get(&uint_artmap, 100);
+ *	if (val)
+ *		printf("100 => %i\n", *val);
+ */
+#define uartmap_get(umap, index)					\
+	tcon_cast((umap), uartmap_canary,				\
+		  artmap_get_(uartmap_unwrap_(umap), (index)))
+
+/**
+ * sartmap_get - get a value from a signed integer map
+ * @smap: the typed artmap to search.
+ * @index: the signed index to search for.
+ *
+ * Returns the value, or NULL if it isn't in the map (and sets errno = ENOENT).
+ *
+ * Example:
+ *	int *val2 = sartmap_get(&sint_artmap, -100);
+ *	if (val2)
+ *		printf("-100 => %i\n", *val2);
+ */
+#define sartmap_get(smap, index)					\
+	tcon_cast((smap), sartmap_canary,				\
+		  artmap_get_(sartmap_unwrap_(smap), SARTMAP_OFF(index)))
+
+void *artmap_get_(const struct artmap *map, artmap_index_t index);
+
+/**
+ * uartmap_add - place a member in an unsigned integer map.
+ * @umap: the typed artmap to add to.
+ * @index: the unsigned index to place in the map.
+ * @value: the (non-NULL) value.
+ *
+ * This returns false if we run out of memory (errno = ENOMEM), or
+ * (more normally) if that index already appears in the map (EEXIST).
+ *
+ * Note that the value is not copied, just the pointer.
+ *
+ * Example:
+ *	val = malloc(sizeof *val);
+ *	*val = 17;
+ *	if (!uartmap_add(&uint_artmap, 100, val))
+ *		printf("100 was already in the map\n");
+ */
+#define uartmap_add(umap, index, value)					\
+	artmap_add_(uartmap_unwrap_(tcon_check((umap), uartmap_canary,	\
+					       (value))),		\
+		    (index), (void *)(value))
+
+/**
+ * sartmap_add - place a member in a signed integer map.
+ * @smap: the typed artmap to add to.
+ * @index: the signed index to place in the map.
+ * @value: the (non-NULL) value.
+ *
+ * This returns false if we run out of memory (errno = ENOMEM), or
+ * (more normally) if that index already appears in the map (EEXIST).
+ *
+ * Note that the value is not copied, just the pointer.
+ *
+ * Example:
+ *	val = malloc(sizeof *val);
+ *	*val = 17;
+ *	if (!sartmap_add(&sint_artmap, -100, val))
+ *		printf("-100 was already in the map\n");
+ */
+#define sartmap_add(smap, index, value)					\
+	artmap_add_(sartmap_unwrap_(tcon_check((smap), sartmap_canary,	\
+					       (value))),		\
+		    SARTMAP_OFF(index), (void *)(value))
+
+bool artmap_add_(struct artmap *map, artmap_index_t member, const void *value);
+
+/**
+ * uartmap_del - remove a member from an unsigned integer map.
+ * @umap: the typed artmap to delete from.
+ * @index: the unsigned index to remove from the map.
+ *
+ * This returns the value, or NULL if there was no value at that
+ * index.
+ *
+ * Example:
+ *	if (uartmap_del(&uint_artmap, 100) == NULL)
+ *		printf("100 was not in the map?\n");
+ */
+#define uartmap_del(umap, index)					\
+	tcon_cast((umap), uartmap_canary,				\
+		  artmap_del_(uartmap_unwrap_(umap), (index)))
+
+/**
+ * sartmap_del - remove a member from a signed integer map.
+ * @smap: the typed artmap to delete from.
+ * @index: the signed index to remove from the map.
+ *
+ * This returns the value, or NULL if there was no value at that
+ * index.
+ *
+ * Example:
+ *	if (sartmap_del(&sint_artmap, -100) == NULL)
+ *		printf("-100 was not in the map?\n");
+ */
+#define sartmap_del(smap, index)					\
+	tcon_cast((smap), sartmap_canary,				\
+		  artmap_del_(sartmap_unwrap_(smap), SARTMAP_OFF(index)))
+
+void *artmap_del_(struct artmap *map, artmap_index_t index);
+
+/**
+ * uartmap_clear - remove every member from an unsigned integer map.
+ * @umap: the typed artmap to clear.
+ *
+ * The map will be empty after this.
+ *
+ * Example:
+ *	uartmap_clear(&uint_artmap);
+ */
+#define uartmap_clear(umap) artmap_clear_(uartmap_unwrap_(umap))
+
+/**
+ * sartmap_clear - remove every member from a signed integer map.
+ * @smap: the typed artmap to clear.
+ *
+ * The map will be empty after this.
+ *
+ * Example:
+ *	sartmap_clear(&sint_artmap);
+ */
+#define sartmap_clear(smap) artmap_clear_(sartmap_unwrap_(smap))
+
+void artmap_clear_(struct artmap *map);
+
+/**
+ * uartmap_first - get first value in an unsigned artmap
+ * @umap: the typed artmap to iterate through.
+ * @indexp: a pointer to store the index.
+ *
+ * Returns NULL if the map is empty, otherwise populates *@indexp and
+ * returns the lowest entry.
+ */
+#define uartmap_first(umap, indexp)					\
+	tcon_cast((umap), uartmap_canary,				\
+		  artmap_first_(uartmap_unwrap_(umap), (indexp)))
+
+void *artmap_first_(const struct artmap *map, artmap_index_t *indexp);
+
+/**
+ * sartmap_first - get first value in a signed artmap
+ * @smap: the typed artmap to iterate through.
+ * @indexp: a pointer to store the index.
+ *
+ * Returns NULL if the map is empty, otherwise populates *@indexp and
+ * returns the lowest entry.
+ */
+#define sartmap_first(smap, indexp)					\
+	tcon_cast((smap), sartmap_canary,				\
+		  sartmap_first_(sartmap_unwrap_(smap), (indexp)))
+
+/**
+ * uartmap_after - get the closest following index in an unsigned artmap
+ * @umap: the typed artmap to iterate through.
+ * @indexp: the preceeding index (may not exist)
+ *
+ * Returns NULL if the there is no entry > @indexp, otherwise
+ * populates *@indexp and returns the lowest entry > @indexp.
+ */
+#define uartmap_after(umap, indexp)					\
+	tcon_cast((umap), uartmap_canary,				\
+		  artmap_after_(uartmap_unwrap_(umap), (indexp)))
+
+void *artmap_after_(const struct artmap *map, artmap_index_t *indexp);
+
+/**
+ * sartmap_after - get the closest following index in a signed artmap
+ * @smap: the typed artmap to iterate through.
+ * @indexp: the preceeding index (may not exist)
+ *
+ * Returns NULL if the there is no entry > @indexp, otherwise
+ * populates *@indexp and returns the lowest entry > @indexp.
+ */
+#define sartmap_after(smap, indexp)					\
+	tcon_cast((smap), sartmap_canary,				\
+		  sartmap_after_(sartmap_unwrap_(smap), (indexp)))
+
+/* These make sure it really is a uartmap/sartmap */
+#define uartmap_unwrap_(u) (tcon_unwrap(u) + 0*tcon_sizeof((u), uartmap_canary))
+#define sartmap_unwrap_(s) (tcon_unwrap(s) + 0*tcon_sizeof((s), sartmap_canary))
+
+/* We have to offset indices if they're signed, so ordering works. */
+#define SARTMAP_OFFSET		((artmap_index_t)1 << (sizeof(artmap_index_t)*8-1))
+#define SARTMAP_OFF(index)	((artmap_index_t)(index) + SARTMAP_OFFSET)
+#define SARTMAP_UNOFF(index)	((artmap_index_t)(index) - SARTMAP_OFFSET)
+
+/* Due to multi-evaluation, these can't be macros */
+static inline void *sartmap_first_(const struct artmap *map,
+				   sartmap_index_t *indexp)
+{
+	artmap_index_t i;
+	void *ret = artmap_first_(map, &i);
+	*indexp = SARTMAP_UNOFF(i);
+	return ret;
+
+}
+
+static inline void *sartmap_after_(const struct artmap *map,
+				   sartmap_index_t *indexp)
+{
+	artmap_index_t i = SARTMAP_OFF(*indexp);
+	void *ret = artmap_after_(map, &i);
+	*indexp = SARTMAP_UNOFF(i);
+	return ret;
+}
+#endif /* CCAN_ARTMAP_H */
@@ -0,0 +1,92 @@
+#include <ccan/artmap/artmap.h>
+#include <ccan/artmap/artmap.c>
+#include <ccan/tap/tap.h>
+
+/* Enough to fill node256s at the bottom, and node48s above. */
+#define NUM 70000
+
+static bool check_all(const struct artmap *map, uint64_t *vals,
+		      const bool *present)
+{
+	uint64_t i, prev = 0;
+	uint64_t *v;
+	bool first = true;
+	size_t count = 0, expected = 0;
+
+	for (i = 0; i < NUM; i++) {
+		if (present[i]) {
+			expected++;
+			if (artmap_get_(map, vals[i]) != &vals[i])
+				return false;
+		} else if (artmap_get_(map, vals[i]))
+			return false;
+	}
+
+	for (v = artmap_first_(map, &i); v; v = artmap_after_(map, &i)) {
+		if (!first && i <= prev)
+			return false;
+		if (*v != i)
+			return false;
+		first = false;
+		prev = i;
+		count++;
+	}
+	return count == expected;
+}
+
+int main(void)
+{
+	struct artmap map;
+	uint64_t *vals = calloc(NUM, sizeof(*vals));
+	bool *present = calloc(NUM, sizeof(*present));
+	unsigned int i, j;
+
+	/* This is how many tests you plan to run */
+	plan_tests(9);
+
+	artmap_init_(&map);
+	for (i = 0; i < NUM; i++) {
+		/* Dense at the bottom, but with a sparse upper byte. */
+		vals[i] = ((uint64_t)(i % 7) << 40) | i;
+		if (!artmap_add_(&map, vals[i], &vals[i]))
+			break;
+		present[i] = true;
+	}
+	ok1(i == NUM);
+	ok1(check_all(&map, vals, present));
+	ok1(!artmap_add_(&map, vals[100], &vals[100]) && errno == EEXIST);
+
+	/* Delete most of them, in a scattered order, to force shrinking. */
+	for (i = 0, j = 0; i < NUM; i++) {
+		unsigned int k = (i * 7919) % NUM;
+		if (k % 50 == 0)
+			continue;
+		if (artmap_del_(&map, vals[k]) != &vals[k])
+			break;
+		present[k] = false;
+		j++;
+	}
+	ok1(i == NUM);
+	ok1(check_all(&map, vals, present));
+
+	/* Put them back. */
+	for (i = 0; i < NUM; i++) {
+		if (present[i])
+			continue;
+		if (!artmap_add_(&map, vals[i], &vals[i]))
+			break;
+		present[i] = true;
+	}
+	ok1(i == NUM);
+	ok1(check_all(&map, vals, present));
+
+	artmap_clear_(&map);
+	ok1(artmap_empty_(&map));
+	memset(present, 0, NUM * sizeof(*present));
+	ok1(check_all(&map, vals, present));
+
+	free(vals);
+	free(present);
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,55 @@
+#include <ccan/artmap/artmap.h>
+#include <ccan/artmap/artmap.c>
+#include <ccan/tap/tap.h>
+
+int main(void)
+{
+	UARTMAP(char *) map;
+	const char val[] = "there";
+	const char none[] = "";
+
+	/* This is how many tests you plan to run */
+	plan_tests(28);
+
+	uartmap_init(&map);
+
+	ok1(!uartmap_get(&map, 1));
+	ok1(errno == ENOENT);
+	ok1(!uartmap_get(&map, 0));
+	ok1(errno == ENOENT);
+	ok1(!uartmap_del(&map, 1));
+	ok1(errno == ENOENT);
+	ok1(!uartmap_del(&map, 0));
+	ok1(errno == ENOENT);
+
+	ok1(uartmap_add(&map, 1, val));
+	ok1(uartmap_get(&map, 1) == val);
+	ok1(!uartmap_get(&map, 0));
+	ok1(errno == ENOENT);
+
+	/* Add a duplicate should fail. */
+	ok1(!uartmap_add(&map, 1, val));
+	ok1(errno == EEXIST);
+
+	/* Delete should succeed. */
+	ok1(uartmap_del(&map, 1) == val);
+	ok1(!uartmap_get(&map, 1));
+	ok1(errno == ENOENT);
+	ok1(!uartmap_get(&map, 0));
+	ok1(errno == ENOENT);
+
+	/* Both at once... */
+	ok1(uartmap_add(&map, 0, none));
+	ok1(uartmap_add(&map, 1, val));
+	ok1(uartmap_get(&map, 1) == val);
+	ok1(uartmap_get(&map, 0) == none);
+	ok1(!uartmap_del(&map, 2));
+	ok1(uartmap_del(&map, 0) == none);
+	ok1(uartmap_get(&map, 1) == val);
+	ok1(uartmap_del(&map, 1) == val);
+
+	ok1(uartmap_empty(&map));
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,148 @@
+/* Simple speed tests for artmap, compared with intmap (and jmap). */
+#include <ccan/artmap/artmap.h>
+#include <ccan/intmap/intmap.h>
+#ifdef SPEED_JMAP
+#include <ccan/jmap/jmap.h>
+#endif
+#include <ccan/time/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			unsigned int num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#ifdef SPEED_JMAP
+struct jmap_u64 {
+	JMAP_MEMBERS(unsigned long, uint64_t *);
+};
+#endif
+
+#define TIME(name, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, num));	\
+	} while (0)
+
+static void speed_artmap(uint64_t *keys, size_t num)
+{
+	UARTMAP(uint64_t *) map;
+	uint64_t idx;
+	size_t i;
+
+	uartmap_init(&map);
+	TIME("artmap insert",
+	     for (i = 0; i < num; i++)
+		     uartmap_add(&map, keys[i], &keys[i]));
+	TIME("artmap lookup (match)",
+	     for (i = 0; i < num; i++)
+		     if (uartmap_get(&map, keys[i]) != &keys[i])
+			     abort());
+	TIME("artmap lookup (miss)",
+	     for (i = 0; i < num; i++)
+		     if (uartmap_get(&map, keys[i] + 1)
+			 && *uartmap_get(&map, keys[i] + 1) != keys[i] + 1)
+			     abort());
+	TIME("artmap iterate",
+	     for (i = 0, idx = 0; uartmap_after(&map, &idx); i++));
+	TIME("artmap delete",
+	     for (i = 0; i < num; i++)
+		     if (uartmap_del(&map, keys[i]) != &keys[i])
+			     abort());
+}
+
+static void speed_intmap(uint64_t *keys, size_t num)
+{
+	UINTMAP(uint64_t *) map;
+	uint64_t idx;
+	size_t i;
+
+	uintmap_init(&map);
+	TIME("intmap insert",
+	     for (i = 0; i < num; i++)
+		     uintmap_add(&map, keys[i], &keys[i]));
+	TIME("intmap lookup (match)",
+	     for (i = 0; i < num; i++)
+		     if (uintmap_get(&map, keys[i]) != &keys[i])
+			     abort());
+	TIME("intmap lookup (miss)",
+	     for (i = 0; i < num; i++)
+		     if (uintmap_get(&map, keys[i] + 1)
+			 && *uintmap_get(&map, keys[i] + 1) != keys[i] + 1)
+			     abort());
+	TIME("intmap iterate",
+	     for (i = 0, idx = 0; uintmap_after(&map, &idx); i++));
+	TIME("intmap delete",
+	     for (i = 0; i < num; i++)
+		     if (uintmap_del(&map, keys[i]) != &keys[i])
+			     abort());
+}
+
+#ifdef SPEED_JMAP
+static void speed_jmap(uint64_t *keys, size_t num)
+{
+	struct jmap_u64 *map = jmap_new(struct jmap_u64);
+	unsigned long idx;
+	size_t i;
+
+	TIME("jmap insert",
+	     for (i = 0; i < num; i++)
+		     jmap_add(map, keys[i], &keys[i]));
+	TIME("jmap lookup (match)",
+	     for (i = 0; i < num; i++)
+		     if (jmap_get(map, keys[i]) != &keys[i])
+			     abort());
+	TIME("jmap lookup (miss)",
+	     for (i = 0; i < num; i++)
+		     if (jmap_get(map, keys[i] + 1)
+			 && *jmap_get(map, keys[i] + 1) != keys[i] + 1)
+			     abort());
+	TIME("jmap iterate",
+	     for (i = 0, idx = jmap_first(map); idx; idx = jmap_next(map, idx), i++));
+	TIME("jmap delete",
+	     for (i = 0; i < num; i++)
+		     if (!jmap_del(map, keys[i]))
+			     abort());
+	jmap_free(map);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	uint64_t *keys;
+	size_t i, num;
+
+	num = argv[1] ? atoi(argv[1]) : 1000000;
+	keys = calloc(num, sizeof(keys[0]));
+
+	/* Even keys, so key + 1 always misses. */
+	printf("Sequential keys:\n");
+	for (i = 0; i < num; i++)
+		keys[i] = (i + 1) * 2;
+	speed_artmap(keys, num);
+	speed_intmap(keys, num);
+#ifdef SPEED_JMAP
+	speed_jmap(keys, num);
+#endif
+
+	printf("Random keys:\n");
+	for (i = 0; i < num; i++)
+		keys[i] = (((uint64_t)random() << 32) ^ random()) & ~1ULL;
+	speed_artmap(keys, num);
+	speed_intmap(keys, num);
+#ifdef SPEED_JMAP
+	speed_jmap(keys, num);
+#endif
+
+	free(keys);
+	return 0;
+}
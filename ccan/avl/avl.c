@@ -446,3 +446,314 @@ void avl_iter_next(AvlIter *iter)
 	iter->key   = (void*) node->key;
 	iter->value = (void*) node->value;
 }
+
+
+/************************* Intrusive trees *************************/
+
+/*
+ * The balance (-1, 0 or 1) is kept in the low bits of the parent pointer,
+ * plus one.  A link whose balance would become -2 or +2 is rotated
+ * straight away, so that never needs storing.
+ */
+static AvlLink *getParent(const AvlLink *link)
+{
+	return (AvlLink*) (link->parent_balance & ~(uintptr_t) 3);
+}
+
+static int getBalance(const AvlLink *link)
+{
+	return (int) (link->parent_balance & 3) - 1;
+}
+
+static void setParent(AvlLink *link, AvlLink *parent)
+{
+	link->parent_balance = (uintptr_t) parent | (link->parent_balance & 3);
+}
+
+static void setBalance(AvlLink *link, int balance)
+{
+	link->parent_balance = (link->parent_balance & ~(uintptr_t) 3) | (balance + 1);
+}
+
+static size_t linkSize(const AvlLink *link)
+{
+	return link ? link->size : 0;
+}
+
+/* Point whatever pointed at old (its parent, or the root) at new. */
+static void replaceChild(AvlTree *tree, AvlLink *parent, AvlLink *old, AvlLink *new)
+{
+	if (parent == NULL)
+		tree->root = new;
+	else
+		parent->lr[parent->lr[1] == old] = new;
+}
+
+/*
+ * Rotate the child on the given side of a link up into its place.
+ * Balances are left to the caller.
+ */
+static void rotate(AvlTree *tree, AvlLink *link, int side)
+{
+	AvlLink *child  = link->lr[side],
+	        *parent = getParent(link),
+	        *inner  = child->lr[1 - side];
+	
+	link->lr[side] = inner;
+	if (inner != NULL)
+		setParent(inner, link);
+	
+	child->lr[1 - side] = link;
+	setParent(link, child);
+	setParent(child, parent);
+	replaceChild(tree, parent, link, child);
+	
+	child->size = link->size;
+	link->size  = 1 + linkSize(link->lr[0]) + linkSize(link->lr[1]);
+}
+
+/*
+ * Rebalance a link whose balance would be -2 (side == 0) or +2 (side == 1),
+ * the same way balance() does.
+ *
+ * Return the link which replaces it at the top of the subtree.
+ */
+static AvlLink *rebalanceLink(AvlTree *tree, AvlLink *link, int side)
+{
+	AvlLink *child = link->lr[side];
+	int      bal   = bal(side);
+	int      cbal  = getBalance(child);
+	
+	if (cbal != -bal) {
+		/* Left-left (side == 0) or right-right (side == 1) */
+		rotate(tree, link, side);
+		setBalance(child, cbal - bal);
+		setBalance(link, bal - cbal);
+		return child;
+	} else {
+		/* Left-right (side == 0) or right-left (side == 1) */
+		AvlLink *grandchild = child->lr[1 - side];
+		int      gbal       = getBalance(grandchild);
+		
+		rotate(tree, child, 1 - side);
+		rotate(tree, link, side);
+		setBalance(link,  gbal == bal  ? -bal : 0);
+		setBalance(child, gbal == -bal ?  bal : 0);
+		setBalance(grandchild, 0);
+		return grandchild;
+	}
+}
+
+void avl_tree_link(AvlTree *tree, AvlLink *link, AvlLink *parent, int side)
+{
+	AvlLink *child;
+	
+	link->lr[0] = NULL;
+	link->lr[1] = NULL;
+	link->parent_balance = (uintptr_t) parent | 1;
+	link->size = 1;
+	
+	if (parent == NULL) {
+		assert(tree->root == NULL);
+		tree->root = link;
+		return;
+	}
+	assert(parent->lr[side] == NULL);
+	parent->lr[side] = link;
+	
+	/* Counts first, so rotations can recalculate them from the children. */
+	for (child = parent; child != NULL; child = getParent(child))
+		child->size++;
+	
+	/* Walk up while the subtree on our side has grown. */
+	for (child = link; parent != NULL; child = parent, parent = getParent(parent)) {
+		int balance;
+		
+		side    = parent->lr[1] == child;
+		balance = getBalance(parent);
+		
+		if (balance == -bal(side)) {
+			setBalance(parent, 0);
+			break;
+		}
+		if (balance == bal(side)) {
+			rebalanceLink(tree, parent, side);
+			break;
+		}
+		setBalance(parent, bal(side));
+	}
+}
+
+void avl_tree_unlink(AvlTree *tree, AvlLink *link)
+{
+	AvlLink *parent = getParent(link),
+	        *child, *shrunk;
+	int      side;
+	
+	if (link->lr[0] != NULL && link->lr[1] != NULL) {
+		/* Replace it with its neighbour from the taller (or left) side,
+		 * as remove() does. */
+		AvlLink *replacement;
+		int      from = getBalance(link) <= 0 ? 0 : 1;
+		
+		replacement = link->lr[from];
+		while (replacement->lr[1 - from] != NULL)
+			replacement = replacement->lr[1 - from];
+		
+		if (getParent(replacement) == link) {
+			shrunk = replacement;
+			side   = from;
+		} else {
+			shrunk = getParent(replacement);
+			side   = 1 - from;
+			child  = replacement->lr[from];
+			shrunk->lr[side] = child;
+			if (child != NULL)
+				setParent(child, shrunk);
+			replacement->lr[from] = link->lr[from];
+			setParent(link->lr[from], replacement);
+		}
+		replacement->lr[1 - from] = link->lr[1 - from];
+		setParent(link->lr[1 - from], replacement);
+		
+		replacement->parent_balance = link->parent_balance;
+		replacement->size = link->size;
+		replaceChild(tree, parent, link, replacement);
+	} else {
+		child  = link->lr[link->lr[0] == NULL];
+		shrunk = parent;
+		side   = parent != NULL && parent->lr[1] == link;
+		replaceChild(tree, parent, link, child);
+		if (child != NULL)
+			setParent(child, parent);
+	}
+	
+	for (child = shrunk; child != NULL; child = getParent(child))
+		child->size--;
+	
+	/* Walk up while the subtree on our side has shrunk. */
+	while (shrunk != NULL) {
+		int balance = getBalance(shrunk);
+		
+		if (balance == 0) {
+			setBalance(shrunk, -bal(side));
+			break;
+		}
+		if (balance == bal(side)) {
+			setBalance(shrunk, 0);
+		} else {
+			shrunk = rebalanceLink(tree, shrunk, 1 - side);
+			if (getBalance(shrunk) != 0)
+				break;
+		}
+		
+		child  = shrunk;
+		shrunk = getParent(shrunk);
+		if (shrunk != NULL)
+			side = shrunk->lr[1] == child;
+	}
+}
+
+static AvlLink *extremum(AvlLink *link, int side)
+{
+	if (link != NULL)
+		while (link->lr[side] != NULL)
+			link = link->lr[side];
+	return link;
+}
+
+/* The next link in the given direction (1 == forward) from this one. */
+static AvlLink *step(const AvlLink *link, int side)
+{
+	AvlLink *parent;
+	
+	if (link->lr[side] != NULL)
+		return extremum(link->lr[side], 1 - side);
+	
+	while ((parent = getParent(link)) != NULL && parent->lr[side] == link)
+		link = parent;
+	return parent;
+}
+
+AvlLink *avl_tree_first(const AvlTree *tree)
+{
+	return extremum(tree->root, 0);
+}
+
+AvlLink *avl_tree_last(const AvlTree *tree)
+{
+	return extremum(tree->root, 1);
+}
+
+AvlLink *avl_link_next(const AvlLink *link)
+{
+	return step(link, 1);
+}
+
+AvlLink *avl_link_prev(const AvlLink *link)
+{
+	return step(link, 0);
+}
+
+size_t avl_link_rank(const AvlLink *link)
+{
+	size_t   rank = linkSize(link->lr[0]);
+	AvlLink *parent;
+	
+	/* Everything left of each ancestor we're right of comes first. */
+	for (; (parent = getParent(link)) != NULL; link = parent)
+		if (parent->lr[1] == link)
+			rank += linkSize(parent->lr[0]) + 1;
+	return rank;
+}
+
+AvlLink *avl_tree_select(const AvlTree *tree, size_t index)
+{
+	AvlLink *link = tree->root;
+	
+	while (link != NULL) {
+		size_t left = linkSize(link->lr[0]);
+		
+		if (index == left)
+			return link;
+		if (index < left) {
+			link = link->lr[0];
+		} else {
+			index -= left + 1;
+			link = link->lr[1];
+		}
+	}
+	return NULL;
+}
+
+static bool checkLinks(const AvlLink *link, const AvlLink *parent, int *height)
+{
+	if (link) {
+		int h0, h1;
+		
+		if (getParent(link) != parent)
+			return false;
+		if (!checkLinks(link->lr[0], link, &h0))
+			return false;
+		if (!checkLinks(link->lr[1], link, &h1))
+			return false;
+		
+		if (getBalance(link) != h1 - h0 || h1 - h0 < -1 || h1 - h0 > 1)
+			return false;
+		if (link->size != 1 + linkSize(link->lr[0]) + linkSize(link->lr[1]))
+			return false;
+		
+		*height = (h0 > h1 ? h0 : h1) + 1;
+		return true;
+	} else {
+		*height = 0;
+		return true;
+	}
+}
+
+bool avl_tree_check_invariants(const AvlTree *tree)
+{
+	int dummy;
+	
+	return checkLinks(tree->root, NULL, &dummy);
+}
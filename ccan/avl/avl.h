@@ -25,12 +25,15 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <ccan/order/order.h>
 
 typedef struct AVL           AVL;
 typedef struct AvlNode       AvlNode;
 typedef struct AvlIter       AvlIter;
+typedef struct AvlTree       AvlTree;
+typedef struct AvlLink       AvlLink;
 
 AVL *avl_new(total_order_noctx_cb compare);
 	/* Create a new AVL tree sorted with the given comparison function. */
@@ -103,6 +106,78 @@ void avl_iter_next(AvlIter *iter);
 	     avl_iter_next(&iter))
 
 
+/************************* Intrusive trees *************************/
+
+/*
+ * An AvlTree doesn't allocate anything: each element embeds an AvlLink,
+ * the way ccan/list elements embed a list_node.  Since the tree doesn't
+ * know how to compare elements, you find where an element goes yourself,
+ * then link it in there; avl_type.h's AVL_DEFINE_TYPE does this for you,
+ * with a comparison which can be inlined.
+ *
+ * Each link counts the elements in its subtree, so the tree can find the
+ * element at an index, or the index of an element, in O(log n).
+ */
+
+static inline void avl_tree_init(AvlTree *tree);
+	/* Initialize an empty tree.  Or use AVL_TREE_INIT. */
+
+static inline size_t avl_tree_count(const AvlTree *tree);
+	/* O(1). Return the number of elements in the tree. */
+
+void avl_tree_link(AvlTree *tree, AvlLink *link, AvlLink *parent, int side);
+	/*
+	 * O(log n). Insert a link as the left (side == 0) or right (side == 1)
+	 * child of parent, which must not have a child there already, then
+	 * rebalance.  Use parent == NULL to insert into an empty tree.
+	 */
+
+void avl_tree_unlink(AvlTree *tree, AvlLink *link);
+	/* O(log n). Remove a link from the tree, and rebalance. */
+
+AvlLink *avl_tree_first(const AvlTree *tree);
+AvlLink *avl_tree_last(const AvlTree *tree);
+	/* O(log n). Return the left-most/right-most link, or NULL if empty. */
+
+AvlLink *avl_link_next(const AvlLink *link);
+AvlLink *avl_link_prev(const AvlLink *link);
+	/* Amortized O(1). Return the following/preceding link, or NULL. */
+
+size_t avl_link_rank(const AvlLink *link);
+	/* O(log n). Return the index of a link in its tree, from 0. */
+
+AvlLink *avl_tree_select(const AvlTree *tree, size_t index);
+	/* O(log n). Return the link at an index, or NULL if index >= count. */
+
+bool avl_tree_check_invariants(const AvlTree *tree);
+	/*
+	 * For testing purposes: check the balance, parent and count of each
+	 * link.  Ordering is up to the caller.
+	 */
+
+struct AvlTree {
+	AvlLink    *root;
+};
+
+#define AVL_TREE_INIT { NULL }
+
+struct AvlLink {
+	AvlLink    *lr[2];
+	uintptr_t   parent_balance; /* parent pointer | (balance + 1) */
+	size_t      size;           /* links in this subtree, including this one */
+};
+
+static inline void avl_tree_init(AvlTree *tree)
+{
+	tree->root = NULL;
+}
+
+static inline size_t avl_tree_count(const AvlTree *tree)
+{
+	return tree->root ? tree->root->size : 0;
+}
+
+
 /***************** Internal data structures ******************/
 
 struct AVL {
@@ -0,0 +1,247 @@
+/* Licensed under MIT - see LICENSE file for details */
+#ifndef CCAN_AVL_TYPE_H
+#define CCAN_AVL_TYPE_H
+#include "config.h"
+#include <ccan/avl/avl.h>
+#include <ccan/compiler/compiler.h>
+#include <ccan/container_of/container_of.h>
+
+/**
+ * AVL_DEFINE_TYPE - create a typed, intrusive AVL tree
+ * @type: the element type, which contains an AvlLink
+ * @member: the name of the AvlLink within @type
+ * @keyof: a function/macro to extract a key: <keytype> @keyof(const type *elem)
+ * @cmpfn: a comparison function: int @cmpfn(const type *elem, const <keytype> k)
+ * @name: a prefix for the tree type and all the functions to define
+ *
+ * The tree doesn't allocate: elements are linked through their @member,
+ * so an element can only be in one tree through it at a time, and it
+ * must stay put while it's there.  @cmpfn returns less than, equal to or
+ * greater than zero if @elem sorts before, with or after @k, and is
+ * inlined into the searches rather than called through a pointer.
+ *
+ * Without typeof, <keytype> is assumed to be a pointer, unless you
+ * define AVL_KTYPE(keyof, type) yourself.
+ *
+ * Keys are unique: to keep equal keys (eg. equal scores), make the key
+ * unique by adding a tie-breaker (eg. an id).
+ *
+ * This defines the tree type:
+ *	struct <name>;
+ *
+ * Initialization (or use AVL_TREE_INIT) and the number of elements:
+ *	void <name>_init(struct <name> *);
+ *	size_t <name>_count(const struct <name> *);
+ *
+ * Add fails (returning false) if an element with that key is there:
+ *	bool <name>_add(struct <name> *t, type *e);
+ *
+ * Delete an element which is in the tree, or one by key (returning it,
+ * or NULL if there's none):
+ *	void <name>_del(struct <name> *t, type *e);
+ *	type *<name>_delkey(struct <name> *t, const <keytype> k);
+ *
+ * Find an element, or the first one not before a key, or NULL:
+ *	type *<name>_get(const struct <name> *t, const <keytype> k);
+ *	type *<name>_lower_bound(const struct <name> *t, const <keytype> k);
+ *
+ * Order statistics, all O(log n): the index of an element, how many
+ * elements sort before a key, and the element at an index (or NULL):
+ *	size_t <name>_rank(const struct <name> *t, const type *e);
+ *	size_t <name>_rank_key(const struct <name> *t, const <keytype> k);
+ *	type *<name>_select(const struct <name> *t, size_t index);
+ *
+ * In-order iteration (each returns NULL at the end):
+ *	type *<name>_first(const struct <name> *t);
+ *	type *<name>_last(const struct <name> *t);
+ *	type *<name>_next(const struct <name> *t, const type *e);
+ *	type *<name>_prev(const struct <name> *t, const type *e);
+ *
+ * And for testing, check the tree's shape and order:
+ *	bool <name>_check(const struct <name> *t);
+ *
+ * Example:
+ *	#include <ccan/avl/avl_type.h>
+ *	#include <stdint.h>
+ *	#include <stdio.h>
+ *
+ *	// Best score first, then earliest player.
+ *	struct player {
+ *		AvlLink link;
+ *		struct score { uint64_t points; unsigned id; } score;
+ *	};
+ *
+ *	static inline const struct score *player_score(const struct player *p)
+ *	{
+ *		return &p->score;
+ *	}
+ *
+ *	static inline int score_cmp(const struct player *p,
+ *				    const struct score *s)
+ *	{
+ *		if (p->score.points != s->points)
+ *			return p->score.points > s->points ? -1 : 1;
+ *		return (p->score.id > s->id) - (p->score.id < s->id);
+ *	}
+ *
+ *	AVL_DEFINE_TYPE(struct player, link, player_score, score_cmp,
+ *			leaderboard);
+ *
+ *	static void new_score(struct leaderboard *board, struct player *p,
+ *			      uint64_t points)
+ *	{
+ *		leaderboard_del(board, p);
+ *		p->score.points = points;
+ *		leaderboard_add(board, p);
+ *		printf("Player %u is now number %zu of %zu\n", p->score.id,
+ *		       leaderboard_rank(board, p) + 1,
+ *		       leaderboard_count(board));
+ *	}
+ *
+ *	int main(void)
+ *	{
+ *		struct leaderboard board = { AVL_TREE_INIT };
+ *		struct player p[2] = { { .score = { 0, 1 } },
+ *				       { .score = { 0, 2 } } };
+ *
+ *		leaderboard_add(&board, &p[0]);
+ *		leaderboard_add(&board, &p[1]);
+ *		new_score(&board, &p[1], 100);
+ *		return leaderboard_check(&board) ? 0 : 1;
+ *	}
+ */
+#define AVL_DEFINE_TYPE(type, member, keyof, cmpfn, name)		\
+	struct name { AvlTree raw; };					\
+	static inline type *name##_elem_(const AvlLink *link)		\
+	{								\
+		return container_of_or_null((AvlLink *)link, type, member); \
+	}								\
+	static inline UNNEEDED void name##_init(struct name *t)		\
+	{								\
+		avl_tree_init(&t->raw);					\
+	}								\
+	static inline UNNEEDED size_t name##_count(const struct name *t) \
+	{								\
+		return avl_tree_count(&t->raw);				\
+	}								\
+	static inline UNNEEDED bool name##_add(struct name *t, type *e)	\
+	{								\
+		const AVL_KTYPE(keyof, type) k = keyof(e);		\
+		AvlLink *parent = NULL, *link = t->raw.root;		\
+		int side = 0;						\
+									\
+		while (link) {						\
+			int c = cmpfn(name##_elem_(link), k);		\
+			if (c == 0)					\
+				return false;				\
+			parent = link;					\
+			side = c < 0;					\
+			link = link->lr[side];				\
+		}							\
+		avl_tree_link(&t->raw, &e->member, parent, side);	\
+		return true;						\
+	}								\
+	static inline UNNEEDED void name##_del(struct name *t, type *e)	\
+	{								\
+		avl_tree_unlink(&t->raw, &e->member);			\
+	}								\
+	static inline UNNEEDED type *name##_get(const struct name *t,	\
+					const AVL_KTYPE(keyof, type) k) \
+	{								\
+		AvlLink *link = t->raw.root;				\
+									\
+		while (link) {						\
+			int c = cmpfn(name##_elem_(link), k);		\
+			if (c == 0)					\
+				return name##_elem_(link);		\
+			link = link->lr[c < 0];				\
+		}							\
+		return NULL;						\
+	}								\
+	static inline UNNEEDED type *name##_delkey(struct name *t,	\
+					const AVL_KTYPE(keyof, type) k) \
+	{								\
+		type *e = name##_get(t, k);				\
+		if (e)							\
+			name##_del(t, e);				\
+		return e;						\
+	}								\
+	static inline UNNEEDED type *name##_lower_bound(const struct name *t, \
+					const AVL_KTYPE(keyof, type) k) \
+	{								\
+		AvlLink *link = t->raw.root, *best = NULL;		\
+									\
+		while (link) {						\
+			if (cmpfn(name##_elem_(link), k) >= 0) {	\
+				best = link;				\
+				link = link->lr[0];			\
+			} else						\
+				link = link->lr[1];			\
+		}							\
+		return name##_elem_(best);				\
+	}								\
+	static inline UNNEEDED size_t name##_rank(const struct name *t,	\
+						  const type *e)	\
+	{								\
+		return avl_link_rank(&e->member);			\
+	}								\
+	static inline UNNEEDED size_t name##_rank_key(const struct name *t, \
+					const AVL_KTYPE(keyof, type) k) \
+	{								\
+		AvlLink *link = t->raw.root;				\
+		size_t rank = 0;					\
+									\
+		while (link) {						\
+			if (cmpfn(name##_elem_(link), k) < 0) {		\
+				rank += 1 + (link->lr[0]		\
+					     ? link->lr[0]->size : 0);	\
+				link = link->lr[1];			\
+			} else						\
+				link = link->lr[0];			\
+		}							\
+		return rank;						\
+	}								\
+	static inline UNNEEDED type *name##_select(const struct name *t, \
+						   size_t index)	\
+	{								\
+		return name##_elem_(avl_tree_select(&t->raw, index));	\
+	}								\
+	static inline UNNEEDED type *name##_first(const struct name *t)	\
+	{								\
+		return name##_elem_(avl_tree_first(&t->raw));		\
+	}								\
+	static inline UNNEEDED type *name##_last(const struct name *t)	\
+	{								\
+		return name##_elem_(avl_tree_last(&t->raw));		\
+	}								\
+	static inline UNNEEDED type *name##_next(const struct name *t,	\
+						 const type *e)		\
+	{								\
+		return name##_elem_(avl_link_next(&e->member));		\
+	}								\
+	static inline UNNEEDED type *name##_prev(const struct name *t,	\
+						 const type *e)		\
+	{								\
+		return name##_elem_(avl_link_prev(&e->member));		\
+	}								\
+	static inline UNNEEDED bool name##_check(const struct name *t)	\
+	{								\
+		const type *e, *prev = NULL;				\
+									\
+		if (!avl_tree_check_invariants(&t->raw))		\
+			return false;					\
+		for (e = name##_first(t); e; prev = e, e = name##_next(t, e)) \
+			if (prev && cmpfn(prev, keyof(e)) >= 0)		\
+				return false;				\
+		return true;						\
+	}
+
+#if HAVE_TYPEOF
+#define AVL_KTYPE(keyof, type) typeof(keyof((const type *)NULL))
+#else
+/* Assumes keys are a pointer: if not, override. */
+#ifndef AVL_KTYPE
+#define AVL_KTYPE(keyof, type) void *
+#endif
+#endif
+#endif /* CCAN_AVL_TYPE_H */
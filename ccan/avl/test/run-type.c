@@ -0,0 +1,184 @@
+#include <ccan/avl/avl_type.h>
+
+#define remove remove_
+#include <ccan/avl/avl.c>
+#undef remove
+
+#include <ccan/tap/tap.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM 5000
+
+struct item {
+	uint32_t key;
+	AvlLink  link;
+};
+
+/* Keys are pointers, so this works without typeof too. */
+static inline const uint32_t *item_key(const struct item *item)
+{
+	return &item->key;
+}
+
+static inline int item_cmp(const struct item *item, const uint32_t *key)
+{
+	return (item->key > *key) - (item->key < *key);
+}
+
+#define K(k) (&(const uint32_t){ (k) })
+
+AVL_DEFINE_TYPE(struct item, link, item_key, item_cmp, item_tree);
+
+/* Strings, to check pointer keys and a macro comparison. */
+struct name {
+	AvlLink     link;
+	const char *str;
+};
+#define name_str(n) ((n)->str)
+#define name_cmp(n, s) strcmp((n)->str, (s))
+AVL_DEFINE_TYPE(struct name, link, name_str, name_cmp, name_tree);
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+static struct item items[NUM];
+static bool in_tree[NUM];
+
+/* Items' keys are 2 * their index, so odd keys are never there. */
+static bool tree_matches(const struct item_tree *t)
+{
+	size_t i, count = 0;
+	const struct item *e;
+
+	for (i = 0; i < NUM; i++) {
+		if (in_tree[i]) {
+			if (item_tree_select(t, count) != &items[i])
+				return false;
+			if (item_tree_rank(t, &items[i]) != count)
+				return false;
+			if (item_tree_get(t, K(2 * i)) != &items[i])
+				return false;
+			count++;
+		} else if (item_tree_get(t, K(2 * i))) {
+			return false;
+		}
+		if (item_tree_rank_key(t, K(2 * i + 1)) != count)
+			return false;
+	}
+	if (item_tree_count(t) != count || item_tree_select(t, count))
+		return false;
+
+	/* Backwards too. */
+	for (e = item_tree_last(t); e; e = item_tree_prev(t, e))
+		if (!in_tree[e->key / 2] || count-- == 0)
+			return false;
+	return count == 0;
+}
+
+static int height(const AvlLink *link)
+{
+	int h0, h1;
+
+	if (!link)
+		return 0;
+	h0 = height(link->lr[0]);
+	h1 = height(link->lr[1]);
+	return 1 + (h0 > h1 ? h0 : h1);
+}
+
+int main(void)
+{
+	struct item_tree t;
+	struct name_tree names = { AVL_TREE_INIT };
+	struct name n[4] = { { .str = "b" }, { .str = "d" },
+			     { .str = "a" }, { .str = "c" } };
+	size_t i, round, bad;
+
+	plan_tests(3 * 3 + 20);
+
+	item_tree_init(&t);
+	ok1(item_tree_count(&t) == 0);
+	ok1(item_tree_first(&t) == NULL && item_tree_select(&t, 0) == NULL);
+	ok1(item_tree_lower_bound(&t, K(0)) == NULL);
+
+	for (i = 0; i < NUM; i++)
+		items[i].key = 2 * i;
+
+	/* Fill in random order, then empty in random order, three times:
+	 * the second time, delete by element and put some back too. */
+	for (round = 0; round < 3; round++) {
+		bad = 0;
+		for (i = 0; i < NUM * 2; i++) {
+			size_t j = rand32() % NUM;
+
+			if (item_tree_add(&t, &items[j]) == in_tree[j])
+				bad++;
+			in_tree[j] = true;
+			if (i % 97 == 0 && !item_tree_check(&t))
+				bad++;
+		}
+		ok1(bad == 0 && item_tree_check(&t));
+		ok1(tree_matches(&t));
+
+		bad = 0;
+		for (i = 0; i < NUM * 2; i++) {
+			size_t j = rand32() % NUM;
+
+			if (in_tree[j]) {
+				if (round == 1 && (i & 1)) {
+					item_tree_del(&t, &items[j]);
+				} else if (item_tree_delkey(&t, K(2 * j))
+					   != &items[j]) {
+					bad++;
+				}
+				in_tree[j] = false;
+			} else if (item_tree_delkey(&t, K(2 * j))) {
+				bad++;
+			}
+			if (round == 1 && (i & 2) && !in_tree[j]) {
+				item_tree_add(&t, &items[j]);
+				in_tree[j] = true;
+			}
+			if (i % 97 == 0 && !item_tree_check(&t))
+				bad++;
+		}
+		ok1(bad == 0 && item_tree_check(&t) && tree_matches(&t));
+		for (i = 0; i < NUM; i++)
+			if (in_tree[i])
+				item_tree_del(&t, &items[i]);
+		memset(in_tree, 0, sizeof(in_tree));
+	}
+
+	/* Ascending insertion is the worst case for an unbalanced tree. */
+	for (i = 0; i < NUM; i++)
+		item_tree_add(&t, &items[i]);
+	ok1(item_tree_check(&t));
+	ok1(item_tree_count(&t) == NUM);
+	ok1(item_tree_first(&t) == &items[0]);
+	ok1(item_tree_last(&t) == &items[NUM - 1]);
+	ok1(item_tree_next(&t, &items[NUM - 1]) == NULL);
+	ok1(item_tree_lower_bound(&t, K(7)) == &items[4]);
+	ok1(item_tree_lower_bound(&t, K(8)) == &items[4]);
+	ok1(item_tree_lower_bound(&t, K(2 * NUM)) == NULL);
+	ok1(item_tree_rank_key(&t, K(0)) == 0 && item_tree_rank_key(&t, K(1)) == 1);
+	/* AVL trees are at most 1.44 log2(n) high: 17 for 5000. */
+	ok1(height(t.raw.root) <= 17);
+
+	for (i = 0; i < 4; i++)
+		ok1(name_tree_add(&names, &n[i]));
+	ok1(!name_tree_add(&names, &n[0]));
+	ok1(name_tree_select(&names, 2)->str == n[3].str);
+	ok1(name_tree_check(&names));
+
+	return exit_status();
+}
@@ -0,0 +1,128 @@
+/*
+ * Speed tests for AVL_DEFINE_TYPE, compared with avl_insert/avl_lookup,
+ * on a leaderboard: 64-bit scores, with rank and select queries.
+ *
+ * Usage: speed [entries]
+ */
+#include <ccan/avl/avl.h>
+#include <ccan/avl/avl_type.h>
+#include <ccan/time/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+struct entry {
+	uint64_t score;
+	AvlLink link;
+};
+
+static inline uint64_t entry_score(const struct entry *e)
+{
+	return e->score;
+}
+
+static inline int entry_cmp(const struct entry *e, uint64_t score)
+{
+	return (e->score > score) - (e->score < score);
+}
+
+AVL_DEFINE_TYPE(struct entry, link, entry_score, entry_cmp, board);
+
+static int score_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t rand64(void)
+{
+	return ((uint64_t)random() << 33) ^ ((uint64_t)random() << 11)
+		^ random();
+}
+
+int main(int argc, char *argv[])
+{
+	size_t i, num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	struct entry *entries = malloc(num * sizeof(*entries));
+	uint64_t *keys = malloc(num * sizeof(*keys));
+	size_t *order = malloc(num * sizeof(*order)), sum = 0;
+	struct board board = { AVL_TREE_INIT };
+	AVL *avl = avl_new(score_cmp);
+
+	for (i = 0; i < num; i++) {
+		/* avl points at its own copies, so it can change them. */
+		keys[i] = entries[i].score = rand64();
+		order[i] = random() % num;
+	}
+
+	printf("%zu entries:\n", num);
+	TIME("avl_insert", num,
+	     for (i = 0; i < num; i++)
+		     avl_insert(avl, &keys[i], &entries[i]));
+	TIME("board_add", num,
+	     for (i = 0; i < num; i++)
+		     board_add(&board, &entries[i]));
+
+	TIME("avl_lookup (random)", num,
+	     for (i = 0; i < num; i++)
+		     sum += (avl_lookup(avl, &keys[order[i]]) != NULL));
+	TIME("board_get (random)", num,
+	     for (i = 0; i < num; i++)
+		     sum += (board_get(&board, entries[order[i]].score) != NULL));
+
+	TIME("board_rank (random)", num,
+	     for (i = 0; i < num; i++)
+		     sum += board_rank(&board, &entries[order[i]]));
+	TIME("board_rank_key (random)", num,
+	     for (i = 0; i < num; i++)
+		     sum += board_rank_key(&board, entries[order[i]].score));
+	TIME("board_select (random)", num,
+	     for (i = 0; i < num; i++)
+		     sum += (board_select(&board, order[i]) != NULL));
+
+	/* A new score for everyone. */
+	TIME("avl_remove + avl_insert", num,
+	     for (i = 0; i < num; i++) {
+		     uint64_t *k = &keys[order[i]];
+		     if (avl_remove(avl, k)) {
+			     *k = rand64();
+			     avl_insert(avl, k, &entries[order[i]]);
+		     }
+	     });
+	TIME("board_del + board_add", num,
+	     for (i = 0; i < num; i++) {
+		     struct entry *e = &entries[order[i]];
+		     board_del(&board, e);
+		     e->score = rand64();
+		     if (!board_add(&board, e))
+			     abort();
+	     });
+
+	TIME("avl_free", num, avl_free(avl));
+	if (!sum)
+		printf("(sum %zu)\n", sum);
+	free(keys);
+	free(entries);
+	free(order);
+	return 0;
+}
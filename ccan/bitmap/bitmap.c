@@ -6,8 +6,316 @@
 
 #include <assert.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) \
+	&& (defined(__GNUC__) || defined(__clang__))
+#define BITMAP_AVX2 1
+#include <ccan/cpuid/cpuid.h>
+#include <immintrin.h>
+#else
+#define BITMAP_AVX2 0
+#endif
+
 #define BIT_ALIGN_DOWN(n)	((n) & ~(BITMAP_WORD_BITS - 1))
 #define BIT_ALIGN_UP(n)		BIT_ALIGN_DOWN((n) + BITMAP_WORD_BITS - 1)
+#define ALL_ONES		((bitmap_word)-1)
+
+/*
+ * Whole-word kernels, which the large operations go through.  Both find
+ * functions return the index of the first word which matches, or nw.
+ */
+struct bitmap_kernels {
+	void (*and_words)(bitmap_word *dst, const bitmap_word *a,
+			  const bitmap_word *b, size_t nw);
+	void (*or_words)(bitmap_word *dst, const bitmap_word *a,
+			 const bitmap_word *b, size_t nw);
+	void (*xor_words)(bitmap_word *dst, const bitmap_word *a,
+			  const bitmap_word *b, size_t nw);
+	void (*andnot_words)(bitmap_word *dst, const bitmap_word *a,
+			     const bitmap_word *b, size_t nw);
+	/* First a[i] != skip, where skip is 0 or ALL_ONES. */
+	size_t (*find_word)(const bitmap_word *a, size_t nw, bitmap_word skip);
+	/* First a[i] & (b[i] ^ flip) != 0, where flip is 0 or ALL_ONES. */
+	size_t (*find_and_word)(const bitmap_word *a, const bitmap_word *b,
+				size_t nw, bitmap_word flip);
+	unsigned long (*weight_words)(const bitmap_word *a, size_t nw);
+};
+
+static unsigned long bitmap_popcount(bitmap_word w)
+{
+#if HAVE_BUILTIN_POPCOUNTL
+	return __builtin_popcountl(w);
+#else
+	unsigned long n = 0;
+
+	while (w) {
+		w &= w - 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+#define DEF_GENERIC_BINOP(_name, _op)					\
+	static void generic_##_name##_words(bitmap_word *dst,		\
+					    const bitmap_word *a,	\
+					    const bitmap_word *b,	\
+					    size_t nw)			\
+	{								\
+		size_t i;						\
+									\
+		for (i = 0; i < nw; i++)				\
+			dst[i] = a[i] _op b[i];				\
+	}
+
+DEF_GENERIC_BINOP(and, &)
+DEF_GENERIC_BINOP(or, |)
+DEF_GENERIC_BINOP(xor, ^)
+DEF_GENERIC_BINOP(andnot, & ~)
+
+static size_t generic_find_word(const bitmap_word *a, size_t nw,
+				bitmap_word skip)
+{
+	size_t i;
+
+	for (i = 0; i < nw; i++)
+		if (a[i] != skip)
+			break;
+	return i;
+}
+
+static size_t generic_find_and_word(const bitmap_word *a,
+				    const bitmap_word *b,
+				    size_t nw, bitmap_word flip)
+{
+	size_t i;
+
+	for (i = 0; i < nw; i++)
+		if (a[i] & (b[i] ^ flip))
+			break;
+	return i;
+}
+
+static unsigned long generic_weight_words(const bitmap_word *a, size_t nw)
+{
+	unsigned long weight = 0;
+	size_t i;
+
+	for (i = 0; i < nw; i++)
+		weight += bitmap_popcount(a[i]);
+	return weight;
+}
+
+static const struct bitmap_kernels generic_kernels = {
+	generic_and_words, generic_or_words,
+	generic_xor_words, generic_andnot_words,
+	generic_find_word, generic_find_and_word, generic_weight_words
+};
+
+#if BITMAP_AVX2
+#define AVX2		__attribute__((target("avx2,popcnt")))
+#define VWORDS		(sizeof(__m256i) / sizeof(bitmap_word))
+#define VLOAD(p)	_mm256_loadu_si256((const __m256i *)(p))
+
+#define DEF_AVX2_BINOP(_name, _vexpr, _op)				\
+	static AVX2 void avx2_##_name##_words(bitmap_word *dst,	\
+					      const bitmap_word *a,	\
+					      const bitmap_word *b,	\
+					      size_t nw)		\
+	{								\
+		size_t i;						\
+									\
+		for (i = 0; i + VWORDS <= nw; i += VWORDS) {		\
+			__m256i va = VLOAD(a + i), vb = VLOAD(b + i);	\
+			_mm256_storeu_si256((__m256i *)(dst + i), _vexpr); \
+		}							\
+		for (; i < nw; i++)					\
+			dst[i] = a[i] _op b[i];				\
+	}
+
+DEF_AVX2_BINOP(and, _mm256_and_si256(va, vb), &)
+DEF_AVX2_BINOP(or, _mm256_or_si256(va, vb), |)
+DEF_AVX2_BINOP(xor, _mm256_xor_si256(va, vb), ^)
+DEF_AVX2_BINOP(andnot, _mm256_andnot_si256(vb, va), & ~)
+
+/* skip and flip are all-zeroes or all-ones, so any byte will do. */
+static AVX2 size_t avx2_find_word(const bitmap_word *a, size_t nw,
+				  bitmap_word skip)
+{
+	const __m256i vskip = _mm256_set1_epi8((char)skip);
+	size_t i;
+
+	for (i = 0; i + 2 * VWORDS <= nw; i += 2 * VWORDS) {
+		__m256i x = _mm256_xor_si256(VLOAD(a + i), vskip);
+		__m256i y = _mm256_xor_si256(VLOAD(a + i + VWORDS), vskip);
+		__m256i xy = _mm256_or_si256(x, y);
+
+		if (!_mm256_testz_si256(xy, xy))
+			break;
+	}
+	for (; i < nw; i++)
+		if (a[i] != skip)
+			break;
+	return i;
+}
+
+static AVX2 size_t avx2_find_and_word(const bitmap_word *a,
+				      const bitmap_word *b,
+				      size_t nw, bitmap_word flip)
+{
+	const __m256i vflip = _mm256_set1_epi8((char)flip);
+	size_t i;
+
+	for (i = 0; i + 2 * VWORDS <= nw; i += 2 * VWORDS) {
+		__m256i x = _mm256_and_si256(VLOAD(a + i),
+				_mm256_xor_si256(VLOAD(b + i), vflip));
+		__m256i y = _mm256_and_si256(VLOAD(a + i + VWORDS),
+				_mm256_xor_si256(VLOAD(b + i + VWORDS), vflip));
+		__m256i xy = _mm256_or_si256(x, y);
+
+		if (!_mm256_testz_si256(xy, xy))
+			break;
+	}
+	for (; i < nw; i++)
+		if (a[i] & (b[i] ^ flip))
+			break;
+	return i;
+}
+
+/*
+ * Count each nibble with a table lookup (vpshufb), adding up bytes until
+ * they might overflow (31 * 8 < 256), then summing those with vpsadbw.
+ */
+static AVX2 unsigned long avx2_weight_words(const bitmap_word *a, size_t nw)
+{
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+						1, 2, 2, 3, 2, 3, 3, 4,
+						0, 1, 1, 2, 1, 2, 2, 3,
+						1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i total = _mm256_setzero_si256();
+	unsigned long long lanes[4];
+	unsigned long weight;
+	size_t i = 0, j;
+
+	while (i + VWORDS <= nw) {
+		__m256i bytes = _mm256_setzero_si256();
+
+		for (j = 0; j < 31 && i + VWORDS <= nw; j++, i += VWORDS) {
+			__m256i v = VLOAD(a + i);
+			__m256i lo = _mm256_and_si256(v, low);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4),
+						      low);
+
+			bytes = _mm256_add_epi8(bytes,
+						_mm256_shuffle_epi8(lookup, lo));
+			bytes = _mm256_add_epi8(bytes,
+						_mm256_shuffle_epi8(lookup, hi));
+		}
+		total = _mm256_add_epi64(total,
+				_mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, total);
+	weight = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	for (; i < nw; i++)
+		weight += __builtin_popcountl(a[i]);
+	return weight;
+}
+
+static const struct bitmap_kernels avx2_kernels = {
+	avx2_and_words, avx2_or_words, avx2_xor_words, avx2_andnot_words,
+	avx2_find_word, avx2_find_and_word, avx2_weight_words
+};
+
+static bool avx2_supported(void)
+{
+	return cpuid_is_supported()
+		&& cpuid_has_ecxfeature(CPUID_FEAT_ECX_POPCNT)
+		&& cpuid_has_os_avx()
+		&& cpuid_has_ebxfeature7(CPUID_FEAT7_EBX_AVX2);
+}
+#else
+static bool avx2_supported(void)
+{
+	return false;
+}
+#endif /* BITMAP_AVX2 */
+
+/* Racing threads would all set this to the same thing. */
+static const struct bitmap_kernels *kernels_in_use;
+
+static const struct bitmap_kernels *kernels(void)
+{
+	if (!kernels_in_use)
+		bitmap_use_simd(true);
+	return kernels_in_use;
+}
+
+bool bitmap_use_simd(bool enable)
+{
+#if BITMAP_AVX2
+	if (enable && avx2_supported()) {
+		kernels_in_use = &avx2_kernels;
+		return true;
+	}
+#endif
+	kernels_in_use = &generic_kernels;
+	return false;
+}
+
+#define DEF_LARGE_BINOP(_name)						\
+	void bitmap_##_name##_(bitmap *dst, const bitmap *src1,	\
+			       const bitmap *src2, unsigned long nbits) \
+	{								\
+		kernels()->_name##_words(&dst->w, &src1->w, &src2->w,	\
+					 BITMAP_NWORDS(nbits));		\
+	}
+
+DEF_LARGE_BINOP(and)
+DEF_LARGE_BINOP(or)
+DEF_LARGE_BINOP(xor)
+DEF_LARGE_BINOP(andnot)
+
+bool bitmap_intersects_(const bitmap *src1, const bitmap *src2,
+			unsigned long nbits)
+{
+	size_t nw = BITMAP_HEADWORDS(nbits);
+
+	if (kernels()->find_and_word(&src1->w, &src2->w, nw, 0) < nw)
+		return true;
+	return BITMAP_HASTAIL(nbits)
+		&& (BITMAP_TAIL(src1, nbits) & BITMAP_TAIL(src2, nbits));
+}
+
+bool bitmap_subset_(const bitmap *src1, const bitmap *src2,
+		    unsigned long nbits)
+{
+	size_t nw = BITMAP_HEADWORDS(nbits);
+
+	if (kernels()->find_and_word(&src1->w, &src2->w, nw, ALL_ONES) < nw)
+		return false;
+	return !BITMAP_HASTAIL(nbits)
+		|| !(BITMAP_TAIL(src1, nbits) & ~BITMAP_TAIL(src2, nbits));
+}
+
+bool bitmap_full_(const bitmap *bitmap, unsigned long nbits)
+{
+	size_t nw = BITMAP_HEADWORDS(nbits);
+
+	if (kernels()->find_word(&bitmap->w, nw, ALL_ONES) < nw)
+		return false;
+	return !BITMAP_HASTAIL(nbits)
+		|| BITMAP_TAIL(bitmap, nbits) == BITMAP_TAILBITS(nbits);
+}
+
+bool bitmap_empty_(const bitmap *bitmap, unsigned long nbits)
+{
+	size_t nw = BITMAP_HEADWORDS(nbits);
+
+	if (kernels()->find_word(&bitmap->w, nw, 0) < nw)
+		return false;
+	return !BITMAP_HASTAIL(nbits) || BITMAP_TAIL(bitmap, nbits) == 0;
+}
 
 void bitmap_zero_range(bitmap *bitmap, unsigned long n, unsigned long m)
 {
@@ -76,6 +384,22 @@ static int bitmap_clz(bitmap_word w)
 #endif
 }
 
+static int bitmap_ctz(bitmap_word w)
+{
+#if HAVE_BUILTIN_CTZL
+	return __builtin_ctzl(w);
+#else
+	int tz = 0;
+
+	while (!(w & 1)) {
+		tz++;
+		w >>= 1;
+	}
+
+	return tz;
+#endif
+}
+
 unsigned long bitmap_ffs(const bitmap *bitmap,
 			 unsigned long n, unsigned long m)
 {
@@ -103,13 +427,12 @@ unsigned long bitmap_ffs(const bitmap *bitmap,
 			return BIT_ALIGN_DOWN(n) + bitmap_clz(w);
 	}
 
-	while (an < am) {
-		bitmap_word w = bitmap_bswap(BITMAP_WORD(bitmap, an));
-
-		if (w)
-			return an + bitmap_clz(w);
-
-		an += BITMAP_WORD_BITS;
+	if (an < am) {
+		an += kernels()->find_word(&BITMAP_WORD(bitmap, an),
+					   (am - an) / BITMAP_WORD_BITS, 0)
+			* BITMAP_WORD_BITS;
+		if (an < am)
+			return an + bitmap_clz(bitmap_bswap(BITMAP_WORD(bitmap, an)));
 	}
 
 	if (m > am) {
@@ -123,3 +446,97 @@ unsigned long bitmap_ffs(const bitmap *bitmap,
 
 	return m;
 }
+
+unsigned long bitmap_weight(const bitmap *bitmap,
+			    unsigned long n, unsigned long m)
+{
+	unsigned long an = BIT_ALIGN_UP(n);
+	unsigned long am = BIT_ALIGN_DOWN(m);
+	bitmap_word headmask = ALL_ONES >> (n % BITMAP_WORD_BITS);
+	bitmap_word tailmask = ~(ALL_ONES >> (m % BITMAP_WORD_BITS));
+	unsigned long weight = 0;
+
+	assert(m >= n);
+
+	if (am < an)
+		return bitmap_popcount(bitmap_bswap(BITMAP_WORD(bitmap, n))
+				       & headmask & tailmask);
+
+	if (an > n)
+		weight += bitmap_popcount(bitmap_bswap(BITMAP_WORD(bitmap, n))
+					  & headmask);
+
+	if (am > an)
+		weight += kernels()->weight_words(&BITMAP_WORD(bitmap, an),
+						  (am - an) / BITMAP_WORD_BITS);
+
+	if (m > am)
+		weight += bitmap_popcount(bitmap_bswap(BITMAP_WORD(bitmap, m))
+					  & tailmask);
+
+	return weight;
+}
+
+/*
+ * Word at a time: run is the number of clear bits just before this word,
+ * and we look for one starting there, then one within the word.  Bits
+ * outside [n, m) count as set, and runs of set words are skipped at once.
+ */
+unsigned long bitmap_ffz_run(const bitmap *bitmap, unsigned long n,
+			     unsigned long m, unsigned long len)
+{
+	const bitmap_word *words = &bitmap->w;
+	unsigned long i, run = 0;
+
+	assert(m >= n);
+
+	if (len > m - n)
+		return m;
+	if (len == 0)
+		return n;
+
+	for (i = n / BITMAP_WORD_BITS; i * BITMAP_WORD_BITS < m; i++) {
+		unsigned long base = i * BITMAP_WORD_BITS;
+		bitmap_word w = bitmap_bswap(words[i]);
+
+		if (base < n)
+			w |= ~(ALL_ONES >> (n - base));
+		if (m - base < BITMAP_WORD_BITS)
+			w |= ALL_ONES >> (m - base);
+
+		if (!w) {
+			run += BITMAP_WORD_BITS;
+			if (run >= len)
+				return base + BITMAP_WORD_BITS - run;
+			continue;
+		}
+
+		if (run + bitmap_clz(w) >= len)
+			return base - run;
+
+		if (len < BITMAP_WORD_BITS) {
+			/* Bit k of r is set if len bits from k are clear. */
+			bitmap_word r = ~w;
+			unsigned long k, step;
+
+			for (k = 1; k < len && r; k += step) {
+				step = k < len - k ? k : len - k;
+				r &= r << step;
+			}
+			if (r)
+				return base + bitmap_clz(r);
+		}
+
+		if (w == ALL_ONES && i + 1 < m / BITMAP_WORD_BITS) {
+			i += kernels()->find_word(words + i + 1,
+						  m / BITMAP_WORD_BITS - (i + 1),
+						  ALL_ONES);
+			run = 0;
+			continue;
+		}
+
+		run = bitmap_ctz(w);
+	}
+
+	return m;
+}
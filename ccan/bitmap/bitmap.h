@@ -94,11 +94,25 @@ static inline void bitmap_copy(bitmap *dst, const bitmap *src,
 	memcpy(dst, src, bitmap_sizeof(nbits));
 }
 
+/*
+ * Operations on bitmaps of BITMAP_LARGE_BITS or more go out of line,
+ * to versions which use AVX2 if the CPU has it (see bitmap_use_simd()).
+ * Don't call the _-suffixed functions directly.
+ */
+#define BITMAP_LARGE_BITS	1024
+
 #define BITMAP_DEF_BINOP(_name, _op) \
-	static inline void bitmap_##_name(bitmap *dst, bitmap *src1, bitmap *src2, \
+	void bitmap_##_name##_(bitmap *dst, const bitmap *src1, \
+			       const bitmap *src2, unsigned long nbits); \
+	static inline void bitmap_##_name(bitmap *dst, const bitmap *src1, \
+					  const bitmap *src2, \
 					  unsigned long nbits)		\
 	{ \
 		unsigned long i = 0; \
+		if (nbits >= BITMAP_LARGE_BITS) { \
+			bitmap_##_name##_(dst, src1, src2, nbits); \
+			return; \
+		} \
 		for (i = 0; i < BITMAP_NWORDS(nbits); i++) { \
 			dst[i].w = src1[i].w _op src2[i].w; \
 		} \
@@ -111,6 +125,13 @@ BITMAP_DEF_BINOP(andnot, & ~)
 
 #undef BITMAP_DEF_BINOP
 
+bool bitmap_intersects_(const bitmap *src1, const bitmap *src2,
+			unsigned long nbits);
+bool bitmap_subset_(const bitmap *src1, const bitmap *src2,
+		    unsigned long nbits);
+bool bitmap_full_(const bitmap *bitmap, unsigned long nbits);
+bool bitmap_empty_(const bitmap *bitmap, unsigned long nbits);
+
 static inline void bitmap_complement(bitmap *dst, const bitmap *src,
 				     unsigned long nbits)
 {
@@ -133,6 +154,9 @@ static inline bool bitmap_intersects(const bitmap *src1, const bitmap *src2,
 {
 	unsigned long i;
 
+	if (nbits >= BITMAP_LARGE_BITS)
+		return bitmap_intersects_(src1, src2, nbits);
+
 	for (i = 0; i < BITMAP_HEADWORDS(nbits); i++) {
 		if (src1[i].w & src2[i].w)
 			return true;
@@ -148,6 +172,9 @@ static inline bool bitmap_subset(const bitmap *src1, const bitmap *src2,
 {
 	unsigned long i;
 
+	if (nbits >= BITMAP_LARGE_BITS)
+		return bitmap_subset_(src1, src2, nbits);
+
 	for (i = 0; i < BITMAP_HEADWORDS(nbits); i++) {
 		if (src1[i].w  & ~src2[i].w)
 			return false;
@@ -162,6 +189,9 @@ static inline bool bitmap_full(const bitmap *bitmap, unsigned long nbits)
 {
 	unsigned long i;
 
+	if (nbits >= BITMAP_LARGE_BITS)
+		return bitmap_full_(bitmap, nbits);
+
 	for (i = 0; i < BITMAP_HEADWORDS(nbits); i++) {
 		if (bitmap[i].w != -1UL)
 			return false;
@@ -177,6 +207,9 @@ static inline bool bitmap_empty(const bitmap *bitmap, unsigned long nbits)
 {
 	unsigned long i;
 
+	if (nbits >= BITMAP_LARGE_BITS)
+		return bitmap_empty_(bitmap, nbits);
+
 	for (i = 0; i < BITMAP_HEADWORDS(nbits); i++) {
 		if (bitmap[i].w != 0)
 			return false;
@@ -190,6 +223,26 @@ static inline bool bitmap_empty(const bitmap *bitmap, unsigned long nbits)
 unsigned long bitmap_ffs(const bitmap *bitmap,
 			 unsigned long n, unsigned long m);
 
+/*
+ * The number of bits set in [n, m).
+ */
+unsigned long bitmap_weight(const bitmap *bitmap,
+			    unsigned long n, unsigned long m);
+
+/*
+ * The first bit in [n, m) which starts a run of len clear bits lying
+ * wholly within [n, m), or m if there's none.
+ */
+unsigned long bitmap_ffz_run(const bitmap *bitmap, unsigned long n,
+			     unsigned long m, unsigned long len);
+
+/*
+ * Whether to use the AVX2 versions of the large bitmap operations:
+ * they're used by default if the CPU and OS support them.  Returns
+ * whether they're now in use, which is false if they're unsupported.
+ */
+bool bitmap_use_simd(bool enable);
+
 /*
  * Allocation functions
  */
@@ -0,0 +1,198 @@
+#include <ccan/bitmap/bitmap.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+
+#include <ccan/bitmap/bitmap.c>
+
+#include <stdint.h>
+
+/* All at least BITMAP_LARGE_BITS, so they take the out-of-line paths. */
+static const unsigned long bitmap_sizes[] = {
+	1024, 1025, 1087, 4133, 20000,
+};
+#define NSIZES ARRAY_SIZE(bitmap_sizes)
+#define NTESTS 12
+#define NRANGES 300
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+/* About one bit in 2^density set (or clear, for negative density), so we
+ * get long runs both ways; density 0 sets half of them. */
+static void fill_random(bitmap *b, unsigned long nbits, int density)
+{
+	unsigned long i;
+	bool set;
+
+	bitmap_zero(b, nbits);
+	for (i = 0; i < nbits; i++) {
+		/* Shifting by 32 is undefined: and the low bits of an LCG
+		 * are poor, so use the top one. */
+		if (density == 0)
+			set = rand32() >> 31;
+		else if (density < 0)
+			set = (rand32() >> (32 + density)) != 0;
+		else
+			set = (rand32() >> (32 - density)) == 0;
+		if (set)
+			bitmap_set_bit(b, i);
+	}
+}
+
+static unsigned long naive_ffs(const bitmap *b, unsigned long n,
+			       unsigned long m)
+{
+	for (; n < m; n++)
+		if (bitmap_test_bit(b, n))
+			return n;
+	return m;
+}
+
+static unsigned long naive_weight(const bitmap *b, unsigned long n,
+				  unsigned long m)
+{
+	unsigned long weight = 0;
+
+	for (; n < m; n++)
+		weight += bitmap_test_bit(b, n);
+	return weight;
+}
+
+static unsigned long naive_ffz_run(const bitmap *b, unsigned long n,
+				   unsigned long m, unsigned long len)
+{
+	unsigned long i, run = 0;
+
+	if (len == 0)
+		return n;
+	for (i = n; i < m; i++) {
+		run = bitmap_test_bit(b, i) ? 0 : run + 1;
+		if (run == len)
+			return i + 1 - len;
+	}
+	return m;
+}
+
+enum op { AND, OR, XOR, ANDNOT };
+
+/* dst must have the bits of a op b. */
+static bool same_as_bits(const bitmap *dst, const bitmap *a,
+			 const bitmap *b, unsigned long nbits, enum op op)
+{
+	unsigned long i;
+
+	for (i = 0; i < nbits; i++) {
+		bool x = bitmap_test_bit(a, i), y = bitmap_test_bit(b, i);
+		bool want = op == AND ? x && y : op == OR ? x || y
+			: op == XOR ? x != y : x && !y;
+
+		if (bitmap_test_bit(dst, i) != want)
+			return false;
+	}
+	return true;
+}
+
+static void test_size(unsigned long nbits)
+{
+	bitmap *a = bitmap_alloc(nbits), *b = bitmap_alloc(nbits);
+	bitmap *dst = bitmap_alloc(nbits);
+	unsigned long i, n, m, len, bad;
+	int density;
+
+	/* Bulk combinations, at several densities. */
+	for (bad = 0, density = -3; density <= 3; density++) {
+		fill_random(a, nbits, density);
+		fill_random(b, nbits, -density);
+		bitmap_and(dst, a, b, nbits);
+		bad += !same_as_bits(dst, a, b, nbits, AND);
+		bitmap_or(dst, a, b, nbits);
+		bad += !same_as_bits(dst, a, b, nbits, OR);
+		bitmap_xor(dst, a, b, nbits);
+		bad += !same_as_bits(dst, a, b, nbits, XOR);
+		bitmap_andnot(dst, a, b, nbits);
+		bad += !same_as_bits(dst, a, b, nbits, ANDNOT);
+	}
+	ok1(bad == 0);
+
+	/* Tests of the whole bitmap, with one bit making the difference. */
+	for (bad = 0, i = 0; i < nbits; i += 1 + rand32() % 61) {
+		bitmap_zero(a, nbits);
+		bitmap_fill(b, nbits);
+		bad += !bitmap_empty(a, nbits) || !bitmap_full(b, nbits);
+		bad += !bitmap_subset(a, b, nbits) || bitmap_intersects(a, b, nbits);
+		bitmap_set_bit(a, i);
+		bitmap_clear_bit(b, i);
+		bad += bitmap_empty(a, nbits) || bitmap_full(b, nbits);
+		bad += bitmap_subset(a, b, nbits) || bitmap_intersects(a, b, nbits);
+		bitmap_set_bit(b, i);
+		bad += !bitmap_subset(a, b, nbits) || !bitmap_intersects(a, b, nbits);
+	}
+	ok1(bad == 0);
+	ok1(bitmap_full(b, nbits) && !bitmap_empty(b, nbits));
+	ok1(!bitmap_subset(b, a, nbits) && bitmap_subset(a, a, nbits));
+
+	/* Bits past the end don't count. */
+	bitmap_fill(a, nbits);
+	bitmap_zero_range(a, 0, nbits);
+	ok1(bitmap_empty(a, nbits) && bitmap_weight(a, 0, nbits) == 0);
+	bitmap_zero(a, nbits);
+	bitmap_fill_range(a, 0, nbits);
+	ok1(bitmap_full(a, nbits) && bitmap_ffz_run(a, 0, nbits, 1) == nbits);
+
+	/* Searches and counts over random ranges. */
+	for (density = -4; density <= 4; density += 4) {
+		fill_random(a, nbits, density);
+		for (bad = 0, i = 0; i < NRANGES; i++) {
+			n = rand32() % (nbits + 1);
+			m = n + rand32() % (nbits + 1 - n);
+			len = rand32() % 3 ? rand32() % 70 : rand32() % 300;
+			if (bitmap_ffs(a, n, m) != naive_ffs(a, n, m))
+				bad++;
+			if (bitmap_weight(a, n, m) != naive_weight(a, n, m))
+				bad++;
+			if (bitmap_ffz_run(a, n, m, len)
+			    != naive_ffz_run(a, n, m, len))
+				bad++;
+		}
+		ok1(bad == 0);
+	}
+
+	/* A free map: find a run exactly where it was freed. */
+	bitmap_fill(a, nbits);
+	n = nbits / 2 - 7;
+	bitmap_zero_range(a, n, n + 100);
+	ok1(bitmap_ffz_run(a, 0, nbits, 100) == n);
+	ok1(bitmap_ffz_run(a, 0, nbits, 101) == nbits);
+	ok1(bitmap_weight(a, 0, nbits) == nbits - 100);
+
+	free(a);
+	free(b);
+	free(dst);
+}
+
+int main(void)
+{
+	int i, simd;
+
+	/* This is how many tests you plan to run */
+	plan_tests(2 * NSIZES * NTESTS + 1);
+
+	ok1(bitmap_use_simd(true) == avx2_supported());
+	for (simd = 0; simd < 2; simd++) {
+		bitmap_use_simd(simd);
+		for (i = 0; i < NSIZES; i++) {
+			diag("Testing %lu-bit bitmap (%s)", bitmap_sizes[i],
+			     simd ? "simd" : "generic");
+			test_size(bitmap_sizes[i]);
+		}
+	}
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
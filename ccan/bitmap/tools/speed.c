@@ -0,0 +1,116 @@
+/*
+ * Speed tests for the large bitmap operations, with and without SIMD.
+ *
+ * Each operation goes over the whole bitmap: the searches are set up so
+ * they only find what they're looking for at the very end.
+ *
+ * Usage: speed [maxbits]  (up to 1G bits by default, which needs 625MB)
+ */
+#include <ccan/bitmap/bitmap.h>
+#include <ccan/time/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Microseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_usec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu us\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+/* Stops the compiler throwing away the results. */
+static volatile unsigned long sink;
+
+static void run(unsigned long nbits, bitmap *zero, bitmap *ones,
+		bitmap *free_map, bitmap *random, bitmap *dst)
+{
+	/* Enough to go through about 4G bits per operation. */
+	size_t i, reps = nbits >= (1UL << 32) ? 1 : (1UL << 32) / nbits;
+
+	TIME("bitmap_ffs (none set)", reps,
+	     for (i = 0; i < reps; i++) sink = bitmap_ffs(zero, 0, nbits));
+	TIME("bitmap_empty", reps,
+	     for (i = 0; i < reps; i++) sink = bitmap_empty(zero, nbits));
+	TIME("bitmap_full", reps,
+	     for (i = 0; i < reps; i++) sink = bitmap_full(ones, nbits));
+	TIME("bitmap_intersects (disjoint)", reps,
+	     for (i = 0; i < reps; i++)
+		     sink = bitmap_intersects(zero, ones, nbits));
+	TIME("bitmap_subset", reps,
+	     for (i = 0; i < reps; i++)
+		     sink = bitmap_subset(random, ones, nbits));
+	TIME("bitmap_weight", reps,
+	     for (i = 0; i < reps; i++)
+		     sink = bitmap_weight(random, 0, nbits));
+	TIME("bitmap_ffz_run (100 clear, at the end)", reps,
+	     for (i = 0; i < reps; i++)
+		     sink = bitmap_ffz_run(free_map, 0, nbits, 100));
+	TIME("bitmap_ffz_run (3 clear, sparse map)", reps,
+	     for (i = 0; i < reps; i++)
+		     sink = bitmap_ffz_run(random, 0, nbits, 3));
+	TIME("bitmap_and", reps,
+	     for (i = 0; i < reps; i++)
+		     bitmap_and(dst, random, free_map, nbits));
+	TIME("bitmap_andnot", reps,
+	     for (i = 0; i < reps; i++)
+		     bitmap_andnot(dst, random, free_map, nbits));
+}
+
+int main(int argc, char *argv[])
+{
+	const unsigned long sizes[] = { 1000000, 100000000, 1000000000 };
+	unsigned long maxbits = argc > 1 ? strtoul(argv[1], NULL, 0) : sizes[2];
+	unsigned long nbits, i, s;
+	bitmap *zero, *ones, *free_map, *random, *dst;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		nbits = sizes[s];
+		if (nbits > maxbits)
+			break;
+		/* Not bitmap_alloc0: calloc could map the same zero page
+		 * everywhere, which is much quicker to scan. */
+		zero = bitmap_alloc1(nbits);
+		if (zero)
+			bitmap_zero_range(zero, 0, nbits);
+		ones = bitmap_alloc1(nbits);
+		free_map = bitmap_alloc1(nbits);
+		random = bitmap_alloc(nbits);
+		dst = bitmap_alloc(nbits);
+		if (!zero || !ones || !free_map || !random || !dst) {
+			fprintf(stderr, "Out of memory for %lu bits\n", nbits);
+			return 1;
+		}
+		bitmap_zero_range(free_map, nbits - 100, nbits);
+		/* Never 3 clear bits together, except at the end. */
+		for (i = 0; i < BITMAP_NWORDS(nbits); i++)
+			random[i].w = (bitmap_word)0x6db6db6db6db6db6ULL
+				| (i * (bitmap_word)0x9e3779b97f4a7c15ULL);
+		bitmap_zero_range(random, nbits - 3, nbits);
+
+		printf("%lu bits, generic:\n", nbits);
+		bitmap_use_simd(false);
+		run(nbits, zero, ones, free_map, random, dst);
+		if (bitmap_use_simd(true)) {
+			printf("%lu bits, simd:\n", nbits);
+			run(nbits, zero, ones, free_map, random, dst);
+		}
+		free(zero);
+		free(ones);
+		free(free_map);
+		free(random);
+		free(dst);
+	}
+	return 0;
+}
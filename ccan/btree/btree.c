@@ -22,6 +22,8 @@
 
 #include "btree.h"
 
+#include <ccan/build_assert/build_assert.h>
+
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,8 +31,19 @@
 #define MAX (BTREE_ITEM_MAX)
 #define MIN (BTREE_ITEM_MAX >> 1)
 
+/*
+ * Nodes are aligned so a leaf covers as few cache lines (or, for big
+ * nodes, pages) as possible.
+ */
+#define CACHE_LINE 64
+#define NODE_ALIGN (BTREE_NODE_BYTES >= 4096 ? 4096 : CACHE_LINE)
+
+/* How much of the next leaf a scan prefetches. */
+#define PREFETCH_BYTES (BTREE_NODE_BYTES < 512 ? BTREE_NODE_BYTES : 512)
+
 static struct btree_node *node_alloc(int internal);
 static void node_delete(struct btree_node *node, struct btree *btree);
+static void node_free(struct btree_node *node);
 
 static void branch_begin(btree_iterator iter);
 static void branch_end(btree_iterator iter);
@@ -65,8 +78,14 @@ static int node_walk_forward(const struct btree_node *node,
 
 struct btree *btree_new(btree_search_t search)
 {
-	struct btree *btree = calloc(1, sizeof(struct btree));
-	struct btree_node *node = node_alloc(0);
+	struct btree *btree;
+	struct btree_node *node;
+
+	/* Leaves must hold at least a few items. */
+	BUILD_ASSERT(BTREE_NODE_BYTES >= 64);
+
+	btree = calloc(1, sizeof(struct btree));
+	node = node_alloc(0);
 		node->parent = NULL;
 		node->count = 0;
 		node->depth = 0;
@@ -213,6 +232,124 @@ int btree_find_lr(const struct btree *btree, const void *key,
 	return found;
 }
 
+/*
+ * Size of group i, when dividing total between groups which may have at
+ * most max and (except for a lone group) at least min.  All groups are
+ * full except the last, which is evened out with the one before it if it
+ * would be too small.
+ */
+static size_t group_size(size_t total, size_t groups, size_t i,
+				size_t max, size_t min)
+{
+	size_t last = total - max * (groups - 1);
+	
+	if (groups == 1)
+		return total;
+	if (last >= min || i < groups - 2)
+		return i == groups - 1 ? last : max;
+	if (i == groups - 2)
+		return max + last - (max + last) / 2;
+	return (max + last) / 2;
+}
+
+bool btree_load_sorted(struct btree *btree,
+				const void * const *items, size_t count)
+{
+	struct btree_node **level, *node;
+	const void **seps;
+	size_t nodes, i, j, n, c = 0;
+	unsigned int depth;
+	
+	if (btree->count)
+		return false;
+	
+	if (count <= MAX) {
+		memcpy(btree->root->item, items, count * sizeof(*items));
+		btree->root->count = count;
+		btree->count = count;
+		return true;
+	}
+	
+	/*
+	 * Every leaf but the first is preceded by a separator item which goes
+	 * up into the level above, so we need the smallest number of leaves
+	 * where count <= leaves * MAX + (leaves - 1).
+	 */
+	nodes = (count + 1 + MAX) / (MAX + 1);
+	level = malloc(nodes * sizeof(*level));
+	seps = malloc((nodes - 1) * sizeof(*seps));
+	if (!level || !seps)
+		goto fail_arrays;
+	
+	for (i = 0; i < nodes; i++) {
+		node = node_alloc(0);
+		if (!node) {
+			while (i--)
+				node_free(level[i]);
+			goto fail_arrays;
+		}
+		n = group_size(count - (nodes - 1), nodes, i, MAX, MIN);
+		node->count = n;
+		node->depth = 0;
+		memcpy(node->item, items, n * sizeof(*items));
+		items += n;
+		if (i < nodes - 1)
+			seps[i] = *items++;
+		level[i] = node;
+	}
+	
+	/*
+	 * Now group each level's nodes (and the separators between them)
+	 * into parents, until there's only one.  We can do this in place,
+	 * since we never write an entry before we have read it.
+	 */
+	for (depth = 1; nodes > 1; depth++) {
+		size_t parents = (nodes + MAX) / (MAX + 1);
+		
+		for (i = 0, c = 0; i < parents; i++) {
+			node = node_alloc(1);
+			if (!node)
+				goto fail;
+			n = group_size(nodes, parents, i, MAX + 1, MIN + 1);
+			node->count = n - 1;
+			node->depth = depth;
+			for (j = 0; j < n; j++) {
+				node->branch[j] = level[c + j];
+				node->branch[j]->parent = node;
+				node->branch[j]->k = j;
+				if (j < n - 1)
+					node->item[j] = seps[c + j];
+			}
+			c += n;
+			level[i] = node;
+			if (i < parents - 1)
+				seps[i] = seps[c - 1];
+		}
+		nodes = parents;
+	}
+	
+	node = level[0];
+	node->parent = NULL;
+	node->k = 0;
+	free(btree->root);
+	btree->root = node;
+	btree->count = count;
+	free(level);
+	free(seps);
+	return true;
+	
+fail:
+	/* level[0..i) are new parents, and level[c..nodes) aren't used yet. */
+	for (j = 0; j < i; j++)
+		node_free(level[j]);
+	for (j = c; j < nodes; j++)
+		node_free(level[j]);
+fail_arrays:
+	free(level);
+	free(seps);
+	return false;
+}
+
 int btree_walk_backward(const struct btree *btree,
 				btree_action_t action, void *ctx)
 {
@@ -353,10 +490,97 @@ finished:
 	return 1;
 }
 
+/* Prefetch the leaf (or, rarely, the subtree) following this one. */
+static void prefetch_next(const struct btree_node *node)
+{
+#if HAVE_BUILTIN_PREFETCH
+	const struct btree_node *parent = node->parent;
+	
+	if (parent && node->k < parent->count) {
+		const char *next = (const char *)parent->branch[node->k + 1];
+		size_t i;
+		
+		for (i = 0; i < PREFETCH_BYTES; i += CACHE_LINE)
+			__builtin_prefetch(next + i);
+	}
+#else
+	(void)node;
+#endif
+}
+
+static void scan_enter(struct btree_scan *scan, struct btree_node *node,
+				unsigned int k)
+{
+	scan->node = node;
+	scan->k = k;
+	scan->stop = node == scan->end_node ? scan->end_k : node->count;
+	prefetch_next(node);
+}
+
+/* Moves an iterator to the equivalent position at the end of a leaf. */
+static void iter_to_leaf(btree_iterator iter)
+{
+	if (iter->node->depth)
+		branch_end(iter);
+}
+
+void btree_scan_init(struct btree_scan *scan,
+			const btree_iterator begin, const btree_iterator end)
+{
+	btree_iterator b = {*begin}, e = {*end};
+	
+	if (btree_cmp_iters(b, e) > 0)
+		*e = *b;
+	iter_to_leaf(b);
+	iter_to_leaf(e);
+	
+	scan->end_node = e->node;
+	scan->end_k = e->k;
+	scan->item = NULL;
+	scan_enter(scan, b->node, b->k);
+}
+
+void btree_scan_range(const struct btree *btree,
+			const void *lo, const void *hi, struct btree_scan *scan)
+{
+	btree_iterator begin, end;
+	
+	btree_find_first(btree, lo, begin);
+	btree_find_first(btree, hi, end);
+	btree_scan_init(scan, begin, end);
+}
+
+/* Called by btree_scan_next when we reach scan->stop. */
+int btree_scan_next_(struct btree_scan *scan)
+{
+	struct btree_node *node = scan->node;
+	unsigned int k;
+	
+	if (node == scan->end_node)
+		return 0;
+	
+	/* We've finished this leaf: the next item is the separator above. */
+	do {
+		k = node->k;
+		node = node->parent;
+		if (!node)
+			return 0;
+	} while (k == node->count);
+	scan->item = (void*)node->item[k];
+	
+	/* After that comes the leftmost leaf of the branch to its right. */
+	node = node->branch[k + 1];
+	while (node->depth)
+		node = node->branch[0];
+	scan_enter(scan, node, 0);
+	return 1;
+}
+
 /*
  * ascends iterator a until it matches iterator b's depth.
  *
- * Returns -1 if they end up on the same k (meaning a < b).
+ * Returns -1 if they end up at the same position (meaning a was in the
+ * branch to the left of b, so a < b).
  * Returns 0 otherwise.
  */
 static int elevate(btree_iterator a, btree_iterator b)
@@ -364,7 +588,7 @@ static int elevate(btree_iterator a, btree_iterator b)
 	while (a->node->depth < b->node->depth)
 		ascend(a);
 	
-	if (a->k == b->k)
+	if (a->node == b->node && a->k == b->k)
 		return -1;
 	return 0;
 }
@@ -423,12 +647,21 @@ btree_search_implement
 
 static struct btree_node *node_alloc(int internal)
 {
-	struct btree_node *node;
 	size_t isize = internal
 		? sizeof(struct btree_node*) * (BTREE_ITEM_MAX+1)
 		: 0;
-	node = malloc(sizeof(struct btree_node) + isize);
+#if HAVE_POSIX_MEMALIGN
+	void *node;
+	size_t size = sizeof(struct btree_node) + isize;
+	
+	/* Round up, so the next node doesn't share our last cache line. */
+	size = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+	if (posix_memalign(&node, NODE_ALIGN, size) != 0)
+		return NULL;
 	return node;
+#else
+	return malloc(sizeof(struct btree_node) + isize);
+#endif
 }
 
 static void node_delete(struct btree_node *node, struct btree *btree)
@@ -452,6 +685,18 @@ static void node_delete(struct btree_node *node, struct btree *btree)
 	free(node);
 }
 
+/* Free node and everything under it, without destroying any items. */
+static void node_free(struct btree_node *node)
+{
+	unsigned int i;
+	
+	if (node->depth) {
+		for (i = 0; i <= node->count; i++)
+			node_free(node->branch[i]);
+	}
+	free(node);
+}
+
 /* Set iter to beginning of branch pointed to by iter. */
 static void branch_begin(btree_iterator iter)
 {
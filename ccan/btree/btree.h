@@ -33,28 +33,42 @@ btree_remove
 btree_lookup
 */
 
+#include "config.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
 /*
- * Maximum number of items per node.
+ * Size of a leaf node in bytes.  Define this (as a plain number, and
+ * identically) before including btree.h and when compiling btree.c to
+ * tune it: a multiple of the cache line size is best for lookups, while
+ * 4096 (one leaf per page) suits long range scans.  It must be at least 64.
+ */
+#ifndef BTREE_NODE_BYTES
+#define BTREE_NODE_BYTES 256
+#endif
+
+/*
+ * Maximum number of items per node.  The node header takes up the first
+ * two words, so a leaf fills exactly BTREE_NODE_BYTES (on 64-bit).
  * The maximum number of branches is BTREE_ITEM_MAX + 1.
  */
-#define BTREE_ITEM_MAX 20
+#define BTREE_ITEM_MAX \
+	((unsigned int)((BTREE_NODE_BYTES - 2 * sizeof(void *)) / sizeof(void *)))
 
 struct btree_node {
 	struct btree_node *parent;
 	
 	/* Number of items (rather than branches). */
-	unsigned char count;
+	unsigned short count;
+	
+	/* node->parent->branch[node->k] == this */
+	unsigned short k;
 	
 	/* 0 if node is a leaf, 1 if it has leaf children, etc. */
 	unsigned char depth;
 	
-	/* node->parent->branch[node->k] == this */
-	unsigned char k;
-	
 	const void *item[BTREE_ITEM_MAX];
 	
 	/*
@@ -122,6 +136,14 @@ struct btree {
 	void *destroy_ctx;
 };
 
+/*
+ * BTREE_NODE_BYTES changes the layout of struct btree_node, so btree_new
+ * is named after it: a caller which disagrees with btree.c fails to link,
+ * rather than corrupting memory.
+ */
+#define BTREE_NEW__(bytes) btree_new_##bytes
+#define BTREE_NEW_(bytes) BTREE_NEW__(bytes)
+#define btree_new BTREE_NEW_(BTREE_NODE_BYTES)
 struct btree *btree_new(btree_search_t search);
 void btree_delete(struct btree *btree);
 
@@ -155,6 +177,21 @@ int btree_begin_end_lr(const struct btree *btree, btree_iterator iter, int lr);
 int btree_find_lr(const struct btree *btree, const void *key,
 				btree_iterator iter, int lr);
 
+/*
+ * Replaces the contents of an empty btree with count items, which must
+ * already be sorted according to btree->search (and must not contain
+ * duplicates unless btree->multi is set).  This is not checked.
+ *
+ * This builds the tree bottom-up in O(count) time, with every leaf full
+ * except (possibly) the last two, so it is much faster than inserting
+ * the items one at a time, and leaves a tree which is faster to scan.
+ *
+ * Returns false if btree is not empty, or if allocation fails (in which
+ * case btree is left empty).
+ */
+bool btree_load_sorted(struct btree *btree,
+				const void * const *items, size_t count);
+
 int btree_walk_backward(const struct btree *btree,
 				btree_action_t action, void *ctx);
 int btree_walk_forward(const struct btree *btree,
@@ -228,6 +265,68 @@ int btree_remove_at(btree_iterator iter);
  */
 int btree_cmp_iters(const btree_iterator iter_a, const btree_iterator iter_b);
 
+/*
+ * A range scan: a cheap forward iterator between two positions.
+ *
+ * Unlike btree_next, which starts from the top of the tree each time it
+ * leaves a node, a scan runs straight through each leaf, and prefetches
+ * the next leaf as it enters one.  Like any iterator, it is invalidated
+ * by insertion or removal.
+ *
+ * Example (given a btree of strings, ordered by btree_strcmp):
+ *	struct btree_scan scan;
+ *
+ *	// Everything from "apple" (inclusive) to "banana" (exclusive).
+ *	btree_scan_range(btree, "apple", "banana", &scan);
+ *	while (btree_scan_next(&scan))
+ *		printf("%s\n", (char *)scan.item);
+ */
+struct btree_scan {
+	struct btree_node *node;
+	unsigned int k;
+	
+	/* Where we have to stop in this node. */
+	unsigned int stop;
+	
+	/* The (leaf) position we finish at. */
+	struct btree_node *end_node;
+	unsigned int end_k;
+	
+	/* Set by btree_scan_next. */
+	void *item;
+};
+
+/*
+ * Starts a scan over the items from begin up to (but not including) end.
+ * If end is before begin, the scan is empty.
+ */
+void btree_scan_init(struct btree_scan *scan,
+			const btree_iterator begin, const btree_iterator end);
+
+/*
+ * Starts a scan over the items which are >= lo and < hi, as determined
+ * by btree->search.  To scan from a typed search (see
+ * btree_find_implement), use that to find the two iterators and call
+ * btree_scan_init.
+ */
+void btree_scan_range(const struct btree *btree,
+			const void *lo, const void *hi, struct btree_scan *scan);
+
+int btree_scan_next_(struct btree_scan *scan);
+
+/*
+ * If the scan has not finished, sets scan->item to the next item and
+ * returns 1.  Otherwise returns 0.
+ */
+static inline int btree_scan_next(struct btree_scan *scan)
+{
+	if (scan->k < scan->stop) {
+		scan->item = (void*)scan->node->item[scan->k++];
+		return 1;
+	}
+	return btree_scan_next_(scan);
+}
+
 #define btree_search_implement(name, type, setup, equals, lessthan) \
 unsigned int name(const void *__key, \
 		const void * const *__base, unsigned int __count, \
@@ -261,4 +360,47 @@ unsigned int name(const void *__key, \
 	return __start; \
 }
 
+/*
+ * btree_find_lr calls btree->search through a function pointer at every
+ * level of the tree.  This defines a function which behaves exactly like
+ * btree_find_lr, but calls search (usually defined with
+ * btree_search_implement in the same file) directly, so the compiler can
+ * inline the comparisons into the descent.
+ *
+ * Example:
+ *	static btree_search_implement(order_u64, const uint64_t *,
+ *				       , *a == *b, *a < *b)
+ *	static btree_find_implement(find_u64, order_u64)
+ *
+ *	static void *lookup_u64(const struct btree *btree, uint64_t key)
+ *	{
+ *		btree_iterator iter;
+ *		return find_u64(btree, &key, iter, 0) ? iter->item : NULL;
+ *	}
+ */
+#define btree_find_implement(name, search) \
+int name(const struct btree *__btree, const void *__key, \
+		btree_iterator __iter, int __lr) \
+{ \
+	struct btree_node *__node = __btree->root; \
+	unsigned int __k, __depth = __node->depth; \
+	int __found = 0; \
+	__iter->btree = (struct btree *)__btree; \
+	__iter->item = NULL; \
+	for (;;) { \
+		int __f = 0; \
+		__k = search(__key, __node->item, __node->count, __lr, &__f); \
+		if (__f) { \
+			__iter->item = (void*)__node->item[__k - __lr]; \
+			__found = 1; \
+		} \
+		if (!__depth--) \
+			break; \
+		__node = __node->branch[__k]; \
+	} \
+	__iter->node = __node; \
+	__iter->k = __k; \
+	return __found; \
+}
+
 #endif /* #ifndef CCAN_BTREE_H */
@@ -0,0 +1,400 @@
+/* MIT (BSD) license - see LICENSE file for details */
+#include <ccan/btree/olc/olc.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define MAX (BTREE_ITEM_MAX)
+#define MIN (BTREE_ITEM_MAX >> 1)
+
+#define CACHE_LINE 64
+
+/* Readers race with writers on these: the version tells them to retry. */
+static unsigned int get_count(const struct btree_olc_node *node)
+{
+	return atomic_load_explicit(&node->count, memory_order_relaxed);
+}
+
+static void set_count(struct btree_olc_node *node, unsigned int count)
+{
+	atomic_store_explicit(&node->count, count, memory_order_relaxed);
+}
+
+static const void *get_item(const struct btree_olc_node *node, unsigned int i)
+{
+	return atomic_load_explicit(&node->item[i], memory_order_relaxed);
+}
+
+static void set_item(struct btree_olc_node *node, unsigned int i,
+		     const void *item)
+{
+	atomic_store_explicit(&node->item[i], item, memory_order_relaxed);
+}
+
+static struct btree_olc_node *get_branch(const struct btree_olc_node *node,
+					 unsigned int i)
+{
+	return atomic_load_explicit(&node->branch[i], memory_order_relaxed);
+}
+
+static void set_branch(struct btree_olc_node *node, unsigned int i,
+		       struct btree_olc_node *branch)
+{
+	atomic_store_explicit(&node->branch[i], branch, memory_order_relaxed);
+}
+
+static struct btree_olc_node *node_alloc(unsigned int depth)
+{
+	struct btree_olc_node *node;
+	size_t size = sizeof(*node)
+		+ (depth ? sizeof(struct btree_olc_node *) * (MAX + 1) : 0);
+
+#if HAVE_POSIX_MEMALIGN
+	void *mem;
+
+	/* Nodes are written by different threads: don't share lines. */
+	size = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+	if (posix_memalign(&mem, CACHE_LINE, size) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	node = mem;
+#else
+	node = malloc(size);
+	if (!node)
+		return NULL;
+#endif
+	atomic_init(&node->version, 0);
+	atomic_init(&node->count, 0);
+	node->depth = depth;
+	return node;
+}
+
+/* Wait until nobody is writing node, and return its version. */
+static uint64_t read_lock(struct btree_olc_node *node)
+{
+	unsigned int spins = 0;
+	uint64_t v;
+
+	while ((v = atomic_load_explicit(&node->version,
+					 memory_order_acquire)) & 1) {
+		if (++spins % 128 == 0)
+			sched_yield();
+	}
+	return v;
+}
+
+/* Has node been written since we read version v? */
+static bool changed(struct btree_olc_node *node, uint64_t v)
+{
+	/* Everything we read from the node must be done before we check. */
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&node->version, memory_order_relaxed) != v;
+}
+
+/* Lock node for writing, if it hasn't been written since version v. */
+static bool upgrade(struct btree_olc_node *node, uint64_t v)
+{
+	if (!atomic_compare_exchange_strong_explicit(&node->version,
+						     &v, v + 1,
+						     memory_order_acquire,
+						     memory_order_relaxed))
+		return false;
+	/* A reader who sees any of our writes must then see us locked. */
+	atomic_thread_fence(memory_order_release);
+	return true;
+}
+
+static void write_unlock(struct btree_olc_node *node)
+{
+	atomic_fetch_add_explicit(&node->version, 1, memory_order_release);
+}
+
+/*
+ * Copy node's items, so the search function sees a consistent set (once
+ * we've checked the version) and never one which is being shifted.
+ */
+static unsigned int snapshot(const struct btree_olc_node *node,
+			     const void **items)
+{
+	/* A writer may change it: make sure we only read it once. */
+	unsigned int i, count = get_count(node);
+
+	if (count > MAX)
+		count = MAX;
+	for (i = 0; i < count; i++)
+		items[i] = get_item(node, i);
+	return count;
+}
+
+static struct btree_olc_node *get_root(const struct btree_olc *btree)
+{
+	return atomic_load_explicit(&btree->root, memory_order_acquire);
+}
+
+/* Get the root, once we're sure it still is the root. */
+static struct btree_olc_node *lock_root(const struct btree_olc *btree,
+					uint64_t *v)
+{
+	struct btree_olc_node *root;
+
+	do {
+		root = get_root(btree);
+		*v = read_lock(root);
+	} while (root != get_root(btree));
+	return root;
+}
+
+/* Inserts item x and right branch xr at position k in (locked) node p. */
+static void node_insert(struct btree_olc_node *p, unsigned int k,
+			const void *x, struct btree_olc_node *xr)
+{
+	unsigned int i, count = get_count(p);
+
+	for (i = count; i > k; i--)
+		set_item(p, i, get_item(p, i - 1));
+	set_item(p, k, x);
+	if (p->depth) {
+		for (i = count + 1; i > k + 1; i--)
+			set_branch(p, i, get_branch(p, i - 1));
+		set_branch(p, k + 1, xr);
+	}
+	set_count(p, count + 1);
+}
+
+/*
+ * Split full node (at version v) in two, pushing the median up into
+ * parent (at version pv, where node is branch pk), or into a new root.
+ *
+ * Returns false if we ran out of memory; otherwise the caller restarts,
+ * whether the split happened or someone else got there first.
+ */
+static bool split(struct btree_olc *btree,
+		  struct btree_olc_node *parent, uint64_t pv, unsigned int pk,
+		  struct btree_olc_node *node, uint64_t v)
+{
+	struct btree_olc_node *right, *root = NULL;
+	const void *median;
+	unsigned int i;
+
+	if (parent && !upgrade(parent, pv))
+		return true;
+	if (!upgrade(node, v)) {
+		if (parent)
+			write_unlock(parent);
+		return true;
+	}
+
+	right = node_alloc(node->depth);
+	if (!parent)
+		root = node_alloc(node->depth + 1);
+	if (!right || (!parent && !root)) {
+		free(right);
+		free(root);
+		write_unlock(node);
+		if (parent)
+			write_unlock(parent);
+		errno = ENOMEM;
+		return false;
+	}
+
+	/* Left keeps item[0..MIN), item[MIN] goes up, right gets the rest. */
+	median = get_item(node, MIN);
+	for (i = MIN + 1; i < MAX; i++)
+		set_item(right, i - (MIN + 1), get_item(node, i));
+	if (node->depth)
+		for (i = MIN + 1; i <= MAX; i++)
+			set_branch(right, i - (MIN + 1), get_branch(node, i));
+	set_count(right, MAX - MIN - 1);
+	set_count(node, MIN);
+
+	if (parent) {
+		node_insert(parent, pk, median, right);
+	} else {
+		set_count(root, 1);
+		set_item(root, 0, median);
+		set_branch(root, 0, node);
+		set_branch(root, 1, right);
+		/* Before we unlock node, so readers who see it notice. */
+		atomic_store_explicit(&btree->root, root, memory_order_release);
+	}
+
+	write_unlock(node);
+	if (parent)
+		write_unlock(parent);
+	return true;
+}
+
+struct btree_olc *btree_olc_new(btree_search_t search)
+{
+	struct btree_olc *btree = calloc(1, sizeof(*btree));
+	struct btree_olc_node *root;
+
+	if (!btree)
+		return NULL;
+	root = node_alloc(0);
+	if (!root) {
+		free(btree);
+		return NULL;
+	}
+	atomic_init(&btree->root, root);
+	btree->search = search;
+	btree->multi = false;
+	return btree;
+}
+
+static void node_delete(struct btree_olc_node *node, struct btree_olc *btree)
+{
+	unsigned int i, count = get_count(node);
+
+	for (i = 0; i < count; i++) {
+		if (node->depth)
+			node_delete(get_branch(node, i), btree);
+		if (btree->destroy)
+			btree->destroy((void *)get_item(node, i),
+				       btree->destroy_ctx);
+	}
+	if (node->depth)
+		node_delete(get_branch(node, count), btree);
+	free(node);
+}
+
+void btree_olc_delete(struct btree_olc *btree)
+{
+	node_delete(get_root(btree), btree);
+	free(btree);
+}
+
+bool btree_olc_insert(struct btree_olc *btree, const void *item)
+{
+	const void *items[MAX];
+	struct btree_olc_node *node, *parent, *child;
+	uint64_t v, pv = 0, cv;
+	unsigned int count, k, pk = 0;
+	int found;
+
+restart:
+	parent = NULL;
+	node = lock_root(btree, &v);
+
+	for (;;) {
+		count = snapshot(node, items);
+		if (changed(node, v))
+			goto restart;
+
+		/*
+		 * Split full nodes on the way down, so the parent of any node
+		 * we split always has room for the median.
+		 */
+		if (count == MAX) {
+			if (!split(btree, parent, pv, pk, node, v))
+				return false;
+			goto restart;
+		}
+
+		found = 0;
+		k = btree->search(item, items, count, 1, &found);
+		if (found && !btree->multi) {
+			errno = EEXIST;
+			return false;
+		}
+
+		if (!node->depth) {
+			if (!upgrade(node, v))
+				goto restart;
+			node_insert(node, k, item, NULL);
+			write_unlock(node);
+			return true;
+		}
+
+		/* Lock coupling: check node is unchanged at every step. */
+		child = get_branch(node, k);
+		if (changed(node, v))
+			goto restart;
+		cv = read_lock(child);
+		if (changed(node, v))
+			goto restart;
+
+		parent = node;
+		pv = v;
+		pk = k;
+		node = child;
+		v = cv;
+	}
+}
+
+bool btree_olc_find(const struct btree_olc *btree, const void *key, int lr,
+		    void **itemp)
+{
+	const void *items[MAX], *item = NULL;
+	struct btree_olc_node *node, *child;
+	uint64_t v, cv;
+	unsigned int count, k;
+	int found;
+
+restart:
+	found = 0;
+	node = lock_root(btree, &v);
+
+	for (;;) {
+		int f = 0;
+
+		count = snapshot(node, items);
+		if (changed(node, v))
+			goto restart;
+
+		/* This is btree_find_lr, on our copy of the items. */
+		k = btree->search(key, items, count, lr, &f);
+		if (f) {
+			item = items[k - lr];
+			found = 1;
+		}
+		if (!node->depth)
+			break;
+
+		child = get_branch(node, k);
+		if (changed(node, v))
+			goto restart;
+		cv = read_lock(child);
+		if (changed(node, v))
+			goto restart;
+
+		node = child;
+		v = cv;
+	}
+
+	if (found)
+		*itemp = (void *)item;
+	return found;
+}
+
+void *btree_olc_lookup(const struct btree_olc *btree, const void *key)
+{
+	void *item;
+
+	if (btree_olc_find(btree, key, 0, &item))
+		return item;
+	return NULL;
+}
+
+static int node_walk(const struct btree_olc_node *node,
+		     btree_action_t action, void *ctx)
+{
+	unsigned int i, count = get_count(node);
+
+	for (i = 0; i < count; i++) {
+		if (node->depth && !node_walk(get_branch(node, i), action, ctx))
+			return 0;
+		if (!action((void *)get_item(node, i), ctx))
+			return 0;
+	}
+	if (node->depth)
+		return node_walk(get_branch(node, count), action, ctx);
+	return 1;
+}
+
+int btree_olc_walk(const struct btree_olc *btree,
+		   btree_action_t action, void *ctx)
+{
+	return node_walk(get_root(btree), action, ctx);
+}
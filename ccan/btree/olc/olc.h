@@ -0,0 +1,104 @@
+/* MIT (BSD) license - see LICENSE file for details */
+#ifndef CCAN_BTREE_OLC_H
+#define CCAN_BTREE_OLC_H
+#include "config.h"
+#include <ccan/btree/btree.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The same layout as struct btree_node, except that there are no parent
+ * pointers (which writers would have to keep up to date under a lock):
+ * that word holds a version counter instead.
+ *
+ * The bottom bit of the version is set while the node is being written;
+ * every write adds 2.  Readers never write to a node: they note the
+ * version, read the node, and start again if the version changed.  Since
+ * they read while writers write, count, item and branch are atomic (and
+ * accessed relaxed: the version orders them).  depth never changes.
+ */
+struct btree_olc_node {
+	_Atomic(uint64_t) version;
+
+	/* Number of items (rather than branches). */
+	_Atomic(unsigned short) count;
+
+	/* 0 if node is a leaf, 1 if it has leaf children, etc. */
+	unsigned char depth;
+
+	_Atomic(const void *) item[BTREE_ITEM_MAX];
+
+	/*
+	 * Allocated to BTREE_ITEM_MAX+1 items if this is
+	 * an internal node, 0 items if it is a leaf.
+	 */
+	_Atomic(struct btree_olc_node *) branch[];
+};
+
+/*
+ * A B-tree which any number of threads can search and insert into at
+ * once, using optimistic lock coupling: lookups take no locks at all,
+ * and inserts only lock the one or two nodes they change.
+ *
+ * Items can't be removed while other threads are using the tree (nodes
+ * are only ever freed by btree_olc_delete, so readers can't trip over a
+ * freed one).  The search function may be called on items which are
+ * being moved by another thread, but only ever on items which were
+ * inserted into the tree.
+ */
+struct btree_olc {
+	_Atomic(struct btree_olc_node *) root;
+
+	btree_search_t search;
+	bool multi;
+
+	/* As for struct btree: called on each item by btree_olc_delete(). */
+	btree_action_t destroy;
+	void *destroy_ctx;
+};
+
+/*
+ * Returns NULL if out of memory.  Set btree->multi before sharing the
+ * tree if you want duplicates.
+ */
+struct btree_olc *btree_olc_new(btree_search_t search);
+
+/* Frees the tree: no other thread may be using it. */
+void btree_olc_delete(struct btree_olc *btree);
+
+/*
+ * Inserts an item into the btree.  As for btree_insert, if an equal item
+ * is already there and btree->multi is false, returns false and doesn't
+ * insert it.  If btree->multi is true, it goes after its duplicates.
+ *
+ * Also returns false (with errno = ENOMEM) if allocation fails.
+ *
+ * Safe to call concurrently with btree_olc_insert and btree_olc_find.
+ */
+bool btree_olc_insert(struct btree_olc *btree, const void *item);
+
+/*
+ * Finds an item equal to key: the first one if lr is 0, the last if lr is
+ * 1 (these only differ if btree->multi is set).  Returns true and sets
+ * *itemp if it's found, otherwise returns false.
+ *
+ * Safe to call concurrently with btree_olc_insert and btree_olc_find.
+ */
+bool btree_olc_find(const struct btree_olc *btree, const void *key, int lr,
+				void **itemp);
+
+/*
+ * Returns the first item equal to key, or NULL if there isn't one, like
+ * btree_lookup.  Use btree_olc_find if you need to put NULLs in the tree.
+ */
+void *btree_olc_lookup(const struct btree_olc *btree, const void *key);
+
+/*
+ * Walks the items in order, as btree_walk_forward does.  This is not safe
+ * to call while another thread is inserting.
+ */
+int btree_olc_walk(const struct btree_olc *btree,
+				btree_action_t action, void *ctx);
+
+#endif /* CCAN_BTREE_OLC_H */
@@ -0,0 +1,100 @@
+#include <ccan/btree/olc/olc.h>
+/* Include the C files directly. */
+#include <ccan/btree/olc/olc.c>
+#include <ccan/tap/tap.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define WRITERS 4
+#define READERS 4
+#define NUM 50000
+
+static btree_search_implement(order_by_ptr, size_t*, , a == b, a < b)
+
+static struct btree_olc *btree;
+/* Even keys are there from the start; writers add the odd ones. */
+static size_t key[2 * WRITERS * NUM];
+static atomic_int writers_done;
+
+static void *writer(void *arg)
+{
+	size_t i, t = (size_t)arg;
+	int ok = 1;
+
+	/* Interleave the threads, so they fight over the same leaves. */
+	for (i = 0; i < NUM; i++)
+		if (!btree_olc_insert(btree, &key[2 * (i * WRITERS + t) + 1]))
+			ok = 0;
+	atomic_fetch_add(&writers_done, 1);
+	return ok ? arg : NULL;
+}
+
+/* Inserts must never make an existing item disappear. */
+static void *reader(void *arg)
+{
+	size_t i = (size_t)arg, misses = 0;
+
+	do {
+		i = (i * 1103515245 + 12345) % (WRITERS * NUM);
+		if (btree_olc_lookup(btree, &key[2 * i]) != &key[2 * i])
+			misses++;
+	} while (atomic_load(&writers_done) != WRITERS);
+	return (void *)misses;
+}
+
+struct walk {
+	size_t n;
+	int ok;
+};
+
+static int check_item(size_t *item, struct walk *w)
+{
+	if (item != &key[w->n])
+		w->ok = 0;
+	w->n++;
+	return 1;
+}
+
+int main(void)
+{
+	pthread_t w[WRITERS], r[READERS];
+	size_t i, misses = 0;
+	int ok = 1;
+	struct walk walk = { 0, 1 };
+	void *ret;
+
+	plan_tests(5);
+
+	btree = btree_olc_new(order_by_ptr);
+	for (i = 0; i < WRITERS * NUM; i++)
+		btree_olc_insert(btree, &key[2 * i]);
+
+	for (i = 0; i < READERS; i++)
+		pthread_create(&r[i], NULL, reader, (void *)(i + 1));
+	for (i = 0; i < WRITERS; i++)
+		pthread_create(&w[i], NULL, writer, (void *)i);
+
+	for (i = 0; i < WRITERS; i++) {
+		pthread_join(w[i], &ret);
+		if (ret != (void *)i)
+			ok = 0;
+	}
+	for (i = 0; i < READERS; i++) {
+		pthread_join(r[i], &ret);
+		misses += (size_t)ret;
+	}
+	ok1(ok);
+	ok1(misses == 0);
+
+	for (i = 0; i < 2 * WRITERS * NUM; i++)
+		if (btree_olc_lookup(btree, &key[i]) != &key[i])
+			break;
+	ok1(i == 2 * WRITERS * NUM);
+	ok1(btree_olc_walk(btree, (btree_action_t)check_item, &walk));
+	ok1(walk.ok && walk.n == 2 * WRITERS * NUM);
+	btree_olc_delete(btree);
+
+	return exit_status();
+}
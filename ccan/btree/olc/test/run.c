@@ -0,0 +1,112 @@
+#include <ccan/btree/olc/olc.h>
+/* Include the C files directly. */
+#include <ccan/btree/olc/olc.c>
+#include <ccan/tap/tap.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define NUM 100000
+
+static btree_search_implement(order_by_ptr, size_t*, , a == b, a < b)
+
+struct walk {
+	size_t *key;
+	size_t n;
+	int ok;
+};
+
+/* Every item should be in order, with multi duplicates of each. */
+static int check_item(size_t *item, struct walk *w)
+{
+	if (item != &w->key[w->n / (*item)])
+		w->ok = 0;
+	w->n++;
+	return 1;
+}
+
+static int count_destroy(void *item, size_t *destroyed)
+{
+	(*destroyed)++;
+	return 1;
+}
+
+int main(void)
+{
+	static size_t key[NUM + 1];
+	struct btree_olc *btree;
+	struct walk w;
+	size_t i, destroyed = 0;
+	int ok = 1;
+	void *item;
+
+	plan_tests(14);
+
+	btree = btree_olc_new(order_by_ptr);
+	ok1(btree_olc_lookup(btree, &key[0]) == NULL);
+	ok1(!btree_olc_find(btree, &key[0], 1, &item));
+
+	/* Insert in a scrambled order, so nodes split everywhere. */
+	for (i = 0; i < NUM; i++) {
+		size_t k = (i * 7919) % NUM;
+		key[k] = 1;
+		if (!btree_olc_insert(btree, &key[k]))
+			ok = 0;
+	}
+	ok1(ok);
+
+	for (i = 0; i < NUM; i++)
+		if (btree_olc_lookup(btree, &key[i]) != &key[i])
+			break;
+	ok1(i == NUM);
+	ok1(btree_olc_lookup(btree, &key[NUM]) == NULL);
+
+	/* Duplicates are refused. */
+	ok1(!btree_olc_insert(btree, &key[NUM / 2]) && errno == EEXIST);
+
+	w.key = key;
+	w.n = 0;
+	w.ok = 1;
+	ok1(btree_olc_walk(btree, (btree_action_t)check_item, &w));
+	ok1(w.ok && w.n == NUM);
+
+	btree->destroy = (btree_action_t)count_destroy;
+	btree->destroy_ctx = &destroyed;
+	btree_olc_delete(btree);
+	ok1(destroyed == NUM);
+
+	/* Now with three of each. */
+	btree = btree_olc_new(order_by_ptr);
+	btree->multi = true;
+	for (i = 0; i < NUM; i++) {
+		size_t k = (i * 7919) % NUM;
+		key[k] = 3;
+		if (!btree_olc_insert(btree, &key[k])
+		    || !btree_olc_insert(btree, &key[k])
+		    || !btree_olc_insert(btree, &key[k]))
+			ok = 0;
+	}
+	ok1(ok);
+	for (i = 0; i < NUM; i++) {
+		if (!btree_olc_find(btree, &key[i], 0, &item) || item != &key[i])
+			break;
+		if (!btree_olc_find(btree, &key[i], 1, &item) || item != &key[i])
+			break;
+	}
+	ok1(i == NUM);
+	ok1(!btree_olc_find(btree, &key[NUM], 0, &item));
+	w.n = 0;
+	w.ok = 1;
+	btree_olc_walk(btree, (btree_action_t)check_item, &w);
+	ok1(w.ok && w.n == 3 * NUM);
+	btree_olc_delete(btree);
+
+	/* An empty one is fine, too. */
+	btree = btree_olc_new(order_by_ptr);
+	w.n = 0;
+	btree_olc_walk(btree, (btree_action_t)check_item, &w);
+	ok1(w.n == 0);
+	btree_olc_delete(btree);
+
+	return exit_status();
+}
@@ -0,0 +1,132 @@
+/*
+ * Multi-threaded speed test: btree/olc against a btree behind a
+ * pthread rwlock, for a mix of lookups and inserts.
+ *
+ * Usage: speed [keys] [ops-per-thread] [max-threads]
+ */
+#include <ccan/btree/olc/olc.h>
+#include <ccan/time/time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static btree_search_implement(order_u64, const uint64_t *, ,
+			      *a == *b, *a < *b)
+
+/* Even keys are loaded first; threads insert odd ones. */
+static uint64_t *keys;
+static size_t num, ops;
+static unsigned int write_percent;
+
+static struct btree_olc *olc;
+static struct btree *locked;
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+struct thread {
+	pthread_t id;
+	unsigned int t, nthreads;
+	bool use_olc;
+};
+
+static void *run(void *arg)
+{
+	const struct thread *me = arg;
+	uint64_t r = me->t * 2654435761U + 1;
+	/* Each thread inserts its own odd keys, in a scattered order. */
+	size_t next = me->t, i;
+
+	for (i = 0; i < ops; i++) {
+		r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+		if ((r >> 33) % 100 < write_percent) {
+			uint64_t *k;
+
+			k = &keys[2 * ((next * 7919) % num) + 1];
+			next += me->nthreads;
+			if (me->use_olc)
+				btree_olc_insert(olc, k);
+			else {
+				pthread_rwlock_wrlock(&lock);
+				btree_insert(locked, k);
+				pthread_rwlock_unlock(&lock);
+			}
+		} else {
+			uint64_t *k = &keys[2 * ((r >> 20) % num)];
+
+			if (me->use_olc) {
+				if (btree_olc_lookup(olc, k) != k)
+					abort();
+			} else {
+				pthread_rwlock_rdlock(&lock);
+				if (btree_lookup(locked, k) != k)
+					abort();
+				pthread_rwlock_unlock(&lock);
+			}
+		}
+	}
+	return NULL;
+}
+
+static double bench(bool use_olc, unsigned int nthreads)
+{
+	struct thread *threads = calloc(nthreads, sizeof(*threads));
+	struct timeabs start;
+	size_t i;
+
+	if (use_olc) {
+		olc = btree_olc_new(order_u64);
+		for (i = 0; i < num; i++)
+			btree_olc_insert(olc, &keys[2 * i]);
+	} else {
+		locked = btree_new(order_u64);
+		for (i = 0; i < num; i++)
+			btree_insert(locked, &keys[2 * i]);
+	}
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].t = i;
+		threads[i].nthreads = nthreads;
+		threads[i].use_olc = use_olc;
+		pthread_create(&threads[i].id, NULL, run, &threads[i]);
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i].id, NULL);
+
+	if (use_olc)
+		btree_olc_delete(olc);
+	else
+		btree_delete(locked);
+	free(threads);
+
+	/* Millions of operations per second. */
+	return (double)nthreads * ops
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int mixes[] = { 0, 5, 50 }, max_threads, n, m;
+	size_t i;
+
+	num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+	max_threads = argc > 3 ? atoi(argv[3]) : 32;
+
+	keys = malloc(2 * num * sizeof(*keys));
+	for (i = 0; i < 2 * num; i++)
+		keys[i] = i;
+
+	printf("%zu keys, %zu ops per thread (Mops/sec)\n", num, ops);
+	for (m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+		write_percent = mixes[m];
+		printf("%u%% inserts:\n", write_percent);
+		printf("threads\tolc\trwlock\n");
+		for (n = 1; n <= max_threads; n *= 2) {
+			double o = bench(true, n);
+			double l = bench(false, n);
+			printf("%u\t%.2f\t%.2f\n", n, o, l);
+		}
+	}
+	free(keys);
+	return 0;
+}
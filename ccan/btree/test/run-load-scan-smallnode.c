@@ -0,0 +1,3 @@
+/* Same tests, with the smallest nodes (six items) so trees get deep. */
+#define BTREE_NODE_BYTES 64
+#include "run-load-scan.c"
@@ -0,0 +1,179 @@
+/* Include the main header first, to test it works */
+#include <ccan/btree/btree.h>
+/* Include the C files directly. */
+#include <ccan/btree/btree.c>
+#include <ccan/tap/tap.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t rand32_state = 0;
+
+/*
+ * Finds a pseudorandom 32-bit number from 0 to 2^32-1 .
+ * Uses the BCPL linear congruential generator method.
+ */
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+static btree_search_implement(order_by_ptr, size_t*, , a == b, a < b)
+static btree_find_implement(find_by_ptr, order_by_ptr)
+
+static int node_ok(struct btree_node *node, struct btree_node *parent,
+			size_t *count)
+{
+	unsigned int i;
+	
+	if (node->parent != parent)
+		return 0;
+	if (parent) {
+		if (node->depth != parent->depth - 1)
+			return 0;
+		if (node != parent->branch[node->k])
+			return 0;
+		/* Only the root may fall below the minimum. */
+		if (node->count < MIN)
+			return 0;
+	}
+	if (node->count > MAX)
+		return 0;
+	if (node->depth) {
+		if (node->count == 0)
+			return 0;
+		for (i = 0; i <= node->count; i++)
+			if (!node_ok(node->branch[i], node, count))
+				return 0;
+	}
+	*count += node->count;
+	return 1;
+}
+
+/* Is the tree well-formed, and does it hold exactly key[0..count)? */
+static int tree_ok(struct btree *btree, size_t key[], size_t count)
+{
+	btree_iterator iter;
+	size_t n = 0, i = 0;
+	
+	if (!node_ok(btree->root, NULL, &n) || n != count || btree->count != count)
+		return 0;
+	for (btree_begin(btree, iter); btree_next(iter); i++)
+		if (iter->item != &key[i])
+			return 0;
+	return i == count;
+}
+
+/* Does a scan from key[lo] to key[hi] give exactly those items? */
+static int scan_ok(struct btree *btree, size_t key[], size_t lo, size_t hi)
+{
+	struct btree_scan scan;
+	size_t i = lo;
+	
+	btree_scan_range(btree, &key[lo], &key[hi], &scan);
+	while (btree_scan_next(&scan)) {
+		if (i >= hi || scan.item != &key[i])
+			return 0;
+		i++;
+	}
+	return i == hi || (lo > hi && i == lo);
+}
+
+/* Does the typed find agree with btree_find_lr everywhere? */
+static int find_ok(struct btree *btree, size_t key[], size_t count)
+{
+	btree_iterator a, b;
+	size_t i;
+	int lr;
+	
+	for (i = 0; i < count; i++) {
+		for (lr = 0; lr < 2; lr++) {
+			if (btree_find_lr(btree, &key[i], a, lr)
+			    != find_by_ptr(btree, &key[i], b, lr))
+				return 0;
+			if (a->node != b->node || a->k != b->k
+			    || a->item != b->item || a->item != &key[i])
+				return 0;
+		}
+	}
+	return 1;
+}
+
+int main(void)
+{
+	size_t max = 3 * (MAX + 1) * (MAX + 1), big = 100000;
+	size_t *key = calloc(big + 1, sizeof(*key));
+	const void **items = malloc((big + 1) * sizeof(*items));
+	struct btree *btree;
+	struct btree_scan scan;
+	btree_iterator begin, end;
+	size_t count, i, n;
+	int loaded = 1, scanned = 1, found = 1, changed = 1;
+	
+	plan_tests(9);
+	
+	for (i = 0; i <= big; i++)
+		items[i] = &key[i];
+	
+	/* Every size through three levels, so every way of evening out. */
+	for (count = 0; count <= max; count++) {
+		btree = btree_new(order_by_ptr);
+		if (!btree_load_sorted(btree, items, count)
+		    || !tree_ok(btree, key, count))
+			loaded = 0;
+		for (i = 0; i < 10 && count; i++) {
+			size_t lo = rand32() % (count + 1);
+			size_t hi = rand32() % (count + 1);
+			if (!scan_ok(btree, key, lo, hi))
+				scanned = 0;
+		}
+		if (count % 97 == 0 && !find_ok(btree, key, count))
+			found = 0;
+		btree_delete(btree);
+	}
+	ok1(loaded);
+	ok1(scanned);
+	ok1(found);
+	
+	/* A big one: scan everything, and check every leaf is full. */
+	btree = btree_new(order_by_ptr);
+	ok1(btree_load_sorted(btree, items, big) && tree_ok(btree, key, big));
+	btree_begin(btree, begin);
+	btree_end(btree, end);
+	btree_scan_init(&scan, begin, end);
+	for (n = 0; btree_scan_next(&scan); n++)
+		if (scan.item != &key[n])
+			break;
+	ok1(n == big);
+	
+	/* Only an empty tree can be loaded. */
+	ok1(!btree_load_sorted(btree, items, 1) && btree->count == big);
+	
+	/* It's an ordinary btree after that. */
+	for (i = 0; i < 10000; i++) {
+		size_t k = rand32() % big;
+		btree_remove(btree, &key[k]);
+		if (!btree_insert(btree, &key[k]))
+			changed = 0;
+	}
+	ok1(changed && tree_ok(btree, key, big));
+	btree_delete(btree);
+	
+	/* Empty trees scan as empty. */
+	btree = btree_new(order_by_ptr);
+	btree_scan_range(btree, &key[0], &key[1], &scan);
+	ok1(!btree_scan_next(&scan));
+	btree_begin(btree, begin);
+	btree_end(btree, end);
+	btree_scan_init(&scan, begin, end);
+	ok1(!btree_scan_next(&scan));
+	btree_delete(btree);
+	
+	free(items);
+	free(key);
+	return exit_status();
+}
@@ -0,0 +1,138 @@
+/* Speed tests for btree: bulk loading, lookups and range scans. */
+#include <ccan/btree/btree.h>
+#include <ccan/time/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+static btree_search_implement(order_u64, const uint64_t *, ,
+			      *a == *b, *a < *b)
+static btree_find_implement(find_u64, order_u64)
+
+static uint64_t rand64(void)
+{
+	return ((uint64_t)random() << 33) ^ ((uint64_t)random() << 11)
+		^ random();
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t *ka = a, *kb = b;
+	return *ka < *kb ? -1 : *ka > *kb;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	size_t runs = 10000, len = 1000, i, j, sum = 0;
+	uint64_t *keys = malloc(num * sizeof(*keys));
+	const void **items = malloc(num * sizeof(*items));
+	size_t *order = malloc(num * sizeof(*order));
+	struct btree *btree;
+	btree_iterator iter, end;
+	struct btree_scan scan;
+
+	if (!keys || !items || !order)
+		abort();
+	printf("%zu keys, %u items per node\n", num, BTREE_ITEM_MAX);
+
+	for (i = 0; i < num; i++)
+		keys[i] = rand64();
+	qsort(keys, num, sizeof(*keys), cmp_u64);
+	for (i = 0; i < num; i++) {
+		items[i] = &keys[i];
+		order[i] = i;
+	}
+	for (i = num - 1; i > 0; i--) {
+		size_t tmp, r = random() % (i + 1);
+		tmp = order[i];
+		order[i] = order[r];
+		order[r] = tmp;
+	}
+
+	btree = btree_new(order_u64);
+	TIME("insert (random order)", num,
+	     for (i = 0; i < num; i++)
+		     btree_insert(btree, &keys[order[i]]));
+	btree_delete(btree);
+
+	btree = btree_new(order_u64);
+	TIME("insert (sorted order)", num,
+	     for (i = 0; i < num; i++)
+		     btree_insert(btree, &keys[i]));
+	btree_delete(btree);
+
+	btree = btree_new(order_u64);
+	TIME("btree_load_sorted", num,
+	     if (!btree_load_sorted(btree, items, num))
+		     abort());
+
+	TIME("lookup (btree_find)", num,
+	     for (i = 0; i < num; i++)
+		     if (!btree_find(btree, &keys[order[i]], iter))
+			     abort());
+	TIME("lookup (btree_find_implement)", num,
+	     for (i = 0; i < num; i++)
+		     if (!find_u64(btree, &keys[order[i]], iter, 0))
+			     abort());
+
+	/* Random ranges of len keys each. */
+	TIME("range of 1000 (btree_next), per key", runs * len,
+	     for (i = 0; i < runs; i++) {
+		     size_t start = order[i % num] % (num - len);
+		     find_u64(btree, &keys[start], iter, 0);
+		     find_u64(btree, &keys[start + len], end, 0);
+		     while (btree_cmp_iters(iter, end) < 0
+			    && btree_next(iter))
+			     sum += *(uint64_t *)iter->item;
+	     });
+	TIME("range of 1000 (btree_scan), per key", runs * len,
+	     for (i = 0; i < runs; i++) {
+		     size_t start = order[i % num] % (num - len);
+		     find_u64(btree, &keys[start], iter, 0);
+		     find_u64(btree, &keys[start + len], end, 0);
+		     btree_scan_init(&scan, iter, end);
+		     while (btree_scan_next(&scan))
+			     sum += *(uint64_t *)scan.item;
+	     });
+
+	TIME("full walk (btree_next), per key", num,
+	     for (btree_begin(btree, iter); btree_next(iter);)
+		     sum += *(uint64_t *)iter->item);
+	TIME("full walk (btree_scan), per key", num,
+	     btree_begin(btree, iter);
+	     btree_end(btree, end);
+	     btree_scan_init(&scan, iter, end);
+	     for (j = 0; btree_scan_next(&scan); j++)
+		     sum += *(uint64_t *)scan.item);
+	if (j != num)
+		abort();
+	btree_delete(btree);
+
+	/* Make sure the compiler can't discard the sums. */
+	if (sum == 42)
+		printf("(sum %zu)\n", sum);
+
+	free(order);
+	free(items);
+	free(keys);
+	return 0;
+}
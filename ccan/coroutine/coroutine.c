@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
 
 #include <unistd.h>
 #include <sys/mman.h>
@@ -93,6 +95,10 @@ struct coroutine_stack *coroutine_stack_alloc(size_t totalsize, size_t metasize)
 		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 	if (map == MAP_FAILED)
 		return NULL;
+#ifdef MADV_NOHUGEPAGE
+	/* So coroutine_stack_hwm() sees which pages were really touched. */
+	madvise(map, mapsize, MADV_NOHUGEPAGE);
+#endif
 
 #if HAVE_STACK_GROWS_UPWARDS
 	guard = map + mapsize - pgsz;
@@ -133,6 +139,198 @@ static void coroutine_stack_free(struct coroutine_stack *stack, size_t metasize)
 	munmap(map, mapsize);
 }
 
+/*
+ * The shared pool: one per power-of-2 size class, of whole slots carved
+ * from big mappings which are never unmapped.  Each slot is a power-of-2
+ * stack with a page beyond its end.  That page is a guard where the kernel
+ * has lightweight guard regions: unlike mprotect(), these don't split the
+ * mapping, so they don't use up vm.max_map_count with many stacks.  If
+ * it doesn't, coroutine_stack_check() looks at how deep stacks have been
+ * used instead.  A few released slots are kept committed, for the next
+ * allocations; the rest are decommitted and kept in an array.
+ */
+#define POOL_MIN_SHIFT		13	/* 8k */
+#define POOL_MAX_SHIFT		20	/* COROUTINE_STACK_POOL_MAX */
+#define POOL_CLASSES		(POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_MAP_MIN		(1024 * 1024)
+#define POOL_MAP_SLOTS		16
+#define POOL_WARM		16
+
+#if defined(__linux__) && !defined(MADV_GUARD_INSTALL)
+#define MADV_GUARD_INSTALL	102	/* Linux 6.13 */
+#endif
+
+static struct coroutine_stack_pool {
+	atomic_flag lock;
+	void *warm[POOL_WARM];
+	size_t nwarm;
+	void **free;
+	size_t nfree, maxfree;
+} pool[POOL_CLASSES];
+
+static void pool_lock(struct coroutine_stack_pool *p)
+{
+	unsigned int spins = 0;
+
+	while (atomic_flag_test_and_set_explicit(&p->lock,
+						 memory_order_acquire))
+		if (++spins % 128 == 0)
+			sched_yield();
+}
+
+static void pool_unlock(struct coroutine_stack_pool *p)
+{
+	atomic_flag_clear_explicit(&p->lock, memory_order_release);
+}
+
+static unsigned int pool_class(size_t totalsize)
+{
+	unsigned int shift = POOL_MIN_SHIFT;
+
+	while (((size_t)1 << shift) < totalsize)
+		shift++;
+	return shift - POOL_MIN_SHIFT;
+}
+
+/* With the lock held. */
+static bool pool_push(struct coroutine_stack_pool *p, void *slot)
+{
+	if (p->nfree == p->maxfree) {
+		size_t max = p->maxfree ? p->maxfree * 2 : 64;
+		void **free = realloc(p->free, max * sizeof(*free));
+
+		if (!free)
+			return false;
+		p->free = free;
+		p->maxfree = max;
+	}
+	p->free[p->nfree++] = slot;
+	return true;
+}
+
+/* Set once any pooled stack has been made without a guard page. */
+static atomic_bool pool_unguarded;
+
+/* Make a guard page if we can, without a new VMA. */
+static void add_guard(void *page, size_t pgsz)
+{
+#ifdef MADV_GUARD_INSTALL
+	if (atomic_load_explicit(&pool_unguarded, memory_order_relaxed)
+	    || madvise(page, pgsz, MADV_GUARD_INSTALL) != 0)
+#endif
+		atomic_store_explicit(&pool_unguarded, true,
+				      memory_order_relaxed);
+}
+
+/* With the lock held: map some more slots, and return one. */
+static void *pool_grow(struct coroutine_stack_pool *p, size_t slotsize)
+{
+	size_t pgsz = getpagesize();
+	size_t i, n = POOL_MAP_SLOTS, stride = slotsize + pgsz;
+	char *map, *slot;
+
+	if (n * stride < POOL_MAP_MIN)
+		n = POOL_MAP_MIN / stride;
+	map = mmap(NULL, n * stride, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+#ifdef MADV_NOHUGEPAGE
+	/* Huge pages would commit (and report resident) 2MB at a time. */
+	madvise(map, n * stride, MADV_NOHUGEPAGE);
+#endif
+
+	for (i = 0; i < n; i++) {
+#if HAVE_STACK_GROWS_UPWARDS
+		slot = map + i * stride;
+		add_guard(slot + slotsize, pgsz);
+#else
+		slot = map + i * stride + pgsz;
+		add_guard(slot - pgsz, pgsz);
+#endif
+		/* We keep the first for ourselves. */
+		if (i && !pool_push(p, slot))
+			break;
+	}
+	/* On failure, the rest are lost; we still have the first. */
+#if HAVE_STACK_GROWS_UPWARDS
+	return map;
+#else
+	return map + pgsz;
+#endif
+}
+
+/* The slot a pooled stack was made in. */
+static void *pool_slot(struct coroutine_stack *stack, size_t metasize)
+{
+#if HAVE_STACK_GROWS_UPWARDS
+	return (char *)stack - metasize;
+#else
+	return coroutine_stack_base(stack);
+#endif
+}
+
+struct coroutine_stack *coroutine_stack_pool_alloc(size_t totalsize,
+						   size_t metasize)
+{
+	struct coroutine_stack_pool *p;
+	struct coroutine_stack *stack;
+	unsigned int class;
+	size_t slotsize;
+	void *slot;
+
+	BUILD_ASSERT((1 << POOL_MAX_SHIFT) == COROUTINE_STACK_POOL_MAX);
+	if (totalsize < (COROUTINE_MIN_STKSZ + sizeof(*stack) + metasize))
+		return NULL;
+	if (totalsize > COROUTINE_STACK_POOL_MAX)
+		return coroutine_stack_alloc(totalsize, metasize);
+
+	class = pool_class(totalsize);
+	p = &pool[class];
+	slotsize = (size_t)1 << (class + POOL_MIN_SHIFT);
+	pool_lock(p);
+	if (p->nwarm)
+		slot = p->warm[--p->nwarm];
+	else if (p->nfree)
+		slot = p->free[--p->nfree];
+	else
+		slot = pool_grow(p, slotsize);
+	pool_unlock(p);
+	if (!slot)
+		return NULL;
+
+	stack = coroutine_stack_init(slot, slotsize, metasize);
+	stack->magic = COROUTINE_STACK_MAGIC_POOL;
+	stack->pool_class = class;
+	return stack;
+}
+
+static void coroutine_stack_pool_free(struct coroutine_stack *stack,
+				      size_t metasize)
+{
+	size_t slotsize = (size_t)1 << (stack->pool_class + POOL_MIN_SHIFT);
+	struct coroutine_stack_pool *p = &pool[stack->pool_class];
+	void *slot = pool_slot(stack, metasize);
+	bool warm = false;
+
+	stack->magic = 0;
+	pool_lock(p);
+	if (p->nwarm < POOL_WARM) {
+		p->warm[p->nwarm++] = slot;
+		warm = true;
+	}
+	pool_unlock(p);
+	if (warm)
+		return;
+
+	/* Give the memory back, but keep the address space. */
+	madvise(slot, slotsize, MADV_DONTNEED);
+	pool_lock(p);
+	/* If the array can't grow, the slot is lost (but decommitted). */
+	pool_push(p, slot);
+	pool_unlock(p);
+}
+
 void coroutine_stack_release(struct coroutine_stack *stack, size_t metasize)
 {
 	vg_deregister_stack(stack);
@@ -146,6 +344,10 @@ void coroutine_stack_release(struct coroutine_stack *stack, size_t metasize)
 		coroutine_stack_free(stack, metasize);
 		break;
 
+	case COROUTINE_STACK_MAGIC_POOL:
+		coroutine_stack_pool_free(stack, metasize);
+		break;
+
 	default:
 		abort();
 	}
@@ -156,9 +358,25 @@ struct coroutine_stack *coroutine_stack_check(struct coroutine_stack *stack,
 {
 	if (stack && vg_addressable(stack, sizeof(*stack))
 	    && ((stack->magic == COROUTINE_STACK_MAGIC_BUF)
-		|| (stack->magic == COROUTINE_STACK_MAGIC_ALLOC))
-	    && (stack->size >= COROUTINE_MIN_STKSZ))
-		return stack;
+		|| (stack->magic == COROUTINE_STACK_MAGIC_ALLOC)
+		|| (stack->magic == COROUTINE_STACK_MAGIC_POOL))
+	    && (stack->size >= COROUTINE_MIN_STKSZ)
+	    && (stack->magic != COROUTINE_STACK_MAGIC_POOL
+		|| stack->pool_class < POOL_CLASSES)) {
+		/* Without a guard page, did it reach the end? */
+		if (stack->magic != COROUTINE_STACK_MAGIC_POOL
+		    || !atomic_load_explicit(&pool_unguarded,
+					     memory_order_relaxed)
+		    || coroutine_stack_hwm(stack) < stack->size)
+			return stack;
+		if (abortstr) {
+			fprintf(stderr,
+				"%s: Coroutine stack at %p used to its end (size=%zd)\n",
+				abortstr, stack, stack->size);
+			abort();
+		}
+		return NULL;
+	}
 
 	if (abortstr) {
 		if (!stack)
@@ -177,6 +395,37 @@ size_t coroutine_stack_size(const struct coroutine_stack *stack)
 	return stack->size;
 }
 
+size_t coroutine_stack_hwm(const struct coroutine_stack *stack)
+{
+	size_t pgsz = getpagesize();
+	char *base = coroutine_stack_base((struct coroutine_stack *)stack);
+	size_t npages = (stack->size + pgsz - 1) / pgsz, i, used = 0;
+	unsigned char vec[256];
+
+	/* Mapped stacks start on a page; we can ask which are resident. */
+	if (stack->magic == COROUTINE_STACK_MAGIC_BUF
+	    || (uintptr_t)base % pgsz)
+		return stack->size;
+
+	for (i = 0; i < npages; i += sizeof(vec)) {
+		size_t j, n = npages - i < sizeof(vec) ? npages - i : sizeof(vec);
+
+		if (mincore(base + i * pgsz, n * pgsz, (void *)vec) != 0)
+			return stack->size;
+		for (j = 0; j < n; j++) {
+			if (!(vec[j] & 1))
+				continue;
+#if HAVE_STACK_GROWS_UPWARDS
+			used = (i + j + 1) * pgsz;
+#else
+			/* The lowest resident page is the deepest. */
+			return stack->size - (i + j) * pgsz;
+#endif
+		}
+	}
+	return used > stack->size ? stack->size : used;
+}
+
 #if HAVE_UCONTEXT
 static void coroutine_uc_stack(stack_t *uc_stack,
 			       const struct coroutine_stack *stack)
@@ -22,6 +22,8 @@ struct coroutine_stack {
 	uint64_t magic;
 	size_t size;
 	int valgrind_id;
+	/* Size class, for stacks from the shared pool. */
+	unsigned int pool_class;
 };
 
 /**
@@ -64,6 +66,20 @@ struct coroutine_state;
  */
 #define COROUTINE_STACK_MAGIC_ALLOC	0xc040c040574ca110
 
+/**
+ * COROUTINE_STACK_MAGIC_POOL - Magic number for coroutine stacks
+ *                              from the shared pool
+ */
+#define COROUTINE_STACK_MAGIC_POOL	0xc040c040574c9001
+
+/**
+ * COROUTINE_STACK_POOL_MAX - Largest stack the shared pool holds
+ *
+ * coroutine_stack_pool_alloc() hands bigger requests to
+ * coroutine_stack_alloc().
+ */
+#define COROUTINE_STACK_POOL_MAX	(1024 * 1024)
+
 /**
  * coroutine_stack_init - Prepare a coroutine stack in an existing buffer
  * @buf: buffer to use for the coroutine stack
@@ -98,6 +114,34 @@ struct coroutine_stack *coroutine_stack_init(void *buf, size_t bufsize,
  */
 struct coroutine_stack *coroutine_stack_alloc(size_t bufsize, size_t metasize);
 
+/**
+ * coroutine_stack_pool_alloc - Get a coroutine stack from the shared pool
+ * @totalsize: total size wanted (rounded up to a power of 2)
+ * @metasize: size of metadata to add to the stack (not including
+ *            coroutine internal overhead)
+ *
+ * Like coroutine_stack_alloc(), but many stacks are carved from each
+ * mapping, and coroutine_stack_release() returns them to a pool (one
+ * per size class, shared by all threads) rather than unmapping them.
+ *
+ * Memory is only committed as the stack is touched, so a large stack
+ * which is rarely used deeply costs little: reserve generously.  Most
+ * released stacks are also decommitted (MADV_DONTNEED), except a few
+ * which are kept ready for reuse.
+ *
+ * Where the kernel has lightweight guard regions (Linux 6.13 and later),
+ * each stack has a guard page as with coroutine_stack_alloc(), so
+ * overrunning it crashes rather than corrupting its neighbours.  These
+ * don't split the mapping, so any number of stacks can have one.
+ * Otherwise coroutine_stack_check() reports a stack which has been used
+ * to its end instead.
+ *
+ * This will fail if the totalsize < (COROUTINE_MIN_STKSZ +
+ * COROUTINE_STK_OVERHEAD + metasize).
+ */
+struct coroutine_stack *coroutine_stack_pool_alloc(size_t totalsize,
+						   size_t metasize);
+
 /**
  * coroutine_stack_release - Stop using a coroutine stack
  * @stack: coroutine stack to release
@@ -118,6 +162,11 @@ void coroutine_stack_release(struct coroutine_stack *stack, size_t metasize);
  * stack, and @abortstr is non-NULL it will be printed and the
  * function will abort.
  *
+ * If the kernel can't give pooled stacks guard pages, a stack from
+ * coroutine_stack_pool_alloc() is also invalid if it has been used to
+ * within a page of its end (see coroutine_stack_hwm()), since it may
+ * have overflowed.
+ *
  * Returns @stack if it appears valid, NULL if not (it can never
  * return NULL if @abortstr is set).
  */
@@ -177,6 +226,16 @@ coroutine_stack_from_metadata(void *metadata, size_t metasize)
  */
 size_t coroutine_stack_size(const struct coroutine_stack *stack);
 
+/**
+ * coroutine_stack_hwm - Return high-water mark of a coroutine stack
+ * @stack: coroutine stack
+ *
+ * Returns how much of @stack has been used, to a page: the deepest any
+ * coroutine has reached since the memory was committed.  For stacks in
+ * a user supplied buffer, this can't be told, so it returns the size.
+ */
+size_t coroutine_stack_hwm(const struct coroutine_stack *stack);
+
 /*
  * Coroutine switching
  */
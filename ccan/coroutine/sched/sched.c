@@ -0,0 +1,774 @@
+/* Licensed under LGPLv2.1+ - see LICENSE file for details */
+#include "config.h"
+#include <ccan/coroutine/sched/sched.h>
+#include <ccan/container_of/container_of.h>
+#include <ccan/deque/ring/ring.h>
+#include <ccan/timer/timer.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+/* Runnable tasks each thread can queue; the rest go on the global list. */
+#define QUEUE_SIZE 256
+/* Most tasks moved by one steal, or taken from the global list at once. */
+#define BATCH 128
+/* Finished tasks' stacks each thread keeps for reuse. */
+#define POOL_MAX 64
+/* How often a busy thread looks at the global list and its fds. */
+#define FAIR_TICKS 61
+
+/*
+ * Each thread (worker) switches between its own coroutine and tasks'.
+ * A task which yields, sleeps, waits or finishes sets its state and
+ * switches back, and the worker does the rest: it can't be queued (where
+ * another worker could steal it) until its context has been saved.
+ *
+ * Sleeping and waiting tasks are in their worker's timers and pollfd
+ * array, which only that worker touches; only runnable tasks move.
+ */
+enum task_state {
+	TASK_RUNNABLE,
+	TASK_YIELD,
+	TASK_SLEEP,
+	TASK_WAIT,
+	TASK_DONE,
+};
+
+/* Lives in the stack's metadata area. */
+struct task {
+	struct coroutine_state cs;
+	struct coroutine_stack *stack;
+	void (*fn)(void *);
+	void *arg;
+	enum task_state state;
+	/* While sleeping (or waiting with a deadline). */
+	struct timer timer;
+	bool timed;
+	/* Index in the worker's pollfd array while waiting. */
+	unsigned int waiting;
+	short revents;
+	/* On the global list, or the pool. */
+	struct task *next;
+};
+
+typedef DEQ_RING_WRAP(struct task *) taskq_t;
+
+struct worker {
+	taskq_t q;
+	struct coroutine_sched *sched;
+	pthread_t thread;
+	struct coroutine_state cs;
+	struct task *cur;
+	struct timers timers;
+	unsigned int timed;
+	/* pfd[0] is the wake pipe; waiter[i] waits on pfd[i]. */
+	struct pollfd *pfd;
+	struct task **waiter;
+	unsigned int npfd, maxpfd;
+	int wake[2];
+	_Atomic(bool) asleep;
+	struct task *pool;
+	unsigned int npool;
+	uint64_t rand;
+	uint64_t switches, steals;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct coroutine_sched {
+	size_t stacksize;
+	unsigned int nworkers;
+	struct worker *worker;
+	_Atomic(size_t) live;
+	_Atomic(bool) done;
+	_Atomic(unsigned int) sleepers;
+	_Atomic(uint64_t) stacks;
+	pthread_mutex_t lock;
+	_Atomic(size_t) nglobal;
+	/* Protected by lock. */
+	struct task *global, **global_end;
+	/* Stacks for spawns from outside: workers' pools, once they stop. */
+	struct task *pool;
+};
+
+static __thread struct worker *cur_worker;
+
+/*
+ * Tasks move between threads, so code which may run before and after a
+ * switch mustn't let the compiler reuse one thread's address for
+ * cur_worker (or errno) in another.
+ */
+static __attribute__((__noinline__)) struct worker *this_worker(void)
+{
+	return cur_worker;
+}
+
+static struct task *this_task(void)
+{
+	struct worker *w = this_worker();
+
+	assert(w && w->cur);
+	return w->cur;
+}
+
+static unsigned int rand_below(struct worker *w, unsigned int n)
+{
+	/* xorshift64 */
+	w->rand ^= w->rand << 13;
+	w->rand ^= w->rand >> 7;
+	w->rand ^= w->rand << 17;
+	return w->rand % n;
+}
+
+static void wake(struct worker *w)
+{
+	char c = 0;
+
+	if (write(w->wake[1], &c, 1) != 1) {
+		/* Full pipe: it's awake anyway. */
+	}
+}
+
+/* Wake a sleeping worker, if there is one, to look for work. */
+static void wake_one(struct coroutine_sched *s)
+{
+	unsigned int i, start = 0;
+	struct worker *me = this_worker();
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load_explicit(&s->sleepers, memory_order_relaxed))
+		return;
+	if (me && me->sched == s)
+		start = rand_below(me, s->nworkers);
+	for (i = 0; i < s->nworkers; i++) {
+		struct worker *w = &s->worker[(start + i) % s->nworkers];
+		bool asleep = true;
+
+		if (atomic_compare_exchange_strong(&w->asleep, &asleep, false)) {
+			wake(w);
+			return;
+		}
+	}
+}
+
+static void push_global(struct coroutine_sched *s, struct task *t)
+{
+	t->next = NULL;
+	pthread_mutex_lock(&s->lock);
+	*s->global_end = t;
+	s->global_end = &t->next;
+	atomic_fetch_add(&s->nglobal, 1);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void enqueue(struct worker *w, struct task *t)
+{
+	t->state = TASK_RUNNABLE;
+	if (!deq_ring_push(&w->q, t))
+		push_global(w->sched, t);
+}
+
+/* Take a share of the global list: return one, queue the rest. */
+static struct task *take_global(struct worker *w)
+{
+	struct coroutine_sched *s = w->sched;
+	struct task *got[BATCH];
+	size_t i, n;
+
+	if (!atomic_load_explicit(&s->nglobal, memory_order_relaxed))
+		return NULL;
+
+	pthread_mutex_lock(&s->lock);
+	n = atomic_load(&s->nglobal) / s->nworkers + 1;
+	if (n > BATCH)
+		n = BATCH;
+	for (i = 0; i < n && s->global; i++) {
+		got[i] = s->global;
+		s->global = got[i]->next;
+	}
+	if (!s->global)
+		s->global_end = &s->global;
+	atomic_fetch_sub(&s->nglobal, i);
+	pthread_mutex_unlock(&s->lock);
+
+	/* Not under the lock: enqueue may need it. */
+	for (n = 1; n < i; n++)
+		enqueue(w, got[n]);
+	return i ? got[0] : NULL;
+}
+
+/* Take half of another worker's queue: return one, queue the rest. */
+static struct task *steal(struct worker *w)
+{
+	struct coroutine_sched *s = w->sched;
+	struct task *got[BATCH];
+	unsigned int i, j, start, n;
+
+	if (s->nworkers == 1)
+		return NULL;
+	start = rand_below(w, s->nworkers);
+	for (i = 0; i < s->nworkers; i++) {
+		struct worker *v = &s->worker[(start + i) % s->nworkers];
+
+		if (v == w)
+			continue;
+		n = (deq_ring_len(&v->q) + 1) / 2;
+		if (n > BATCH)
+			n = BATCH;
+		if (n && (n = deq_ring_shift_n(&v->q, got, n)) != 0) {
+			w->steals++;
+			for (j = 1; j < n; j++)
+				enqueue(w, got[j]);
+			return got[0];
+		}
+	}
+	return NULL;
+}
+
+static bool add_waiter(struct worker *w, struct task *t, int fd, short events)
+{
+	if (w->npfd == w->maxpfd) {
+		unsigned int max = w->maxpfd * 2;
+		struct pollfd *pfd;
+		struct task **waiter;
+
+		pfd = realloc(w->pfd, max * sizeof(*pfd));
+		if (!pfd)
+			return false;
+		w->pfd = pfd;
+		waiter = realloc(w->waiter, max * sizeof(*waiter));
+		if (!waiter)
+			return false;
+		w->waiter = waiter;
+		w->maxpfd = max;
+	}
+	w->pfd[w->npfd].fd = fd;
+	w->pfd[w->npfd].events = events;
+	w->pfd[w->npfd].revents = 0;
+	w->waiter[w->npfd] = t;
+	t->waiting = w->npfd++;
+	return true;
+}
+
+static void del_waiter(struct worker *w, struct task *t)
+{
+	unsigned int i = t->waiting, last = --w->npfd;
+
+	w->pfd[i] = w->pfd[last];
+	w->waiter[i] = w->waiter[last];
+	w->waiter[i]->waiting = i;
+}
+
+static void add_timer(struct worker *w, struct task *t, struct timemono when)
+{
+	timer_init(&t->timer);
+	timer_addmono(&w->timers, &t->timer, when);
+	t->timed = true;
+	w->timed++;
+}
+
+static void del_timer(struct worker *w, struct task *t)
+{
+	timer_del(&w->timers, &t->timer);
+	t->timed = false;
+	w->timed--;
+}
+
+static void expire(struct worker *w)
+{
+	struct timemono now;
+	struct timer *timer;
+	bool woke = false;
+
+	if (!w->timed)
+		return;
+	now = time_mono();
+	while ((timer = timers_expire(&w->timers, now)) != NULL) {
+		struct task *t = container_of(timer, struct task, timer);
+
+		t->timed = false;
+		w->timed--;
+		if (t->state == TASK_WAIT) {
+			del_waiter(w, t);
+			t->revents = 0;
+		}
+		enqueue(w, t);
+		woke = true;
+	}
+	if (woke)
+		wake_one(w->sched);
+}
+
+/* Poll the wake pipe and waiters' fds, and queue those which are ready. */
+static void poll_fds(struct worker *w, int timeout)
+{
+	unsigned int i;
+	bool woke = false;
+
+	if (poll(w->pfd, w->npfd, timeout) <= 0)
+		return;
+	if (w->pfd[0].revents) {
+		char buf[64];
+
+		while (read(w->wake[0], buf, sizeof(buf)) > 0);
+	}
+	/* From the end, so del_waiter only moves fds we've looked at. */
+	for (i = w->npfd - 1; i > 0; i--) {
+		struct task *t = w->waiter[i];
+
+		if (!w->pfd[i].revents)
+			continue;
+		t->revents = w->pfd[i].revents;
+		del_waiter(w, t);
+		if (t->timed)
+			del_timer(w, t);
+		enqueue(w, t);
+		woke = true;
+	}
+	if (woke)
+		wake_one(w->sched);
+}
+
+static bool work_anywhere(struct worker *w)
+{
+	struct coroutine_sched *s = w->sched;
+	unsigned int i;
+
+	if (atomic_load(&s->done) || atomic_load(&s->nglobal))
+		return true;
+	for (i = 0; i < s->nworkers; i++)
+		if (deq_ring_len(&s->worker[i].q))
+			return true;
+	return false;
+}
+
+/* Nothing to run: sleep until a timer, an fd or another worker wakes us. */
+static void idle(struct worker *w)
+{
+	struct coroutine_sched *s = w->sched;
+	int timeout = -1;
+
+	if (w->timed) {
+		struct timemono first, now = time_mono();
+
+		if (timer_earliest(&w->timers, &first)) {
+			uint64_t ms = 0;
+
+			/* Round up, or we'd spin until it's due. */
+			if (time_greater_(first.ts, now.ts))
+				ms = time_to_msec(timemono_between(first, now))
+					+ 1;
+			timeout = ms > INT_MAX ? INT_MAX : ms;
+		}
+	}
+
+	atomic_store(&w->asleep, true);
+	atomic_fetch_add(&s->sleepers, 1);
+	/* Anyone who queued work before seeing us asleep: we see it. */
+	if (work_anywhere(w))
+		timeout = 0;
+	poll_fds(w, timeout);
+	atomic_fetch_sub(&s->sleepers, 1);
+	atomic_store(&w->asleep, false);
+}
+
+static void finish(struct worker *w, struct task *t)
+{
+	struct coroutine_sched *s = w->sched;
+	unsigned int i;
+
+	if (w->npool < POOL_MAX) {
+		t->next = w->pool;
+		w->pool = t;
+		w->npool++;
+	} else
+		coroutine_stack_release(t->stack, sizeof(*t));
+
+	if (atomic_fetch_sub(&s->live, 1) == 1) {
+		atomic_store(&s->done, true);
+		for (i = 0; i < s->nworkers; i++)
+			wake(&s->worker[i]);
+	}
+}
+
+static void run(struct worker *w, struct task *t)
+{
+	w->cur = t;
+	w->switches++;
+	coroutine_switch(&w->cs, &t->cs);
+	w->cur = NULL;
+
+	switch (t->state) {
+	case TASK_YIELD:
+		enqueue(w, t);
+		break;
+	case TASK_DONE:
+		finish(w, t);
+		break;
+	case TASK_SLEEP:
+	case TASK_WAIT:
+		/* It's in our timers or pollfds now. */
+		break;
+	case TASK_RUNNABLE:
+		abort();
+	}
+}
+
+static struct task *next_task(struct worker *w)
+{
+	struct task *t;
+
+	if (deq_ring_shift(&w->q, &t))
+		return t;
+	if ((t = take_global(w)) != NULL)
+		return t;
+	if (w->npfd > 1) {
+		poll_fds(w, 0);
+		if (deq_ring_shift(&w->q, &t))
+			return t;
+	}
+	return steal(w);
+}
+
+static void worker_loop(struct worker *w)
+{
+	struct coroutine_sched *s = w->sched;
+	unsigned int tick = 0;
+	struct task *t;
+
+	cur_worker = w;
+	while (!atomic_load_explicit(&s->done, memory_order_acquire)) {
+		/* So queued tasks can't starve the rest forever. */
+		if (++tick % FAIR_TICKS == 0) {
+			if ((t = take_global(w)) != NULL)
+				enqueue(w, t);
+			if (w->npfd > 1)
+				poll_fds(w, 0);
+		}
+		expire(w);
+		t = next_task(w);
+		if (t)
+			run(w, t);
+		else
+			idle(w);
+	}
+	cur_worker = NULL;
+}
+
+static void *worker_thread(void *arg)
+{
+	worker_loop(arg);
+	return NULL;
+}
+
+static void task_main(void *arg)
+{
+	struct task *t = arg;
+
+	t->fn(t->arg);
+	t->state = TASK_DONE;
+	/* Never switched back to: its stack may be reused at once. */
+	coroutine_jump(&this_worker()->cs);
+}
+
+static bool init_worker(struct coroutine_sched *s, struct worker *w,
+			unsigned int i)
+{
+	memset(w, 0, sizeof(*w));
+	w->sched = s;
+	w->wake[0] = w->wake[1] = -1;
+	w->rand = 0x9e3779b97f4a7c15ULL * (i + 1);
+	timers_init(&w->timers, time_mono());
+	if (deq_ring_init(&w->q, QUEUE_SIZE, DEQ_MPMC, 0) == -1)
+		return false;
+	if (pipe(w->wake) == -1
+	    || fcntl(w->wake[0], F_SETFL, O_NONBLOCK) == -1
+	    || fcntl(w->wake[1], F_SETFL, O_NONBLOCK) == -1)
+		return false;
+	w->maxpfd = 16;
+	w->pfd = malloc(w->maxpfd * sizeof(*w->pfd));
+	w->waiter = malloc(w->maxpfd * sizeof(*w->waiter));
+	if (!w->pfd || !w->waiter)
+		return false;
+	w->pfd[0].fd = w->wake[0];
+	w->pfd[0].events = POLLIN;
+	w->waiter[0] = NULL;
+	w->npfd = 1;
+	return true;
+}
+
+static void free_task(struct task *t)
+{
+	coroutine_stack_release(t->stack, sizeof(*t));
+}
+
+static void cleanup_worker(struct worker *w)
+{
+	struct task *t;
+
+	if (w->q.ring.v) {
+		while (deq_ring_shift(&w->q, &t))
+			free_task(t);
+		deq_ring_reset(&w->q);
+	}
+	while ((t = w->pool) != NULL) {
+		w->pool = t->next;
+		free_task(t);
+	}
+	timers_cleanup(&w->timers);
+	free(w->pfd);
+	free(w->waiter);
+	if (w->wake[0] != -1)
+		close(w->wake[0]);
+	if (w->wake[1] != -1)
+		close(w->wake[1]);
+}
+
+struct coroutine_sched *coroutine_sched_new(unsigned int threads,
+					    size_t stacksize)
+{
+	struct coroutine_sched *s;
+	unsigned int i;
+	void *mem;
+
+#if !COROUTINE_AVAILABLE
+	errno = ENOSYS;
+	return NULL;
+#endif
+	if (!stacksize)
+		stacksize = COROUTINE_SCHED_DEFAULT_STACK;
+	if (!threads || stacksize < COROUTINE_MIN_STKSZ) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	if (posix_memalign(&mem, CACHE_LINE, threads * sizeof(*s->worker))) {
+		free(s);
+		errno = ENOMEM;
+		return NULL;
+	}
+	s->worker = mem;
+	s->nworkers = threads;
+	s->stacksize = stacksize;
+	s->global_end = &s->global;
+	pthread_mutex_init(&s->lock, NULL);
+	for (i = 0; i < threads; i++) {
+		if (!init_worker(s, &s->worker[i], i)) {
+			int err = errno;
+
+			s->nworkers = i + 1;
+			coroutine_sched_free(s);
+			errno = err;
+			return NULL;
+		}
+	}
+	return s;
+}
+
+void coroutine_sched_free(struct coroutine_sched *s)
+{
+	struct task *t;
+	unsigned int i;
+
+	if (!s)
+		return;
+	/* Tasks spawned but never run. */
+	while ((t = s->global) != NULL) {
+		s->global = t->next;
+		free_task(t);
+	}
+	while ((t = s->pool) != NULL) {
+		s->pool = t->next;
+		free_task(t);
+	}
+	for (i = 0; i < s->nworkers; i++)
+		cleanup_worker(&s->worker[i]);
+	pthread_mutex_destroy(&s->lock);
+	free(s->worker);
+	free(s);
+}
+
+bool coroutine_sched_spawn_(struct coroutine_sched *s,
+			    void (*fn)(void *), void *arg)
+{
+	struct worker *w = this_worker();
+	struct coroutine_stack *stack;
+	struct task *t = NULL;
+
+	if (w && w->sched != s)
+		w = NULL;
+	if (w && w->pool) {
+		t = w->pool;
+		w->pool = t->next;
+		w->npool--;
+	} else if (!w) {
+		pthread_mutex_lock(&s->lock);
+		if ((t = s->pool) != NULL)
+			s->pool = t->next;
+		pthread_mutex_unlock(&s->lock);
+	}
+	if (!t) {
+		stack = coroutine_stack_alloc(s->stacksize
+					      + COROUTINE_STK_OVERHEAD
+					      + sizeof(*t), sizeof(*t));
+		if (!stack)
+			return false;
+		t = coroutine_stack_to_metadata(stack, sizeof(*t));
+		t->stack = stack;
+		atomic_fetch_add_explicit(&s->stacks, 1, memory_order_relaxed);
+	}
+	t->fn = fn;
+	t->arg = arg;
+	t->timed = false;
+	t->revents = 0;
+	coroutine_init(&t->cs, task_main, t, t->stack);
+
+	atomic_fetch_add(&s->live, 1);
+	if (w)
+		enqueue(w, t);
+	else {
+		t->state = TASK_RUNNABLE;
+		push_global(s, t);
+	}
+	wake_one(s);
+	return true;
+}
+
+void coroutine_sched_run(struct coroutine_sched *s)
+{
+	unsigned int i, started;
+
+	if (!atomic_load(&s->live))
+		return;
+	atomic_store(&s->done, false);
+	for (started = 1; started < s->nworkers; started++)
+		if (pthread_create(&s->worker[started].thread, NULL,
+				   worker_thread, &s->worker[started]) != 0)
+			break;
+	/* With fewer threads than asked, it's still correct, just slower. */
+	worker_loop(&s->worker[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(s->worker[i].thread, NULL);
+
+	pthread_mutex_lock(&s->lock);
+	for (i = 0; i < s->nworkers; i++) {
+		struct worker *w = &s->worker[i];
+		struct task *t;
+
+		while ((t = w->pool) != NULL) {
+			w->pool = t->next;
+			t->next = s->pool;
+			s->pool = t;
+		}
+		w->npool = 0;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+void coroutine_sched_yield(void)
+{
+	struct task *t = this_task();
+
+	t->state = TASK_YIELD;
+	coroutine_switch(&t->cs, &this_worker()->cs);
+}
+
+void coroutine_sched_sleep_until(struct timemono deadline)
+{
+	struct task *t = this_task();
+	struct worker *w = this_worker();
+
+	add_timer(w, t, deadline);
+	t->state = TASK_SLEEP;
+	coroutine_switch(&t->cs, &w->cs);
+}
+
+void coroutine_sched_sleep(struct timerel rel)
+{
+	coroutine_sched_sleep_until(timemono_add(time_mono(), rel));
+}
+
+short coroutine_sched_wait_fd(int fd, short events,
+			      const struct timemono *deadline)
+{
+	struct task *t = this_task();
+	struct worker *w = this_worker();
+
+	if (!add_waiter(w, t, fd, events)) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (deadline)
+		add_timer(w, t, *deadline);
+	t->state = TASK_WAIT;
+	coroutine_switch(&t->cs, &w->cs);
+	return t->revents;
+}
+
+/* Returns -2 instead of failing with EAGAIN. */
+static __attribute__((__noinline__))
+ssize_t try_io(int fd, void *buf, size_t len, bool writing)
+{
+	ssize_t ret = writing ? write(fd, buf, len) : read(fd, buf, len);
+
+	if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return -2;
+	return ret;
+}
+
+ssize_t coroutine_sched_read(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while ((ret = try_io(fd, buf, len, false)) == -2)
+		if (coroutine_sched_wait_fd(fd, POLLIN, NULL) == -1)
+			return -1;
+	return ret;
+}
+
+ssize_t coroutine_sched_write(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = try_io(fd, (char *)buf + done, len - done, true);
+		if (ret == -2) {
+			if (coroutine_sched_wait_fd(fd, POLLOUT, NULL) == -1)
+				return -1;
+		} else if (ret == -1)
+			return -1;
+		else
+			done += ret;
+	}
+	return len;
+}
+
+bool coroutine_sched_in_task(void)
+{
+	struct worker *w = this_worker();
+
+	return w && w->cur;
+}
+
+void coroutine_sched_stats(const struct coroutine_sched *s,
+			   struct coroutine_sched_stats *stats)
+{
+	unsigned int i;
+
+	stats->switches = stats->steals = 0;
+	for (i = 0; i < s->nworkers; i++) {
+		stats->switches += s->worker[i].switches;
+		stats->steals += s->worker[i].steals;
+	}
+	stats->stacks = atomic_load(&s->stacks);
+}
@@ -0,0 +1,212 @@
+/* Licensed under LGPLv2.1+ - see LICENSE file for details */
+#ifndef CCAN_COROUTINE_SCHED_H
+#define CCAN_COROUTINE_SCHED_H
+#include "config.h"
+#include <ccan/coroutine/coroutine.h>
+#include <ccan/time/time.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * COROUTINE_SCHED_DEFAULT_STACK - stack size used if none is given
+ *
+ * Each stack also has a guard page below it, so running off the end
+ * crashes rather than scribbling on another task.
+ */
+#define COROUTINE_SCHED_DEFAULT_STACK (64 * 1024)
+
+struct coroutine_sched;
+
+/**
+ * struct coroutine_sched_stats - what the scheduler has been up to
+ * @switches: how many times a task was switched to
+ * @steals: how many times a thread took tasks queued on another
+ * @stacks: how many stacks were mapped (the rest were reused)
+ */
+struct coroutine_sched_stats {
+	uint64_t switches;
+	uint64_t steals;
+	uint64_t stacks;
+};
+
+/**
+ * coroutine_sched_new - create a scheduler
+ * @threads: number of threads to run tasks on (at least 1)
+ * @stacksize: size of each task's stack, or 0 for the default
+ *
+ * Tasks are coroutines: each runs on its own stack until it finishes or
+ * waits (see coroutine_sched_yield(), coroutine_sched_sleep() and
+ * coroutine_sched_wait_fd()), when the thread switches to another task.
+ * Each thread has its own queue of runnable tasks; a thread which runs
+ * out takes half of another thread's.
+ *
+ * Finished tasks' stacks are kept by each thread for reuse, so a task
+ * costs no system calls once the scheduler is warm.
+ *
+ * Returns NULL on error (errno ENOSYS if this platform can't run
+ * coroutines).
+ *
+ * Example:
+ *	struct coroutine_sched *sched = coroutine_sched_new(4, 0);
+ *
+ *	if (!sched)
+ *		err(1, "coroutine_sched_new");
+ */
+struct coroutine_sched *coroutine_sched_new(unsigned int threads,
+					    size_t stacksize);
+
+/**
+ * coroutine_sched_free - free a scheduler
+ * @sched: the scheduler, which must not be running
+ *
+ * Tasks spawned since coroutine_sched_run() last returned are freed
+ * without being run.
+ */
+void coroutine_sched_free(struct coroutine_sched *sched);
+
+/**
+ * coroutine_sched_spawn - start a task
+ * @sched: the scheduler
+ * @fn: the function for the task to run
+ * @arg: the argument for @fn
+ *
+ * Called from a task, the new task goes on the end of this thread's
+ * queue (and an idle thread is woken to take it, if there is one).
+ * Otherwise it goes on a queue shared by all the threads: do this
+ * before coroutine_sched_run(), or while it runs, as long as some
+ * task is still running.
+ *
+ * Example:
+ *	static void hello(int *count)
+ *	{
+ *		printf("Hello from task %i\n", ++*count);
+ *	}
+ *	...
+ *	static int count;
+ *
+ *	if (!coroutine_sched_spawn(sched, hello, &count))
+ *		err(1, "coroutine_sched_spawn");
+ *
+ * Returns: false (errno set) on error
+ */
+#define coroutine_sched_spawn(sched, fn, arg)				\
+	coroutine_sched_spawn_((sched),					\
+			       typesafe_cb(void, void *, (fn), (arg)),	\
+			       (arg))
+bool coroutine_sched_spawn_(struct coroutine_sched *sched,
+			    void (*fn)(void *), void *arg);
+
+/**
+ * coroutine_sched_run - run tasks until all have finished
+ * @sched: the scheduler
+ *
+ * This starts the other threads, runs tasks in the calling thread too,
+ * and returns once every task has finished.  A task which waits forever
+ * (eg. for an fd which never becomes ready) keeps it running forever.
+ *
+ * Example:
+ *	coroutine_sched_run(sched);
+ *	coroutine_sched_free(sched);
+ */
+void coroutine_sched_run(struct coroutine_sched *sched);
+
+/**
+ * coroutine_sched_yield - let other tasks run
+ *
+ * The calling task goes to the back of its thread's queue.
+ */
+void coroutine_sched_yield(void);
+
+/**
+ * coroutine_sched_sleep - wait a while
+ * @rel: how long to wait
+ *
+ * The task's thread runs other tasks meanwhile.  The deadline is kept in
+ * that thread's ccan/timer wheel.
+ */
+void coroutine_sched_sleep(struct timerel rel);
+
+/**
+ * coroutine_sched_sleep_until - wait until a deadline
+ * @deadline: when to wake
+ */
+void coroutine_sched_sleep_until(struct timemono deadline);
+
+/**
+ * coroutine_sched_wait_fd - wait for a file descriptor to become ready
+ * @fd: the file descriptor
+ * @events: the poll(2) events to wait for (eg. POLLIN)
+ * @deadline: when to give up, or NULL to wait forever
+ *
+ * Each thread polls the file descriptors its waiting tasks want, along
+ * with its timers, whenever it has nothing else to do (and now and then
+ * when it does).
+ *
+ * Example:
+ *	#include <poll.h>
+ *	#include <unistd.h>
+ *
+ *	static void echo(void *arg)
+ *	{
+ *		int fd = (long)arg;
+ *		char buf[100];
+ *		ssize_t len;
+ *
+ *		while (coroutine_sched_wait_fd(fd, POLLIN, NULL)) {
+ *			len = read(fd, buf, sizeof(buf));
+ *			if (len <= 0)
+ *				break;
+ *			if (write(fd, buf, len) != len)
+ *				break;
+ *		}
+ *		close(fd);
+ *	}
+ *
+ * Returns: the poll(2) revents, 0 if @deadline passed first, or -1
+ * (errno ENOMEM) if the fd couldn't be added to the thread's poll set
+ */
+short coroutine_sched_wait_fd(int fd, short events,
+			      const struct timemono *deadline);
+
+/**
+ * coroutine_sched_read - read from a non-blocking fd, waiting if need be
+ * @fd: the file descriptor (with O_NONBLOCK set)
+ * @buf: where to read to
+ * @len: the size of @buf
+ *
+ * This is read(2) for tasks: instead of EAGAIN, the task waits until
+ * there's something to read.
+ *
+ * Returns: as read(2)
+ */
+ssize_t coroutine_sched_read(int fd, void *buf, size_t len);
+
+/**
+ * coroutine_sched_write - write all of a buffer to a non-blocking fd
+ * @fd: the file descriptor (with O_NONBLOCK set)
+ * @buf: what to write
+ * @len: how much
+ *
+ * The task waits whenever the fd is full, until everything is written.
+ *
+ * Returns: @len, or -1 (errno set) on error
+ */
+ssize_t coroutine_sched_write(int fd, const void *buf, size_t len);
+
+/**
+ * coroutine_sched_in_task - is this code running in a task?
+ */
+bool coroutine_sched_in_task(void);
+
+/**
+ * coroutine_sched_stats - get the scheduler's statistics
+ * @sched: the scheduler
+ * @stats: filled in
+ *
+ * Only exact once coroutine_sched_run() has returned.
+ */
+void coroutine_sched_stats(const struct coroutine_sched *sched,
+			   struct coroutine_sched_stats *stats);
+#endif /* CCAN_COROUTINE_SCHED_H */
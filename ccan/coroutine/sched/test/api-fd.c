@@ -0,0 +1,154 @@
+#include <ccan/coroutine/sched/sched.h>
+#include <ccan/tap/tap.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Several times a pipe's buffer, so writers must wait. */
+#define LEN (1024 * 1024)
+#define PAIRS 8
+
+static struct coroutine_sched *sched;
+
+struct pipe {
+	int fd[2];
+	char *in, *out;
+	ssize_t written, got;
+};
+
+static void writer(struct pipe *p)
+{
+	p->written = coroutine_sched_write(p->fd[1], p->out, LEN);
+	close(p->fd[1]);
+}
+
+static void reader(struct pipe *p)
+{
+	ssize_t len;
+
+	while ((len = coroutine_sched_read(p->fd[0], p->in + p->got,
+					   LEN - p->got)) > 0)
+		p->got += len;
+	close(p->fd[0]);
+}
+
+static short timeout_revents = -1;
+static int timeout_ms;
+
+static void timeout(int *fd)
+{
+	struct timemono start = time_mono(),
+		deadline = timemono_add(start, time_from_msec(20));
+
+	timeout_revents = coroutine_sched_wait_fd(*fd, POLLIN, &deadline);
+	timeout_ms = time_to_msec(timemono_since(start));
+}
+
+static short woken_revents;
+
+static void waiter(int *fd)
+{
+	struct timemono deadline = timemono_add(time_mono(),
+						time_from_sec(10));
+
+	woken_revents = coroutine_sched_wait_fd(*fd, POLLIN, &deadline);
+}
+
+static void poker(int *fd)
+{
+	coroutine_sched_sleep(time_from_msec(10));
+	if (write(*fd, "x", 1) != 1)
+		abort();
+}
+
+static ssize_t bad_ret;
+static int bad_errno;
+
+static void bad_fd(void *unused)
+{
+	char c;
+
+	bad_ret = coroutine_sched_read(-1, &c, 1);
+	bad_errno = errno;
+}
+
+static void make_pipe(int fd[2])
+{
+	if (pipe(fd) != 0
+	    || fcntl(fd[0], F_SETFL, O_NONBLOCK) != 0
+	    || fcntl(fd[1], F_SETFL, O_NONBLOCK) != 0)
+		abort();
+}
+
+int main(void)
+{
+	struct pipe p[PAIRS];
+	int fd[2], i;
+	bool all;
+
+	/* This is how many tests you plan to run */
+	plan_tests(7);
+
+	sched = coroutine_sched_new(3, 0);
+	if (!COROUTINE_AVAILABLE) {
+		skip(7, "Coroutines not available");
+		return exit_status();
+	}
+
+	/* A deadline with nothing to read. */
+	make_pipe(fd);
+	coroutine_sched_spawn(sched, timeout, &fd[0]);
+	coroutine_sched_run(sched);
+	ok1(timeout_revents == 0);
+	ok1(timeout_ms >= 20);
+
+	/* Something to read before the deadline. */
+	coroutine_sched_spawn(sched, waiter, &fd[0]);
+	coroutine_sched_spawn(sched, poker, &fd[1]);
+	coroutine_sched_run(sched);
+	ok1(woken_revents & POLLIN);
+	close(fd[0]);
+	close(fd[1]);
+
+	/* Readers and writers on many pipes at once. */
+	for (i = 0; i < PAIRS; i++) {
+		int j;
+
+		make_pipe(p[i].fd);
+		p[i].in = calloc(LEN, 1);
+		p[i].out = malloc(LEN);
+		for (j = 0; j < LEN; j++)
+			p[i].out[j] = i + j * 7;
+		p[i].written = p[i].got = 0;
+		coroutine_sched_spawn(sched, reader, &p[i]);
+		coroutine_sched_spawn(sched, writer, &p[i]);
+	}
+	coroutine_sched_run(sched);
+	for (all = true, i = 0; i < PAIRS; i++)
+		all &= p[i].written == LEN;
+	ok1(all);
+	for (all = true, i = 0; i < PAIRS; i++)
+		all &= p[i].got == LEN;
+	ok1(all);
+	for (all = true, i = 0; i < PAIRS; i++)
+		all &= memcmp(p[i].in, p[i].out, LEN) == 0;
+	ok1(all);
+
+	/* Errors other than EAGAIN come straight back. */
+	coroutine_sched_spawn(sched, bad_fd, NULL);
+	coroutine_sched_run(sched);
+	ok1(bad_ret == -1 && bad_errno == EBADF);
+
+	for (i = 0; i < PAIRS; i++) {
+		free(p[i].in);
+		free(p[i].out);
+	}
+	coroutine_sched_free(sched);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,156 @@
+#include <ccan/coroutine/sched/sched.h>
+#include <ccan/tap/tap.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TASKS 1000
+#define YIELDS 10
+
+static struct coroutine_sched *sched;
+static atomic_int ran, yields, spawned;
+
+static void yielder(int *count)
+{
+	int i;
+
+	for (i = 0; i < YIELDS; i++) {
+		(*count)++;
+		atomic_fetch_add(&yields, 1);
+		coroutine_sched_yield();
+	}
+	atomic_fetch_add(&ran, 1);
+}
+
+/* Spawns two children until depth runs out: a binary tree of tasks. */
+static void spawner(void *arg)
+{
+	long depth = (long)arg;
+
+	atomic_fetch_add(&spawned, 1);
+	if (depth == 0)
+		return;
+	coroutine_sched_spawn(sched, spawner, (void *)(depth - 1));
+	coroutine_sched_yield();
+	coroutine_sched_spawn(sched, spawner, (void *)(depth - 1));
+}
+
+static int order[3], norder;
+
+static void sleeper(void *arg)
+{
+	long ms = (long)arg;
+
+	coroutine_sched_sleep(time_from_msec(ms));
+	order[norder++] = ms;
+}
+
+static void deep(int *touched)
+{
+	char buf[32 * 1024];
+	int i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+	for (i = 0; i < sizeof(buf); i++)
+		*touched += buf[i];
+}
+
+static void check_in_task(bool *in)
+{
+	*in = coroutine_sched_in_task();
+}
+
+int main(void)
+{
+	struct coroutine_sched_stats stats;
+	struct timemono start;
+	int counts[TASKS] = { 0 }, i, touched = 0;
+	bool in = false, all;
+
+	/* This is how many tests you plan to run */
+	plan_tests(17);
+
+	sched = coroutine_sched_new(1, 0);
+	if (!COROUTINE_AVAILABLE) {
+		ok1(!sched && errno == ENOSYS);
+		skip(16, "Coroutines not available");
+		return exit_status();
+	}
+	ok1(sched);
+
+	ok1(!coroutine_sched_new(0, 0) && errno == EINVAL);
+	ok1(!coroutine_sched_new(1, 16) && errno == EINVAL);
+	ok1(!coroutine_sched_in_task());
+
+	/* Nothing to run. */
+	coroutine_sched_run(sched);
+
+	/* One thread: tasks take turns. */
+	for (all = true, i = 0; i < 10; i++)
+		all &= coroutine_sched_spawn(sched, yielder, &counts[i]);
+	ok1(all);
+	coroutine_sched_spawn(sched, check_in_task, &in);
+	coroutine_sched_run(sched);
+	ok1(ran == 10 && yields == 10 * YIELDS);
+	ok1(in);
+	coroutine_sched_stats(sched, &stats);
+	ok1(stats.switches == 10 * (YIELDS + 1) + 1);
+	ok1(stats.steals == 0);
+
+	/* Stacks came back to the pool: these reuse them. */
+	ran = 0;
+	for (i = 0; i < 10; i++)
+		coroutine_sched_spawn(sched, yielder, &counts[i]);
+	coroutine_sched_run(sched);
+	coroutine_sched_stats(sched, &stats);
+	ok1(ran == 10 && stats.stacks == 11);
+
+	/* Sleeps end in deadline order, not spawn order. */
+	start = time_mono();
+	coroutine_sched_spawn(sched, sleeper, (void *)30L);
+	coroutine_sched_spawn(sched, sleeper, (void *)10L);
+	coroutine_sched_spawn(sched, sleeper, (void *)20L);
+	coroutine_sched_run(sched);
+	ok1(norder == 3 && order[0] == 10 && order[1] == 20 && order[2] == 30);
+	ok1(time_to_msec(timemono_since(start)) >= 30);
+
+	/* The whole stack is usable. */
+	coroutine_sched_spawn(sched, deep, &touched);
+	coroutine_sched_run(sched);
+	ok1(touched != 0);
+	coroutine_sched_free(sched);
+
+	/* Freeing a task which never ran (counts[0] is from the runs above). */
+	sched = coroutine_sched_new(2, 0);
+	coroutine_sched_spawn(sched, yielder, &counts[0]);
+	coroutine_sched_free(sched);
+	ok1(counts[0] == 2 * YIELDS);
+
+	/* Many threads, many tasks. */
+	sched = coroutine_sched_new(4, 0);
+	ran = yields = 0;
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < TASKS; i++)
+		coroutine_sched_spawn(sched, yielder, &counts[i]);
+	coroutine_sched_run(sched);
+	ok1(ran == TASKS && yields == TASKS * YIELDS);
+	for (all = true, i = 0; i < TASKS; i++)
+		all &= counts[i] == YIELDS;
+	ok1(all);
+
+	/* Tasks spawned by tasks. */
+	coroutine_sched_spawn(sched, spawner, (void *)10L);
+	coroutine_sched_run(sched);
+	ok1(spawned == (1 << 11) - 1);
+	coroutine_sched_stats(sched, &stats);
+	diag("switches %llu, steals %llu, stacks %llu",
+	     (unsigned long long)stats.switches,
+	     (unsigned long long)stats.steals,
+	     (unsigned long long)stats.stacks);
+	coroutine_sched_free(sched);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
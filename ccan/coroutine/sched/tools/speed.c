@@ -0,0 +1,127 @@
+/*
+ * Speed test for coroutine/sched.
+ *
+ * yield: tasks which only yield, so this is the cost of a switch.
+ * spawn: a tree of tasks, each spawning two more: the cost of starting
+ * and finishing one (with pooled stacks).
+ * pingpong: pairs of tasks passing a byte back and forth over pipes.
+ *
+ * Usage: speed [max-threads]
+ */
+#include <ccan/coroutine/sched/sched.h>
+#include <ccan/time/time.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define TASKS 1000
+#define YIELDS 1000
+#define DEPTH 17
+#define PAIRS 100
+#define ROUNDS 1000
+
+static struct coroutine_sched *sched;
+
+static void yielder(void *unused)
+{
+	int i;
+
+	for (i = 0; i < YIELDS; i++)
+		coroutine_sched_yield();
+}
+
+static void spawner(void *arg)
+{
+	long depth = (long)arg;
+
+	if (depth == 0)
+		return;
+	if (!coroutine_sched_spawn(sched, spawner, (void *)(depth - 1))
+	    || !coroutine_sched_spawn(sched, spawner, (void *)(depth - 1)))
+		err(1, "spawn");
+}
+
+struct end {
+	int in, out;
+};
+
+static void pinger(struct end *e)
+{
+	char c = 0;
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		if (coroutine_sched_write(e->out, &c, 1) != 1
+		    || coroutine_sched_read(e->in, &c, 1) != 1)
+			err(1, "pinger");
+	}
+	close(e->in);
+	close(e->out);
+}
+
+static void make_pipe(int fd[2])
+{
+	if (pipe(fd) != 0
+	    || fcntl(fd[0], F_SETFL, O_NONBLOCK) != 0
+	    || fcntl(fd[1], F_SETFL, O_NONBLOCK) != 0)
+		err(1, "pipe");
+}
+
+static void report(const char *name, unsigned threads,
+		   struct timemono start, unsigned long ops)
+{
+	struct coroutine_sched_stats stats;
+	uint64_t ns = time_to_nsec(timemono_since(start));
+
+	coroutine_sched_stats(sched, &stats);
+	printf("%-9s %2u threads: %8.1f ns/op, %llu steals, %llu stacks\n",
+	       name, threads, (double)ns / ops,
+	       (unsigned long long)stats.steals,
+	       (unsigned long long)stats.stacks);
+	coroutine_sched_free(sched);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned threads, max = argc > 1 ? atoi(argv[1]) : 4;
+	struct end *ends = calloc(PAIRS * 2, sizeof(*ends));
+	struct timemono start;
+	int i;
+
+	for (threads = 1; threads <= max; threads *= 2) {
+		sched = coroutine_sched_new(threads, 0);
+		if (!sched)
+			err(1, "coroutine_sched_new");
+		for (i = 0; i < TASKS; i++)
+			coroutine_sched_spawn(sched, yielder, NULL);
+		start = time_mono();
+		coroutine_sched_run(sched);
+		report("yield", threads, start, (unsigned long)TASKS * YIELDS);
+
+		sched = coroutine_sched_new(threads, 0);
+		coroutine_sched_spawn(sched, spawner, (void *)(long)DEPTH);
+		start = time_mono();
+		coroutine_sched_run(sched);
+		report("spawn", threads, start, (1UL << (DEPTH + 1)) - 1);
+
+		sched = coroutine_sched_new(threads, 0);
+		for (i = 0; i < PAIRS; i++) {
+			int a[2], b[2];
+
+			make_pipe(a);
+			make_pipe(b);
+			ends[i * 2] = (struct end){ b[0], a[1] };
+			ends[i * 2 + 1] = (struct end){ a[0], b[1] };
+			coroutine_sched_spawn(sched, pinger, &ends[i * 2]);
+			coroutine_sched_spawn(sched, pinger, &ends[i * 2 + 1]);
+		}
+		start = time_mono();
+		coroutine_sched_run(sched);
+		report("pingpong", threads, start,
+		       (unsigned long)PAIRS * 2 * ROUNDS);
+	}
+	free(ends);
+	return 0;
+}
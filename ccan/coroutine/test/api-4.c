@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include <ccan/coroutine/coroutine.h>
+#include <ccan/tap/tap.h>
+
+/* Test metadata */
+#define META_MAGIC 0x4d86aa82ec1892f6
+#define STACKSIZE  (64 * 1024)
+#define TOUCH      (32 * 1024)
+#define MANY       100
+
+struct metadata {
+	uint64_t magic;
+};
+
+struct state {
+	struct coroutine_state ret;
+	size_t touch;
+};
+
+/* Touch s->touch bytes of stack */
+static void toucher(void *p)
+{
+	struct state *s = (struct state *)p;
+	volatile char buf[s->touch], *c;
+
+	/* Every page, so a stack without a guard page is used to its end. */
+	for (c = buf; c < buf + s->touch; c += 512)
+		*c = 1;
+	buf[s->touch - 1] = 1;
+	coroutine_jump(&s->ret);
+}
+
+static void touch(struct coroutine_stack *stack, size_t len)
+{
+	struct coroutine_state t;
+	struct state s = {
+		.touch = len,
+	};
+
+	coroutine_init(&t, toucher, &s, stack);
+	coroutine_switch(&s.ret, &t);
+}
+
+int main(void)
+{
+	struct coroutine_stack *stack, *stacks[MANY];
+	struct metadata *meta;
+	size_t pgsz = getpagesize();
+	int i, cold, status;
+	pid_t child;
+
+	/* This is how many tests you plan to run */
+	plan_tests(15);
+
+	ok1(coroutine_stack_pool_alloc(COROUTINE_MIN_STKSZ, 0) == NULL);
+
+	/* Rounded up to a power of 2. */
+	stack = coroutine_stack_pool_alloc(STACKSIZE - 1000, sizeof(*meta));
+	ok1(coroutine_stack_check(stack, NULL) == stack);
+	ok1(coroutine_stack_size(stack)
+	    == STACKSIZE - COROUTINE_STK_OVERHEAD - sizeof(*meta));
+	meta = coroutine_stack_to_metadata(stack, sizeof(*meta));
+	meta->magic = META_MAGIC;
+	ok1(coroutine_stack_from_metadata(meta, sizeof(*meta)) == stack);
+
+	/* Nothing but the top page has been touched. */
+	ok1(coroutine_stack_hwm(stack) <= pgsz);
+
+	if (COROUTINE_AVAILABLE) {
+		touch(stack, TOUCH);
+		ok1(coroutine_stack_hwm(stack) >= TOUCH);
+		ok1(coroutine_stack_hwm(stack) < coroutine_stack_size(stack));
+		ok1(coroutine_stack_check(stack, NULL) == stack);
+
+		/* To the end, but no further. */
+		touch(stack, coroutine_stack_size(stack) - 1024);
+		ok1(coroutine_stack_hwm(stack) == coroutine_stack_size(stack));
+
+		/* Overflowing hits the guard page, or at least gets noticed. */
+		fflush(stdout);
+		child = fork();
+		if (child == 0) {
+			touch(stack, coroutine_stack_size(stack) + 1024);
+			_exit(coroutine_stack_check(stack, NULL) == NULL ? 0 : 1);
+		}
+		waitpid(child, &status, 0);
+		ok1(WIFSIGNALED(status) ? WTERMSIG(status) == SIGSEGV
+		    : WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	} else {
+		skip(5, "Coroutines not available");
+	}
+	ok1(meta->magic == META_MAGIC);
+
+	/* The last one released is the first one reused. */
+	coroutine_stack_release(stack, sizeof(*meta));
+	ok1(coroutine_stack_pool_alloc(STACKSIZE, sizeof(*meta)) == stack);
+	coroutine_stack_release(stack, sizeof(*meta));
+
+	/* Released stacks beyond the first few are decommitted. */
+	for (i = 0; i < MANY; i++) {
+		stacks[i] = coroutine_stack_pool_alloc(STACKSIZE, 0);
+		if (COROUTINE_AVAILABLE)
+			touch(stacks[i], TOUCH);
+	}
+	for (i = 0; i < MANY; i++)
+		coroutine_stack_release(stacks[i], 0);
+	for (i = 0; i < MANY; i++)
+		stacks[i] = coroutine_stack_pool_alloc(STACKSIZE, 0);
+	for (cold = 0, i = 0; i < MANY; i++)
+		cold += coroutine_stack_hwm(stacks[i]) <= pgsz;
+	ok1(cold >= MANY / 2);
+	for (i = 0; i < MANY; i++)
+		coroutine_stack_release(stacks[i], 0);
+
+	/* Too big for the pool: an ordinary stack. */
+	stack = coroutine_stack_pool_alloc(COROUTINE_STACK_POOL_MAX * 2, 0);
+	ok1(stack && stack->magic == COROUTINE_STACK_MAGIC_ALLOC);
+	ok1(coroutine_stack_hwm(stack) <= pgsz);
+	coroutine_stack_release(stack, 0);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
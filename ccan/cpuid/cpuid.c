@@ -39,13 +39,21 @@ enum {
 #ifndef _MSC_VER
 static void get_cpuid(cpuid_t info, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
+	/* 32bit PIC: Don't clobber ebx.  On 64bit, exchanging only the low
+	 * halves would zero the top of rbx, so exchange all of it.  */
+#if UINTPTR_MAX == 0xffffffffffffffff
+#define ASM_XCHG_EBX	"xchg %%rbx, %%rdi\n\t"
+#else
+#define ASM_XCHG_EBX	"xchg %%ebx, %%edi\n\t"
+#endif
 	__asm__(
-		"xchg %%ebx, %%edi\n\t" 	/* 32bit PIC: Don't clobber ebx.  */
+		ASM_XCHG_EBX
 		"cpuid\n\t"
-		"xchg %%ebx, %%edi\n\t"
+		ASM_XCHG_EBX
 		: "=a"(*eax), "=D"(*ebx), "=c"(*ecx), "=d"(*edx)
-		: "0" (info)
+		: "0" (info), "2" (0)
 	);
+#undef ASM_XCHG_EBX
 }
 #else
 #include <intrin.h>
@@ -53,7 +61,7 @@ static void get_cpuid(cpuid_t info, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
 static void get_cpuid(cpuid_t info, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
 	uint32_t registers[4];
-	__cpuid(registers, info);
+	__cpuidex(registers, info, 0);
 
 	*eax = registers[0];
 	*ebx = registers[1];
@@ -152,31 +160,20 @@ bool cpuid_test_feature(cpuid_t feature)
 }
 
 #if defined(__GNUC__) || defined(__clang__)
+/* The callers cache these: don't cache here, since the leaves differ. */
 static uint32_t fetch_ecx(uint32_t what)
 {
-	static uint32_t ecx;
-	if (ecx == 0) {
-		asm volatile(
-			"cpuid\n\t"
-			: "=c" (ecx)
-			: "a" (what)
-		);
-	}
+	uint32_t eax, ebx, ecx, edx;
 
+	get_cpuid(what, &eax, &ebx, &ecx, &edx);
 	return ecx;
 }
 
 static uint32_t fetch_edx(uint32_t what)
 {
-	static uint32_t edx;
-	if (edx == 0) {
-		asm volatile(
-			"cpuid\n\t"
-			: "=d" (edx)
-			: "a" (what)
-		);
-	}
+	uint32_t eax, ebx, ecx, edx;
 
+	get_cpuid(what, &eax, &ebx, &ecx, &edx);
 	return edx;
 }
 #elif defined(_MSC_VER)
@@ -226,6 +223,45 @@ DEFINE_FEATURE_FUNC(edxfeature_ext, edx, CPUID_EXTENDED_PROC_INFO_FEATURE_BITS)
 
 #undef DEFINE_FEATURE_FUNC
 
+bool cpuid_has_ebxfeature7(int feature)
+{
+	static uint32_t ebx;
+	static bool fetched;
+
+	if (!fetched) {
+		uint32_t highest, unused[3];
+
+		get_cpuid(CPUID_VENDORID, &highest, &unused[0], &unused[1], &unused[2]);
+		if (highest >= 7)
+			get_cpuid((cpuid_t)7, &unused[0], &ebx, &unused[1], &unused[2]);
+		fetched = true;
+	}
+	return !!(ebx & feature);
+}
+
+bool cpuid_has_os_avx(void)
+{
+	uint32_t xcr0;
+
+	if (!cpuid_has_ecxfeature(CPUID_FEAT_ECX_OSXSAVE)
+	    || !cpuid_has_ecxfeature(CPUID_FEAT_ECX_AVX))
+		return false;
+
+	/* XMM and YMM state both enabled? */
+#if defined(__GNUC__) || defined(__clang__)
+	{
+		uint32_t hi;
+		/* xgetbv, which older assemblers don't know. */
+		asm volatile(".byte 0x0f, 0x01, 0xd0"
+			     : "=a" (xcr0), "=d" (hi)
+			     : "c" (0));
+	}
+#elif defined(_MSC_VER)
+	xcr0 = (uint32_t)_xgetbv(0);
+#endif
+	return (xcr0 & 6) == 6;
+}
+
 cputype_t cpuid_get_cpu_type(void)
 {
 	static cputype_t cputype;
@@ -378,7 +414,7 @@ bool cpuid_write_info(uint32_t info, uint32_t featureset, FILE *file)
 		fprintf(file, "Highest extended function supported: %#010x\n\n", cpuid_highest_ext_func_supported());
 
 	if (info & CPUID_EXTENDED_L2_CACHE_FEATURES) {
-		uint32_t l2c[3];
+		uint32_t l2c[3] = { 0 };
 		cpuid(CPUID_EXTENDED_L2_CACHE_FEATURES, l2c);
 
 		fprintf(file, "-- Extended L2 Cache features --\nL2 Line size: %u bytes\nAssociativity: %02xh\nCache Size: %u KB\n\n",
@@ -386,7 +422,7 @@ bool cpuid_write_info(uint32_t info, uint32_t featureset, FILE *file)
 	}
 
 	if (info & CPUID_VIRT_PHYS_ADDR_SIZES) {
-		uint32_t phys_virt[2];
+		uint32_t phys_virt[2] = { 0 };
 		cpuid(CPUID_VIRT_PHYS_ADDR_SIZES, phys_virt);
 
 		fprintf(file, "-- Virtual and Physical address sizes --\n"
@@ -394,7 +430,7 @@ bool cpuid_write_info(uint32_t info, uint32_t featureset, FILE *file)
 	}
 
 	if (info & CPUID_PROCINFO_AND_FEATUREBITS) {
-		uint32_t procinfo[9];
+		uint32_t procinfo[9] = { 0 };
 		cpuid(CPUID_PROCINFO_AND_FEATUREBITS, procinfo);
 
 		fputs("-- Processor information and feature bits --\n", file	);
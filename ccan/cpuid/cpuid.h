@@ -213,6 +213,25 @@ enum {
 	CPUID_EXTFEAT_EDX_3DNOW 		= 1 << 31
 };
 
+/* Structured extended features: leaf 7, subleaf 0, EBX. */
+enum {
+	CPUID_FEAT7_EBX_FSGSBASE		= 1 << 0,
+	CPUID_FEAT7_EBX_BMI1			= 1 << 3,
+	CPUID_FEAT7_EBX_HLE			= 1 << 4,
+	CPUID_FEAT7_EBX_AVX2			= 1 << 5,
+	CPUID_FEAT7_EBX_SMEP			= 1 << 7,
+	CPUID_FEAT7_EBX_BMI2			= 1 << 8,
+	CPUID_FEAT7_EBX_ERMS			= 1 << 9,
+	CPUID_FEAT7_EBX_INVPCID			= 1 << 10,
+	CPUID_FEAT7_EBX_RTM			= 1 << 11,
+	CPUID_FEAT7_EBX_AVX512F			= 1 << 16,
+	CPUID_FEAT7_EBX_RDSEED			= 1 << 18,
+	CPUID_FEAT7_EBX_ADX			= 1 << 19,
+	CPUID_FEAT7_EBX_SMAP			= 1 << 20,
+	CPUID_FEAT7_EBX_CLFLUSHOPT		= 1 << 23,
+	CPUID_FEAT7_EBX_SHA			= 1 << 29
+};
+
 typedef enum cputype {
 	CT_NONE,
 	CT_AMDK5,
@@ -425,6 +444,30 @@ bool cpuid_has_edxfeature(int feature);
 bool cpuid_has_ecxfeature_ext(int extfeature);
 bool cpuid_has_edxfeature_ext(int extfeature);
 
+/**
+ * cpuid_has_ebxfeature7 - Test if structured extended @feature is supported
+ * @feature: one of the CPUID_FEAT7_EBX_* bits.
+ *
+ * This is leaf 7 (eg. AVX2, BMI2), which older CPUs don't have: then
+ * this returns false.
+ *
+ * Note that for AVX and AVX2, the OS has to save the registers too:
+ * see cpuid_has_os_avx().
+ */
+bool cpuid_has_ebxfeature7(int feature);
+
+/**
+ * cpuid_has_os_avx - Test if AVX registers are usable
+ *
+ * Returns true if the CPU has AVX and the OS saves the YMM registers
+ * across context switches (ie. it has enabled them in XCR0).
+ *
+ * Example:
+ *	if (cpuid_has_os_avx() && cpuid_has_ebxfeature7(CPUID_FEAT7_EBX_AVX2))
+ *		printf("We can use AVX2\n");
+ */
+bool cpuid_has_os_avx(void);
+
 #else
 #include <ccan/build_assert/build_assert.h>
 
@@ -441,6 +484,8 @@ bool cpuid_has_edxfeature_ext(int extfeature);
 #define cpuid_test_feature(feature) 			BUILD_ASSERT_OR_ZERO(0)
 #define cpuid_has_ecxfeature(feature) 			BUILD_ASSERT_OR_ZERO(0)
 #define cpuid_has_edxfeature(feature) 			BUILD_ASSERT_OR_ZERO(0)
+#define cpuid_has_ebxfeature7(feature) 			BUILD_ASSERT_OR_ZERO(0)
+#define cpuid_has_os_avx() 				BUILD_ASSERT_OR_ZERO(0)
 
 #endif
 #endif
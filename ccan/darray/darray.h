@@ -39,6 +39,15 @@
  *     darray_init(foo.a);
  *     darray_free(foo.a);
  *
+ * Life cycle of a darray with room for a few items inside it:
+ *
+ *     darray_small(int, 8) a = darray_small_new(a, NULL);
+ *     darray_free(a);
+ *
+ *     struct {darray_small(int, 8) a;} foo;
+ *     darray_small_init(foo.a, &allocator);
+ *     darray_free(foo.a);
+ *
  * Typedefs for darrays of common types:
  *
  *     darray_char, darray_schar, darray_uchar
@@ -102,6 +111,9 @@
  *
  *     void   darray_make_room(darray(T) arr, size_t room);
  *
+ *     void   darray_reserve(darray(T) arr, size_t newAlloc);
+ *     void   darray_shrink(darray(T) arr);
+ *
  * Traversal:
  *
  *     darray_foreach(T *&i, darray(T) arr) {...}
@@ -109,6 +121,9 @@
  *
  * Except for darray_foreach, darray_foreach_reverse, and darray_remove,
  * all macros evaluate their non-darray arguments only once.
+ *
+ * Apart from darray_new and darray_init, everything above works on a
+ * darray_small as well as a darray.
  */
 
 /*** Life cycle ***/
@@ -117,7 +132,128 @@
 
 #define darray_new() {0,0,0}
 #define darray_init(arr) do {(arr).item=0; (arr).size=0; (arr).alloc=0;} while(0)
-#define darray_free(arr) do {free((arr).item);} while(0)
+#define darray_free(arr) do { \
+		if (darray_inline_alloc_(arr)) \
+			darray_small_free_(&(arr), (arr).item, &(arr).alloc); \
+		else \
+			free((arr).item); \
+	} while(0)
+
+
+/*
+ * darray_small(type, N) is a darray which keeps up to N items inside
+ * itself, and only allocates memory if it grows beyond that.  Short-lived
+ * arrays which rarely hold more than a few items then never touch malloc.
+ *
+ * The items live inside the darray_small, so don't copy one (or move it
+ * with memcpy or realloc) unless it's empty.  darray_small_new zeroes the
+ * inline storage, as any initializer does; darray_small_init doesn't, so
+ * it's cheaper for arrays on the stack of a hot function.
+ *
+ * Once it outgrows its inline storage, memory comes from the allocator
+ * given at initialization (or the heap if that's NULL).  An allocator's
+ * realloc is called with ptr NULL to allocate, and is told how many bytes
+ * are worth keeping, so that arena or pool allocators can copy the items
+ * themselves.  Its free may be NULL, for an arena which is freed all at
+ * once.
+ *
+ *     static void *arena_realloc(void *ctx, void *ptr, size_t keep, size_t newSize) {
+ *         void *mem = arena_alloc(ctx, newSize);
+ *         if (mem && ptr)
+ *             memcpy(mem, ptr, keep);
+ *         return mem;
+ *     }
+ *     static const struct darray_allocator arena = {arena_realloc, NULL, &my_arena};
+ *
+ *     darray_small(int, 8) a = darray_small_new(a, &arena);
+ *
+ * To hang a tal context off a darray_small, use tal_arr/tal_resize in
+ * realloc and tal_free in free.
+ */
+
+struct darray_allocator {
+	void *(*realloc)(void *ctx, void *ptr, size_t keep, size_t newSize);
+	void (*free)(void *ctx, void *ptr);
+	void *ctx;
+};
+
+#define darray_small(type, n) \
+	struct {type small[n]; type *item; size_t size; size_t alloc; \
+		const struct darray_allocator *allocator;}
+
+#define darray_small_new(arr, allocator_) \
+	{.item=(arr).small, .size=0, .alloc=darray_inline_alloc_(arr), .allocator=(allocator_)}
+#define darray_small_init(arr, allocator_) do { \
+		(arr).item=(arr).small; (arr).size=0; \
+		(arr).alloc=darray_inline_alloc_(arr); (arr).allocator=(allocator_); \
+	} while(0)
+
+/*
+ * How many items fit before .item in this darray: the inline storage of a
+ * darray_small (including any padding), or 0 for a plain darray.  This is
+ * a constant, so macros which work on both only compile in one branch.
+ */
+#define darray_inline_alloc_(arr) \
+	((size_t)((char *)&(arr).item - (char *)&(arr)) / sizeof(*(arr).item))
+
+/* The allocator always comes straight after .alloc in a darray_small. */
+static inline const struct darray_allocator *darray_small_allocator_(size_t *alloc)
+{
+	return *(const struct darray_allocator **)(alloc + 1);
+}
+
+static inline void darray_small_free_(void *arr, void *item, size_t *alloc)
+{
+	const struct darray_allocator *allocator = darray_small_allocator_(alloc);
+
+	if (item == arr)
+		return;
+	if (!allocator)
+		free(item);
+	else if (allocator->free)
+		allocator->free(allocator->ctx, item);
+}
+
+/*
+ * Move a darray_small's items (those below size which fit in the old
+ * allocation) to newAlloc slots.  They stay in (or move back to) the
+ * inline storage if newAlloc fits there.
+ */
+static inline void *darray_small_realloc_(void *arr, void *item, size_t size,
+					  size_t *alloc, size_t inlineAlloc,
+					  size_t newAlloc, size_t itemSize)
+{
+	const struct darray_allocator *allocator = darray_small_allocator_(alloc);
+	size_t keep = size < *alloc ? size : *alloc;
+	void *newItem;
+
+	if (keep > newAlloc)
+		keep = newAlloc;
+
+	if (newAlloc <= inlineAlloc) {
+		if (item != arr) {
+			memcpy(arr, item, keep * itemSize);
+			darray_small_free_(arr, item, alloc);
+		}
+		*alloc = inlineAlloc;
+		return arr;
+	}
+
+	if (item == arr) {
+		newItem = allocator
+			? allocator->realloc(allocator->ctx, NULL, 0, newAlloc * itemSize)
+			: malloc(newAlloc * itemSize);
+		if (newItem)
+			memcpy(newItem, arr, keep * itemSize);
+	} else if (allocator) {
+		newItem = allocator->realloc(allocator->ctx, item,
+					     keep * itemSize, newAlloc * itemSize);
+	} else {
+		newItem = realloc(item, newAlloc * itemSize);
+	}
+	*alloc = newAlloc;
+	return newItem;
+}
 
 
 /*
@@ -265,7 +401,11 @@ typedef darray(unsigned long)  darray_ulong;
 	} while(0)
 
 #define darray_realloc(arr, newAlloc) do { \
-		(arr).item = realloc((arr).item, ((arr).alloc = (newAlloc)) * sizeof(*(arr).item)); \
+		if (darray_inline_alloc_(arr)) \
+			(arr).item = darray_small_realloc_(&(arr), (arr).item, (arr).size, &(arr).alloc, \
+				darray_inline_alloc_(arr), (newAlloc), sizeof(*(arr).item)); \
+		else \
+			(arr).item = realloc((arr).item, ((arr).alloc = (newAlloc)) * sizeof(*(arr).item)); \
 	} while(0)
 #define darray_growalloc(arr, need) do { \
 		size_t __need = (need); \
@@ -273,6 +413,23 @@ typedef darray(unsigned long)  darray_ulong;
 			darray_realloc(arr, darray_next_alloc((arr).alloc, __need)); \
 	} while(0)
 
+/* Unlike darray_growalloc, these allocate exactly what's asked for. */
+#define darray_reserve(arr, newAlloc) do { \
+		size_t __newAlloc = (newAlloc); \
+		if (__newAlloc > (arr).alloc) \
+			darray_realloc(arr, __newAlloc); \
+	} while(0)
+#define darray_shrink(arr) do { \
+		if ((arr).size < (arr).alloc) { \
+			if ((arr).size || darray_inline_alloc_(arr)) \
+				darray_realloc(arr, (arr).size); \
+			else { \
+				darray_free(arr); \
+				darray_init(arr); \
+			} \
+		} \
+	} while(0)
+
 #if HAVE_STATEMENT_EXPR==1
 #define darray_make_room(arr, room) ({size_t newAlloc = (arr).size+(room); if ((arr).alloc<newAlloc) darray_realloc(arr, newAlloc); (arr).item+(arr).size; })
 #endif
@@ -323,6 +480,11 @@ darray_pop_check(arr) does the same as darray_pop, but returns NULL if there are
 darray_make_room(arr, room) ensures there's 'room' elements of space after the end of the darray, and it returns a pointer to this space.
 Currently requires HAVE_STATEMENT_EXPR, but I plan to remove this dependency by creating an inline function.
 
+darray_reserve(arr, newAlloc) makes sure the darray can hold newAlloc items, allocating exactly that many
+	if it can't (no slack), so you can fill a darray whose final size you know with a single allocation.
+darray_shrink(arr) gives back the slack after the last item.  A darray_small moves its items back inside
+	itself if they fit.
+
 The following require HAVE_TYPEOF==1 :
 
 darray_appends(arr, item0, item1...) appends a collection of comma-delimited items to the darray.
@@ -0,0 +1,150 @@
+#include <ccan/tap/tap.h>
+#include <ccan/darray/darray.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static int reallocs, frees;
+
+static void *counting_realloc(void *ctx, void *ptr, size_t keep, size_t newSize)
+{
+	reallocs++;
+	return realloc(ptr, newSize);
+}
+
+static void counting_free(void *ctx, void *ptr)
+{
+	frees++;
+	free(ptr);
+}
+
+static const struct darray_allocator counting = {
+	counting_realloc, counting_free, NULL
+};
+
+/* A bump allocator which is thrown away all at once. */
+struct arena {
+	char buf[4096];
+	size_t used;
+};
+
+static void *arena_realloc(void *ctx, void *ptr, size_t keep, size_t newSize)
+{
+	struct arena *arena = ctx;
+	void *mem;
+
+	if (arena->used + newSize > sizeof(arena->buf))
+		return NULL;
+	mem = arena->buf + arena->used;
+	arena->used += (newSize + 15) & ~(size_t)15;
+	if (ptr)
+		memcpy(mem, ptr, keep);
+	return mem;
+}
+
+static bool is_sequence(const int *item, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++)
+		if (item[i] != (int)i)
+			return false;
+	return true;
+}
+
+int main(void)
+{
+	darray_small(int, 4) a = darray_small_new(a, &counting);
+	darray_small(char, 5) s;
+	darray(int) plain = darray_new();
+	struct arena arena = { .used = 0 };
+	const struct darray_allocator arena_allocator = {
+		arena_realloc, NULL, &arena
+	};
+	int items[100];
+	size_t i;
+
+	plan_tests(28);
+
+	for (i = 0; i < 100; i++)
+		items[i] = i;
+
+	/* Small arrays never allocate. */
+	ok1(a.item == a.small);
+	ok1(darray_alloc(a) == 4);
+	for (i = 0; i < 4; i++)
+		darray_append(a, i);
+	ok1(a.item == a.small && reallocs == 0);
+	ok1(is_sequence(a.item, 4));
+
+	/* Bigger ones do, through the allocator. */
+	darray_append(a, 4);
+	ok1(a.item != a.small && reallocs == 1);
+	ok1(darray_size(a) == 5 && is_sequence(a.item, 5));
+	darray_append_items(a, items + 5, 95);
+	ok1(darray_size(a) == 100 && is_sequence(a.item, 100));
+
+	/* Shrinking moves them back inside. */
+	darray_resize(a, 3);
+	darray_shrink(a);
+	ok1(a.item == a.small && frees == 1);
+	ok1(darray_alloc(a) == 4 && is_sequence(a.item, 3));
+
+	/* Reserving exactly. */
+	darray_reserve(a, 7);
+	ok1(darray_alloc(a) == 7 && a.item != a.small);
+	ok1(is_sequence(a.item, 3));
+	darray_reserve(a, 5);
+	ok1(darray_alloc(a) == 7);
+	darray_free(a);
+	ok1(frees == 2);
+
+	/* Freeing an inline array doesn't call the allocator. */
+	darray_small_init(a, &counting);
+	darray_prepend(a, 1);
+	darray_prepend(a, 0);
+	ok1(is_sequence(a.item, 2));
+	darray_free(a);
+	ok1(frees == 2);
+
+	/* Default allocator, padding used for items, string helpers. */
+	darray_small_init(s, NULL);
+	ok1(darray_alloc(s) >= 5);
+	darray_append_string(s, "abc");
+	ok1(s.item == s.small && strcmp(s.item, "abc") == 0);
+	darray_append_string(s, "defghijklmnop");
+	ok1(s.item != s.small && strcmp(s.item, "abcdefghijklmnop") == 0);
+	darray_from_lit(s, "hi");
+	darray_shrink(s);
+	ok1(s.item == s.small && darray_size(s) == 2
+	    && memcmp(s.item, "hi", 2) == 0);
+	darray_free(s);
+
+	/* An arena allocator with no free. */
+	darray_small_init(a, &arena_allocator);
+	darray_append_items(a, items, 100);
+	ok1(a.item != a.small && is_sequence(a.item, 100));
+	ok1((char *)a.item >= arena.buf
+	    && (char *)a.item < arena.buf + sizeof(arena.buf));
+	darray_free(a);
+
+	/* The same operations on a plain darray. */
+	darray_reserve(plain, 37);
+	ok1(darray_alloc(plain) == 37 && darray_size(plain) == 0);
+	darray_append_items(plain, items, 10);
+	ok1(darray_alloc(plain) == 37);
+	darray_shrink(plain);
+	ok1(darray_alloc(plain) == 10 && is_sequence(plain.item, 10));
+	darray_resize(plain, 0);
+	darray_shrink(plain);
+	ok1(darray_alloc(plain) == 0 && plain.item == NULL);
+	darray_free(plain);
+
+	/* A small darray which is never touched is free to make. */
+	darray_small_init(a, NULL);
+	ok1(darray_empty(a));
+	ok1(darray_inline_alloc_(plain) == 0);
+	ok1(darray_inline_alloc_(a) == 4);
+	darray_free(a);
+
+	return exit_status();
+}
@@ -0,0 +1,108 @@
+/* Speed tests for short-lived darrays: plain, reserved, and darray_small. */
+#include <ccan/darray/darray.h>
+#include <ccan/time/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+static volatile long sink;
+
+static long sum(const long *item, size_t num)
+{
+	long total = 0;
+	size_t i;
+
+	for (i = 0; i < num; i++)
+		total += item[i];
+	return total;
+}
+
+/* Build an array of n items, use it, throw it away. */
+static void __attribute__((noinline)) plain(size_t n)
+{
+	darray(long) arr = darray_new();
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		darray_append(arr, i);
+	sink = sum(arr.item, arr.size);
+	darray_free(arr);
+}
+
+static void __attribute__((noinline)) reserved(size_t n)
+{
+	darray(long) arr = darray_new();
+	size_t i;
+
+	darray_reserve(arr, n);
+	for (i = 0; i < n; i++)
+		darray_append(arr, i);
+	sink = sum(arr.item, arr.size);
+	darray_free(arr);
+}
+
+static void __attribute__((noinline)) small(size_t n)
+{
+	darray_small(long, 8) arr;
+	size_t i;
+
+	darray_small_init(arr, NULL);
+	for (i = 0; i < n; i++)
+		darray_append(arr, i);
+	sink = sum(arr.item, arr.size);
+	darray_free(arr);
+}
+
+static void __attribute__((noinline)) small_items(const long *items, size_t n)
+{
+	darray_small(long, 8) arr;
+
+	darray_small_init(arr, NULL);
+	darray_append_items(arr, items, n);
+	sink = sum(arr.item, arr.size);
+	darray_free(arr);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t sizes[] = { 2, 6, 8, 20, 100 }, num, i, j;
+	long items[100];
+
+	num = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+	for (i = 0; i < 100; i++)
+		items[i] = i;
+
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		size_t n = sizes[j];
+		char name[80];
+
+		printf("%zu items:\n", n);
+		sprintf(name, "darray append x %zu", n);
+		TIME(name, num, for (i = 0; i < num; i++) plain(n));
+		sprintf(name, "darray reserve+append x %zu", n);
+		TIME(name, num, for (i = 0; i < num; i++) reserved(n));
+		sprintf(name, "darray_small(8) append x %zu", n);
+		TIME(name, num, for (i = 0; i < num; i++) small(n));
+		sprintf(name, "darray_small(8) append_items %zu", n);
+		TIME(name, num, for (i = 0; i < num; i++) small_items(items, n));
+	}
+	return 0;
+}
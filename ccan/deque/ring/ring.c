@@ -0,0 +1,186 @@
+/* Licensed under Apache License v2.0 - see LICENSE file for details */
+#include "config.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#include "ring.h"
+
+static void *alloc_aligned(size_t size)
+{
+#if HAVE_POSIX_MEMALIGN
+	void *p;
+
+	if (posix_memalign(&p, DEQ_RING_CACHE_LINE, size) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return p;
+#else
+	return malloc(size);
+#endif
+}
+
+void *deq_ring_alloc_(size_t size)
+{
+	return alloc_aligned(size);
+}
+
+int deq_ring_init_(struct deq_ring *r, unsigned esz, unsigned min,
+		   enum deq_ring_sync sync, unsigned flags)
+{
+	unsigned cap = 1, i;
+
+	assert(r && esz > 0 && min > 0);
+	assert(sync == DEQ_SPSC || sync == DEQ_MPMC);
+
+	/* Indices wrap at UINT_MAX, so must be able to tell full from empty. */
+	if (min > UINT_MAX / 2 + 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	while (cap < min)
+		cap *= 2;
+
+	memset(r, 0, sizeof(*r));
+	r->notempty.fd = r->notfull.fd = -1;
+	r->mask = cap - 1;
+	r->esz = esz;
+	r->sync = sync;
+	r->v = alloc_aligned((size_t)esz * cap);
+	if (!r->v)
+		return -1;
+
+	if (sync == DEQ_MPMC) {
+		r->seq = alloc_aligned(sizeof(r->seq[0]) * cap);
+		if (!r->seq) {
+			deq_ring_reset_(r);
+			return -1;
+		}
+		/* Every slot is free for the first lap of producers. */
+		for (i = 0; i < cap; i++)
+			atomic_init(&r->seq[i], i);
+	}
+
+	if (flags & DEQ_RING_WAIT) {
+#if HAVE_EVENTFD
+		/* One token per wakeup, so each sleeper gets its own. */
+		r->notempty.fd = eventfd(0, EFD_SEMAPHORE|EFD_CLOEXEC);
+		r->notfull.fd = eventfd(0, EFD_SEMAPHORE|EFD_CLOEXEC);
+		if (r->notempty.fd < 0 || r->notfull.fd < 0) {
+			deq_ring_reset_(r);
+			return -1;
+		}
+		r->wait = true;
+#else
+		deq_ring_reset_(r);
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+	return 0;
+}
+
+void deq_ring_reset_(struct deq_ring *r)
+{
+	int saved_errno = errno;
+
+	free(r->v);
+	free(r->seq);
+	if (r->notempty.fd >= 0)
+		close(r->notempty.fd);
+	if (r->notfull.fd >= 0)
+		close(r->notfull.fd);
+	memset(r, 0, sizeof(*r));
+	r->notempty.fd = r->notfull.fd = -1;
+	errno = saved_errno;
+}
+
+#if HAVE_EVENTFD
+/* Is there room (prod) or an element (!prod) for us now? */
+static bool ready(struct deq_ring *r, bool prod)
+{
+	if (r->sync == DEQ_MPMC) {
+		struct deq_ring_end *me = prod ? &r->prod : &r->cons;
+		unsigned pos = atomic_load_explicit(&me->head,
+						    memory_order_relaxed);
+
+		return atomic_load_explicit(&r->seq[pos & r->mask],
+					    memory_order_acquire) == pos + !prod;
+	}
+	if (prod)
+		return atomic_load_explicit(&r->cons.tail, memory_order_acquire)
+			+ r->mask + 1
+			!= atomic_load_explicit(&r->prod.head, memory_order_relaxed);
+	return atomic_load_explicit(&r->prod.tail, memory_order_acquire)
+		!= atomic_load_explicit(&r->cons.head, memory_order_relaxed);
+}
+
+/*
+ * Each sleeper adds itself to the waiters count before it sleeps, and a
+ * waker takes as many off as it writes tokens, so each sleep costs the
+ * other side one write however many slots it releases meanwhile.
+ *
+ * A waiter which finds it doesn't need to sleep after all leaves its
+ * count there (it can't tell its count from another sleeper's), so
+ * someone may later get a spurious wakeup: they just look again.
+ */
+void deq_ring_wake_(struct deq_ring_waitq *wq, unsigned n)
+{
+	unsigned waiters = atomic_load_explicit(&wq->waiters,
+						memory_order_relaxed);
+	uint64_t val;
+
+	do {
+		val = n < waiters ? n : waiters;
+		if (!val)
+			return;
+	} while (!atomic_compare_exchange_weak_explicit(&wq->waiters,
+							 &waiters,
+							 waiters - val,
+							 memory_order_relaxed,
+							 memory_order_relaxed));
+
+	/* This only fails if the count overflows, so they're awake anyway. */
+	if (write(wq->fd, &val, sizeof(val)) != sizeof(val))
+		return;
+}
+
+int deq_ring_wait_(struct deq_ring *r, bool prod)
+{
+	struct deq_ring_waitq *wq = prod ? &r->notfull : &r->notempty;
+	uint64_t val;
+
+	if (!r->wait) {
+		sched_yield();
+		return 0;
+	}
+
+	atomic_fetch_add_explicit(&wq->waiters, 1, memory_order_relaxed);
+	/* Either the other side sees we're waiting, or we see its release. */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (ready(r, prod))
+		return 0;
+	if (read(wq->fd, &val, sizeof(val)) < 0 && errno != EINTR)
+		return -1;
+	return 0;
+}
+#else
+void deq_ring_wake_(struct deq_ring_waitq *wq, unsigned n)
+{
+	abort();
+}
+
+int deq_ring_wait_(struct deq_ring *r, bool prod)
+{
+	sched_yield();
+	return 0;
+}
+#endif
@@ -0,0 +1,464 @@
+/* Licensed under Apache License v2.0 - see LICENSE file for details */
+#ifndef CCAN_DEQUE_RING_H
+#define CCAN_DEQUE_RING_H
+#include "config.h"
+#if !HAVE_STATEMENT_EXPR
+#error "This code needs compiler support for statement expressions. Try using gcc or clang."
+#endif
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define DEQ_RING_CACHE_LINE 64
+
+/**
+ * enum deq_ring_sync - who may use each end of a ring
+ * @DEQ_SPSC: one producer thread and one consumer thread.
+ * @DEQ_MPMC: any number of producer and consumer threads.
+ */
+enum deq_ring_sync { DEQ_SPSC, DEQ_MPMC };
+
+/**
+ * DEQ_RING_WAIT - flag for deq_ring_init: sleep in the _wait operations
+ *
+ * Without this flag, deq_ring_push_wait() and friends spin (yielding the
+ * CPU) until they can proceed.  With it, they sleep on an eventfd, which
+ * costs the other side a system call whenever it releases slots while
+ * someone is asleep (and a memory barrier the rest of the time).
+ */
+#define DEQ_RING_WAIT 1
+
+/*
+ * One side of the ring.  Each side claims slots by moving its head, fills
+ * or empties them, then hands them to the other side.
+ *
+ * With a single thread on each side, that's done by moving the tail up to
+ * the head.  With many, it's done slot by slot: each slot has a sequence
+ * number saying whose turn it is, so threads which claimed later slots
+ * never wait for one which is slow to finish with an earlier one.
+ */
+struct deq_ring_end {
+	_Atomic(unsigned) head;
+	/* SPSC only: where we've handed slots over up to. */
+	_Atomic(unsigned) tail;
+	/* SPSC only: the other side's tail, when we last looked at it. */
+	unsigned seen;
+};
+
+struct deq_ring_waitq {
+	_Atomic(unsigned) waiters;
+	int fd;
+};
+
+/**
+ * struct deq_ring - bounded lock-free ring metadata
+ * @v: char pointer to malloced memory
+ * @mask: capacity - 1 (capacity is a power of 2)
+ * @esz: element size
+ * @sync: DEQ_SPSC or DEQ_MPMC
+ * @wait: whether the DEQ_RING_WAIT flag was given
+ * @seq: MPMC only: sequence number of each slot
+ * @prod: the producers' indices
+ * @cons: the consumers' indices
+ * @notempty: consumers sleeping until there's an element
+ * @notfull: producers sleeping until there's room
+ *
+ * Indices count up forever (wrapping at UINT_MAX), and are masked to find
+ * a slot.  Each side's indices are on their own cache line, so producers
+ * and consumers only share a line when one of them runs out of slots.
+ *
+ * In MPMC mode, slot i is free for the producer at index p when @seq[i]
+ * is p, and full for the consumer at index c when it is c + 1.
+ */
+struct deq_ring {
+	char *v;
+	unsigned mask, esz;
+	enum deq_ring_sync sync;
+	bool wait;
+	_Atomic(unsigned) *seq;
+	_Alignas(DEQ_RING_CACHE_LINE) struct deq_ring_end prod;
+	_Alignas(DEQ_RING_CACHE_LINE) struct deq_ring_end cons;
+	_Alignas(DEQ_RING_CACHE_LINE) struct deq_ring_waitq notempty, notfull;
+};
+
+/**
+ * DEQ_RING_WRAP - declare a wrapper type for struct deq_ring and base type
+ * @basetype: the base type to wrap
+ *
+ * This is the bounded, thread-safe counterpart of DEQ_WRAP: elements are
+ * pushed onto the end and shifted off the beginning, by the threads
+ * given at deq_ring_init().
+ *
+ * Example:
+ *	struct job { int fd; unsigned events; };
+ *	typedef DEQ_RING_WRAP(struct job) jobq_t;
+ *	jobq_t jobs;
+ *
+ *	if (deq_ring_init(&jobs, 1024, DEQ_SPSC, DEQ_RING_WAIT) == -1)
+ *		err(1, "deq_ring_init");
+ */
+#define DEQ_RING_WRAP(basetype)		\
+	union {				\
+		struct deq_ring ring;	\
+		basetype *v;		\
+	}
+
+/**
+ * deq_ring_init - initialize struct deq_ring and malloc
+ * @w: pointer to wrapper
+ * @min: minimum capacity of ring (rounded up to a power of 2)
+ * @sync: DEQ_SPSC or DEQ_MPMC
+ * @flags: 0 or DEQ_RING_WAIT
+ *
+ * Unlike a deque, a ring never grows: pushes to a full ring fail (or wait).
+ *
+ * Returns: 0 on success, -1 on error (ENOSYS if DEQ_RING_WAIT isn't
+ * supported on this platform)
+ */
+int deq_ring_init_(struct deq_ring *r, unsigned esz, unsigned min,
+		   enum deq_ring_sync sync, unsigned flags);
+#define deq_ring_init(w, min, sync, flags) \
+	deq_ring_init_(&(w)->ring, sizeof(*(w)->v), (min), (sync), (flags))
+
+/**
+ * deq_ring_new - malloc wrapper and run deq_ring_init
+ * @w: pointer to wrapper
+ * @min: minimum capacity of ring
+ * @sync: DEQ_SPSC or DEQ_MPMC
+ * @flags: 0 or DEQ_RING_WAIT
+ *
+ * The wrapper is cache-line aligned, so use deq_ring_free() (or free())
+ * to release it.
+ *
+ * Example:
+ *	DEQ_RING_WRAP(int) *q;
+ *
+ *	if (deq_ring_new(q, 256, DEQ_MPMC, 0) == -1)
+ *		err(1, "deq_ring_new");
+ *	//later
+ *	deq_ring_free(q);
+ *
+ * Returns: 0 on success, -1 on error
+ */
+void *deq_ring_alloc_(size_t size);
+#define deq_ring_new(w, min, sync, flags) ({				\
+	w = deq_ring_alloc_(sizeof(*w));				\
+	if (w && deq_ring_init(w, min, sync, flags) == -1) {		\
+		free(w);						\
+		w = 0;							\
+	}								\
+	w ? 0 : -1;							\
+})
+
+/* Claim up to n slots on our side, returning how many we got. */
+static inline unsigned deq_ring_claim_(struct deq_ring *r, bool prod,
+				       unsigned n, unsigned *start)
+{
+	struct deq_ring_end *me = prod ? &r->prod : &r->cons;
+	unsigned head, k;
+
+	if (r->sync == DEQ_SPSC) {
+		struct deq_ring_end *other = prod ? &r->cons : &r->prod;
+		/* Producers can refill every slot the consumers released. */
+		unsigned off = prod ? r->mask + 1 : 0;
+
+		head = atomic_load_explicit(&me->head, memory_order_relaxed);
+		/* Don't touch the other side's line unless we have to. */
+		if (me->seen + off - head < n)
+			me->seen = atomic_load_explicit(&other->tail,
+							memory_order_acquire);
+		k = me->seen + off - head;
+		if (n > k)
+			n = k;
+		if (n)
+			atomic_store_explicit(&me->head, head + n,
+					      memory_order_relaxed);
+		*start = head;
+		return n;
+	}
+
+	head = atomic_load_explicit(&me->head, memory_order_relaxed);
+	for (;;) {
+		/* Count the slots from head which are our side's turn. */
+		for (k = 0; k < n; k++) {
+			unsigned pos = head + k;
+
+			if (atomic_load_explicit(&r->seq[pos & r->mask],
+						 memory_order_acquire)
+			    != pos + !prod)
+				break;
+		}
+		if (k == 0) {
+			unsigned now = atomic_load_explicit(&me->head,
+							    memory_order_relaxed);
+			/* Really full (or empty), not just someone beat us. */
+			if (now == head)
+				return 0;
+			head = now;
+			continue;
+		}
+		/* Nobody else can touch them until we move head past them. */
+		if (atomic_compare_exchange_weak_explicit(&me->head, &head,
+							  head + k,
+							  memory_order_relaxed,
+							  memory_order_relaxed))
+			break;
+	}
+	*start = head;
+	return k;
+}
+
+void deq_ring_wake_(struct deq_ring_waitq *wq, unsigned n);
+
+/* Hand n claimed slots, from start, to the other side. */
+static inline void deq_ring_release_(struct deq_ring *r, bool prod,
+				     unsigned start, unsigned n)
+{
+	if (r->sync == DEQ_SPSC) {
+		struct deq_ring_end *me = prod ? &r->prod : &r->cons;
+
+		atomic_store_explicit(&me->tail, start + n,
+				      memory_order_release);
+	} else {
+		/* Consumers free the slot for the producer one lap on. */
+		unsigned k, next = prod ? 1 : r->mask + 1;
+
+		for (k = 0; k < n; k++)
+			atomic_store_explicit(&r->seq[(start + k) & r->mask],
+					      start + k + next,
+					      memory_order_release);
+	}
+
+	if (r->wait) {
+		struct deq_ring_waitq *wq = prod ? &r->notempty : &r->notfull;
+
+		/* Pairs with the fence in deq_ring_wait_(). */
+		atomic_thread_fence(memory_order_seq_cst);
+		if (atomic_load_explicit(&wq->waiters, memory_order_relaxed))
+			deq_ring_wake_(wq, n);
+	}
+}
+
+/**
+ * deq_ring_push - add element to end of ring
+ * @w: pointer to wrapper
+ * @e: element to add
+ *
+ * Returns: 1 on success, 0 if ring is full
+ */
+#define deq_ring_push(w, e) ({						\
+	unsigned __s = 0;							\
+	int __ret = deq_ring_claim_(&(w)->ring, true, 1, &__s);		\
+	if (__ret) {							\
+		(w)->v[__s & (w)->ring.mask] = (e);			\
+		deq_ring_release_(&(w)->ring, true, __s, 1);		\
+	}								\
+	__ret;								\
+})
+
+/**
+ * deq_ring_shift - remove element from beginning of ring
+ * @w: pointer to wrapper
+ * @e: pointer to receive element
+ *
+ * Returns: 1 on success, 0 if ring is empty
+ */
+#define deq_ring_shift(w, e) ({						\
+	unsigned __s = 0;							\
+	int __ret = deq_ring_claim_(&(w)->ring, false, 1, &__s);	\
+	if (__ret) {							\
+		*(e) = (w)->v[__s & (w)->ring.mask];			\
+		deq_ring_release_(&(w)->ring, false, __s, 1);		\
+	}								\
+	__ret;								\
+})
+
+/**
+ * deq_ring_push_n - add up to n elements to end of ring
+ * @w: pointer to wrapper
+ * @e: array of elements to add
+ * @n: number of elements in @e
+ *
+ * This adds as many of the elements as will fit, in order, for about the
+ * cost of a single push.
+ *
+ * Example:
+ *	struct job { int fd; unsigned events; };
+ *	typedef DEQ_RING_WRAP(struct job) jobq_t;
+ *
+ *	static void send_all(jobq_t *q, const struct job *job, unsigned num)
+ *	{
+ *		unsigned done = 0;
+ *
+ *		while (done < num)
+ *			done += deq_ring_push_n(q, job + done, num - done);
+ *	}
+ *
+ * Returns: number of elements added (0 if ring is full)
+ */
+#define deq_ring_push_n(w, e, n) ({					\
+	unsigned __s = 0, __k;						\
+	unsigned __n = deq_ring_claim_(&(w)->ring, true, (n), &__s);	\
+	for (__k = 0; __k < __n; __k++)					\
+		(w)->v[(__s + __k) & (w)->ring.mask] = (e)[__k];	\
+	if (__n)							\
+		deq_ring_release_(&(w)->ring, true, __s, __n);		\
+	__n;								\
+})
+
+/**
+ * deq_ring_shift_n - remove up to n elements from beginning of ring
+ * @w: pointer to wrapper
+ * @e: array to receive elements
+ * @n: maximum number of elements to remove
+ *
+ * Returns: number of elements removed (0 if ring is empty)
+ */
+#define deq_ring_shift_n(w, e, n) ({					\
+	unsigned __s = 0, __k;						\
+	unsigned __n = deq_ring_claim_(&(w)->ring, false, (n), &__s);	\
+	for (__k = 0; __k < __n; __k++)					\
+		(e)[__k] = (w)->v[(__s + __k) & (w)->ring.mask];	\
+	if (__n)							\
+		deq_ring_release_(&(w)->ring, false, __s, __n);		\
+	__n;								\
+})
+
+/* Wait until there's probably room (prod) or an element (!prod). */
+int deq_ring_wait_(struct deq_ring *r, bool prod);
+
+/**
+ * deq_ring_push_wait - add element to end of ring, waiting if it's full
+ * @w: pointer to wrapper
+ * @e: element to add
+ *
+ * Returns: 1 on success, -1 on error
+ */
+#define deq_ring_push_wait(w, e) ({					\
+	unsigned __s = 0;							\
+	int __ret;							\
+	while ((__ret = deq_ring_claim_(&(w)->ring, true, 1, &__s)) == 0 \
+	       && (__ret = deq_ring_wait_(&(w)->ring, true)) == 0);	\
+	if (__ret == 1) {						\
+		(w)->v[__s & (w)->ring.mask] = (e);			\
+		deq_ring_release_(&(w)->ring, true, __s, 1);		\
+	}								\
+	__ret;								\
+})
+
+/**
+ * deq_ring_shift_wait - remove element from beginning of ring, waiting if empty
+ * @w: pointer to wrapper
+ * @e: pointer to receive element
+ *
+ * Returns: 1 on success, -1 on error
+ */
+#define deq_ring_shift_wait(w, e) ({					\
+	unsigned __s = 0;							\
+	int __ret;							\
+	while ((__ret = deq_ring_claim_(&(w)->ring, false, 1, &__s)) == 0 \
+	       && (__ret = deq_ring_wait_(&(w)->ring, false)) == 0);	\
+	if (__ret == 1) {						\
+		*(e) = (w)->v[__s & (w)->ring.mask];			\
+		deq_ring_release_(&(w)->ring, false, __s, 1);		\
+	}								\
+	__ret;								\
+})
+
+/**
+ * deq_ring_shift_n_wait - remove 1 to n elements from beginning of ring
+ * @w: pointer to wrapper
+ * @e: array to receive elements
+ * @n: maximum number of elements to remove (must be at least 1)
+ *
+ * This waits until the ring isn't empty, then takes whatever is there (up
+ * to @n elements).
+ *
+ * Example:
+ *	struct job { int fd; unsigned events; };
+ *	typedef DEQ_RING_WRAP(struct job) jobq_t;
+ *
+ *	static void *worker(jobq_t *q)
+ *	{
+ *		struct job job[32];
+ *		int i, n;
+ *
+ *		while ((n = deq_ring_shift_n_wait(q, job, 32)) > 0) {
+ *			for (i = 0; i < n; i++)
+ *				if (job[i].fd < 0)
+ *					return NULL;
+ *			// ... handle job[0] to job[n-1]
+ *		}
+ *		err(1, "deq_ring_shift_n_wait");
+ *	}
+ *
+ * Returns: number of elements removed, or -1 on error
+ */
+#define deq_ring_shift_n_wait(w, e, n) ({				\
+	unsigned __s = 0, __k;						\
+	int __ret;							\
+	while ((__ret = deq_ring_claim_(&(w)->ring, false, (n), &__s)) == 0 \
+	       && (__ret = deq_ring_wait_(&(w)->ring, false)) == 0);	\
+	for (__k = 0; __ret > 0 && __k < (unsigned)__ret; __k++)	\
+		(e)[__k] = (w)->v[(__s + __k) & (w)->ring.mask];	\
+	if (__ret > 0)							\
+		deq_ring_release_(&(w)->ring, false, __s, __ret);	\
+	__ret;								\
+})
+
+/**
+ * deq_ring_reset - free malloced buffer and eventfds
+ * @w: pointer to wrapper
+ *
+ * No other thread may be using the ring.
+ *
+ * Returns: void
+ */
+void deq_ring_reset_(struct deq_ring *r);
+#define deq_ring_reset(w) do {		\
+	assert(w);			\
+	deq_ring_reset_(&(w)->ring);	\
+} while (0)
+
+/**
+ * deq_ring_free - run deq_ring_reset and free malloced wrapper
+ * @w: pointer to wrapper
+ *
+ * Returns: void
+ */
+#define deq_ring_free(w) do {	\
+	deq_ring_reset(w);	\
+	free(w);		\
+	w = 0;			\
+} while (0)
+
+/**
+ * deq_ring_len - return number of elements in ring
+ * @w: pointer to wrapper
+ *
+ * If other threads are using the ring, this is only a snapshot: elements
+ * which are being pushed or shifted right now may or may not be counted.
+ *
+ * Returns: unsigned
+ */
+static inline unsigned deq_ring_len_(struct deq_ring *r)
+{
+	/* Consumers' head first: it can't pass the producers' head. */
+	unsigned cons = atomic_load_explicit(&r->cons.head, memory_order_acquire);
+	unsigned len = atomic_load_explicit(&r->prod.head, memory_order_acquire)
+		- cons;
+
+	return len > r->mask ? r->mask + 1 : len;
+}
+#define deq_ring_len(w) ({ assert(w); deq_ring_len_(&(w)->ring); })
+
+/**
+ * deq_ring_cap - return ring capacity
+ * @w: pointer to wrapper
+ *
+ * Returns: unsigned
+ */
+#define deq_ring_cap(w) ({ assert(w); (w)->ring.mask + 1; })
+
+#endif /* CCAN_DEQUE_RING_H */
@@ -0,0 +1,134 @@
+#include <ccan/deque/ring/ring.h>
+/* Include the C files directly. */
+#include <ccan/deque/ring/ring.c>
+#include <ccan/tap/tap.h>
+
+#include <pthread.h>
+
+#define THREADS 4
+#define NUM 20000
+#define BATCH 7
+
+/* Producer number in the top bits, sequence number in the bottom. */
+typedef DEQ_RING_WRAP(unsigned) ring_t;
+static ring_t *q;
+static unsigned char seen[THREADS][NUM];
+
+static void *producer(void *arg)
+{
+	unsigned i = 0, t = (unsigned long)arg, arr[BATCH], k;
+
+	while (i < NUM) {
+		/* Mix single and batch pushes. */
+		if (i % 2) {
+			if (deq_ring_push_wait(q, (t << 24) | i) != 1)
+				return NULL;
+			i++;
+			continue;
+		}
+		for (k = 0; k < BATCH && i + k < NUM; k++)
+			arr[k] = (t << 24) | (i + k);
+		i += k;
+		while (k) {
+			unsigned n = deq_ring_push_n(q, arr, k);
+			memmove(arr, arr + n, (k - n) * sizeof(arr[0]));
+			k -= n;
+			if (k && deq_ring_wait_(&q->ring, true) == -1)
+				return NULL;
+		}
+	}
+	return arg;
+}
+
+/* Each consumer checks that each producer's items arrive in order. */
+static void *consumer(void *arg)
+{
+	unsigned next[THREADS] = { 0 }, arr[BATCH], ok = 1, stops = 0;
+	int i, n;
+
+	while (!stops) {
+		n = deq_ring_shift_n_wait(q, arr, BATCH);
+		if (n < 0)
+			return NULL;
+		for (i = 0; i < n; i++) {
+			unsigned t = arr[i] >> 24, seq = arr[i] & 0xFFFFFF;
+
+			/* Told to stop. */
+			if (t == THREADS) {
+				stops++;
+				continue;
+			}
+			if (seq < next[t] || stops)
+				ok = 0;
+			next[t] = seq + 1;
+			seen[t][seq]++;
+		}
+	}
+	/* We may have grabbed someone else's stop message too. */
+	while (--stops)
+		deq_ring_push_wait(q, THREADS << 24);
+	return ok ? arg : NULL;
+}
+
+static bool all_seen_once(void)
+{
+	int t, i;
+
+	for (t = 0; t < THREADS; t++)
+		for (i = 0; i < NUM; i++)
+			if (seen[t][i] != 1)
+				return false;
+	return true;
+}
+
+static void run(enum deq_ring_sync sync, unsigned flags, unsigned cap,
+		int producers, int consumers)
+{
+	pthread_t prod[THREADS], cons[THREADS];
+	void *ret;
+	int i, ok = 1;
+
+	memset(seen, 0, sizeof(seen));
+	ok1(deq_ring_new(q, cap, sync, flags) == 0);
+
+	for (i = 0; i < producers; i++)
+		pthread_create(&prod[i], NULL, producer, (void *)(long)i);
+	for (i = 0; i < consumers; i++)
+		pthread_create(&cons[i], NULL, consumer, (void *)(long)(i + 1));
+
+	for (i = 0; i < producers; i++) {
+		pthread_join(prod[i], &ret);
+		if (ret != (void *)(long)i)
+			ok = 0;
+	}
+	for (i = 0; i < consumers; i++)
+		deq_ring_push_wait(q, THREADS << 24);
+	for (i = 0; i < consumers; i++) {
+		pthread_join(cons[i], &ret);
+		if (ret != (void *)(long)(i + 1))
+			ok = 0;
+	}
+	ok1(ok);
+	ok1(deq_ring_len(q) == 0);
+
+	/* Only the producers we ran pushed anything. */
+	for (i = producers; i < THREADS; i++)
+		memset(seen[i], 1, NUM);
+	ok1(all_seen_once());
+	deq_ring_free(q);
+}
+
+int main(void)
+{
+	plan_tests(6 * 4);
+
+	/* Tiny rings, so both sides keep running out. */
+	run(DEQ_SPSC, 0, 4, 1, 1);
+	run(DEQ_SPSC, DEQ_RING_WAIT, 4, 1, 1);
+	run(DEQ_MPMC, 0, 8, THREADS, THREADS);
+	run(DEQ_MPMC, DEQ_RING_WAIT, 8, THREADS, THREADS);
+	run(DEQ_MPMC, DEQ_RING_WAIT, 2, THREADS, 1);
+	run(DEQ_SPSC, DEQ_RING_WAIT, 1024, 1, 1);
+
+	return exit_status();
+}
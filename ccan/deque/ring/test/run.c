@@ -0,0 +1,109 @@
+#include <ccan/deque/ring/ring.h>
+/* Include the C files directly. */
+#include <ccan/deque/ring/ring.c>
+#include <ccan/tap/tap.h>
+#include <stddef.h>
+
+static void test_sync(enum deq_ring_sync sync, unsigned flags)
+{
+	DEQ_RING_WRAP(int) *q;
+	int i, t, ok_order, arr[10], out[10];
+	unsigned n;
+
+	ok1(deq_ring_new(q, 5, sync, flags) == 0);
+	ok1(deq_ring_cap(q) == 8);
+	ok1(deq_ring_len(q) == 0);
+	ok1(deq_ring_shift(q, &t) == 0);
+
+	for (i = 0; i < 8; i++)
+		if (deq_ring_push(q, i) != 1)
+			break;
+	ok1(i == 8);
+	ok1(deq_ring_len(q) == 8);
+	ok1(deq_ring_push(q, 8) == 0);
+
+	ok1(deq_ring_shift(q, &t) == 1 && t == 0);
+	ok1(deq_ring_shift(q, &t) == 1 && t == 1);
+	ok1(deq_ring_len(q) == 6);
+
+	/* Only two fit, and they wrap around. */
+	for (i = 0; i < 10; i++)
+		arr[i] = 100 + i;
+	ok1(deq_ring_push_n(q, arr, 10) == 2);
+	ok1(deq_ring_push_n(q, arr, 10) == 0);
+	ok1(deq_ring_len(q) == 8);
+
+	n = deq_ring_shift_n(q, out, 10);
+	ok1(n == 8);
+	ok_order = 1;
+	for (i = 0; i < 6; i++)
+		if (out[i] != i + 2)
+			ok_order = 0;
+	ok1(ok_order && out[6] == 100 && out[7] == 101);
+	ok1(deq_ring_shift_n(q, out, 10) == 0);
+
+	/* Go round plenty of times, in odd sized batches. */
+	ok_order = 1;
+	for (i = 0, t = 0; i < 1000; i++) {
+		int j, k;
+
+		for (j = 0; j < 3; j++)
+			arr[j] = i * 3 + j;
+		if (deq_ring_push_n(q, arr, 3) != 3)
+			ok_order = 0;
+		n = deq_ring_shift_n(q, out, 2);
+		for (k = 0; k < n; k++)
+			if (out[k] != t++)
+				ok_order = 0;
+		if (deq_ring_len(q) > 4) {
+			n = deq_ring_shift_n(q, out, 10);
+			for (k = 0; k < n; k++)
+				if (out[k] != t++)
+					ok_order = 0;
+		}
+	}
+	ok1(ok_order);
+	while (deq_ring_shift(q, &i) == 1)
+		if (i != t++)
+			ok_order = 0;
+	ok1(ok_order && t == 3000);
+
+	/* These don't wait if they don't have to. */
+	ok1(deq_ring_push_wait(q, 7) == 1);
+	ok1(deq_ring_push(q, 8) == 1);
+	ok1(deq_ring_shift_wait(q, &t) == 1 && t == 7);
+	ok1(deq_ring_shift_n_wait(q, out, 10) == 1 && out[0] == 8);
+
+	deq_ring_free(q);
+	ok1(q == NULL);
+}
+
+int main(void)
+{
+	DEQ_RING_WRAP(char) c;
+	struct point { int x, y; } p = { 1, 2 };
+	DEQ_RING_WRAP(struct point) pq;
+
+	plan_tests(3 * 23 + 7);
+
+	test_sync(DEQ_SPSC, 0);
+	test_sync(DEQ_MPMC, 0);
+	test_sync(DEQ_MPMC, DEQ_RING_WAIT);
+
+	/* Padded, so producers and consumers don't share a line. */
+	ok1(offsetof(struct deq_ring, cons) - offsetof(struct deq_ring, prod)
+	    >= DEQ_RING_CACHE_LINE);
+
+	ok1(deq_ring_init(&c, 1, DEQ_SPSC, 0) == 0);
+	ok1(deq_ring_cap(&c) == 1);
+	ok1(deq_ring_push(&c, 'a') == 1 && deq_ring_push(&c, 'b') == 0);
+	deq_ring_reset(&c);
+
+	ok1(deq_ring_init(&pq, 3, DEQ_SPSC, 0) == 0);
+	ok1(deq_ring_push(&pq, p) == 1);
+	p.x = p.y = 0;
+	ok1(deq_ring_shift(&pq, &p) == 1 && p.x == 1 && p.y == 2);
+	deq_ring_reset(&pq);
+
+	return exit_status();
+}
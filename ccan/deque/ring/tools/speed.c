@@ -0,0 +1,158 @@
+/*
+ * Thread handoff speed test: a struct deq behind a mutex and condition
+ * variable, against SPSC and MPMC rings, pushing single items or
+ * batches from producer threads to consumer threads.
+ *
+ * Usage: speed [items-per-producer] [ring-size] [max-threads]
+ */
+#include <ccan/deque/deque.h>
+#include <ccan/deque/ring/ring.h>
+#include <ccan/time/time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH 32
+
+enum kind { LOCKED, SPSC, MPMC };
+
+static size_t num;
+static unsigned int ring_size;
+
+static DEQ_WRAP(size_t) locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static DEQ_RING_WRAP(size_t) *ring;
+
+struct thread {
+	pthread_t id;
+	enum kind kind;
+	unsigned int batch;
+	/* Consumers: how many items to take. */
+	size_t todo;
+	size_t sum;
+};
+
+static void *produce(void *arg)
+{
+	struct thread *me = arg;
+	size_t i, k, arr[BATCH];
+
+	for (i = 0; i < num; i += me->batch) {
+		for (k = 0; k < me->batch; k++)
+			arr[k] = i + k;
+		if (me->kind == LOCKED) {
+			pthread_mutex_lock(&lock);
+			for (k = 0; k < me->batch; k++)
+				deq_push(&locked, arr[k]);
+			pthread_cond_signal(&cond);
+			pthread_mutex_unlock(&lock);
+		} else if (me->batch == 1) {
+			deq_ring_push_wait(ring, arr[0]);
+		} else {
+			size_t done = 0;
+
+			while ((done += deq_ring_push_n(ring, arr + done,
+							me->batch - done))
+			       < me->batch)
+				deq_ring_wait_(&ring->ring, true);
+		}
+	}
+	return NULL;
+}
+
+static void *consume(void *arg)
+{
+	struct thread *me = arg;
+	size_t arr[BATCH];
+	int k, n;
+
+	while (me->todo) {
+		if (me->kind == LOCKED) {
+			pthread_mutex_lock(&lock);
+			while (deq_len(&locked) == 0)
+				pthread_cond_wait(&cond, &lock);
+			for (n = 0; n < me->batch && n < me->todo
+				     && deq_shift(&locked, &arr[n]) == 1;
+			     n++);
+			pthread_mutex_unlock(&lock);
+		} else {
+			n = deq_ring_shift_n_wait(ring, arr,
+						  me->batch < me->todo
+						  ? me->batch : me->todo);
+		}
+		for (k = 0; k < n; k++)
+			me->sum += arr[k];
+		me->todo -= n;
+	}
+	return NULL;
+}
+
+/* Nanoseconds per item. */
+static double bench(enum kind kind, unsigned int batch, unsigned int nthreads)
+{
+	struct thread prod[nthreads], cons[nthreads];
+	size_t sum = 0;
+	struct timeabs start;
+	unsigned int i;
+
+	if (kind == LOCKED)
+		deq_init(&locked, ring_size, DEQ_NO_SHRINK);
+	else
+		deq_ring_new(ring, ring_size, kind == SPSC ? DEQ_SPSC : DEQ_MPMC,
+			     DEQ_RING_WAIT);
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++) {
+		prod[i].kind = cons[i].kind = kind;
+		prod[i].batch = cons[i].batch = batch;
+		cons[i].todo = num;
+		cons[i].sum = 0;
+		pthread_create(&prod[i].id, NULL, produce, &prod[i]);
+		pthread_create(&cons[i].id, NULL, consume, &cons[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(prod[i].id, NULL);
+		pthread_join(cons[i].id, NULL);
+		sum += cons[i].sum;
+	}
+	if (sum != (size_t)nthreads * num * (num - 1) / 2)
+		abort();
+
+	if (kind == LOCKED)
+		deq_reset(&locked);
+	else
+		deq_ring_free(ring);
+
+	return (double)time_to_nsec(time_between(time_now(), start))
+		/ (nthreads * num);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int batches[] = { 1, BATCH }, max_threads, n, b;
+
+	num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	ring_size = argc > 2 ? atoi(argv[2]) : 1024;
+	max_threads = argc > 3 ? atoi(argv[3]) : 8;
+	/* Batches must divide evenly. */
+	num -= num % BATCH;
+
+	printf("%zu items per producer, ring of %u (ns/item)\n",
+	       num, ring_size);
+	for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+		printf("batch %u:\n", batches[b]);
+		printf("pairs\tmutex\tspsc\tmpmc\n");
+		for (n = 1; n <= max_threads; n *= 2) {
+			/* Only a single producer and consumer can use SPSC. */
+			printf("%u\t%.1f\t", n, bench(LOCKED, batches[b], n));
+			if (n == 1)
+				printf("%.1f\t", bench(SPSC, batches[b], n));
+			else
+				printf("-\t");
+			printf("%.1f\n", bench(MPMC, batches[b], n));
+		}
+	}
+	return 0;
+}
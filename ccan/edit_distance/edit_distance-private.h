@@ -9,6 +9,13 @@
 
 #include "edit_distance.h"
 
+#if defined(ED_COST_IS_SYMMETRIC) && defined(ED_HASH_ON_STACK)
+/** Defined when the bit-parallel algorithms can be used: all operations cost
+ * 1 and #ED_HASH_ELEM maps elements to a small range, so a bit-vector of the
+ * positions of each element value in @p src is affordable. */
+# define ED_BIT_PARALLEL
+#endif
+
 /** Unsafe (arguments evaluated multiple times) 3-value minimum. */
 #define ED_MIN2(a, b) ((a) < (b) ? (a) : (b))
 
@@ -16,10 +23,16 @@
 #define ED_MIN3(a, b, c) \
 	((a) < (b) ? ((a) < (c) ? (a) : (c)) : ((b) < (c) ? (b) : (c)))
 
+/** Unsafe (arguments evaluated multiple times) 2-value maximum. */
+#define ED_MAX2(a, b) ((a) > (b) ? (a) : (b))
+
 /** Swap variables @p a and @p b of a given type. */
 #define ED_SWAP(a, b, Type) \
 	do { Type swaptmp = a; a = b; b = swaptmp; } while (0)
 
+/** Result for a distance which exceeds @p max. */
+#define ED_OVER(max) ((ed_dist)((max) + 1))
+
 /** Number of elements in triangular matrix (with diagonal).
  * @param rc Number of rows (or columns, since square). */
 #define ED_TMAT_SIZE(rc) (((rc) + 1) * (rc) / 2)
@@ -34,10 +47,12 @@
  * @param slen Number of elements in @p src to consider (must be > 0).
  * @param tgt Target array to calculate distance to.
  * @param tlen Number of elements in @p tgt to consider (must be > 0).
- * @return LCS distance from @p src[0..slen-1] to @p tgt[0..tlen-1].
+ * @param max Distance beyond which the exact value is not needed.
+ * @return LCS distance from @p src[0..slen-1] to @p tgt[0..tlen-1], or a
+ * value greater than @p max if it is greater than @p max.
  */
 ed_dist edit_distance_lcs(const ed_elem *src, ed_size slen,
-			  const ed_elem *tgt, ed_size tlen);
+			  const ed_elem *tgt, ed_size tlen, ed_dist max);
 
 /**
  * Calculates non-trivial Levenshtein distance (for internal use).
@@ -46,10 +61,12 @@ ed_dist edit_distance_lcs(const ed_elem *src, ed_size slen,
  * @param slen Number of elements in @p src to consider (must be > 0).
  * @param tgt Target array to calculate distance to.
  * @param tlen Number of elements in @p tgt to consider (must be > 0).
- * @return Levenshtein distance from @p src[0..slen-1] to @p tgt[0..tlen-1].
+ * @param max Distance beyond which the exact value is not needed.
+ * @return Levenshtein distance from @p src[0..slen-1] to @p tgt[0..tlen-1],
+ * or a value greater than @p max if it is greater than @p max.
  */
 ed_dist edit_distance_lev(const ed_elem *src, ed_size slen,
-			  const ed_elem *tgt, ed_size tlen);
+			  const ed_elem *tgt, ed_size tlen, ed_dist max);
 
 /**
  * Calculates non-trivial Restricted Damerau-Levenshtein distance (for internal
@@ -59,11 +76,13 @@ ed_dist edit_distance_lev(const ed_elem *src, ed_size slen,
  * @param slen Number of elements in @p src to consider (must be > 0).
  * @param tgt Target array to calculate distance to.
  * @param tlen Number of elements in @p tgt to consider (must be > 0).
+ * @param max Distance beyond which the exact value is not needed.
  * @return Restricted Damerau-Levenshtein distance from @p src[0..slen-1] to
- * @p tgt[0..tlen-1].
+ * @p tgt[0..tlen-1], or a value greater than @p max if it is greater than
+ * @p max.
  */
 ed_dist edit_distance_rdl(const ed_elem *src, ed_size slen,
-			  const ed_elem *tgt, ed_size tlen);
+			  const ed_elem *tgt, ed_size tlen, ed_dist max);
 
 /**
  * Calculates non-trivial Damerau-Levenshtein distance (for internal use).
@@ -78,4 +97,124 @@ ed_dist edit_distance_rdl(const ed_elem *src, ed_size slen,
 ed_dist edit_distance_dl(const ed_elem *src, ed_size slen,
 			 const ed_elem *tgt, ed_size tlen);
 
+#ifdef ED_BIT_PARALLEL
+# include <stdint.h>		/* uint64_t */
+# include <string.h>		/* memset */
+
+/** Word of a bit-vector with one bit per element of @p src. */
+typedef uint64_t ed_word;
+
+/** Number of bits in an ::ed_word. */
+# define ED_WORD_BITS 64
+
+/** Number of ::ed_word blocks needed for @p len elements. */
+# define ED_BLOCKS(len) (((len) + ED_WORD_BITS - 1) / ED_WORD_BITS)
+
+/** Number of ::ed_word values in the match table for @p len elements. */
+# define ED_PEQ_WORDS(len) (ED_BLOCKS(len) * ((size_t)ED_HASH_MAX + 1))
+
+/** Maximum number of ::ed_word values in a match table on the stack (one
+ * block, like the #ED_HASH_MAX values edit_distance_dl() keeps there). */
+# define ED_STACK_PEQ_WORDS ((size_t)ED_HASH_MAX + 1)
+
+/** Maximum number of blocks of Levenshtein state kept on the stack. */
+# define ED_STACK_BLOCKS 16
+
+# ifdef __GNUC__
+/** Number of bits set in an ::ed_word. */
+#  define ED_POPCOUNT(w) __builtin_popcountll(w)
+# else
+static inline int ED_POPCOUNT(ed_word w)
+{
+	int count = 0;
+	for (; w; w &= w - 1) {
+		++count;
+	}
+	return count;
+}
+# endif
+
+/**
+ * Builds the match table for bit-parallel algorithms (for internal use).
+ * @private
+ * @param peq Table of ED_PEQ_WORDS(@p slen) values to fill.  Bit @c i%64 of
+ * <code>peq[ED_HASH_ELEM(e) * ED_BLOCKS(slen) + i/64]</code> is set when
+ * <code>src[i] == e</code> (or @c i >= @p slen, when there is more than one
+ * block), so each element's blocks are together.
+ * @param src Source array.
+ * @param slen Number of elements in @p src (must be > 0).
+ */
+static inline void ed_peq_init(ed_word *peq, const ed_elem *src, ed_size slen)
+{
+	size_t nblocks = ED_BLOCKS(slen);
+
+	memset(peq, 0, ED_PEQ_WORDS(slen) * sizeof(ed_word));
+	for (ed_size i = 0; i < slen; ++i) {
+		peq[(size_t)ED_HASH_ELEM(src[i]) * nblocks + i / ED_WORD_BITS]
+		    |= (ed_word)1 << (i % ED_WORD_BITS);
+	}
+
+	/* Rows past the end of src match everything, so they never make the
+	 * last block look worse than row slen-1 (as in edlib). @cite Sosic17
+	 * Only the blocked Levenshtein algorithm looks at them. */
+	if (nblocks > 1 && slen % ED_WORD_BITS != 0) {
+		ed_word pad = ~(ed_word)0 << (slen % ED_WORD_BITS);
+		for (size_t h = 0; h <= (size_t)ED_HASH_MAX; ++h) {
+			peq[h * nblocks + nblocks - 1] |= pad;
+		}
+	}
+}
+
+/**
+ * Calculates LCS distance with Hyyrö's bit-parallel algorithm (for internal
+ * use).
+ * @private
+ * @param peq Match table for @p src from ed_peq_init().
+ * @param slen Number of elements in @p src (must be > 0).
+ * @param tgt Target array to calculate distance to.
+ * @param tlen Number of elements in @p tgt to consider.
+ * @param max Distance beyond which the exact value is not needed.
+ * @return As for edit_distance_lcs().
+ */
+ed_dist edit_distance_lcs_peq(const ed_word *peq, ed_size slen,
+			      const ed_elem *tgt, ed_size tlen, ed_dist max);
+
+/**
+ * Calculates Levenshtein distance with Myers' bit-parallel algorithm (for
+ * internal use).
+ *
+ * Uses Hyyrö's blocked formulation with Ukkonen's cut-off when @p src does
+ * not fit in one ::ed_word.
+ * @private
+ * @param peq Match table for @p src from ed_peq_init().
+ * @param slen Number of elements in @p src (must be > 0).
+ * @param tgt Target array to calculate distance to.
+ * @param tlen Number of elements in @p tgt to consider.
+ * @param max Distance beyond which the exact value is not needed.
+ * @return As for edit_distance_lev().
+ */
+ed_dist edit_distance_lev_peq(const ed_word *peq, ed_size slen,
+			      const ed_elem *tgt, ed_size tlen, ed_dist max);
+
+/** Number of targets edit_distance_lev_lanes() compares at once. */
+# define ED_LANES 4
+
+/**
+ * Calculates Levenshtein distance from one short array to #ED_LANES others
+ * at once, one per SIMD lane (for internal use).
+ * @private
+ * @param peq Match table for @p src from ed_peq_init().
+ * @param slen Number of elements in @p src (must be > 0 and at most
+ * #ED_WORD_BITS).
+ * @param tgts #ED_LANES target arrays.
+ * @param tlens Number of elements in each of @p tgts.
+ * @param max Distance beyond which the exact value is not needed.
+ * @param dists Receives the #ED_LANES distances, as for edit_distance_lev().
+ */
+void edit_distance_lev_lanes(const ed_word *peq, ed_size slen,
+			     const ed_elem *const tgts[],
+			     const ed_size tlens[],
+			     ed_dist max, ed_dist dists[]);
+#endif
+
 #endif
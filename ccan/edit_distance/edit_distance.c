@@ -4,11 +4,43 @@
  * @copyright 2016 Kevin Locke <kevin@kevinlocke.name>
  *            MIT license - see LICENSE file for details
  */
+#include <stdlib.h>		/* free, malloc */
+
 #include "edit_distance-params.h"
 #include "edit_distance-private.h"
 
-ed_dist edit_distance(const ed_elem *src, ed_size slen,
-		      const ed_elem *tgt, ed_size tlen, enum ed_measure measure)
+/** Sum of the costs to delete all of @p src and insert all of @p tgt, which
+ * no measure exceeds. */
+static ed_dist ed_max_dist(const ed_elem *src, ed_size slen,
+			   const ed_elem *tgt, ed_size tlen)
+{
+	ed_dist result = 0;
+
+#ifdef ED_DEL_COST_CONST
+	(void)src;
+	result += (ed_dist)slen *ED_DEL_COST();
+#else
+	for (ed_size i = 0; i < slen; ++i) {
+		result += ED_DEL_COST(src[i]);
+	}
+#endif
+
+#ifdef ED_INS_COST_CONST
+	(void)tgt;
+	result += (ed_dist)tlen *ED_INS_COST();
+#else
+	for (ed_size j = 0; j < tlen; ++j) {
+		result += ED_INS_COST(tgt[j]);
+	}
+#endif
+
+	return result;
+}
+
+/** edit_distance_max() without the normalization of results > @p max. */
+static ed_dist edit_distance_upto(const ed_elem *src, ed_size slen,
+				  const ed_elem *tgt, ed_size tlen,
+				  enum ed_measure measure, ed_dist max)
 {
 	/* Remove common prefix. */
 	while (slen > 0 && tlen > 0 && ED_ELEM_EQUAL(src[0], tgt[0])) {
@@ -31,6 +63,11 @@ ed_dist edit_distance(const ed_elem *src, ed_size slen,
 		ED_SWAP(src, tgt, const ed_elem *);
 		ED_SWAP(slen, tlen, ed_size);
 	}
+
+	/* Early return when the extra elements alone cost more than max. */
+	if ((ed_dist)(tlen - slen) > max) {
+		return ED_OVER(max);
+	}
 #endif
 
 	/* Early return when all insertions. */
@@ -103,14 +140,112 @@ ed_dist edit_distance(const ed_elem *src, ed_size slen,
 
 	switch (measure) {
 	case EDIT_DISTANCE_LCS:
-		return edit_distance_lcs(src, slen, tgt, tlen);
+		return edit_distance_lcs(src, slen, tgt, tlen, max);
 	case EDIT_DISTANCE_LEV:
-		return edit_distance_lev(src, slen, tgt, tlen);
+		return edit_distance_lev(src, slen, tgt, tlen, max);
 	case EDIT_DISTANCE_RDL:
-		return edit_distance_rdl(src, slen, tgt, tlen);
+		return edit_distance_rdl(src, slen, tgt, tlen, max);
 	case EDIT_DISTANCE_DL:
 		return edit_distance_dl(src, slen, tgt, tlen);
 	}
 
 	return (ed_dist)-1;
 }
+
+ed_dist edit_distance(const ed_elem *src, ed_size slen,
+		      const ed_elem *tgt, ed_size tlen, enum ed_measure measure)
+{
+	return edit_distance_upto(src, slen, tgt, tlen, measure,
+				  ed_max_dist(src, slen, tgt, tlen));
+}
+
+ed_dist edit_distance_max(const ed_elem *src, ed_size slen,
+			  const ed_elem *tgt, ed_size tlen,
+			  enum ed_measure measure, ed_dist max)
+{
+	ed_dist result = edit_distance_upto(src, slen, tgt, tlen, measure, max);
+	return result > max ? ED_OVER(max) : result;
+}
+
+
+void edit_distance_batch(const ed_elem *src, ed_size slen,
+			 const ed_elem *const tgts[], const ed_size tlens[],
+			 size_t count, enum ed_measure measure, ed_dist max,
+			 ed_dist dists[])
+{
+	size_t i = 0;
+
+#ifdef ED_BIT_PARALLEL
+	if (slen > 0 &&
+	    (measure == EDIT_DISTANCE_LEV || measure == EDIT_DISTANCE_LCS)) {
+		/* Optimization: Avoid malloc when the match table can fit on
+		 * the stack.
+		 */
+		ed_word stackpeq[ED_STACK_PEQ_WORDS];
+		ed_word *peq = ED_PEQ_WORDS(slen) <= ED_STACK_PEQ_WORDS ?
+		    stackpeq : malloc(ED_PEQ_WORDS(slen) * sizeof(ed_word));
+
+		/* The match table for src is shared by all targets. */
+		ed_peq_init(peq, src, slen);
+
+		if (measure == EDIT_DISTANCE_LEV && slen <= ED_WORD_BITS) {
+			/* Targets not ruled out by their length alone, to be
+			 * compared #ED_LANES at a time. */
+			const ed_elem *lanetgts[ED_LANES];
+			ed_size lanelens[ED_LANES];
+			ed_dist lanedists[ED_LANES];
+			size_t lanes[ED_LANES];
+			int nlanes = 0;
+
+			for (; i < count; ++i) {
+				ed_size diff = slen > tlens[i] ?
+				    slen - tlens[i] : tlens[i] - slen;
+				if ((ed_dist)diff > max) {
+					dists[i] = ED_OVER(max);
+					continue;
+				}
+
+				lanetgts[nlanes] = tgts[i];
+				lanelens[nlanes] = tlens[i];
+				lanes[nlanes++] = i;
+				if (nlanes == ED_LANES) {
+					edit_distance_lev_lanes(peq, slen,
+								lanetgts,
+								lanelens, max,
+								lanedists);
+					for (int l = 0; l < ED_LANES; ++l) {
+						dists[lanes[l]] = lanedists[l];
+					}
+					nlanes = 0;
+				}
+			}
+
+			for (int l = 0; l < nlanes; ++l) {
+				ed_dist dist = edit_distance_lev_peq(peq, slen,
+						lanetgts[l], lanelens[l], max);
+				dists[lanes[l]] = dist > max ?
+				    ED_OVER(max) : dist;
+			}
+		}
+
+		for (; i < count; ++i) {
+			ed_dist dist = measure == EDIT_DISTANCE_LEV ?
+			    edit_distance_lev_peq(peq, slen, tgts[i], tlens[i],
+						  max) :
+			    edit_distance_lcs_peq(peq, slen, tgts[i], tlens[i],
+						  max);
+			dists[i] = dist > max ? ED_OVER(max) : dist;
+		}
+
+		if (peq != stackpeq) {
+			free(peq);
+		}
+		return;
+	}
+#endif
+
+	for (; i < count; ++i) {
+		dists[i] = edit_distance_max(src, slen, tgts[i], tlens[i],
+					     measure, max);
+	}
+}
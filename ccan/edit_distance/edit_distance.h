@@ -59,7 +59,10 @@ enum ed_measure {
 	 *
 	 * This implementation uses an iterative version of the Wagner-Fischer
 	 * algorithm @cite Wagner74 which requires <code>O(slen * tlen)</code>
-	 * time and <code>min(slen, tlen) + 1</code> space.
+	 * time and <code>min(slen, tlen) + 1</code> space.  When all costs
+	 * are 1 and #ED_HASH_ON_STACK is defined, it uses the bit-parallel
+	 * algorithm of Allison and Dix @cite Allison86 @cite Hyyro04 instead,
+	 * which requires <code>O(slen * tlen / 64)</code> time.
 	 */
 	EDIT_DISTANCE_LCS = 1,
 	/**
@@ -72,7 +75,12 @@ enum ed_measure {
 	 *
 	 * This implementation uses a modified version of the Wagner-Fischer
 	 * algorithm @cite Wagner74 which requires <code>O(slen * tlen)</code>
-	 * time and only <code>min(slen, tlen) + 1</code> space.
+	 * time and only <code>min(slen, tlen) + 1</code> space.  When all
+	 * costs are 1 and #ED_HASH_ON_STACK is defined, it uses Myers'
+	 * bit-parallel algorithm @cite Myers99 instead, in blocks of 64
+	 * elements for longer arrays @cite Hyyro03, which requires
+	 * <code>O(slen * tlen / 64)</code> time (less when a maximum distance
+	 * is given).
 	 */
 	EDIT_DISTANCE_LEV,
 	/**
@@ -128,4 +136,75 @@ enum ed_measure {
 ed_dist edit_distance(const ed_elem *src, ed_size slen,
 		      const ed_elem *tgt, ed_size tlen,
 		      enum ed_measure measure);
+
+/**
+ * edit_distance_max - Calculates the edit distance between two arrays, if it
+ * is at most a given value.
+ *
+ * Knowing when the distance is too large to be interesting lets the
+ * calculation stop early: immediately when the lengths differ by more than
+ * @p max (and all costs are 1), and otherwise as soon as no alignment can
+ * come back within @p max.  ed_measure::EDIT_DISTANCE_LEV also skips the
+ * parts of the distance matrix more than @p max from its diagonal.
+ * @cite Ukkonen85  ed_measure::EDIT_DISTANCE_DL always calculates the full
+ * distance.
+ *
+ * @param src Source array to calculate distance from.
+ * @param slen Number of elements in @p src to consider.
+ * @param tgt Target array to calculate distance to.
+ * @param tlen Number of elements in @p tgt to consider.
+ * @param measure Edit distance measure to calculate.
+ * @param max Largest distance of interest.  Must be less than the largest
+ * value of ::ed_dist.
+ * @return Edit distance from @p src[0..slen-1] to @p tgt[0..tlen-1] if it is
+ * at most @p max, otherwise <code>max + 1</code>.
+ *
+ * @code
+ * Example:
+ * const char *source = "kitten";
+ * const char *target = "sitting";
+ * assert(edit_distance_max(source, strlen(source),
+ *                          target, strlen(target),
+ *                          EDIT_DISTANCE_LEV, 3) == 3);
+ * assert(edit_distance_max(source, strlen(source),
+ *                          target, strlen(target),
+ *                          EDIT_DISTANCE_LEV, 2) == 3);
+ * Example_End: @endcode
+ */
+ed_dist edit_distance_max(const ed_elem *src, ed_size slen,
+			  const ed_elem *tgt, ed_size tlen,
+			  enum ed_measure measure, ed_dist max);
+
+/**
+ * edit_distance_batch - Calculates the edit distances from one array to many.
+ *
+ * Equivalent to calling edit_distance_max() for each of @p tgts, but the
+ * bit-parallel algorithms prepare @p src only once, and for
+ * ed_measure::EDIT_DISTANCE_LEV with @p slen <= 64 several targets are
+ * compared at once, one per SIMD lane.
+ *
+ * @param src Source array to calculate distances from.
+ * @param slen Number of elements in @p src to consider.
+ * @param tgts Target arrays to calculate distances to.
+ * @param tlens Number of elements in each of @p tgts to consider.
+ * @param count Number of elements in @p tgts, @p tlens and @p dists.
+ * @param measure Edit distance measure to calculate.
+ * @param max Largest distance of interest, as for edit_distance_max().
+ * @param dists Receives the distance to each of @p tgts, as returned by
+ * edit_distance_max().
+ *
+ * @code
+ * Example:
+ * const char *words[] = { "sitting", "kitchen", "mitten", "bitten" };
+ * ed_size lens[] = { 7, 7, 6, 6 };
+ * ed_dist dists[4];
+ * edit_distance_batch("kitten", 6, words, lens, 4, EDIT_DISTANCE_LEV, 2,
+ *                     dists);
+ * assert(dists[0] == 3 && dists[1] == 2 && dists[2] == 1);
+ * Example_End: @endcode
+ */
+void edit_distance_batch(const ed_elem *src, ed_size slen,
+			 const ed_elem *const tgts[], const ed_size tlens[],
+			 size_t count, enum ed_measure measure, ed_dist max,
+			 ed_dist dists[]);
 #endif
@@ -10,9 +10,102 @@
 #include "edit_distance-params.h"
 #include "edit_distance-private.h"
 
+#ifdef ED_BIT_PARALLEL
+/** Number of elements of src in the LCS so far: the 0 bits of @p v in the
+ * first @p slen rows. */
+static long ed_lcs_len(const ed_word *v, ed_size slen)
+{
+	size_t nblocks = ED_BLOCKS(slen);
+	long ones = 0;
+
+	for (size_t b = 0; b + 1 < nblocks; ++b) {
+		ones += ED_POPCOUNT(v[b]);
+	}
+	ed_word below = ~(ed_word)0 >>
+	    (ED_WORD_BITS - 1 - (slen - 1) % ED_WORD_BITS);
+	ones += ED_POPCOUNT(v[nblocks - 1] & below);
+
+	return (long)slen - ones;
+}
+
+ed_dist edit_distance_lcs_peq(const ed_word *peq, ed_size slen,
+			      const ed_elem *tgt, ed_size tlen, ed_dist max)
+{
+	/* Largest distance of interest, as a signed integer. */
+	long k = max >= (ed_dist)(slen + tlen) ? (long)(slen + tlen) :
+	    (long)max;
+	const long sum = (long)slen + (long)tlen;
+
+	/* Each unmatched element costs at least one operation. */
+	if ((long)(slen > tlen ? slen - tlen : tlen - slen) > k) {
+		return (ed_dist)(k + 1);
+	}
+
+	const size_t nblocks = ED_BLOCKS(slen);
+	ed_word stackv[ED_STACK_BLOCKS];
+	ed_word *v = nblocks <= ED_STACK_BLOCKS ? stackv :
+	    malloc(nblocks * sizeof(ed_word));
+	for (size_t b = 0; b < nblocks; ++b) {
+		v[b] = ~(ed_word)0;
+	}
+
+	ed_dist total;
+	for (ed_size j = 0; j < tlen; ++j) {
+		const ed_word *eq = peq + (size_t)ED_HASH_ELEM(tgt[j]) * nblocks;
+
+		/* V' = (V + (V & M)) | (V & ~M), with carries between blocks.
+		 * @cite Allison86 @cite Hyyro04 */
+		ed_word carry = 0;
+		for (size_t b = 0; b < nblocks; ++b) {
+			ed_word u = v[b] & eq[b];
+			ed_word sum1 = v[b] + u;
+			ed_word sum2 = sum1 + carry;
+			carry = (sum1 < u) | (sum2 < sum1);
+			v[b] = sum2 | (v[b] - u);
+		}
+
+		/* Once per block of columns (and after the last), check
+		 * whether matching every remaining element could still come
+		 * within max. */
+		ed_size left = tlen - j - 1;
+		if (left % ED_WORD_BITS == 0) {
+			long len = ed_lcs_len(v, slen);
+			long best = len + ED_MIN2((long)left, (long)slen - len);
+			if (sum - 2 * best > k) {
+				total = (ed_dist)(k + 1);
+				goto done;
+			}
+		}
+	}
+
+	total = (ed_dist)(sum - 2 * ed_lcs_len(v, slen));
+
+done:
+	if (v != stackv) {
+		free(v);
+	}
+	return total;
+}
+#endif
+
 ed_dist edit_distance_lcs(const ed_elem *src, ed_size slen,
-			  const ed_elem *tgt, ed_size tlen)
+			  const ed_elem *tgt, ed_size tlen, ed_dist max)
 {
+#ifdef ED_BIT_PARALLEL
+	/* Optimization: Avoid malloc when the match table can fit on the
+	 * stack.
+	 */
+	ed_word stackpeq[ED_STACK_PEQ_WORDS];
+	ed_word *peq = ED_PEQ_WORDS(slen) <= ED_STACK_PEQ_WORDS ? stackpeq :
+	    malloc(ED_PEQ_WORDS(slen) * sizeof(ed_word));
+
+	ed_peq_init(peq, src, slen);
+	ed_dist total = edit_distance_lcs_peq(peq, slen, tgt, tlen, max);
+	if (peq != stackpeq) {
+		free(peq);
+	}
+	return total;
+#else
 	/* Optimization: Avoid malloc when row of distance matrix can fit on
 	 * the stack.
 	 */
@@ -33,6 +126,10 @@ ed_dist edit_distance_lcs(const ed_elem *src, ed_size slen,
 		ed_dist diagdist = dist[0];
 		dist[0] = dist[0] + ED_INS_COST(tgt[j - 1]);
 
+		/* Smallest value in the row.  Every path to dist[slen] passes
+		 * through this row, so once it is > max, so is the result. */
+		ed_dist rowmin = dist[0];
+
 		/* Loop invariant: dist[i] is the edit distance between first j
 		 * elements of tgt and first i elements of src.
 		 */
@@ -57,8 +154,13 @@ ed_dist edit_distance_lcs(const ed_elem *src, ed_size slen,
 				dist[i] = ED_MIN2(insdist, deldist);
 			}
 
+			rowmin = ED_MIN2(rowmin, dist[i]);
 			diagdist = nextdiagdist;
 		}
+
+		if (rowmin > max) {
+			break;
+		}
 	}
 
 	ed_dist total = dist[slen];
@@ -66,4 +168,5 @@ ed_dist edit_distance_lcs(const ed_elem *src, ed_size slen,
 		free(dist);
 	}
 	return total;
+#endif
 }
@@ -4,15 +4,311 @@
  * @copyright 2016 Kevin Locke <kevin@kevinlocke.name>
  *            MIT license - see LICENSE file for details
  */
+#include <stdbool.h>		/* bool */
 #include <stdlib.h>		/* free, malloc */
 
 #include "edit_distance.h"
 #include "edit_distance-params.h"
 #include "edit_distance-private.h"
 
+#ifdef ED_BIT_PARALLEL
+/** Most significant bit of an ::ed_word. */
+# define ED_WORD_HIGH ((ed_word)1 << (ED_WORD_BITS - 1))
+
+/** Vertical deltas and bottom row value of one block of the distance matrix
+ * column, for Hyyrö's blocked algorithm. */
+struct ed_lev_block {
+	ed_word pv;		/**< Bits where row i is 1 more than row i-1. */
+	ed_word mv;		/**< Bits where row i is 1 less than row i-1. */
+	long score;		/**< Value in the last row of the block. */
+};
+
+/**
+ * Advances one block of Myers' algorithm by one column.
+ * @param block Block to advance.
+ * @param eq Match bits of the block for the column's target element.
+ * @param hin Horizontal delta (-1, 0, 1) entering the top of the block.
+ * @return Horizontal delta leaving the bottom of the block.
+ */
+static inline int ed_lev_advance(struct ed_lev_block *block, ed_word eq,
+				 int hin)
+{
+	ed_word pv = block->pv, mv = block->mv;
+	ed_word xv = eq | mv;
+	if (hin < 0) {
+		eq |= 1;
+	}
+	ed_word xh = (((eq & pv) + pv) ^ pv) | eq;
+	ed_word ph = mv | ~(xh | pv);
+	ed_word mh = pv & xh;
+
+	int hout = 0;
+	if (ph & ED_WORD_HIGH) {
+		hout = 1;
+	} else if (mh & ED_WORD_HIGH) {
+		hout = -1;
+	}
+
+	ph <<= 1;
+	mh <<= 1;
+	if (hin < 0) {
+		mh |= 1;
+	} else if (hin > 0) {
+		ph |= 1;
+	}
+
+	block->pv = mh | ~(xv | ph);
+	block->mv = ph & xv;
+	return hout;
+}
+
+/** Levenshtein distance for @p slen <= #ED_WORD_BITS. @cite Myers99 */
+static ed_dist ed_lev_word(const ed_word *peq, ed_size slen,
+			   const ed_elem *tgt, ed_size tlen, long k)
+{
+	const ed_word last = (ed_word)1 << (slen - 1);
+	ed_word pv = ~(ed_word)0, mv = 0;
+	long score = (long)slen;
+
+	for (ed_size j = 0; j < tlen; ++j) {
+		ed_word eq = peq[ED_HASH_ELEM(tgt[j])];
+		ed_word xv = eq | mv;
+		ed_word xh = (((eq & pv) + pv) ^ pv) | eq;
+		ed_word ph = mv | ~(xh | pv);
+		ed_word mh = pv & xh;
+
+		if (ph & last) {
+			++score;
+		} else if (mh & last) {
+			--score;
+		}
+
+		/* Row 0 increases by 1 in every column. */
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+
+		/* Score can only decrease by 1 per remaining column. */
+		if (score - (long)(tlen - j - 1) > k) {
+			return (ed_dist)(k + 1);
+		}
+	}
+
+	return (ed_dist)score;
+}
+
+/**
+ * Levenshtein distance for @p slen > #ED_WORD_BITS, computing only the band
+ * of blocks which may hold values <= @p k on a path to the last cell.
+ * @cite Hyyro03 @cite Ukkonen85 @cite Sosic17
+ */
+static ed_dist ed_lev_blocks(const ed_word *peq, ed_size slen,
+			     const ed_elem *tgt, ed_size tlen, long k)
+{
+	const long w = ED_WORD_BITS, m = (long)slen, n = (long)tlen;
+	const long nblocks = (long)ED_BLOCKS(slen);
+	struct ed_lev_block stackblocks[ED_STACK_BLOCKS];
+	struct ed_lev_block *blocks = nblocks <= ED_STACK_BLOCKS ? stackblocks :
+	    malloc(nblocks * sizeof(struct ed_lev_block));
+	ed_dist total = (ed_dist)(k + 1);
+
+	/* Rows below k start out > k, and rows too far below the diagonal of
+	 * the last cell can't get back to it within k. */
+	long startrows = ED_MIN2(k, (k + m - n) / 2) + 1;
+	long last = ED_MIN2(nblocks, (startrows + w - 1) / w) - 1;
+	for (long b = 0; b <= last; ++b) {
+		blocks[b].pv = ~(ed_word)0;
+		blocks[b].mv = 0;
+		blocks[b].score = (b + 1) * w;
+	}
+
+	for (long c = 0; c < n; ++c) {
+		const ed_word *eq = peq + (size_t)ED_HASH_ELEM(tgt[c]) * nblocks;
+
+		int hout = 1;
+		for (long b = 0; b <= last; ++b) {
+			hout = ed_lev_advance(&blocks[b], eq[b], hout);
+			blocks[b].score += hout;
+		}
+
+		/* Extend the band while the top of the next block can be
+		 * reached within k, diagonally from the previous column or
+		 * down from this one.  Rows below the band are either > k or
+		 * can't reach the last cell within k, so starting the block
+		 * as a straight run down from the bottom of the band loses
+		 * nothing. */
+		while (last < nblocks - 1 &&
+		       (blocks[last].score - hout +
+			!(eq[last + 1] & 1) <= k ||
+			blocks[last].score + 1 <= k)) {
+			++last;
+			blocks[last].pv = ~(ed_word)0;
+			blocks[last].mv = 0;
+			blocks[last].score = blocks[last - 1].score - hout + w;
+			hout = ed_lev_advance(&blocks[last], eq[last], hout);
+			blocks[last].score += hout;
+		}
+
+		/* Shrink the band while its last block is all > k, or too far
+		 * below the diagonal of the last cell to get back within k. */
+		while (last >= 0 &&
+		       (blocks[last].score >= k + w ||
+			(last + 1) * w - 1 >
+			k - blocks[last].score + 2 * w - 2 - n + c + m)) {
+			--last;
+		}
+
+		if (last < 0) {
+			goto done;
+		}
+	}
+
+	if (last == nblocks - 1) {
+		/* Walk up from the bottom of the block to row slen-1. */
+		ed_word below = ~(ed_word)0 << ((slen - 1) % ED_WORD_BITS) << 1;
+		long score = blocks[last].score -
+		    ED_POPCOUNT(blocks[last].pv & below) +
+		    ED_POPCOUNT(blocks[last].mv & below);
+		if (score <= k) {
+			total = (ed_dist)score;
+		}
+	}
+
+done:
+	if (blocks != stackblocks) {
+		free(blocks);
+	}
+	return total;
+}
+
+ed_dist edit_distance_lev_peq(const ed_word *peq, ed_size slen,
+			      const ed_elem *tgt, ed_size tlen, ed_dist max)
+{
+	/* Largest distance of interest, as a signed integer. */
+	long k = max >= (ed_dist)(slen + tlen) ? (long)(slen + tlen) :
+	    (long)max;
+
+	/* Each unmatched element costs at least one operation. */
+	if ((long)(slen > tlen ? slen - tlen : tlen - slen) > k) {
+		return (ed_dist)(k + 1);
+	}
+
+	if (tlen == 0) {
+		return (ed_dist)slen;
+	}
+
+	return slen <= ED_WORD_BITS ?
+	    ed_lev_word(peq, slen, tgt, tlen, k) :
+	    ed_lev_blocks(peq, slen, tgt, tlen, k);
+}
+
+# ifdef __GNUC__
+/** #ED_LANES ::ed_word values, one per SIMD lane. */
+typedef ed_word ed_lanes __attribute__((vector_size(ED_LANES *
+						    sizeof(ed_word))));
+/** #ED_LANES signed values, one per SIMD lane. */
+typedef long long ed_slanes __attribute__((vector_size(ED_LANES *
+						       sizeof(long long))));
+
+void edit_distance_lev_lanes(const ed_word *peq, ed_size slen,
+			     const ed_elem *const tgts[],
+			     const ed_size tlens[],
+			     ed_dist max, ed_dist dists[])
+{
+	const ed_word last = (ed_word)1 << (slen - 1);
+	ed_lanes pv = ~(ed_lanes){ 0 }, mv = { 0 };
+	ed_slanes score, lens;
+	ed_size maxlen = 0;
+
+	for (int l = 0; l < ED_LANES; ++l) {
+		score[l] = (long long)slen;
+		lens[l] = (long long)tlens[l];
+		maxlen = ED_MAX2(maxlen, tlens[l]);
+	}
+
+	/* Largest distance of interest, as a signed integer. */
+	long long k = max >= (ed_dist)(slen + maxlen) ?
+	    (long long)(slen + maxlen) : (long long)max;
+
+	/* Lanes with shorter targets stop scoring at their end, and are fed
+	 * no matches from then on. */
+	for (ed_size j = 0; j < maxlen; ++j) {
+		ed_lanes eq;
+		for (int l = 0; l < ED_LANES; ++l) {
+			eq[l] = j < tlens[l] ?
+			    peq[ED_HASH_ELEM(tgts[l][j])] : 0;
+		}
+		ed_slanes active = (ed_slanes){ 0 } + (long long)j < lens;
+
+		ed_lanes xv = eq | mv;
+		ed_lanes xh = (((eq & pv) + pv) ^ pv) | eq;
+		ed_lanes ph = mv | ~(xh | pv);
+		ed_lanes mh = pv & xh;
+
+		/* Comparisons are -1 in lanes where true. */
+		score -= ((ph & last) != 0) & active;
+		score += ((mh & last) != 0) & active;
+
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+
+		/* Every so often, stop if every lane is beyond k even if its
+		 * score decreases in all of its remaining columns. */
+		if (j % 8 == 7) {
+			ed_slanes left = lens - (long long)(j + 1);
+			left &= left > 0;
+			ed_slanes over = score - left > k;
+			bool allover = true;
+			for (int l = 0; l < ED_LANES; ++l) {
+				allover &= over[l] != 0;
+			}
+			if (allover) {
+				break;
+			}
+		}
+	}
+
+	for (int l = 0; l < ED_LANES; ++l) {
+		dists[l] = (ed_dist)score[l] > max ?
+		    ED_OVER(max) : (ed_dist)score[l];
+	}
+}
+# else
+void edit_distance_lev_lanes(const ed_word *peq, ed_size slen,
+			     const ed_elem *const tgts[],
+			     const ed_size tlens[],
+			     ed_dist max, ed_dist dists[])
+{
+	for (int l = 0; l < ED_LANES; ++l) {
+		ed_dist dist =
+		    edit_distance_lev_peq(peq, slen, tgts[l], tlens[l], max);
+		dists[l] = dist > max ? ED_OVER(max) : dist;
+	}
+}
+# endif
+#endif
+
 ed_dist edit_distance_lev(const ed_elem *src, ed_size slen,
-			  const ed_elem *tgt, ed_size tlen)
+			  const ed_elem *tgt, ed_size tlen, ed_dist max)
 {
+#ifdef ED_BIT_PARALLEL
+	/* Optimization: Avoid malloc when the match table can fit on the
+	 * stack.
+	 */
+	ed_word stackpeq[ED_STACK_PEQ_WORDS];
+	ed_word *peq = ED_PEQ_WORDS(slen) <= ED_STACK_PEQ_WORDS ? stackpeq :
+	    malloc(ED_PEQ_WORDS(slen) * sizeof(ed_word));
+
+	ed_peq_init(peq, src, slen);
+	ed_dist total = edit_distance_lev_peq(peq, slen, tgt, tlen, max);
+	if (peq != stackpeq) {
+		free(peq);
+	}
+	return total;
+#else
 	/* Optimization: Avoid malloc when row of distance matrix can fit on
 	 * the stack.
 	 */
@@ -33,6 +329,10 @@ ed_dist edit_distance_lev(const ed_elem *src, ed_size slen,
 		ed_dist diagdist = dist[0];
 		dist[0] = dist[0] + ED_INS_COST(tgt[j - 1]);
 
+		/* Smallest value in the row.  Every path to dist[slen] passes
+		 * through this row, so once it is > max, so is the result. */
+		ed_dist rowmin = dist[0];
+
 		/* Loop invariant: dist[i] is the edit distance between first j
 		 * elements of tgt and first i elements of src.
 		 */
@@ -62,8 +362,13 @@ ed_dist edit_distance_lev(const ed_elem *src, ed_size slen,
 				dist[i] = ED_MIN3(insdist, deldist, subdist);
 			}
 
+			rowmin = ED_MIN2(rowmin, dist[i]);
 			diagdist = nextdiagdist;
 		}
+
+		if (rowmin > max) {
+			break;
+		}
 	}
 
 	ed_dist total = dist[slen];
@@ -71,4 +376,5 @@ ed_dist edit_distance_lev(const ed_elem *src, ed_size slen,
 		free(dist);
 	}
 	return total;
+#endif
 }
@@ -11,7 +11,7 @@
 #include "edit_distance-private.h"
 
 ed_dist edit_distance_rdl(const ed_elem *src, ed_size slen,
-			  const ed_elem *tgt, ed_size tlen)
+			  const ed_elem *tgt, ed_size tlen, ed_dist max)
 {
 	/* Optimization: Avoid malloc when required rows of distance matrix can
 	 * fit on the stack.
@@ -36,6 +36,9 @@ ed_dist edit_distance_rdl(const ed_elem *src, ed_size slen,
 		dist[i] = dist[i - 1] + ED_DEL_COST(src[i - 1]);
 	}
 
+	/* Smallest value in the previous row (0 is dist[0]). */
+	ed_dist prevrowmin = 0;
+
 	for (ed_size j = 1; j <= tlen; ++j) {
 		/* Value for dist[j-2][i-1] (two rows up, one col left). */
 		/* Note: dist[0] is not initialized when j == 1, var unused. */
@@ -48,6 +51,9 @@ ed_dist edit_distance_rdl(const ed_elem *src, ed_size slen,
 
 		dist[0] = prevdist[0] + ED_INS_COST(tgt[j - 1]);
 
+		/* Smallest value in the row. */
+		ed_dist rowmin = dist[0];
+
 		/* Loop invariant: dist[i] is the edit distance between first j
 		 * elements of tgt and first i elements of src.
 		 */
@@ -80,14 +86,22 @@ ed_dist edit_distance_rdl(const ed_elem *src, ed_size slen,
 				    ED_ELEM_EQUAL(src[i - 2], tgt[j - 1]) &&
 				    ED_ELEM_EQUAL(src[i - 1], tgt[j - 2])) {
 					ed_dist tradist = diagdist2 +
-					    ED_TRA_COST(src[j - 2], src[j - 1]);
+					    ED_TRA_COST(src[i - 2], src[i - 1]);
 					dist[i] = ED_MIN2(dist[i], tradist);
 				}
 			}
 
+			rowmin = ED_MIN2(rowmin, dist[i]);
 			diagdist2 = diagdist1;
 			diagdist1 = nextdiagdist;
 		}
+
+		/* A transposition skips a row, but every path to dist[slen]
+		 * passes through this row or the previous one. */
+		if (rowmin > max && prevrowmin > max) {
+			break;
+		}
+		prevrowmin = rowmin;
 	}
 
 	ed_dist total = dist[slen];
@@ -0,0 +1,223 @@
+/** @file
+ * Runnable tests for the bit-parallel, bounded and batch edit distance
+ * functions, against a plain Wagner-Fischer calculation.
+ *
+ * @copyright 2016 Kevin Locke <kevin@kevinlocke.name>
+ *            MIT license - see LICENSE file for details
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ccan/array_size/array_size.h>
+#include <ccan/tap/tap.h>
+
+#include <ccan/edit_distance/edit_distance.c>
+#include <ccan/edit_distance/edit_distance_dl.c>
+#include <ccan/edit_distance/edit_distance_lcs.c>
+#include <ccan/edit_distance/edit_distance_lev.c>
+#include <ccan/edit_distance/edit_distance_rdl.c>
+
+#define MAXLEN 300
+#define PAIRS 2000
+#define BATCH 11
+
+/* Full Wagner-Fischer matrix, with or without substitution. */
+static ed_dist reference(const char *src, ed_size slen,
+			 const char *tgt, ed_size tlen, bool sub)
+{
+	static ed_dist dist[MAXLEN + 1][MAXLEN + 1];
+
+	for (ed_size i = 0; i <= slen; ++i) {
+		dist[i][0] = i;
+	}
+	for (ed_size j = 0; j <= tlen; ++j) {
+		dist[0][j] = j;
+	}
+	for (ed_size i = 1; i <= slen; ++i) {
+		for (ed_size j = 1; j <= tlen; ++j) {
+			ed_dist best = ED_MIN2(dist[i - 1][j], dist[i][j - 1])
+			    + 1;
+			if (src[i - 1] == tgt[j - 1]) {
+				best = ED_MIN2(best, dist[i - 1][j - 1]);
+			} else if (sub) {
+				best = ED_MIN2(best, dist[i - 1][j - 1] + 1);
+			}
+			dist[i][j] = best;
+		}
+	}
+
+	return dist[slen][tlen];
+}
+
+/* Random string from a small alphabet, so there are plenty of matches. */
+static ed_size random_string(char *str, int alphabet)
+{
+	ed_size len = rand() % (MAXLEN + 1);
+
+	for (ed_size i = 0; i < len; ++i) {
+		str[i] = 'a' + rand() % alphabet;
+	}
+	return len;
+}
+
+/* A few random edits of src, so distances are small compared to lengths. */
+static ed_size mutate(const char *src, ed_size slen, char *tgt)
+{
+	ed_size tlen = 0;
+
+	for (ed_size i = 0; i < slen && tlen < MAXLEN; ++i) {
+		switch (rand() % 16) {
+		case 0:		/* delete */
+			break;
+		case 1:		/* insert */
+			tgt[tlen++] = 'a' + rand() % 26;
+			if (tlen < MAXLEN) {
+				tgt[tlen++] = src[i];
+			}
+			break;
+		case 2:		/* substitute */
+			tgt[tlen++] = 'a' + rand() % 26;
+			break;
+		default:
+			tgt[tlen++] = src[i];
+			break;
+		}
+	}
+	return tlen;
+}
+
+static ed_dist bounded(ed_dist dist, ed_dist max)
+{
+	return dist > max ? max + 1 : dist;
+}
+
+int main(void)
+{
+	static char src[MAXLEN], tgts[BATCH][MAXLEN];
+	const char *tgtps[BATCH];
+	ed_size slen, tlens[BATCH];
+	ed_dist dists[BATCH];
+	bool lev_ok = true, lcs_ok = true, lev_max_ok = true,
+	    lcs_max_ok = true, other_max_ok = true, batch_ok = true,
+	    batch_short_ok = true;
+
+	plan_tests(12);
+	srand(0);
+
+	for (int n = 0; n < PAIRS; ++n) {
+		char *tgt = tgts[0];
+		ed_size tlen;
+
+		slen = random_string(src, 2 + n % 4);
+		if (n % 2) {
+			tlen = mutate(src, slen, tgt);
+		} else {
+			tlen = random_string(tgt, 2 + n % 4);
+		}
+
+		ed_dist lev = reference(src, slen, tgt, tlen, true);
+		ed_dist lcs = reference(src, slen, tgt, tlen, false);
+		lev_ok &= edit_distance(src, slen, tgt, tlen,
+					EDIT_DISTANCE_LEV) == lev;
+		lcs_ok &= edit_distance(src, slen, tgt, tlen,
+					EDIT_DISTANCE_LCS) == lcs;
+
+		/* Bounds around the distance, and anywhere else. */
+		ed_dist maxes[] = { 0, lev - 1, lev, lev + 1, lcs - 1, lcs,
+			rand() % (MAXLEN / 4), rand() % MAXLEN
+		};
+		for (size_t i = 0; i < ARRAY_SIZE(maxes); ++i) {
+			ed_dist max = maxes[i];
+			lev_max_ok &= edit_distance_max(src, slen, tgt, tlen,
+							EDIT_DISTANCE_LEV, max)
+			    == bounded(lev, max);
+			lcs_max_ok &= edit_distance_max(src, slen, tgt, tlen,
+							EDIT_DISTANCE_LCS, max)
+			    == bounded(lcs, max);
+		}
+
+		if (n % 10 == 0 && slen < MAXLEN / 4) {
+			ed_dist max = rand() % 8;
+			ed_dist rdl = edit_distance(src, slen, tgt, tlen,
+						    EDIT_DISTANCE_RDL);
+			ed_dist dl = edit_distance(src, slen, tgt, tlen,
+						   EDIT_DISTANCE_DL);
+			other_max_ok &= edit_distance_max(src, slen, tgt, tlen,
+							  EDIT_DISTANCE_RDL,
+							  max)
+			    == bounded(rdl, max);
+			other_max_ok &= edit_distance_max(src, slen, tgt, tlen,
+							  EDIT_DISTANCE_DL,
+							  max)
+			    == bounded(dl, max);
+		}
+	}
+	ok1(lev_ok);
+	ok1(lcs_ok);
+	ok1(lev_max_ok);
+	ok1(lcs_max_ok);
+	ok1(other_max_ok);
+
+	/* One source against many targets, some empty, with long and short
+	 * (single word, SIMD lanes) sources. */
+	for (int n = 0; n < PAIRS / 10; ++n) {
+		enum ed_measure measure = n % 3 ? EDIT_DISTANCE_LEV :
+		    EDIT_DISTANCE_LCS;
+		ed_dist max = n % 5 ? (ed_dist)(rand() % 40) : 2 * MAXLEN;
+
+		slen = random_string(src, 4);
+		if (n % 2) {
+			slen %= ED_WORD_BITS + 1;
+		}
+		for (int i = 0; i < BATCH; ++i) {
+			tlens[i] = i % 4 == 3 ? random_string(tgts[i], 4) :
+			    mutate(src, slen, tgts[i]);
+			if (i == 5) {
+				tlens[i] = 0;
+			}
+			tgtps[i] = tgts[i];
+		}
+
+		edit_distance_batch(src, slen, tgtps, tlens, BATCH, measure,
+				    max, dists);
+		for (int i = 0; i < BATCH; ++i) {
+			ed_dist dist = bounded(reference(src, slen, tgts[i],
+							 tlens[i],
+							 measure ==
+							 EDIT_DISTANCE_LEV),
+					       max);
+			if (slen <= ED_WORD_BITS) {
+				batch_short_ok &= dists[i] == dist;
+			} else {
+				batch_ok &= dists[i] == dist;
+			}
+		}
+	}
+	ok1(batch_ok);
+	ok1(batch_short_ok);
+
+	/* Other measures are calculated one at a time. */
+	tgtps[0] = "ba";
+	tlens[0] = 2;
+	tgtps[1] = "abc";
+	tlens[1] = 3;
+	edit_distance_batch("ab", 2, tgtps, tlens, 2, EDIT_DISTANCE_RDL, 1,
+			    dists);
+	ok1(dists[0] == 1 && dists[1] == 1);
+	edit_distance_batch("ab", 2, tgtps, tlens, 2, EDIT_DISTANCE_LEV, 1,
+			    dists);
+	ok1(dists[0] == 2 && dists[1] == 1);
+
+	/* Lengths alone rule out a distance within max. */
+	ok1(edit_distance_max("a", 1, "abcdef", 6, EDIT_DISTANCE_LEV, 3) == 4);
+	ok1(edit_distance_max("", 0, "abcdef", 6, EDIT_DISTANCE_LCS, 3) == 4);
+
+	/* Nothing to do. */
+	edit_distance_batch("ab", 2, NULL, NULL, 0, EDIT_DISTANCE_LEV, 1,
+			    NULL);
+	ok1(true);
+
+	return exit_status();
+}
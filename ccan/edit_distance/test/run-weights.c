@@ -5,8 +5,10 @@
  *            MIT license - see LICENSE file for details
  */
 
+#include <stdbool.h>
 #include <string.h>
 
+#include <ccan/array_size/array_size.h>
 #include <ccan/build_assert/build_assert.h>
 #include <ccan/tap/tap.h>
 
@@ -233,13 +235,16 @@ static void test_mem_use(void)
 	for (ed_size tlen = 1; tlen < 3; ++tlen) {
 		ed_size slen = ED_STACK_DIST_VALS;
 		/* Above threshold, causes allocation */
-		ok(edit_distance_lcs(src, slen, tgt, tlen) == slen - tlen,
+		ok(edit_distance_lcs(src, slen, tgt, tlen, slen + tlen)
+		   == slen - tlen,
 		   "edit_distance_lcs(\"%.3s..., %u, \"%.*s\", %u) == %u",
 		   src, slen, (int)tlen, tgt, tlen, slen - tlen);
-		ok(edit_distance_lev(src, slen, tgt, tlen) == slen - tlen,
+		ok(edit_distance_lev(src, slen, tgt, tlen, slen + tlen)
+		   == slen - tlen,
 		   "edit_distance_lev(\"%.3s..., %u, \"%.*s\", %u) == %u",
 		   src, slen, (int)tlen, tgt, tlen, slen - tlen);
-		ok(edit_distance_rdl(src, slen, tgt, tlen) == slen - tlen,
+		ok(edit_distance_rdl(src, slen, tgt, tlen, slen + tlen)
+		   == slen - tlen,
 		   "edit_distance_rdl(\"%.3s..., %u, \"%.*s\", %u) == %u",
 		   src, slen, (int)tlen, tgt, tlen, slen - tlen);
 		ok(edit_distance_dl(src, slen, tgt, tlen) == slen - tlen,
@@ -248,13 +253,16 @@ static void test_mem_use(void)
 
 		/* Below threshold, no allocation */
 		--slen;
-		ok(edit_distance_lcs(src, slen, tgt, tlen) == slen - tlen,
+		ok(edit_distance_lcs(src, slen, tgt, tlen, slen + tlen)
+		   == slen - tlen,
 		   "edit_distance_lcs(\"%.3s..., %u, \"%.*s\", %u) == %u",
 		   src, slen, (int)tlen, tgt, tlen, slen - tlen);
-		ok(edit_distance_lev(src, slen, tgt, tlen) == slen - tlen,
+		ok(edit_distance_lev(src, slen, tgt, tlen, slen + tlen)
+		   == slen - tlen,
 		   "edit_distance_lev(\"%.3s..., %u, \"%.*s\", %u) == %u",
 		   src, slen, (int)tlen, tgt, tlen, slen - tlen);
-		ok(edit_distance_rdl(src, slen, tgt, tlen) == slen - tlen,
+		ok(edit_distance_rdl(src, slen, tgt, tlen, slen + tlen)
+		   == slen - tlen,
 		   "edit_distance_rdl(\"%.3s..., %u, \"%.*s\", %u) == %u",
 		   src, slen, (int)tlen, tgt, tlen, slen - tlen);
 		ok(edit_distance_dl(src, slen, tgt, tlen) == slen - tlen,
@@ -263,9 +271,43 @@ static void test_mem_use(void)
 	}
 }
 
+/* Test edit_distance_max stops early without changing distances within max.
+ */
+static void test_max(void)
+{
+	const char *strs[] = { "", "a", "ab", "abcdef", "fedcba", "aabbccdd",
+		"cdeffedc", "dcbadcba", "abcdefabcdef"
+	};
+	enum ed_measure measures[] = { EDIT_DISTANCE_LCS, EDIT_DISTANCE_LEV,
+		EDIT_DISTANCE_RDL, EDIT_DISTANCE_DL
+	};
+
+	for (size_t m = 0; m < ARRAY_SIZE(measures); ++m) {
+		bool all = true;
+		for (size_t i = 0; i < ARRAY_SIZE(strs); ++i) {
+			for (size_t j = 0; j < ARRAY_SIZE(strs); ++j) {
+				ed_size slen = strlen(strs[i]);
+				ed_size tlen = strlen(strs[j]);
+				ed_dist dist = edit_distance(strs[i], slen,
+							     strs[j], tlen,
+							     measures[m]);
+				for (ed_dist max = 0; max < 20; ++max) {
+					ed_dist maxdist = edit_distance_max(
+					    strs[i], slen, strs[j], tlen,
+					    measures[m], max);
+					all &= maxdist ==
+					    (dist > max ? max + 1 : dist);
+				}
+			}
+		}
+		ok(all, "edit_distance_max(..., %d, max) == min(dist, max + 1)",
+		   (int)measures[m]);
+	}
+}
+
 int main(void)
 {
-	plan_tests(109);
+	plan_tests(113);
 
 	test_lcs();
 	test_lev();
@@ -273,6 +315,7 @@ int main(void)
 	test_dl();
 
 	test_mem_use();
+	test_max();
 
 	/* Unsupported edit distance measure */
 	enum ed_measure badmeasure = (enum ed_measure)-1;
@@ -7,35 +7,36 @@
 
 #include <ccan/generator/generator.h>
 
-#define DEFAULT_STATE_SIZE	8192
+/*
+ * Stacks come from coroutine's pool, and are only committed as they're
+ * used, so we can afford plenty: most generators touch a page or two.
+ */
+#define DEFAULT_STATE_SIZE	(64 * 1024)
 #define STATE_ALIGN		ALIGNOF(struct generator_)
 
-static size_t generator_metasize(size_t retsize)
+static size_t generator_align(size_t size)
 {
-	retsize = (retsize + STATE_ALIGN) & ~(STATE_ALIGN - 1);
-	return sizeof(struct generator_) + retsize;
+	return (size + STATE_ALIGN) & ~(STATE_ALIGN - 1);
 }
 
-void *generator_new_(void (*fn)(void *), size_t retsize)
+void *generator_new_(void (*fn)(void *), size_t retsize, size_t argsize)
 {
-	char *base;
-	size_t size = DEFAULT_STATE_SIZE;
-	size_t metasize = generator_metasize(retsize);
+	/* State, then return value, then arguments. */
+	size_t metasize = sizeof(struct generator_) + generator_align(retsize)
+		+ generator_align(argsize);
 	struct coroutine_stack *stack;
 	void *ret;
 	struct generator_ *gen;
 
-	base = malloc(size);
-	if (!base)
+	stack = coroutine_stack_pool_alloc(DEFAULT_STATE_SIZE, metasize);
+	if (!stack)
 		abort();
 
-	retsize = (retsize + STATE_ALIGN) & ~(STATE_ALIGN - 1);
-
-	stack = coroutine_stack_init(base, size, metasize);
 	gen = coroutine_stack_to_metadata(stack, metasize);
 	ret = gen + 1;
 
-	gen->base = base;
+	gen->metasize = metasize;
+	gen->base = (char *)ret + generator_align(retsize);
 	gen->complete = false;
 
 	coroutine_init(&gen->gen, fn, ret, stack);
@@ -46,10 +47,8 @@ void *generator_new_(void (*fn)(void *), size_t retsize)
 void generator_free_(void *ret, size_t retsize)
 {
 	struct generator_ *gen = generator_state_(ret);
-	size_t metasize = generator_metasize(retsize);
 	struct coroutine_stack *stack;
 
-	stack = coroutine_stack_from_metadata(gen, metasize);
-	coroutine_stack_release(stack, metasize);
-	free(gen->base);
+	stack = coroutine_stack_from_metadata(gen, gen->metasize);
+	coroutine_stack_release(stack, gen->metasize);
 }
@@ -31,6 +31,7 @@ struct generator_ {
 	struct coroutine_state gen;
 	struct coroutine_state caller;
 	bool complete;
+	size_t metasize;
 	void *base;
 };
 
@@ -49,7 +50,7 @@ struct generator_incomplete_;
 #define generator_rtype_(gen_)			\
 	typeof((*(gen_))((struct generator_incomplete_ *)NULL))
 
-void *generator_new_(void (*fn)(void *), size_t retsize);
+void *generator_new_(void (*fn)(void *), size_t retsize, size_t argsize);
 void generator_free_(void *ret, size_t retsize);
 
 /*
@@ -134,7 +135,8 @@ void generator_free_(void *ret, size_t retsize);
 	name_(generator_parms_outer_(__VA_ARGS__))			\
 	{								\
 		generator_t(rtype_) gen = generator_new_(name_##_generator__, \
-							 sizeof(rtype_)); \
+			sizeof(rtype_),					\
+			sizeof(generator_argstruct_(__VA_ARGS__)));	\
 		UNNEEDED generator_argstruct_(__VA_ARGS__) *args =	\
 			generator_argp_(gen);				\
 		generator_args_pack_(__VA_ARGS__);			\
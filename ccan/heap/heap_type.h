@@ -0,0 +1,248 @@
+/* Licensed under BSD-MIT - see LICENSE file for details */
+#ifndef CCAN_HEAP_TYPE_H
+#define CCAN_HEAP_TYPE_H
+#include "config.h"
+#include <ccan/compiler/compiler.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * HEAP_NO_HANDLE - handle returned when a push fails
+ */
+#define HEAP_NO_HANDLE ((size_t)-1)
+
+/**
+ * HEAP_DEFINE_TYPE - create a typed heap which stores elements inline
+ * @type: the element type (eg. a key, or a struct holding a key and a pointer)
+ * @lessfn: a function/macro to order elements: bool @lessfn(const type *, const type *)
+ * @name: a prefix for the heap type and all the functions to define
+ *
+ * Unlike struct heap, the elements themselves are kept in the heap array,
+ * so a comparison doesn't chase a pointer, and @lessfn is inlined rather
+ * than called through a function pointer.  The array is laid out as a
+ * 4-ary heap, so the children of a node share a cache line or two, and
+ * the tree is half as deep.
+ *
+ * Every element pushed gets a handle, which stays valid until that
+ * element is popped or removed, and which you can use to change or
+ * remove it without searching.  Handles are small integers, and are
+ * reused.
+ *
+ * This defines the heap type:
+ *	struct <name>;
+ *
+ * Initialization and freeing functions:
+ *	void <name>_init(struct <name> *);
+ *	void <name>_clear(struct <name> *);
+ *
+ * Push only fails if we run out of memory, returning HEAP_NO_HANDLE:
+ *	size_t <name>_push(struct <name> *h, type e);
+ *
+ * Peek returns NULL if the heap is empty; pop returns false:
+ *	type *<name>_peek(const struct <name> *h);
+ *	bool <name>_pop(struct <name> *h, type *e);
+ *
+ * Access, change or remove an element by handle:
+ *	type *<name>_get(const struct <name> *h, size_t handle);
+ *	void <name>_decrease_key(struct <name> *h, size_t handle, type e);
+ *	void <name>_update(struct <name> *h, size_t handle, type e);
+ *	type <name>_remove(struct <name> *h, size_t handle);
+ *
+ * decrease_key requires that @e is not greater than the element it
+ * replaces (as for a min-heap; "greater" means according to @lessfn), and
+ * is cheaper than update, which can move the element either way.
+ *
+ * And the number of elements:
+ *	size_t <name>_len(const struct <name> *h);
+ *
+ * Example:
+ *	#include <ccan/heap/heap_type.h>
+ *	#include <stdint.h>
+ *
+ *	struct timer {
+ *		uint64_t when;
+ *		void (*fn)(void);
+ *	};
+ *	static inline bool timer_less(const struct timer *a,
+ *				      const struct timer *b)
+ *	{
+ *		return a->when < b->when;
+ *	}
+ *	HEAP_DEFINE_TYPE(struct timer, timer_less, timer_heap);
+ *
+ *	static void run_timers(struct timer_heap *timers, uint64_t now)
+ *	{
+ *		struct timer t;
+ *
+ *		while (timer_heap_peek(timers)
+ *		       && timer_heap_peek(timers)->when <= now) {
+ *			timer_heap_pop(timers, &t);
+ *			t.fn();
+ *		}
+ *	}
+ */
+#define HEAP_DEFINE_TYPE(type, lessfn, name)				\
+	struct name {							\
+		/* The heap, and the handle of each element. */		\
+		type *elem;						\
+		size_t *handle;						\
+		/* Position of each handle, or next free handle. */	\
+		size_t *pos;						\
+		size_t len, cap, free_handle;				\
+	};								\
+	static inline UNNEEDED void name##_init(struct name *h)		\
+	{								\
+		memset(h, 0, sizeof(*h));				\
+		h->free_handle = HEAP_NO_HANDLE;			\
+	}								\
+	static inline UNNEEDED void name##_clear(struct name *h)	\
+	{								\
+		free(h->elem);						\
+		free(h->handle);					\
+		free(h->pos);						\
+		name##_init(h);						\
+	}								\
+	static inline UNNEEDED size_t name##_len(const struct name *h)	\
+	{								\
+		return h->len;						\
+	}								\
+	static inline UNNEEDED type *name##_peek(const struct name *h)	\
+	{								\
+		return h->len ? &h->elem[0] : NULL;			\
+	}								\
+	static inline UNNEEDED type *name##_get(const struct name *h,	\
+						size_t handle)		\
+	{								\
+		return &h->elem[h->pos[handle]];			\
+	}								\
+	static inline bool name##_grow_(struct name *h)			\
+	{								\
+		size_t i, cap = h->cap ? h->cap * 2 : 16;		\
+		void *m;						\
+									\
+		if (!(m = realloc(h->elem, cap * sizeof(type))))	\
+			return false;					\
+		h->elem = m;						\
+		if (!(m = realloc(h->handle, cap * sizeof(size_t))))	\
+			return false;					\
+		h->handle = m;						\
+		if (!(m = realloc(h->pos, cap * sizeof(size_t))))	\
+			return false;					\
+		h->pos = m;						\
+		/* We're full, so the new handles are the only free ones. */ \
+		for (i = h->cap; i < cap - 1; i++)			\
+			h->pos[i] = i + 1;				\
+		h->pos[cap - 1] = HEAP_NO_HANDLE;			\
+		h->free_handle = h->cap;				\
+		h->cap = cap;						\
+		return true;						\
+	}								\
+	static inline void name##_place_(struct name *h, size_t i,	\
+					 const type *e, size_t handle)	\
+	{								\
+		h->elem[i] = *e;					\
+		h->handle[i] = handle;					\
+		h->pos[handle] = i;					\
+	}								\
+	/* Move the hole at i up until e fits, then put e there. */	\
+	static inline void name##_up_(struct name *h, size_t i,		\
+				      type e, size_t handle)		\
+	{								\
+		while (i) {						\
+			size_t p = (i - 1) / 4;				\
+			if (!lessfn(&e, &h->elem[p]))			\
+				break;					\
+			name##_place_(h, i, &h->elem[p], h->handle[p]);	\
+			i = p;						\
+		}							\
+		name##_place_(h, i, &e, handle);			\
+	}								\
+	/* Move the hole at i down until e fits, then put e there. */	\
+	static inline void name##_down_(struct name *h, size_t i,	\
+					type e, size_t handle)		\
+	{								\
+		for (;;) {						\
+			size_t c = 4 * i + 1, best = c, b2;		\
+			if (c >= h->len)				\
+				break;					\
+			if (h->len - c >= 4) {				\
+				/* Pairwise, so it can be branchless. */ \
+				best += lessfn(&h->elem[c+1], &h->elem[c]); \
+				b2 = c + 2					\
+					+ lessfn(&h->elem[c+3], &h->elem[c+2]); \
+				if (lessfn(&h->elem[b2], &h->elem[best]))	\
+					best = b2;			\
+			} else {					\
+				for (c++; c < h->len; c++)		\
+					if (lessfn(&h->elem[c], &h->elem[best])) \
+						best = c;		\
+			}						\
+			if (!lessfn(&h->elem[best], &e))		\
+				break;					\
+			name##_place_(h, i, &h->elem[best], h->handle[best]); \
+			i = best;					\
+		}							\
+		name##_place_(h, i, &e, handle);			\
+	}								\
+	static inline void name##_fix_(struct name *h, size_t i,	\
+				       type e, size_t handle)		\
+	{								\
+		if (i && lessfn(&e, &h->elem[(i - 1) / 4]))		\
+			name##_up_(h, i, e, handle);			\
+		else							\
+			name##_down_(h, i, e, handle);			\
+	}								\
+	static inline void name##_free_handle_(struct name *h,		\
+					       size_t handle)		\
+	{								\
+		h->pos[handle] = h->free_handle;			\
+		h->free_handle = handle;				\
+	}								\
+	static inline UNNEEDED size_t name##_push(struct name *h, type e) \
+	{								\
+		size_t handle;						\
+									\
+		if (h->len == h->cap && !name##_grow_(h))		\
+			return HEAP_NO_HANDLE;				\
+		handle = h->free_handle;				\
+		h->free_handle = h->pos[handle];			\
+		name##_up_(h, h->len++, e, handle);			\
+		return handle;						\
+	}								\
+	static inline UNNEEDED bool name##_pop(struct name *h, type *e)	\
+	{								\
+		if (!h->len)						\
+			return false;					\
+		if (e)							\
+			*e = h->elem[0];				\
+		name##_free_handle_(h, h->handle[0]);			\
+		if (--h->len)						\
+			name##_down_(h, 0, h->elem[h->len],		\
+				     h->handle[h->len]);		\
+		return true;						\
+	}								\
+	static inline UNNEEDED void name##_decrease_key(struct name *h,	\
+							size_t handle,	\
+							type e)		\
+	{								\
+		name##_up_(h, h->pos[handle], e, handle);		\
+	}								\
+	static inline UNNEEDED void name##_update(struct name *h,	\
+						  size_t handle, type e) \
+	{								\
+		name##_fix_(h, h->pos[handle], e, handle);		\
+	}								\
+	static inline UNNEEDED type name##_remove(struct name *h,	\
+						  size_t handle)	\
+	{								\
+		size_t i = h->pos[handle];				\
+		type ret = h->elem[i];					\
+									\
+		name##_free_handle_(h, handle);				\
+		if (i != --h->len)					\
+			name##_fix_(h, i, h->elem[h->len],		\
+				    h->handle[h->len]);			\
+		return ret;						\
+	}
+#endif /* CCAN_HEAP_TYPE_H */
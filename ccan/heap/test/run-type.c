@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <ccan/heap/heap_type.h>
+#include <ccan/tap/tap.h>
+
+#define NUM 10000
+
+struct event {
+	uint64_t when;
+	void *data;
+};
+
+static inline bool event_less(const struct event *a, const struct event *b)
+{
+	return a->when < b->when;
+}
+
+HEAP_DEFINE_TYPE(struct event, event_less, event_heap);
+
+/* A max-heap of plain ints, to check lessfn can be a macro. */
+#define int_more(a, b) (*(a) > *(b))
+HEAP_DEFINE_TYPE(int, int_more, int_heap);
+
+static bool heap_ok(const struct event_heap *h)
+{
+	size_t i;
+
+	for (i = 1; i < h->len; i++)
+		if (event_less(&h->elem[i], &h->elem[(i - 1) / 4]))
+			return false;
+	/* Every element's handle must lead back to it. */
+	for (i = 0; i < h->len; i++)
+		if (h->pos[h->handle[i]] != i)
+			return false;
+	return true;
+}
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+int main(void)
+{
+	struct event_heap h;
+	struct int_heap ih;
+	struct event e, prev;
+	/* Handle and value of each event we've pushed, by data index. */
+	static size_t handle[NUM];
+	static uint64_t when[NUM];
+	static bool live[NUM];
+	size_t i, n;
+	bool ok;
+	int v;
+
+	plan_tests(15);
+
+	event_heap_init(&h);
+	ok1(event_heap_len(&h) == 0);
+	ok1(event_heap_peek(&h) == NULL);
+	ok1(!event_heap_pop(&h, &e));
+
+	ok = true;
+	for (i = 0; i < NUM; i++) {
+		e.when = when[i] = rand32() % 100000;
+		e.data = &when[i];
+		handle[i] = event_heap_push(&h, e);
+		live[i] = true;
+		if (handle[i] == HEAP_NO_HANDLE)
+			ok = false;
+	}
+	ok1(ok);
+	ok1(event_heap_len(&h) == NUM && heap_ok(&h));
+
+	/* Handles find the right elements. */
+	for (i = 0; i < NUM; i++)
+		if (event_heap_get(&h, handle[i])->data != &when[i])
+			break;
+	ok1(i == NUM);
+
+	/* Reschedule some earlier, some later, and remove some. */
+	ok = true;
+	for (n = 0; n < NUM; n++) {
+		i = rand32() % NUM;
+		if (!live[i])
+			continue;
+		switch (rand32() % 3) {
+		case 0:
+			e.when = when[i] = when[i] / 2;
+			e.data = &when[i];
+			event_heap_decrease_key(&h, handle[i], e);
+			break;
+		case 1:
+			e.when = when[i] = rand32() % 100000;
+			e.data = &when[i];
+			event_heap_update(&h, handle[i], e);
+			break;
+		case 2:
+			e = event_heap_remove(&h, handle[i]);
+			if (e.data != &when[i] || e.when != when[i])
+				ok = false;
+			live[i] = false;
+			break;
+		}
+		if (n % 100 == 0 && !heap_ok(&h))
+			ok = false;
+	}
+	ok1(ok && heap_ok(&h));
+
+	for (i = 0; i < NUM; i++)
+		if (live[i] && event_heap_get(&h, handle[i])->when != when[i])
+			break;
+	ok1(i == NUM);
+
+	/* Popping gives them all back in order. */
+	ok = true;
+	prev.when = 0;
+	for (n = 0; event_heap_pop(&h, &e); n++) {
+		uint64_t *w = e.data;
+		if (e.when < prev.when || *w != e.when || !live[w - when])
+			ok = false;
+		live[w - when] = false;
+		prev = e;
+	}
+	ok1(ok);
+	for (i = 0; i < NUM; i++)
+		if (live[i])
+			break;
+	ok1(i == NUM);
+	ok1(event_heap_len(&h) == 0);
+
+	/* Handles get reused, so we don't keep growing. */
+	for (i = 0; i < 16; i++) {
+		e.when = i;
+		event_heap_push(&h, e);
+	}
+	ok1(h.cap == 16384);
+	event_heap_clear(&h);
+	ok1(h.cap == 0 && h.len == 0);
+
+	int_heap_init(&ih);
+	for (i = 0; i < 100; i++)
+		int_heap_push(&ih, (i * 37) % 100);
+	ok = true;
+	for (i = 100; i-- > 0;) {
+		if (*int_heap_peek(&ih) != (int)i)
+			ok = false;
+		int_heap_pop(&ih, &v);
+		if (v != (int)i)
+			ok = false;
+	}
+	ok1(ok);
+	ok1(!int_heap_pop(&ih, NULL));
+	int_heap_clear(&ih);
+
+	return exit_status();
+}
@@ -0,0 +1,132 @@
+/* Speed tests for HEAP_DEFINE_TYPE, compared with heap_push/heap_pop. */
+#include <ccan/heap/heap.h>
+#include <ccan/heap/heap_type.h>
+#include <ccan/time/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+/* What a scheduler might keep: a deadline, and what to run. */
+struct task {
+	uint64_t when;
+	void *data;
+};
+
+static bool task_less(const void *a, const void *b)
+{
+	return ((const struct task *)a)->when < ((const struct task *)b)->when;
+}
+
+static inline bool task_less_typed(const struct task *a, const struct task *b)
+{
+	return a->when < b->when;
+}
+
+HEAP_DEFINE_TYPE(struct task, task_less_typed, task_heap);
+
+static uint64_t rand64(void)
+{
+	return ((uint64_t)random() << 33) ^ ((uint64_t)random() << 11)
+		^ random();
+}
+
+static void bench(size_t size, size_t runs)
+{
+	struct task *tasks = malloc(size * sizeof(*tasks)), *t;
+	struct task task = { 0, NULL };
+	uint64_t *incr = malloc(runs * sizeof(*incr)), now;
+	size_t *handles = malloc(size * sizeof(*handles));
+	struct heap *h = heap_init(task_less);
+	struct task_heap th;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		tasks[i].when = rand64() % (size * 100);
+		tasks[i].data = &tasks[i];
+	}
+	for (i = 0; i < runs; i++)
+		incr[i] = rand64() % (size * 100);
+
+	printf("%zu tasks:\n", size);
+	TIME("heap_push", size,
+	     for (i = 0; i < size; i++)
+		     heap_push(h, &tasks[i]));
+	/* The "hold" model: take the earliest, and reschedule it later. */
+	TIME("heap_pop + heap_push", runs,
+	     for (i = 0; i < runs; i++) {
+		     t = heap_pop(h);
+		     t->when += incr[i];
+		     heap_push(h, t);
+	     });
+	TIME("heap_pop", size,
+	     for (i = 0; i < size; i++)
+		     heap_pop(h));
+
+	/* Same again; tasks[].when has changed, but that doesn't matter. */
+	task_heap_init(&th);
+	TIME("task_heap_push", size,
+	     for (i = 0; i < size; i++)
+		     handles[i] = task_heap_push(&th, tasks[i]));
+	TIME("task_heap_pop + task_heap_push", runs,
+	     for (i = 0; i < runs; i++) {
+		     task_heap_pop(&th, &task);
+		     task.when += incr[i];
+		     task_heap_push(&th, task);
+	     });
+	TIME("task_heap_update (earliest)", runs,
+	     for (i = 0; i < runs; i++) {
+		     task = *task_heap_peek(&th);
+		     task.when += incr[i];
+		     task_heap_update(&th, th.handle[0], task);
+	     });
+	TIME("task_heap_decrease_key (random)", runs,
+	     for (i = 0; i < runs; i++) {
+		     size_t hd = th.handle[incr[i] % size];
+		     task = *task_heap_get(&th, hd);
+		     task.when -= task.when / 4;
+		     task_heap_decrease_key(&th, hd, task);
+	     });
+	now = 0;
+	TIME("task_heap_pop", size,
+	     for (i = 0; i < size; i++) {
+		     task_heap_pop(&th, &task);
+		     now += task.when;
+	     });
+	if (now == 42)
+		printf("(%zu)\n", (size_t)now);
+
+	task_heap_clear(&th);
+	heap_free(h);
+	free(handles);
+	free(incr);
+	free(tasks);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t runs = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+
+	bench(1000, runs);
+	bench(100000, runs);
+	bench(10000000, runs);
+	return 0;
+}
@@ -0,0 +1,360 @@
+/* Licensed under GPLv2+ - see LICENSE file for details */
+#include <ccan/idtree/lf/lf.h>
+#include <ccan/tal/tal.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define IDTREE_BITS 5
+#define IDTREE_FULL 0xffffffffu
+#define IDTREE_SIZE (1 << IDTREE_BITS)
+#define IDTREE_MASK ((1 << IDTREE_BITS)-1)
+#define MAX_ID_SHIFT (sizeof(int)*8 - 1)
+#define MAX_LEVEL ((MAX_ID_SHIFT + IDTREE_BITS - 1) / IDTREE_BITS)
+
+/*
+ * The same layers as ccan/idtree.  In a leaf, a bit is set if that id is
+ * taken, and ary[] holds the user's pointers; in the layers above, a bit
+ * is set if the layer below is full, and ary[] points to the layers below.
+ *
+ * Layers are only ever added (with a compare-and-swap, so racing threads
+ * agree on which one went in), and only freed with the whole tree: so a
+ * lookup can walk down without any locks.
+ */
+struct idtree_lf_layer {
+	_Atomic(uint32_t) bitmap;
+	_Atomic(void *) ary[IDTREE_SIZE];
+};
+
+struct idtree_lf {
+	struct idtree_lf_layer *top;
+	unsigned int layers;
+	int max_id;
+};
+
+static unsigned int lowest_bit(uint32_t bm)
+{
+#if HAVE_BUILTIN_CTZ
+	return __builtin_ctz(bm);
+#else
+	unsigned int n = 0;
+
+	while (!(bm & (1u << n)))
+		n++;
+	return n;
+#endif
+}
+
+/* Layer @l (0 is a leaf) whose first id is @base.  Ids past max_id are
+ * marked taken from the start, so we never hand them out. */
+static struct idtree_lf_layer *new_layer(const struct idtree_lf *idp,
+					 uint64_t base, unsigned int l)
+{
+	struct idtree_lf_layer *p = malloc(sizeof(*p));
+	uint32_t bm = 0;
+	unsigned int n;
+
+	if (!p)
+		return NULL;
+	for (n = 0; n < IDTREE_SIZE; n++) {
+		if (base + ((uint64_t)n << (IDTREE_BITS * l)) > (uint64_t)idp->max_id)
+			bm |= 1u << n;
+		atomic_init(&p->ary[n], NULL);
+	}
+	atomic_init(&p->bitmap, bm);
+	return p;
+}
+
+static struct idtree_lf_layer *get_child(const struct idtree_lf *idp,
+					 struct idtree_lf_layer *p,
+					 unsigned int n,
+					 uint64_t base, unsigned int l)
+{
+	void *old = NULL;
+	struct idtree_lf_layer *pn;
+
+	pn = atomic_load_explicit(&p->ary[n], memory_order_acquire);
+	if (pn)
+		return pn;
+
+	if (!(pn = new_layer(idp, base, l)))
+		return NULL;
+	if (!atomic_compare_exchange_strong_explicit(&p->ary[n], &old, pn,
+						     memory_order_acq_rel,
+						     memory_order_acquire)) {
+		/* Someone else beat us to it. */
+		free(pn);
+		pn = old;
+	}
+	return pn;
+}
+
+/*
+ * Layer pa[l] just filled up: set its bit in the layer above, and so on
+ * up the tree.  A remove racing with us may have freed an id in it after
+ * we filled it, and found that bit not yet set (so left it alone): so
+ * once we've set it, check the layer is still full, and take it back if
+ * not.  The worst a race leaves behind is a bit clear for a full layer,
+ * which just costs the next search a look at it.
+ */
+static void mark_full(const struct idtree_lf *idp,
+		      struct idtree_lf_layer *pa[], unsigned int l, uint64_t id)
+{
+	for (l++; l < idp->layers; l++) {
+		uint32_t bit = 1u << ((id >> (IDTREE_BITS * l)) & IDTREE_MASK);
+		uint32_t old = atomic_fetch_or(&pa[l]->bitmap, bit);
+
+		if (atomic_load(&pa[l-1]->bitmap) != IDTREE_FULL) {
+			atomic_fetch_and(&pa[l]->bitmap, ~bit);
+			return;
+		}
+		if ((old | bit) != IDTREE_FULL)
+			return;
+	}
+}
+
+/* The leaf pa[0] was full, and now isn't: clear its bit above, and so on. */
+static void mark_free(const struct idtree_lf *idp,
+		      struct idtree_lf_layer *pa[], uint64_t id)
+{
+	unsigned int l;
+
+	for (l = 1; l < idp->layers; l++) {
+		uint32_t bit = 1u << ((id >> (IDTREE_BITS * l)) & IDTREE_MASK);
+
+		if (atomic_fetch_and(&pa[l]->bitmap, ~bit) != IDTREE_FULL)
+			return;
+	}
+}
+
+/*
+ * Claim the lowest free id from @id to @limit: just that one, or if
+ * @whole, every free one in its leaf.  Returns the (lowest) id claimed,
+ * or -1.
+ */
+static int claim(struct idtree_lf *idp, uint64_t id, int limit, bool whole,
+		 struct idtree_lf_layer **leaf, uint32_t *claimed)
+{
+	struct idtree_lf_layer *pa[MAX_LEVEL], *p;
+	unsigned int l, n, m, sh;
+	uint32_t bm, avail, old;
+
+restart:
+	if (id > (uint64_t)limit)
+		return -1;
+	p = idp->top;
+	l = idp->layers - 1;
+	while (1) {
+		/*
+		 * We run around this while until we reach the leaf node...
+		 */
+		sh = IDTREE_BITS * l;
+		n = (id >> sh) & IDTREE_MASK;
+		bm = atomic_load_explicit(&p->bitmap, memory_order_acquire);
+		avail = ~bm & (IDTREE_FULL << n);
+		if (!avail) {
+			/* no space available: if already at the top, we're
+			 * full; otherwise try the next layer along. */
+			if (l == idp->layers - 1)
+				return -1;
+			/* Nobody told the layer above this one is full. */
+			if (bm == IDTREE_FULL) {
+				pa[l] = p;
+				mark_full(idp, pa, l, id);
+			}
+			id = ((id >> (sh + IDTREE_BITS)) + 1) << (sh + IDTREE_BITS);
+			goto restart;
+		}
+		m = lowest_bit(avail);
+		if (m != n)
+			id = ((id >> sh) - n + m) << sh;
+		if (id > (uint64_t)limit)
+			return -1;
+		if (l == 0)
+			break;
+		pa[l] = p;
+		p = get_child(idp, p, m, id >> sh << sh, l - 1);
+		if (!p)
+			return -1;
+		l--;
+	}
+
+	/*
+	 * We have reached the leaf node: try to take the id (or ids).
+	 */
+	if (!whole)
+		avail = 1u << m;
+	old = atomic_fetch_or(&p->bitmap, avail);
+	avail &= ~old;
+	if (!avail)
+		/* Someone else took them first. */
+		goto restart;
+
+	if ((old | avail) == IDTREE_FULL) {
+		pa[0] = p;
+		mark_full(idp, pa, 0, id);
+	}
+	*leaf = p;
+	*claimed = avail;
+	return (id & ~(uint64_t)IDTREE_MASK) + lowest_bit(avail);
+}
+
+/* Fill in the layers down to @id's leaf, if they're there. */
+static struct idtree_lf_layer *find_leaf(const struct idtree_lf *idp, int id,
+					 struct idtree_lf_layer *pa[])
+{
+	struct idtree_lf_layer *p = idp->top;
+	unsigned int l;
+
+	if (id < 0 || id > idp->max_id)
+		return NULL;
+
+	for (l = idp->layers - 1; l > 0; l--) {
+		pa[l] = p;
+		p = atomic_load_explicit(&p->ary[(id >> (IDTREE_BITS * l))
+						 & IDTREE_MASK],
+					 memory_order_acquire);
+		if (!p)
+			return NULL;
+	}
+	return pa[0] = p;
+}
+
+static void release(const struct idtree_lf *idp, struct idtree_lf_layer *pa[],
+		    int id, uint32_t bits)
+{
+	if (atomic_fetch_and(&pa[0]->bitmap, ~bits) == IDTREE_FULL)
+		mark_free(idp, pa, id);
+}
+
+static void free_layers(struct idtree_lf_layer *p, unsigned int l)
+{
+	unsigned int n;
+
+	if (l > 0) {
+		for (n = 0; n < IDTREE_SIZE; n++) {
+			struct idtree_lf_layer *pn;
+
+			pn = atomic_load_explicit(&p->ary[n],
+						  memory_order_relaxed);
+			if (pn)
+				free_layers(pn, l - 1);
+		}
+	}
+	free(p);
+}
+
+static void destroy_idtree(struct idtree_lf *idp)
+{
+	free_layers(idp->top, idp->layers - 1);
+}
+
+struct idtree_lf *idtree_lf_new(void *mem_ctx, int max_id)
+{
+	struct idtree_lf *idp;
+
+	assert(max_id >= 0);
+	idp = tal(mem_ctx, struct idtree_lf);
+	if (!idp)
+		return NULL;
+
+	idp->max_id = max_id;
+	idp->layers = 1;
+	while (idp->layers < MAX_LEVEL
+	       && (max_id >> (IDTREE_BITS * idp->layers)))
+		idp->layers++;
+	idp->top = new_layer(idp, 0, idp->layers - 1);
+	if (!idp->top)
+		return tal_free(idp);
+	tal_add_destructor(idp, destroy_idtree);
+	return idp;
+}
+
+void *idtree_lf_lookup(const struct idtree_lf *idp, int id)
+{
+	struct idtree_lf_layer *pa[MAX_LEVEL], *p;
+
+	p = find_leaf(idp, id, pa);
+	if (!p)
+		return NULL;
+	return atomic_load_explicit(&p->ary[id & IDTREE_MASK],
+				    memory_order_acquire);
+}
+
+bool idtree_lf_remove(struct idtree_lf *idp, int id)
+{
+	struct idtree_lf_layer *pa[MAX_LEVEL], *p;
+
+	p = find_leaf(idp, id, pa);
+	if (!p)
+		return false;
+
+	/* Whoever clears the pointer owns the id: then it can go back. */
+	if (!atomic_exchange(&p->ary[id & IDTREE_MASK], NULL))
+		return false;
+	release(idp, pa, id, 1u << (id & IDTREE_MASK));
+	return true;
+}
+
+int idtree_lf_add_above(struct idtree_lf *idp, const void *ptr,
+			int starting_id, int limit)
+{
+	struct idtree_lf_layer *leaf;
+	uint32_t claimed;
+	int id;
+
+	if (limit > idp->max_id)
+		limit = idp->max_id;
+	id = claim(idp, starting_id < 0 ? 0 : starting_id, limit, false,
+		   &leaf, &claimed);
+	if (id >= 0)
+		atomic_store_explicit(&leaf->ary[id & IDTREE_MASK],
+				      (void *)ptr, memory_order_release);
+	return id;
+}
+
+int idtree_lf_add(struct idtree_lf *idp, const void *ptr, int limit)
+{
+	return idtree_lf_add_above(idp, ptr, 0, limit);
+}
+
+void idtree_lf_cache_init(struct idtree_lf_cache *cache,
+			  struct idtree_lf *idtree)
+{
+	cache->idtree = idtree;
+	cache->leaf = NULL;
+	cache->base = 0;
+	cache->reserved = 0;
+}
+
+int idtree_lf_cache_add(struct idtree_lf_cache *cache, const void *ptr)
+{
+	unsigned int n;
+
+	if (!cache->reserved) {
+		int id = claim(cache->idtree, 0, cache->idtree->max_id, true,
+			       &cache->leaf, &cache->reserved);
+		if (id < 0)
+			return -1;
+		cache->base = id & ~IDTREE_MASK;
+	}
+
+	n = lowest_bit(cache->reserved);
+	cache->reserved &= cache->reserved - 1;
+	atomic_store_explicit(&cache->leaf->ary[n], (void *)ptr,
+			      memory_order_release);
+	return cache->base + n;
+}
+
+void idtree_lf_cache_flush(struct idtree_lf_cache *cache)
+{
+	struct idtree_lf_layer *pa[MAX_LEVEL];
+
+	if (!cache->reserved)
+		return;
+
+	/* The leaf is there: we took these ids from it. */
+	if (find_leaf(cache->idtree, cache->base, pa))
+		release(cache->idtree, pa, cache->base, cache->reserved);
+	cache->reserved = 0;
+}
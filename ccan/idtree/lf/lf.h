@@ -0,0 +1,187 @@
+/* Licensed under GPLv2+ - see LICENSE file for details */
+#ifndef CCAN_IDTREE_LF_H
+#define CCAN_IDTREE_LF_H
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+struct idtree_lf;
+struct idtree_lf_layer;
+
+/**
+ * struct idtree_lf_cache - ids reserved for one thread.
+ *
+ * Each thread allocating through idtree_lf_cache_add() keeps one of these:
+ * it holds a whole leaf's worth of free ids (up to 32), claimed from the
+ * tree with a single atomic operation, and hands them out without
+ * touching shared memory again.
+ *
+ * Initialize it with idtree_lf_cache_init(), and give back the ids it
+ * still holds with idtree_lf_cache_flush() before the thread exits.
+ */
+struct idtree_lf_cache {
+	struct idtree_lf *idtree;
+	struct idtree_lf_layer *leaf;
+	int base;
+	uint32_t reserved;
+};
+
+/**
+ * idtree_lf_new - create an id tree which many threads can use at once.
+ * @mem_ctx: tal parent to allocate from (may be NULL).
+ * @max_id: the largest id it will ever hand out (eg. INT_MAX).
+ *
+ * The tree is as deep as @max_id needs, so a smaller @max_id makes for
+ * quicker lookups.  Free it with tal_free(), once no thread is using it.
+ *
+ * Example:
+ *	static struct idtree_lf *conns;
+ *
+ *	static void init(void)
+ *	{
+ *		conns = idtree_lf_new(NULL, 1 << 24);
+ *		if (!conns)
+ *			err(1, "Failed to allocate idtree");
+ *	}
+ */
+struct idtree_lf *idtree_lf_new(void *mem_ctx, int max_id);
+
+/**
+ * idtree_lf_add - get lowest available id, and assign a pointer to it.
+ * @idtree: the tree to allocate from
+ * @ptr: the non-NULL pointer to associate with the id
+ * @limit: the maximum id to allocate (ie. INT_MAX means no limit).
+ *
+ * This returns a non-negative id number, or -1 if all are taken (or we
+ * ran out of memory).  It is safe to call from any number of threads
+ * at once: each id is claimed with an atomic bitmap update, so when
+ * threads race, the lowest id goes to one of them and the others move
+ * on to the next.
+ *
+ * Example:
+ *	struct conn {
+ *		int id;
+ *		// ...
+ *	};
+ *
+ *	static struct conn *new_conn(void)
+ *	{
+ *		int id;
+ *		struct conn *conn = calloc(1, sizeof(*conn));
+ *		if (!conn)
+ *			return NULL;
+ *
+ *		id = idtree_lf_add(conns, conn, INT_MAX);
+ *		if (id < 0) {
+ *			free(conn);
+ *			return NULL;
+ *		}
+ *		conn->id = id;
+ *		return conn;
+ *	}
+ */
+int idtree_lf_add(struct idtree_lf *idtree, const void *ptr, int limit);
+
+/**
+ * idtree_lf_add_above - get lowest available id, starting at a given value.
+ * @idtree: the tree to allocate from
+ * @ptr: the non-NULL pointer to associate with the id
+ * @starting_id: the minimum id value to consider.
+ * @limit: the maximum id to allocate (ie. INT_MAX means no limit).
+ *
+ * Like idtree_lf_add(), this is safe to call from any number of threads.
+ *
+ * Example:
+ *	// Use the high ids for listeners.
+ *	static int add_listener(struct conn *conn)
+ *	{
+ *		return idtree_lf_add_above(conns, conn, 1 << 23, INT_MAX);
+ *	}
+ */
+int idtree_lf_add_above(struct idtree_lf *idtree, const void *ptr,
+			int starting_id, int limit);
+
+/**
+ * idtree_lf_lookup - look up a given id
+ * @idtree: the tree to look in
+ * @id: the id to look up
+ *
+ * Returns NULL if the value is not found, otherwise the pointer value
+ * set when it was added.  This takes no locks and writes nothing, so any
+ * number of threads can look up ids while others add and remove them.
+ *
+ * Example:
+ *	static struct conn *find_conn(int id)
+ *	{
+ *		return idtree_lf_lookup(conns, id);
+ *	}
+ */
+void *idtree_lf_lookup(const struct idtree_lf *idtree, int id);
+
+/**
+ * idtree_lf_remove - remove a given id.
+ * @idtree: the tree to remove from
+ * @id: the id to remove.
+ *
+ * Returns false if the id was not in the tree.  Once this returns, the
+ * id can be handed out again.  Only the memory for the ids themselves
+ * is reused: the tree's layers stay until the tree is freed, which is
+ * why lookups don't need locks.
+ *
+ * Example:
+ *	static void free_conn(struct conn *conn)
+ *	{
+ *		if (!idtree_lf_remove(conns, conn->id))
+ *			abort();
+ *		free(conn);
+ *	}
+ */
+bool idtree_lf_remove(struct idtree_lf *idtree, int id);
+
+/**
+ * idtree_lf_cache_init - set up a thread's id cache.
+ * @cache: the cache
+ * @idtree: the tree it takes ids from.
+ *
+ * Example:
+ *	static void *conn_thread(void *arg)
+ *	{
+ *		struct idtree_lf_cache cache;
+ *		struct conn *conn = calloc(1, sizeof(*conn));
+ *
+ *		idtree_lf_cache_init(&cache, conns);
+ *		if (conn) {
+ *			int id = idtree_lf_cache_add(&cache, conn);
+ *			conn->id = id;
+ *			// ...
+ *		}
+ *		idtree_lf_cache_flush(&cache);
+ *		return arg;
+ *	}
+ */
+void idtree_lf_cache_init(struct idtree_lf_cache *cache,
+			  struct idtree_lf *idtree);
+
+/**
+ * idtree_lf_cache_add - assign a pointer to one of a thread's reserved ids.
+ * @cache: the thread's cache
+ * @ptr: the non-NULL pointer to associate with the id
+ *
+ * When the cache is empty, this reserves every free id in the lowest
+ * leaf (32 ids) which has any; otherwise it's a couple of instructions
+ * and a store.  So ids are not strictly lowest-first: each thread works
+ * through its own leaf.
+ *
+ * Returns the id, or -1 if they are all taken (or we ran out of memory).
+ * Remove the id with idtree_lf_remove() as normal, from any thread.
+ */
+int idtree_lf_cache_add(struct idtree_lf_cache *cache, const void *ptr);
+
+/**
+ * idtree_lf_cache_flush - give back a cache's unused ids.
+ * @cache: the thread's cache
+ *
+ * This leaves the cache empty, but still usable.
+ */
+void idtree_lf_cache_flush(struct idtree_lf_cache *cache);
+#endif /* CCAN_IDTREE_LF_H */
@@ -0,0 +1,96 @@
+#include <ccan/idtree/lf/lf.c>
+#include <ccan/tap/tap.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define LIVE 1000
+#define ROUNDS 50
+/* Barely enough room (the caches hold up to a leaf each), so they fight
+ * over the same leaves. */
+#define NUM_IDS (THREADS * (LIVE + IDTREE_SIZE))
+
+static struct idtree_lf *idtree;
+/* What each thread put in: a pointer to its own slot. */
+static char owned[THREADS][LIVE];
+static int ids[THREADS][LIVE];
+/* Which ids are handed out, by which thread (+1). */
+static _Atomic(int) owner[NUM_IDS];
+
+/* Allocate, check, and free ids, over and over. */
+static void *worker(void *arg)
+{
+	size_t t = (size_t)arg, i, round, bad = 0;
+	struct idtree_lf_cache cache;
+
+	idtree_lf_cache_init(&cache, idtree);
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < LIVE; i++) {
+			int expect = 0;
+
+			if ((i + round + t) % 3)
+				ids[t][i] = idtree_lf_add(idtree, &owned[t][i],
+							  INT_MAX);
+			else
+				ids[t][i] = idtree_lf_cache_add(&cache,
+								&owned[t][i]);
+			/* Nobody else may have it. */
+			if (ids[t][i] < 0
+			    || !atomic_compare_exchange_strong(&owner[ids[t][i]],
+							       &expect, t + 1))
+				bad++;
+		}
+		for (i = 0; i < LIVE; i++)
+			if (idtree_lf_lookup(idtree, ids[t][i]) != &owned[t][i])
+				bad++;
+		/* Free in a different order. */
+		for (i = 0; i < LIVE; i++) {
+			size_t j = (i * 7) % LIVE;
+
+			atomic_store(&owner[ids[t][j]], 0);
+			if (!idtree_lf_remove(idtree, ids[t][j]))
+				bad++;
+		}
+	}
+	idtree_lf_cache_flush(&cache);
+	return bad ? NULL : arg;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	size_t i, bad = 0;
+	struct idtree_lf_layer *pa[MAX_LEVEL];
+
+	plan_tests(4);
+	idtree = idtree_lf_new(NULL, NUM_IDS - 1);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (i = 0; i < THREADS; i++) {
+		void *ret;
+
+		pthread_join(threads[i], &ret);
+		if (ret != (void *)i)
+			bad++;
+	}
+	ok1(bad == 0);
+
+	/* Everything came back: the tree is empty again. */
+	for (bad = 0, i = 0; i < NUM_IDS; i++) {
+		if (idtree_lf_lookup(idtree, i))
+			bad++;
+		if (find_leaf(idtree, i, pa)
+		    && atomic_load(&pa[0]->bitmap) & (1u << (i & IDTREE_MASK)))
+			bad++;
+	}
+	ok1(bad == 0);
+	for (bad = 0, i = 0; i < NUM_IDS; i++)
+		if (idtree_lf_add(idtree, &owned[0][0], INT_MAX) != i)
+			bad++;
+	ok1(bad == 0);
+	ok1(idtree_lf_add(idtree, &owned[0][0], INT_MAX) == -1);
+
+	tal_free(idtree);
+	return exit_status();
+}
@@ -0,0 +1,113 @@
+#include <ccan/idtree/lf/lf.c>
+#include <ccan/tap/tap.h>
+#include <limits.h>
+
+#define ALLOC_MAX (2 * IDTREE_SIZE * IDTREE_SIZE + 7)
+
+static bool check_tal_parent(const tal_t *parent, const tal_t *ctx)
+{
+	while (ctx) {
+		if (ctx == parent)
+			return true;
+		ctx = tal_parent(ctx);
+	}
+	return false;
+}
+
+/* Is every bit above a full layer set, and every other one clear? */
+static bool bits_consistent(struct idtree_lf_layer *p, unsigned int l)
+{
+	unsigned int n;
+	uint32_t bm = atomic_load(&p->bitmap);
+
+	if (l == 0)
+		return true;
+	for (n = 0; n < IDTREE_SIZE; n++) {
+		struct idtree_lf_layer *pn = atomic_load(&p->ary[n]);
+
+		if (!pn)
+			continue;
+		if (!bits_consistent(pn, l - 1))
+			return false;
+		if (!!(bm & (1u << n)) != (atomic_load(&pn->bitmap) == IDTREE_FULL))
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, bad;
+	static const char allocated[ALLOC_MAX] = { 0 };
+	struct idtree_lf *idtree;
+	struct idtree_lf_cache cache, cache2;
+	void *ctx;
+
+	plan_tests(19);
+	ctx = tal(NULL, char);
+	idtree = idtree_lf_new(ctx, ALLOC_MAX - 1);
+	ok1(check_tal_parent(ctx, idtree));
+	ok1(idtree->layers == 3);
+
+	/* Lowest first, up to max_id. */
+	for (bad = 0, i = 0; i < ALLOC_MAX; i++) {
+		if (idtree_lf_add(idtree, &allocated[i], INT_MAX) != i)
+			bad++;
+		if (idtree_lf_lookup(idtree, i) != &allocated[i])
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(idtree_lf_add(idtree, &allocated[0], INT_MAX) == -1);
+	ok1(!idtree_lf_lookup(idtree, ALLOC_MAX) && !idtree_lf_lookup(idtree, -1));
+	ok1(bits_consistent(idtree->top, idtree->layers - 1));
+
+	/* Remove every second one. */
+	for (bad = 0, i = 0; i < ALLOC_MAX; i += 2)
+		if (!idtree_lf_remove(idtree, i))
+			bad++;
+	ok1(bad == 0);
+	ok1(!idtree_lf_remove(idtree, 0) && !idtree_lf_remove(idtree, ALLOC_MAX));
+	for (bad = 0, i = 0; i < ALLOC_MAX; i++) {
+		if (idtree_lf_lookup(idtree, i) != (i % 2 ? &allocated[i] : NULL))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(bits_consistent(idtree->top, idtree->layers - 1));
+
+	/* Now, finally, reallocate: respecting limits and starting ids. */
+	ok1(idtree_lf_add(idtree, &allocated[0], INT_MAX) == 0);
+	ok1(idtree_lf_add_above(idtree, &allocated[1000], 999, INT_MAX) == 1000);
+	ok1(idtree_lf_add_above(idtree, &allocated[1002], 1001, 1001) == -1);
+	for (bad = 0, i = 1; i <= ALLOC_MAX/2; i++) {
+		if (i * 2 == 1000)
+			continue;
+		if (idtree_lf_add(idtree, &allocated[i*2], INT_MAX) != i * 2)
+			bad++;
+	}
+	ok1(bad == 0);
+	for (bad = 0, i = 0; i < ALLOC_MAX; i++)
+		if (idtree_lf_lookup(idtree, i) != &allocated[i])
+			bad++;
+	ok1(bad == 0);
+
+	/* Caches reserve a leaf each, and give back what they don't use. */
+	for (i = 0; i < 3 * IDTREE_SIZE; i++)
+		idtree_lf_remove(idtree, IDTREE_SIZE + i);
+	idtree_lf_cache_init(&cache, idtree);
+	idtree_lf_cache_init(&cache2, idtree);
+	ok1(idtree_lf_cache_add(&cache, &allocated[1]) == IDTREE_SIZE
+	    && idtree_lf_cache_add(&cache2, &allocated[2]) == 2 * IDTREE_SIZE
+	    && idtree_lf_cache_add(&cache, &allocated[3]) == IDTREE_SIZE + 1);
+	/* Reserved, but not assigned. */
+	ok1(!idtree_lf_lookup(idtree, IDTREE_SIZE + 2)
+	    && !idtree_lf_remove(idtree, IDTREE_SIZE + 2)
+	    && idtree_lf_add(idtree, &allocated[4], INT_MAX) == 3 * IDTREE_SIZE);
+	idtree_lf_cache_flush(&cache);
+	ok1(idtree_lf_add(idtree, &allocated[5], INT_MAX) == IDTREE_SIZE + 2
+	    && idtree_lf_lookup(idtree, IDTREE_SIZE) == &allocated[1]);
+	idtree_lf_cache_flush(&cache2);
+	ok1(bits_consistent(idtree->top, idtree->layers - 1));
+
+	tal_free(ctx);
+	exit(exit_status());
+}
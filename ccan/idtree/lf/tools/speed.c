@@ -0,0 +1,161 @@
+/*
+ * Multi-threaded speed test: idtree/lf (with and without a per-thread
+ * cache) against an idtree behind a pthread mutex.
+ *
+ * Each thread keeps a window of live ids, like connections: it
+ * allocates one, looks up a few of its others, and frees the oldest.
+ *
+ * Usage: speed [live-ids-per-thread] [ops-per-thread] [max-threads]
+ */
+#include <ccan/idtree/idtree.h>
+#include <ccan/idtree/lf/lf.h>
+#include <ccan/tal/tal.h>
+#include <ccan/time/time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum kind { LOCKED, LOCKFREE, CACHED };
+
+static size_t live, ops;
+static struct idtree *locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct idtree_lf *lf;
+
+struct thread {
+	pthread_t id;
+	unsigned int t;
+	enum kind kind;
+	int *ids;
+};
+
+static int add(struct thread *me, struct idtree_lf_cache *cache)
+{
+	int id;
+
+	switch (me->kind) {
+	case LOCKED:
+		pthread_mutex_lock(&lock);
+		id = idtree_add(locked, me, INT_MAX);
+		pthread_mutex_unlock(&lock);
+		return id;
+	case LOCKFREE:
+		return idtree_lf_add(lf, me, INT_MAX);
+	case CACHED:
+		return idtree_lf_cache_add(cache, me);
+	}
+	abort();
+}
+
+static void *lookup(struct thread *me, int id)
+{
+	void *p;
+
+	if (me->kind != LOCKED)
+		return idtree_lf_lookup(lf, id);
+	pthread_mutex_lock(&lock);
+	p = idtree_lookup(locked, id);
+	pthread_mutex_unlock(&lock);
+	return p;
+}
+
+static void del(struct thread *me, int id)
+{
+	bool ok;
+
+	if (me->kind != LOCKED)
+		ok = idtree_lf_remove(lf, id);
+	else {
+		pthread_mutex_lock(&lock);
+		ok = idtree_remove(locked, id);
+		pthread_mutex_unlock(&lock);
+	}
+	if (!ok)
+		abort();
+}
+
+static void *run(void *arg)
+{
+	struct thread *me = arg;
+	struct idtree_lf_cache cache;
+	size_t i, r = me->t * 2654435761U;
+
+	if (me->kind == CACHED)
+		idtree_lf_cache_init(&cache, lf);
+	for (i = 0; i < live; i++)
+		me->ids[i] = add(me, &cache);
+	for (i = 0; i < ops; i++) {
+		size_t slot = i % live;
+
+		/* Three lookups for every allocation. */
+		r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+		if (lookup(me, me->ids[(r >> 33) % live]) != me
+		    || lookup(me, me->ids[(r >> 17) % live]) != me
+		    || lookup(me, me->ids[(r >> 5) % live]) != me)
+			abort();
+		del(me, me->ids[slot]);
+		me->ids[slot] = add(me, &cache);
+		if (me->ids[slot] < 0)
+			abort();
+	}
+	for (i = 0; i < live; i++)
+		del(me, me->ids[i]);
+	if (me->kind == CACHED)
+		idtree_lf_cache_flush(&cache);
+	return NULL;
+}
+
+static double bench(enum kind kind, unsigned int nthreads)
+{
+	struct thread *threads = calloc(nthreads, sizeof(*threads));
+	struct timeabs start;
+	size_t i;
+
+	if (kind == LOCKED)
+		locked = idtree_new(NULL);
+	else
+		lf = idtree_lf_new(NULL, INT_MAX);
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].t = i;
+		threads[i].kind = kind;
+		threads[i].ids = calloc(live, sizeof(int));
+		pthread_create(&threads[i].id, NULL, run, &threads[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].id, NULL);
+		free(threads[i].ids);
+	}
+
+	tal_free(locked);
+	tal_free(lf);
+	locked = NULL;
+	lf = NULL;
+	free(threads);
+
+	/* Millions of allocations (each with a free and 3 lookups) per second. */
+	return (double)nthreads * ops
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads, n;
+
+	live = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+	ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+	max_threads = argc > 3 ? atoi(argv[3]) : 32;
+
+	printf("%zu live ids, %zu allocations per thread (Mallocs/sec)\n",
+	       live, ops);
+	printf("threads\tcached\tlf\tmutex\n");
+	for (n = 1; n <= max_threads; n *= 2) {
+		double c = bench(CACHED, n);
+		double f = bench(LOCKFREE, n);
+		double l = bench(LOCKED, n);
+		printf("%u\t%.2f\t%.2f\t%.2f\n", n, c, f, l);
+	}
+	return 0;
+}
@@ -3,6 +3,16 @@
 #include <ccan/hash/hash.h>
 #include <ccan/endian/endian.h>
 #include <assert.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+	&& (defined(__GNUC__) || defined(__clang__))
+#define INVBLOOM_AVX2 1
+#include <ccan/cpuid/cpuid.h>
+#include <immintrin.h>
+#else
+#define INVBLOOM_AVX2 0
+#endif
 
 /* 	"We will show that hash_count values of 3 or 4 work well in practice"
 
@@ -17,16 +27,30 @@ struct invbloom *invbloom_new_(const tal_t *ctx,
 			       size_t n_elems,
 			       u32 salt)
 {
-	struct invbloom *ib = tal(ctx, struct invbloom);
+	return invbloom_new_hashes_(ctx, id_size, n_elems, salt, NUM_HASHES);
+}
+
+struct invbloom *invbloom_new_hashes_(const tal_t *ctx,
+				      size_t id_size,
+				      size_t n_elems,
+				      u32 salt,
+				      unsigned int num_hashes)
+{
+	struct invbloom *ib;
 
+	assert(num_hashes > 0 && num_hashes <= INVBLOOM_MAX_HASHES);
+	ib = tal(ctx, struct invbloom);
 	if (ib) {
 		ib->n_elems = n_elems;
 		ib->id_size = id_size;
 		ib->salt = salt;
+		ib->num_hashes = num_hashes;
+		ib->extract_pos = 0;
 		ib->singleton = NULL;
 		ib->count = tal_arrz(ib, s32, n_elems);
 		ib->idsum = tal_arrz(ib, u8, id_size * n_elems);
-		if (!ib->count || !ib->idsum)
+		ib->hashsum = tal_arrz(ib, u32, n_elems);
+		if (!ib->count || !ib->idsum || !ib->hashsum)
 			ib = tal_free(ib);
 	}
 	return ib;
@@ -41,9 +65,14 @@ void invbloom_singleton_cb_(struct invbloom *ib,
 	ib->singleton_data = data;
 }
 
+static u32 hash_id(const struct invbloom *ib, const void *id, size_t i)
+{
+	return hash((const char *)id, ib->id_size, ib->salt+i*7);
+}
+
 static size_t hash_bucket(const struct invbloom *ib, const void *id, size_t i)
 {
-	return hash((const char *)id, ib->id_size, ib->salt+i*7) % ib->n_elems;
+	return hash_id(ib, id, i) % ib->n_elems;
 }
 
 static u8 *idsum_ptr(const struct invbloom *ib, size_t bucket)
@@ -62,7 +91,14 @@ static void check_for_singleton(struct invbloom *ib, size_t bucket, bool before)
 	ib->singleton(ib, bucket, before, ib->singleton_data);
 }
 
-static void add_to_bucket(struct invbloom *ib, size_t n, const u8 *id)
+/*
+ * Each cell also sums a hash of its ids (the first one, which we need
+ * anyway), so we can tell when a cell holds just one.  It's added, not
+ * xored: an id in a cell twice (two of its hashes collided) cancels out
+ * of idsum, but not out of this.
+ */
+static void add_to_bucket(struct invbloom *ib, size_t n, const u8 *id,
+			  u32 check)
 {
 	size_t i;
 	u8 *idsum = idsum_ptr(ib, n);
@@ -70,6 +106,7 @@ static void add_to_bucket(struct invbloom *ib, size_t n, const u8 *id)
 	check_for_singleton(ib, n, true);
 
 	ib->count[n]++;
+	ib->hashsum[n] += check;
 
 	for (i = 0; i < ib->id_size; i++)
 		idsum[i] ^= id[i];
@@ -77,7 +114,8 @@ static void add_to_bucket(struct invbloom *ib, size_t n, const u8 *id)
 	check_for_singleton(ib, n, false);
 }
 
-static void remove_from_bucket(struct invbloom *ib, size_t n, const u8 *id)
+static void remove_from_bucket(struct invbloom *ib, size_t n, const u8 *id,
+			       u32 check)
 {
 	size_t i;
 	u8 *idsum = idsum_ptr(ib, n);
@@ -85,6 +123,7 @@ static void remove_from_bucket(struct invbloom *ib, size_t n, const u8 *id)
 	check_for_singleton(ib, n, true);
 
 	ib->count[n]--;
+	ib->hashsum[n] -= check;
 	for (i = 0; i < ib->id_size; i++)
 		idsum[i] ^= id[i];
 
@@ -93,18 +132,81 @@ static void remove_from_bucket(struct invbloom *ib, size_t n, const u8 *id)
 
 void invbloom_insert(struct invbloom *ib, const void *id)
 {
+	u32 check = hash_id(ib, id, 0);
 	unsigned int i;
 
-	for (i = 0; i < NUM_HASHES; i++)
-		add_to_bucket(ib, hash_bucket(ib, id, i), id);
+	add_to_bucket(ib, check % ib->n_elems, id, check);
+	for (i = 1; i < ib->num_hashes; i++)
+		add_to_bucket(ib, hash_bucket(ib, id, i), id, check);
 }
 
 void invbloom_delete(struct invbloom *ib, const void *id)
 {
+	u32 check = hash_id(ib, id, 0);
 	unsigned int i;
 
-	for (i = 0; i < NUM_HASHES; i++)
-		remove_from_bucket(ib, hash_bucket(ib, id, i), id);
+	remove_from_bucket(ib, check % ib->n_elems, id, check);
+	for (i = 1; i < ib->num_hashes; i++)
+		remove_from_bucket(ib, hash_bucket(ib, id, i), id, check);
+}
+
+/* Cells to hash (and prefetch) at once: enough to cover memory latency. */
+#define BATCH_BUCKETS 128
+
+static void prefetch_bucket(const struct invbloom *ib, size_t n)
+{
+#if HAVE_BUILTIN_PREFETCH
+	__builtin_prefetch(&ib->count[n], 1);
+	__builtin_prefetch(&ib->hashsum[n], 1);
+	__builtin_prefetch(idsum_ptr(ib, n), 1);
+#else
+	(void)ib;
+	(void)n;
+#endif
+}
+
+static void update_many(struct invbloom *ib, const u8 *elems, size_t num,
+			void (*update)(struct invbloom *, size_t, const u8 *,
+				       u32))
+{
+	size_t buckets[BATCH_BUCKETS];
+	u32 checks[BATCH_BUCKETS];
+	size_t batch = BATCH_BUCKETS / ib->num_hashes;
+
+	while (num) {
+		size_t i, n = num < batch ? num : batch;
+		unsigned int h, b = 0;
+
+		for (i = 0; i < n; i++) {
+			const u8 *id = elems + i * ib->id_size;
+
+			checks[i] = hash_id(ib, id, 0);
+			buckets[b] = checks[i] % ib->n_elems;
+			prefetch_bucket(ib, buckets[b++]);
+			for (h = 1; h < ib->num_hashes; h++) {
+				buckets[b] = hash_bucket(ib, id, h);
+				prefetch_bucket(ib, buckets[b++]);
+			}
+		}
+
+		for (i = 0, b = 0; i < n; i++)
+			for (h = 0; h < ib->num_hashes; h++)
+				update(ib, buckets[b++], elems + i * ib->id_size,
+				       checks[i]);
+
+		elems += n * ib->id_size;
+		num -= n;
+	}
+}
+
+void invbloom_insert_many(struct invbloom *ib, const void *elems, size_t num)
+{
+	update_many(ib, elems, num, add_to_bucket);
+}
+
+void invbloom_delete_many(struct invbloom *ib, const void *elems, size_t num)
+{
+	update_many(ib, elems, num, remove_from_bucket);
 }
 
 static bool all_zero(const u8 *mem, size_t size)
@@ -121,7 +223,7 @@ bool invbloom_get(const struct invbloom *ib, const void *id)
 {
 	unsigned int i;
 
-	for (i = 0; i < NUM_HASHES; i++) {
+	for (i = 0; i < ib->num_hashes; i++) {
 		size_t h = hash_bucket(ib, id, i);
 		u8 *idsum = idsum_ptr(ib, h);
 
@@ -134,17 +236,31 @@ bool invbloom_get(const struct invbloom *ib, const void *id)
 	return false;
 }
 
+/*
+ * After a subtract, a cell can have a count of 1 without holding one
+ * element (eg. two inserted, one deleted): then its hashsum won't match.
+ * A removed element's hash was subtracted, so it's negated.
+ */
+static bool pure(const struct invbloom *ib, size_t bucket, int count)
+{
+	return ib->hashsum[bucket]
+		== (u32)count * hash_id(ib, idsum_ptr(ib, bucket), 0);
+}
+
 static void *extract(const tal_t *ctx, struct invbloom *ib, int count)
 {
-	size_t i;
+	size_t j;
 
-	/* FIXME: this makes full extraction O(n^2). */
-	for (i = 0; i < ib->n_elems; i++) {
+	/* Carry on from the last one found, so full extraction takes a
+	 * few passes over the table, rather than one per element. */
+	for (j = 0; j < ib->n_elems; j++) {
+		size_t i = (ib->extract_pos + j) % ib->n_elems;
 		void *id;
 
-		if (ib->count[i] != count)
+		if (ib->count[i] != count || !pure(ib, i, count))
 			continue;
 
+		ib->extract_pos = i;
 		id = tal_dup_arr(ctx, u8, idsum_ptr(ib, i), ib->id_size, 0);
 		return id;
 	}
@@ -171,6 +287,62 @@ void *invbloom_extract_negative(const tal_t *ctx, struct invbloom *ib)
 	return id;
 }
 
+static void generic_subtract(s32 *count, const s32 *count2, size_t n_elems,
+			     u8 *idsum, const u8 *idsum2, size_t idbytes)
+{
+	size_t i;
+
+	for (i = 0; i < n_elems; i++)
+		count[i] -= count2[i];
+
+	/* A word at a time (they may not be aligned). */
+	for (i = 0; i + sizeof(u64) <= idbytes; i += sizeof(u64)) {
+		u64 a, b;
+
+		memcpy(&a, idsum + i, sizeof(a));
+		memcpy(&b, idsum2 + i, sizeof(b));
+		a ^= b;
+		memcpy(idsum + i, &a, sizeof(a));
+	}
+	for (; i < idbytes; i++)
+		idsum[i] ^= idsum2[i];
+}
+
+#if INVBLOOM_AVX2
+#define AVX2 __attribute__((target("avx2")))
+#define VLOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define VSTORE(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+AVX2 static void avx2_subtract(s32 *count, const s32 *count2, size_t n_elems,
+			       u8 *idsum, const u8 *idsum2, size_t idbytes)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n_elems; i += 8)
+		VSTORE(count + i, _mm256_sub_epi32(VLOAD(count + i),
+						   VLOAD(count2 + i)));
+	for (; i < n_elems; i++)
+		count[i] -= count2[i];
+
+	for (i = 0; i + 32 <= idbytes; i += 32)
+		VSTORE(idsum + i, _mm256_xor_si256(VLOAD(idsum + i),
+						   VLOAD(idsum2 + i)));
+	for (; i < idbytes; i++)
+		idsum[i] ^= idsum2[i];
+}
+
+static bool avx2_supported(void)
+{
+	return cpuid_is_supported()
+		&& cpuid_has_os_avx()
+		&& cpuid_has_ebxfeature7(CPUID_FEAT7_EBX_AVX2);
+}
+#endif /* INVBLOOM_AVX2 */
+
+/* Racing threads would all set this to the same thing. */
+static void (*subtract_cells)(s32 *, const s32 *, size_t,
+			      u8 *, const u8 *, size_t);
+
 void invbloom_subtract(struct invbloom *ib1, const struct invbloom *ib2)
 {
 	size_t i;
@@ -178,17 +350,30 @@ void invbloom_subtract(struct invbloom *ib1, const struct invbloom *ib2)
 	assert(ib1->n_elems == ib2->n_elems);
 	assert(ib1->id_size == ib2->id_size);
 	assert(ib1->salt == ib2->salt);
+	assert(ib1->num_hashes == ib2->num_hashes);
+
+	if (!subtract_cells) {
+#if INVBLOOM_AVX2
+		if (avx2_supported())
+			subtract_cells = avx2_subtract;
+		else
+#endif
+			subtract_cells = generic_subtract;
+	}
 
-	for (i = 0; i < ib1->n_elems; i++)
-		check_for_singleton(ib1, i, true);
+	if (ib1->singleton)
+		for (i = 0; i < ib1->n_elems; i++)
+			check_for_singleton(ib1, i, true);
 
-	for (i = 0; i < ib1->n_elems * ib1->id_size; i++)
-		ib1->idsum[i] ^= ib2->idsum[i];
+	subtract_cells(ib1->count, ib2->count, ib1->n_elems,
+		       ib1->idsum, ib2->idsum, ib1->n_elems * ib1->id_size);
+	/* The hashsums subtract just like the counts. */
+	subtract_cells((s32 *)ib1->hashsum, (const s32 *)ib2->hashsum,
+		       ib1->n_elems, NULL, NULL, 0);
 
-	for (i = 0; i < ib1->n_elems; i++) {
-		ib1->count[i] -= ib2->count[i];
-		check_for_singleton(ib1, i, false);
-	}
+	if (ib1->singleton)
+		for (i = 0; i < ib1->n_elems; i++)
+			check_for_singleton(ib1, i, false);
 }
 
 bool invbloom_empty(const struct invbloom *ib)
@@ -196,10 +381,286 @@ bool invbloom_empty(const struct invbloom *ib)
 	size_t i;
 
 	for (i = 0; i < ib->n_elems; i++) {
-		if (ib->count[i])
+		if (ib->count[i] || ib->hashsum[i])
 			return false;
 		if (!all_zero(idsum_ptr(ib, i), ib->id_size))
 			return false;
 	}
 	return true;
 }
+
+/*
+ * Wire format, all little-endian:
+ *	le32 magic, u8 version, u8 num_hashes, le16 0,
+ *	le32 id_size, le32 salt, le64 n_elems,
+ * then the cells, each group starting with a varint t (7 bits a byte,
+ * lowest first, top bit set if there's more):
+ *	t odd: t >> 1 empty cells (all zero).
+ *	t even: a cell whose count is zigzag encoded in t >> 1, then its
+ *		le32 hashsum and id_size bytes of idsum.
+ */
+#define WIRE_MAGIC	0x544c4249	/* "IBLT" */
+#define WIRE_VERSION	1
+#define WIRE_HDR_LEN	24
+#define WIRE_HASHSUM_LEN 4
+
+/* If p is NULL, just returns the length. */
+static size_t put_varint(u8 *p, u64 v)
+{
+	size_t len = 0;
+
+	do {
+		u8 byte = v & 0x7F;
+
+		v >>= 7;
+		if (v)
+			byte |= 0x80;
+		if (p)
+			p[len] = byte;
+		len++;
+	} while (v);
+	return len;
+}
+
+/* So small negative counts are small too. */
+static u64 zigzag(s32 v)
+{
+	return v < 0 ? ((u64)-(s64)v << 1) - 1 : (u64)v << 1;
+}
+
+static s64 unzigzag(u64 v)
+{
+	return v & 1 ? -(s64)((v + 1) >> 1) : (s64)(v >> 1);
+}
+
+static size_t encode_cells(const struct invbloom *ib, u8 *p)
+{
+	size_t i = 0, len = 0;
+
+	while (i < ib->n_elems) {
+		size_t run = 0;
+
+		while (i + run < ib->n_elems
+		       && ib->count[i + run] == 0
+		       && ib->hashsum[i + run] == 0
+		       && all_zero(idsum_ptr(ib, i + run), ib->id_size))
+			run++;
+		if (run) {
+			len += put_varint(p ? p + len : NULL,
+					  ((u64)run << 1) | 1);
+			i += run;
+			continue;
+		}
+
+		len += put_varint(p ? p + len : NULL, zigzag(ib->count[i]) << 1);
+		if (p) {
+			le32 l32 = cpu_to_le32(ib->hashsum[i]);
+
+			memcpy(p + len, &l32, WIRE_HASHSUM_LEN);
+			memcpy(p + len + WIRE_HASHSUM_LEN,
+			       idsum_ptr(ib, i), ib->id_size);
+		}
+		len += WIRE_HASHSUM_LEN + ib->id_size;
+		i++;
+	}
+	return len;
+}
+
+u8 *invbloom_serialize(const tal_t *ctx, const struct invbloom *ib)
+{
+	u8 *wire = tal_arr(ctx, u8, WIRE_HDR_LEN + encode_cells(ib, NULL));
+	le32 l32;
+	le64 l64;
+
+	if (!wire)
+		return NULL;
+
+	l32 = cpu_to_le32(WIRE_MAGIC);
+	memcpy(wire, &l32, 4);
+	wire[4] = WIRE_VERSION;
+	wire[5] = ib->num_hashes;
+	wire[6] = wire[7] = 0;
+	l32 = cpu_to_le32(ib->id_size);
+	memcpy(wire + 8, &l32, 4);
+	l32 = cpu_to_le32(ib->salt);
+	memcpy(wire + 12, &l32, 4);
+	l64 = cpu_to_le64(ib->n_elems);
+	memcpy(wire + 16, &l64, 8);
+
+	encode_cells(ib, wire + WIRE_HDR_LEN);
+	return wire;
+}
+
+enum decode_state {
+	DECODE_HEADER, DECODE_TAG, DECODE_IDSUM, DECODE_DONE, DECODE_BAD
+};
+
+struct invbloom_decoder {
+	size_t max_elems;
+	enum decode_state state;
+	/* The header, as it arrives. */
+	u8 hdr[WIRE_HDR_LEN];
+	/* How far into the header, or the current cell's hashsum and idsum. */
+	size_t off;
+	le32 hashsum;
+	/* The tag varint, as it arrives. */
+	u64 tag;
+	unsigned int shift;
+	/* The table, and the cell we're up to. */
+	struct invbloom *ib;
+	size_t cell;
+};
+
+struct invbloom_decoder *invbloom_decoder_new(const tal_t *ctx,
+					      size_t max_elems)
+{
+	struct invbloom_decoder *d = tal(ctx, struct invbloom_decoder);
+
+	if (d) {
+		d->max_elems = max_elems;
+		d->state = DECODE_HEADER;
+		d->off = 0;
+		d->tag = 0;
+		d->shift = 0;
+		d->ib = NULL;
+		d->cell = 0;
+	}
+	return d;
+}
+
+static bool decode_header(struct invbloom_decoder *d)
+{
+	u32 magic, id_size, salt;
+	u64 n_elems;
+	le32 l32;
+	le64 l64;
+
+	memcpy(&l32, d->hdr, 4);
+	magic = le32_to_cpu(l32);
+	memcpy(&l32, d->hdr + 8, 4);
+	id_size = le32_to_cpu(l32);
+	memcpy(&l32, d->hdr + 12, 4);
+	salt = le32_to_cpu(l32);
+	memcpy(&l64, d->hdr + 16, 8);
+	n_elems = le64_to_cpu(l64);
+
+	if (magic != WIRE_MAGIC || d->hdr[4] != WIRE_VERSION)
+		return false;
+	if (d->hdr[5] == 0 || d->hdr[5] > INVBLOOM_MAX_HASHES)
+		return false;
+	if (d->hdr[6] || d->hdr[7])
+		return false;
+	if (id_size == 0 || n_elems == 0 || n_elems > SIZE_MAX / id_size)
+		return false;
+	if (d->max_elems && n_elems > d->max_elems)
+		return false;
+
+	d->ib = invbloom_new_hashes_(d, id_size, n_elems, salt, d->hdr[5]);
+	return d->ib != NULL;
+}
+
+static bool decode_tag(struct invbloom_decoder *d)
+{
+	if (d->tag & 1) {
+		u64 run = d->tag >> 1;
+
+		/* The cells are already empty. */
+		if (run == 0 || run > d->ib->n_elems - d->cell)
+			return false;
+		d->cell += run;
+		d->state = d->cell == d->ib->n_elems ? DECODE_DONE : DECODE_TAG;
+	} else {
+		s64 count = unzigzag(d->tag >> 1);
+
+		if (count < INT32_MIN || count > INT32_MAX)
+			return false;
+		d->ib->count[d->cell] = count;
+		d->off = 0;
+		d->state = DECODE_IDSUM;
+	}
+	d->tag = 0;
+	d->shift = 0;
+	return true;
+}
+
+bool invbloom_decoder_feed(struct invbloom_decoder *d,
+			   const void *buf, size_t len)
+{
+	const u8 *p = buf, *end = p + len;
+	size_t n;
+
+	if (d->state == DECODE_BAD)
+		return false;
+
+	while (p < end) {
+		switch (d->state) {
+		case DECODE_HEADER:
+			n = WIRE_HDR_LEN - d->off;
+			if (n > (size_t)(end - p))
+				n = end - p;
+			memcpy(d->hdr + d->off, p, n);
+			d->off += n;
+			p += n;
+			if (d->off == WIRE_HDR_LEN) {
+				if (!decode_header(d))
+					goto bad;
+				d->state = DECODE_TAG;
+			}
+			break;
+		case DECODE_TAG:
+			/* Only one bit fits in the last byte. */
+			if (d->shift == 63 && (*p & 0x7E))
+				goto bad;
+			d->tag |= (u64)(*p & 0x7F) << d->shift;
+			d->shift += 7;
+			if (!(*p++ & 0x80)) {
+				if (!decode_tag(d))
+					goto bad;
+			} else if (d->shift > 63)
+				goto bad;
+			break;
+		case DECODE_IDSUM:
+			if (d->off < WIRE_HASHSUM_LEN) {
+				n = WIRE_HASHSUM_LEN - d->off;
+				if (n > (size_t)(end - p))
+					n = end - p;
+				memcpy((u8 *)&d->hashsum + d->off, p, n);
+			} else {
+				n = WIRE_HASHSUM_LEN + d->ib->id_size - d->off;
+				if (n > (size_t)(end - p))
+					n = end - p;
+				memcpy(idsum_ptr(d->ib, d->cell)
+				       + d->off - WIRE_HASHSUM_LEN, p, n);
+			}
+			d->off += n;
+			p += n;
+			if (d->off == WIRE_HASHSUM_LEN + d->ib->id_size) {
+				d->ib->hashsum[d->cell] = le32_to_cpu(d->hashsum);
+				d->cell++;
+				d->state = d->cell == d->ib->n_elems
+					? DECODE_DONE : DECODE_TAG;
+			}
+			break;
+		case DECODE_DONE:
+		case DECODE_BAD:
+			/* Trailing rubbish. */
+			goto bad;
+		}
+	}
+	return true;
+
+bad:
+	d->state = DECODE_BAD;
+	return false;
+}
+
+struct invbloom *invbloom_decoder_finish(const tal_t *ctx,
+					 struct invbloom_decoder *d)
+{
+	struct invbloom *ib = NULL;
+
+	if (d->state == DECODE_DONE)
+		ib = tal_steal(ctx, d->ib);
+	tal_free(d);
+	return ib;
+}
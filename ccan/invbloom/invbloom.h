@@ -9,8 +9,11 @@ struct invbloom {
 	size_t n_elems;
 	size_t id_size;
 	u32 salt;
+	unsigned int num_hashes;
+	size_t extract_pos;
 	s32 *count; /* [n_elems] */
 	u8 *idsum; /* [n_elems][id_size] */
+	u32 *hashsum; /* [n_elems] */
 	void (*singleton)(struct invbloom *ib, size_t elem, bool, void *);
 	void *singleton_data;
 };
@@ -30,6 +33,35 @@ struct invbloom *invbloom_new_(const tal_t *ctx,
 			       size_t id_size,
 			       size_t n_elems, u32 salt);
 
+/* The most hashes (cells per element) invbloom_new_hashes() allows. */
+#define INVBLOOM_MAX_HASHES 16
+
+/**
+ * invbloom_new_hashes - create a table with a given number of hashes
+ * @ctx: context to tal() from, or NULL.
+ * @type: type to place into the buckets (must not contain padding)
+ * @n_elems: number of entries in table
+ * @salt: 32 bit seed for table
+ * @num_hashes: cells each element goes in (1 to INVBLOOM_MAX_HASHES)
+ *
+ * invbloom_new() uses 3, which works well for most table sizes: 4 can
+ * decode a little more from very small tables.  Tables to be subtracted
+ * from each other need the same number.
+ *
+ * Example:
+ *	struct invbloom *ib = invbloom_new_hashes(NULL, u64, 1000, 0, 4);
+ *
+ *	if (!ib)
+ *		errx(1, "Out of memory");
+ */
+#define invbloom_new_hashes(ctx, type, n_elems, salt, num_hashes)	\
+	invbloom_new_hashes_((ctx), sizeof(type), (n_elems), (salt),	\
+			     (num_hashes))
+struct invbloom *invbloom_new_hashes_(const tal_t *ctx,
+				      size_t id_size,
+				      size_t n_elems, u32 salt,
+				      unsigned int num_hashes);
+
 /**
  * invbloom_singleton_cb - set callback for a singleton created/destroyed.
  * @ib: the invertable bloom lookup table.
@@ -78,6 +110,39 @@ void invbloom_insert(struct invbloom *ib, const void *elem);
  */
 void invbloom_delete(struct invbloom *ib, const void *elem);
 
+/**
+ * invbloom_insert_many - add an array of new elements
+ * @ib: the invertable bloom lookup table.
+ * @elems: the elements, one after another.
+ * @num: the number of elements.
+ *
+ * This is the same as calling invbloom_insert() on each in turn
+ * (including any singleton callbacks), but faster for large tables: the
+ * hashes of a batch of elements are computed first, so the memory for
+ * their cells can be fetched in parallel.
+ *
+ * Example:
+ *	u64 ids[100];
+ *
+ *	memset(ids, 0, sizeof(ids));
+ *	invbloom_insert_many(ib, ids, 100);
+ */
+void invbloom_insert_many(struct invbloom *ib, const void *elems, size_t num);
+
+/**
+ * invbloom_delete_many - remove an array of elements
+ * @ib: the invertable bloom lookup table.
+ * @elems: the elements, one after another.
+ * @num: the number of elements.
+ *
+ * This is the batched version of invbloom_delete(), and the inverse of
+ * invbloom_insert_many().
+ *
+ * Example:
+ *	invbloom_delete_many(ib, ids, 100);
+ */
+void invbloom_delete_many(struct invbloom *ib, const void *elems, size_t num);
+
 /**
  * invbloom_get - check if an element is (probably) in the table.
  * @ib: the invertable bloom lookup table.
@@ -142,4 +207,71 @@ void invbloom_subtract(struct invbloom *ib1, const struct invbloom *ib2);
  * deleted than inserted.
  */
 bool invbloom_empty(const struct invbloom *ib);
+
+/**
+ * invbloom_serialize - encode a table for sending to a peer.
+ * @ctx: the context to tal() the return value from.
+ * @ib: the invertable bloom lookup table.
+ *
+ * The encoding is portable, and compact: counts take a byte or so, and
+ * runs of empty cells take almost nothing.  Returns a tal array (use
+ * tal_count() for its length), or NULL if out of memory.  The singleton
+ * callback is not included.
+ *
+ * Example:
+ *	u8 *wire = invbloom_serialize(NULL, ib);
+ *
+ *	printf("Sending %zu bytes\n", tal_count(wire));
+ */
+u8 *invbloom_serialize(const tal_t *ctx, const struct invbloom *ib);
+
+struct invbloom_decoder;
+
+/**
+ * invbloom_decoder_new - start decoding a table from invbloom_serialize()
+ * @ctx: the context to tal() the decoder from.
+ * @max_elems: the most cells to accept (0 for no limit).
+ *
+ * The encoded table can be fed in as it arrives, in pieces of any size.
+ * Since the table is allocated as soon as its header is seen, set
+ * @max_elems if the input isn't trusted.  Returns NULL if out of memory.
+ *
+ * Example:
+ *	struct invbloom_decoder *d = invbloom_decoder_new(NULL, 1000000);
+ *
+ *	if (!d)
+ *		errx(1, "Out of memory");
+ */
+struct invbloom_decoder *invbloom_decoder_new(const tal_t *ctx,
+					      size_t max_elems);
+
+/**
+ * invbloom_decoder_feed - decode the next part of an encoded table
+ * @d: the decoder.
+ * @buf: the bytes.
+ * @len: the number of bytes.
+ *
+ * Returns false if the input is malformed, goes past the end of the
+ * table, or asks for a table too large (or we ran out of memory).
+ * Further calls will fail too.
+ *
+ * Example:
+ *	if (!invbloom_decoder_feed(d, wire, tal_count(wire)))
+ *		printf("Bad table from peer\n");
+ */
+bool invbloom_decoder_feed(struct invbloom_decoder *d,
+			   const void *buf, size_t len);
+
+/**
+ * invbloom_decoder_finish - get the decoded table
+ * @ctx: the context to tal() the table from.
+ * @d: the decoder, which is freed.
+ *
+ * Returns NULL if the table wasn't fed completely, or was malformed.
+ *
+ * Example:
+ *	ib = invbloom_decoder_finish(NULL, d);
+ */
+struct invbloom *invbloom_decoder_finish(const tal_t *ctx,
+					 struct invbloom_decoder *d);
 #endif /* CCAN_INVBLOOM_H */
@@ -0,0 +1,180 @@
+#include <ccan/invbloom/invbloom.h>
+/* Include the C files directly. */
+#include <ccan/invbloom/invbloom.c>
+#include <ccan/tap/tap.h>
+
+struct id {
+	u8 bytes[20];
+};
+
+#define NUM_IDS 5000
+#define MAX_CALLS (NUM_IDS * INVBLOOM_MAX_HASHES * 2)
+
+/* Record of singleton callbacks. */
+struct calls {
+	size_t num;
+	size_t bucket[MAX_CALLS];
+	bool before[MAX_CALLS];
+};
+
+static void record_cb(struct invbloom *ib, size_t n, bool before,
+		      struct calls *calls)
+{
+	if (calls->num < MAX_CALLS) {
+		calls->bucket[calls->num] = n;
+		calls->before[calls->num] = before;
+	}
+	calls->num++;
+}
+
+static bool same_table(const struct invbloom *a, const struct invbloom *b)
+{
+	return a->n_elems == b->n_elems
+		&& memcmp(a->count, b->count,
+			  a->n_elems * sizeof(a->count[0])) == 0
+		&& memcmp(a->idsum, b->idsum, a->n_elems * a->id_size) == 0
+		&& memcmp(a->hashsum, b->hashsum,
+			  a->n_elems * sizeof(a->hashsum[0])) == 0;
+}
+
+static struct calls calls1, calls2;
+
+int main(void)
+{
+	const tal_t *ctx = tal(NULL, char);
+	struct invbloom *ib1, *ib2;
+	struct id *ids = tal_arr(ctx, struct id, NUM_IDS), *id;
+	s32 *c1, *c2;
+	u8 *s1, *s2;
+	unsigned int h, bad, i, n, neg;
+	bool progress;
+	int simd;
+
+	/* This is how many tests you plan to run */
+	plan_tests(INVBLOOM_MAX_HASHES * 3 + 8);
+
+	for (i = 0; i < NUM_IDS; i++) {
+		memset(ids[i].bytes, i, sizeof(ids[i].bytes));
+		memcpy(ids[i].bytes, &i, sizeof(i));
+	}
+
+	/* Batched is exactly the same as one at a time, callbacks and all. */
+	for (h = 1; h <= INVBLOOM_MAX_HASHES; h++) {
+		ib1 = invbloom_new_hashes(ctx, struct id, 1000 + h, h, h);
+		ib2 = invbloom_new_hashes(ctx, struct id, 1000 + h, h, h);
+		invbloom_singleton_cb(ib1, record_cb, &calls1);
+		invbloom_singleton_cb(ib2, record_cb, &calls2);
+		calls1.num = calls2.num = 0;
+
+		invbloom_insert_many(ib1, ids, NUM_IDS);
+		for (i = 0; i < NUM_IDS; i++)
+			invbloom_insert(ib2, &ids[i]);
+		ok1(same_table(ib1, ib2));
+
+		invbloom_delete_many(ib1, ids + 7, NUM_IDS - 7);
+		for (i = 7; i < NUM_IDS; i++)
+			invbloom_delete(ib2, &ids[i]);
+		ok1(same_table(ib1, ib2));
+		ok1(calls1.num == calls2.num && calls1.num <= MAX_CALLS
+		    && memcmp(calls1.bucket, calls2.bucket,
+			      calls1.num * sizeof(calls1.bucket[0])) == 0
+		    && memcmp(calls1.before, calls2.before,
+			      calls1.num * sizeof(calls1.before[0])) == 0);
+		tal_free(ib1);
+		tal_free(ib2);
+	}
+
+	/* The seven left can be extracted, with more hashes too. */
+	ib1 = invbloom_new_hashes(ctx, struct id, 100, 0, 5);
+	invbloom_insert_many(ib1, ids, NUM_IDS);
+	invbloom_delete_many(ib1, ids + 7, NUM_IDS - 7);
+	for (n = 0; (id = invbloom_extract(ctx, ib1)) != NULL; n++)
+		tal_free(id);
+	ok1(n == 7);
+	ok1(invbloom_empty(ib1));
+
+	/* Both subtract kernels give the right answer, at awkward sizes. */
+	for (simd = 0; simd < 2; simd++) {
+		for (bad = 0, n = 1; n < 70; n++) {
+			size_t j, idbytes = n * 3;
+
+			c1 = tal_arr(ctx, s32, n);
+			c2 = tal_arr(ctx, s32, n);
+			s1 = tal_arr(ctx, u8, idbytes);
+			s2 = tal_arr(ctx, u8, idbytes);
+			for (j = 0; j < n; j++) {
+				c1[j] = j * 7 - 100;
+				c2[j] = j * 3 + 1;
+			}
+			for (j = 0; j < idbytes; j++) {
+				s1[j] = j * 13;
+				s2[j] = j * 5 + 7;
+			}
+#if INVBLOOM_AVX2
+			if (simd && avx2_supported())
+				avx2_subtract(c1, c2, n, s1, s2, idbytes);
+			else
+#endif
+				generic_subtract(c1, c2, n, s1, s2, idbytes);
+			for (j = 0; j < n; j++)
+				bad += (c1[j] != (s32)(j * 7 - 100 - (j * 3 + 1)));
+			for (j = 0; j < idbytes; j++)
+				bad += (s1[j] != (u8)((u8)(j * 13) ^ (u8)(j * 5 + 7)));
+			tal_free(c1);
+			tal_free(c2);
+			tal_free(s1);
+			tal_free(s2);
+		}
+		ok1(bad == 0);
+	}
+
+	/* Subtracting sets which differ leaves only the differences. */
+	ib1 = invbloom_new_hashes(ctx, struct id, 1000, 1, 4);
+	ib2 = invbloom_new_hashes(ctx, struct id, 1000, 1, 4);
+	invbloom_insert_many(ib1, ids, NUM_IDS - 5);
+	invbloom_insert_many(ib2, ids + 10, NUM_IDS - 10);
+	invbloom_subtract(ib1, ib2);
+	/* Peeling one side can free up the other, so alternate. */
+	bad = n = neg = 0;
+	do {
+		progress = false;
+		while ((id = invbloom_extract(ctx, ib1)) != NULL) {
+			memcpy(&i, id->bytes, sizeof(i));
+			bad += (i >= 10);
+			n++;
+			progress = true;
+			tal_free(id);
+		}
+		while ((id = invbloom_extract_negative(ctx, ib1)) != NULL) {
+			memcpy(&i, id->bytes, sizeof(i));
+			bad += (i < NUM_IDS - 5);
+			neg++;
+			progress = true;
+			tal_free(id);
+		}
+	} while (progress);
+	ok1(n == 10 && neg == 5 && bad == 0);
+	ok1(invbloom_empty(ib1));
+
+	/* An id in a cell twice doesn't make another look pure there. */
+	ib1 = invbloom_new(ctx, struct id, 50, 0);
+	ib2 = invbloom_new(ctx, struct id, 50, 0);
+	for (i = 0; hash_bucket(ib1, &ids[i], 0) != hash_bucket(ib1, &ids[i], 1);
+	     i++);
+	for (n = i + 1;
+	     hash_bucket(ib1, &ids[n], 0) != hash_bucket(ib1, &ids[i], 0);
+	     n++);
+	invbloom_insert(ib1, &ids[i]);
+	invbloom_insert(ib2, &ids[n]);
+	invbloom_subtract(ib1, ib2);
+	ok1(ib1->count[hash_bucket(ib1, &ids[i], 0)] == 1
+	    && !pure(ib1, hash_bucket(ib1, &ids[i], 0), 1));
+
+	ok1(invbloom_new_hashes(ctx, int, 1, 0, 4)->num_hashes == 4
+	    && invbloom_new(ctx, int, 1, 0)->num_hashes == NUM_HASHES);
+
+	tal_free(ctx);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
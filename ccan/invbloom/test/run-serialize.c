@@ -0,0 +1,123 @@
+#include <ccan/invbloom/invbloom.h>
+/* Include the C files directly. */
+#include <ccan/invbloom/invbloom.c>
+#include <ccan/tap/tap.h>
+
+static bool same_table(const struct invbloom *a, const struct invbloom *b)
+{
+	return a->n_elems == b->n_elems
+		&& a->id_size == b->id_size
+		&& a->salt == b->salt
+		&& a->num_hashes == b->num_hashes
+		&& memcmp(a->count, b->count,
+			  a->n_elems * sizeof(a->count[0])) == 0
+		&& memcmp(a->idsum, b->idsum, a->n_elems * a->id_size) == 0
+		&& memcmp(a->hashsum, b->hashsum,
+			  a->n_elems * sizeof(a->hashsum[0])) == 0;
+}
+
+/* Feed it in pieces of @piece bytes. */
+static struct invbloom *decode(const tal_t *ctx, const u8 *wire, size_t len,
+			       size_t piece, size_t max_elems)
+{
+	struct invbloom_decoder *d = invbloom_decoder_new(ctx, max_elems);
+	size_t off;
+
+	for (off = 0; off < len; off += piece) {
+		size_t n = len - off < piece ? len - off : piece;
+
+		if (!invbloom_decoder_feed(d, wire + off, n))
+			break;
+	}
+	return invbloom_decoder_finish(ctx, d);
+}
+
+int main(void)
+{
+	const tal_t *ctx = tal(NULL, char);
+	struct invbloom *ib, *ib2;
+	struct invbloom_decoder *d;
+	u64 ids[300];
+	u8 *wire;
+	size_t i, len, bad;
+
+	/* This is how many tests you plan to run */
+	plan_tests(17);
+
+	for (i = 0; i < 300; i++)
+		ids[i] = i * 0x9E3779B97F4A7C15ULL;
+
+	/* A mostly empty table is tiny. */
+	ib = invbloom_new_hashes(ctx, u64, 1000, 7, 4);
+	invbloom_insert_many(ib, ids, 3);
+	wire = invbloom_serialize(ctx, ib);
+	len = tal_count(wire);
+	ok1(len <= 24 + 12 * (1 + 4 + sizeof(u64)) + 13 * 2);
+	ib2 = decode(ctx, wire, len, len, 0);
+	ok1(ib2 && same_table(ib, ib2));
+
+	/* A full one, with negative counts too, in pieces of any size. */
+	invbloom_insert_many(ib, ids, 300);
+	invbloom_delete_many(ib, ids + 100, 200);
+	invbloom_delete_many(ib, ids + 150, 100);
+	wire = invbloom_serialize(ctx, ib);
+	len = tal_count(wire);
+	for (bad = 0, i = 1; i < 50; i++) {
+		ib2 = decode(ctx, wire, len, i, 1000);
+		if (!ib2 || !same_table(ib, ib2))
+			bad++;
+		tal_free(ib2);
+	}
+	ok1(bad == 0);
+
+	/* It's all there: nothing less will do. */
+	for (bad = 0, i = 0; i < len; i++) {
+		ib2 = decode(ctx, wire, i, 7, 0);
+		if (ib2)
+			bad++;
+	}
+	ok1(bad == 0);
+
+	/* Nor anything more. */
+	d = invbloom_decoder_new(ctx, 0);
+	ok1(invbloom_decoder_feed(d, wire, len));
+	ok1(!invbloom_decoder_feed(d, wire, 1));
+	ok1(!invbloom_decoder_feed(d, wire, 0));
+	ok1(invbloom_decoder_finish(ctx, d) == NULL);
+
+	/* Too big for the limit. */
+	ok1(decode(ctx, wire, len, len, 999) == NULL);
+
+	/* Bad headers. */
+	wire[0] ^= 1;
+	ok1(decode(ctx, wire, len, len, 0) == NULL);
+	wire[0] ^= 1;
+	wire[4] = 2;
+	ok1(decode(ctx, wire, len, len, 0) == NULL);
+	wire[4] = 1;
+	wire[5] = 0;
+	ok1(decode(ctx, wire, len, len, 0) == NULL);
+	wire[5] = INVBLOOM_MAX_HASHES + 1;
+	ok1(decode(ctx, wire, len, len, 0) == NULL);
+	wire[5] = 4;
+	ok1(decode(ctx, wire, len, len, 0) != NULL);
+
+	/* A run of empty cells which goes past the end. */
+	ib = invbloom_new(ctx, u64, 10, 0);
+	wire = invbloom_serialize(ctx, ib);
+	ok1(tal_count(wire) == 25 && wire[24] == (10 << 1 | 1));
+	wire[24] = 11 << 1 | 1;
+	ok1(decode(ctx, wire, 25, 25, 0) == NULL);
+
+	/* And an overlong varint. */
+	wire = tal_arr(ctx, u8, 24 + 11);
+	memcpy(wire, invbloom_serialize(ctx, ib), 24);
+	memset(wire + 24, 0x80, 10);
+	wire[34] = 0x01;
+	ok1(decode(ctx, wire, 35, 1, 0) == NULL);
+
+	tal_free(ctx);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,141 @@
+/*
+ * Speed tests for reconciling two large sets with invbloom.
+ *
+ * Two "mempools" of 32-byte ids share all but a few: each side builds a
+ * table sized for the difference, one is sent (encoded and decoded) to
+ * the other, which subtracts and then extracts the differences.
+ *
+ * Usage: speed [ids]  (1 million by default)
+ */
+/* Include the C files directly, to time both subtract kernels. */
+#include <ccan/invbloom/invbloom.c>
+#include <ccan/time/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct txid {
+	u8 bytes[32];
+};
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+static void make_id(struct txid *id, size_t i)
+{
+	u32 seed = i, h;
+	size_t j;
+
+	for (j = 0; j < sizeof(id->bytes); j += sizeof(h)) {
+		h = hash_u32(&seed, 1, j);
+		memcpy(id->bytes + j, &h, sizeof(h));
+	}
+}
+
+/* Extract everything, both ways, until neither makes progress. */
+static size_t peel(struct invbloom *ib)
+{
+	size_t n = 0;
+	bool progress;
+	void *id;
+
+	do {
+		progress = false;
+		while ((id = invbloom_extract(NULL, ib)) != NULL) {
+			tal_free(id);
+			n++;
+			progress = true;
+		}
+		while ((id = invbloom_extract_negative(NULL, ib)) != NULL) {
+			tal_free(id);
+			n++;
+			progress = true;
+		}
+	} while (progress);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t diffs[] = { 10, 100, 1000, 10000 };
+	size_t num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	size_t i, d, n, cells, found;
+	struct txid *ids;
+	struct invbloom *a, *b, *b2;
+	struct invbloom_decoder *dec;
+	u8 *wire;
+
+	ids = tal_arr(NULL, struct txid, num + diffs[3]);
+	for (i = 0; i < num + diffs[3]; i++)
+		make_id(&ids[i], i);
+
+	/* Building, in a table big enough not to fit in cache. */
+	cells = 1000000;
+	a = invbloom_new(NULL, struct txid, cells, 0);
+	TIME("invbloom_insert (1M cells)", num,
+	     for (i = 0; i < num; i++) invbloom_insert(a, &ids[i]));
+	TIME("invbloom_insert_many (1M cells)", num,
+	     invbloom_insert_many(a, ids, num));
+	b = invbloom_new(NULL, struct txid, cells, 1);
+	invbloom_insert_many(b, ids, num);
+
+	TIME("invbloom_subtract generic (1M cells)", 1,
+	     generic_subtract(a->count, b->count, cells,
+			      a->idsum, b->idsum, cells * a->id_size));
+#if INVBLOOM_AVX2
+	if (avx2_supported())
+		TIME("invbloom_subtract avx2 (1M cells)", 1,
+		     avx2_subtract(a->count, b->count, cells,
+				   a->idsum, b->idsum, cells * a->id_size));
+#endif
+	tal_free(a);
+	tal_free(b);
+
+	for (d = 0; d < sizeof(diffs) / sizeof(diffs[0]); d++) {
+		/* Twice as many cells as differences decodes reliably. */
+		cells = diffs[d] * 2 + 30;
+		printf("%zu ids, %zu different, %zu cells:\n",
+		       num, diffs[d], cells);
+		a = invbloom_new(NULL, struct txid, cells, 0);
+		b = invbloom_new(NULL, struct txid, cells, 0);
+
+		/* b has the last diffs[d] / 2 a doesn't, and vice versa. */
+		TIME("  build one table", 1,
+		     invbloom_insert_many(a, ids, num));
+		invbloom_insert_many(b, ids + diffs[d] / 2, num);
+
+		TIME("  encode", 1, wire = invbloom_serialize(NULL, b));
+		printf("  (%zu bytes)\n", tal_count(wire));
+		TIME("  decode", 1,
+		     dec = invbloom_decoder_new(NULL, 0);
+		     invbloom_decoder_feed(dec, wire, tal_count(wire));
+		     b2 = invbloom_decoder_finish(NULL, dec));
+		TIME("  subtract", 1, invbloom_subtract(a, b2));
+		TIME("  extract differences", 1, found = peel(a));
+		n = diffs[d] / 2 * 2;
+		printf("  (found %zu of %zu%s)\n", found, n,
+		       invbloom_empty(a) ? "" : ", table not empty!");
+
+		tal_free(wire);
+		tal_free(a);
+		tal_free(b);
+		tal_free(b2);
+	}
+	tal_free(ids);
+	return 0;
+}
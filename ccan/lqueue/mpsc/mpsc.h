@@ -0,0 +1,289 @@
+/* Licensed under BSD-MIT - see LICENSE file for details */
+#ifndef CCAN_LQUEUE_MPSC_H
+#define CCAN_LQUEUE_MPSC_H
+#include "config.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sched.h>
+
+#include <ccan/tcon/tcon.h>
+
+/**
+ * struct lqueue_mpsc_link - a queue link
+ * @next: next entry towards the back, or NULL if this is the back
+ *
+ * This is used as a link within a queue entry.
+ *
+ * Example:
+ *	struct job {
+ *		int num;
+ *		struct lqueue_mpsc_link ql;
+ *	};
+ */
+struct lqueue_mpsc_link {
+	_Atomic(struct lqueue_mpsc_link *) next;
+};
+
+/**
+ * struct lqueue_mpsc_ - a multi-producer queue (internal type)
+ * @back: the last entry added (producers swap themselves in here)
+ * @front: the next entry to remove (only the consumer touches this)
+ * @stub: dummy entries, so the queue is never really empty
+ * @cur: which stub dequeues put back
+ *
+ * This is Dmitry Vyukov's intrusive MPSC queue: adding is one atomic
+ * exchange and a store, removing needs no atomic read-modify-write at
+ * all.  It contains pointers to itself, so it can't be copied or moved
+ * once initialized.
+ */
+struct lqueue_mpsc_ {
+	_Atomic(struct lqueue_mpsc_link *) back;
+	struct lqueue_mpsc_link *front;
+	struct lqueue_mpsc_link stub[2];
+	unsigned int cur;
+};
+
+/**
+ * LQUEUE_MPSC - declare a multi-producer, single-consumer queue
+ * @type: the type of elements in the queue
+ * @link: the field containing the lqueue_mpsc_link in @type
+ *
+ * Any number of threads can lqueue_mpsc_enqueue() at once, but only one
+ * thread at a time may remove entries.  You must call lqueue_mpsc_init()
+ * before using it.
+ *
+ * Example:
+ *	LQUEUE_MPSC(struct job, ql) jobs;
+ */
+#define LQUEUE_MPSC(etype, link)					\
+	TCON_WRAP(struct lqueue_mpsc_,					\
+		  TCON_CONTAINER(canary, etype, link))
+
+/**
+ * lqueue_mpsc_entry - convert an lqueue_mpsc_link back into its structure.
+ * @q: the queue
+ * @l: the lqueue_mpsc_link
+ */
+#define lqueue_mpsc_entry(q_, l_) tcon_container_of((q_), canary, (l_))
+
+/**
+ * lqueue_mpsc_init - initialize a queue
+ * @q: the queue to set to an empty queue
+ *
+ * Example:
+ *	static void setup(void)
+ *	{
+ *		lqueue_mpsc_init(&jobs);
+ *	}
+ */
+#define lqueue_mpsc_init(q_) \
+	lqueue_mpsc_init_(tcon_unwrap(q_))
+static inline void lqueue_mpsc_init_(struct lqueue_mpsc_ *q)
+{
+	atomic_init(&q->stub[0].next, NULL);
+	atomic_init(&q->stub[1].next, NULL);
+	q->cur = 0;
+	atomic_init(&q->back, &q->stub[0]);
+	q->front = &q->stub[0];
+}
+
+static inline bool lqueue_mpsc_is_stub_(const struct lqueue_mpsc_ *q,
+					const struct lqueue_mpsc_link *l)
+{
+	return l == &q->stub[0] || l == &q->stub[1];
+}
+
+/**
+ * lqueue_mpsc_empty - is a queue empty?
+ * @q: the queue
+ *
+ * If the queue is empty, returns true.  Only the consumer should ask:
+ * to anyone else, the answer may be out of date before they get it.
+ */
+#define lqueue_mpsc_empty(q_) \
+	lqueue_mpsc_empty_(tcon_unwrap(q_))
+static inline bool lqueue_mpsc_empty_(const struct lqueue_mpsc_ *q)
+{
+	return lqueue_mpsc_is_stub_(q, q->front)
+		&& atomic_load_explicit(&q->back, memory_order_acquire)
+		== q->front;
+}
+
+/**
+ * lqueue_mpsc_enqueue - add an entry to the back of a queue
+ * @q: the queue to add the node to
+ * @e: the item to enqueue
+ *
+ * This is safe to call from any number of threads at once.  The
+ * lqueue_mpsc_link does not need to be initialized; it will be
+ * overwritten.
+ *
+ * Example:
+ *	static void add_job(struct job *job)
+ *	{
+ *		lqueue_mpsc_enqueue(&jobs, job);
+ *	}
+ */
+#define lqueue_mpsc_enqueue(q_, e_)					\
+	lqueue_mpsc_enqueue_(tcon_unwrap(q_), tcon_member_of((q_), canary, (e_)))
+static inline void lqueue_mpsc_enqueue_(struct lqueue_mpsc_ *q,
+					struct lqueue_mpsc_link *e)
+{
+	struct lqueue_mpsc_link *prev;
+
+	atomic_store_explicit(&e->next, NULL, memory_order_relaxed);
+	prev = atomic_exchange_explicit(&q->back, e, memory_order_acq_rel);
+	/* Until this store, the consumer can't see past prev. */
+	atomic_store_explicit(&prev->next, e, memory_order_release);
+}
+
+/**
+ * lqueue_mpsc_dequeue - remove and return the entry from the front
+ * @q: the queue
+ *
+ * Only one thread at a time may call this (or lqueue_mpsc_drain()).
+ *
+ * Returns NULL if the queue is empty.  It can also return NULL if a
+ * producer is half-way through adding an entry (it has swapped itself in
+ * at the back, but not yet linked on to the entry before it): this never
+ * waits for it.  Try again later.
+ *
+ * Example:
+ *	static void run_jobs(void)
+ *	{
+ *		struct job *job;
+ *
+ *		while ((job = lqueue_mpsc_dequeue(&jobs)) != NULL)
+ *			printf("Job %i\n", job->num);
+ *	}
+ */
+#define lqueue_mpsc_dequeue(q_) \
+	lqueue_mpsc_entry((q_), lqueue_mpsc_dequeue_(tcon_unwrap(q_)))
+static inline struct lqueue_mpsc_link *
+lqueue_mpsc_dequeue_(struct lqueue_mpsc_ *q)
+{
+	struct lqueue_mpsc_link *front = q->front, *next;
+
+	next = atomic_load_explicit(&front->next, memory_order_acquire);
+	if (lqueue_mpsc_is_stub_(q, front)) {
+		if (!next)
+			return NULL;
+		q->front = front = next;
+		next = atomic_load_explicit(&front->next, memory_order_acquire);
+	}
+	if (next) {
+		q->front = next;
+		return front;
+	}
+
+	/* This is the last one: put the stub behind it, so the queue
+	 * is never left with nothing in it. */
+	if (atomic_load_explicit(&q->back, memory_order_acquire) != front)
+		return NULL;
+	lqueue_mpsc_enqueue_(q, &q->stub[q->cur]);
+	next = atomic_load_explicit(&front->next, memory_order_acquire);
+	if (next) {
+		q->front = next;
+		return front;
+	}
+	return NULL;
+}
+
+static inline struct lqueue_mpsc_link *
+lqueue_mpsc_wait_next_(struct lqueue_mpsc_link *l)
+{
+	struct lqueue_mpsc_link *next;
+	unsigned int spins = 0;
+
+	while (!(next = atomic_load_explicit(&l->next, memory_order_acquire)))
+		if (++spins % 128 == 0)
+			sched_yield();
+	return next;
+}
+
+/**
+ * lqueue_mpsc_drain - remove every entry from a queue at once
+ * @q: the queue
+ *
+ * This takes everything producers have added so far with one atomic
+ * exchange, and returns the first entry, or NULL if the queue is empty.
+ * Walk the rest, in order, with lqueue_mpsc_next().  Producers can carry
+ * on adding to the (now empty) queue meanwhile.
+ *
+ * If a producer is half-way through adding an entry we took, this waits
+ * for it to finish linking it in, so nothing is lost.
+ *
+ * Only one thread at a time may call this (or lqueue_mpsc_dequeue()).
+ *
+ * Example:
+ *	static void run_all_jobs(void)
+ *	{
+ *		struct job *job, *next;
+ *
+ *		for (job = lqueue_mpsc_drain(&jobs); job; job = next) {
+ *			next = lqueue_mpsc_next(&jobs, job);
+ *			printf("Job %i\n", job->num);
+ *		}
+ *	}
+ */
+#define lqueue_mpsc_drain(q_) \
+	lqueue_mpsc_entry((q_), lqueue_mpsc_drain_(tcon_unwrap(q_)))
+static inline struct lqueue_mpsc_link *
+lqueue_mpsc_drain_(struct lqueue_mpsc_ *q)
+{
+	struct lqueue_mpsc_link *stub, *back, *l, *first = NULL, *prev = NULL;
+	struct lqueue_mpsc_link *next = NULL;
+
+	if (lqueue_mpsc_empty_(q))
+		return NULL;
+
+	/*
+	 * The stub we hand producers can't be the one which may be in the
+	 * entries we're taking: its link is still needed.  So swap stubs.
+	 */
+	stub = &q->stub[!q->cur];
+	atomic_store_explicit(&stub->next, NULL, memory_order_relaxed);
+	back = atomic_exchange_explicit(&q->back, stub, memory_order_acq_rel);
+	l = q->front;
+	q->front = stub;
+	q->cur = !q->cur;
+
+	/* Everything from the old front to back is ours: link it into a
+	 * plain list, leaving out the old stub. */
+	for (;;) {
+		if (l != back)
+			next = lqueue_mpsc_wait_next_(l);
+		if (!lqueue_mpsc_is_stub_(q, l)) {
+			if (prev)
+				atomic_store_explicit(&prev->next, l,
+						      memory_order_relaxed);
+			else
+				first = l;
+			prev = l;
+		}
+		if (l == back)
+			break;
+		l = next;
+	}
+	if (prev)
+		atomic_store_explicit(&prev->next, NULL, memory_order_relaxed);
+	return first;
+}
+
+/**
+ * lqueue_mpsc_next - the entry after one returned by lqueue_mpsc_drain()
+ * @q: the queue it was drained from
+ * @e: the entry
+ *
+ * Returns NULL after the last one.  Once an entry has been enqueued
+ * again, its link belongs to the queue: so get the next entry first.
+ */
+#define lqueue_mpsc_next(q_, e_)					\
+	lqueue_mpsc_entry((q_),						\
+			  lqueue_mpsc_next_(tcon_member_of((q_), canary, (e_))))
+static inline struct lqueue_mpsc_link *
+lqueue_mpsc_next_(struct lqueue_mpsc_link *e)
+{
+	return atomic_load_explicit(&e->next, memory_order_relaxed);
+}
+#endif /* CCAN_LQUEUE_MPSC_H */
@@ -0,0 +1,65 @@
+#include "config.h"
+
+#include <ccan/lqueue/mpsc/mpsc.h>
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+
+#define PRODUCERS 8
+#define NUM 20000
+
+struct msg {
+	unsigned int from, num;
+	struct lqueue_mpsc_link ql;
+};
+
+static LQUEUE_MPSC(struct msg, ql) q;
+static struct msg msgs[PRODUCERS][NUM];
+
+static void *producer(void *arg)
+{
+	size_t t = (size_t)arg, i;
+
+	for (i = 0; i < NUM; i++) {
+		msgs[t][i].from = t;
+		msgs[t][i].num = i;
+		lqueue_mpsc_enqueue(&q, &msgs[t][i]);
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[PRODUCERS];
+	unsigned int expect[PRODUCERS] = { 0 }, bad = 0, got = 0, drains = 0;
+	struct msg *m, *next;
+	size_t i;
+
+	plan_tests(3);
+	lqueue_mpsc_init(&q);
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_create(&threads[i], NULL, producer, (void *)i);
+
+	/* Every message arrives once, and each producer's in order. */
+	while (got < PRODUCERS * NUM) {
+		if (got % 7 == 0) {
+			for (m = lqueue_mpsc_drain(&q); m; m = next) {
+				next = lqueue_mpsc_next(&q, m);
+				if (m->num != expect[m->from]++)
+					bad++;
+				got++;
+			}
+			drains++;
+		} else if ((m = lqueue_mpsc_dequeue(&q)) != NULL) {
+			if (m->num != expect[m->from]++)
+				bad++;
+			got++;
+		}
+	}
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_join(threads[i], NULL);
+	ok1(bad == 0);
+	ok1(got == PRODUCERS * NUM && lqueue_mpsc_empty(&q));
+	ok1(drains > 0);
+
+	return exit_status();
+}
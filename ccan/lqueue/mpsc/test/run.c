@@ -0,0 +1,78 @@
+#include "config.h"
+
+#include <ccan/lqueue/mpsc/mpsc.h>
+#include <ccan/tap/tap.h>
+
+struct waiter {
+	const char *name;
+	struct lqueue_mpsc_link ql;
+};
+
+int main(void)
+{
+	LQUEUE_MPSC(struct waiter, ql) q;
+	struct waiter a = { "Alice" };
+	struct waiter b = { "Bob" };
+	struct waiter c = { "Carol" };
+	struct waiter *waiter, *next;
+
+	/* This is how many tests you plan to run */
+	plan_tests(25);
+
+	lqueue_mpsc_init(&q);
+	ok1(lqueue_mpsc_empty(&q));
+	ok1(lqueue_mpsc_dequeue(&q) == NULL);
+	ok1(lqueue_mpsc_drain(&q) == NULL);
+
+	lqueue_mpsc_enqueue(&q, &a);
+	ok1(!lqueue_mpsc_empty(&q));
+	lqueue_mpsc_enqueue(&q, &b);
+	lqueue_mpsc_enqueue(&q, &c);
+
+	ok1(lqueue_mpsc_dequeue(&q) == &a);
+	ok1(lqueue_mpsc_dequeue(&q) == &b);
+	ok1(!lqueue_mpsc_empty(&q));
+	ok1(lqueue_mpsc_dequeue(&q) == &c);
+	ok1(lqueue_mpsc_empty(&q));
+	ok1(lqueue_mpsc_dequeue(&q) == NULL);
+
+	/* The last dequeue left the stub at the back: drain skips it. */
+	lqueue_mpsc_enqueue(&q, &a);
+	lqueue_mpsc_enqueue(&q, &b);
+	waiter = lqueue_mpsc_drain(&q);
+	ok1(waiter == &a);
+	next = lqueue_mpsc_next(&q, waiter);
+	ok1(next == &b);
+	ok1(lqueue_mpsc_next(&q, next) == NULL);
+	ok1(lqueue_mpsc_empty(&q));
+	ok1(lqueue_mpsc_drain(&q) == NULL);
+
+	/* Drain with the stub in front, after the other stub, and mixed
+	 * with dequeues. */
+	lqueue_mpsc_enqueue(&q, &c);
+	lqueue_mpsc_enqueue(&q, &a);
+	waiter = lqueue_mpsc_drain(&q);
+	ok1(waiter == &c && lqueue_mpsc_next(&q, waiter) == &a);
+	ok1(lqueue_mpsc_next(&q, &a) == NULL);
+
+	lqueue_mpsc_enqueue(&q, &b);
+	ok1(lqueue_mpsc_dequeue(&q) == &b);
+	lqueue_mpsc_enqueue(&q, &a);
+	lqueue_mpsc_enqueue(&q, &c);
+	waiter = lqueue_mpsc_drain(&q);
+	ok1(waiter == &a && lqueue_mpsc_next(&q, waiter) == &c);
+	ok1(lqueue_mpsc_next(&q, &c) == NULL);
+
+	/* Drain a single entry, then dequeue again. */
+	lqueue_mpsc_enqueue(&q, &b);
+	ok1(lqueue_mpsc_drain(&q) == &b && lqueue_mpsc_next(&q, &b) == NULL);
+	lqueue_mpsc_enqueue(&q, &a);
+	lqueue_mpsc_enqueue(&q, &c);
+	ok1(lqueue_mpsc_dequeue(&q) == &a);
+	ok1(lqueue_mpsc_dequeue(&q) == &c);
+	ok1(lqueue_mpsc_dequeue(&q) == NULL);
+	ok1(lqueue_mpsc_empty(&q));
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
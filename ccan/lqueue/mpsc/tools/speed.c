@@ -0,0 +1,112 @@
+/*
+ * Multi-threaded speed test: lqueue/mpsc against an lqueue behind a
+ * pthread mutex.
+ *
+ * Producer threads each send a fixed number of messages; one consumer
+ * takes them off, either one at a time or by draining the whole queue.
+ *
+ * Usage: speed [msgs-per-producer] [max-producers]
+ */
+#include <ccan/lqueue/lqueue.h>
+#include <ccan/lqueue/mpsc/mpsc.h>
+#include <ccan/time/time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum kind { LOCKED, DEQUEUE, DRAIN };
+
+struct msg {
+	struct lqueue_link l;
+	struct lqueue_mpsc_link ql;
+};
+
+static size_t num;
+static enum kind kind;
+static LQUEUE(struct msg, l) locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static LQUEUE_MPSC(struct msg, ql) q;
+
+static void *producer(void *arg)
+{
+	struct msg *msgs = arg;
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		if (kind == LOCKED) {
+			pthread_mutex_lock(&lock);
+			lqueue_enqueue(&locked, &msgs[i]);
+			pthread_mutex_unlock(&lock);
+		} else
+			lqueue_mpsc_enqueue(&q, &msgs[i]);
+	}
+	return NULL;
+}
+
+static size_t consume(void)
+{
+	struct msg *m, *next;
+	size_t got = 0;
+
+	switch (kind) {
+	case LOCKED:
+		pthread_mutex_lock(&lock);
+		m = lqueue_dequeue(&locked);
+		pthread_mutex_unlock(&lock);
+		return m != NULL;
+	case DEQUEUE:
+		return lqueue_mpsc_dequeue(&q) != NULL;
+	case DRAIN:
+		for (m = lqueue_mpsc_drain(&q); m; m = next) {
+			next = lqueue_mpsc_next(&q, m);
+			got++;
+		}
+		return got;
+	}
+	abort();
+}
+
+static double bench(enum kind k, unsigned int nthreads)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(*threads));
+	struct msg *msgs = calloc(nthreads * num, sizeof(*msgs));
+	struct timeabs start;
+	size_t i, got = 0;
+
+	kind = k;
+	lqueue_init(&locked);
+	lqueue_mpsc_init(&q);
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, producer, msgs + i * num);
+	while (got < nthreads * num)
+		got += consume();
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(msgs);
+	free(threads);
+
+	/* Millions of messages per second. */
+	return (double)nthreads * num
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads, n;
+
+	num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	max_threads = argc > 2 ? atoi(argv[2]) : 64;
+
+	printf("%zu messages per producer (Mops/sec)\n", num);
+	printf("producers\tdrain\tdequeue\tmutex\n");
+	for (n = 1; n <= max_threads; n *= 2) {
+		double d = bench(DRAIN, n);
+		double q = bench(DEQUEUE, n);
+		double l = bench(LOCKED, n);
+		printf("%u\t%.2f\t%.2f\t%.2f\n", n, d, q, l);
+	}
+	return 0;
+}
@@ -0,0 +1,230 @@
+/* Licensed under BSD-MIT - see LICENSE file for details */
+#ifndef CCAN_LSTACK_LF_H
+#define CCAN_LSTACK_LF_H
+#include "config.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ccan/tcon/tcon.h>
+
+/**
+ * struct lstack_lf_link - a stack link
+ * @down: the entry below this one, or NULL if this is the bottom
+ *
+ * This is used as a link within a stack entry.
+ *
+ * Example:
+ *	struct buf {
+ *		char data[100];
+ *		struct lstack_lf_link sl;
+ *	};
+ */
+struct lstack_lf_link {
+	_Atomic(struct lstack_lf_link *) down;
+};
+
+/* The top of the stack, and how many times it has been popped. */
+struct lstack_lf_top_ {
+	struct lstack_lf_link *top;
+	uintptr_t tag;
+};
+
+/**
+ * struct lstack_lf_ - a lock-free stack (internal type)
+ * @top: the top entry, and a tag
+ *
+ * This is a Treiber stack: push and pop are a compare-and-swap on the
+ * top.  A pop swaps in the entry which was below the top, and by then
+ * that entry may have been popped (and pushed back) by another thread:
+ * so the top is swapped along with a tag which every pop changes
+ * (double-width, so this needs libatomic on most platforms).
+ */
+struct lstack_lf_ {
+	_Atomic(struct lstack_lf_top_) top;
+};
+
+/**
+ * LSTACK_LF - declare a stack which many threads can use at once
+ * @type: the type of elements in the stack
+ * @link: the field containing the lstack_lf_link in @type
+ *
+ * The LSTACK_LF macro declares a stack.  It can be prepended by
+ * "static" to define a static stack.  The stack begins in undefined
+ * state, you must either initialize with LSTACK_LF_INIT, or call
+ * lstack_lf_init() before using it.
+ *
+ * A popping thread may read the link of an entry which another thread
+ * has just popped: so entries must stay readable memory while the stack
+ * is in use (a free list of them, say), even if they're not on it.
+ *
+ * Example:
+ *	LSTACK_LF(struct buf, sl) free_bufs = LSTACK_LF_INIT;
+ *
+ *	if (lstack_lf_empty(&free_bufs))
+ *		printf("No free buffers yet\n");
+ */
+#define LSTACK_LF(etype, link)						\
+	TCON_WRAP(struct lstack_lf_,					\
+		  TCON_CONTAINER(canary, etype, link))
+
+/**
+ * LSTACK_LF_INIT - initializer for an empty stack
+ *
+ * The LSTACK_LF_INIT macro returns a suitable initializer for a stack
+ * defined with LSTACK_LF.
+ */
+#define LSTACK_LF_INIT				\
+	TCON_WRAP_INIT({ { NULL, 0 } })
+
+/**
+ * lstack_lf_entry - convert an lstack_lf_link back into its structure.
+ * @s: the stack
+ * @l: the lstack_lf_link
+ */
+#define lstack_lf_entry(s_, l_) tcon_container_of((s_), canary, (l_))
+
+/**
+ * lstack_lf_init - initialize a stack
+ * @s: the lstack_lf to set to an empty stack
+ *
+ * Example:
+ *	LSTACK_LF(struct buf, sl) bufs;
+ *
+ *	lstack_lf_init(&bufs);
+ */
+#define lstack_lf_init(s_) \
+	lstack_lf_init_(tcon_unwrap(s_))
+static inline void lstack_lf_init_(struct lstack_lf_ *s)
+{
+	struct lstack_lf_top_ empty = { NULL, 0 };
+
+	atomic_init(&s->top, empty);
+}
+
+/**
+ * lstack_lf_empty - is a stack empty?
+ * @s: the stack
+ *
+ * If the stack is empty, returns true.  With other threads using it, the
+ * answer may be out of date by the time you get it.
+ */
+#define lstack_lf_empty(s_) \
+	lstack_lf_empty_(tcon_unwrap(s_))
+static inline bool lstack_lf_empty_(struct lstack_lf_ *s)
+{
+	return atomic_load_explicit(&s->top, memory_order_acquire).top == NULL;
+}
+
+/**
+ * lstack_lf_push - add an entry to the top of the stack
+ * @s: the stack to push the node onto
+ * @e: the item to push
+ *
+ * This is safe to call from any number of threads at once.  The
+ * lstack_lf_link does not need to be initialized; it will be overwritten.
+ *
+ * Example:
+ *	struct buf *b = malloc(sizeof(*b));
+ *
+ *	lstack_lf_push(&free_bufs, b);
+ */
+#define lstack_lf_push(s_, e_)						\
+	lstack_lf_push_(tcon_unwrap(s_), tcon_member_of((s_), canary, (e_)))
+static inline void lstack_lf_push_(struct lstack_lf_ *s,
+				   struct lstack_lf_link *e)
+{
+	struct lstack_lf_top_ old, want;
+
+	old = atomic_load_explicit(&s->top, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&e->down, old.top, memory_order_relaxed);
+		want.top = e;
+		want.tag = old.tag;
+	} while (!atomic_compare_exchange_weak_explicit(&s->top, &old, want,
+							memory_order_release,
+							memory_order_relaxed));
+}
+
+/**
+ * lstack_lf_pop - remove and return the entry from the top of the stack
+ * @s: the stack
+ *
+ * This is safe to call from any number of threads at once.  Returns NULL
+ * if the stack is empty.
+ *
+ * Example:
+ *	b = lstack_lf_pop(&free_bufs);
+ *	if (!b)
+ *		b = malloc(sizeof(*b));
+ */
+#define lstack_lf_pop(s_)						\
+	lstack_lf_entry((s_), lstack_lf_pop_(tcon_unwrap(s_)))
+static inline struct lstack_lf_link *lstack_lf_pop_(struct lstack_lf_ *s)
+{
+	struct lstack_lf_top_ old, want;
+
+	old = atomic_load_explicit(&s->top, memory_order_acquire);
+	do {
+		if (!old.top)
+			return NULL;
+		want.top = atomic_load_explicit(&old.top->down,
+					       memory_order_relaxed);
+		want.tag = old.tag + 1;
+	} while (!atomic_compare_exchange_weak_explicit(&s->top, &old, want,
+							memory_order_acquire,
+							memory_order_acquire));
+	return old.top;
+}
+
+/**
+ * lstack_lf_drain - remove every entry from a stack at once
+ * @s: the stack
+ *
+ * This takes the whole stack with a single compare-and-swap (it can't be
+ * a plain exchange: the tag has to change, as for a pop), and returns
+ * the top entry, or NULL if the stack was empty.  Walk down the rest with
+ * lstack_lf_next().
+ *
+ * Example:
+ *	struct buf *next;
+ *
+ *	for (b = lstack_lf_drain(&free_bufs); b; b = next) {
+ *		next = lstack_lf_next(&free_bufs, b);
+ *		free(b);
+ *	}
+ */
+#define lstack_lf_drain(s_)						\
+	lstack_lf_entry((s_), lstack_lf_drain_(tcon_unwrap(s_)))
+static inline struct lstack_lf_link *lstack_lf_drain_(struct lstack_lf_ *s)
+{
+	struct lstack_lf_top_ old, want;
+
+	old = atomic_load_explicit(&s->top, memory_order_acquire);
+	do {
+		if (!old.top)
+			return NULL;
+		want.top = NULL;
+		want.tag = old.tag + 1;
+	} while (!atomic_compare_exchange_weak_explicit(&s->top, &old, want,
+							memory_order_acquire,
+							memory_order_acquire));
+	return old.top;
+}
+
+/**
+ * lstack_lf_next - the entry below one returned by lstack_lf_drain()
+ * @s: the stack it was drained from
+ * @e: the entry
+ *
+ * Returns NULL after the last one.  Once an entry has been pushed again,
+ * its link belongs to the stack: so get the next entry first.
+ */
+#define lstack_lf_next(s_, e_)						\
+	lstack_lf_entry((s_),						\
+			lstack_lf_next_(tcon_member_of((s_), canary, (e_))))
+static inline struct lstack_lf_link *lstack_lf_next_(struct lstack_lf_link *e)
+{
+	return atomic_load_explicit(&e->down, memory_order_relaxed);
+}
+#endif /* CCAN_LSTACK_LF_H */
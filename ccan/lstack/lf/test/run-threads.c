@@ -0,0 +1,71 @@
+#include "config.h"
+
+#include <ccan/lstack/lf/lf.h>
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define NUM 64
+#define ROUNDS 20000
+
+struct item {
+	_Atomic(int) held;
+	struct lstack_lf_link sl;
+};
+
+static LSTACK_LF(struct item, sl) pool = LSTACK_LF_INIT;
+static struct item items[NUM];
+
+/* Take items, and put them back: nobody else may have them meanwhile. */
+static void *worker(void *arg)
+{
+	struct item *mine[3];
+	size_t i, j, bad = 0;
+
+	for (i = 0; i < ROUNDS; i++) {
+		for (j = 0; j < 3; j++) {
+			mine[j] = lstack_lf_pop(&pool);
+			if (mine[j] && atomic_exchange(&mine[j]->held, 1))
+				bad++;
+		}
+		for (j = 0; j < 3; j++) {
+			if (!mine[j])
+				continue;
+			atomic_store(&mine[j]->held, 0);
+			lstack_lf_push(&pool, mine[j]);
+		}
+	}
+	return bad ? NULL : arg;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	struct item *it, *next;
+	size_t i, bad = 0, n = 0;
+
+	plan_tests(2);
+	for (i = 0; i < NUM; i++)
+		lstack_lf_push(&pool, &items[i]);
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+	for (i = 0; i < THREADS; i++) {
+		void *ret;
+
+		pthread_join(threads[i], &ret);
+		if (ret != (void *)(i + 1))
+			bad++;
+	}
+	ok1(bad == 0);
+
+	/* They all came back, once each. */
+	for (it = lstack_lf_drain(&pool); it; it = next) {
+		next = lstack_lf_next(&pool, it);
+		if (atomic_exchange(&it->held, 1))
+			bad++;
+		n++;
+	}
+	ok1(n == NUM && bad == 0);
+
+	return exit_status();
+}
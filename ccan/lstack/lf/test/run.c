@@ -0,0 +1,60 @@
+#include "config.h"
+
+#include <ccan/lstack/lf/lf.h>
+#include <ccan/tap/tap.h>
+
+struct stacker {
+	const char *name;
+	struct lstack_lf_link sl;
+};
+
+int main(void)
+{
+	LSTACK_LF(struct stacker, sl) s = LSTACK_LF_INIT;
+	struct stacker a = { "Alice" };
+	struct stacker b = { "Bob" };
+	struct stacker c = { "Carol" };
+	struct stacker *stacker;
+
+	/* This is how many tests you plan to run */
+	plan_tests(18);
+
+	ok1(lstack_lf_empty(&s));
+	ok1(lstack_lf_pop(&s) == NULL);
+	ok1(lstack_lf_drain(&s) == NULL);
+
+	lstack_lf_push(&s, &a);
+	ok1(!lstack_lf_empty(&s));
+	lstack_lf_push(&s, &b);
+	lstack_lf_push(&s, &c);
+
+	ok1(lstack_lf_pop(&s) == &c);
+	ok1(lstack_lf_pop(&s) == &b);
+	ok1(!lstack_lf_empty(&s));
+	ok1(lstack_lf_pop(&s) == &a);
+	ok1(lstack_lf_empty(&s));
+	ok1(lstack_lf_pop(&s) == NULL);
+
+	/* Every pop which takes something changes the tag. */
+	ok1(atomic_load(&tcon_unwrap(&s)->top).tag == 3);
+
+	lstack_lf_push(&s, &a);
+	lstack_lf_push(&s, &b);
+	lstack_lf_push(&s, &c);
+	stacker = lstack_lf_drain(&s);
+	ok1(stacker == &c);
+	ok1(lstack_lf_empty(&s));
+	stacker = lstack_lf_next(&s, stacker);
+	ok1(stacker == &b);
+	stacker = lstack_lf_next(&s, stacker);
+	ok1(stacker == &a);
+	ok1(lstack_lf_next(&s, stacker) == NULL);
+
+	lstack_lf_init(&s);
+	ok1(lstack_lf_empty(&s));
+	lstack_lf_push(&s, &b);
+	ok1(lstack_lf_pop(&s) == &b);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
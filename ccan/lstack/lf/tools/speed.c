@@ -0,0 +1,96 @@
+/*
+ * Multi-threaded speed test: lstack/lf against an lstack behind a
+ * pthread mutex.
+ *
+ * The stack is a shared pool of buffers: each thread takes one, and
+ * puts it back.
+ *
+ * Usage: speed [ops-per-thread] [max-threads]
+ */
+#include <ccan/lstack/lstack.h>
+#include <ccan/lstack/lf/lf.h>
+#include <ccan/time/time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define POOL 1024
+
+struct buf {
+	struct lstack_link l;
+	struct lstack_lf_link sl;
+};
+
+static size_t ops;
+static bool use_lock;
+static LSTACK(struct buf, l) locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static LSTACK_LF(struct buf, sl) s;
+static struct buf bufs[POOL];
+
+static void *run(void *arg)
+{
+	struct buf *b;
+	size_t i;
+
+	for (i = 0; i < ops; i++) {
+		if (use_lock) {
+			pthread_mutex_lock(&lock);
+			b = lstack_pop(&locked);
+			pthread_mutex_unlock(&lock);
+			if (!b)
+				continue;
+			pthread_mutex_lock(&lock);
+			lstack_push(&locked, b);
+			pthread_mutex_unlock(&lock);
+		} else {
+			b = lstack_lf_pop(&s);
+			if (b)
+				lstack_lf_push(&s, b);
+		}
+	}
+	return NULL;
+}
+
+static double bench(bool lf, unsigned int nthreads)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(*threads));
+	struct timeabs start;
+	size_t i;
+
+	use_lock = !lf;
+	lstack_init(&locked);
+	lstack_lf_init(&s);
+	for (i = 0; i < POOL; i++) {
+		lstack_push(&locked, &bufs[i]);
+		lstack_lf_push(&s, &bufs[i]);
+	}
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, run, NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	/* Millions of pop+push pairs per second. */
+	return (double)nthreads * ops
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads, n;
+
+	ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	max_threads = argc > 2 ? atoi(argv[2]) : 64;
+
+	printf("%zu pop+push per thread (Mops/sec)\n", ops);
+	printf("threads\tlf\tmutex\n");
+	for (n = 1; n <= max_threads; n *= 2) {
+		double f = bench(true, n);
+		double l = bench(false, n);
+		printf("%u\t%.2f\t%.2f\n", n, f, l);
+	}
+	return 0;
+}
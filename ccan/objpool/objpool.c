@@ -0,0 +1,376 @@
+/* Licensed under LGPLv3+ - see LICENSE file for details */
+#include <ccan/objpool/objpool.h>
+#include <ccan/talloc/talloc.h>
+#include <assert.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_LINE 64
+#define CHUNK_SIZE (64 * 1024)
+/* Objects swapped between a cache and the pool at once. */
+#define BATCH 32
+
+/*
+ * A free object.  Objects are linked into batches through next; the
+ * first object of each batch says how many are in it, and links it to
+ * the next batch on the pool's list.
+ */
+struct obj {
+	struct obj *next;
+	struct obj *next_batch;
+	size_t num;
+};
+
+struct chunk {
+	struct chunk *next;
+	size_t size;
+	bool mapped;
+};
+
+struct objpool_cache {
+	struct objpool_cache *next;
+	struct objpool *pool;
+	bool in_use;
+	/* Free objects, and how many. */
+	struct obj *free;
+	size_t num;
+};
+
+struct objpool {
+	_Atomic(unsigned int) lock;
+	size_t objsize, align;
+	unsigned int flags;
+	/* Everything below is protected by lock. */
+	struct obj *batches;
+	struct chunk *chunks;
+	struct objpool_cache *caches;
+	_Atomic(size_t) num_chunks;
+};
+
+static void lock(struct objpool *pool)
+{
+	unsigned int spins = 0;
+
+	while (atomic_exchange_explicit(&pool->lock, 1, memory_order_acquire))
+		if (++spins % 128 == 0)
+			sched_yield();
+}
+
+static void unlock(struct objpool *pool)
+{
+	atomic_store_explicit(&pool->lock, 0, memory_order_release);
+}
+
+static size_t chunk_header(const struct objpool *pool)
+{
+	return (sizeof(struct chunk) + pool->align - 1) & ~(pool->align - 1);
+}
+
+static void init_pool(struct objpool *pool, size_t size, size_t align,
+		      unsigned int flags)
+{
+	/* Free objects must hold a struct obj, suitably aligned. */
+	if (align < ALIGNOF(struct obj))
+		align = ALIGNOF(struct obj);
+	if (size < sizeof(struct obj))
+		size = sizeof(struct obj);
+	assert(align <= CACHE_LINE && (align & (align - 1)) == 0);
+
+	atomic_init(&pool->lock, 0);
+	pool->objsize = (size + align - 1) & ~(align - 1);
+	pool->align = align;
+	pool->flags = flags;
+	pool->batches = NULL;
+	pool->chunks = NULL;
+	pool->caches = NULL;
+	atomic_init(&pool->num_chunks, 0);
+}
+
+static void free_chunk(struct chunk *c)
+{
+#if HAVE_MMAP
+	if (c->mapped) {
+		munmap(c, c->size);
+		return;
+	}
+#endif
+	free(c);
+}
+
+static void cleanup_pool(struct objpool *pool)
+{
+	struct chunk *c, *next_c;
+	struct objpool_cache *cache, *next_cache;
+
+	for (c = pool->chunks; c; c = next_c) {
+		next_c = c->next;
+		free_chunk(c);
+	}
+	for (cache = pool->caches; cache; cache = next_cache) {
+		next_cache = cache->next;
+		free(cache);
+	}
+}
+
+static void destroy_objpool(struct objpool *pool)
+{
+	cleanup_pool(pool);
+}
+
+static int destroy_talloc_objpool(struct objpool *pool)
+{
+	cleanup_pool(pool);
+	return 0;
+}
+
+struct objpool *objpool_new_(const tal_t *ctx, size_t size, size_t align,
+			     unsigned int flags)
+{
+	struct objpool *pool = tal(ctx, struct objpool);
+
+	if (pool) {
+		init_pool(pool, size, align, flags);
+		tal_add_destructor(pool, destroy_objpool);
+	}
+	return pool;
+}
+
+struct objpool *objpool_talloc_new_(const void *ctx, size_t size,
+				    size_t align, unsigned int flags)
+{
+	struct objpool *pool = talloc(ctx, struct objpool);
+
+	if (pool) {
+		init_pool(pool, size, align, flags);
+		talloc_set_destructor(pool, destroy_talloc_objpool);
+	}
+	return pool;
+}
+
+size_t objpool_objsize(const struct objpool *pool)
+{
+	return pool->objsize;
+}
+
+size_t objpool_chunks(const struct objpool *pool)
+{
+	return atomic_load_explicit(&pool->num_chunks, memory_order_relaxed);
+}
+
+struct objpool_cache *objpool_cache(struct objpool *pool)
+{
+	struct objpool_cache *cache;
+	void *mem;
+
+	lock(pool);
+	for (cache = pool->caches; cache; cache = cache->next) {
+		if (!cache->in_use) {
+			cache->in_use = true;
+			unlock(pool);
+			return cache;
+		}
+	}
+	unlock(pool);
+
+	/* A cache line each, so threads don't slow each other down. */
+	if (posix_memalign(&mem, CACHE_LINE, CACHE_LINE) != 0)
+		return NULL;
+	cache = mem;
+	cache->pool = pool;
+	cache->in_use = true;
+	cache->free = NULL;
+	cache->num = 0;
+
+	lock(pool);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	unlock(pool);
+	return cache;
+}
+
+/* Called with the lock held. */
+static void push_batch(struct objpool *pool, struct obj *batch, size_t num)
+{
+	batch->num = num;
+	batch->next_batch = pool->batches;
+	pool->batches = batch;
+}
+
+void objpool_cache_release(struct objpool_cache *cache)
+{
+	struct objpool *pool = cache->pool;
+
+	lock(pool);
+	if (cache->free)
+		push_batch(pool, cache->free, cache->num);
+	cache->free = NULL;
+	cache->num = 0;
+	cache->in_use = false;
+	unlock(pool);
+}
+
+#if HAVE_MMAP
+/*
+ * Ask the kernel for this chunk's pages on our node.  Without mbind,
+ * first touch (we're about to write every object's link) does the same
+ * unless memory is short there.
+ */
+static void bind_local(void *mem, size_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+	unsigned int cpu, node;
+	unsigned long mask;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0
+	    || node >= sizeof(mask) * 8)
+		return;
+	mask = 1UL << node;
+	/* MPOL_PREFERRED: fall back to other nodes if this one is full. */
+	syscall(SYS_mbind, mem, size, 1, &mask, sizeof(mask) * 8 + 1, 0);
+#else
+	(void)mem;
+	(void)size;
+#endif
+}
+#endif
+
+static struct chunk *alloc_chunk(const struct objpool *pool, size_t size)
+{
+	struct chunk *c;
+	void *mem;
+
+#if HAVE_MMAP
+	if (pool->flags & OBJPOOL_NUMA_LOCAL) {
+		mem = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED)
+			return NULL;
+		bind_local(mem, size);
+		c = mem;
+		c->mapped = true;
+		c->size = size;
+		return c;
+	}
+#endif
+	if (posix_memalign(&mem, CACHE_LINE, size) != 0)
+		return NULL;
+	c = mem;
+	c->mapped = false;
+	c->size = size;
+	return c;
+}
+
+/*
+ * Carve a new chunk into batches: keep the first, give the pool the rest.
+ * We do the carving outside the lock (and in this thread, so the pages
+ * are first touched here).
+ */
+static struct obj *new_chunk(struct objpool *pool, size_t *num)
+{
+	size_t size = CHUNK_SIZE, n, i;
+	struct obj *first, *rest = NULL, *last = NULL;
+	struct chunk *c;
+	char *p;
+
+	if (size < chunk_header(pool) + pool->objsize * BATCH)
+		size = chunk_header(pool) + pool->objsize * BATCH;
+	c = alloc_chunk(pool, size);
+	if (!c)
+		return NULL;
+
+	n = (size - chunk_header(pool)) / pool->objsize;
+	p = (char *)c + chunk_header(pool);
+	for (i = 0; i < n; i++) {
+		struct obj *o = (struct obj *)(p + i * pool->objsize);
+
+		if (i % BATCH == 0) {
+			/* Pushed on the front: the first batch is the tail. */
+			o->next_batch = rest;
+			o->num = n - i < BATCH ? n - i : BATCH;
+			if (!last)
+				last = o;
+			rest = o;
+		}
+		o->next = (i % BATCH == BATCH - 1 || i == n - 1)
+			? NULL : (struct obj *)(p + (i + 1) * pool->objsize);
+	}
+
+	first = rest;
+	*num = first->num;
+	rest = first->next_batch;
+
+	lock(pool);
+	if (rest) {
+		last->next_batch = pool->batches;
+		pool->batches = rest;
+	}
+	c->next = pool->chunks;
+	pool->chunks = c;
+	atomic_fetch_add_explicit(&pool->num_chunks, 1, memory_order_relaxed);
+	unlock(pool);
+	return first;
+}
+
+void *objpool_alloc(struct objpool_cache *cache)
+{
+	struct objpool *pool = cache->pool;
+	struct obj *o;
+
+	if (!cache->free) {
+		lock(pool);
+		o = pool->batches;
+		if (o) {
+			pool->batches = o->next_batch;
+			cache->num = o->num;
+		}
+		unlock(pool);
+		if (!o) {
+			o = new_chunk(pool, &cache->num);
+			if (!o)
+				return NULL;
+		}
+		cache->free = o;
+	}
+
+	o = cache->free;
+	cache->free = o->next;
+	cache->num--;
+	return o;
+}
+
+void objpool_free(struct objpool_cache *cache, void *obj)
+{
+	struct obj *o = obj, *last;
+	size_t i;
+
+	if (!obj)
+		return;
+
+	/* Too many?  Give the most recently freed batch back. */
+	if (cache->num == 2 * BATCH) {
+		struct objpool *pool = cache->pool;
+		struct obj *batch = cache->free;
+
+		for (last = batch, i = 1; i < BATCH; i++)
+			last = last->next;
+		cache->free = last->next;
+		cache->num -= BATCH;
+		last->next = NULL;
+		lock(pool);
+		push_batch(pool, batch, BATCH);
+		unlock(pool);
+	}
+
+	o->next = cache->free;
+	cache->free = o;
+	cache->num++;
+}
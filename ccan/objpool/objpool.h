@@ -0,0 +1,140 @@
+/* Licensed under LGPLv3+ - see LICENSE file for details */
+#ifndef CCAN_OBJPOOL_H
+#define CCAN_OBJPOOL_H
+#include "config.h"
+#include <ccan/alignof/alignof.h>
+#include <ccan/tal/tal.h>
+#include <stddef.h>
+
+/* Back the pool with chunks on the NUMA node of the thread which needs them. */
+#define OBJPOOL_NUMA_LOCAL 1
+
+struct objpool;
+struct objpool_cache;
+
+/**
+ * objpool_new - allocate a pool of objects of one type, from a tal context.
+ * @ctx: the tal context to allocate from (or NULL).
+ * @type: the type of the objects.
+ * @flags: 0, or OBJPOOL_NUMA_LOCAL.
+ *
+ * The pool hands out objects from large chunks, through per-thread
+ * caches (see objpool_cache()).  Freeing the pool (with tal_free(), or
+ * by freeing @ctx) frees every object in it at once: there's no need to
+ * free them one by one first.
+ *
+ * Returns NULL on out of memory.
+ *
+ * Example:
+ *	struct request {
+ *		int fd;
+ *		char buf[200];
+ *	};
+ *
+ *	static struct objpool *requests;
+ *
+ *	static void setup(void)
+ *	{
+ *		requests = objpool_new(NULL, struct request, 0);
+ *		if (!requests)
+ *			err(1, "Allocating request pool");
+ *	}
+ */
+#define objpool_new(ctx, type, flags)					\
+	objpool_new_((ctx), sizeof(type), ALIGNOF(type), (flags))
+
+/**
+ * objpool_talloc_new - allocate a pool of objects, from a talloc context.
+ * @ctx: the talloc context to allocate from (or NULL).
+ * @type: the type of the objects.
+ * @flags: 0, or OBJPOOL_NUMA_LOCAL.
+ *
+ * This is objpool_new() for talloc users: free the pool (and all its
+ * objects) with talloc_free(), or by freeing @ctx.
+ *
+ * Example:
+ *	static struct objpool *talloc_requests(void *ctx)
+ *	{
+ *		return objpool_talloc_new(ctx, struct request, 0);
+ *	}
+ */
+#define objpool_talloc_new(ctx, type, flags)				\
+	objpool_talloc_new_((ctx), sizeof(type), ALIGNOF(type), (flags))
+
+struct objpool *objpool_new_(const tal_t *ctx, size_t size, size_t align,
+			     unsigned int flags);
+struct objpool *objpool_talloc_new_(const void *ctx, size_t size,
+				    size_t align, unsigned int flags);
+
+/**
+ * objpool_cache - get a cache for this thread.
+ * @pool: the pool.
+ *
+ * Each thread allocates and frees through its own cache, which holds a
+ * few dozen free objects: most objpool_alloc() and objpool_free() calls
+ * touch nothing else.  When it runs out, or has too many, it swaps a
+ * batch of them with the pool at once.
+ *
+ * This reuses a cache given back with objpool_cache_release() if it can.
+ * Returns NULL on out of memory.
+ *
+ * Example:
+ *	static void *request_thread(void *unused)
+ *	{
+ *		struct objpool_cache *cache = objpool_cache(requests);
+ *		struct request *req;
+ *
+ *		req = objpool_alloc(cache);
+ *		if (req) {
+ *			req->fd = -1;
+ *			objpool_free(cache, req);
+ *		}
+ *		objpool_cache_release(cache);
+ *		return NULL;
+ *	}
+ */
+struct objpool_cache *objpool_cache(struct objpool *pool);
+
+/**
+ * objpool_cache_release - give back a cache.
+ * @cache: this thread's cache.
+ *
+ * The objects it holds go back to the pool; another thread may reuse
+ * the cache.  Caches not given back are freed with the pool.
+ */
+void objpool_cache_release(struct objpool_cache *cache);
+
+/**
+ * objpool_alloc - allocate an object.
+ * @cache: this thread's cache.
+ *
+ * The object is uninitialized.  Returns NULL on out of memory.
+ */
+void *objpool_alloc(struct objpool_cache *cache);
+
+/**
+ * objpool_free - free an object.
+ * @cache: this thread's cache.
+ * @obj: the object (or NULL).
+ *
+ * @obj may have been allocated through any cache of the same pool.
+ */
+void objpool_free(struct objpool_cache *cache, void *obj);
+
+/**
+ * objpool_objsize - the size of each object.
+ * @pool: the pool.
+ *
+ * This is the size given to objpool_new(), rounded up to its alignment
+ * and to at least three pointers (the free lists live in free objects).
+ */
+size_t objpool_objsize(const struct objpool *pool);
+
+/**
+ * objpool_chunks - how many chunks the pool has allocated.
+ * @pool: the pool.
+ *
+ * Chunks are never given back until the pool is freed.
+ */
+size_t objpool_chunks(const struct objpool *pool);
+#endif /* CCAN_OBJPOOL_H */
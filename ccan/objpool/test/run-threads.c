@@ -0,0 +1,81 @@
+#include <ccan/objpool/objpool.h>
+#include <ccan/objpool/objpool.c>
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define ROUNDS 100000
+#define LIVE 500
+
+struct conn {
+	unsigned int owner;
+	unsigned int n;
+	char pad[40];
+};
+
+static struct objpool *pool;
+/* Each thread frees its neighbour's leftovers. */
+static struct conn *left[THREADS][LIVE];
+static pthread_barrier_t barrier;
+
+static void *run(void *arg)
+{
+	unsigned int me = (long)arg, i, n, bad = 0;
+	struct objpool_cache *cache = objpool_cache(pool);
+	struct conn *live[LIVE] = { NULL };
+
+	for (i = 0; i < ROUNDS; i++) {
+		n = (i * 7919) % LIVE;
+		if (live[n]) {
+			if (live[n]->owner != me || live[n]->n != n)
+				bad++;
+			objpool_free(cache, live[n]);
+		}
+		live[n] = objpool_alloc(cache);
+		live[n]->owner = me;
+		live[n]->n = n;
+	}
+	memcpy(left[me], live, sizeof(live));
+
+	pthread_barrier_wait(&barrier);
+	for (n = 0; n < LIVE; n++) {
+		struct conn *c = left[(me + 1) % THREADS][n];
+		if (c->owner != (me + 1) % THREADS || c->n != n)
+			bad++;
+		objpool_free(cache, c);
+	}
+	objpool_cache_release(cache);
+	return (void *)(long)bad;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	unsigned long i, bad = 0, total = 0;
+	struct obj *b, *o;
+	void *ret;
+
+	plan_tests(3);
+
+	pool = objpool_new(NULL, struct conn, 0);
+	pthread_barrier_init(&barrier, NULL, THREADS);
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, run, (void *)i);
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &ret);
+		bad += (long)ret;
+	}
+	ok1(bad == 0);
+
+	/* Everything came back, and nothing twice. */
+	for (b = pool->batches; b; b = b->next_batch)
+		for (o = b; o; o = o->next)
+			total++;
+	ok1(total == objpool_chunks(pool)
+	    * ((CHUNK_SIZE - chunk_header(pool)) / objpool_objsize(pool)));
+	ok1(objpool_chunks(pool) < THREADS * 2);
+
+	tal_free(pool);
+	pthread_barrier_destroy(&barrier);
+	return exit_status();
+}
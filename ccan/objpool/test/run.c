@@ -0,0 +1,154 @@
+#include <ccan/objpool/objpool.h>
+#include <ccan/objpool/objpool.c>
+#include <ccan/tap/tap.h>
+#include <stdint.h>
+
+#define NUM 10000
+
+struct small {
+	char c;
+};
+
+struct big {
+	double d;
+	char buf[1000];
+};
+
+static void *p[NUM];
+
+static int addr_cmp(const void *a, const void *b)
+{
+	const char *pa = *(void **)a, *pb = *(void **)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+static bool unique(unsigned int num)
+{
+	unsigned int i;
+
+	qsort(p, num, sizeof(p[0]), addr_cmp);
+	for (i = 1; i < num; i++)
+		if ((char *)p[i] < (char *)p[i-1] + sizeof(struct big))
+			return false;
+	return true;
+}
+
+static size_t pool_free(struct objpool *pool)
+{
+	struct obj *b, *o;
+	size_t n = 0;
+
+	for (b = pool->batches; b; b = b->next_batch)
+		for (o = b; o; o = o->next)
+			n++;
+	return n;
+}
+
+int main(void)
+{
+	struct objpool *pool;
+	struct objpool_cache *cache, *other;
+	void *ctx;
+	unsigned int i;
+	size_t chunks;
+
+	plan_tests(26);
+
+	/* Small objects are padded to hold the free list. */
+	pool = objpool_new(NULL, struct small, 0);
+	ok1(pool);
+	ok1(objpool_objsize(pool) == sizeof(struct obj));
+	ok1(objpool_chunks(pool) == 0);
+	tal_free(pool);
+
+	pool = objpool_new(NULL, struct big, 0);
+	ok1(objpool_objsize(pool) == sizeof(struct big));
+	cache = objpool_cache(pool);
+	ok1(cache);
+
+	for (i = 0; i < NUM; i++) {
+		p[i] = objpool_alloc(cache);
+		if (!p[i] || (uintptr_t)p[i] % ALIGNOF(struct big))
+			break;
+		memset(p[i], i, sizeof(struct big));
+	}
+	ok1(i == NUM);
+	chunks = objpool_chunks(pool);
+	ok1(chunks == (NUM + 63) / 64);
+	ok1(cache->num + pool_free(pool) + NUM
+	    == chunks * ((CHUNK_SIZE - chunk_header(pool))
+			 / objpool_objsize(pool)));
+
+	/* A cache never holds more than two batches. */
+	for (i = 0; i < NUM; i++)
+		objpool_free(cache, p[i]);
+	ok1(cache->num <= 2 * BATCH);
+	ok1(unique(NUM));
+
+	/* Reuse barely needs more chunks, even from another cache. */
+	other = objpool_cache(pool);
+	ok1(other && other != cache);
+	for (i = 0; i < NUM; i++)
+		p[i] = objpool_alloc(other);
+	/* (The first cache may be sitting on up to two batches.) */
+	ok1(objpool_chunks(pool) <= chunks + 1);
+	chunks = objpool_chunks(pool);
+	ok1(unique(NUM));
+	for (i = 0; i < NUM; i++)
+		objpool_free(cache, p[i]);
+	objpool_free(cache, NULL);
+
+	/* Released caches give back everything, and get reused. */
+	objpool_cache_release(other);
+	objpool_cache_release(cache);
+	ok1(pool_free(pool) == chunks * ((CHUNK_SIZE - chunk_header(pool))
+					 / objpool_objsize(pool)));
+	ok1(objpool_cache(pool) == other);
+	ok1(objpool_cache(pool) == cache);
+	ok1(objpool_cache(pool) != cache);
+
+	/* Freeing the pool frees every object (valgrind will tell). */
+	for (i = 0; i < NUM; i++)
+		p[i] = objpool_alloc(cache);
+	tal_free(pool);
+
+	/* Freed with its tal parent. */
+	ctx = tal(NULL, char);
+	pool = objpool_new(ctx, struct big, 0);
+	ok1(tal_parent(pool) == ctx);
+	cache = objpool_cache(pool);
+	ok1(objpool_alloc(cache));
+	tal_free(ctx);
+
+	/* Or its talloc parent. */
+	ctx = talloc(NULL, char);
+	pool = objpool_talloc_new(ctx, struct big, 0);
+	ok1(talloc_parent(pool) == ctx);
+	cache = objpool_cache(pool);
+	for (i = 0; i < NUM; i++)
+		p[i] = objpool_alloc(cache);
+	ok1(unique(NUM));
+	talloc_free(ctx);
+
+	/* Node-local chunks work the same. */
+	pool = objpool_talloc_new(NULL, struct big, OBJPOOL_NUMA_LOCAL);
+	cache = objpool_cache(pool);
+	for (i = 0; i < NUM; i++) {
+		p[i] = objpool_alloc(cache);
+		if (!p[i])
+			break;
+		memset(p[i], i, sizeof(struct big));
+	}
+	ok1(i == NUM);
+	ok1(pool->chunks->mapped == HAVE_MMAP);
+	ok1(unique(NUM));
+	for (i = 0; i < NUM; i++)
+		objpool_free(cache, p[i]);
+	objpool_cache_release(cache);
+	ok1(pool_free(pool) == objpool_chunks(pool)
+	    * ((CHUNK_SIZE - chunk_header(pool)) / objpool_objsize(pool)));
+	ok1(talloc_free(pool) == 0);
+
+	return exit_status();
+}
@@ -0,0 +1,132 @@
+/*
+ * Multi-threaded speed test: objpool against malloc/free.
+ *
+ * Each thread keeps a working set of connection-sized objects, replacing
+ * one each time round; one object in 16 is freed by the next thread
+ * instead, as when connections move between threads.
+ *
+ * Usage: speed [ops-per-thread] [max-threads]
+ */
+#include <ccan/objpool/objpool.h>
+#include <ccan/time/time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LIVE 1024
+
+enum kind { OBJPOOL, MALLOC };
+
+struct conn {
+	int fd;
+	unsigned int flags;
+	char addr[128];
+	void *req, *resp;
+	unsigned long bytes_in, bytes_out;
+};
+
+static unsigned long num;
+static struct objpool *pool;
+
+struct thread {
+	pthread_t id;
+	enum kind kind;
+	/* Handed over by the previous thread, to free. */
+	_Atomic(struct conn *) handoff;
+	struct thread *next;
+};
+
+static void release(enum kind kind, struct objpool_cache *cache,
+		    struct conn *c)
+{
+	if (kind == OBJPOOL)
+		objpool_free(cache, c);
+	else
+		free(c);
+}
+
+static void *run(void *arg)
+{
+	struct thread *me = arg;
+	struct objpool_cache *cache = NULL;
+	struct conn *live[LIVE] = { NULL }, *c;
+	unsigned long i;
+
+	if (me->kind == OBJPOOL)
+		cache = objpool_cache(pool);
+	for (i = 0; i < num; i++) {
+		unsigned int n = i % LIVE;
+
+		if (live[n]) {
+			if (i % 16 == 0)
+				c = atomic_exchange(&me->next->handoff, live[n]);
+			else
+				c = live[n];
+			if (c)
+				release(me->kind, cache, c);
+		}
+		if (me->kind == OBJPOOL)
+			live[n] = objpool_alloc(cache);
+		else
+			live[n] = malloc(sizeof(struct conn));
+		live[n]->fd = n;
+	}
+	for (i = 0; i < LIVE; i++)
+		release(me->kind, cache, live[i]);
+	if (cache)
+		objpool_cache_release(cache);
+	return NULL;
+}
+
+static double bench(enum kind kind, unsigned int nthreads)
+{
+	struct thread *threads = calloc(nthreads, sizeof(*threads));
+	struct timeabs start;
+	struct conn *c;
+	unsigned int i;
+
+	if (kind == OBJPOOL)
+		pool = objpool_new(NULL, struct conn, 0);
+	for (i = 0; i < nthreads; i++) {
+		threads[i].kind = kind;
+		threads[i].next = &threads[(i + 1) % nthreads];
+		atomic_init(&threads[i].handoff, NULL);
+	}
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i].id, NULL, run, &threads[i]);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i].id, NULL);
+
+	/* Leftover handoffs: objpool ones go with the pool. */
+	for (i = 0; i < nthreads; i++) {
+		c = atomic_load(&threads[i].handoff);
+		if (kind == MALLOC)
+			free(c);
+	}
+	if (kind == OBJPOOL)
+		pool = tal_free(pool);
+	free(threads);
+	return (double)num * nthreads
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nthreads, max_threads = 4;
+
+	num = 10000000;
+	if (argc > 1)
+		num = atol(argv[1]);
+	if (argc > 2)
+		max_threads = atoi(argv[2]);
+
+	printf("%lu alloc+free per thread (Mops/sec):\n", num);
+	printf("threads\tobjpool\tmalloc\n");
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+		printf("%u\t%.1f\t%.1f\n", nthreads,
+		       bench(OBJPOOL, nthreads), bench(MALLOC, nthreads));
+	return 0;
+}
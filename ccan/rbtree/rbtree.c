@@ -993,3 +993,494 @@ trbt_findfirstarray32(trbt_tree_t *tree, uint32_t keylen)
 }
 
 
+
+
+/* Intrusive trees.
+
+   The color lives in the bottom bit of the parent pointer.  These use
+   child[side] rather than separate left/right cases, so each operation
+   only has to be written once.
+*/
+static inline trbt_link_t *
+link_parent(const trbt_link_t *link)
+{
+	return (trbt_link_t *)(link->parent_color & ~(uintptr_t)1);
+}
+
+/* NULL links are black by definition */
+static inline int
+link_is_red(const trbt_link_t *link)
+{
+	return link && (link->parent_color & 1) == TRBT_RED;
+}
+
+static inline void
+link_set_parent(trbt_link_t *link, trbt_link_t *parent)
+{
+	link->parent_color = (uintptr_t)parent | (link->parent_color & 1);
+}
+
+static inline void
+link_set_color(trbt_link_t *link, int color)
+{
+	link->parent_color = (link->parent_color & ~(uintptr_t)1) | color;
+}
+
+/* Point whatever pointed to old (its parent, or the root) at new */
+static inline void
+link_replace(trbt_root_t *root, trbt_link_t *parent,
+	     trbt_link_t *old, trbt_link_t *new)
+{
+	if (parent == NULL) {
+		root->root = new;
+	} else {
+		parent->child[parent->child[1] == old] = new;
+	}
+}
+
+/* Rotate link's child on this side up into link's place */
+static void
+link_rotate(trbt_root_t *root, trbt_link_t *link, int side)
+{
+	trbt_link_t *child = link->child[side];
+	trbt_link_t *parent = link_parent(link);
+	trbt_link_t *inner = child->child[!side];
+
+	link->child[side] = inner;
+	if (inner) {
+		link_set_parent(inner, link);
+	}
+	child->child[!side] = link;
+	link_set_parent(link, child);
+	link_set_parent(child, parent);
+	link_replace(root, parent, link, child);
+}
+
+/* link is red: fix up any red parent above it.  Returns true if the
+   root had to be turned black, which adds one to the black height.
+*/
+static int
+link_insert_fixup(trbt_root_t *root, trbt_link_t *link)
+{
+	trbt_link_t *parent, *grandparent, *uncle;
+	int side;
+
+	while ((parent = link_parent(link)) && link_is_red(parent)) {
+		/* a red parent is never the root */
+		grandparent = link_parent(parent);
+		side = grandparent->child[1] == parent;
+		uncle = grandparent->child[!side];
+
+		if (link_is_red(uncle)) {
+			link_set_color(parent, TRBT_BLACK);
+			link_set_color(uncle, TRBT_BLACK);
+			link_set_color(grandparent, TRBT_RED);
+			link = grandparent;
+			continue;
+		}
+		if (parent->child[!side] == link) {
+			link_rotate(root, parent, !side);
+			parent = link;
+		}
+		link_set_color(parent, TRBT_BLACK);
+		link_set_color(grandparent, TRBT_RED);
+		link_rotate(root, grandparent, side);
+		break;
+	}
+	if (link_is_red(root->root)) {
+		link_set_color(root->root, TRBT_BLACK);
+		return 1;
+	}
+	return 0;
+}
+
+void
+trbt_link_insert(trbt_root_t *root, trbt_link_t *link,
+		 trbt_link_t *parent, int side)
+{
+	link->parent_color = (uintptr_t)parent | TRBT_RED;
+	link->child[0] = link->child[1] = NULL;
+	if (parent == NULL) {
+		root->root = link;
+	} else {
+		parent->child[side] = link;
+	}
+	link_insert_fixup(root, link);
+}
+
+/* The subtree on this side of parent lost a black link: link is what
+   is there now (perhaps NULL) */
+static void
+link_delete_fixup(trbt_root_t *root, trbt_link_t *link,
+		  trbt_link_t *parent, int side)
+{
+	trbt_link_t *sibling;
+
+	while (parent && !link_is_red(link)) {
+		/* the other side has a black link more, so isn't empty */
+		sibling = parent->child[!side];
+		if (link_is_red(sibling)) {
+			link_set_color(sibling, TRBT_BLACK);
+			link_set_color(parent, TRBT_RED);
+			link_rotate(root, parent, !side);
+			sibling = parent->child[!side];
+		}
+		if (!link_is_red(sibling->child[0])
+		    && !link_is_red(sibling->child[1])) {
+			link_set_color(sibling, TRBT_RED);
+			link = parent;
+			parent = link_parent(link);
+			if (parent) {
+				side = parent->child[1] == link;
+			}
+			continue;
+		}
+		if (!link_is_red(sibling->child[!side])) {
+			link_set_color(sibling->child[side], TRBT_BLACK);
+			link_set_color(sibling, TRBT_RED);
+			link_rotate(root, sibling, side);
+			sibling = parent->child[!side];
+		}
+		link_set_color(sibling, parent->parent_color & 1);
+		link_set_color(parent, TRBT_BLACK);
+		link_set_color(sibling->child[!side], TRBT_BLACK);
+		link_rotate(root, parent, !side);
+		return;
+	}
+	if (link) {
+		link_set_color(link, TRBT_BLACK);
+	}
+}
+
+void
+trbt_link_delete(trbt_root_t *root, trbt_link_t *link)
+{
+	trbt_link_t *parent = link_parent(link);
+	trbt_link_t *child, *next;
+	int color = link->parent_color & 1;
+	int side;
+
+	if (link->child[0] == NULL || link->child[1] == NULL) {
+		child = link->child[link->child[0] == NULL];
+		side = parent && parent->child[1] == link;
+		link_replace(root, parent, link, child);
+		if (child) {
+			link_set_parent(child, parent);
+		}
+	} else {
+		/* swap in the next link, which has no left child */
+		next = link->child[1];
+		while (next->child[0]) {
+			next = next->child[0];
+		}
+		color = next->parent_color & 1;
+		child = next->child[1];
+		if (link_parent(next) == link) {
+			parent = next;
+			side = 1;
+		} else {
+			parent = link_parent(next);
+			side = 0;
+			parent->child[0] = child;
+			if (child) {
+				link_set_parent(child, parent);
+			}
+			next->child[1] = link->child[1];
+			link_set_parent(next->child[1], next);
+		}
+		next->child[0] = link->child[0];
+		link_set_parent(next->child[0], next);
+		next->parent_color = link->parent_color;
+		link_replace(root, link_parent(link), link, next);
+	}
+
+	if (color == TRBT_BLACK) {
+		link_delete_fixup(root, child, parent, side);
+	}
+}
+
+static trbt_link_t *
+link_extreme(trbt_link_t *link, int side)
+{
+	if (link) {
+		while (link->child[side]) {
+			link = link->child[side];
+		}
+	}
+	return link;
+}
+
+static trbt_link_t *
+link_step(const trbt_link_t *link, int side)
+{
+	trbt_link_t *parent;
+
+	if (link->child[side]) {
+		return link_extreme(link->child[side], !side);
+	}
+	while ((parent = link_parent(link)) && parent->child[side] == link) {
+		link = parent;
+	}
+	return parent;
+}
+
+trbt_link_t *
+trbt_root_first(const trbt_root_t *root)
+{
+	return link_extreme(root->root, 0);
+}
+
+trbt_link_t *
+trbt_root_last(const trbt_root_t *root)
+{
+	return link_extreme(root->root, 1);
+}
+
+trbt_link_t *
+trbt_link_next(const trbt_link_t *link)
+{
+	return link_step(link, 1);
+}
+
+trbt_link_t *
+trbt_link_prev(const trbt_link_t *link)
+{
+	return link_step(link, 0);
+}
+
+/* Black links on the way down to a leaf, including this one */
+static int
+link_black_height(const trbt_link_t *link)
+{
+	int height = 0;
+
+	for (; link; link = link->child[0]) {
+		height += !link_is_red(link);
+	}
+	return height;
+}
+
+/* Make left hold left, then pivot, then right; right is emptied.
+   Takes the black heights of each (counting the roots as black) and
+   returns the black height of the result.
+
+   Walk down the inside edge of the taller tree until we find a black
+   subtree as high as the other tree, and put pivot there (red) with
+   those two either side of it.  Then it's just like an insert.
+*/
+static int
+link_join(trbt_root_t *left, int left_height, trbt_link_t *pivot,
+	  trbt_root_t *right, int right_height)
+{
+	trbt_root_t *tall, *shrt;
+	trbt_link_t *parent = NULL, *link;
+	int height, target, side;
+
+	if (left->root) {
+		link_set_color(left->root, TRBT_BLACK);
+	}
+	if (right->root) {
+		link_set_color(right->root, TRBT_BLACK);
+	}
+	if (left_height >= right_height) {
+		tall = left;
+		shrt = right;
+		height = left_height;
+		target = right_height;
+		side = 1;
+	} else {
+		tall = right;
+		shrt = left;
+		height = right_height;
+		target = left_height;
+		side = 0;
+	}
+
+	link = tall->root;
+	while (height > target || link_is_red(link)) {
+		height -= !link_is_red(link);
+		parent = link;
+		link = link->child[side];
+	}
+
+	pivot->child[!side] = link;
+	if (link) {
+		link_set_parent(link, pivot);
+	}
+	pivot->child[side] = shrt->root;
+	if (shrt->root) {
+		link_set_parent(shrt->root, pivot);
+	}
+	pivot->parent_color = (uintptr_t)parent | TRBT_RED;
+	if (parent) {
+		parent->child[side] = pivot;
+	} else {
+		tall->root = pivot;
+	}
+
+	left->root = tall->root;
+	right->root = NULL;
+	height = left_height > right_height ? left_height : right_height;
+	return height + link_insert_fixup(left, pivot);
+}
+
+void
+trbt_root_join(trbt_root_t *left, trbt_root_t *right)
+{
+	trbt_link_t *pivot;
+
+	if (right->root == NULL) {
+		return;
+	}
+	if (left->root == NULL) {
+		left->root = right->root;
+		right->root = NULL;
+		return;
+	}
+	pivot = trbt_root_first(right);
+	trbt_link_delete(right, pivot);
+	/* roots are black, so the leftmost path is as good as any */
+	link_join(left, link_black_height(left->root),
+		  pivot, right, link_black_height(right->root));
+}
+
+/* Take a subtree out on its own */
+static trbt_root_t
+link_detach(trbt_link_t *link)
+{
+	trbt_root_t root = { link };
+
+	if (link) {
+		link_set_parent(link, NULL);
+	}
+	return root;
+}
+
+/* Walk up from link: each ancestor we're left of joins the right tree
+   along with its right subtree, and each we're right of joins the left
+   tree with its left subtree.  Keeping track of the black heights on
+   the way up, rather than measuring each tree, the joins' walks add up
+   to O(log n).
+*/
+void
+trbt_root_split(trbt_root_t *root, trbt_link_t *link, trbt_root_t *right)
+{
+	trbt_root_t left, sub;
+	trbt_link_t *parent;
+	int height, left_height, right_height, sub_height, black, side, up;
+
+	right->root = NULL;
+	if (link == NULL) {
+		return;
+	}
+
+	/* height is that of the subtree we just came up from (and so its
+	   sibling's), in the original colors */
+	height = link_black_height(link);
+	black = !link_is_red(link);
+	parent = link_parent(link);
+	side = parent && parent->child[1] == link;
+	left = link_detach(link->child[0]);
+	left_height = height - black + link_is_red(left.root);
+	sub = link_detach(link->child[1]);
+	sub_height = height - black + link_is_red(sub.root);
+	right_height = link_join(right, 0, link, &sub, sub_height);
+
+	while (parent) {
+		link = parent;
+		parent = link_parent(link);
+		up = parent && parent->child[1] == link;
+		black = !link_is_red(link);
+		if (side == 0) {
+			sub = link_detach(link->child[1]);
+			sub_height = height + link_is_red(sub.root);
+			right_height = link_join(right, right_height,
+						 link, &sub, sub_height);
+		} else {
+			sub = link_detach(link->child[0]);
+			sub_height = height + link_is_red(sub.root);
+			left_height = link_join(&sub, sub_height,
+						link, &left, left_height);
+			left = sub;
+		}
+		height += black;
+		side = up;
+	}
+	/* left may still be a subtree with a red root */
+	if (left.root) {
+		link_set_color(left.root, TRBT_BLACK);
+	}
+	root->root = left.root;
+}
+
+/* Halve recursively.  Every path down then ends at red_depth or the
+   level above it, so coloring the links at red_depth red (and the rest
+   black) keeps the black heights equal.
+*/
+static trbt_link_t *
+link_build(void *const *objs, size_t num, size_t offset,
+	   trbt_link_t *parent, int depth, int red_depth)
+{
+	trbt_link_t *link;
+	size_t mid = num / 2;
+
+	if (num == 0) {
+		return NULL;
+	}
+	link = (trbt_link_t *)((char *)objs[mid] + offset);
+	link->parent_color = (uintptr_t)parent
+		| (depth == red_depth ? TRBT_RED : TRBT_BLACK);
+	link->child[0] = link_build(objs, mid, offset,
+				    link, depth + 1, red_depth);
+	link->child[1] = link_build(objs + mid + 1, num - mid - 1, offset,
+				    link, depth + 1, red_depth);
+	return link;
+}
+
+void
+trbt_root_build(trbt_root_t *root, void *const *objs, size_t num,
+		size_t offset)
+{
+	int red_depth = 0;
+
+	/* The deepest level holds up to 2^red_depth links */
+	while (((size_t)2 << red_depth) - 1 < num) {
+		red_depth++;
+	}
+	root->root = link_build(objs, num, offset, NULL, 0, red_depth);
+	if (root->root) {
+		link_set_color(root->root, TRBT_BLACK);
+	}
+}
+
+static int
+link_check(const trbt_link_t *link, const trbt_link_t *parent)
+{
+	int left, right;
+
+	if (link == NULL) {
+		return 0;
+	}
+	if (link_parent(link) != parent) {
+		return -1;
+	}
+	if (link_is_red(link)
+	    && (link_is_red(link->child[0]) || link_is_red(link->child[1]))) {
+		return -1;
+	}
+	left = link_check(link->child[0], link);
+	right = link_check(link->child[1], link);
+	if (left < 0 || left != right) {
+		return -1;
+	}
+	return left + !link_is_red(link);
+}
+
+int
+trbt_root_check(const trbt_root_t *root)
+{
+	if (link_is_red(root->root)) {
+		return -1;
+	}
+	return link_check(root->root, NULL);
+}
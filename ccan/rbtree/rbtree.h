@@ -18,6 +18,7 @@
 */
 #ifndef CCAN_RBTREE_H
 #define CCAN_RBTREE_H
+#include <stddef.h>
 #include <stdint.h>
 #include <ccan/talloc/talloc.h>
 
@@ -83,4 +84,66 @@ void trbt_traversearray32(trbt_tree_t *tree, uint32_t keylen, void (*callback)(v
    and return a pointer to data or NULL */
 void *trbt_findfirstarray32(trbt_tree_t *tree, uint32_t keylen);
 
+
+/* Intrusive trees: the caller embeds a trbt_link_t in each of its objects
+   and nothing is allocated, so there's no talloc involved.  The tree
+   doesn't know the keys: find where the link goes (see rbtree_type.h's
+   TRBT_DEFINE_TYPE, which does that with an inlined comparison) and then
+   call trbt_link_insert().
+*/
+typedef struct trbt_link {
+	/* parent pointer | TRBT_RED or TRBT_BLACK */
+	uintptr_t parent_color;
+	/* left, right */
+	struct trbt_link *child[2];
+} trbt_link_t;
+
+typedef struct trbt_root {
+	trbt_link_t *root;
+} trbt_root_t;
+
+#define TRBT_ROOT_INIT { NULL }
+
+/* Insert link as the left (side 0) or right (side 1) child of parent,
+   which must be empty there, and rebalance.  parent is NULL if the tree
+   is empty.
+*/
+void trbt_link_insert(trbt_root_t *root, trbt_link_t *link,
+		      trbt_link_t *parent, int side);
+
+/* Remove link from the tree and rebalance */
+void trbt_link_delete(trbt_root_t *root, trbt_link_t *link);
+
+/* The first/last link in the tree, or NULL if it is empty */
+trbt_link_t *trbt_root_first(const trbt_root_t *root);
+trbt_link_t *trbt_root_last(const trbt_root_t *root);
+
+/* The next/previous link in order, or NULL */
+trbt_link_t *trbt_link_next(const trbt_link_t *link);
+trbt_link_t *trbt_link_prev(const trbt_link_t *link);
+
+/* Move everything in right onto the end of left, leaving right empty.
+   Everything in right must sort after everything in left.
+   O(log n).
+*/
+void trbt_root_join(trbt_root_t *left, trbt_root_t *right);
+
+/* Move link and everything after it from root into right, which is
+   overwritten.  If link is NULL, right is left empty.
+   O(log n).
+*/
+void trbt_root_split(trbt_root_t *root, trbt_link_t *link, trbt_root_t *right);
+
+/* Build a tree from num objects which are already in order, replacing
+   whatever root held.  Each object's link is offset bytes into it.
+   O(num).
+*/
+void trbt_root_build(trbt_root_t *root, void *const *objs, size_t num,
+		     size_t offset);
+
+/* Check the colors and parent pointers, for testing.  Returns the black
+   height of the tree, or -1 if it is broken.
+*/
+int trbt_root_check(const trbt_root_t *root);
+
 #endif /* CCAN_RBTREE_H */
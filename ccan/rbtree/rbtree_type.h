@@ -0,0 +1,259 @@
+/* Licensed under GPLv3+ - see LICENSE file for details */
+#ifndef CCAN_RBTREE_TYPE_H
+#define CCAN_RBTREE_TYPE_H
+#include "config.h"
+#include <ccan/rbtree/rbtree.h>
+#include <ccan/compiler/compiler.h>
+#include <ccan/container_of/container_of.h>
+#include <stdbool.h>
+
+/**
+ * TRBT_DEFINE_TYPE - create a typed, intrusive red-black tree
+ * @type: the element type, which contains a trbt_link_t
+ * @member: the name of the trbt_link_t within @type
+ * @keyof: a function/macro to extract a key: <keytype> @keyof(const type *elem)
+ * @cmpfn: a comparison function: int @cmpfn(const type *elem, const <keytype> k)
+ * @name: a prefix for the tree type and all the functions to define
+ *
+ * Unlike trbt_insert32(), nothing is allocated: elements are linked
+ * through their @member, so they must stay put while they're in the
+ * tree.  Keys can be anything @cmpfn can compare, and @cmpfn (which
+ * returns less than, equal to or greater than zero if @elem sorts
+ * before, with or after @k) is inlined into the searches.
+ *
+ * Without typeof, <keytype> is assumed to be a pointer, unless you
+ * define TRBT_KTYPE(keyof, type) yourself.
+ *
+ * This defines the tree type:
+ *	struct <name>;
+ *
+ * Initialization (or use TRBT_ROOT_INIT):
+ *	void <name>_init(struct <name> *);
+ *	bool <name>_empty(const struct <name> *);
+ *
+ * Add fails (returning false) if an element with that key is there:
+ *	bool <name>_add(struct <name> *t, type *e);
+ *
+ * Delete an element which is in the tree, or one by key (returning it,
+ * or NULL if there's none):
+ *	void <name>_del(struct <name> *t, type *e);
+ *	type *<name>_delkey(struct <name> *t, const <keytype> k);
+ *
+ * Find an element, the first not before a key, or the first after it
+ * (or NULL):
+ *	type *<name>_get(const struct <name> *t, const <keytype> k);
+ *	type *<name>_lower_bound(const struct <name> *t, const <keytype> k);
+ *	type *<name>_upper_bound(const struct <name> *t, const <keytype> k);
+ *
+ * In-order iteration (each returns NULL at the end):
+ *	type *<name>_first(const struct <name> *t);
+ *	type *<name>_last(const struct <name> *t);
+ *	type *<name>_next(const struct <name> *t, const type *e);
+ *	type *<name>_prev(const struct <name> *t, const type *e);
+ *
+ * Bulk operations.  Join moves all of @src (which must all sort after
+ * @t's elements) onto the end of @t; split moves every element not
+ * before @k into @right; both are O(log n).  Build fills an empty tree
+ * from an array sorted by key in O(n), or fails if it isn't sorted:
+ *	void <name>_join(struct <name> *t, struct <name> *src);
+ *	void <name>_split(struct <name> *t, const <keytype> k,
+ *			  struct <name> *right);
+ *	bool <name>_build(struct <name> *t, type *const *elems, size_t num);
+ *
+ * And for testing, check the tree's shape and order:
+ *	bool <name>_check(const struct <name> *t);
+ *
+ * Example:
+ *	#include <ccan/rbtree/rbtree_type.h>
+ *	#include <stdint.h>
+ *	#include <stdio.h>
+ *
+ *	struct extent {
+ *		uint64_t start, len;
+ *		trbt_link_t link;
+ *	};
+ *
+ *	static inline uint64_t extent_start(const struct extent *e)
+ *	{
+ *		return e->start;
+ *	}
+ *
+ *	static inline int extent_cmp(const struct extent *e, uint64_t start)
+ *	{
+ *		return (e->start > start) - (e->start < start);
+ *	}
+ *
+ *	TRBT_DEFINE_TYPE(struct extent, link, extent_start, extent_cmp,
+ *			 extent_tree);
+ *
+ *	// Print the extents starting in [from, to).
+ *	static void print_range(const struct extent_tree *t,
+ *				uint64_t from, uint64_t to)
+ *	{
+ *		const struct extent *e;
+ *
+ *		for (e = extent_tree_lower_bound(t, from);
+ *		     e && e->start < to;
+ *		     e = extent_tree_next(t, e))
+ *			printf("%llu+%llu\n", (unsigned long long)e->start,
+ *			       (unsigned long long)e->len);
+ *	}
+ *
+ *	int main(void)
+ *	{
+ *		struct extent_tree t = { TRBT_ROOT_INIT };
+ *		struct extent e[3] = { { 0, 10 }, { 10, 5 }, { 100, 1 } };
+ *		struct extent *sorted[3] = { &e[0], &e[1], &e[2] };
+ *
+ *		if (!extent_tree_build(&t, sorted, 3))
+ *			return 1;
+ *		print_range(&t, 5, 100);
+ *		return 0;
+ *	}
+ */
+#define TRBT_DEFINE_TYPE(type, member, keyof, cmpfn, name)		\
+	struct name { trbt_root_t raw; };				\
+	static inline type *name##_elem_(const trbt_link_t *link)	\
+	{								\
+		return container_of_or_null((trbt_link_t *)link, type, member); \
+	}								\
+	static inline UNNEEDED void name##_init(struct name *t)		\
+	{								\
+		t->raw.root = NULL;					\
+	}								\
+	static inline UNNEEDED bool name##_empty(const struct name *t)	\
+	{								\
+		return t->raw.root == NULL;				\
+	}								\
+	static inline UNNEEDED bool name##_add(struct name *t, type *e)	\
+	{								\
+		const TRBT_KTYPE(keyof, type) k = keyof(e);		\
+		trbt_link_t *parent = NULL, *link = t->raw.root;	\
+		int side = 0;						\
+									\
+		while (link) {						\
+			int c = cmpfn(name##_elem_(link), k);		\
+			if (c == 0)					\
+				return false;				\
+			parent = link;					\
+			side = c < 0;					\
+			link = link->child[side];			\
+		}							\
+		trbt_link_insert(&t->raw, &e->member, parent, side);	\
+		return true;						\
+	}								\
+	static inline UNNEEDED void name##_del(struct name *t, type *e)	\
+	{								\
+		trbt_link_delete(&t->raw, &e->member);			\
+	}								\
+	static inline UNNEEDED type *name##_get(const struct name *t,	\
+					const TRBT_KTYPE(keyof, type) k) \
+	{								\
+		trbt_link_t *link = t->raw.root;			\
+									\
+		while (link) {						\
+			int c = cmpfn(name##_elem_(link), k);		\
+			if (c == 0)					\
+				return name##_elem_(link);		\
+			link = link->child[c < 0];			\
+		}							\
+		return NULL;						\
+	}								\
+	static inline UNNEEDED type *name##_delkey(struct name *t,	\
+					const TRBT_KTYPE(keyof, type) k) \
+	{								\
+		type *e = name##_get(t, k);				\
+		if (e)							\
+			name##_del(t, e);				\
+		return e;						\
+	}								\
+	/* First element with cmpfn >= 0 (lower) or > 0 (upper). */	\
+	static inline type *name##_bound_(const struct name *t,		\
+					  const TRBT_KTYPE(keyof, type) k, \
+					  int upper)			\
+	{								\
+		trbt_link_t *link = t->raw.root, *best = NULL;		\
+									\
+		while (link) {						\
+			if (cmpfn(name##_elem_(link), k) >= upper) {	\
+				best = link;				\
+				link = link->child[0];			\
+			} else						\
+				link = link->child[1];			\
+		}							\
+		return name##_elem_(best);				\
+	}								\
+	static inline UNNEEDED type *name##_lower_bound(const struct name *t, \
+					const TRBT_KTYPE(keyof, type) k) \
+	{								\
+		return name##_bound_(t, k, 0);				\
+	}								\
+	static inline UNNEEDED type *name##_upper_bound(const struct name *t, \
+					const TRBT_KTYPE(keyof, type) k) \
+	{								\
+		return name##_bound_(t, k, 1);				\
+	}								\
+	static inline UNNEEDED type *name##_first(const struct name *t)	\
+	{								\
+		return name##_elem_(trbt_root_first(&t->raw));		\
+	}								\
+	static inline UNNEEDED type *name##_last(const struct name *t)	\
+	{								\
+		return name##_elem_(trbt_root_last(&t->raw));		\
+	}								\
+	static inline UNNEEDED type *name##_next(const struct name *t,	\
+						 const type *e)		\
+	{								\
+		return name##_elem_(trbt_link_next(&e->member));	\
+	}								\
+	static inline UNNEEDED type *name##_prev(const struct name *t,	\
+						 const type *e)		\
+	{								\
+		return name##_elem_(trbt_link_prev(&e->member));	\
+	}								\
+	static inline UNNEEDED void name##_join(struct name *t,		\
+						struct name *src)	\
+	{								\
+		trbt_root_join(&t->raw, &src->raw);			\
+	}								\
+	static inline UNNEEDED void name##_split(struct name *t,	\
+					const TRBT_KTYPE(keyof, type) k, \
+					struct name *right)		\
+	{								\
+		type *e = name##_lower_bound(t, k);			\
+		trbt_root_split(&t->raw, e ? &e->member : NULL, &right->raw); \
+	}								\
+	static inline UNNEEDED bool name##_build(struct name *t,	\
+						 type *const *elems,	\
+						 size_t num)		\
+	{								\
+		size_t i;						\
+									\
+		for (i = 1; i < num; i++)				\
+			if (cmpfn(elems[i-1], keyof(elems[i])) >= 0)	\
+				return false;				\
+		trbt_root_build(&t->raw, (void *const *)elems, num,	\
+				offsetof(type, member));		\
+		return true;						\
+	}								\
+	static inline UNNEEDED bool name##_check(const struct name *t)	\
+	{								\
+		const type *e, *prev = NULL;				\
+									\
+		if (trbt_root_check(&t->raw) < 0)			\
+			return false;					\
+		for (e = name##_first(t); e; prev = e, e = name##_next(t, e)) \
+			if (prev && cmpfn(prev, keyof(e)) >= 0)		\
+				return false;				\
+		return true;						\
+	}
+
+#if HAVE_TYPEOF
+#define TRBT_KTYPE(keyof, type) typeof(keyof((const type *)NULL))
+#else
+/* Assumes keys are a pointer: if not, override. */
+#ifndef TRBT_KTYPE
+#define TRBT_KTYPE(keyof, type) void *
+#endif
+#endif
+#endif /* CCAN_RBTREE_TYPE_H */
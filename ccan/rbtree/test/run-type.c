@@ -0,0 +1,203 @@
+#include <ccan/rbtree/rbtree_type.h>
+#include <ccan/rbtree/rbtree.c>
+#include <ccan/tap/tap.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NUM 3000
+
+struct elem {
+	trbt_link_t link;
+	uint64_t key;
+};
+
+/* Keys are pointers, so this works without typeof too. */
+static inline const uint64_t *elem_key(const struct elem *e)
+{
+	return &e->key;
+}
+
+static inline int elem_cmp(const struct elem *e, const uint64_t *key)
+{
+	return (e->key > *key) - (e->key < *key);
+}
+
+TRBT_DEFINE_TYPE(struct elem, link, elem_key, elem_cmp, elem_tree);
+
+#define K(k) (&(const uint64_t){ (k) })
+
+static struct elem elems[NUM];
+static struct elem *sorted[NUM];
+static bool in_tree[NUM];
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+/* elems[i] has key 3 * i, and should be there iff in_tree[i]. */
+static bool tree_matches(const struct elem_tree *t)
+{
+	const struct elem *e = elem_tree_first(t);
+	size_t i;
+
+	for (i = 0; i < NUM; i++) {
+		if (!in_tree[i])
+			continue;
+		if (e != &elems[i])
+			return false;
+		e = elem_tree_next(t, e);
+	}
+	return e == NULL && elem_tree_check(t);
+}
+
+int main(void)
+{
+	struct elem_tree t, right;
+	const struct elem *e;
+	size_t i, j, bad, n;
+
+	plan_tests(24);
+
+	for (i = 0; i < NUM; i++) {
+		elems[i].key = 3 * i;
+		sorted[i] = &elems[i];
+	}
+
+	elem_tree_init(&t);
+	ok1(elem_tree_empty(&t));
+	ok1(elem_tree_first(&t) == NULL && elem_tree_last(&t) == NULL);
+
+	/* Random adds and deletes. */
+	bad = 0;
+	for (i = 0; i < NUM * 10; i++) {
+		j = rand32() % NUM;
+		if (rand32() % 3) {
+			if (elem_tree_add(&t, &elems[j]) == in_tree[j])
+				bad++;
+			in_tree[j] = true;
+		} else if (in_tree[j]) {
+			if (i % 2)
+				elem_tree_del(&t, &elems[j]);
+			else if (elem_tree_delkey(&t, K(3 * j)) != &elems[j])
+				bad++;
+			in_tree[j] = false;
+		} else if (elem_tree_delkey(&t, K(3 * j)) != NULL) {
+			bad++;
+		}
+		if (i % 101 == 0 && !elem_tree_check(&t))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(tree_matches(&t));
+
+	/* Bounds, between keys and on them. */
+	for (bad = 0, j = 0; j < NUM * 3; j++) {
+		const struct elem *lo = elem_tree_lower_bound(&t, K(j));
+		const struct elem *hi = elem_tree_upper_bound(&t, K(j));
+		for (i = (j + 2) / 3; i < NUM && !in_tree[i]; i++);
+		if (lo != (i < NUM ? &elems[i] : NULL))
+			bad++;
+		for (i = j / 3 + 1; i < NUM && !in_tree[i]; i++);
+		if (hi != (i < NUM ? &elems[i] : NULL))
+			bad++;
+		if (elem_tree_get(&t, K(j)) != (j % 3 == 0 && in_tree[j / 3]
+					       ? &elems[j / 3] : NULL))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(elem_tree_lower_bound(&t, K(3 * NUM)) == NULL);
+
+	/* Backwards. */
+	for (bad = 0, i = NUM, e = elem_tree_last(&t); i-- > 0;) {
+		if (!in_tree[i])
+			continue;
+		if (e != &elems[i])
+			bad++;
+		e = elem_tree_prev(&t, e);
+	}
+	ok1(bad == 0 && e == NULL);
+
+	/* Split at every possible key, then join back. */
+	for (bad = 0, j = 0; j < NUM * 3 + 3; j++) {
+		const struct elem *lo = elem_tree_lower_bound(&t, K(j));
+
+		elem_tree_split(&t, K(j), &right);
+		if (!elem_tree_check(&t) || !elem_tree_check(&right))
+			bad++;
+		if (elem_tree_first(&right) != lo)
+			bad++;
+		e = elem_tree_last(&t);
+		if (e && e->key >= j)
+			bad++;
+		elem_tree_join(&t, &right);
+		if (!elem_tree_empty(&right) || !elem_tree_check(&t))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(tree_matches(&t));
+
+	/* Building every size up to 200 gives a valid tree. */
+	for (bad = 0, n = 0; n <= 200; n++) {
+		elem_tree_init(&t);
+		if (!elem_tree_build(&t, sorted, n))
+			bad++;
+		for (i = 0; i < NUM; i++)
+			in_tree[i] = i < n;
+		if (!tree_matches(&t))
+			bad++;
+	}
+	ok1(bad == 0);
+
+	/* But not from unsorted input. */
+	elem_tree_init(&t);
+	sorted[5] = &elems[4];
+	ok1(!elem_tree_build(&t, sorted, 10));
+	ok1(elem_tree_empty(&t));
+	sorted[5] = &elems[5];
+
+	/* Join trees of very different heights, both ways round. */
+	elem_tree_build(&t, sorted, 7);
+	elem_tree_build(&right, sorted + 7, NUM - 7);
+	elem_tree_join(&t, &right);
+	for (i = 0; i < NUM; i++)
+		in_tree[i] = true;
+	ok1(tree_matches(&t));
+	ok1(elem_tree_empty(&right));
+
+	elem_tree_build(&t, sorted, NUM - 2);
+	elem_tree_build(&right, sorted + NUM - 2, 2);
+	elem_tree_join(&t, &right);
+	ok1(tree_matches(&t));
+
+	/* Joining with an empty tree is a no-op. */
+	elem_tree_join(&t, &right);
+	ok1(tree_matches(&t));
+	elem_tree_join(&right, &t);
+	ok1(elem_tree_empty(&t));
+	ok1(tree_matches(&right));
+
+	/* Splitting off everything, and nothing. */
+	elem_tree_split(&right, K(0), &t);
+	ok1(elem_tree_empty(&right));
+	ok1(tree_matches(&t));
+	elem_tree_split(&t, K(3 * NUM), &right);
+	ok1(elem_tree_empty(&right));
+	ok1(tree_matches(&t));
+
+	/* Take the tree apart from a built one. */
+	for (bad = 0, i = 0; i < NUM; i++) {
+		elem_tree_del(&t, &elems[(i * 7) % NUM]);
+		in_tree[(i * 7) % NUM] = false;
+		if (i % 97 == 0 && !tree_matches(&t))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(elem_tree_empty(&t));
+
+	return exit_status();
+}
@@ -0,0 +1,168 @@
+/*
+ * Speed tests for TRBT_DEFINE_TYPE against trbt_* with 64-bit keys.
+ *
+ * trbt only has 32-bit keys, so 64-bit keys go through the array32
+ * calls (a tree of trees); trbt_insert32 on the low half of each key is
+ * shown too, as the best trbt can do.
+ *
+ * Usage: speed [entries]
+ */
+#include <ccan/rbtree/rbtree.h>
+#include <ccan/rbtree/rbtree_type.h>
+#include <ccan/talloc/talloc.h>
+#include <ccan/time/time.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Nanoseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_nsec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ns\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+struct entry {
+	uint64_t key;
+	trbt_link_t link;
+};
+
+static inline uint64_t entry_key(const struct entry *e)
+{
+	return e->key;
+}
+
+static inline int entry_cmp(const struct entry *e, uint64_t key)
+{
+	return (e->key > key) - (e->key < key);
+}
+
+TRBT_DEFINE_TYPE(struct entry, link, entry_key, entry_cmp, etree);
+
+static uint64_t rand64(void)
+{
+	return ((uint64_t)random() << 33) ^ ((uint64_t)random() << 11)
+		^ random();
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct entry *x = *(struct entry **)a, *y = *(struct entry **)b;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static void *store(void *param, void *data)
+{
+	return param;
+}
+
+static size_t sum;
+
+static void add_up(void *param, void *data)
+{
+	sum++;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t i, num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	struct entry *entries = calloc(num, sizeof(*entries)), *e;
+	struct entry **sorted = malloc(num * sizeof(*sorted));
+	size_t *order = malloc(num * sizeof(*order));
+	void **data = malloc(num * sizeof(*data));
+	void *ctx = talloc_new(NULL);
+	trbt_tree_t *t32 = trbt_create(ctx, 0), *t64 = trbt_create(ctx, 0);
+	struct etree t = { TRBT_ROOT_INIT }, right;
+	uint32_t k[2];
+
+	for (i = 0; i < num; i++) {
+		entries[i].key = rand64();
+		sorted[i] = &entries[i];
+		order[i] = random() % num;
+	}
+	qsort(sorted, num, sizeof(*sorted), cmp_entry);
+
+	printf("%zu entries:\n", num);
+	TIME("trbt_insert32 (32-bit)", num,
+	     for (i = 0; i < num; i++)
+		     trbt_insert32(t32, (uint32_t)entries[i].key,
+				   talloc_size(ctx, 1)));
+	TIME("trbt_insertarray32_callback", num,
+	     for (i = 0; i < num; i++) {
+		     k[0] = entries[i].key >> 32;
+		     k[1] = entries[i].key;
+		     data[i] = talloc_size(ctx, 1);
+		     trbt_insertarray32_callback(t64, 2, k, store, data[i]);
+	     });
+	TIME("etree_add", num,
+	     for (i = 0; i < num; i++)
+		     etree_add(&t, &entries[i]));
+
+	TIME("trbt_lookup32 (32-bit)", num,
+	     for (i = 0; i < num; i++)
+		     sum += !!trbt_lookup32(t32, (uint32_t)entries[order[i]].key));
+	TIME("trbt_lookuparray32", num,
+	     for (i = 0; i < num; i++) {
+		     k[0] = entries[order[i]].key >> 32;
+		     k[1] = entries[order[i]].key;
+		     sum += !!trbt_lookuparray32(t64, 2, k);
+	     });
+	TIME("etree_get", num,
+	     for (i = 0; i < num; i++)
+		     sum += !!etree_get(&t, entries[order[i]].key));
+
+	TIME("trbt_traversearray32", num,
+	     trbt_traversearray32(t64, 2, add_up, NULL));
+	TIME("etree_first/etree_next", num,
+	     for (e = etree_first(&t); e; e = etree_next(&t, e))
+		     sum++);
+	TIME("etree_lower_bound + 10 next", num,
+	     for (i = 0; i < num; i++) {
+		     int n;
+		     e = etree_lower_bound(&t, entries[order[i]].key);
+		     for (n = 0; e && n < 10; n++, e = etree_next(&t, e))
+			     sum++;
+	     });
+
+	TIME("etree_split + etree_join", num,
+	     for (i = 0; i < num; i++) {
+		     etree_split(&t, entries[order[i]].key, &right);
+		     etree_join(&t, &right);
+	     });
+
+	TIME("trbt_delete32 (32-bit)", num,
+	     for (i = 0; i < num; i++)
+		     trbt_delete32(t32, (uint32_t)entries[i].key));
+	TIME("etree_del", num,
+	     for (i = 0; i < num; i++)
+		     etree_del(&t, &entries[i]));
+
+	TIME("etree_build (from sorted)", num,
+	     etree_build(&t, sorted, num));
+	TIME("etree_add (sorted)", num,
+	     etree_init(&t);
+	     for (i = 0; i < num; i++)
+		     etree_add(&t, sorted[i]));
+
+	if (!sum)
+		printf("(sum %zu)\n", sum);
+	talloc_free(ctx);
+	free(data);
+	free(order);
+	free(sorted);
+	free(entries);
+	return 0;
+}
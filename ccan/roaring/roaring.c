@@ -0,0 +1,1368 @@
+/* Licensed under LGPLv2.1+ - see LICENSE file for details */
+#include <ccan/roaring/roaring.h>
+#include <ccan/bitmap/bitmap.h>
+#include <ccan/endian/endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_BITS	65536
+#define BITSET_BYTES	(CHUNK_BITS / CHAR_BIT)
+#define BITSET_WORDS	BITMAP_NWORDS(CHUNK_BITS)
+/* Above this, an array is bigger than a bitset. */
+#define ARRAY_MAX	(BITSET_BYTES / sizeof(uint16_t))
+#define ALL_ONES	((bitmap_word)-1)
+
+#define ROARING_MAGIC	0x31414f52	/* "ROA1" */
+
+enum chunk_type { ARRAY, BITSET, RUN };
+
+/* Inclusive, so one run can cover a whole chunk. */
+struct roaring_run {
+	uint16_t start, last;
+};
+
+/*
+ * The ids whose top 16 bits are key.  Arrays and runs are sorted, runs
+ * never touch, and an array never has more than ARRAY_MAX entries.
+ */
+struct roaring_chunk {
+	uint16_t key;
+	uint8_t type;
+	/* Number of ids: 1 to CHUNK_BITS. */
+	uint32_t card;
+	/* Entries used and allocated, for arrays and runs. */
+	uint32_t len, cap;
+	union {
+		uint16_t *array;
+		bitmap *bits;
+		struct roaring_run *runs;
+		void *mem;
+	} u;
+};
+
+enum op { AND, OR, XOR, ANDNOT };
+
+static unsigned int word_clz(bitmap_word w)
+{
+#if HAVE_BUILTIN_CLZL
+	return __builtin_clzl(w);
+#else
+	unsigned int lz = 0;
+
+	while (!(w & ((bitmap_word)1 << (BITMAP_WORD_BITS - 1)))) {
+		lz++;
+		w <<= 1;
+	}
+	return lz;
+#endif
+}
+
+static unsigned int word_popcount(bitmap_word w)
+{
+#if HAVE_BUILTIN_POPCOUNTL
+	return __builtin_popcountl(w);
+#else
+	unsigned int n = 0;
+
+	while (w) {
+		w &= w - 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static size_t run_bytes(uint32_t len)
+{
+	return len * sizeof(struct roaring_run);
+}
+
+static size_t array_bytes(uint32_t card)
+{
+	return card * sizeof(uint16_t);
+}
+
+/*
+ * Bitset helpers.  These use ccan/bitmap's layout, whose bytes are the
+ * same on every machine, so bitsets serialize as they are.
+ */
+
+/* First bit from @from which is set (invert 0) or clear (invert ~0). */
+static uint32_t bits_scan(const bitmap *bits, uint32_t from,
+			  bitmap_word invert)
+{
+	size_t i = from / BITMAP_WORD_BITS;
+	bitmap_word w;
+
+	if (from >= CHUNK_BITS)
+		return CHUNK_BITS;
+
+	w = (bitmap_bswap(bits[i].w) ^ invert)
+		& (ALL_ONES >> (from % BITMAP_WORD_BITS));
+	while (!w) {
+		if (++i == BITSET_WORDS)
+			return CHUNK_BITS;
+		w = bitmap_bswap(bits[i].w) ^ invert;
+	}
+	return i * BITMAP_WORD_BITS + word_clz(w);
+}
+
+static void bits_from_chunk(const struct roaring_chunk *c, bitmap *bits)
+{
+	uint32_t i;
+
+	if (c->type == BITSET) {
+		bitmap_copy(bits, c->u.bits, CHUNK_BITS);
+		return;
+	}
+	bitmap_zero(bits, CHUNK_BITS);
+	if (c->type == ARRAY) {
+		for (i = 0; i < c->len; i++)
+			bitmap_set_bit(bits, c->u.array[i]);
+	} else {
+		for (i = 0; i < c->len; i++)
+			bitmap_fill_range(bits, c->u.runs[i].start,
+					  c->u.runs[i].last + 1);
+	}
+}
+
+/* Every value in a (non-array) chunk, in order. */
+static void values_from_chunk(const struct roaring_chunk *c, uint16_t *out)
+{
+	uint32_t i, v, n = 0;
+
+	if (c->type == BITSET) {
+		for (v = bits_scan(c->u.bits, 0, 0); v < CHUNK_BITS;
+		     v = bits_scan(c->u.bits, v + 1, 0))
+			out[n++] = v;
+	} else {
+		for (i = 0; i < c->len; i++)
+			for (v = c->u.runs[i].start; v <= c->u.runs[i].last; v++)
+				out[n++] = v;
+	}
+}
+
+static uint32_t count_runs(const struct roaring_chunk *c)
+{
+	uint32_t i, v, n = 0;
+
+	switch (c->type) {
+	case ARRAY:
+		for (i = 1, n = 1; i < c->len; i++)
+			n += (c->u.array[i] != c->u.array[i-1] + 1);
+		return n;
+	case BITSET:
+		for (v = bits_scan(c->u.bits, 0, 0); v < CHUNK_BITS; n++)
+			v = bits_scan(c->u.bits,
+				      bits_scan(c->u.bits, v, ALL_ONES), 0);
+		return n;
+	}
+	return c->len;
+}
+
+static void runs_from_chunk(const struct roaring_chunk *c,
+			    struct roaring_run *runs)
+{
+	uint32_t i, v, n = 0;
+
+	if (c->type == ARRAY) {
+		for (i = 0; i < c->len; i++) {
+			if (n && runs[n-1].last + 1 == c->u.array[i])
+				runs[n-1].last++;
+			else
+				runs[n++] = (struct roaring_run){ c->u.array[i],
+								  c->u.array[i] };
+		}
+	} else {
+		for (v = bits_scan(c->u.bits, 0, 0); v < CHUNK_BITS; n++) {
+			runs[n].start = v;
+			v = bits_scan(c->u.bits, v, ALL_ONES);
+			runs[n].last = v - 1;
+			v = bits_scan(c->u.bits, v, 0);
+		}
+	}
+}
+
+/*
+ * Chunk memory.
+ */
+static bool chunk_alloc(struct roaring_chunk *c, enum chunk_type type,
+			uint32_t cap)
+{
+	size_t size;
+
+	if (type == ARRAY)
+		size = array_bytes(cap);
+	else if (type == RUN)
+		size = run_bytes(cap);
+	else
+		size = BITSET_BYTES;
+
+	c->u.mem = malloc(size ? size : 1);
+	if (!c->u.mem)
+		return false;
+	c->type = type;
+	c->card = c->len = 0;
+	c->cap = cap;
+	return true;
+}
+
+static bool chunk_reserve(struct roaring_chunk *c, uint32_t len)
+{
+	uint32_t cap = c->cap * 2;
+	void *mem;
+
+	if (len <= c->cap)
+		return true;
+	if (cap < len)
+		cap = len;
+	mem = realloc(c->u.mem, c->type == ARRAY ? array_bytes(cap)
+		      : run_bytes(cap));
+	if (!mem)
+		return false;
+	c->u.mem = mem;
+	c->cap = cap;
+	return true;
+}
+
+/* Replace c's contents with a new representation. */
+static bool chunk_convert(struct roaring_chunk *c, enum chunk_type type)
+{
+	struct roaring_chunk n = *c;
+
+	if (!chunk_alloc(&n, type,
+			 type == ARRAY ? c->card
+			 : type == RUN ? count_runs(c) : 0))
+		return false;
+	n.card = c->card;
+	n.len = n.cap;
+	if (type == BITSET)
+		bits_from_chunk(c, n.u.bits);
+	else if (type == ARRAY)
+		values_from_chunk(c, n.u.array);
+	else
+		runs_from_chunk(c, n.u.runs);
+	free(c->u.mem);
+	*c = n;
+	return true;
+}
+
+/*
+ * Pick the smallest of array and bitset (and runs, if it's already
+ * runs).  Only failing to make an overfull array a bitset is an error:
+ * otherwise the chunk is still fine, just bigger than it could be.
+ */
+static bool chunk_fix(struct roaring_chunk *c)
+{
+	size_t best;
+
+	switch (c->type) {
+	case ARRAY:
+		if (c->card > ARRAY_MAX)
+			return chunk_convert(c, BITSET);
+		break;
+	case BITSET:
+		if (c->card <= ARRAY_MAX)
+			chunk_convert(c, ARRAY);
+		break;
+	case RUN:
+		best = c->card <= ARRAY_MAX ? array_bytes(c->card)
+			: BITSET_BYTES;
+		if (run_bytes(c->len) > best)
+			chunk_convert(c, c->card <= ARRAY_MAX ? ARRAY : BITSET);
+		break;
+	}
+	return true;
+}
+
+static bool chunk_copy(struct roaring_chunk *dst,
+		       const struct roaring_chunk *src)
+{
+	size_t size;
+
+	*dst = *src;
+	if (src->type == BITSET)
+		size = BITSET_BYTES;
+	else if (src->type == ARRAY)
+		size = array_bytes(src->len);
+	else
+		size = run_bytes(src->len);
+	dst->cap = src->len;
+	dst->u.mem = malloc(size);
+	if (!dst->u.mem)
+		return false;
+	memcpy(dst->u.mem, src->u.mem, size);
+	return true;
+}
+
+/* First index with array[i] >= v. */
+static uint32_t array_lower_bound(const uint16_t *array, uint32_t len,
+				  uint32_t v)
+{
+	uint32_t lo = 0, hi = len;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (array[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* First index with runs[i].last >= v. */
+static uint32_t run_lower_bound(const struct roaring_run *runs, uint32_t len,
+				uint32_t v)
+{
+	uint32_t lo = 0, hi = len;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (runs[mid].last < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static bool chunk_test(const struct roaring_chunk *c, uint32_t v)
+{
+	uint32_t i;
+
+	switch (c->type) {
+	case ARRAY:
+		i = array_lower_bound(c->u.array, c->len, v);
+		return i < c->len && c->u.array[i] == v;
+	case BITSET:
+		return bitmap_test_bit(c->u.bits, v);
+	}
+	i = run_lower_bound(c->u.runs, c->len, v);
+	return i < c->len && c->u.runs[i].start <= v;
+}
+
+static bool chunk_add(struct roaring_chunk *c, uint32_t v)
+{
+	struct roaring_run *runs;
+	uint32_t i;
+
+	switch (c->type) {
+	case ARRAY:
+		i = array_lower_bound(c->u.array, c->len, v);
+		if (i < c->len && c->u.array[i] == v)
+			return true;
+		if (c->len == ARRAY_MAX) {
+			if (!chunk_convert(c, BITSET))
+				return false;
+			bitmap_set_bit(c->u.bits, v);
+			break;
+		}
+		if (!chunk_reserve(c, c->len + 1))
+			return false;
+		memmove(c->u.array + i + 1, c->u.array + i,
+			array_bytes(c->len - i));
+		c->u.array[i] = v;
+		c->len++;
+		break;
+	case BITSET:
+		if (bitmap_test_bit(c->u.bits, v))
+			return true;
+		bitmap_set_bit(c->u.bits, v);
+		break;
+	case RUN:
+		i = run_lower_bound(c->u.runs, c->len, v);
+		if (i < c->len && c->u.runs[i].start <= v)
+			return true;
+		runs = c->u.runs;
+		if (i > 0 && runs[i-1].last + 1 == v) {
+			if (i < c->len && runs[i].start == v + 1) {
+				runs[i-1].last = runs[i].last;
+				memmove(runs + i, runs + i + 1,
+					run_bytes(c->len - i - 1));
+				c->len--;
+			} else
+				runs[i-1].last = v;
+		} else if (i < c->len && runs[i].start == v + 1) {
+			runs[i].start = v;
+		} else {
+			if (!chunk_reserve(c, c->len + 1))
+				return false;
+			memmove(c->u.runs + i + 1, c->u.runs + i,
+				run_bytes(c->len - i));
+			c->u.runs[i] = (struct roaring_run){ v, v };
+			c->len++;
+		}
+		c->card++;
+		return chunk_fix(c);
+	}
+	c->card++;
+	return true;
+}
+
+static bool chunk_remove(struct roaring_chunk *c, uint32_t v)
+{
+	struct roaring_run *run;
+	uint32_t i;
+
+	switch (c->type) {
+	case ARRAY:
+		i = array_lower_bound(c->u.array, c->len, v);
+		if (i == c->len || c->u.array[i] != v)
+			return true;
+		memmove(c->u.array + i, c->u.array + i + 1,
+			array_bytes(c->len - i - 1));
+		c->len--;
+		break;
+	case BITSET:
+		if (!bitmap_test_bit(c->u.bits, v))
+			return true;
+		bitmap_clear_bit(c->u.bits, v);
+		c->card--;
+		return chunk_fix(c);
+	case RUN:
+		i = run_lower_bound(c->u.runs, c->len, v);
+		if (i == c->len || c->u.runs[i].start > v)
+			return true;
+		run = &c->u.runs[i];
+		if (run->start == run->last) {
+			memmove(run, run + 1, run_bytes(c->len - i - 1));
+			c->len--;
+		} else if (run->start == v) {
+			run->start++;
+		} else if (run->last == v) {
+			run->last--;
+		} else {
+			if (!chunk_reserve(c, c->len + 1))
+				return false;
+			run = &c->u.runs[i];
+			memmove(run + 1, run, run_bytes(c->len - i));
+			run[0].last = v - 1;
+			run[1].start = v + 1;
+			c->len++;
+		}
+		break;
+	}
+	c->card--;
+	return true;
+}
+
+/*
+ * Operations between two chunks with the same key, into a new one.  On
+ * success, out->card may be 0, in which case there's nothing to free.
+ */
+
+/* Keep the values of an array which are (or aren't) in another chunk. */
+static bool chunk_filter(struct roaring_chunk *out,
+			 const struct roaring_chunk *a,
+			 const struct roaring_chunk *b, bool want)
+{
+	const uint16_t *av = a->u.array;
+	uint32_t i, j = 0, step, hi, n = 0;
+	uint16_t *o;
+
+	if (!chunk_alloc(out, ARRAY, a->len))
+		return false;
+	o = out->u.array;
+
+	switch (b->type) {
+	case ARRAY:
+		for (i = 0; i < a->len; i++) {
+			/* Gallop, for when b is much bigger than a. */
+			for (step = 1;
+			     j + step < b->len && b->u.array[j + step] < av[i];
+			     step *= 2)
+				j += step;
+			hi = j + step < b->len ? j + step : b->len;
+			j += array_lower_bound(b->u.array + j, hi - j, av[i]);
+			if ((j < b->len && b->u.array[j] == av[i]) == want)
+				o[n++] = av[i];
+		}
+		break;
+	case BITSET:
+		for (i = 0; i < a->len; i++)
+			if (bitmap_test_bit(b->u.bits, av[i]) == want)
+				o[n++] = av[i];
+		break;
+	case RUN:
+		for (i = 0; i < a->len; i++) {
+			while (j < b->len && b->u.runs[j].last < av[i])
+				j++;
+			if ((j < b->len && b->u.runs[j].start <= av[i]) == want)
+				o[n++] = av[i];
+		}
+		break;
+	}
+	out->card = out->len = n;
+	return true;
+}
+
+/* Branch-free, since which side comes next is unpredictable. */
+#define MERGE_LOOP(emit, keep)					\
+	while (i < a->len && j < b->len) {			\
+		uint16_t x = av[i], y = bv[j];			\
+		o[n] = (emit);					\
+		n += (keep);					\
+		i += (x <= y);					\
+		j += (y <= x);					\
+	}
+
+static bool array_merge(struct roaring_chunk *out,
+			const struct roaring_chunk *a,
+			const struct roaring_chunk *b, enum op op)
+{
+	const uint16_t *av = a->u.array, *bv = b->u.array;
+	uint32_t i = 0, j = 0, n = 0;
+	uint16_t *o;
+
+	/* This may be more than ARRAY_MAX: chunk_fix() sorts that out. */
+	if (!chunk_alloc(out, ARRAY, a->len + b->len))
+		return false;
+	o = out->u.array;
+
+	switch (op) {
+	case AND:
+		MERGE_LOOP(x, x == y);
+		break;
+	case OR:
+		MERGE_LOOP(x < y ? x : y, 1);
+		break;
+	case XOR:
+		MERGE_LOOP(x < y ? x : y, x != y);
+		break;
+	case ANDNOT:
+		MERGE_LOOP(x, x < y);
+		break;
+	}
+	if (op != AND)
+		while (i < a->len)
+			o[n++] = av[i++];
+	if (op == OR || op == XOR)
+		while (j < b->len)
+			o[n++] = bv[j++];
+
+	out->card = out->len = n;
+	return true;
+}
+
+/* Sweep over the boundaries of both sets of runs. */
+static bool runs_combine(struct roaring_chunk *out,
+			 const struct roaring_run *a, uint32_t na,
+			 const struct roaring_run *b, uint32_t nb,
+			 enum op op)
+{
+	uint32_t i = 0, j = 0, pos = 0, n = 0, card = 0;
+	struct roaring_run *o;
+
+	if (!chunk_alloc(out, RUN, na + nb + 1))
+		return false;
+	o = out->u.runs;
+
+	while (pos < CHUNK_BITS) {
+		uint32_t next_a, next_b, next;
+		bool in_a, in_b, in;
+
+		while (i < na && a[i].last < pos)
+			i++;
+		while (j < nb && b[j].last < pos)
+			j++;
+		in_a = i < na && a[i].start <= pos;
+		in_b = j < nb && b[j].start <= pos;
+		next_a = in_a ? a[i].last + 1U : i < na ? a[i].start : CHUNK_BITS;
+		next_b = in_b ? b[j].last + 1U : j < nb ? b[j].start : CHUNK_BITS;
+		next = next_a < next_b ? next_a : next_b;
+
+		switch (op) {
+		case AND: in = in_a && in_b; break;
+		case OR: in = in_a || in_b; break;
+		case XOR: in = in_a != in_b; break;
+		default: in = in_a && !in_b; break;
+		}
+		if (in) {
+			if (n && o[n-1].last + 1U == pos)
+				o[n-1].last = next - 1;
+			else
+				o[n++] = (struct roaring_run){ pos, next - 1 };
+			card += next - pos;
+		}
+		pos = next;
+	}
+	out->len = n;
+	out->card = card;
+	return true;
+}
+
+static bool runs_op(struct roaring_chunk *out,
+		    const struct roaring_chunk *a,
+		    const struct roaring_chunk *b, enum op op)
+{
+	const struct roaring_chunk *array;
+	struct roaring_run *runs;
+	uint32_t n;
+	bool ok;
+
+	array = a->type == ARRAY ? a : b->type == ARRAY ? b : NULL;
+	if (!array)
+		return runs_combine(out, a->u.runs, a->len,
+				    b->u.runs, b->len, op);
+
+	/* Make the array into runs first. */
+	n = count_runs(array);
+	runs = malloc(run_bytes(n));
+	if (!runs)
+		return false;
+	runs_from_chunk(array, runs);
+	if (array == a)
+		ok = runs_combine(out, runs, n, b->u.runs, b->len, op);
+	else
+		ok = runs_combine(out, a->u.runs, a->len, runs, n, op);
+	free(runs);
+	return ok;
+}
+
+static bool bits_op(struct roaring_chunk *out,
+		    const struct roaring_chunk *a,
+		    const struct roaring_chunk *b, enum op op)
+{
+	BITMAP_DECLARE(tmp, CHUNK_BITS);
+	const bitmap *bbits;
+	uint32_t i;
+
+	if (!chunk_alloc(out, BITSET, 0))
+		return false;
+	bits_from_chunk(a, out->u.bits);
+
+	/* Where it's simple, apply b's values directly. */
+	if (b->type == ARRAY && op != AND && op != XOR) {
+		for (i = 0; i < b->len; i++) {
+			if (op == OR)
+				bitmap_set_bit(out->u.bits, b->u.array[i]);
+			else
+				bitmap_clear_bit(out->u.bits, b->u.array[i]);
+		}
+		goto count;
+	}
+	if (b->type == RUN && op != AND && op != XOR) {
+		for (i = 0; i < b->len; i++) {
+			if (op == OR)
+				bitmap_fill_range(out->u.bits, b->u.runs[i].start,
+						  b->u.runs[i].last + 1);
+			else
+				bitmap_zero_range(out->u.bits, b->u.runs[i].start,
+						  b->u.runs[i].last + 1);
+		}
+		goto count;
+	}
+
+	if (b->type == BITSET)
+		bbits = b->u.bits;
+	else {
+		bits_from_chunk(b, tmp);
+		bbits = tmp;
+	}
+	switch (op) {
+	case AND:
+		bitmap_and(out->u.bits, out->u.bits, bbits, CHUNK_BITS);
+		break;
+	case OR:
+		bitmap_or(out->u.bits, out->u.bits, bbits, CHUNK_BITS);
+		break;
+	case XOR:
+		bitmap_xor(out->u.bits, out->u.bits, bbits, CHUNK_BITS);
+		break;
+	case ANDNOT:
+		bitmap_andnot(out->u.bits, out->u.bits, bbits, CHUNK_BITS);
+		break;
+	}
+
+count:
+	out->card = bitmap_weight(out->u.bits, 0, CHUNK_BITS);
+	return true;
+}
+
+static bool chunk_op(struct roaring_chunk *out,
+		     const struct roaring_chunk *a,
+		     const struct roaring_chunk *b, enum op op)
+{
+	bool ok;
+
+	out->key = a->key;
+	if (a->type == ARRAY && b->type == ARRAY
+	    && (op == OR || op == XOR
+		|| (a->len < b->len * 16 && b->len < a->len * 16)))
+		ok = array_merge(out, a, b, op);
+	else if (a->type == ARRAY && (op == AND || op == ANDNOT))
+		ok = chunk_filter(out, a, b, op == AND);
+	else if (b->type == ARRAY && op == AND)
+		ok = chunk_filter(out, b, a, true);
+	else if (a->type != BITSET && b->type != BITSET)
+		ok = runs_op(out, a, b, op);
+	else
+		ok = bits_op(out, a, b, op);
+
+	if (!ok)
+		return false;
+	if (out->card == 0) {
+		free(out->u.mem);
+		return true;
+	}
+	if (!chunk_fix(out)) {
+		free(out->u.mem);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * The set itself: chunks sorted by key.
+ */
+void roaring_init(struct roaring *r)
+{
+	r->num = r->max = 0;
+	r->chunks = NULL;
+}
+
+void roaring_free(struct roaring *r)
+{
+	size_t i;
+
+	for (i = 0; i < r->num; i++)
+		free(r->chunks[i].u.mem);
+	free(r->chunks);
+	roaring_init(r);
+}
+
+/* First chunk with key >= key. */
+static size_t chunk_index(const struct roaring *r, uint32_t key)
+{
+	size_t lo = 0, hi = r->num;
+
+	/* Ids are often added in increasing order. */
+	if (hi && r->chunks[hi - 1].key < key)
+		return hi;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (r->chunks[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static struct roaring_chunk *find_chunk(const struct roaring *r, uint32_t id)
+{
+	size_t i = chunk_index(r, id >> 16);
+
+	if (i < r->num && r->chunks[i].key == id >> 16)
+		return &r->chunks[i];
+	return NULL;
+}
+
+static bool chunks_reserve(struct roaring *r, size_t num)
+{
+	size_t max = r->max * 2;
+	struct roaring_chunk *chunks;
+
+	if (num <= r->max)
+		return true;
+	if (max < num)
+		max = num;
+	chunks = realloc(r->chunks, max * sizeof(*chunks));
+	if (!chunks)
+		return false;
+	r->chunks = chunks;
+	r->max = max;
+	return true;
+}
+
+/* Put a new chunk (which has its memory) in place. */
+static bool chunk_insert(struct roaring *r, size_t i,
+			 const struct roaring_chunk *c)
+{
+	if (!chunks_reserve(r, r->num + 1))
+		return false;
+	memmove(r->chunks + i + 1, r->chunks + i,
+		(r->num - i) * sizeof(r->chunks[0]));
+	r->chunks[i] = *c;
+	r->num++;
+	return true;
+}
+
+static void chunk_delete(struct roaring *r, size_t i)
+{
+	free(r->chunks[i].u.mem);
+	memmove(r->chunks + i, r->chunks + i + 1,
+		(r->num - i - 1) * sizeof(r->chunks[0]));
+	r->num--;
+}
+
+bool roaring_test(const struct roaring *r, uint32_t id)
+{
+	const struct roaring_chunk *c = find_chunk(r, id);
+
+	return c && chunk_test(c, id & 0xFFFF);
+}
+
+bool roaring_set(struct roaring *r, uint32_t id)
+{
+	size_t i = chunk_index(r, id >> 16);
+	struct roaring_chunk c;
+
+	if (i < r->num && r->chunks[i].key == id >> 16)
+		return chunk_add(&r->chunks[i], id & 0xFFFF);
+
+	if (!chunk_alloc(&c, ARRAY, 4))
+		return false;
+	c.key = id >> 16;
+	c.u.array[0] = id & 0xFFFF;
+	c.card = c.len = 1;
+	if (!chunk_insert(r, i, &c)) {
+		free(c.u.mem);
+		return false;
+	}
+	return true;
+}
+
+bool roaring_clear(struct roaring *r, uint32_t id)
+{
+	size_t i = chunk_index(r, id >> 16);
+
+	if (i == r->num || r->chunks[i].key != id >> 16)
+		return true;
+	if (!chunk_remove(&r->chunks[i], id & 0xFFFF))
+		return false;
+	if (r->chunks[i].card == 0)
+		chunk_delete(r, i);
+	return true;
+}
+
+bool roaring_set_range(struct roaring *r, uint32_t first, uint32_t last)
+{
+	uint32_t key;
+
+	for (key = first >> 16; key <= last >> 16; key++) {
+		struct roaring_run run;
+		struct roaring_chunk range, c;
+		size_t i = chunk_index(r, key);
+
+		run.start = key == first >> 16 ? first & 0xFFFF : 0;
+		run.last = key == last >> 16 ? last & 0xFFFF : 0xFFFF;
+		range.key = key;
+		range.type = RUN;
+		range.len = range.cap = 1;
+		range.card = run.last - run.start + 1;
+		range.u.runs = &run;
+
+		if (i < r->num && r->chunks[i].key == key) {
+			if (!chunk_op(&c, &r->chunks[i], &range, OR))
+				return false;
+			free(r->chunks[i].u.mem);
+			r->chunks[i] = c;
+		} else {
+			if (!chunk_copy(&c, &range))
+				return false;
+			if (!chunk_fix(&c) || !chunk_insert(r, i, &c)) {
+				free(c.u.mem);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+uint64_t roaring_count(const struct roaring *r)
+{
+	uint64_t count = 0;
+	size_t i;
+
+	for (i = 0; i < r->num; i++)
+		count += r->chunks[i].card;
+	return count;
+}
+
+bool roaring_copy(struct roaring *dst, const struct roaring *src)
+{
+	struct roaring out = ROARING_INIT;
+
+	if (!chunks_reserve(&out, src->num))
+		return false;
+	for (out.num = 0; out.num < src->num; out.num++) {
+		if (!chunk_copy(&out.chunks[out.num], &src->chunks[out.num])) {
+			roaring_free(&out);
+			return false;
+		}
+	}
+	roaring_free(dst);
+	*dst = out;
+	return true;
+}
+
+static bool roaring_op(struct roaring *dst, const struct roaring *a,
+		       const struct roaring *b, enum op op)
+{
+	struct roaring out = ROARING_INIT;
+	size_t i = 0, j = 0, max;
+
+	if (op == AND)
+		max = a->num < b->num ? a->num : b->num;
+	else if (op == ANDNOT)
+		max = a->num;
+	else
+		max = a->num + b->num;
+	if (!chunks_reserve(&out, max))
+		return false;
+
+	while (i < a->num || j < b->num) {
+		const struct roaring_chunk *ca = i < a->num ? &a->chunks[i] : NULL;
+		const struct roaring_chunk *cb = j < b->num ? &b->chunks[j] : NULL;
+		struct roaring_chunk *c = &out.chunks[out.num];
+
+		if (!cb || (ca && ca->key < cb->key)) {
+			i++;
+			if (op == AND)
+				continue;
+			if (!chunk_copy(c, ca))
+				goto fail;
+		} else if (!ca || cb->key < ca->key) {
+			j++;
+			if (op == AND || op == ANDNOT)
+				continue;
+			if (!chunk_copy(c, cb))
+				goto fail;
+		} else {
+			i++;
+			j++;
+			if (!chunk_op(c, ca, cb, op))
+				goto fail;
+			if (c->card == 0)
+				continue;
+		}
+		out.num++;
+	}
+	roaring_free(dst);
+	*dst = out;
+	return true;
+
+fail:
+	roaring_free(&out);
+	return false;
+}
+
+bool roaring_or(struct roaring *dst,
+		const struct roaring *a, const struct roaring *b)
+{
+	return roaring_op(dst, a, b, OR);
+}
+
+bool roaring_and(struct roaring *dst,
+		 const struct roaring *a, const struct roaring *b)
+{
+	return roaring_op(dst, a, b, AND);
+}
+
+bool roaring_andnot(struct roaring *dst,
+		    const struct roaring *a, const struct roaring *b)
+{
+	return roaring_op(dst, a, b, ANDNOT);
+}
+
+bool roaring_xor(struct roaring *dst,
+		 const struct roaring *a, const struct roaring *b)
+{
+	return roaring_op(dst, a, b, XOR);
+}
+
+uint64_t roaring_rank(const struct roaring *r, uint32_t id)
+{
+	const struct roaring_chunk *c;
+	uint32_t low = id & 0xFFFF, i;
+	uint64_t rank = 0;
+	size_t n;
+
+	for (n = 0; n < r->num && r->chunks[n].key < id >> 16; n++)
+		rank += r->chunks[n].card;
+	if (n == r->num || r->chunks[n].key != id >> 16)
+		return rank;
+
+	c = &r->chunks[n];
+	switch (c->type) {
+	case ARRAY:
+		return rank + array_lower_bound(c->u.array, c->len, low);
+	case BITSET:
+		return rank + bitmap_weight(c->u.bits, 0, low);
+	}
+	for (i = 0; i < c->len && c->u.runs[i].start < low; i++) {
+		if (c->u.runs[i].last < low)
+			rank += c->u.runs[i].last - c->u.runs[i].start + 1;
+		else
+			rank += low - c->u.runs[i].start;
+	}
+	return rank;
+}
+
+bool roaring_select(const struct roaring *r, uint64_t rank, uint32_t *id)
+{
+	const struct roaring_chunk *c;
+	uint32_t i, len;
+	size_t n;
+
+	for (n = 0; n < r->num && rank >= r->chunks[n].card; n++)
+		rank -= r->chunks[n].card;
+	if (n == r->num)
+		return false;
+
+	c = &r->chunks[n];
+	*id = (uint32_t)c->key << 16;
+	switch (c->type) {
+	case ARRAY:
+		*id |= c->u.array[rank];
+		return true;
+	case BITSET:
+		for (i = 0; ; i++) {
+			bitmap_word w = bitmap_bswap(c->u.bits[i].w);
+
+			if (rank >= word_popcount(w)) {
+				rank -= word_popcount(w);
+				continue;
+			}
+			while (rank--)
+				w &= ~(~(ALL_ONES >> 1) >> word_clz(w));
+			*id |= i * BITMAP_WORD_BITS + word_clz(w);
+			return true;
+		}
+	}
+	for (i = 0; ; i++) {
+		len = c->u.runs[i].last - c->u.runs[i].start + 1;
+		if (rank < len) {
+			*id |= c->u.runs[i].start + rank;
+			return true;
+		}
+		rank -= len;
+	}
+}
+
+/*
+ * Iteration: pos is the array index, or the value itself in bitsets and
+ * runs (where run is the run index).
+ */
+
+/* Find the first value >= low in it->chunk. */
+static bool iter_seek_chunk(struct roaring_iter *it, uint32_t low,
+			    uint32_t *id)
+{
+	for (; it->chunk < it->r->num; it->chunk++, low = 0) {
+		const struct roaring_chunk *c = &it->r->chunks[it->chunk];
+		uint32_t v;
+
+		switch (c->type) {
+		case ARRAY:
+			it->pos = array_lower_bound(c->u.array, c->len, low);
+			if (it->pos == c->len)
+				continue;
+			v = c->u.array[it->pos];
+			break;
+		case BITSET:
+			v = it->pos = bits_scan(c->u.bits, low, 0);
+			if (v == CHUNK_BITS)
+				continue;
+			break;
+		default:
+			it->run = run_lower_bound(c->u.runs, c->len, low);
+			if (it->run == c->len)
+				continue;
+			v = it->pos = c->u.runs[it->run].start > low
+				? c->u.runs[it->run].start : low;
+			break;
+		}
+		*id = ((uint32_t)c->key << 16) | v;
+		return true;
+	}
+	return false;
+}
+
+bool roaring_first(const struct roaring *r, struct roaring_iter *it,
+		   uint32_t *id)
+{
+	it->r = r;
+	it->chunk = 0;
+	return iter_seek_chunk(it, 0, id);
+}
+
+bool roaring_seek(const struct roaring *r, struct roaring_iter *it,
+		  uint32_t *id)
+{
+	it->r = r;
+	it->chunk = chunk_index(r, *id >> 16);
+	if (it->chunk < r->num && r->chunks[it->chunk].key == *id >> 16)
+		return iter_seek_chunk(it, *id & 0xFFFF, id);
+	return iter_seek_chunk(it, 0, id);
+}
+
+bool roaring_next(struct roaring_iter *it, uint32_t *id)
+{
+	const struct roaring_chunk *c;
+	uint32_t v;
+
+	if (it->chunk >= it->r->num)
+		return false;
+
+	c = &it->r->chunks[it->chunk];
+	switch (c->type) {
+	case ARRAY:
+		if (++it->pos == c->len)
+			goto next_chunk;
+		v = c->u.array[it->pos];
+		break;
+	case BITSET:
+		v = it->pos = bits_scan(c->u.bits, it->pos + 1, 0);
+		if (v == CHUNK_BITS)
+			goto next_chunk;
+		break;
+	default:
+		if (it->pos < c->u.runs[it->run].last)
+			v = ++it->pos;
+		else if (++it->run < c->len)
+			v = it->pos = c->u.runs[it->run].start;
+		else
+			goto next_chunk;
+		break;
+	}
+	*id = ((uint32_t)c->key << 16) | v;
+	return true;
+
+next_chunk:
+	it->chunk++;
+	return iter_seek_chunk(it, 0, id);
+}
+
+bool roaring_optimize(struct roaring *r)
+{
+	bool ok = true;
+	size_t i;
+
+	for (i = 0; i < r->num; i++) {
+		struct roaring_chunk *c = &r->chunks[i];
+		size_t best = c->card <= ARRAY_MAX ? array_bytes(c->card)
+			: BITSET_BYTES;
+
+		if (c->type == RUN) {
+			chunk_fix(c);
+			continue;
+		}
+		if (run_bytes(count_runs(c)) < best && !chunk_convert(c, RUN))
+			ok = false;
+	}
+	return ok;
+}
+
+/*
+ * Serialized form, all little-endian:
+ *	le32 magic, le32 number of chunks, then each chunk:
+ *	le16 key, u8 type, u8 0, le32 number of ids, then
+ *	array: le16 per id
+ *	bitset: 8192 bytes, id n being bit (7 - n % 8) of byte n / 8
+ *	runs: le32 number of runs, then le16 start, le16 last for each.
+ */
+#define HDR_BYTES	8
+#define CHUNK_HDR_BYTES	8
+
+static unsigned char *put_le16(unsigned char *p, uint16_t v)
+{
+	leint16_t le = cpu_to_le16(v);
+
+	memcpy(p, &le, sizeof(le));
+	return p + sizeof(le);
+}
+
+static unsigned char *put_le32(unsigned char *p, uint32_t v)
+{
+	leint32_t le = cpu_to_le32(v);
+
+	memcpy(p, &le, sizeof(le));
+	return p + sizeof(le);
+}
+
+static uint16_t get_le16(const unsigned char *p)
+{
+	leint16_t le;
+
+	memcpy(&le, p, sizeof(le));
+	return le16_to_cpu(le);
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	leint32_t le;
+
+	memcpy(&le, p, sizeof(le));
+	return le32_to_cpu(le);
+}
+
+static size_t chunk_payload_bytes(const struct roaring_chunk *c)
+{
+	if (c->type == ARRAY)
+		return array_bytes(c->len);
+	if (c->type == BITSET)
+		return BITSET_BYTES;
+	return 4 + run_bytes(c->len);
+}
+
+size_t roaring_serialized_size(const struct roaring *r)
+{
+	size_t i, size = HDR_BYTES;
+
+	for (i = 0; i < r->num; i++)
+		size += CHUNK_HDR_BYTES + chunk_payload_bytes(&r->chunks[i]);
+	return size;
+}
+
+size_t roaring_serialize(const struct roaring *r, void *buf)
+{
+	unsigned char *p = buf;
+	size_t i;
+	uint32_t j;
+
+	p = put_le32(p, ROARING_MAGIC);
+	p = put_le32(p, r->num);
+	for (i = 0; i < r->num; i++) {
+		const struct roaring_chunk *c = &r->chunks[i];
+
+		p = put_le16(p, c->key);
+		*(p++) = c->type;
+		*(p++) = 0;
+		p = put_le32(p, c->card);
+		switch (c->type) {
+		case ARRAY:
+			for (j = 0; j < c->len; j++)
+				p = put_le16(p, c->u.array[j]);
+			break;
+		case BITSET:
+			memcpy(p, c->u.bits, BITSET_BYTES);
+			p += BITSET_BYTES;
+			break;
+		case RUN:
+			p = put_le32(p, c->len);
+			for (j = 0; j < c->len; j++) {
+				p = put_le16(p, c->u.runs[j].start);
+				p = put_le16(p, c->u.runs[j].last);
+			}
+			break;
+		}
+	}
+	return p - (unsigned char *)buf;
+}
+
+/* Read one chunk's contents, checking everything.  Returns 0 if bad. */
+static size_t read_chunk(struct roaring_chunk *c, const unsigned char *p,
+			 size_t len)
+{
+	uint32_t i, n, card = 0;
+
+	switch (c->type) {
+	case ARRAY:
+		if (c->card > ARRAY_MAX || len < array_bytes(c->card))
+			return 0;
+		if (!chunk_alloc(c, ARRAY, c->card))
+			return 0;
+		for (i = 0; i < c->cap; i++) {
+			c->u.array[i] = get_le16(p + array_bytes(i));
+			if (i && c->u.array[i] <= c->u.array[i-1])
+				return 0;
+		}
+		c->card = c->len = c->cap;
+		return array_bytes(c->card);
+	case BITSET:
+		if (len < BITSET_BYTES)
+			return 0;
+		n = c->card;
+		if (!chunk_alloc(c, BITSET, 0))
+			return 0;
+		memcpy(c->u.bits, p, BITSET_BYTES);
+		c->card = bitmap_weight(c->u.bits, 0, CHUNK_BITS);
+		return c->card == n ? BITSET_BYTES : 0;
+	case RUN:
+		if (len < 4)
+			return 0;
+		n = get_le32(p);
+		if (n == 0 || n > CHUNK_BITS / 2 || len - 4 < run_bytes(n))
+			return 0;
+		card = c->card;
+		if (!chunk_alloc(c, RUN, n))
+			return 0;
+		for (i = 0; i < n; i++) {
+			struct roaring_run *run = &c->u.runs[i];
+
+			run->start = get_le16(p + 4 + run_bytes(i));
+			run->last = get_le16(p + 4 + run_bytes(i) + 2);
+			if (run->last < run->start
+			    || (i && run->start <= run[-1].last + 1U))
+				return 0;
+			c->card += run->last - run->start + 1;
+		}
+		c->len = n;
+		return c->card == card ? 4 + run_bytes(n) : 0;
+	}
+	return 0;
+}
+
+bool roaring_deserialize(struct roaring *r, const void *buf, size_t len)
+{
+	const unsigned char *p = buf, *end = p + len;
+	struct roaring out = ROARING_INIT;
+	uint32_t num;
+
+	errno = EINVAL;
+	if (len < HDR_BYTES || get_le32(p) != ROARING_MAGIC)
+		return false;
+	num = get_le32(p + 4);
+	if (num > CHUNK_BITS)
+		return false;
+	p += HDR_BYTES;
+
+	if (!chunks_reserve(&out, num)) {
+		errno = ENOMEM;
+		return false;
+	}
+	for (out.num = 0; out.num < num; out.num++) {
+		struct roaring_chunk *c = &out.chunks[out.num];
+		size_t used;
+
+		if ((size_t)(end - p) < CHUNK_HDR_BYTES)
+			goto fail;
+		c->key = get_le16(p);
+		c->type = p[2];
+		c->card = get_le32(p + 4);
+		c->u.mem = NULL;
+		if (p[3] != 0 || c->type > RUN
+		    || c->card == 0 || c->card > CHUNK_BITS
+		    || (out.num && c->key <= c[-1].key))
+			goto fail;
+		p += CHUNK_HDR_BYTES;
+
+		errno = 0;
+		used = read_chunk(c, p, end - p);
+		if (!used) {
+			/* Count it, so it's freed. */
+			out.num++;
+			if (errno != ENOMEM)
+				errno = EINVAL;
+			goto fail_errno;
+		}
+		p += used;
+	}
+	if (p != end)
+		goto fail;
+
+	roaring_free(r);
+	*r = out;
+	return true;
+
+fail:
+	errno = EINVAL;
+fail_errno:
+	roaring_free(&out);
+	return false;
+}
@@ -0,0 +1,324 @@
+/* Licensed under LGPLv2.1+ - see LICENSE file for details */
+#ifndef CCAN_ROARING_H
+#define CCAN_ROARING_H
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct roaring_chunk;
+
+/**
+ * struct roaring - a compressed set of 32-bit ids.
+ *
+ * The ids are split into chunks by their top 16 bits, and each chunk
+ * holds the bottom 16 bits in whichever of a sorted array, a bitmap or
+ * a list of runs is smallest.
+ *
+ * It's exposed here so you can put it in your structures: initialize it
+ * with ROARING_INIT or roaring_init(), and release it with roaring_free().
+ */
+struct roaring {
+	size_t num, max;
+	struct roaring_chunk *chunks;
+};
+
+#define ROARING_INIT { 0, 0, NULL }
+
+/**
+ * struct roaring_iter - an iterator over a roaring set.
+ *
+ * Changing the set invalidates it.
+ */
+struct roaring_iter {
+	const struct roaring *r;
+	size_t chunk;
+	uint32_t pos, run;
+};
+
+/**
+ * roaring_init - initialize an empty set.
+ * @r: the set.
+ *
+ * Example:
+ *	struct roaring set;
+ *
+ *	roaring_init(&set);
+ */
+void roaring_init(struct roaring *r);
+
+/**
+ * roaring_free - release all the memory used by a set.
+ * @r: the set.
+ *
+ * This leaves it empty, ready for reuse.
+ *
+ * Example:
+ *	roaring_free(&set);
+ */
+void roaring_free(struct roaring *r);
+
+/**
+ * roaring_test - is an id in the set?
+ * @r: the set.
+ * @id: the id.
+ *
+ * Example:
+ *	if (roaring_test(&set, 7))
+ *		printf("7 is in the set\n");
+ */
+bool roaring_test(const struct roaring *r, uint32_t id);
+
+/**
+ * roaring_set - add an id to the set.
+ * @r: the set.
+ * @id: the id (it's fine if it's already there).
+ *
+ * Returns false if we ran out of memory: the set is unchanged.
+ *
+ * Example:
+ *	if (!roaring_set(&set, 7))
+ *		err(1, "Adding 7");
+ */
+bool roaring_set(struct roaring *r, uint32_t id);
+
+/**
+ * roaring_clear - remove an id from the set.
+ * @r: the set.
+ * @id: the id (it's fine if it's not there).
+ *
+ * Removing from the middle of a run needs memory: this returns false
+ * if we ran out, and the set is unchanged.
+ *
+ * Example:
+ *	if (!roaring_clear(&set, 7))
+ *		err(1, "Removing 7");
+ */
+bool roaring_clear(struct roaring *r, uint32_t id);
+
+/**
+ * roaring_set_range - add every id from @first to @last inclusive.
+ * @r: the set.
+ * @first: the first id to add.
+ * @last: the last id to add (>= @first).
+ *
+ * This is stored as runs, so even a huge range takes little space.
+ * Returns false if we ran out of memory, leaving the set with some of
+ * the range added.
+ *
+ * Example:
+ *	// Reserve the first 1024 ids.
+ *	if (!roaring_set_range(&set, 0, 1023))
+ *		err(1, "Reserving ids");
+ */
+bool roaring_set_range(struct roaring *r, uint32_t first, uint32_t last);
+
+/**
+ * roaring_count - how many ids are in the set?
+ * @r: the set.
+ *
+ * Example:
+ *	printf("%llu ids\n", (unsigned long long)roaring_count(&set));
+ */
+uint64_t roaring_count(const struct roaring *r);
+
+/**
+ * roaring_empty - is the set empty?
+ * @r: the set.
+ *
+ * Example:
+ *	assert(roaring_empty(&set) == (roaring_count(&set) == 0));
+ */
+static inline bool roaring_empty(const struct roaring *r)
+{
+	return r->num == 0;
+}
+
+/**
+ * roaring_copy - make one set the same as another.
+ * @dst: the set to replace.
+ * @src: the set to copy.
+ *
+ * Returns false if we ran out of memory, leaving @dst unchanged.
+ */
+bool roaring_copy(struct roaring *dst, const struct roaring *src);
+
+/**
+ * roaring_or - set @dst to the union of two sets.
+ * @dst: the set to replace (which can be @a or @b).
+ * @a: the first set.
+ * @b: the second set.
+ *
+ * Like the other set operations, this works a chunk at a time, on
+ * whatever the chunks happen to be: merging arrays, combining bitmaps a
+ * word (or vector) at a time, or combining runs.  Chunks only in one set
+ * are simply copied (or skipped).
+ *
+ * Returns false if we ran out of memory, leaving @dst unchanged.
+ *
+ * Example:
+ *	struct roaring more = ROARING_INIT;
+ *
+ *	roaring_set_range(&more, 2000, 2999);
+ *	if (!roaring_or(&set, &set, &more))
+ *		err(1, "Merging sets");
+ */
+bool roaring_or(struct roaring *dst,
+		const struct roaring *a, const struct roaring *b);
+
+/**
+ * roaring_and - set @dst to the intersection of two sets.
+ * @dst: the set to replace (which can be @a or @b).
+ * @a: the first set.
+ * @b: the second set.
+ *
+ * Returns false if we ran out of memory, leaving @dst unchanged.
+ */
+bool roaring_and(struct roaring *dst,
+		 const struct roaring *a, const struct roaring *b);
+
+/**
+ * roaring_andnot - set @dst to the ids in @a but not in @b.
+ * @dst: the set to replace (which can be @a or @b).
+ * @a: the first set.
+ * @b: the set to remove.
+ *
+ * Returns false if we ran out of memory, leaving @dst unchanged.
+ */
+bool roaring_andnot(struct roaring *dst,
+		    const struct roaring *a, const struct roaring *b);
+
+/**
+ * roaring_xor - set @dst to the ids in exactly one of two sets.
+ * @dst: the set to replace (which can be @a or @b).
+ * @a: the first set.
+ * @b: the second set.
+ *
+ * Returns false if we ran out of memory, leaving @dst unchanged.
+ */
+bool roaring_xor(struct roaring *dst,
+		 const struct roaring *a, const struct roaring *b);
+
+/**
+ * roaring_rank - how many ids in the set are less than @id?
+ * @r: the set.
+ * @id: the id (which needn't be in the set).
+ *
+ * Example:
+ *	printf("%llu ids below 1000\n",
+ *	       (unsigned long long)roaring_rank(&set, 1000));
+ */
+uint64_t roaring_rank(const struct roaring *r, uint32_t id);
+
+/**
+ * roaring_select - find the id with a given rank.
+ * @r: the set.
+ * @rank: how many ids in the set are less than the one we want.
+ * @id: set to the id.
+ *
+ * Returns false if @rank >= roaring_count(@r).
+ *
+ * Example:
+ *	uint32_t median;
+ *
+ *	if (roaring_select(&set, roaring_count(&set) / 2, &median))
+ *		printf("Median is %u\n", median);
+ */
+bool roaring_select(const struct roaring *r, uint64_t rank, uint32_t *id);
+
+/**
+ * roaring_first - start iterating over a set, in increasing order.
+ * @r: the set.
+ * @it: the iterator to initialize.
+ * @id: set to the first id.
+ *
+ * Returns false if the set is empty.
+ *
+ * Example:
+ *	struct roaring_iter it;
+ *	uint32_t id;
+ *	bool ok;
+ *
+ *	for (ok = roaring_first(&set, &it, &id); ok;
+ *	     ok = roaring_next(&it, &id))
+ *		printf("%u\n", id);
+ */
+bool roaring_first(const struct roaring *r, struct roaring_iter *it,
+		   uint32_t *id);
+
+/**
+ * roaring_seek - start iterating at the first id not less than @id.
+ * @r: the set.
+ * @it: the iterator to initialize.
+ * @id: the id to start at, set to the id found.
+ *
+ * Returns false if there are no ids that large.
+ *
+ * Example:
+ *	// First free id at or after 100.
+ *	id = 100;
+ *	if (roaring_seek(&set, &it, &id))
+ *		printf("%u\n", id);
+ */
+bool roaring_seek(const struct roaring *r, struct roaring_iter *it,
+		  uint32_t *id);
+
+/**
+ * roaring_next - get the next id in a set.
+ * @it: the iterator from roaring_first() or roaring_seek().
+ * @id: set to the next id.
+ *
+ * Returns false at the end of the set.
+ */
+bool roaring_next(struct roaring_iter *it, uint32_t *id);
+
+/**
+ * roaring_optimize - convert chunks to runs where that is smaller.
+ * @r: the set.
+ *
+ * Individual ids are added as arrays or bitmaps, which is what you want
+ * for random ids, but wasteful for long stretches of consecutive ids.
+ * Call this once a set is built to store those as runs instead.
+ *
+ * Returns false if we ran out of memory: the set is still valid.
+ */
+bool roaring_optimize(struct roaring *r);
+
+/**
+ * roaring_serialized_size - how many bytes roaring_serialize() will need.
+ * @r: the set.
+ */
+size_t roaring_serialized_size(const struct roaring *r);
+
+/**
+ * roaring_serialize - write a set out in a portable form.
+ * @r: the set.
+ * @buf: somewhere with room for roaring_serialized_size() bytes.
+ *
+ * The form is the same on every machine: little-endian, with no padding.
+ * Returns the number of bytes written.
+ *
+ * Example:
+ *	static void *set_to_buf(const struct roaring *r, size_t *len)
+ *	{
+ *		void *buf = malloc(roaring_serialized_size(r));
+ *
+ *		if (buf)
+ *			*len = roaring_serialize(r, buf);
+ *		return buf;
+ *	}
+ */
+size_t roaring_serialize(const struct roaring *r, void *buf);
+
+/**
+ * roaring_deserialize - read a set written by roaring_serialize().
+ * @r: the set to replace.
+ * @buf: the serialized set.
+ * @len: the number of bytes in @buf.
+ *
+ * Everything is checked, so @buf can come from an untrusted source.
+ * Returns false (with errno EINVAL) if it's malformed, or (with errno
+ * ENOMEM) if we ran out of memory: @r is unchanged.
+ */
+bool roaring_deserialize(struct roaring *r, const void *buf, size_t len);
+#endif /* CCAN_ROARING_H */
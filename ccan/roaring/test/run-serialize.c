@@ -0,0 +1,104 @@
+#include <ccan/roaring/roaring.h>
+#include <ccan/tap/tap.h>
+#include <ccan/roaring/roaring.c>
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+static bool same(const struct roaring *a, const struct roaring *b)
+{
+	struct roaring_iter ita, itb;
+	uint32_t ida, idb;
+	bool oka, okb;
+
+	for (oka = roaring_first(a, &ita, &ida), okb = roaring_first(b, &itb, &idb);
+	     oka && okb;
+	     oka = roaring_next(&ita, &ida), okb = roaring_next(&itb, &idb))
+		if (ida != idb)
+			return false;
+	return oka == okb;
+}
+
+int main(void)
+{
+	struct roaring r = ROARING_INIT, r2 = ROARING_INIT;
+	unsigned char *buf;
+	size_t len, i, bad;
+	uint32_t id;
+
+	plan_tests(15);
+
+	/* Empty. */
+	buf = malloc(roaring_serialized_size(&r));
+	len = roaring_serialize(&r, buf);
+	ok1(len == roaring_serialized_size(&r) && len == 8);
+	roaring_set(&r2, 1);
+	ok1(roaring_deserialize(&r2, buf, len) && roaring_empty(&r2));
+	free(buf);
+
+	/* One chunk of each kind. */
+	for (i = 0; i < 100; i++)
+		roaring_set(&r, rand32() % 65536);
+	for (i = 0; i < 65536; i += 2)
+		roaring_set(&r, 65536 + i);
+	roaring_set_range(&r, 5 * 65536 + 100, 7 * 65536 - 100);
+	roaring_set(&r, 0xFFFFFFFF);
+	roaring_optimize(&r);
+
+	len = roaring_serialized_size(&r);
+	buf = malloc(len + 1);
+	ok1(roaring_serialize(&r, buf) == len);
+	ok1(roaring_deserialize(&r2, buf, len));
+	ok1(same(&r, &r2));
+	ok1(roaring_count(&r2) == roaring_count(&r));
+
+	/* It's little-endian, whatever we are. */
+	ok1(buf[0] == 'R' && buf[1] == 'O' && buf[2] == 'A' && buf[3] == '1');
+	ok1(buf[4] == r.num && buf[5] == 0);
+
+	/* Truncated at every length, or with a byte extra. */
+	for (bad = 0, i = 0; i < len; i++) {
+		errno = 0;
+		if (roaring_deserialize(&r2, buf, i) || errno != EINVAL)
+			bad++;
+	}
+	ok1(bad == 0);
+	buf[len] = 0;
+	ok1(!roaring_deserialize(&r2, buf, len + 1) && errno == EINVAL);
+	ok1(same(&r, &r2));
+
+	/* Flipping a bit is either noticed, or (in an array value, say)
+	 * gives another valid set of the same size. */
+	for (bad = 0, i = 0; i < len * 8; i += 1 + rand32() % 7) {
+		buf[i / 8] ^= 1 << (i % 8);
+		errno = 0;
+		if (roaring_deserialize(&r2, buf, len)) {
+			if (roaring_count(&r2) != roaring_count(&r)
+			    || roaring_serialized_size(&r2) != len)
+				bad++;
+		} else if (errno != EINVAL)
+			bad++;
+		buf[i / 8] ^= 1 << (i % 8);
+	}
+	ok1(bad == 0);
+	buf[0] ^= 1;
+	ok1(!roaring_deserialize(&r2, buf, len) && errno == EINVAL);
+	buf[0] ^= 1;
+
+	/* Still fine after all that. */
+	ok1(roaring_deserialize(&r2, buf, len) && same(&r, &r2));
+	id = 0xFFFFFFFE;
+	ok1(roaring_seek(&r2, &(struct roaring_iter){ NULL }, &id)
+	    && id == 0xFFFFFFFF);
+
+	free(buf);
+	roaring_free(&r);
+	roaring_free(&r2);
+	return exit_status();
+}
@@ -0,0 +1,255 @@
+#include <ccan/roaring/roaring.h>
+#include <ccan/tap/tap.h>
+#include <ccan/roaring/roaring.c>
+
+/* Ids in the first few chunks, and in the very last one. */
+#define LOW_IDS		(4 * 65536)
+#define NREF		(LOW_IDS + 65536)
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+static uint32_t ref_id(uint32_t i)
+{
+	return i < LOW_IDS ? i : 0xFFFF0000 + (i - LOW_IDS);
+}
+
+static uint32_t ref_index(uint32_t id)
+{
+	return id < LOW_IDS ? id : id - 0xFFFF0000 + LOW_IDS;
+}
+
+static void set_both(struct roaring *r, bitmap *ref, uint32_t i)
+{
+	roaring_set(r, ref_id(i));
+	bitmap_set_bit(ref, i);
+}
+
+static void range_both(struct roaring *r, bitmap *ref,
+		       uint32_t first, uint32_t last)
+{
+	roaring_set_range(r, ref_id(first), ref_id(last));
+	bitmap_fill_range(ref, first, last + 1);
+}
+
+/* Each chunk gets a different kind of contents. */
+static void fill(struct roaring *r, bitmap *ref)
+{
+	uint32_t chunk, i, start, len;
+
+	roaring_free(r);
+	bitmap_zero(ref, NREF);
+	for (chunk = 0; chunk < NREF / 65536; chunk++) {
+		uint32_t base = chunk * 65536;
+
+		switch (rand32() % 5) {
+		case 0:
+			/* Sparse: an array. */
+			for (i = rand32() % 3000; i > 0; i--)
+				set_both(r, ref, base + rand32() % 65536);
+			break;
+		case 1:
+			/* Dense: a bitmap. */
+			for (i = 0; i < 65536; i++)
+				if (rand32() % 3 == 0)
+					set_both(r, ref, base + i);
+			break;
+		case 2:
+			/* Runs, some touching. */
+			for (i = rand32() % 50; i > 0; i--) {
+				start = rand32() % 65536;
+				len = rand32() % 2000;
+				if (start + len > 65535)
+					len = 65535 - start;
+				range_both(r, ref, base + start,
+					   base + start + len);
+			}
+			break;
+		case 3:
+			/* Nearly full. */
+			range_both(r, ref, base, base + 65535);
+			for (i = rand32() % 100; i > 0; i--) {
+				start = rand32() % 65536;
+				roaring_clear(r, ref_id(base + start));
+				bitmap_clear_bit(ref, base + start);
+			}
+			break;
+		case 4:
+			/* Empty. */
+			break;
+		}
+	}
+}
+
+static bool matches(const struct roaring *r, const bitmap *ref)
+{
+	struct roaring_iter it;
+	uint32_t id, i = 0;
+	uint64_t count = 0;
+	bool ok;
+
+	for (ok = roaring_first(r, &it, &id); ok; ok = roaring_next(&it, &id)) {
+		if (id >= LOW_IDS && id < 0xFFFF0000)
+			return false;
+		/* Everything between the last id and this is missing. */
+		for (; i < ref_index(id); i++)
+			if (bitmap_test_bit(ref, i) || roaring_test(r, ref_id(i)))
+				return false;
+		if (!bitmap_test_bit(ref, i) || !roaring_test(r, id))
+			return false;
+		i++;
+		count++;
+	}
+	for (; i < NREF; i++)
+		if (bitmap_test_bit(ref, i) || roaring_test(r, ref_id(i)))
+			return false;
+	return roaring_count(r) == count
+		&& roaring_empty(r) == (count == 0);
+}
+
+/* Indexed by roaring.c's enum op. */
+static bool (*op_fn[])(struct roaring *, const struct roaring *,
+		       const struct roaring *) = {
+	roaring_and, roaring_or, roaring_xor, roaring_andnot
+};
+
+static void ref_op(bitmap *dst, const bitmap *a, const bitmap *b, enum op op)
+{
+	switch (op) {
+	case AND: bitmap_and(dst, a, b, NREF); break;
+	case OR: bitmap_or(dst, a, b, NREF); break;
+	case XOR: bitmap_xor(dst, a, b, NREF); break;
+	case ANDNOT: bitmap_andnot(dst, a, b, NREF); break;
+	}
+}
+
+int main(void)
+{
+	struct roaring a = ROARING_INIT, b = ROARING_INIT, dst = ROARING_INIT;
+	bitmap *refa = bitmap_alloc(NREF), *refb = bitmap_alloc(NREF);
+	bitmap *refdst = bitmap_alloc(NREF);
+	struct roaring_iter it;
+	uint32_t i, id, n;
+	unsigned int bad, pass;
+	uint64_t rank;
+	size_t size;
+	int op;
+
+	plan_tests(20);
+
+	/* Empty. */
+	bitmap_zero(refa, NREF);
+	ok1(matches(&a, refa));
+	ok1(!roaring_first(&a, &it, &id) && !roaring_select(&a, 0, &id));
+	ok1(roaring_rank(&a, 0xFFFFFFFF) == 0);
+
+	/* Ranges across chunks, right up to the last id. */
+	ok1(roaring_set_range(&a, 65530, 3 * 65536 + 7));
+	ok1(roaring_set_range(&a, 0xFFFFFFF0, 0xFFFFFFFF));
+	bitmap_fill_range(refa, 65530, 3 * 65536 + 8);
+	bitmap_fill_range(refa, NREF - 16, NREF);
+	ok1(matches(&a, refa));
+	ok1(roaring_count(&a) == 2 * 65536 + 14 + 16);
+
+	/* Punch holes in runs, and fill them again. */
+	for (bad = 0, i = 0; i < 2000; i++) {
+		n = 65530 + rand32() % (2 * 65536);
+		if (!roaring_clear(&a, n))
+			bad++;
+		bitmap_clear_bit(refa, n);
+	}
+	ok1(bad == 0 && matches(&a, refa));
+	ok1(roaring_set_range(&a, 65530, 3 * 65536 + 7));
+	bitmap_fill_range(refa, 65530, 3 * 65536 + 8);
+	ok1(matches(&a, refa));
+
+	/* Mixed chunks, then all the operations between them, before and
+	 * after making runs. */
+	for (bad = 0, pass = 0; pass < 12; pass++) {
+		fill(&a, refa);
+		fill(&b, refb);
+		if (pass % 2) {
+			roaring_optimize(&a);
+			roaring_optimize(&b);
+		}
+		if (pass % 4 > 1)
+			roaring_optimize(&a);
+		if (!matches(&a, refa) || !matches(&b, refb))
+			bad++;
+		for (op = AND; op <= ANDNOT; op++) {
+			ref_op(refdst, refa, refb, op);
+			if (!op_fn[op](&dst, &a, &b) || !matches(&dst, refdst))
+				bad++;
+			/* Into either of the sources. */
+			roaring_copy(&dst, &a);
+			if (!op_fn[op](&dst, &dst, &b) || !matches(&dst, refdst))
+				bad++;
+			roaring_copy(&dst, &b);
+			if (!op_fn[op](&dst, &a, &dst) || !matches(&dst, refdst))
+				bad++;
+		}
+	}
+	ok1(bad == 0);
+
+	/* With itself. */
+	ok1(roaring_and(&dst, &a, &a) && matches(&dst, refa));
+	ok1(roaring_xor(&dst, &a, &a) && roaring_empty(&dst));
+
+	/* Optimizing changes nothing but the size. */
+	fill(&a, refa);
+	size = roaring_serialized_size(&a);
+	ok1(roaring_optimize(&a) && matches(&a, refa));
+	ok1(roaring_serialized_size(&a) <= size);
+
+	/* Rank and select. */
+	for (bad = 0, i = 0; i < 3000; i++) {
+		n = rand32() % NREF;
+		rank = bitmap_weight(refa, 0, n);
+		if (roaring_rank(&a, ref_id(n)) != rank)
+			bad++;
+		if (bitmap_test_bit(refa, n)
+		    && (!roaring_select(&a, rank, &id) || id != ref_id(n)))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(!roaring_select(&a, roaring_count(&a), &id));
+
+	/* Seeking. */
+	for (bad = 0, i = 0; i < 3000; i++) {
+		n = rand32() % NREF;
+		id = ref_id(n);
+		n = bitmap_ffs(refa, n, NREF);
+		if (roaring_seek(&a, &it, &id) != (n < NREF)
+		    || (n < NREF && id != ref_id(n)))
+			bad++;
+		/* And carry on from there. */
+		if (n < NREF && n + 1 < NREF) {
+			n = bitmap_ffs(refa, n + 1, NREF);
+			if (roaring_next(&it, &id) != (n < NREF)
+			    || (n < NREF && id != ref_id(n)))
+				bad++;
+		}
+	}
+	ok1(bad == 0);
+	id = LOW_IDS;
+	ok1(roaring_seek(&a, &it, &id) == !bitmap_empty(refa + BITMAP_NWORDS(LOW_IDS), 65536));
+
+	/* Clear everything. */
+	for (i = 0; i < NREF; i++)
+		roaring_clear(&a, ref_id(i));
+	ok1(roaring_empty(&a) && a.num == 0);
+
+	roaring_free(&a);
+	roaring_free(&b);
+	roaring_free(&dst);
+	free(refa);
+	free(refb);
+	free(refdst);
+	return exit_status();
+}
@@ -0,0 +1,159 @@
+/*
+ * Speed tests for set algebra on roaring sets, against merging sorted
+ * arrays of ids (the obvious uncompressed representation).
+ *
+ * Both sets have the same number of ids, drawn from one of:
+ *	sparse:    spread over all 32 bits (so array chunks)
+ *	dense:     about half of a range (so bitmap chunks)
+ *	clustered: runs of about a thousand (so run chunks)
+ *
+ * Usage: speed [ids]  (100 million by default, which needs about 2GB)
+ */
+#include <ccan/roaring/roaring.h>
+#include <ccan/time/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Milliseconds per operation */
+static size_t normalize(const struct timeabs *start,
+			const struct timeabs *stop,
+			size_t num)
+{
+	return time_to_msec(time_divide(time_between(*stop, *start), num));
+}
+
+#define TIME(name, num, loop)						\
+	do {								\
+		struct timeabs start, stop;				\
+		printf("%s: ", (name));					\
+		fflush(stdout);						\
+		start = time_now();					\
+		loop;							\
+		stop = time_now();					\
+		printf(" %zu ms\n", normalize(&start, &stop, (num)));	\
+	} while (0)
+
+static uint32_t rand32_state = 0;
+
+static uint32_t rand32(void)
+{
+	rand32_state *= (uint32_t)0x7FF8A3ED;
+	rand32_state += (uint32_t)0x2AA01D31;
+	return rand32_state;
+}
+
+enum op { AND, OR, XOR, ANDNOT };
+
+/* Merge two sorted arrays into dst (which has room for both). */
+static size_t merge(uint32_t *dst, const uint32_t *a, size_t na,
+		    const uint32_t *b, size_t nb, enum op op)
+{
+	size_t i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			if (op != AND)
+				dst[n++] = a[i];
+			i++;
+		} else if (a[i] > b[j]) {
+			if (op == OR || op == XOR)
+				dst[n++] = b[j];
+			j++;
+		} else {
+			if (op == AND || op == OR)
+				dst[n++] = a[i];
+			i++;
+			j++;
+		}
+	}
+	if (op != AND)
+		while (i < na)
+			dst[n++] = a[i++];
+	if (op == OR || op == XOR)
+		while (j < nb)
+			dst[n++] = b[j++];
+	return n;
+}
+
+/* num increasing ids, in both forms. */
+static void fill(uint32_t *ids, struct roaring *r, size_t num, int dist)
+{
+	uint32_t id = rand32() % 16, left = 0;
+	size_t i;
+
+	roaring_free(r);
+	for (i = 0; i < num; i++) {
+		ids[i] = id;
+		roaring_set(r, id);
+		switch (dist) {
+		case 0:
+			id += 1 + rand32() % 79;
+			break;
+		case 1:
+			id += 1 + rand32() % 3;
+			break;
+		case 2:
+			if (left) {
+				left--;
+				id++;
+			} else {
+				left = rand32() % 2000;
+				id += 1 + rand32() % 2000;
+			}
+			break;
+		}
+	}
+	roaring_optimize(r);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dists[] = { "sparse", "dense", "clustered" };
+	const char *ops[] = { "and", "or", "xor", "andnot" };
+	bool (*fns[])(struct roaring *, const struct roaring *,
+		      const struct roaring *) = {
+		roaring_and, roaring_or, roaring_xor, roaring_andnot
+	};
+	size_t num = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000000;
+	struct roaring a = ROARING_INIT, b = ROARING_INIT, dst = ROARING_INIT;
+	uint32_t *ida, *idb, *iddst;
+	volatile size_t n;
+	char name[100];
+	int dist, op;
+
+	ida = malloc(num * sizeof(*ida));
+	idb = malloc(num * sizeof(*idb));
+	iddst = malloc(2 * num * sizeof(*iddst));
+	if (!ida || !idb || !iddst) {
+		fprintf(stderr, "Could not allocate arrays for %zu ids\n", num);
+		exit(1);
+	}
+
+	for (dist = 0; dist < 3; dist++) {
+		fill(ida, &a, num, dist);
+		fill(idb, &b, num, dist);
+		printf("%s, %zu ids: arrays %zu MB, roaring %zu MB\n",
+		       dists[dist], num, num * sizeof(*ida) >> 20,
+		       roaring_serialized_size(&a) >> 20);
+		for (op = AND; op <= ANDNOT; op++) {
+			sprintf(name, "  %s (sorted arrays)", ops[op]);
+			TIME(name, 1, n = merge(iddst, ida, num, idb, num, op));
+			sprintf(name, "  %s (roaring)", ops[op]);
+			TIME(name, 1, fns[op](&dst, &a, &b));
+			/* The same answer, of course. */
+			if (roaring_count(&dst) != n) {
+				fprintf(stderr, "%s: %zu vs %llu!\n", name, n,
+					(unsigned long long)roaring_count(&dst));
+				exit(1);
+			}
+		}
+	}
+
+	roaring_free(&a);
+	roaring_free(&b);
+	roaring_free(&dst);
+	free(ida);
+	free(idb);
+	free(iddst);
+	return 0;
+}
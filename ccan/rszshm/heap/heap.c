@@ -0,0 +1,520 @@
+/* Licensed under Apache License v2.0 - see LICENSE file for details */
+#include "config.h"
+#include <ccan/rszshm/heap/heap.h>
+#include <ccan/ilog/ilog.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+
+/*
+ * The region is carved into 64k spans, from the end of the heap header
+ * up.  A span holds blocks of one small size class, or is the start of
+ * one large block (a power of 2 of spans).  Each block has a 16-byte
+ * header; offsets handed out point just past it.
+ *
+ * Every change to shared state is a single atomic operation, so a
+ * process dying anywhere leaves the heap consistent:
+ *  - claiming spans is a compare-and-swap on top;
+ *  - a small size class's newest span hands out blocks with a fetch-and-
+ *    add of its next index;
+ *  - free lists are stacks, pushed and popped with a compare-and-swap
+ *    on a head tagged with a generation count (against ABA).
+ */
+#define HEAP_MAGIC 0x6873686d68656170ULL
+#define SPAN_SIZE (64 * 1024UL)
+#define SPAN_HEADER 64
+#define BLOCK_HEADER 16
+#define SMALL_CLASSES 20
+#define LARGE_CLASSES 21
+#define CLASSES (SMALL_CLASSES + LARGE_CLASSES)
+
+/* Tagged free list heads: 24 bits of tag, 40 bits of offset / 16. */
+#define TAG_SHIFT 40
+#define OFF_MASK ((1ULL << TAG_SHIFT) - 1)
+
+enum block_state {
+	/* Never handed out (or its allocator died handing it out). */
+	BLOCK_UNUSED = 0,
+	BLOCK_FREE = 0x46524545,
+	BLOCK_USED = 0x55534544
+};
+
+struct heap_header {
+	uint64_t magic;
+	/* Offset of the first unclaimed span. */
+	_Atomic(uint64_t) top;
+	_Atomic(uint64_t) root;
+	_Atomic(uint64_t) free[CLASSES];
+	/* Each small class's newest span, which may have unused blocks. */
+	_Atomic(uint64_t) cur[SMALL_CLASSES];
+};
+
+struct span_header {
+	/* (class + 1) << 32 | pid of claimer: 0 if the claimer died first. */
+	_Atomic(uint64_t) info;
+	/* Blocks handed out so far (may pass num), and number of blocks. */
+	_Atomic(uint32_t) next;
+	uint32_t num;
+};
+
+struct block_header {
+	_Atomic(uint32_t) state;
+	uint32_t class;
+	_Atomic(int32_t) owner;
+	uint32_t unused;
+};
+
+/* A free block keeps the next one on its list just past its header. */
+struct free_block {
+	struct block_header h;
+	_Atomic(uint64_t) next;
+};
+
+static pid_t cached_pid;
+static pthread_once_t pid_once = PTHREAD_ONCE_INIT;
+
+static void reset_pid(void)
+{
+	cached_pid = getpid();
+}
+
+static void init_pid(void)
+{
+	reset_pid();
+	pthread_atfork(NULL, NULL, reset_pid);
+}
+
+/* getpid() is a system call these days: we call it per allocation. */
+static pid_t my_pid(void)
+{
+	pthread_once(&pid_once, init_pid);
+	return cached_pid;
+}
+
+static uint64_t first_span(void)
+{
+	return (sizeof(struct rszshm_hdr) + sizeof(struct heap_header)
+		+ SPAN_HEADER - 1) & ~(uint64_t)(SPAN_HEADER - 1);
+}
+
+static struct heap_header *heap(struct rszshm *r)
+{
+	return r->dat;
+}
+
+/* Make sure this process maps the region up to end. */
+static bool mapped(struct rszshm *r, uint64_t end)
+{
+	return end <= r->flen || (rszshm_up(r) != -1 && end <= r->flen);
+}
+
+static void *at(struct rszshm *r, uint64_t off)
+{
+	return (char *)r->hdr + off;
+}
+
+static size_t class_size(unsigned int class)
+{
+	if (class < SMALL_CLASSES)
+		return class % 2 ? 3UL << (4 + class / 2)
+			: 1UL << (5 + class / 2);
+	return SPAN_SIZE << (class - SMALL_CLASSES);
+}
+
+/* 32, 48, 64, 96 ... 16384, 24576 byte blocks, then powers of 2 of spans. */
+static int size_to_class(size_t size)
+{
+	size_t need = size + BLOCK_HEADER, spans;
+	unsigned int b;
+
+	if (size > (SPAN_SIZE << (LARGE_CLASSES - 1)) - SPAN_HEADER
+	    - BLOCK_HEADER)
+		return -1;
+	if (need <= 32)
+		return 0;
+	if (need <= class_size(SMALL_CLASSES - 1)) {
+		b = ilog64(need - 1);
+		return need <= (3UL << (b - 2)) ? 2 * (b - 5) - 1 : 2 * (b - 5);
+	}
+	spans = (need + SPAN_HEADER + SPAN_SIZE - 1) / SPAN_SIZE;
+	return SMALL_CLASSES + (spans == 1 ? 0 : ilog64(spans - 1));
+}
+
+static uint64_t head_off(uint64_t head)
+{
+	return (head & OFF_MASK) << 4;
+}
+
+static uint64_t make_head(uint64_t old, uint64_t off)
+{
+	return (((old >> TAG_SHIFT) + 1) << TAG_SHIFT) | (off >> 4);
+}
+
+static void push(struct rszshm *r, unsigned int class, uint64_t block)
+{
+	_Atomic(uint64_t) *head = &heap(r)->free[class];
+	struct free_block *b = at(r, block);
+	uint64_t old = atomic_load(head);
+
+	do {
+		atomic_store_explicit(&b->next, head_off(old),
+				      memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak(head, &old,
+					       make_head(old, block)));
+}
+
+static uint64_t pop(struct rszshm *r, unsigned int class)
+{
+	_Atomic(uint64_t) *head = &heap(r)->free[class];
+	uint64_t old = atomic_load(head), block, next;
+
+	do {
+		block = head_off(old);
+		if (!block)
+			return 0;
+		/* It may have been popped and reused already: the tag catches
+		 * that, but we still need to be able to read it. */
+		if (!mapped(r, block + sizeof(struct free_block)))
+			return 0;
+		next = atomic_load_explicit(&((struct free_block *)at(r, block))
+					    ->next, memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak(head, &old,
+					       make_head(old, next)));
+	return block;
+}
+
+/* Claim num spans at the top, growing the region if we need to. */
+static uint64_t claim_spans(struct rszshm *r, uint64_t num,
+			    unsigned int class)
+{
+	struct heap_header *h = heap(r);
+	uint64_t top = atomic_load(&h->top), end;
+	struct span_header *s;
+
+	do {
+		end = top + num * SPAN_SIZE;
+		if (end > r->hdr->max) {
+			errno = ENOMEM;
+			return 0;
+		}
+		while (end > r->hdr->flen) {
+			if (rszshm_grow(r) == -1)
+				return 0;
+		}
+	} while (!atomic_compare_exchange_weak(&h->top, &top, end));
+
+	if (!mapped(r, end))
+		return 0;
+	s = at(r, top);
+	s->num = class < SMALL_CLASSES
+		? (SPAN_SIZE - SPAN_HEADER) / class_size(class) : 1;
+	/* Block 0 is ours. */
+	atomic_store_explicit(&s->next, 1, memory_order_relaxed);
+	atomic_store_explicit(&s->info, ((uint64_t)(class + 1) << 32)
+			      | (uint32_t)my_pid(), memory_order_release);
+	return top;
+}
+
+static uint64_t block_of(uint64_t span, unsigned int class, uint32_t i)
+{
+	return span + SPAN_HEADER + i * class_size(class);
+}
+
+/* Put the blocks of a span we carved from (after block 0) on the free list. */
+static void free_rest(struct rszshm *r, uint64_t span, unsigned int class)
+{
+	struct span_header *s = at(r, span);
+	uint32_t i;
+
+	/* So walk() sees them, even if we die part way. */
+	atomic_store(&s->next, s->num);
+	for (i = 1; i < s->num; i++) {
+		uint64_t block = block_of(span, class, i);
+		struct block_header *b = at(r, block);
+
+		b->class = class;
+		atomic_store_explicit(&b->owner, 0, memory_order_relaxed);
+		atomic_store_explicit(&b->state, BLOCK_FREE,
+				      memory_order_relaxed);
+		push(r, class, block);
+	}
+}
+
+/* Take an unused block from the class's newest span, or a new one. */
+static uint64_t carve(struct rszshm *r, unsigned int class)
+{
+	struct heap_header *h = heap(r);
+	uint64_t span = atomic_load(&h->cur[class]), fresh;
+	struct span_header *s;
+	uint32_t i;
+
+	if (span) {
+		if (!mapped(r, span + SPAN_SIZE))
+			return 0;
+		s = at(r, span);
+		i = atomic_fetch_add(&s->next, 1);
+		if (i < s->num)
+			return block_of(span, class, i);
+	}
+
+	/* None, or it's full: install a new one. */
+	fresh = claim_spans(r, 1, class);
+	if (!fresh)
+		return 0;
+	/* If someone beat us to it, nobody will carve from ours: free the
+	 * rest of its blocks instead. */
+	if (!atomic_compare_exchange_strong(&h->cur[class], &span, fresh))
+		free_rest(r, fresh, class);
+	return block_of(fresh, class, 0);
+}
+
+int rszshm_heap_init(struct rszshm *r)
+{
+	struct heap_header *h;
+	unsigned int i;
+
+	while (r->hdr->flen < first_span())
+		if (rszshm_grow(r) == -1)
+			return -1;
+
+	h = heap(r);
+	atomic_init(&h->top, first_span());
+	atomic_init(&h->root, 0);
+	for (i = 0; i < CLASSES; i++)
+		atomic_init(&h->free[i], 0);
+	for (i = 0; i < SMALL_CLASSES; i++)
+		atomic_init(&h->cur[i], 0);
+	h->magic = HEAP_MAGIC;
+	return 0;
+}
+
+uint64_t rszshm_heap_alloc(struct rszshm *r, size_t size)
+{
+	struct block_header *b;
+	uint64_t block;
+	int class;
+
+	class = size_to_class(size);
+	if (class < 0) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	block = pop(r, class);
+	if (!block) {
+		if (class < SMALL_CLASSES)
+			block = carve(r, class);
+		else {
+			block = claim_spans(r, 1ULL << (class - SMALL_CLASSES),
+					    class);
+			if (block)
+				block += SPAN_HEADER;
+		}
+		if (!block)
+			return 0;
+	}
+
+	b = at(r, block);
+	b->class = class;
+	atomic_store_explicit(&b->owner, my_pid(), memory_order_relaxed);
+	atomic_store_explicit(&b->state, BLOCK_USED, memory_order_release);
+	return block + BLOCK_HEADER;
+}
+
+static bool free_block(struct rszshm *r, uint64_t block)
+{
+	struct block_header *b = at(r, block);
+	uint32_t used = BLOCK_USED;
+
+	/* Don't let a double free corrupt the list. */
+	if (!atomic_compare_exchange_strong(&b->state, &used, BLOCK_FREE))
+		return false;
+	atomic_store_explicit(&b->owner, 0, memory_order_relaxed);
+	push(r, b->class, block);
+	return true;
+}
+
+void rszshm_heap_free(struct rszshm *r, uint64_t off)
+{
+	if (off && mapped(r, off))
+		free_block(r, off - BLOCK_HEADER);
+}
+
+void *rszshm_heap_ptr(struct rszshm *r, uint64_t off)
+{
+	if (!off || !mapped(r, off))
+		return NULL;
+	return at(r, off);
+}
+
+uint64_t rszshm_heap_off(const struct rszshm *r, const void *p)
+{
+	if (!p)
+		return 0;
+	return (const char *)p - (const char *)r->hdr;
+}
+
+size_t rszshm_heap_size(struct rszshm *r, uint64_t off)
+{
+	const struct block_header *b = rszshm_heap_ptr(r, off - BLOCK_HEADER);
+
+	if (b->class < SMALL_CLASSES)
+		return class_size(b->class) - BLOCK_HEADER;
+	return class_size(b->class) - SPAN_HEADER - BLOCK_HEADER;
+}
+
+uint64_t rszshm_heap_root(struct rszshm *r)
+{
+	return atomic_load(&heap(r)->root);
+}
+
+bool rszshm_heap_set_root(struct rszshm *r, uint64_t off)
+{
+	uint64_t unset = 0;
+
+	return atomic_compare_exchange_strong(&heap(r)->root, &unset, off);
+}
+
+void rszshm_heap_publish(struct rszshm *r, uint64_t off)
+{
+	struct block_header *b = rszshm_heap_ptr(r, off - BLOCK_HEADER);
+
+	atomic_store_explicit(&b->owner, 0, memory_order_relaxed);
+}
+
+/* Call fn on every block ever handed out; false if the heap is bad. */
+static bool walk(struct rszshm *r,
+		 bool (*fn)(struct rszshm *r, uint64_t block, void *arg),
+		 void *arg)
+{
+	uint64_t span, top = atomic_load(&heap(r)->top);
+
+	if (!mapped(r, top))
+		return false;
+	for (span = first_span(); span < top; ) {
+		struct span_header *s = at(r, span);
+		uint64_t info = atomic_load(&s->info);
+		unsigned int class;
+		uint32_t i, num;
+
+		/* Claimer died before saying what it was for. */
+		if (!info) {
+			span += SPAN_SIZE;
+			continue;
+		}
+		class = (info >> 32) - 1;
+		if (class >= CLASSES)
+			return false;
+		if (class >= SMALL_CLASSES) {
+			if (s->num != 1 || !fn(r, span + SPAN_HEADER, arg))
+				return false;
+			span += class_size(class);
+			continue;
+		}
+		if (s->num != (SPAN_SIZE - SPAN_HEADER) / class_size(class))
+			return false;
+		num = atomic_load(&s->next);
+		if (num > s->num)
+			num = s->num;
+		for (i = 0; i < num; i++)
+			if (!fn(r, block_of(span, class, i), arg))
+				return false;
+		span += SPAN_SIZE;
+	}
+	return span == top;
+}
+
+struct reclaim {
+	pid_t pid;
+	long freed;
+};
+
+static bool reclaim_block(struct rszshm *r, uint64_t block, void *arg)
+{
+	struct reclaim *rec = arg;
+	struct block_header *b = at(r, block);
+
+	if (atomic_load(&b->state) == BLOCK_USED
+	    && atomic_load(&b->owner) == rec->pid
+	    && free_block(r, block))
+		rec->freed++;
+	return true;
+}
+
+long rszshm_heap_reclaim(struct rszshm *r, pid_t pid)
+{
+	struct reclaim rec = { pid, 0 };
+
+	if (kill(pid, 0) == 0 || errno != ESRCH) {
+		errno = EBUSY;
+		return -1;
+	}
+	walk(r, reclaim_block, &rec);
+	return rec.freed;
+}
+
+struct check {
+	uint64_t free[CLASSES];
+};
+
+static bool check_block(struct rszshm *r, uint64_t block, void *arg)
+{
+	struct check *check = arg;
+	struct block_header *b = at(r, block);
+
+	switch (atomic_load(&b->state)) {
+	case BLOCK_UNUSED:
+	case BLOCK_USED:
+		return true;
+	case BLOCK_FREE:
+		if (b->class >= CLASSES)
+			return false;
+		check->free[b->class]++;
+		return true;
+	}
+	return false;
+}
+
+bool rszshm_heap_check(struct rszshm *r)
+{
+	struct heap_header *h = heap(r);
+	struct check check;
+	uint64_t top;
+	unsigned int i;
+
+	if (h->magic != HEAP_MAGIC)
+		return false;
+	memset(&check, 0, sizeof(check));
+	if (!walk(r, check_block, &check))
+		return false;
+
+	top = atomic_load(&h->top);
+	for (i = 0; i < CLASSES; i++) {
+		uint64_t block, num = 0;
+
+		for (block = head_off(atomic_load(&h->free[i]));
+		     block;
+		     block = atomic_load(&((struct free_block *)at(r, block))
+					 ->next)) {
+			struct block_header *b = at(r, block);
+
+			if (block < first_span() || block >= top)
+				return false;
+			if (atomic_load(&b->state) != BLOCK_FREE
+			    || b->class != i)
+				return false;
+			/* More than we saw in the walk: a loop. */
+			if (++num > check.free[i])
+				return false;
+		}
+		/*
+		 * Fewer is fine: a process which died between marking a
+		 * block free and pushing it (or popping and marking it
+		 * used) leaves it on no list.
+		 */
+	}
+	return true;
+}
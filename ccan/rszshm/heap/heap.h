@@ -0,0 +1,167 @@
+/* Licensed under Apache License v2.0 - see LICENSE file for details */
+#ifndef CCAN_RSZSHM_HEAP_H
+#define CCAN_RSZSHM_HEAP_H
+#include "config.h"
+#include <ccan/rszshm/rszshm.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * rszshm_heap_init - set up an allocator in a shared region
+ * @r: handle from rszshm_mk
+ *
+ * The heap lives in r->dat, and grows the region with rszshm_grow when
+ * it needs more room.  Only the process which made the region calls
+ * this, before any other process uses the heap; processes which attach
+ * with rszshm_at (or are forked) just use it.
+ *
+ * Every allocation is named by its offset from the start of the region,
+ * so it means the same thing in every process whatever its mapping, and
+ * can be stored in the region itself.  0 is never a valid offset.
+ *
+ * Example:
+ *	struct rszshm r;
+ *
+ *	if (!rszshm_mk(&r, 4*MiB, NULL))
+ *		err(1, "rszshm_mk");
+ *	if (rszshm_heap_init(&r) == -1)
+ *		err(1, "rszshm_heap_init");
+ *
+ * Returns: 0 on success, -1 on error (from rszshm_grow)
+ */
+int rszshm_heap_init(struct rszshm *r);
+
+/**
+ * rszshm_heap_alloc - allocate from the shared heap
+ * @r: this process's handle
+ * @size: bytes wanted
+ *
+ * Sizes up to a few kilobytes come from per-size free lists, taken and
+ * refilled with a single compare-and-swap: no locks, so no process can
+ * stall another by dying or being descheduled.  Larger sizes are rounded
+ * up to a power of 2 of 64k spans.  Freed memory is reused for the same
+ * size class; it is never coalesced or given back to the region.
+ *
+ * The allocation is 16-byte aligned, and belongs to this process until
+ * it is freed or published (see rszshm_heap_reclaim).
+ *
+ * Example:
+ *	uint64_t off = rszshm_heap_alloc(&r, 100);
+ *	char *p;
+ *
+ *	if (!off)
+ *		err(1, "rszshm_heap_alloc");
+ *	p = rszshm_heap_ptr(&r, off);
+ *	strcpy(p, "shared string");
+ *
+ * Returns: the offset of the allocation, or 0 (errno set) on error
+ */
+uint64_t rszshm_heap_alloc(struct rszshm *r, size_t size);
+
+/**
+ * rszshm_heap_free - free an allocation
+ * @r: this process's handle
+ * @off: the offset from rszshm_heap_alloc (or 0)
+ *
+ * Any process may free any allocation.
+ *
+ * Example:
+ *	rszshm_heap_free(&r, off);
+ */
+void rszshm_heap_free(struct rszshm *r, uint64_t off);
+
+/**
+ * rszshm_heap_ptr - get this process's pointer for an offset
+ * @r: this process's handle
+ * @off: the offset (or 0)
+ *
+ * This calls rszshm_up first, in case another process has grown the
+ * region to make room for @off.
+ *
+ * Returns: the pointer, or NULL for 0 (or if rszshm_up failed)
+ */
+void *rszshm_heap_ptr(struct rszshm *r, uint64_t off);
+
+/**
+ * rszshm_heap_off - get the offset for a pointer into the region
+ * @r: this process's handle
+ * @p: the pointer (or NULL)
+ *
+ * Returns: the offset, or 0 for NULL
+ */
+uint64_t rszshm_heap_off(const struct rszshm *r, const void *p);
+
+/**
+ * rszshm_heap_size - the usable size of an allocation
+ * @r: this process's handle
+ * @off: the offset from rszshm_heap_alloc
+ *
+ * Returns: at least the size asked for
+ */
+size_t rszshm_heap_size(struct rszshm *r, uint64_t off);
+
+/**
+ * rszshm_heap_root - get the region's root offset
+ * @r: this process's handle
+ *
+ * The heap keeps one offset for the application, so processes which
+ * attach later can find its data structures.
+ *
+ * Example:
+ *	uint64_t root = rszshm_heap_root(&r);
+ *	if (root)
+ *		printf("Root: %s\n", (char *)rszshm_heap_ptr(&r, root));
+ *
+ * Returns: the root offset, 0 if never set
+ */
+uint64_t rszshm_heap_root(struct rszshm *r);
+
+/**
+ * rszshm_heap_set_root - set the region's root offset, if unset
+ * @r: this process's handle
+ * @off: the new root (which should be published)
+ *
+ * Returns: true if it was unset, false if another process got there first
+ */
+bool rszshm_heap_set_root(struct rszshm *r, uint64_t off);
+
+/**
+ * rszshm_heap_publish - hand an allocation over to the region
+ * @r: this process's handle
+ * @off: the offset from rszshm_heap_alloc
+ *
+ * Once an allocation is linked into a shared data structure, it no longer
+ * belongs to the process which allocated it: rszshm_heap_reclaim will not
+ * free it when that process dies.
+ */
+void rszshm_heap_publish(struct rszshm *r, uint64_t off);
+
+/**
+ * rszshm_heap_reclaim - free what a dead process left behind
+ * @r: this process's handle
+ * @pid: the process which died
+ *
+ * A process which dies never leaves the heap locked or inconsistent, but
+ * whatever it had allocated (and not published) stays allocated, and so
+ * does a span it was carving into objects.  This walks the heap and
+ * frees all of those.  (At most one allocation which was half-way into or
+ * out of a free list when it died is simply lost.)
+ *
+ * Returns: how many allocations were freed, or -1 with errno EBUSY if
+ * @pid is still running
+ */
+long rszshm_heap_reclaim(struct rszshm *r, pid_t pid);
+
+/**
+ * rszshm_heap_check - check the heap's consistency
+ * @r: this process's handle
+ *
+ * This walks every span and free list; no process may be using the heap.
+ * Blocks lost by processes which died (see rszshm_heap_reclaim) are not
+ * errors.
+ *
+ * Returns: true if all is well
+ */
+bool rszshm_heap_check(struct rszshm *r);
+#endif /* CCAN_RSZSHM_HEAP_H */
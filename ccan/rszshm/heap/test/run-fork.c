@@ -0,0 +1,88 @@
+#include <ccan/rszshm/heap/heap.h>
+#include <ccan/rszshm/heap/heap.c>
+#include <ccan/tap/tap.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <stdio.h>
+
+#define PROCS 4
+#define LIVE 500
+#define ROUNDS 50000
+
+/* Each process keeps LIVE allocations, each filled with its own byte. */
+static bool hammer(struct rszshm *r, unsigned int seed, bool forever)
+{
+	uint64_t offs[LIVE] = { 0 };
+	size_t len[LIVE];
+	unsigned int i, n;
+
+	srandom(seed);
+	for (i = 0; forever || i < ROUNDS; i++) {
+		n = random() % LIVE;
+		if (offs[n]) {
+			unsigned char *p = rszshm_heap_ptr(r, offs[n]);
+			if (p[0] != (unsigned char)n
+			    || p[len[n]-1] != (unsigned char)n)
+				return false;
+			rszshm_heap_free(r, offs[n]);
+		}
+		/* Mostly small, a few big ones. */
+		len[n] = random() % 64 ? random() % 1000 + 1
+			: random() % 100000 + 1;
+		offs[n] = rszshm_heap_alloc(r, len[n]);
+		if (!offs[n])
+			return false;
+		memset(rszshm_heap_ptr(r, offs[n]), n, len[n]);
+	}
+	for (n = 0; n < LIVE; n++)
+		rszshm_heap_free(r, offs[n]);
+	return true;
+}
+
+int main(void)
+{
+	struct rszshm r;
+	unsigned int i, bad = 0;
+	pid_t victim;
+	int status;
+
+	plan_tests(5);
+
+	if (!rszshm_mk(&r, 4096, NULL))
+		err(1, "rszshm_mk");
+	rszshm_heap_init(&r);
+
+	fflush(stdout);
+	for (i = 0; i < PROCS; i++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			_exit(hammer(&r, i, false) ? 0 : 1);
+		}
+	}
+	/* This one gets killed, wherever it is. */
+	victim = fork();
+	if (victim == 0)
+		_exit(hammer(&r, PROCS, true) ? 0 : 1);
+
+	for (i = 0; i < PROCS; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status)
+		    || WEXITSTATUS(status) != 0)
+			bad++;
+	}
+	ok1(bad == 0);
+
+	kill(victim, SIGKILL);
+	ok1(waitpid(victim, &status, 0) == victim && WIFSIGNALED(status));
+	/* Not every block it held, if it was mid-free or mid-alloc. */
+	ok1(rszshm_heap_reclaim(&r, victim) >= LIVE - 1);
+	ok1(rszshm_heap_check(&r));
+
+	/* And the heap is still good to use. */
+	ok1(hammer(&r, PROCS + 1, false));
+
+	rszshm_rm(&r);
+	rszshm_dt(&r);
+	return exit_status();
+}
@@ -0,0 +1,160 @@
+#include <ccan/rszshm/heap/heap.h>
+#include <ccan/rszshm/heap/heap.c>
+#include <ccan/tap/tap.h>
+#include <sys/wait.h>
+#include <err.h>
+#include <stdio.h>
+
+#define NUM 5000
+
+static uint64_t offs[NUM];
+
+/* Each class is the smallest which fits, the slow way. */
+static bool classes_ok(void)
+{
+	size_t size;
+	int c;
+
+	for (size = 0; size < 4 * SPAN_SIZE; size++) {
+		c = size_to_class(size);
+		if (c < 0 || c >= CLASSES)
+			return false;
+		if (c < SMALL_CLASSES) {
+			if (class_size(c) < size + BLOCK_HEADER)
+				return false;
+			if (c > 0 && class_size(c-1) >= size + BLOCK_HEADER)
+				return false;
+		} else if (class_size(c) < size + BLOCK_HEADER + SPAN_HEADER)
+			return false;
+	}
+	for (c = 1; c < SMALL_CLASSES; c++)
+		if (class_size(c) <= class_size(c-1) || class_size(c) % 16)
+			return false;
+	return size_to_class((SPAN_SIZE << (LARGE_CLASSES - 1))) == -1;
+}
+
+static bool distinct(struct rszshm *r, unsigned int num, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		char *p = rszshm_heap_ptr(r, offs[i]);
+		if (!p || offs[i] % 16 || rszshm_heap_size(r, offs[i]) < size)
+			return false;
+		memset(p, i, size);
+	}
+	for (i = 0; i < num; i++) {
+		unsigned char *p = rszshm_heap_ptr(r, offs[i]);
+		if (p[0] != (unsigned char)i || p[size-1] != (unsigned char)i)
+			return false;
+	}
+	return true;
+}
+
+int main(void)
+{
+	struct rszshm r;
+	unsigned int i, class;
+	uint64_t off, big, span;
+	size_t flen;
+	pid_t child;
+	int status;
+
+	plan_tests(32);
+
+	ok1(classes_ok());
+
+	if (!rszshm_mk(&r, 4096, NULL))
+		err(1, "rszshm_mk");
+	flen = r.flen;
+	ok1(rszshm_heap_init(&r) == 0);
+	ok1(rszshm_heap_check(&r));
+	ok1(rszshm_heap_root(&r) == 0);
+
+	/* Grows the region as needed. */
+	for (i = 0; i < NUM; i++)
+		offs[i] = rszshm_heap_alloc(&r, 100);
+	ok1(r.flen > flen);
+	ok1(distinct(&r, NUM, 100));
+	ok1(rszshm_heap_check(&r));
+	ok1(rszshm_heap_off(&r, rszshm_heap_ptr(&r, offs[0])) == offs[0]);
+	ok1(rszshm_heap_ptr(&r, 0) == NULL && rszshm_heap_off(&r, NULL) == 0);
+
+	/* Freed ones are reused, last freed first. */
+	off = offs[NUM/2];
+	rszshm_heap_free(&r, off);
+	rszshm_heap_free(&r, off);
+	ok1(rszshm_heap_check(&r));
+	ok1(rszshm_heap_alloc(&r, 90) == off);
+	for (i = 0; i < NUM; i++)
+		rszshm_heap_free(&r, offs[i]);
+	rszshm_heap_free(&r, 0);
+	ok1(rszshm_heap_check(&r));
+	flen = r.flen;
+	for (i = 0; i < NUM; i++)
+		offs[i] = rszshm_heap_alloc(&r, 97);
+	ok1(r.flen == flen);
+	ok1(distinct(&r, NUM, 97));
+
+	/* Every size class, small and large. */
+	for (i = 0; i < 200; i++)
+		rszshm_heap_free(&r, offs[i]);
+	for (i = 0; i < 200; i++)
+		offs[i] = rszshm_heap_alloc(&r, i * 997);
+	for (i = 0; i < 200; i++)
+		if (!offs[i] || rszshm_heap_size(&r, offs[i]) < i * 997)
+			break;
+	ok1(i == 200);
+	ok1(rszshm_heap_check(&r));
+	big = rszshm_heap_alloc(&r, 1000000);
+	ok1(big && rszshm_heap_size(&r, big) >= 1000000);
+	memset(rszshm_heap_ptr(&r, big), 0xFF, 1000000);
+	ok1(rszshm_heap_check(&r));
+	rszshm_heap_free(&r, big);
+	ok1(rszshm_heap_alloc(&r, 999999) == big);
+
+	/* Losing the race to install a span frees the rest of its blocks. */
+	class = size_to_class(1000);
+	span = claim_spans(&r, 1, class);
+	free_rest(&r, span, class);
+	ok1(rszshm_heap_check(&r));
+	for (i = 1; i < ((struct span_header *)at(&r, span))->num; i++) {
+		off = rszshm_heap_alloc(&r, 1000);
+		if (off < span || off >= span + SPAN_SIZE)
+			break;
+	}
+	ok1(i == ((struct span_header *)at(&r, span))->num);
+
+	/* Too big for the region, or anything. */
+	errno = 0;
+	ok1(rszshm_heap_alloc(&r, r.hdr->max) == 0 && errno == ENOMEM);
+	ok1(rszshm_heap_alloc(&r, -1UL) == 0);
+	ok1(rszshm_heap_check(&r));
+
+	/* Root can only be set once. */
+	ok1(rszshm_heap_set_root(&r, offs[0]));
+	ok1(!rszshm_heap_set_root(&r, offs[1]));
+	ok1(rszshm_heap_root(&r) == offs[0]);
+
+	/* A child allocates, publishes one, and dies. */
+	fflush(stdout);
+	child = fork();
+	if (child == 0) {
+		for (i = 0; i < 100; i++)
+			offs[i] = rszshm_heap_alloc(&r, 200);
+		rszshm_heap_publish(&r, offs[0]);
+		*(uint64_t *)rszshm_heap_ptr(&r, rszshm_heap_root(&r)) = offs[0];
+		_exit(0);
+	}
+	ok1(rszshm_heap_reclaim(&r, getpid()) == -1 && errno == EBUSY);
+	waitpid(child, &status, 0);
+	off = *(uint64_t *)rszshm_heap_ptr(&r, rszshm_heap_root(&r));
+	ok1(rszshm_heap_reclaim(&r, child) == 99);
+	ok1(rszshm_heap_check(&r));
+	ok1(rszshm_heap_size(&r, off) >= 200);
+	ok1(rszshm_heap_reclaim(&r, child) == 0);
+
+	rszshm_rm(&r);
+	rszshm_dt(&r);
+	return exit_status();
+}
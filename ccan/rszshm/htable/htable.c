@@ -0,0 +1,311 @@
+/* Licensed under Apache License v2.0 - see LICENSE file for details */
+#include "config.h"
+#include <ccan/rszshm/htable/htable.h>
+#include <ccan/hash/hash.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * A fixed array of buckets, each a chain of immutable entries in the
+ * heap.  Writers to a bucket take its lock, which holds their pid so a
+ * dead holder can be noticed and replaced.  Every change to a chain is a
+ * single store, so a writer dying anywhere leaves it intact.
+ *
+ * Readers take no lock.  Each bucket has a sequence count which is odd
+ * while a writer changes its chain (and frees what it took out), so a
+ * reader which saw it change may have read freed memory, and retries.
+ * The heap never unmaps anything, so such reads are harmless as long as
+ * they stay inside the region.
+ */
+#define HTABLE_MAGIC 0x6873686d68746162ULL
+
+struct bucket {
+	_Atomic(int32_t) lock;
+	_Atomic(uint32_t) seq;
+	_Atomic(uint64_t) head;
+};
+
+struct table {
+	uint64_t magic;
+	uint64_t buckets;
+	_Atomic(uint64_t) count;
+	uint64_t unused;
+	struct bucket bucket[];
+};
+
+struct entry {
+	_Atomic(uint64_t) next;
+	uint64_t hash;
+	uint32_t klen, vlen;
+	/* Key, then value. */
+	char data[];
+};
+
+static uint64_t hash_key(const void *key, size_t klen)
+{
+	/* Stable, so processes built differently agree. */
+	return hash64_stable((const unsigned char *)key, klen, 0);
+}
+
+/* The bucket for h, or NULL if we can't map it. */
+static struct bucket *bucket_of(struct rszshm *r, uint64_t ht, uint64_t h)
+{
+	struct table *t = rszshm_heap_ptr(r, ht);
+	uint64_t off;
+
+	if (!t)
+		return NULL;
+	off = ht + offsetof(struct table, bucket)
+		+ (h % t->buckets) * sizeof(struct bucket);
+	if (!rszshm_heap_ptr(r, off + sizeof(struct bucket)))
+		return NULL;
+	return rszshm_heap_ptr(r, off);
+}
+
+/* The entry at off, if all of it is inside the region. */
+static struct entry *entry_at(struct rszshm *r, uint64_t off)
+{
+	struct entry *e = rszshm_heap_ptr(r, off);
+
+	if (!e || !rszshm_heap_ptr(r, off + sizeof(*e))
+	    || !rszshm_heap_ptr(r, off + sizeof(*e) + e->klen + e->vlen))
+		return NULL;
+	return e;
+}
+
+static bool dead(pid_t pid)
+{
+	return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+static void lock(struct bucket *b, pid_t me)
+{
+	unsigned int spins = 0;
+
+	for (;;) {
+		int32_t holder = 0;
+
+		if (atomic_compare_exchange_weak(&b->lock, &holder, me))
+			break;
+		if (holder && ++spins % 128 == 0) {
+			if (dead(holder)
+			    && atomic_compare_exchange_strong(&b->lock,
+							      &holder, me))
+				break;
+			sched_yield();
+		}
+	}
+	/* A holder which died mid-change left it odd. */
+	if (atomic_load(&b->seq) % 2)
+		atomic_fetch_add(&b->seq, 1);
+}
+
+static void unlock(struct bucket *b)
+{
+	atomic_store_explicit(&b->lock, 0, memory_order_release);
+}
+
+/* Replace *link with off, where readers may be looking. */
+static void relink(struct bucket *b, _Atomic(uint64_t) *link, uint64_t off)
+{
+	atomic_fetch_add(&b->seq, 1);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(link, off, memory_order_release);
+	atomic_fetch_add_explicit(&b->seq, 1, memory_order_release);
+}
+
+/* With the lock held: the link to key's entry, or to the chain's end. */
+static _Atomic(uint64_t) *find(struct rszshm *r, struct bucket *b,
+			       uint64_t h, const void *key, size_t klen)
+{
+	_Atomic(uint64_t) *link = &b->head;
+	uint64_t off;
+
+	while ((off = atomic_load_explicit(link, memory_order_relaxed))) {
+		struct entry *e = rszshm_heap_ptr(r, off);
+
+		if (e->hash == h && e->klen == klen
+		    && memcmp(e->data, key, klen) == 0)
+			break;
+		link = &e->next;
+	}
+	return link;
+}
+
+uint64_t rszshm_htable_new(struct rszshm *r, size_t buckets)
+{
+	struct table *t;
+	uint64_t off;
+	size_t i;
+
+	if (!buckets) {
+		errno = EINVAL;
+		return 0;
+	}
+	off = rszshm_heap_alloc(r, sizeof(*t) + buckets * sizeof(t->bucket[0]));
+	if (!off)
+		return 0;
+	t = rszshm_heap_ptr(r, off);
+	t->magic = HTABLE_MAGIC;
+	t->buckets = buckets;
+	atomic_init(&t->count, 0);
+	for (i = 0; i < buckets; i++) {
+		atomic_init(&t->bucket[i].lock, 0);
+		atomic_init(&t->bucket[i].seq, 0);
+		atomic_init(&t->bucket[i].head, 0);
+	}
+	rszshm_heap_publish(r, off);
+	return off;
+}
+
+bool rszshm_htable_set(struct rszshm *r, uint64_t ht,
+		       const void *key, size_t klen,
+		       const void *val, size_t vlen)
+{
+	uint64_t h = hash_key(key, klen), off, old;
+	_Atomic(uint64_t) *link;
+	struct bucket *b;
+	struct entry *e;
+
+	if (klen > UINT32_MAX || vlen > UINT32_MAX) {
+		errno = EINVAL;
+		return false;
+	}
+	off = rszshm_heap_alloc(r, sizeof(*e) + klen + vlen);
+	if (!off)
+		return false;
+	e = rszshm_heap_ptr(r, off);
+	e->hash = h;
+	e->klen = klen;
+	e->vlen = vlen;
+	memcpy(e->data, key, klen);
+	memcpy(e->data + klen, val, vlen);
+	/* If we die now, it's lost rather than freed while linked. */
+	rszshm_heap_publish(r, off);
+
+	b = bucket_of(r, ht, h);
+	if (!b) {
+		rszshm_heap_free(r, off);
+		return false;
+	}
+	lock(b, getpid());
+	link = find(r, b, h, key, klen);
+	old = atomic_load_explicit(link, memory_order_relaxed);
+	if (old) {
+		struct entry *o = rszshm_heap_ptr(r, old);
+
+		atomic_init(&e->next, atomic_load(&o->next));
+		relink(b, link, off);
+	} else {
+		atomic_init(&e->next, 0);
+		relink(b, link, off);
+		atomic_fetch_add(&((struct table *)rszshm_heap_ptr(r, ht))
+				 ->count, 1);
+	}
+	unlock(b);
+	rszshm_heap_free(r, old);
+	return true;
+}
+
+bool rszshm_htable_del(struct rszshm *r, uint64_t ht,
+		       const void *key, size_t klen)
+{
+	uint64_t h = hash_key(key, klen), old;
+	_Atomic(uint64_t) *link;
+	struct bucket *b = bucket_of(r, ht, h);
+
+	if (!b)
+		return false;
+	lock(b, getpid());
+	link = find(r, b, h, key, klen);
+	old = atomic_load_explicit(link, memory_order_relaxed);
+	if (old) {
+		struct entry *o = rszshm_heap_ptr(r, old);
+
+		relink(b, link, atomic_load(&o->next));
+		atomic_fetch_sub(&((struct table *)rszshm_heap_ptr(r, ht))
+				 ->count, 1);
+	}
+	unlock(b);
+	rszshm_heap_free(r, old);
+	return old != 0;
+}
+
+/* Wait for an even sequence count. */
+static uint32_t read_begin(struct bucket *b)
+{
+	unsigned int spins = 0;
+	uint32_t seq;
+
+	while ((seq = atomic_load_explicit(&b->seq, memory_order_acquire))
+	       % 2) {
+		/* Its writer may be dead: lock repairs that. */
+		if (++spins % 128 == 0) {
+			lock(b, getpid());
+			unlock(b);
+		}
+	}
+	return seq;
+}
+
+static bool read_retry(struct bucket *b, uint32_t seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&b->seq, memory_order_relaxed) != seq;
+}
+
+ssize_t rszshm_htable_get(struct rszshm *r, uint64_t ht,
+			  const void *key, size_t klen,
+			  void *val, size_t max)
+{
+	uint64_t h = hash_key(key, klen), off;
+	struct bucket *b = bucket_of(r, ht, h);
+	unsigned int steps;
+	uint32_t seq;
+
+	if (!b)
+		return -1;
+again:
+	seq = read_begin(b);
+	off = atomic_load_explicit(&b->head, memory_order_acquire);
+	for (steps = 1; off; steps++) {
+		struct entry *e = entry_at(r, off);
+		uint32_t vlen;
+
+		/* Garbage offset: the chain changed under us? */
+		if (!e) {
+			if (read_retry(b, seq))
+				goto again;
+			return -1;
+		}
+		if (e->hash == h && e->klen == klen
+		    && memcmp(e->data, key, klen) == 0) {
+			vlen = e->vlen;
+			if (max)
+				memcpy(val, e->data + klen,
+				       vlen < max ? vlen : max);
+			if (read_retry(b, seq))
+				goto again;
+			return vlen;
+		}
+		off = atomic_load_explicit(&e->next, memory_order_acquire);
+		/* A chain this long may be a loop through freed entries. */
+		if (steps % 64 == 0 && read_retry(b, seq))
+			goto again;
+	}
+	if (read_retry(b, seq))
+		goto again;
+	return -1;
+}
+
+size_t rszshm_htable_count(struct rszshm *r, uint64_t ht)
+{
+	struct table *t = rszshm_heap_ptr(r, ht);
+
+	return atomic_load(&t->count);
+}
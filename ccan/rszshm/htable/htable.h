@@ -0,0 +1,109 @@
+/* Licensed under Apache License v2.0 - see LICENSE file for details */
+#ifndef CCAN_RSZSHM_HTABLE_H
+#define CCAN_RSZSHM_HTABLE_H
+#include "config.h"
+#include <ccan/rszshm/heap/heap.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * rszshm_htable_new - make a hash table in a shared heap
+ * @r: handle of a region with a heap (see rszshm_heap_init)
+ * @buckets: number of buckets (fixed for the table's life)
+ *
+ * Keys and values are byte strings, copied into the heap.  The table
+ * never resizes, so pick @buckets near the number of entries you expect.
+ *
+ * Store the offset somewhere other processes can find it, such as the
+ * heap's root.
+ *
+ * Example:
+ *	struct rszshm r;
+ *	uint64_t ht;
+ *
+ *	if (!rszshm_mk(&r, 4*MiB, NULL) || rszshm_heap_init(&r) == -1)
+ *		err(1, "Making heap");
+ *	ht = rszshm_htable_new(&r, 1024);
+ *	if (!ht || !rszshm_heap_set_root(&r, ht))
+ *		err(1, "Making table");
+ *
+ * Returns: the table's offset, or 0 (errno set) on error
+ */
+uint64_t rszshm_htable_new(struct rszshm *r, size_t buckets);
+
+/**
+ * rszshm_htable_set - add or replace an entry
+ * @r: this process's handle
+ * @ht: the offset from rszshm_htable_new
+ * @key: the key
+ * @klen: its length in bytes
+ * @val: the value
+ * @vlen: its length in bytes
+ *
+ * Writers to the same bucket take turns, with a lock which names its
+ * holder: if the holder dies, the next writer takes it over.  Readers
+ * never wait for writers.
+ *
+ * Example:
+ *	const char *greeting = "hello";
+ *
+ *	if (!rszshm_htable_set(&r, ht, "greeting", 8, greeting, 6))
+ *		err(1, "Setting greeting");
+ *
+ * Returns: false (errno set) if the heap is out of room
+ */
+bool rszshm_htable_set(struct rszshm *r, uint64_t ht,
+		       const void *key, size_t klen,
+		       const void *val, size_t vlen);
+
+/**
+ * rszshm_htable_get - copy out an entry's value
+ * @r: this process's handle
+ * @ht: the offset from rszshm_htable_new
+ * @key: the key
+ * @klen: its length in bytes
+ * @val: where to copy the value
+ * @max: the room at @val
+ *
+ * This takes no locks and writes nothing shared: it reads the bucket,
+ * then checks no writer changed it meanwhile (retrying if one did).  At
+ * most @max bytes are copied, as with snprintf.
+ *
+ * Example:
+ *	char buf[100];
+ *	ssize_t len = rszshm_htable_get(&r, ht, "greeting", 8,
+ *					buf, sizeof(buf));
+ *	if (len >= 0 && len <= sizeof(buf))
+ *		printf("%.*s\n", (int)len, buf);
+ *
+ * Returns: the length of the value, or -1 if there is no such key
+ */
+ssize_t rszshm_htable_get(struct rszshm *r, uint64_t ht,
+			  const void *key, size_t klen,
+			  void *val, size_t max);
+
+/**
+ * rszshm_htable_del - remove an entry
+ * @r: this process's handle
+ * @ht: the offset from rszshm_htable_new
+ * @key: the key
+ * @klen: its length in bytes
+ *
+ * Example:
+ *	rszshm_htable_del(&r, ht, "greeting", 8);
+ *
+ * Returns: true if the key was there
+ */
+bool rszshm_htable_del(struct rszshm *r, uint64_t ht,
+		       const void *key, size_t klen);
+
+/**
+ * rszshm_htable_count - number of entries
+ * @r: this process's handle
+ * @ht: the offset from rszshm_htable_new
+ *
+ * A writer which dies half-way through may leave this one out.
+ */
+size_t rszshm_htable_count(struct rszshm *r, uint64_t ht);
+#endif /* CCAN_RSZSHM_HTABLE_H */
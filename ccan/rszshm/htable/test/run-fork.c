@@ -0,0 +1,122 @@
+#include <ccan/rszshm/htable/htable.h>
+#include <ccan/rszshm/htable/htable.c>
+#include <ccan/tap/tap.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+
+#define WRITERS 3
+#define READERS 3
+#define KEYS 1000
+#define ROUNDS 20000
+
+/* Every value for key k is some bytes of k, and says how many. */
+struct val {
+	unsigned int len;
+	unsigned char bytes[200];
+};
+
+static bool write_some(struct rszshm *r, uint64_t ht, unsigned int seed,
+		       bool forever)
+{
+	struct val v;
+	unsigned int i, k;
+
+	srandom(seed);
+	for (i = 0; forever || i < ROUNDS; i++) {
+		k = random() % KEYS;
+		if (random() % 4 == 0) {
+			rszshm_htable_del(r, ht, &k, sizeof(k));
+			continue;
+		}
+		v.len = random() % sizeof(v.bytes);
+		memset(v.bytes, k, v.len);
+		if (!rszshm_htable_set(r, ht, &k, sizeof(k), &v,
+				       sizeof(v.len) + v.len))
+			return false;
+	}
+	return true;
+}
+
+static bool read_some(struct rszshm *r, uint64_t ht, unsigned int seed)
+{
+	struct val v;
+	unsigned int i, j, k;
+	ssize_t len;
+
+	srandom(seed);
+	for (i = 0; i < ROUNDS * 2; i++) {
+		k = random() % KEYS;
+		len = rszshm_htable_get(r, ht, &k, sizeof(k), &v, sizeof(v));
+		if (len == -1)
+			continue;
+		if (len != sizeof(v.len) + v.len)
+			return false;
+		for (j = 0; j < v.len; j++)
+			if (v.bytes[j] != (unsigned char)k)
+				return false;
+	}
+	return true;
+}
+
+int main(void)
+{
+	struct rszshm r;
+	unsigned int i, k, bad = 0, found;
+	uint64_t ht;
+	pid_t victim;
+	int status;
+	bool ok;
+
+	plan_tests(5);
+
+	if (!rszshm_mk(&r, 4096, NULL) || rszshm_heap_init(&r) == -1)
+		err(1, "Making heap");
+	ht = rszshm_htable_new(&r, KEYS / 8);
+
+	fflush(stdout);
+	for (i = 0; i < WRITERS + READERS; i++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			_exit((i < WRITERS ? write_some(&r, ht, i, false)
+			       : read_some(&r, ht, i)) ? 0 : 1);
+		}
+	}
+	/* This one gets killed, wherever it is (maybe holding a lock). */
+	victim = fork();
+	if (victim == 0)
+		_exit(write_some(&r, ht, i, true) ? 0 : 1);
+
+	for (i = 0; i < WRITERS + READERS; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status)
+		    || WEXITSTATUS(status) != 0)
+			bad++;
+	}
+	ok1(bad == 0);
+
+	kill(victim, SIGKILL);
+	ok1(waitpid(victim, &status, 0) == victim && WIFSIGNALED(status));
+	rszshm_heap_reclaim(&r, victim);
+
+	/* Every bucket is still usable. */
+	ok1(write_some(&r, ht, i + 1, false) && read_some(&r, ht, i + 2));
+	for (k = 0, found = 0; k < KEYS; k++)
+		if (rszshm_htable_get(&r, ht, &k, sizeof(k), NULL, 0) != -1)
+			found++;
+	/* It may have died between linking and counting. */
+	ok1(rszshm_htable_count(&r, ht) - found <= 1
+	    || found - rszshm_htable_count(&r, ht) <= 1);
+
+	for (k = 0, ok = true; k < KEYS; k++)
+		ok &= rszshm_htable_set(&r, ht, &k, sizeof(k), &k, sizeof(k));
+	for (k = 0; k < KEYS; k++)
+		ok &= rszshm_htable_del(&r, ht, &k, sizeof(k));
+	ok1(ok && rszshm_heap_check(&r));
+
+	rszshm_rm(&r);
+	rszshm_dt(&r);
+	return exit_status();
+}
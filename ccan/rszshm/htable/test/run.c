@@ -0,0 +1,106 @@
+#include <ccan/rszshm/htable/htable.h>
+#include <ccan/rszshm/htable/htable.c>
+#include <ccan/tap/tap.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+
+#define NUM 10000
+
+static bool get_num(struct rszshm *r, uint64_t ht, unsigned int i,
+		    unsigned int want)
+{
+	unsigned int val;
+
+	return rszshm_htable_get(r, ht, &i, sizeof(i), &val, sizeof(val))
+		== sizeof(val) && val == want;
+}
+
+int main(void)
+{
+	struct rszshm r;
+	uint64_t ht;
+	struct bucket *b;
+	char buf[10];
+	unsigned int i;
+	bool ok;
+	pid_t pid;
+
+	plan_tests(27);
+
+	if (!rszshm_mk(&r, 4096, NULL) || rszshm_heap_init(&r) == -1)
+		err(1, "Making heap");
+
+	errno = 0;
+	ok1(rszshm_htable_new(&r, 0) == 0 && errno == EINVAL);
+	ht = rszshm_htable_new(&r, 64);
+	ok1(ht);
+	ok1(rszshm_htable_count(&r, ht) == 0);
+
+	ok1(rszshm_htable_get(&r, ht, "a", 1, buf, sizeof(buf)) == -1);
+	ok1(rszshm_htable_set(&r, ht, "a", 1, "hello", 5));
+	ok1(rszshm_htable_count(&r, ht) == 1);
+	memset(buf, 0, sizeof(buf));
+	ok1(rszshm_htable_get(&r, ht, "a", 1, buf, sizeof(buf)) == 5);
+	ok1(memcmp(buf, "hello", 5) == 0);
+
+	/* Too long: copies what fits, says how long it was. */
+	memset(buf, 0, sizeof(buf));
+	ok1(rszshm_htable_get(&r, ht, "a", 1, buf, 2) == 5);
+	ok1(memcmp(buf, "he\0", 3) == 0);
+
+	/* Replacing keeps the count. */
+	ok1(rszshm_htable_set(&r, ht, "a", 1, "bye", 3));
+	ok1(rszshm_htable_count(&r, ht) == 1);
+	ok1(rszshm_htable_get(&r, ht, "a", 1, buf, sizeof(buf)) == 3
+	    && memcmp(buf, "bye", 3) == 0);
+
+	/* Empty keys and values are fine. */
+	ok1(rszshm_htable_set(&r, ht, "", 0, "", 0));
+	ok1(rszshm_htable_get(&r, ht, "", 0, buf, sizeof(buf)) == 0);
+
+	ok1(rszshm_htable_del(&r, ht, "a", 1));
+	ok1(!rszshm_htable_del(&r, ht, "a", 1));
+	ok1(rszshm_htable_del(&r, ht, "", 0));
+	ok1(rszshm_htable_count(&r, ht) == 0);
+
+	/* Long chains. */
+	for (i = 0, ok = true; i < NUM; i++)
+		ok &= rszshm_htable_set(&r, ht, &i, sizeof(i), &i, sizeof(i));
+	ok1(ok && rszshm_htable_count(&r, ht) == NUM);
+	for (i = 0, ok = true; i < NUM; i += 2)
+		ok &= rszshm_htable_del(&r, ht, &i, sizeof(i));
+	for (i = 0; i < NUM; i++)
+		ok &= (i % 2) ? get_num(&r, ht, i, i)
+			: rszshm_htable_get(&r, ht, &i, sizeof(i), NULL, 0) == -1;
+	ok1(ok && rszshm_htable_count(&r, ht) == NUM / 2);
+
+	/* A writer died holding a lock, mid-change. */
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0)
+		_exit(0);
+	waitpid(pid, NULL, 0);
+	i = 1;
+	b = bucket_of(&r, ht, hash_key(&i, sizeof(i)));
+	atomic_store(&b->lock, pid);
+	atomic_store(&b->seq, atomic_load(&b->seq) | 1);
+	/* Readers don't wait forever... */
+	ok1(get_num(&r, ht, 1, 1));
+	ok1(atomic_load(&b->lock) == 0 && atomic_load(&b->seq) % 2 == 0);
+	/* ...nor do writers. */
+	atomic_store(&b->lock, pid);
+	atomic_store(&b->seq, atomic_load(&b->seq) | 1);
+	ok1(rszshm_htable_set(&r, ht, &i, sizeof(i), &pid, sizeof(pid)));
+	ok1(get_num(&r, ht, 1, pid));
+
+	for (i = 0; i < NUM; i++)
+		rszshm_htable_del(&r, ht, &i, sizeof(i));
+	ok1(rszshm_htable_count(&r, ht) == 0);
+	ok1(rszshm_heap_check(&r));
+
+	rszshm_rm(&r);
+	rszshm_dt(&r);
+	return exit_status();
+}
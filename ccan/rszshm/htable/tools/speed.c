@@ -0,0 +1,113 @@
+/*
+ * Multi-process speed test for rszshm/htable (and the heap under it).
+ *
+ * Each process does random lookups in a table of KEYS entries, some
+ * fraction of them replaced by a set of a fresh value: a set frees the
+ * old entry and allocates a new one, so it exercises the heap too.
+ *
+ * Usage: speed [ops-per-process] [max-processes]
+ */
+#include <ccan/rszshm/htable/htable.h>
+#include <ccan/time/time.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define KEYS 100000
+#define VAL_SIZE 100
+
+static unsigned long num;
+static struct rszshm r;
+static uint64_t ht;
+
+static unsigned long next(unsigned long long *s)
+{
+	*s = *s * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *s >> 33;
+}
+
+/* One in every set_every operations is a set (0 for none). */
+static void run(unsigned int set_every, unsigned int seed)
+{
+	unsigned long long s = seed;
+	char val[VAL_SIZE];
+	unsigned long i, k;
+
+	memset(val, seed, sizeof(val));
+	for (i = 0; i < num; i++) {
+		k = next(&s) % KEYS;
+		if (set_every && i % set_every == 0) {
+			if (!rszshm_htable_set(&r, ht, &k, sizeof(k),
+					       val, sizeof(val)))
+				err(1, "rszshm_htable_set");
+		} else if (rszshm_htable_get(&r, ht, &k, sizeof(k),
+					     val, sizeof(val)) != sizeof(val))
+			errx(1, "Key %lu missing", k);
+	}
+}
+
+static double bench(unsigned int set_every, unsigned int procs)
+{
+	struct timeabs start;
+	unsigned int i;
+	int status;
+
+	start = time_now();
+	for (i = 0; i < procs; i++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			run(set_every, i);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < procs; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status)
+		    || WEXITSTATUS(status) != 0)
+			errx(1, "Child failed");
+	}
+	return (double)num * procs
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int procs, max_procs = 4;
+	char val[VAL_SIZE] = { 0 };
+	unsigned long k;
+
+	num = 5000000;
+	if (argc > 1)
+		num = atol(argv[1]);
+	if (argc > 2)
+		max_procs = atoi(argv[2]);
+
+	if (!rszshm_mk(&r, 64*1024*1024, NULL) || rszshm_heap_init(&r) == -1)
+		err(1, "Making heap");
+	ht = rszshm_htable_new(&r, KEYS);
+	if (!ht)
+		err(1, "rszshm_htable_new");
+	for (k = 0; k < KEYS; k++)
+		if (!rszshm_htable_set(&r, ht, &k, sizeof(k), val, sizeof(val)))
+			err(1, "rszshm_htable_set");
+
+	printf("%lu operations per process on %u keys (Mops/sec):\n",
+	       num, KEYS);
+	printf("procs\tget only\t10%% set\t\tset only\n");
+	for (procs = 1; procs <= max_procs; procs *= 2) {
+		double get = bench(0, procs);
+		double mixed = bench(10, procs);
+		double set = bench(1, procs);
+
+		printf("%u\t%.1f\t\t%.1f\t\t%.1f\n", procs, get, mixed, set);
+	}
+
+	rszshm_rm(&r);
+	rszshm_dt(&r);
+	return 0;
+}
@@ -6,17 +6,99 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/file.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#endif
 
 #define pgup(x, pgsz) (((x) + (pgsz) - 1) & ~((pgsz) - 1))
 
-void *rszshm_mk(struct rszshm *r, size_t flen, const char *fname, struct rszshm_scan scan)
+#define HUGETLBFS_MAGIC 0x958458f6
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#define MPOL_F_MEMS_ALLOWED (1<<2)
+#define MPOL_MF_MOVE (1<<1)
+#define RSZSHM_POLICY_MASK (RSZSHM_THP|RSZSHM_POPULATE|RSZSHM_INTERLEAVE|RSZSHM_BIND)
+
+/* page size of the file's mapping: the huge page size on hugetlbfs */
+static long pagesize(int fd)
 {
 	long pgsz = sysconf(_SC_PAGE_SIZE);
+#ifdef __linux__
+	struct statfs sfs;
+
+	if (fstatfs(fd, &sfs) == 0 && sfs.f_type == HUGETLBFS_MAGIC)
+		pgsz = sfs.f_bsize;
+#endif
+	return pgsz;
+}
+
+static int populate(char *p, size_t len, long pgsz)
+{
+	size_t i;
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(p, len, MADV_POPULATE_WRITE) == 0)
+		return 0;
+	if (errno != EINVAL)
+		return -1;
+#endif
+	/* older kernels: a read fault allocates shmem and hugetlbfs pages */
+	for (i = 0; i < len; i += pgsz)
+		(void) *(volatile char *) (p + i);
+	return 0;
+}
+
+static int numa(char *p, size_t len, unsigned long policy, unsigned long nodes, unsigned mvflags)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	int mode = policy & RSZSHM_BIND ? MPOL_BIND : MPOL_INTERLEAVE;
+
+	/* the kernel drops the last bit of maxnode */
+	return syscall(SYS_mbind, p, len, mode, &nodes, sizeof(nodes) * 8 + 1, mvflags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* apply the region's policy to [from, to) of this process's mapping */
+static int place(struct rszshm *r, size_t from, size_t to, unsigned mvflags)
+{
+	unsigned long policy = r->hdr->policy;
+	char *p = (char *) r->hdr + from;
+	int ret = 0;
+
+	if (from == to || !policy)
+		return 0;
+
+	if (policy & RSZSHM_THP) {
+#ifdef MADV_HUGEPAGE
+		if (madvise(p, to - from, MADV_HUGEPAGE) == -1)
+			ret = -1;
+#else
+		errno = ENOSYS;
+		ret = -1;
+#endif
+	}
+	if (policy & (RSZSHM_INTERLEAVE|RSZSHM_BIND) &&
+	    numa(p, to - from, policy, r->hdr->nodes, mvflags) == -1)
+		ret = -1;
+	/* last, so pages are allocated where the policy says */
+	if (policy & RSZSHM_POPULATE && populate(p, to - from, pagesize(r->fd)) == -1)
+		ret = -1;
+	return ret;
+}
+
+void *rszshm_mk(struct rszshm *r, size_t flen, const char *fname, struct rszshm_scan scan)
+{
+	long pgsz = sysconf(_SC_PAGE_SIZE), hpgsz;
 	int i, errno_;
 	char *m, *tgt, *p = NULL;
 
@@ -59,13 +141,22 @@ void *rszshm_mk(struct rszshm *r, size_t flen, const char *fname, struct rszshm_
 	if ((r->fd = open(r->fname, O_CREAT|O_EXCL|O_RDWR, p ? 0600 : 0666)) == -1)
 		goto err;
 
+	if ((hpgsz = pagesize(r->fd)) != pgsz) {
+		flen = pgup(flen, hpgsz);
+		scan.len &= ~(hpgsz - 1);
+		if ((uintptr_t) m % hpgsz || flen > scan.len) {
+			errno = EINVAL;
+			goto err;
+		}
+	}
+
 	if (ftruncate(r->fd, flen) == -1)
 		goto err;
 
 	if (mmap(m, flen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, r->fd, 0) == MAP_FAILED)
 		goto err;
 
-	*(r->hdr = (typeof(r->hdr)) m) = (typeof(*r->hdr)) { flen, scan.len, m };
+	*(r->hdr = (typeof(r->hdr)) m) = (typeof(*r->hdr)) { flen, scan.len, m, 0, 0 };
 
 	if (msync(m, sizeof(*r->hdr), MS_SYNC) == -1)
 		goto err;
@@ -131,6 +222,9 @@ void *rszshm_at(struct rszshm *r, const char *fname)
 			    .dat = m + sizeof(h), .cap = h.flen - sizeof(h) };
 	strcpy(r->fname, fname);
 
+	/* best effort: the mapping works without it */
+	place(r, 0, r->flen, 0);
+
 	return r->dat;
 
 err:
@@ -152,9 +246,11 @@ int rszshm_up(struct rszshm *r)
 	flen = r->hdr->flen;
 	if (r->flen == flen)
 		return 0;
-	if (mmap(r->hdr, flen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, r->fd, 0) == MAP_FAILED)
+	if (mmap((char *) r->hdr + r->flen, flen - r->flen, PROT_READ|PROT_WRITE,
+		 MAP_SHARED|MAP_FIXED, r->fd, r->flen) == MAP_FAILED)
 		return -1;
 
+	place(r, r->flen, flen, 0);
 	r->flen = flen;
 	r->cap = flen - sizeof(*r->hdr);
 	return 1;
@@ -177,10 +273,13 @@ int rszshm_grow(struct rszshm *r)
 		return -1;
 
 	if ((ret = rszshm_up(r)) == 0) {
-		int flen = r->hdr->flen * 2 < r->hdr->max ? r->hdr->flen * 2 : r->hdr->max;
+		size_t flen = r->hdr->flen * 2 < r->hdr->max ? r->hdr->flen * 2 : r->hdr->max;
 
 		if (ftruncate(r->fd, flen) != -1 &&
-		    mmap(r->hdr, flen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, r->fd, 0) != MAP_FAILED) {
+		    mmap((char *) r->hdr + r->flen, flen - r->flen, PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_FIXED, r->fd, r->flen) != MAP_FAILED) {
+			/* before other processes can see the new part */
+			place(r, r->flen, flen, 0);
 			r->flen = r->hdr->flen = flen;
 			r->cap = flen - sizeof(*r->hdr);
 			ret = 1;
@@ -193,6 +292,44 @@ int rszshm_grow(struct rszshm *r)
 	return ret;
 }
 
+int rszshm_policy(struct rszshm *r, unsigned long flags, unsigned long nodes)
+{
+	int ret = -1;
+
+	assert(r);
+
+	if (flags & ~RSZSHM_POLICY_MASK ||
+	    (flags & RSZSHM_INTERLEAVE && flags & RSZSHM_BIND) ||
+	    (nodes && !(flags & (RSZSHM_INTERLEAVE|RSZSHM_BIND))) ||
+	    (flags & RSZSHM_BIND && !nodes)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (flags & RSZSHM_INTERLEAVE && !nodes) {
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+		if (syscall(SYS_get_mempolicy, NULL, &nodes, sizeof(nodes) * 8 + 1,
+			    NULL, MPOL_F_MEMS_ALLOWED) == -1)
+			return -1;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+
+	if (flock(r->fd, LOCK_EX) == -1)
+		return -1;
+
+	if (rszshm_up(r) != -1) {
+		r->hdr->policy = flags;
+		r->hdr->nodes = nodes;
+		ret = place(r, 0, r->flen, MPOL_MF_MOVE);
+	}
+
+	flock(r->fd, LOCK_UN);
+	return ret;
+}
+
 int rszshm_dt(struct rszshm *r)
 {
 	int ret[3];
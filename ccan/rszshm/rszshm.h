@@ -38,16 +38,21 @@ struct rszshm_scan {
  * @flen: length of the shared file mapping
  * @max: length of the private mapping
  * @addr: address of the mapping
+ * @policy: RSZSHM_* flags set by rszshm_policy
+ * @nodes: NUMA node mask set by rszshm_policy
  *
  * The shared region is mapped over the private region.
  * max is the maximum size the shared region can be extended.
  * addr and max are set at creation time and do not change.
  * flen is updated each time the file and shared region is grown.
+ * policy and nodes are applied to each extension of the mapping.
  */
 struct rszshm_hdr {
 	size_t flen;
 	size_t max;
 	void *addr;
+	unsigned long policy;
+	unsigned long nodes;
 };
 
 /**
@@ -63,6 +68,7 @@ struct rszshm_hdr {
  */
 #define RSZSHM_PATH_MAX 128
 #define RSZSHM_DFLT_FNAME "/dev/shm/rszshm_XXXXXX/0"
+#define RSZSHM_HUGE_FNAME "/dev/hugepages/rszshm_XXXXXX/0"
 struct rszshm {
 	int fd;
 	size_t flen;
@@ -106,6 +112,11 @@ struct rszshm {
  * The initial portion of the mapped file is populated with a struct rszshm_hdr,
  * and msync called to write out the header.
  *
+ * If fname is on a hugetlbfs mount (see RSZSHM_HUGE_FNAME), the region is
+ * backed by huge pages: flen is rounded up to the huge page size instead,
+ * max is rounded down to it, and the address found must be aligned to it
+ * (the default scan addresses are).
+ *
  * Example:
  *	struct rszshm r, s, t;
  *
@@ -225,8 +236,8 @@ int rszshm_dt(struct rszshm *r);
  *
  * Check if flen from the region header matches flen from the handle.
  * They will diverge when another process runs rszshm_grow.
- * If they are different, call mmap with the header flen and MAP_FIXED,
- * and update handle.
+ * If they are different, mmap the part of the file added since with
+ * MAP_FIXED, apply the region's policy to it, and update handle.
  *
  * Returns: -1 if mmap fails, 0 for no change, 1 is mapping updated
  */
@@ -241,13 +252,56 @@ int rszshm_up(struct rszshm *r);
  *
  * rszshm_up is called, to see if another process has already grown the region.
  * If not, a lock is acquired and the check repeated, to avoid races.
- * The file is extended, and mmap called with MAP_FIXED. The header and handle
- * are updated.
+ * The file is extended, and its new part mmap'd with MAP_FIXED. The header
+ * and handle are updated, and the region's policy applied to the new part.
  *
  * Returns: 1 on success, -1 on error
  */
 int rszshm_grow(struct rszshm *r);
 
+#define RSZSHM_THP		0x1
+#define RSZSHM_POPULATE		0x2
+#define RSZSHM_INTERLEAVE	0x4
+#define RSZSHM_BIND		0x8
+
+/**
+ * rszshm_policy - set page size and NUMA placement of the region
+ * @r: pointer to handle
+ * @flags: zero or more of the flags below
+ * @nodes: bitmask of NUMA nodes for RSZSHM_INTERLEAVE or RSZSHM_BIND
+ *
+ * RSZSHM_THP advises the kernel to back the mapping with transparent huge
+ * pages (for /dev/shm, if /sys/kernel/mm/transparent_hugepage/shmem_enabled
+ * says advise or within_size).
+ *
+ * RSZSHM_POPULATE prefaults the mapping, and each extension of it, so that
+ * accesses never stop to allocate pages or fill in page tables.
+ *
+ * RSZSHM_INTERLEAVE spreads pages round robin across nodes (all allowed
+ * nodes if nodes is 0).  RSZSHM_BIND puts them only on nodes.  Pages
+ * already present are moved.  On tmpfs and hugetlbfs the placement belongs
+ * to the file, so it holds whichever process touches a page first.
+ *
+ * The policy is recorded in the header, and applied by rszshm_grow,
+ * rszshm_up and rszshm_at as the mapping is extended or attached.  Call
+ * this right after rszshm_mk, before other processes attach, since
+ * mappings which already exist in other processes keep their page size
+ * advice.
+ *
+ * Example:
+ *	struct rszshm r;
+ *
+ *	if (!rszshm_mk(&r, 4*MiB, NULL))
+ *		err(1, "rszshm_mk");
+ *	// spread a big table over both sockets, and fault it in up front
+ *	if (rszshm_policy(&r, RSZSHM_INTERLEAVE|RSZSHM_POPULATE, 0) == -1)
+ *		err(1, "rszshm_policy");
+ *
+ * Returns: 0 on success, -1 on error (EINVAL for bad flags or nodes,
+ * ENOSYS if the system can't do what is asked)
+ */
+int rszshm_policy(struct rszshm *r, unsigned long flags, unsigned long nodes);
+
 /**
  * rszshm_unlink - unlink shared file
  * @r: pointer to handle
@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <ccan/rszshm/rszshm.h>
+#include <ccan/tap/tap.h>
+
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <ccan/rszshm/rszshm.c>
+
+static int resident(void *p, size_t len)
+{
+	long pgsz = sysconf(_SC_PAGE_SIZE);
+	unsigned char *vec = malloc(len / pgsz);
+	size_t i;
+	int ok;
+
+	ok = mincore(p, len, vec) == 0;
+	for (i = 0; ok && i < len / pgsz; i++)
+		ok = vec[i] & 1;
+	free(vec);
+	return ok;
+}
+
+int main(void)
+{
+	struct rszshm r, s;
+	int status;
+	size_t flen;
+	pid_t p;
+
+	plan_tests(19);
+
+	if (!rszshm_mk(&r, 1*MiB, NULL, ((struct rszshm_scan) { (void *) (48*TiB), 64*MiB, 1*TiB, 10 })))
+		err(1, "rszshm_mk");
+
+	ok1(rszshm_policy(&r, 0x100, 0) == -1 && errno == EINVAL);
+	ok1(rszshm_policy(&r, RSZSHM_INTERLEAVE|RSZSHM_BIND, 1) == -1 && errno == EINVAL);
+	ok1(rszshm_policy(&r, RSZSHM_THP, 1) == -1 && errno == EINVAL);
+	ok1(rszshm_policy(&r, RSZSHM_BIND, 0) == -1 && errno == EINVAL);
+	ok1(r.hdr->policy == 0);
+
+	/* populate faults in what is there, and each extension */
+	ok1(!resident(r.hdr, r.flen));
+	ok1(rszshm_policy(&r, RSZSHM_THP|RSZSHM_POPULATE, 0) == 0);
+	ok1(r.hdr->policy == (RSZSHM_THP|RSZSHM_POPULATE) && r.hdr->nodes == 0);
+	ok1(resident(r.hdr, r.flen));
+	flen = r.flen;
+	ok1(rszshm_grow(&r) == 1 && r.flen == 2 * flen);
+	ok1(resident(r.hdr, r.flen));
+
+	/* the policy travels with the file */
+	memset((char *) r.hdr + flen, 'x', flen);
+	fflush(stdout);
+	if ((p = fork()) == 0) {
+		/* as if unrelated: let go of the inherited mapping */
+		if (rszshm_dt(&r) == -1 || !rszshm_at(&s, r.fname) || s.hdr->policy != (RSZSHM_THP|RSZSHM_POPULATE))
+			_exit(1);
+		_exit(*((char *) s.hdr + 2 * flen - 1) == 'x' ? 0 : 2);
+	}
+	ok1(p != -1 && waitpid(p, &status, 0) == p && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	/* NUMA: node 0 always exists, where NUMA is there at all */
+	if (rszshm_policy(&r, RSZSHM_INTERLEAVE, 0) == -1 && errno == ENOSYS)
+		skip(6, "no NUMA support");
+	else {
+		ok1(r.hdr->policy == RSZSHM_INTERLEAVE && r.hdr->nodes & 1);
+		ok1(rszshm_policy(&r, RSZSHM_BIND|RSZSHM_POPULATE, 1) == 0);
+		ok1(r.hdr->nodes == 1);
+		ok1(rszshm_grow(&r) == 1);
+		ok1(resident(r.hdr, r.flen));
+		/* the old part was moved, not touched */
+		ok1(*((char *) r.hdr + 2 * flen - 1) == 'x');
+	}
+
+	ok1(rszshm_rm(&r) == 0);
+	rszshm_dt(&r);
+	return exit_status();
+}
@@ -0,0 +1,120 @@
+/*
+ * Random access speed of a grown rszshm region under each policy.
+ *
+ * For each policy, the region is made small and grown to size (timed:
+ * this is where RSZSHM_POPULATE pays), then each process does random
+ * 8-byte read-modify-writes over all of it (where huge pages save TLB
+ * misses, and NUMA placement decides how many accesses are remote).
+ *
+ * Usage: speed [MiB] [Maccesses-per-process] [processes] [hugetlbfs-dir]
+ *
+ * With a hugetlbfs directory (eg. /dev/hugepages, with enough pages
+ * reserved in /proc/sys/vm/nr_hugepages), hugetlbfs-backed regions are
+ * timed too.
+ */
+#include <ccan/rszshm/rszshm.h>
+#include <ccan/time/time.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+static size_t size;
+static unsigned long accesses;
+
+static void run(struct rszshm *r, unsigned int seed)
+{
+	uint64_t *words = r->dat, n = r->cap / sizeof(*words);
+	unsigned long long s = seed;
+	unsigned long i;
+
+	for (i = 0; i < accesses; i++) {
+		s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+		words[(s >> 16) % n]++;
+	}
+}
+
+static void bench(const char *name, const char *fname, unsigned long policy,
+		  unsigned long nodes, unsigned int procs)
+{
+	struct timeabs start;
+	struct timerel grow;
+	struct rszshm r;
+	unsigned int i;
+	int status;
+
+	if (!rszshm_mk(&r, 1*MiB, fname, ((struct rszshm_scan) { (void *) (48*TiB), size, 1*TiB, 10 }))) {
+		printf("%-22s(rszshm_mk: %s)\n", name, strerror(errno));
+		return;
+	}
+	if (policy && rszshm_policy(&r, policy, nodes) == -1) {
+		printf("%-22s(rszshm_policy: %s)\n", name, strerror(errno));
+		goto out;
+	}
+
+	start = time_now();
+	while (r.flen < r.hdr->max)
+		if (rszshm_grow(&r) == -1)
+			err(1, "rszshm_grow");
+	grow = time_between(time_now(), start);
+
+	/* fault everything in, so the first policy isn't unfairly slowed */
+	memset(r.dat, 0, r.cap);
+
+	start = time_now();
+	for (i = 0; i < procs; i++) {
+		switch (fork()) {
+		case -1:
+			err(1, "fork");
+		case 0:
+			run(&r, i);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < procs; i++)
+		if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			errx(1, "Child failed");
+
+	printf("%-22s%-16.1f%.1f\n", name, (double)time_to_usec(grow) / 1000,
+	       (double)accesses * procs / time_to_usec(time_between(time_now(), start)));
+out:
+	rszshm_rm(&r);
+	rszshm_dt(&r);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int procs = 1;
+	char huge[RSZSHM_PATH_MAX];
+
+	size = 1*GiB;
+	accesses = 10000000;
+	if (argc > 1)
+		size = atol(argv[1]) * MiB;
+	if (argc > 2)
+		accesses = atol(argv[2]) * 1000000;
+	if (argc > 3)
+		procs = atoi(argv[3]);
+
+	printf("%zu MiB, %lu random accesses by each of %u processes:\n",
+	       size / MiB, accesses, procs);
+	printf("%-22s%-16s%s\n", "policy", "grow (msec)", "Maccesses/sec");
+	bench("default", NULL, 0, 0, procs);
+	bench("thp", NULL, RSZSHM_THP, 0, procs);
+	bench("populate", NULL, RSZSHM_POPULATE, 0, procs);
+	bench("thp+populate", NULL, RSZSHM_THP|RSZSHM_POPULATE, 0, procs);
+	bench("interleave", NULL, RSZSHM_INTERLEAVE, 0, procs);
+	bench("bind node 0", NULL, RSZSHM_BIND, 1, procs);
+	if (argc > 4) {
+		snprintf(huge, sizeof(huge), "%s/rszshm_XXXXXX/0", argv[4]);
+		bench("hugetlbfs", huge, 0, 0, procs);
+		bench("hugetlbfs+populate", huge, RSZSHM_POPULATE, 0, procs);
+		bench("hugetlbfs+interleave", huge, RSZSHM_INTERLEAVE|RSZSHM_POPULATE, 0, procs);
+	}
+	return 0;
+}
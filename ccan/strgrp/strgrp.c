@@ -24,16 +24,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ccan/darray/darray.h"
+#include "ccan/edit_distance/edit_distance.h"
 #include "ccan/stringmap/stringmap.h"
 #include "ccan/tal/tal.h"
 #include "ccan/tal/str/str.h"
 #include "strgrp.h"
 #include "config.h"
+#if HAVE_OPENMP
+#include <omp.h>
+#endif
 
 #define CHAR_N_VALUES (1 << CHAR_BIT)
 
+// q-gram index parameters: gram length and number of hash buckets
+#define QGRAM_Q 3
+#define QGRAM_BITS 16
+#define QGRAM_BUCKETS (1 << QGRAM_BITS)
+
+// Candidate count above which a single search scores in parallel
+#define PARALLEL_CANDS 256
+
+// Strings grouped in parallel per round of strgrp_add_many()
+#define ADD_MANY_CHUNK 4096
+
 typedef darray(struct strgrp_grp *) darray_grp;
 typedef darray(struct strgrp_item *) darray_item;
+typedef darray(uint32_t) darray_u32;
 
 typedef stringmap(struct strgrp_grp *) stringmap_grp;
 
@@ -44,6 +60,50 @@ struct grp_score {
 
 typedef darray(struct grp_score *) darray_score;
 
+// A group's occurrences of a q-gram hash
+struct posting {
+    uint32_t grp;
+    uint32_t count;
+};
+
+typedef darray(struct posting) darray_posting;
+
+// A query's occurrences of a q-gram hash, and the length of its postings
+struct qgram {
+    uint32_t hash;
+    uint32_t count;
+    size_t n_postings;
+};
+
+typedef darray(struct qgram) darray_qgram;
+
+// The LCS a group key of some length needs to reach the threshold, and the
+// q-grams it must then share with the query
+struct len_bound {
+    size_t lcs_min;
+    long shared_min;
+};
+
+typedef darray(struct len_bound) darray_bound;
+
+struct grp_cand {
+    struct strgrp_grp *grp;
+    size_t lcs_min;
+    double score;
+};
+
+typedef darray(struct grp_cand) darray_cand;
+
+// Scratch space for searching the index. Each searching thread needs its own.
+struct grp_search {
+    darray_u32 grams;
+    darray_qgram qgrams;
+    darray_bound bounds;
+    darray_u32 acc;
+    darray_u32 touched;
+    darray_cand cands;
+};
+
 struct strgrp {
     double threshold;
     stringmap_grp known;
@@ -51,6 +111,10 @@ struct strgrp {
     darray_grp grps;
     struct grp_score *scores;
     int16_t pop[CHAR_N_VALUES];
+    // Index of group keys, maintained when threshold > 0
+    darray_posting *postings;
+    darray(darray_u32) by_len;
+    struct grp_search search;
 };
 
 struct strgrp_iter {
@@ -63,6 +127,8 @@ struct strgrp_grp {
     size_t key_len;
     darray_item items;
     int32_t n_items;
+    uint32_t index;
+    int32_t pop2;
     int16_t pop[CHAR_N_VALUES];
 };
 
@@ -92,17 +158,42 @@ strpopcnt(const char *const str, int16_t pop[CHAR_N_VALUES]) {
     }
 }
 
-static inline double
-strcossim(const int16_t ref[CHAR_N_VALUES], const int16_t key[CHAR_N_VALUES]) {
-    int32_t saibi = 0;
+// The vector loops below are written for OpenMP's simd construct: the
+// reductions are integer, so any summation order gives the same result.
+static inline int32_t
+strpopsq(const int16_t pop[CHAR_N_VALUES]) {
     int32_t sai2 = 0;
-    int32_t sbi2 = 0;
-    size_t i;
+    int i;
+#if HAVE_OPENMP
+    #pragma omp simd reduction(+:sai2)
+#endif
+    for (i = 0; i < CHAR_N_VALUES; i++) {
+        sai2 += pop[i] * pop[i];
+    }
+    return sai2;
+}
+
+// The dot product of two distributions, and the size of their intersection:
+// an upper bound on the LCS of the strings.
+static inline int32_t
+strpopdot(const int16_t ref[CHAR_N_VALUES], const int16_t key[CHAR_N_VALUES],
+        int32_t *const common) {
+    int32_t saibi = 0;
+    int32_t smin = 0;
+    int i;
+#if HAVE_OPENMP
+    #pragma omp simd reduction(+:saibi, smin)
+#endif
     for (i = 0; i < CHAR_N_VALUES; i++) {
         saibi += ref[i] * key[i];
-        sai2 += ref[i] * ref[i];
-        sbi2 += key[i] * key[i];
+        smin += (ref[i] < key[i]) ? ref[i] : key[i];
     }
+    *common = smin;
+    return saibi;
+}
+
+static inline double
+strcossim(const int32_t saibi, const int32_t sai2, const int32_t sbi2) {
     return 1.0 - (2 * acos(saibi / sqrt(sai2 * sbi2)) / M_PI);
 }
 
@@ -114,22 +205,35 @@ cossim_correction(const double s)
     return -((s - 0.5) * (s - 0.5)) + 0.33;
 }
 
+static inline bool
+cossim_passes(const double threshold, const int32_t saibi, const int32_t sai2,
+        const int32_t sbi2) {
+    const double s1 = strcossim(saibi, sai2, sbi2);
+    const double s2 = s1 + cossim_correction(s1);
+    return threshold <= s2;
+}
+
 static inline bool
 should_grp_score_cos(const struct strgrp *const ctx,
         struct strgrp_grp *const grp, const char *const str) {
-    const double s1 = strcossim(ctx->pop, grp->pop);
-    const double s2 = s1 + cossim_correction(s1);
-    return ctx->threshold <= s2;
+    int32_t common;
+    const int32_t saibi = strpopdot(ctx->pop, grp->pop, &common);
+    return cossim_passes(ctx->threshold, saibi, strpopsq(ctx->pop), grp->pop2);
 }
 
 static inline bool
-should_grp_score_len(const struct strgrp *const ctx,
-        const struct strgrp_grp *const grp, const char *const str) {
-    const double lstr = (double) strlen(str);
-    const double lkey = (double) grp->key_len;
+len_passes(const double threshold, const size_t str_len, const size_t key_len) {
+    const double lstr = (double) str_len;
+    const double lkey = (double) key_len;
     const double lmin = (lstr > lkey) ? lkey : lstr;
     const double s = sqrt((2 * lmin * lmin) / (1.0 * lstr * lstr + lkey * lkey));
-    return ctx->threshold <= s;
+    return threshold <= s;
+}
+
+static inline bool
+should_grp_score_len(const struct strgrp *const ctx,
+        const struct strgrp_grp *const grp, const char *const str) {
+    return len_passes(ctx->threshold, strlen(str), grp->key_len);
 }
 
 /* Scoring - Longest Common Subsequence[2]
@@ -176,19 +280,341 @@ lcs(const char *const a, const char *const b) {
 #undef ROWS
 
 static inline double
-nlcs(const char *const a, const char *const b) {
-    const double lcss = lcs(a, b);
-    const double la = (double) strlen(a);
-    const double lb = (double) strlen(b);
+nlcs_score(const double lcss, const double la, const double lb) {
     const double s = sqrt((2 * lcss * lcss) / (la * la + lb * lb));
     return s;
 }
 
+static inline double
+nlcs(const char *const a, const char *const b) {
+    return nlcs_score(lcs(a, b), (double) strlen(a), (double) strlen(b));
+}
+
 static inline double
 grp_score(const struct strgrp_grp *const grp, const char *const str) {
     return nlcs(grp->key, str);
 }
 
+/* Candidate index - q-gram count filtering[3]
+ *
+ * Only groups whose LCS with the input string could reach the threshold need
+ * scoring. For a threshold above zero the filters below are all exact: they
+ * never discard a group whose score would reach the threshold, so the chosen
+ * group is that of the exhaustive search.
+ *
+ * 1. Group keys are bucketed by length. The length filter is monotonic in the
+ * key length, so the lengths that pass it form a window around the input
+ * string's length.
+ *
+ * 2. For each length in the window the normalised LCS formula gives the
+ * minimum LCS a group needs to reach the threshold.
+ *
+ * 3. Strings of lengths la and lb with an LCS of L share at least
+ * la - q + 1 - q * (la - L) - (q - 1) * (lb - L) q-grams. An inverted index
+ * from hashed q-grams to groups counts the q-grams each group shares with the
+ * input string. Hash collisions only inflate the counts.
+ *
+ * 4. Candidates pass the unchanged cosine filter, an intersection of the
+ * character distributions bounding the LCS, and finally a bit-parallel LCS
+ * bounded by the minimum LCS.
+ *
+ * [3] Ukkonen, E. (1992). Approximate string-matching with q-grams and maximal
+ * matches. Theoretical Computer Science, 92(1), 191-211.
+ */
+
+static inline bool
+can_index(const struct strgrp *const ctx, const size_t len) {
+    // lcs() keeps lengths in int16_t; leave longer strings to it
+    return ctx->threshold > 0 && len <= INT16_MAX;
+}
+
+static inline uint32_t
+qgram_hash(const char *const str) {
+    const uint32_t g = ((uint32_t)(unsigned char)str[0] << 16)
+        | ((uint32_t)(unsigned char)str[1] << 8)
+        | (uint32_t)(unsigned char)str[2];
+    return (g * UINT32_C(2654435761)) >> (32 - QGRAM_BITS);
+}
+
+static int
+cmp_u32(const void *a, const void *b) {
+    const uint32_t ua = *(const uint32_t *)a;
+    const uint32_t ub = *(const uint32_t *)b;
+    return (ua > ub) - (ua < ub);
+}
+
+static int
+cmp_qgram_postings(const void *a, const void *b) {
+    const size_t na = ((const struct qgram *)a)->n_postings;
+    const size_t nb = ((const struct qgram *)b)->n_postings;
+    return (na < nb) - (na > nb);
+}
+
+// Collect the distinct q-gram hashes of str and their counts into qgrams
+static void
+strqgrams(struct grp_search *const s, const char *const str, const size_t len) {
+    size_t i;
+    darray_resize(s->grams, 0);
+    darray_resize(s->qgrams, 0);
+    if (len < QGRAM_Q) {
+        return;
+    }
+    for (i = 0; i + QGRAM_Q <= len; i++) {
+        darray_push(s->grams, qgram_hash(&str[i]));
+    }
+    qsort(s->grams.item, s->grams.size, sizeof(uint32_t), cmp_u32);
+    for (i = 0; i < s->grams.size; i++) {
+        const uint32_t hash = s->grams.item[i];
+        if (s->qgrams.size && s->qgrams.item[s->qgrams.size - 1].hash == hash) {
+            s->qgrams.item[s->qgrams.size - 1].count++;
+        } else {
+            struct qgram q = { hash, 1, 0 };
+            darray_push(s->qgrams, q);
+        }
+    }
+}
+
+static void
+search_free(struct grp_search *const s) {
+    darray_free(s->grams);
+    darray_free(s->qgrams);
+    darray_free(s->bounds);
+    darray_free(s->acc);
+    darray_free(s->touched);
+    darray_free(s->cands);
+}
+
+static void
+index_grp(struct strgrp *const ctx, struct strgrp_grp *const grp) {
+    struct qgram *q;
+    if (darray_size(ctx->by_len) <= grp->key_len) {
+        darray_resize0(ctx->by_len, grp->key_len + 1);
+    }
+    darray_push(darray_item(ctx->by_len, grp->key_len), grp->index);
+    strqgrams(&ctx->search, grp->key, grp->key_len);
+    darray_foreach(q, ctx->search.qgrams) {
+        struct posting p = { grp->index, q->count };
+        darray_push(ctx->postings[q->hash], p);
+    }
+}
+
+// The least LCS for which a key of length lb scores at least threshold against
+// a string of length la, or more than min(la, lb) if there is none
+static size_t
+lcs_min(const double threshold, const size_t la, const size_t lb) {
+    const size_t m = (la < lb) ? la : lb;
+    const double l2 = ((double) la * la + (double) lb * lb) / 2;
+    size_t l = (size_t) ceil(threshold * sqrt(l2));
+    if (l > m) {
+        l = m;
+    }
+    while (l > 0 && nlcs_score(l - 1, lb, la) >= threshold) {
+        l--;
+    }
+    while (l <= m && nlcs_score(l, lb, la) < threshold) {
+        l++;
+    }
+    return l;
+}
+
+// First posting or group index in a sorted list at or above from
+static size_t
+lower_bound_u32(const uint32_t *const v, size_t n, const uint32_t from) {
+    size_t lo = 0;
+    while (lo < n) {
+        const size_t mid = lo + (n - lo) / 2;
+        if (v[mid] < from) {
+            lo = mid + 1;
+        } else {
+            n = mid;
+        }
+    }
+    return lo;
+}
+
+static size_t
+lower_bound_posting(const struct posting *const v, size_t n,
+        const uint32_t from) {
+    size_t lo = 0;
+    while (lo < n) {
+        const size_t mid = lo + (n - lo) / 2;
+        if (v[mid].grp < from) {
+            lo = mid + 1;
+        } else {
+            n = mid;
+        }
+    }
+    return lo;
+}
+
+static inline double
+cand_score(const struct strgrp *const ctx, const struct grp_cand *const cand,
+        const char *const str, const size_t len,
+        const int16_t pop[CHAR_N_VALUES], const int32_t pop2) {
+    const struct strgrp_grp *const grp = cand->grp;
+    int32_t common;
+    const int32_t saibi = strpopdot(pop, grp->pop, &common);
+    ed_dist max, dist;
+    if (!cossim_passes(ctx->threshold, saibi, pop2, grp->pop2)) {
+        return 0;
+    }
+    // Counts of a character beyond INT16_MAX wrap in grp->pop
+    if (grp->key_len <= INT16_MAX && (size_t) common < cand->lcs_min) {
+        return 0;
+    }
+    max = len + grp->key_len - 2 * cand->lcs_min;
+    dist = edit_distance_max(str, len, grp->key, grp->key_len,
+            EDIT_DISTANCE_LCS, max);
+    if (dist > max) {
+        return 0;
+    }
+    return nlcs_score((int16_t) ((len + grp->key_len - dist) / 2),
+            (double) grp->key_len, (double) len);
+}
+
+// Find the best group with index in [from, to) for str, as grp_for() would
+// among those groups, or NULL if no group reaches the threshold.
+static struct strgrp_grp *
+search_grps(const struct strgrp *const ctx, struct grp_search *const s,
+        const char *const str, const size_t len,
+        const int16_t pop[CHAR_N_VALUES], const uint32_t from,
+        const uint32_t to, double *const score) {
+    const double threshold = ctx->threshold;
+    const int32_t pop2 = strpopsq(pop);
+    size_t lo = len, hi = len, lb, i;
+    long shared_min = LONG_MAX, skipped = 0;
+    struct qgram *q;
+    uint32_t *t;
+    struct grp_cand *c, *best = NULL;
+    int j, n;
+
+    *score = 0;
+    if (from >= to || !darray_size(ctx->by_len)
+            || !len_passes(threshold, len, len)) {
+        return NULL;
+    }
+
+    // The window of key lengths passing the length filter
+    while (lo > 0 && len_passes(threshold, len, lo - 1)) {
+        lo--;
+    }
+    while (hi < darray_size(ctx->by_len) - 1
+            && len_passes(threshold, len, hi + 1)) {
+        hi++;
+    }
+    if (hi >= darray_size(ctx->by_len)) {
+        hi = darray_size(ctx->by_len) - 1;
+    }
+    if (lo > hi) {
+        return NULL;
+    }
+
+    darray_resize(s->bounds, hi - lo + 1);
+    for (lb = lo; lb <= hi; lb++) {
+        struct len_bound *const b = &darray_item(s->bounds, lb - lo);
+        b->lcs_min = lcs_min(threshold, len, lb);
+        if (b->lcs_min > ((len < lb) ? len : lb)) {
+            b->shared_min = LONG_MIN;
+            continue;
+        }
+        b->shared_min = (long) len - QGRAM_Q + 1
+            - QGRAM_Q * ((long) len - (long) b->lcs_min)
+            - (QGRAM_Q - 1) * ((long) lb - (long) b->lcs_min);
+        if (b->shared_min > 0 && darray_size(darray_item(ctx->by_len, lb))
+                && b->shared_min < shared_min) {
+            shared_min = b->shared_min;
+        }
+    }
+
+    darray_resize(s->cands, 0);
+    if (shared_min != LONG_MAX) {
+        strqgrams(s, str, len);
+        darray_foreach(q, s->qgrams) {
+            q->n_postings = darray_size(ctx->postings[q->hash]);
+        }
+        // Skip the longest posting lists while every length still needs a
+        // shared q-gram from those remaining
+        qsort(s->qgrams.item, s->qgrams.size, sizeof(struct qgram),
+                cmp_qgram_postings);
+        q = s->qgrams.item;
+        while (q < s->qgrams.item + s->qgrams.size
+                && skipped + q->count <= shared_min / 2) {
+            skipped += q->count;
+            q++;
+        }
+
+        if (darray_size(s->acc) < to) {
+            darray_resize0(s->acc, to);
+        }
+        darray_resize(s->touched, 0);
+        for (; q < s->qgrams.item + s->qgrams.size; q++) {
+            const darray_posting *const ps = &ctx->postings[q->hash];
+            const struct posting *p = ps->item
+                + lower_bound_posting(ps->item, ps->size, from);
+            for (; p < ps->item + ps->size && p->grp < to; p++) {
+                uint32_t *const acc = &darray_item(s->acc, p->grp);
+                if (!*acc) {
+                    darray_push(s->touched, p->grp);
+                }
+                *acc += (q->count < p->count) ? q->count : p->count;
+            }
+        }
+
+        darray_foreach(t, s->touched) {
+            struct strgrp_grp *const grp = darray_item(ctx->grps, *t);
+            uint32_t *const acc = &darray_item(s->acc, *t);
+            if (grp->key_len >= lo && grp->key_len <= hi) {
+                const struct len_bound *const b =
+                    &darray_item(s->bounds, grp->key_len - lo);
+                if (b->shared_min > 0 && *acc >= b->shared_min - skipped) {
+                    struct grp_cand cand = { grp, b->lcs_min, 0 };
+                    darray_push(s->cands, cand);
+                }
+            }
+            *acc = 0;
+        }
+    }
+
+    // Key lengths for which the q-grams prove nothing
+    for (lb = lo; lb <= hi; lb++) {
+        const struct len_bound *const b = &darray_item(s->bounds, lb - lo);
+        const darray_u32 *const grps = &darray_item(ctx->by_len, lb);
+        if (b->shared_min > 0 || b->shared_min == LONG_MIN) {
+            continue;
+        }
+        for (i = lower_bound_u32(grps->item, grps->size, from);
+                i < grps->size && grps->item[i] < to; i++) {
+            struct grp_cand cand = {
+                darray_item(ctx->grps, grps->item[i]), b->lcs_min, 0
+            };
+            darray_push(s->cands, cand);
+        }
+    }
+
+    n = darray_size(s->cands);
+#if HAVE_OPENMP
+    #pragma omp parallel for schedule(dynamic) if (n >= PARALLEL_CANDS)
+#endif
+    for (j = 0; j < n; j++) {
+        struct grp_cand *const cand = &darray_item(s->cands, j);
+        cand->score = cand_score(ctx, cand, str, len, pop, pop2);
+    }
+
+    // As for grp_for(), the first of equal scores wins
+    darray_foreach(c, s->cands) {
+        if (c->score >= threshold && (!best || c->score > best->score
+                    || (c->score == best->score
+                        && c->grp->index < best->grp->index))) {
+            best = c;
+        }
+    }
+    if (!best) {
+        return NULL;
+    }
+    *score = best->score;
+    return best->grp;
+}
+
 /* Structure management */
 
 static struct strgrp_item *
@@ -244,8 +670,13 @@ add_grp(struct strgrp *const ctx, const char *const str,
         return NULL;
     }
     memcpy(b->pop, ctx->pop, sizeof(ctx->pop));
+    b->pop2 = strpopsq(b->pop);
+    b->index = ctx->n_grps;
     darray_push(ctx->grps, b);
     ctx->n_grps++;
+    if (ctx->postings) {
+        index_grp(ctx, b);
+    }
     if (ctx->scores) {
         if (!tal_resize(&ctx->scores, ctx->n_grps)) {
             return NULL;
@@ -266,6 +697,13 @@ strgrp_new(const double threshold) {
     stringmap_init(ctx->known, NULL);
     // n threads compare strings
     darray_init(ctx->grps);
+    // Pruning is exact only while a score of zero fails the threshold
+    if (threshold > 0) {
+        ctx->postings = tal_arrz(ctx, darray_posting, QGRAM_BUCKETS);
+        if (!ctx->postings) {
+            return tal_free(ctx);
+        }
+    }
     return ctx;
 }
 
@@ -275,8 +713,20 @@ cache(struct strgrp *const ctx, struct strgrp_grp *const grp,
     *(stringmap_enter(ctx->known, str)) = grp;
 }
 
+static inline bool
+is_known(const struct strgrp *const ctx, const char *const str) {
+    // stringmap_lookup() stores its result in the map; this only reads it, so
+    // is safe from many threads
+    return NULL != stringmap_lookup_real((struct stringmap *) &ctx->known.t,
+            str, (size_t) -1, 0, sizeof(*ctx->known.last));
+}
+
+// Find the best group for str, given pick is the best of the groups with an
+// index below from and scores score.
 static struct strgrp_grp *
-grp_for(struct strgrp *const ctx, const char *const str) {
+grp_for_from(struct strgrp *const ctx, const char *const str,
+        struct strgrp_grp *const pick, const double score,
+        const uint32_t from) {
     // Ensure ctx->pop is always populated. Returning null here indicates a new
     // group should be created, at which point add_grp() copies ctx->pop into
     // the new group's struct.
@@ -290,6 +740,15 @@ grp_for(struct strgrp *const ctx, const char *const str) {
             return *grp;
         }
     }
+    const size_t len = strlen(str);
+    if (can_index(ctx, len)) {
+        double found_score;
+        struct strgrp_grp *const found = search_grps(ctx, &ctx->search, str,
+                len, ctx->pop, from, ctx->n_grps, &found_score);
+        // Ties go to the lower index, which is pick's
+        return (found && (!pick || found_score > score)) ? found : pick;
+    }
+    assert(from == 0);
     int i;
 // Keep ccanlint happy in reduced feature mode
 #if HAVE_OPENMP
@@ -314,19 +773,20 @@ grp_for(struct strgrp *const ctx, const char *const str) {
     return (max && max->score >= ctx->threshold) ? max->grp : NULL;
 }
 
+static struct strgrp_grp *
+grp_for(struct strgrp *const ctx, const char *const str) {
+    return grp_for_from(ctx, str, NULL, 0, 0);
+}
+
 const struct strgrp_grp *
 strgrp_grp_for(struct strgrp *const ctx, const char *const str) {
     return grp_for(ctx, str);
 }
 
-const struct strgrp_grp *
-strgrp_add(struct strgrp *const ctx, const char *const str,
-        void *const data) {
+static struct strgrp_grp *
+add_to(struct strgrp *const ctx, struct strgrp_grp *pick,
+        const char *const str, void *const data) {
     bool inserted = false;
-    // grp_for() populates the ctx->pop memory. add_grp() copies this memory
-    // into the strgrp_grp that it creates. It's assumed the ctx->pop memory
-    // has not been modified between the grp_for() and add_grp() calls.
-    struct strgrp_grp *pick = grp_for(ctx, str);
     if (pick) {
         inserted = add_item(pick, str, data);
     } else {
@@ -340,6 +800,111 @@ strgrp_add(struct strgrp *const ctx, const char *const str,
     return pick;
 }
 
+const struct strgrp_grp *
+strgrp_add(struct strgrp *const ctx, const char *const str,
+        void *const data) {
+    // grp_for() populates the ctx->pop memory. add_grp() copies this memory
+    // into the strgrp_grp that it creates. It's assumed the ctx->pop memory
+    // has not been modified between the grp_for() and add_grp() calls.
+    return add_to(ctx, grp_for(ctx, str), str, data);
+}
+
+static inline bool
+many_threads(void) {
+#if HAVE_OPENMP
+    return omp_get_max_threads() > 1;
+#else
+    return false;
+#endif
+}
+
+struct grp_match {
+    struct strgrp_grp *grp;
+    double score;
+    bool searched;
+};
+
+bool
+strgrp_add_many(struct strgrp *const ctx, const char *const *const strs,
+        void *const *const data, const size_t n,
+        const struct strgrp_grp **const grps) {
+    struct grp_match *matches;
+    bool ok = true;
+    size_t base, i;
+
+    // Without the index, or a second thread, there's nothing to share
+    if (!ctx->postings || !many_threads()) {
+        for (i = 0; i < n; i++) {
+            const struct strgrp_grp *const grp =
+                strgrp_add(ctx, strs[i], data ? data[i] : NULL);
+            ok = ok && grp;
+            if (grps) {
+                grps[i] = grp;
+            }
+        }
+        return ok;
+    }
+
+    matches = tal_arr(ctx, struct grp_match,
+            (n < ADD_MANY_CHUNK) ? n : ADD_MANY_CHUNK);
+    if (!matches) {
+        return false;
+    }
+    for (base = 0; base < n; base += ADD_MANY_CHUNK) {
+        const int chunk = (n - base < ADD_MANY_CHUNK) ?
+            n - base : ADD_MANY_CHUNK;
+        const uint32_t n_pre = ctx->n_grps;
+        int j;
+
+        // Match the chunk against the groups that exist before it, which the
+        // chunk's strings cannot change
+#if HAVE_OPENMP
+        #pragma omp parallel
+#endif
+        {
+            struct grp_search s;
+            int16_t pop[CHAR_N_VALUES];
+            memset(&s, 0, sizeof(s));
+#if HAVE_OPENMP
+            #pragma omp for schedule(dynamic, 16)
+#endif
+            for (j = 0; j < chunk; j++) {
+                const char *const str = strs[base + j];
+                const size_t len = strlen(str);
+                struct grp_match *const m = &matches[j];
+                m->grp = NULL;
+                m->score = 0;
+                m->searched = n_pre && can_index(ctx, len)
+                    && !is_known(ctx, str);
+                if (m->searched) {
+                    strpopcnt(str, pop);
+                    m->grp = search_grps(ctx, &s, str, len, pop, 0, n_pre,
+                            &m->score);
+                }
+            }
+            search_free(&s);
+        }
+
+        // Then add the strings in order, matching each against the groups
+        // created by those before it
+        for (j = 0; j < chunk; j++) {
+            const char *const str = strs[base + j];
+            const struct grp_match *const m = &matches[j];
+            struct strgrp_grp *const pick = m->searched ?
+                grp_for_from(ctx, str, m->grp, m->score, n_pre) :
+                grp_for(ctx, str);
+            const struct strgrp_grp *const grp =
+                add_to(ctx, pick, str, data ? data[base + j] : NULL);
+            ok = ok && grp;
+            if (grps) {
+                grps[base + j] = grp;
+            }
+        }
+    }
+    tal_free(matches);
+    return ok;
+}
+
 struct strgrp_iter *
 strgrp_iter_new(struct strgrp *const ctx) {
     struct strgrp_iter *iter = talz(ctx, struct strgrp_iter);
@@ -401,6 +966,18 @@ strgrp_item_value(const struct strgrp_item *const item) {
 
 void
 strgrp_free(struct strgrp *const ctx) {
+    darray_u32 *by_len;
+    if (ctx->postings) {
+        size_t i;
+        for (i = 0; i < QGRAM_BUCKETS; i++) {
+            darray_free(ctx->postings[i]);
+        }
+    }
+    darray_foreach(by_len, ctx->by_len) {
+        darray_free(*by_len);
+    }
+    darray_free(ctx->by_len);
+    search_free(&ctx->search);
     darray_free(ctx->grps);
     stringmap_free(ctx->known);
     tal_free(ctx);
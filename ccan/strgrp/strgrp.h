@@ -3,6 +3,7 @@
 #ifndef STRGRP_H
 #define STRGRP_H
 #include <stdbool.h>
+#include <stddef.h>
 
 struct strgrp;
 struct strgrp_iter;
@@ -55,6 +56,26 @@ strgrp_grp_for(struct strgrp *ctx, const char *str);
 const struct strgrp_grp *
 strgrp_add(struct strgrp *ctx, const char *str, void *data);
 
+/**
+ * Add many string keys and their data values to the appropriate groups.
+ * @ctx: The strgrp instance to add the strings and data
+ * @strs: The n string keys used to select groups, with ownership as for
+ *     strgrp_add
+ * @data: The n data values to attach to the new entries, with ownership as
+ *     for strgrp_add, or NULL to attach NULL to each
+ * @n: The number of strings to add
+ * @grps: An array of n pointers to receive the group to which each item was
+ *     added (NULL where an item could not be added), or NULL
+ *
+ * The result is identical to calling strgrp_add for each string in turn, but
+ * the strings are matched against the existing groups in parallel.
+ *
+ * @return true if all items were added, false otherwise.
+ */
+bool
+strgrp_add_many(struct strgrp *ctx, const char *const *strs,
+        void *const *data, size_t n, const struct strgrp_grp **grps);
+
 /**
  * Create an iterator over the current groups.
  * @ctx: The strgrp instance to iterate over
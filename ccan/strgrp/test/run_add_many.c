@@ -0,0 +1,208 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../strgrp.c"
+#include "helpers.h"
+
+#define N_STRS 1500
+#define N_SEEDS 40
+#define MAX_LEN 60
+#define N_SLICE 500
+
+/* Exhaustive grouping with strgrp's original scoring, as the reference */
+struct ref_grp {
+    const char *key;
+    int16_t pop[CHAR_N_VALUES];
+};
+
+static int
+ref_group(const double threshold, char *const *const strs, const int n,
+        int *const assign) {
+    struct ref_grp *grps = calloc(n, sizeof(*grps));
+    int16_t pop[CHAR_N_VALUES];
+    int n_grps = 0;
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        int best = -1;
+        double best_score = 0;
+        strpopcnt(strs[i], pop);
+        for (j = 0; j < i && assign[i] < 0; j++) {
+            if (streq(strs[i], strs[j])) {
+                assign[i] = assign[j];
+            }
+        }
+        for (j = 0; j < n_grps && assign[i] < 0; j++) {
+            const double lstr = (double) strlen(strs[i]);
+            const double lkey = (double) strlen(grps[j].key);
+            const double lmin = (lstr > lkey) ? lkey : lstr;
+            const double sl = sqrt((2 * lmin * lmin)
+                    / (1.0 * lstr * lstr + lkey * lkey));
+            double score = 0;
+            if (threshold <= sl) {
+                int32_t saibi = 0, sai2 = 0, sbi2 = 0;
+                int k;
+                for (k = 0; k < CHAR_N_VALUES; k++) {
+                    saibi += pop[k] * grps[j].pop[k];
+                    sai2 += pop[k] * pop[k];
+                    sbi2 += grps[j].pop[k] * grps[j].pop[k];
+                }
+                const double s1 = 1.0 - (2 * acos(saibi / sqrt(sai2 * sbi2))
+                        / M_PI);
+                if (threshold <= s1 + cossim_correction(s1)) {
+                    score = nlcs(grps[j].key, strs[i]);
+                }
+            }
+            if (best < 0 || score > best_score) {
+                best = j;
+                best_score = score;
+            }
+        }
+        if (assign[i] < 0) {
+            if (best >= 0 && best_score >= threshold) {
+                assign[i] = best;
+            } else {
+                grps[n_grps].key = strs[i];
+                memcpy(grps[n_grps].pop, pop, sizeof(pop));
+                assign[i] = n_grps++;
+            }
+        }
+    }
+    free(grps);
+    return n_grps;
+}
+
+/* Strings drawn from a few seeds with random edits, and some duplicates */
+static void
+make_strs(char **strs, const int n) {
+    static char seeds[N_SEEDS][MAX_LEN + 1];
+    int i, j;
+
+    for (i = 0; i < N_SEEDS; i++) {
+        const int len = rand() % MAX_LEN;
+        for (j = 0; j < len; j++) {
+            seeds[i][j] = 'a' + rand() % (i % 2 ? 4 : 26);
+        }
+        seeds[i][len] = '\0';
+    }
+    for (i = 0; i < n; i++) {
+        const char *const seed = seeds[rand() % N_SEEDS];
+        char *const str = malloc(2 * MAX_LEN + 1);
+        int len = 0;
+        if (i && rand() % 8 == 0) {
+            strcpy(str, strs[rand() % i]);
+            strs[i] = str;
+            continue;
+        }
+        for (j = 0; seed[j]; j++) {
+            switch (rand() % 40) {
+            case 0:
+                break;
+            case 1:
+                str[len++] = 'a' + rand() % 26;
+                str[len++] = seed[j];
+                break;
+            case 2:
+                str[len++] = 'a' + rand() % 26;
+                break;
+            default:
+                str[len++] = seed[j];
+                break;
+            }
+        }
+        str[len] = '\0';
+        strs[i] = str;
+    }
+}
+
+/* Each string is in the group of the reference, and groups are created in
+ * the same order */
+static bool
+same_groups(const int *const assign, const struct strgrp_grp **const grps,
+        const int n) {
+    const struct strgrp_grp **firsts = calloc(n, sizeof(*firsts));
+    bool same = true;
+    int i;
+    for (i = 0; i < n && same; i++) {
+        if (!firsts[assign[i]]) {
+            firsts[assign[i]] = grps[i];
+        }
+        same = grps[i] && firsts[assign[i]] == grps[i]
+            && grps[i]->index == (uint32_t) assign[i];
+    }
+    free(firsts);
+    return same;
+}
+
+int main(void) {
+    const double thresholds[] = { 0.5, DEFAULT_SIMILARITY, 0.95, 0 };
+    char *strs[N_STRS];
+    void *data[N_STRS];
+    const struct strgrp_grp *grps[N_STRS];
+    int assign[N_STRS];
+    struct strgrp *ctx;
+    size_t t;
+    int i, n_grps;
+
+    plan_tests(22);
+#if HAVE_OPENMP
+    /* Batches are only matched in parallel with more than one thread */
+    omp_set_num_threads(4);
+#endif
+    srand(0);
+    make_strs(strs, N_STRS);
+    for (i = 0; i < N_STRS; i++) {
+        data[i] = &strs[i];
+    }
+
+    for (t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+        bool same_data = true, added = true;
+        memset(assign, -1, sizeof(assign));
+        n_grps = ref_group(thresholds[t], strs, N_STRS, assign);
+
+        create(ctx, thresholds[t]);
+        for (i = 0; i < N_STRS; i++) {
+            grps[i] = strgrp_add(ctx, strs[i], data[i]);
+        }
+        ok1(same_groups(assign, grps, N_STRS));
+        ok1(ctx->n_grps == (unsigned int) n_grps);
+        strgrp_free(ctx);
+
+        /* In slices, so later ones match both existing and new groups */
+        create(ctx, thresholds[t]);
+        memset(grps, 0, sizeof(grps));
+        for (i = 0; i < N_STRS; i += N_SLICE) {
+            added = added && strgrp_add_many(ctx,
+                    (const char *const *) &strs[i], &data[i],
+                    N_STRS - i < N_SLICE ? N_STRS - i : N_SLICE, &grps[i]);
+        }
+        ok1(added);
+        ok1(same_groups(assign, grps, N_STRS));
+        for (i = 0; i < N_STRS; i++) {
+            const struct strgrp_item *item =
+                darray_item(grps[i]->items, 0);
+            int k = 0;
+            while (!streq(strgrp_item_key(item), strs[i])
+                    || strgrp_item_value(item) != data[i]) {
+                if (++k == grps[i]->n_items) {
+                    break;
+                }
+                item = darray_item(grps[i]->items, k);
+            }
+            same_data = same_data && k < grps[i]->n_items;
+        }
+        ok1(same_data);
+        strgrp_free(ctx);
+    }
+
+    /* No data and no groups returned */
+    create(ctx, DEFAULT_SIMILARITY);
+    ok1(strgrp_add_many(ctx, (const char *const *) strs, NULL, 10, NULL));
+    ok1(ctx->n_grps > 0);
+    strgrp_free(ctx);
+
+    for (i = 0; i < N_STRS; i++) {
+        free(strs[i]);
+    }
+    return exit_status();
+}
@@ -0,0 +1,454 @@
+/* CC0 license (public domain) - see LICENSE file for details */
+#include <ccan/strmap/flat/flat.h>
+#include <ccan/read_write_all/read_write_all.h>
+#include <ccan/short_types/short_types.h>
+#include <ccan/str/str.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * The image is a trie much like the in-memory strmap: each node branches
+ * on a single byte, and we compare against a leaf at the end rather than
+ * storing prefixes in nodes.  Everything is 8-byte aligned, and child
+ * offsets have the bottom bit set if they refer to a leaf.
+ *
+ * Children are written before their parent, so the root comes last.
+ */
+#define FLAT_MAGIC "STRMAPF1"
+#define FLAT_ENDIAN 0x0102030405060708ULL
+
+struct flat_header {
+	char magic[8];
+	u64 endian;
+	/* Offset of the root node or leaf (0 if empty). */
+	u64 root;
+	/* Total length of the image. */
+	u64 size;
+};
+
+struct flat_node {
+	/* The byte number we branch on. */
+	u64 byte_num;
+	u32 num;
+	/* Sorted keys, then (aligned) u64 child offsets. */
+	u8 keys[];
+};
+
+struct flat_leaf {
+	u64 value_len;
+	u64 member_len;
+	/* Nul-terminated member, then (aligned) value. */
+	char member[];
+};
+
+static inline size_t align8(size_t off)
+{
+	return (off + 7) & ~(size_t)7;
+}
+
+static inline bool off_is_leaf(u64 off)
+{
+	return off & 1;
+}
+
+static inline const u64 *node_children(const struct flat_node *n)
+{
+	return (const u64 *)((const char *)n
+			     + align8(offsetof(struct flat_node, keys) + n->num));
+}
+
+static inline const void *leaf_value(const struct flat_leaf *l)
+{
+	return (const char *)l + align8(sizeof(*l) + l->member_len + 1);
+}
+
+static inline const struct flat_node *to_node(const struct strmap_flat *flat,
+					      u64 off)
+{
+	return (const struct flat_node *)(flat->base + off);
+}
+
+static inline const struct flat_leaf *to_leaf(const struct strmap_flat *flat,
+					      u64 off)
+{
+	return (const struct flat_leaf *)(flat->base + off - 1);
+}
+
+/* Child offset for this byte, or 0. */
+static u64 flat_find_child(const struct flat_node *n, u8 c)
+{
+	u32 lo = 0, hi = n->num;
+
+	while (lo < hi) {
+		u32 mid = (lo + hi) / 2;
+		if (n->keys[mid] == c)
+			return node_children(n)[mid];
+		if (n->keys[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+/* Any member (the lowest one, in fact) under this non-zero offset. */
+static const struct flat_leaf *flat_any_leaf(const struct strmap_flat *flat,
+					u64 off)
+{
+	while (!off_is_leaf(off))
+		off = node_children(to_node(flat, off))[0];
+	return to_leaf(flat, off);
+}
+
+/* Writing. */
+struct writer {
+	char *buf;
+	size_t len, max;
+};
+
+struct entry {
+	const char *member;
+	const void *data;
+	size_t len;
+};
+
+struct entries {
+	struct entry *arr;
+	size_t num, max;
+	bool failed;
+	size_t (*encode)(const char *, void *, const void **, void *);
+	void *arg;
+};
+
+/* Append (zeroed, aligned) space, and set *off to its offset. */
+static bool reserve(struct writer *w, size_t len, size_t *off)
+{
+	len = align8(len);
+	if (w->len + len > w->max) {
+		size_t max = w->max * 2;
+		char *buf;
+
+		if (max < w->len + len)
+			max = w->len + len;
+		buf = realloc(w->buf, max);
+		if (!buf) {
+			errno = ENOMEM;
+			return false;
+		}
+		w->buf = buf;
+		w->max = max;
+	}
+	*off = w->len;
+	memset(w->buf + *off, 0, len);
+	w->len += len;
+	return true;
+}
+
+static bool write_leaf(struct writer *w, const struct entry *e, u64 *off)
+{
+	size_t mlen = strlen(e->member);
+	size_t hdr = align8(sizeof(struct flat_leaf) + mlen + 1);
+	struct flat_leaf *l;
+	size_t loff;
+
+	if (!reserve(w, hdr + e->len, &loff))
+		return false;
+	l = (struct flat_leaf *)(w->buf + loff);
+	l->value_len = e->len;
+	l->member_len = mlen;
+	memcpy(l->member, e->member, mlen + 1);
+	if (e->len)
+		memcpy(w->buf + loff + hdr, e->data, e->len);
+	*off = loff + 1;
+	return true;
+}
+
+/* Write out trie for these (sorted) entries, which share depth bytes. */
+static bool write_trie(struct writer *w, const struct entry *e, size_t num,
+		       size_t depth, u64 *off)
+{
+	const u8 *first, *last;
+	struct flat_node *n;
+	size_t i, start, byte_num, noff;
+	u8 keys[256];
+	u64 offs[256];
+	u32 num_children = 0;
+
+	if (num == 1)
+		return write_leaf(w, e, off);
+
+	/* Sorted, so first and last have the shortest common prefix. */
+	first = (const u8 *)e[0].member;
+	last = (const u8 *)e[num-1].member;
+	for (byte_num = depth; first[byte_num] == last[byte_num]; byte_num++);
+
+	for (start = 0; start < num; start = i) {
+		u8 c = e[start].member[byte_num];
+
+		for (i = start + 1; i < num; i++)
+			if ((u8)e[i].member[byte_num] != c)
+				break;
+		keys[num_children] = c;
+		if (!write_trie(w, e + start, i - start, byte_num + 1,
+				&offs[num_children]))
+			return false;
+		num_children++;
+	}
+
+	if (!reserve(w, align8(offsetof(struct flat_node, keys) + num_children)
+		     + num_children * sizeof(u64), &noff))
+		return false;
+	n = (struct flat_node *)(w->buf + noff);
+	n->byte_num = byte_num;
+	n->num = num_children;
+	memcpy(n->keys, keys, num_children);
+	memcpy((u64 *)node_children(n), offs, num_children * sizeof(u64));
+	*off = noff;
+	return true;
+}
+
+static bool add_entry(struct entries *ents, const char *member,
+		      const void *data, size_t len)
+{
+	if (ents->num == ents->max) {
+		size_t max = ents->max ? ents->max * 2 : 1024;
+		struct entry *arr = realloc(ents->arr, max * sizeof(*arr));
+		if (!arr) {
+			/* Stops the iteration. */
+			ents->failed = true;
+			return false;
+		}
+		ents->arr = arr;
+		ents->max = max;
+	}
+	ents->arr[ents->num].member = member;
+	ents->arr[ents->num].data = data;
+	ents->arr[ents->num].len = len;
+	ents->num++;
+	return true;
+}
+
+static bool add_member(const char *member, struct entries *ents)
+{
+	return add_entry(ents, member, NULL, 0);
+}
+
+static bool add_value(const char *member, void *value, struct entries *ents)
+{
+	const void *data = NULL;
+	size_t len = ents->encode(member, value, &data, ents->arg);
+
+	return add_entry(ents, member, data, len);
+}
+
+static bool write_entries(int fd, struct entries *ents)
+{
+	struct writer w = { NULL, 0, 0 };
+	struct flat_header *hdr;
+	size_t hoff;
+	bool ok = false;
+	u64 root = 0;
+
+	if (ents->failed) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	if (!reserve(&w, sizeof(*hdr), &hoff))
+		goto out;
+	if (ents->num && !write_trie(&w, ents->arr, ents->num, 0, &root))
+		goto out;
+
+	hdr = (struct flat_header *)(w.buf + hoff);
+	memcpy(hdr->magic, FLAT_MAGIC, sizeof(hdr->magic));
+	hdr->endian = FLAT_ENDIAN;
+	hdr->root = root;
+	hdr->size = w.len;
+	ok = write_all(fd, w.buf, w.len);
+
+out:
+	free(w.buf);
+	free(ents->arr);
+	return ok;
+}
+
+bool strset_flat_write(int fd, const struct strset *set)
+{
+	struct entries ents = { NULL, 0, 0, false, NULL, NULL };
+
+	strset_iterate(set, add_member, &ents);
+	return write_entries(fd, &ents);
+}
+
+bool strmap_flat_write_(int fd, const struct strmap *map,
+			size_t (*encode)(const char *member, void *value,
+					 const void **data, void *arg),
+			void *arg)
+{
+	struct entries ents = { NULL, 0, 0, false, encode, arg };
+
+	strmap_iterate_(map,
+			typesafe_cb_cast(bool (*)(const char *, void *, void *),
+					 bool (*)(const char *, void *,
+						  struct entries *),
+					 add_value),
+			&ents);
+	return write_entries(fd, &ents);
+}
+
+/* Reading. */
+bool strmap_flat_init(struct strmap_flat *flat, const void *mem, size_t size)
+{
+	const struct flat_header *hdr = mem;
+
+	if (size < sizeof(*hdr)
+	    || ((uintptr_t)mem & 7)
+	    || memcmp(hdr->magic, FLAT_MAGIC, sizeof(hdr->magic)) != 0
+	    || hdr->endian != FLAT_ENDIAN
+	    || hdr->size > size
+	    || hdr->root >= hdr->size) {
+		errno = EINVAL;
+		return false;
+	}
+
+	flat->base = mem;
+	flat->size = hdr->size;
+	flat->root = hdr->root;
+	flat->mapped = false;
+	return true;
+}
+
+bool strmap_flat_map(struct strmap_flat *flat, int fd)
+{
+	struct stat st;
+	void *mem;
+
+	if (fstat(fd, &st) != 0)
+		return false;
+
+	if ((size_t)st.st_size < sizeof(struct flat_header)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED)
+		return false;
+
+	if (!strmap_flat_init(flat, mem, st.st_size)) {
+		munmap(mem, st.st_size);
+		errno = EINVAL;
+		return false;
+	}
+	/* Unmap the whole file, even if the image is shorter. */
+	flat->size = st.st_size;
+	flat->mapped = true;
+	return true;
+}
+
+void strmap_flat_unmap(struct strmap_flat *flat)
+{
+	if (flat->mapped)
+		munmap((void *)flat->base, flat->size);
+	flat->base = NULL;
+	flat->root = 0;
+	flat->mapped = false;
+}
+
+const void *strmap_flat_get(const struct strmap_flat *flat,
+			    const char *member, size_t *lenp)
+{
+	size_t len = strlen(member);
+	const u8 *bytes = (const u8 *)member;
+	const struct flat_leaf *l;
+	u64 off = flat->root;
+
+	if (!off)
+		goto fail;
+
+	while (!off_is_leaf(off)) {
+		const struct flat_node *n = to_node(flat, off);
+
+		if (n->byte_num > len)
+			goto fail;
+		off = flat_find_child(n, bytes[n->byte_num]);
+		if (!off)
+			goto fail;
+	}
+
+	l = to_leaf(flat, off);
+	if (l->member_len != len || memcmp(l->member, member, len) != 0)
+		goto fail;
+	if (lenp)
+		*lenp = l->value_len;
+	return leaf_value(l);
+
+fail:
+	errno = ENOENT;
+	return NULL;
+}
+
+static bool flat_iterate(const struct strmap_flat *flat, u64 off,
+		    bool (*handle)(const char *, const void *, size_t, void *),
+		    const void *arg)
+{
+	const struct flat_node *n;
+	const u64 *child;
+	u32 i;
+
+	if (off_is_leaf(off)) {
+		const struct flat_leaf *l = to_leaf(flat, off);
+		return handle(l->member, leaf_value(l), l->value_len,
+			      (void *)arg);
+	}
+
+	n = to_node(flat, off);
+	child = node_children(n);
+	for (i = 0; i < n->num; i++)
+		if (!flat_iterate(flat, child[i], handle, arg))
+			return false;
+	return true;
+}
+
+void strmap_flat_iterate_(const struct strmap_flat *flat,
+			  bool (*handle)(const char *, const void *, size_t,
+					 void *),
+			  const void *arg)
+{
+	if (flat->root)
+		flat_iterate(flat, flat->root, handle, arg);
+}
+
+struct strmap_flat strmap_flat_prefix(const struct strmap_flat *flat,
+				      const char *prefix)
+{
+	struct strmap_flat sub = *flat;
+	size_t len = strlen(prefix);
+	const u8 *bytes = (const u8 *)prefix;
+
+	/* The submap never owns the mapping. */
+	sub.mapped = false;
+
+	/* Empty map -> return empty map. */
+	if (!sub.root)
+		return sub;
+
+	/* Walk until everything below shares the prefix bytes (if any do).
+	 * Bytes before len are non-zero, so we never follow '\0'. */
+	while (!off_is_leaf(sub.root)) {
+		const struct flat_node *n = to_node(flat, sub.root);
+
+		if (n->byte_num >= len)
+			break;
+		sub.root = flat_find_child(n, bytes[n->byte_num]);
+		if (!sub.root)
+			return sub;
+	}
+
+	if (!strstarts(flat_any_leaf(flat, sub.root)->member, prefix))
+		sub.root = 0;
+	return sub;
+}
@@ -0,0 +1,232 @@
+/* CC0 license (public domain) - see LICENSE file for details */
+#ifndef CCAN_STRMAP_FLAT_H
+#define CCAN_STRMAP_FLAT_H
+#include "config.h"
+#include <ccan/strmap/strmap.h>
+#include <ccan/strset/strset.h>
+#include <ccan/tcon/tcon.h>
+#include <ccan/typesafe_cb/typesafe_cb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * struct strmap_flat - a read-only view of a flattened string map
+ * @base: the start of the image.
+ * @size: the length of the image.
+ * @root: offset of the top of this (sub)map within @base (0 == empty).
+ * @mapped: whether strmap_flat_unmap() should munmap() @base.
+ *
+ * The image contains only offsets, never pointers, so it can be mapped
+ * at any address (and shared by many processes).  A view is just these
+ * few words, so strmap_flat_prefix() can return one by value.
+ */
+struct strmap_flat {
+	const char *base;
+	size_t size;
+	uint64_t root;
+	bool mapped;
+};
+
+/**
+ * strset_flat_write - write out a strset as a flat image.
+ * @fd: the file descriptor to write to.
+ * @set: the set to write.
+ *
+ * The members are copied into the image; every value is zero-length.
+ * Returns false (and sets errno) if allocation or writing fails.
+ *
+ * Example:
+ *	static bool save_set(const struct strset *set, const char *filename)
+ *	{
+ *		int fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+ *		bool ok;
+ *
+ *		if (fd < 0)
+ *			return false;
+ *		ok = strset_flat_write(fd, set);
+ *		close(fd);
+ *		return ok;
+ *	}
+ */
+bool strset_flat_write(int fd, const struct strset *set);
+
+/**
+ * strmap_flat_write - write out a strmap as a flat image.
+ * @fd: the file descriptor to write to.
+ * @map: the typed strmap to write.
+ * @encode: function to give the bytes to store for each value.
+ * @arg: argument for @encode.
+ *
+ * The values in a strmap are (usually) pointers, which mean nothing in
+ * another process, so @encode is called for each member in order: it
+ * sets *@data to the bytes to store for that value, and returns their
+ * length.  The members and those bytes are copied into the image.
+ *
+ * Returns false (and sets errno) if allocation or writing fails.
+ *
+ * Example:
+ *	static size_t encode_str(const char *member, char *value,
+ *				 const void **data, void *unused)
+ *	{
+ *		*data = value;
+ *		return strlen(value) + 1;
+ *	}
+ *
+ *	static bool save_map(const struct strmap *map, const char *filename)
+ *	{
+ *		STRMAP(char *) *smap = (void *)map;
+ *		int fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+ *		bool ok;
+ *
+ *		if (fd < 0)
+ *			return false;
+ *		ok = strmap_flat_write(fd, smap, encode_str, NULL);
+ *		close(fd);
+ *		return ok;
+ *	}
+ */
+#define strmap_flat_write(fd, map, encode, arg)				\
+	strmap_flat_write_((fd), tcon_unwrap(map),			\
+			   typesafe_cb_cast(size_t (*)(const char *,	\
+						       void *,		\
+						       const void **,	\
+						       void *),		\
+					    size_t (*)(const char *,	\
+						       tcon_type((map), canary), \
+						       const void **,	\
+						       __typeof__(arg)), \
+					    (encode)),			\
+			   (arg))
+bool strmap_flat_write_(int fd, const struct strmap *map,
+			size_t (*encode)(const char *member, void *value,
+					 const void **data, void *arg),
+			void *arg);
+
+/**
+ * strmap_flat_map - map a flat image from a file, read-only.
+ * @flat: the view to initialize.
+ * @fd: the file descriptor to map.
+ *
+ * There is no deserialization step: after checking the header, the
+ * image is used in place.  The contents of the file are trusted.
+ *
+ * Returns false (and sets errno) on failure: EINVAL if it's not a valid
+ * image (or was written on a machine with different endianness).
+ *
+ * Example:
+ *	static bool load_map(struct strmap_flat *flat, const char *filename)
+ *	{
+ *		int fd = open(filename, O_RDONLY);
+ *		bool ok;
+ *
+ *		if (fd < 0)
+ *			return false;
+ *		// The mapping outlives the fd.
+ *		ok = strmap_flat_map(flat, fd);
+ *		close(fd);
+ *		return ok;
+ *	}
+ */
+bool strmap_flat_map(struct strmap_flat *flat, int fd);
+
+/**
+ * strmap_flat_init - use a flat image which is already in memory.
+ * @flat: the view to initialize.
+ * @mem: the image (must be 8-byte aligned).
+ * @size: the length of @mem.
+ *
+ * Returns false (and sets errno = EINVAL) if it's not a valid image.
+ * @mem must remain valid while @flat is in use.
+ */
+bool strmap_flat_init(struct strmap_flat *flat, const void *mem, size_t size);
+
+/**
+ * strmap_flat_unmap - release a view from strmap_flat_map().
+ * @flat: the view.
+ *
+ * This is a noop for views from strmap_flat_init() or
+ * strmap_flat_prefix().
+ */
+void strmap_flat_unmap(struct strmap_flat *flat);
+
+/**
+ * strmap_flat_empty - is this flat (sub)map empty?
+ * @flat: the view.
+ */
+static inline bool strmap_flat_empty(const struct strmap_flat *flat)
+{
+	return flat->root == 0;
+}
+
+/**
+ * strmap_flat_get - get a value from a flat map.
+ * @flat: the view to search.
+ * @member: the string to search for.
+ * @lenp: set to the length of the value (if non-NULL).
+ *
+ * Returns the value bytes, or NULL if it isn't in the map (and sets
+ * errno = ENOENT).  Values are 8-byte aligned within the image.
+ *
+ * Example:
+ *	static const char *lookup(const struct strmap_flat *flat)
+ *	{
+ *		return strmap_flat_get(flat, "hello", NULL);
+ *	}
+ */
+const void *strmap_flat_get(const struct strmap_flat *flat,
+			    const char *member, size_t *lenp);
+
+/**
+ * strmap_flat_iterate - ordered iteration over a flat map.
+ * @flat: the view.
+ * @handle: the function to call.
+ * @arg: the argument for the function (types should match).
+ *
+ * @handle is called with each member and its value bytes in order.
+ * If it returns false, the iteration will stop.
+ *
+ * Example:
+ *	static bool dump_one(const char *member, const void *value,
+ *			     size_t len, void *unused)
+ *	{
+ *		printf("%s => %zu bytes\n", member, len);
+ *		return true;
+ *	}
+ *
+ *	static void dump(const struct strmap_flat *flat)
+ *	{
+ *		strmap_flat_iterate(flat, dump_one, NULL);
+ *	}
+ */
+#define strmap_flat_iterate(flat, handle, arg)				\
+	strmap_flat_iterate_((flat),					\
+			     typesafe_cb_preargs(bool, void *, (handle), (arg), \
+						 const char *,		\
+						 const void *, size_t),	\
+			     (arg))
+void strmap_flat_iterate_(const struct strmap_flat *flat,
+			  bool (*handle)(const char *, const void *, size_t,
+					 void *),
+			  const void *arg);
+
+/**
+ * strmap_flat_prefix - return a submap matching a prefix
+ * @flat: the view.
+ * @prefix: the prefix.
+ *
+ * This returns a view of the members of @flat which start with @prefix,
+ * which you can use with strmap_flat_get(), strmap_flat_iterate() or
+ * strmap_flat_empty().
+ *
+ * Example:
+ *	static void dump_prefix(const struct strmap_flat *flat,
+ *				const char *prefix)
+ *	{
+ *		struct strmap_flat sub = strmap_flat_prefix(flat, prefix);
+ *		strmap_flat_iterate(&sub, dump_one, NULL);
+ *	}
+ */
+struct strmap_flat strmap_flat_prefix(const struct strmap_flat *flat,
+				      const char *prefix);
+#endif /* CCAN_STRMAP_FLAT_H */
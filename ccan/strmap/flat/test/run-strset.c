@@ -0,0 +1,61 @@
+#include <ccan/strmap/flat/flat.h>
+#include <ccan/strmap/flat/flat.c>
+#include <ccan/tap/tap.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static bool count_members(const char *member, const void *value, size_t len,
+			  unsigned int *count)
+{
+	(*count)++;
+	return len == 0;
+}
+
+int main(void)
+{
+	const char *words[] = { "a", "ab", "abc", "abd", "b", "ba", "\xff" };
+	struct strset set;
+	struct strmap_flat flat, sub;
+	char template[] = "run-strset-XXXXXX";
+	unsigned int i, count;
+	int fd;
+
+	plan_tests(9);
+	strset_init(&set);
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		strset_add(&set, words[i]);
+
+	fd = mkstemp(template);
+	unlink(template);
+	ok1(strset_flat_write(fd, &set));
+	ok1(strmap_flat_map(&flat, fd));
+	close(fd);
+
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+		if (!strmap_flat_get(&flat, words[i], NULL))
+			break;
+	ok1(i == sizeof(words) / sizeof(words[0]));
+	ok1(!strmap_flat_get(&flat, "abe", NULL));
+	ok1(!strmap_flat_get(&flat, "", NULL));
+
+	count = 0;
+	strmap_flat_iterate(&flat, count_members, &count);
+	ok1(count == sizeof(words) / sizeof(words[0]));
+
+	sub = strmap_flat_prefix(&flat, "ab");
+	count = 0;
+	strmap_flat_iterate(&sub, count_members, &count);
+	ok1(count == 3);
+
+	sub = strmap_flat_prefix(&flat, "\xff");
+	count = 0;
+	strmap_flat_iterate(&sub, count_members, &count);
+	ok1(count == 1);
+
+	strmap_flat_unmap(&flat);
+	strset_clear(&set);
+	ok1(strset_empty(&set));
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
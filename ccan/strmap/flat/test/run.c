@@ -0,0 +1,141 @@
+#include <ccan/strmap/flat/flat.h>
+#include <ccan/strmap/flat/flat.c>
+#include <ccan/tap/tap.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define NUM 1000
+
+static size_t encode(const char *member, char *value,
+		     const void **data, int *count)
+{
+	(*count)++;
+	*data = value;
+	return strlen(value) + 1;
+}
+
+struct check {
+	unsigned int count;
+	bool ok;
+	char prev[20];
+};
+
+static bool in_order(const char *member, const void *value, size_t len,
+		     struct check *check)
+{
+	if (check->count && strcmp(check->prev, member) >= 0)
+		check->ok = false;
+	/* Each value is the member prefixed with 'v'. */
+	if (len != strlen(member) + 2 || strcmp((const char *)value + 1, member))
+		check->ok = false;
+	strcpy(check->prev, member);
+	check->count++;
+	return true;
+}
+
+static bool stop_early(const char *member, const void *value, size_t len,
+		       unsigned int *count)
+{
+	return ++(*count) < 5;
+}
+
+int main(void)
+{
+	STRMAP(char *) map;
+	char template[] = "run-flat-XXXXXX";
+	struct strmap_flat flat, sub;
+	char *str[NUM], *val[NUM];
+	struct check check;
+	unsigned int i, count;
+	int fd, encoded = 0;
+	size_t len;
+
+	plan_tests(23);
+	strmap_init(&map);
+
+	/* Empty map. */
+	fd = mkstemp(template);
+	ok1(strmap_flat_write(fd, &map, encode, &encoded));
+	ok1(strmap_flat_map(&flat, fd));
+	close(fd);
+	unlink(template);
+	ok1(strmap_flat_empty(&flat));
+	ok1(!strmap_flat_get(&flat, "", NULL) && errno == ENOENT);
+	strmap_flat_unmap(&flat);
+
+	for (i = 0; i < NUM; i++) {
+		str[i] = malloc(20);
+		val[i] = malloc(21);
+		sprintf(str[i], "%u", i);
+		sprintf(val[i], "v%u", i);
+		strmap_add(&map, str[i], val[i]);
+	}
+	/* Empty string is a member too, and a prefix of everything. */
+	strmap_add(&map, "", "v");
+
+	strcpy(template, "run-flat-XXXXXX");
+	fd = mkstemp(template);
+	ok1(strmap_flat_write(fd, &map, encode, &encoded));
+	ok1(encoded == NUM + 1);
+	ok1(strmap_flat_map(&flat, fd));
+	close(fd);
+	unlink(template);
+	ok1(!strmap_flat_empty(&flat));
+
+	for (i = 0; i < NUM; i++) {
+		const char *v = strmap_flat_get(&flat, str[i], &len);
+		if (!v || strcmp(v, val[i]) || len != strlen(val[i]) + 1)
+			break;
+	}
+	ok1(i == NUM);
+	ok1(strcmp(strmap_flat_get(&flat, "", NULL), "v") == 0);
+	ok1(!strmap_flat_get(&flat, "1000", NULL) && errno == ENOENT);
+	ok1(!strmap_flat_get(&flat, "00", NULL) && errno == ENOENT);
+	ok1(!strmap_flat_get(&flat, "9999", NULL) && errno == ENOENT);
+
+	check.count = 0;
+	check.ok = true;
+	strmap_flat_iterate(&flat, in_order, &check);
+	ok1(check.ok && check.count == NUM + 1);
+
+	count = 0;
+	strmap_flat_iterate(&flat, stop_early, &count);
+	ok1(count == 5);
+
+	/* "99" and "990".."999" */
+	sub = strmap_flat_prefix(&flat, "99");
+	check.count = 0;
+	check.ok = true;
+	strmap_flat_iterate(&sub, in_order, &check);
+	ok1(check.ok && check.count == 11);
+	ok1(strmap_flat_get(&sub, "995", NULL) != NULL);
+
+	sub = strmap_flat_prefix(&flat, "");
+	check.count = 0;
+	strmap_flat_iterate(&sub, in_order, &check);
+	ok1(check.count == NUM + 1);
+
+	sub = strmap_flat_prefix(&flat, "a");
+	ok1(strmap_flat_empty(&sub));
+	sub = strmap_flat_prefix(&flat, "9990");
+	ok1(strmap_flat_empty(&sub));
+	sub = strmap_flat_prefix(&flat, "999");
+	ok1(!strmap_flat_empty(&sub));
+	strmap_flat_unmap(&flat);
+
+	/* Not an image. */
+	{
+		char junk[64] __attribute__((aligned(8)));
+		memset(junk, 'x', sizeof(junk));
+		ok1(!strmap_flat_init(&flat, junk, sizeof(junk)));
+		ok1(errno == EINVAL);
+	}
+
+	strmap_clear(&map);
+	for (i = 0; i < NUM; i++) {
+		free(str[i]);
+		free(val[i]);
+	}
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -1,77 +1,159 @@
-/* This code is based on ccan/strset.c. */
+/* This code is based on ccan/strset.c: an adaptive radix tree, where the
+ * member which ends at a node's byte is its child under '\0'. */
 #include <ccan/strmap/strmap.h>
+#include <ccan/art/art.h>
 #include <ccan/short_types/short_types.h>
 #include <ccan/str/str.h>
-#include <ccan/ilog/ilog.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
-struct node {
-	/* These point to strings or nodes. */
-	struct strmap child[2];
-	/* The byte number where first bit differs. */
-	size_t byte_num;
-	/* The bit where these children differ. */
-	u8 bit_num;
-};
+/* Children are struct strmap: a node, or a member and its value. */
+#define CSIZE sizeof(struct strmap)
+
+/* Anything with NULL value is a node. */
+static inline bool is_node(struct strmap n)
+{
+	return !n.v;
+}
+
+static struct strmap *find_child(const struct art_node *n, u8 c)
+{
+	return art_find_child(n, c, CSIZE);
+}
+
+/* First child with key greater than c (-1 for first), or NULL. */
+static const struct strmap *next_child(const struct art_node *n, int c,
+				       u8 *key)
+{
+	return art_next_child(n, c, key, CSIZE);
+}
+
+/* Add a leaf under n (which is ref->u.n), growing it if required. */
+static bool add_child(struct strmap *ref, u8 c, const struct strmap *leaf)
+{
+	if (!art_add_child(&ref->u.n, c, leaf, CSIZE)) {
+		errno = ENOMEM;
+		return false;
+	}
+	return true;
+}
+
+/* Remove child c from n (which is ref->u.n), shrinking it if worthwhile. */
+static void remove_child(struct strmap *ref, u8 c, struct strmap *child)
+{
+	struct art_node *n;
+
+	art_remove_child(&ref->u.n, c, child, CSIZE);
+	n = ref->u.n;
+
+	if (n->num == 1) {
+		u8 key;
+		/* Last child can replace us (it only needs its own bytes). */
+		*ref = *next_child(n, -1, &key);
+		free(n);
+	}
+}
+
+/* Any member (the lowest one, in fact) in this non-empty map. */
+static const struct strmap *any_member(const struct strmap *n)
+{
+	u8 c;
+
+	while (is_node(*n))
+		n = next_child(n->u.n, -1, &c);
+	return n;
+}
 
 /* Closest member to this in a non-empty map. */
-static struct strmap *closest(struct strmap *n, const char *member)
+static const struct strmap *closest(const struct strmap *n,
+				    const char *member, size_t len)
 {
-	size_t len = strlen(member);
 	const u8 *bytes = (const u8 *)member;
 
-	/* Anything with NULL value is a node. */
-	while (!n->v) {
-		u8 direction = 0;
+	while (is_node(*n)) {
+		const struct strmap *child = NULL;
 
-		if (n->u.n->byte_num < len) {
-			u8 c = bytes[n->u.n->byte_num];
-			direction = (c >> n->u.n->bit_num) & 1;
-		}
-		n = &n->u.n->child[direction];
+		if (n->u.n->depth <= len)
+			child = find_child(n->u.n, bytes[n->u.n->depth]);
+		/* If we can't follow, any member below here is as close. */
+		if (!child)
+			return any_member(n);
+		n = child;
 	}
 	return n;
 }
 
 void *strmap_get_(const struct strmap *map, const char *member)
 {
-	struct strmap *n;
+	size_t len = strlen(member);
+	const u8 *bytes = (const u8 *)member;
+	const struct strmap *n;
 
-	/* Not empty map? */
-	if (map->u.n) {
-		n = closest((struct strmap *)map, member);
-		if (streq(member, n->u.s))
-			return n->v;
+	/* Empty map? */
+	if (!map->u.n)
+		goto fail;
+
+	n = map;
+	while (is_node(*n)) {
+		if (n->u.n->depth > len)
+			goto fail;
+		n = find_child(n->u.n, bytes[n->u.n->depth]);
+		if (!n)
+			goto fail;
 	}
+
+	if (streq(member, n->u.s))
+		return n->v;
+fail:
 	errno = ENOENT;
 	return NULL;
 }
 
+/* Replace *ref with a node4 holding it and leaf. */
+static bool split(struct strmap *ref, size_t byte_num,
+		  u8 old_c, const struct strmap *leaf)
+{
+	struct strmap n;
+
+	n.u.n = art_new(byte_num, CSIZE);
+	if (!n.u.n) {
+		errno = ENOMEM;
+		return false;
+	}
+	n.v = NULL;
+	/* A node4 has room for both, so these can't fail. */
+	art_add_child(&n.u.n, old_c, ref, CSIZE);
+	add_child(&n, leaf->u.s[byte_num], leaf);
+	*ref = n;
+	return true;
+}
+
 bool strmap_add_(struct strmap *map, const char *member, const void *value)
 {
 	size_t len = strlen(member);
 	const u8 *bytes = (const u8 *)member;
-	struct strmap *n;
-	struct node *newn;
+	struct strmap *np, leaf;
+	const char *str;
 	size_t byte_num;
-	u8 bit_num, new_dir;
 
 	assert(value);
 
+	leaf.u.s = member;
+	leaf.v = (void *)value;
+
 	/* Empty map? */
 	if (!map->u.n) {
-		map->u.s = member;
-		map->v = (void *)value;
+		*map = leaf;
 		return true;
 	}
 
 	/* Find closest existing member. */
-	n = closest(map, member);
+	str = closest(map, member, len)->u.s;
 
 	/* Find where they differ. */
-	for (byte_num = 0; n->u.s[byte_num] == member[byte_num]; byte_num++) {
+	for (byte_num = 0; str[byte_num] == member[byte_num]; byte_num++) {
 		if (member[byte_num] == '\0') {
 			/* All identical! */
 			errno = EEXIST;
@@ -79,46 +161,17 @@ bool strmap_add_(struct strmap *map, const char *member, const void *value)
 		}
 	}
 
-	/* Find which bit differs (if we had ilog8, we'd use it) */
-	bit_num = ilog32_nz((u8)n->u.s[byte_num] ^ bytes[byte_num]) - 1;
-	assert(bit_num < CHAR_BIT);
+	/* Find where to insert: first node which doesn't branch above that.
+	 * Bytes before byte_num are non-zero, so we never follow '\0'. */
+	np = map;
+	while (is_node(*np) && np->u.n->depth < byte_num)
+		np = find_child(np->u.n, bytes[np->u.n->depth]);
 
-	/* Which direction do we go at this bit? */
-	new_dir = ((bytes[byte_num]) >> bit_num) & 1;
+	if (is_node(*np) && np->u.n->depth == byte_num)
+		return add_child(np, bytes[byte_num], &leaf);
 
-	/* Allocate new node. */
-	newn = malloc(sizeof(*newn));
-	if (!newn) {
-		errno = ENOMEM;
-		return false;
-	}
-	newn->byte_num = byte_num;
-	newn->bit_num = bit_num;
-	newn->child[new_dir].v = (void *)value;
-	newn->child[new_dir].u.s = member;
-
-	/* Find where to insert: not closest, but first which differs! */
-	n = map;
-	while (!n->v) {
-		u8 direction = 0;
-
-		if (n->u.n->byte_num > byte_num)
-			break;
-		/* Subtle: bit numbers are "backwards" for comparison */
-		if (n->u.n->byte_num == byte_num && n->u.n->bit_num < bit_num)
-			break;
-
-		if (n->u.n->byte_num < len) {
-			u8 c = bytes[n->u.n->byte_num];
-			direction = (c >> n->u.n->bit_num) & 1;
-		}
-		n = &n->u.n->child[direction];
-	}
-
-	newn->child[!new_dir] = *n;
-	n->u.n = newn;
-	n->v = NULL;
-	return true;
+	/* Everything under np shares str's bytes up to byte_num. */
+	return split(np, byte_num, str[byte_num], &leaf);
 }
 
 char *strmap_del_(struct strmap *map, const char *member, void **valuep)
@@ -127,7 +180,7 @@ char *strmap_del_(struct strmap *map, const char *member, void **valuep)
 	const u8 *bytes = (const u8 *)member;
 	struct strmap *parent = NULL, *n;
 	const char *ret = NULL;
-	u8 direction = 0; /* prevent bogus gcc warning. */
+	u8 c = 0;
 
 	/* Empty map? */
 	if (!map->u.n) {
@@ -135,26 +188,24 @@ char *strmap_del_(struct strmap *map, const char *member, void **valuep)
 		return NULL;
 	}
 
-	/* Find closest, but keep track of parent. */
+	/* Find member, but keep track of parent. */
 	n = map;
-	/* Anything with NULL value is a node. */
-	while (!n->v) {
-		u8 c = 0;
-
+	while (is_node(*n)) {
+		struct strmap *child;
+
+		if (n->u.n->depth > len)
+			goto fail;
+		c = bytes[n->u.n->depth];
+		child = find_child(n->u.n, c);
+		if (!child)
+			goto fail;
 		parent = n;
-		if (n->u.n->byte_num < len) {
-			c = bytes[n->u.n->byte_num];
-			direction = (c >> n->u.n->bit_num) & 1;
-		} else
-			direction = 0;
-		n = &n->u.n->child[direction];
+		n = child;
 	}
 
 	/* Did we find it? */
-	if (!streq(member, n->u.s)) {
-		errno = ENOENT;
-		return NULL;
-	}
+	if (!streq(member, n->u.s))
+		goto fail;
 
 	ret = n->u.s;
 	if (valuep)
@@ -163,25 +214,34 @@ char *strmap_del_(struct strmap *map, const char *member, void **valuep)
 	if (!parent) {
 		/* We deleted last node. */
 		map->u.n = NULL;
-	} else {
-		struct node *old = parent->u.n;
-		/* Raise other node to parent. */
-		*parent = old->child[!direction];
-		free(old);
-	}
+		map->v = NULL;
+	} else
+		remove_child(parent, c, n);
 
 	return (char *)ret;
+
+fail:
+	errno = ENOENT;
+	return NULL;
 }
 
 static bool iterate(struct strmap n,
 		    bool (*handle)(const char *, void *, void *),
 		    const void *data)
 {
-	if (n.v)
+	const struct strmap *child;
+	int c = -1;
+	u8 key;
+
+	if (!is_node(n))
 		return handle(n.u.s, n.v, (void *)data);
 
-	return iterate(n.u.n->child[0], handle, data)
-		&& iterate(n.u.n->child[1], handle, data);
+	while ((child = next_child(n.u.n, c, &key)) != NULL) {
+		if (!iterate(*child, handle, data))
+			return false;
+		c = key;
+	}
+	return true;
 }
 
 void strmap_iterate_(const struct strmap *map,
@@ -198,7 +258,9 @@ void strmap_iterate_(const struct strmap *map,
 const struct strmap *strmap_prefix_(const struct strmap *map,
 				    const char *prefix)
 {
-	const struct strmap *n, *top;
+	/* Convenient return for prefixes which do not appear in map. */
+	static const struct strmap empty_map;
+	const struct strmap *n;
 	size_t len = strlen(prefix);
 	const u8 *bytes = (const u8 *)prefix;
 
@@ -206,37 +268,34 @@ const struct strmap *strmap_prefix_(const struct strmap *map,
 	if (!map->u.n)
 		return map;
 
-	top = n = map;
-
-	/* We walk to find the top, but keep going to check prefix matches. */
-	while (!n->v) {
-		u8 c = 0, direction;
-
-		if (n->u.n->byte_num < len)
-			c = bytes[n->u.n->byte_num];
-
-		direction = (c >> n->u.n->bit_num) & 1;
-		n = &n->u.n->child[direction];
-		if (c)
-			top = n;
+	/* Walk until everything below shares the prefix bytes (if any do). */
+	n = map;
+	while (is_node(*n) && n->u.n->depth < len) {
+		n = find_child(n->u.n, bytes[n->u.n->depth]);
+		if (!n)
+			return &empty_map;
 	}
 
-	if (!strstarts(n->u.s, prefix)) {
-		/* Convenient return for prefixes which do not appear in map. */
-		static const struct strmap empty_map;
+	if (!strstarts(any_member(n)->u.s, prefix))
 		return &empty_map;
-	}
 
-	return top;
+	return n;
 }
 
 static void clear(struct strmap n)
 {
-	if (!n.v) {
-		clear(n.u.n->child[0]);
-		clear(n.u.n->child[1]);
-		free(n.u.n);
+	const struct strmap *child;
+	int c = -1;
+	u8 key;
+
+	if (!is_node(n))
+		return;
+
+	while ((child = next_child(n.u.n, c, &key)) != NULL) {
+		clear(*child);
+		c = key;
 	}
+	free(n.u.n);
 }
 
 void strmap_clear_(struct strmap *map)
@@ -244,4 +303,5 @@ void strmap_clear_(struct strmap *map)
 	if (map->u.n)
 		clear(*map);
 	map->u.n = NULL;
+	map->v = NULL;
 }
@@ -14,7 +14,7 @@
  */
 struct strmap {
 	union {
-		struct node *n;
+		struct art_node *n;
 		const char *s;
 	} u;
 	void *v;
@@ -0,0 +1,102 @@
+/* Test growing and shrinking of wide nodes. */
+#include <ccan/strmap/strmap.h>
+#include <ccan/strmap/strmap.c>
+#include <ccan/tap/tap.h>
+
+#define NUM (255 * 20)
+
+typedef STRMAP(char *) map_t;
+
+static void encode(char template[4], unsigned int val)
+{
+	template[0] = 'a' + val % 20;
+	template[1] = (val / 20) % 255 + 1;
+	template[2] = 'z';
+	template[3] = '\0';
+}
+
+struct state {
+	unsigned int count;
+	bool ok;
+	char prev[4];
+};
+
+static bool check(const char *member, char *value, struct state *state)
+{
+	/* Ignore the empty string. */
+	if (!member[0])
+		return true;
+	if (state->count && strcmp(state->prev, member) >= 0)
+		state->ok = false;
+	if (member != value)
+		state->ok = false;
+	strcpy(state->prev, member);
+	state->count++;
+	return true;
+}
+
+static bool check_map(const map_t *map, char str[][4], const bool *present)
+{
+	struct state state;
+	unsigned int i, expected = 0;
+
+	for (i = 0; i < NUM; i++) {
+		if (present[i]) {
+			expected++;
+			if (strmap_get(map, str[i]) != str[i])
+				return false;
+		} else if (strmap_get(map, str[i]))
+			return false;
+	}
+
+	state.count = 0;
+	state.ok = true;
+	strmap_iterate(map, check, &state);
+	return state.ok && state.count == expected;
+}
+
+int main(void)
+{
+	map_t map;
+	static char str[NUM][4];
+	static bool present[NUM];
+	unsigned int i;
+
+	plan_tests(9);
+	strmap_init(&map);
+
+	/* The empty string lives under '\0' of the top node. */
+	ok1(strmap_add(&map, "", str[0]));
+
+	for (i = 0; i < NUM; i++) {
+		encode(str[i], i);
+		if (!strmap_add(&map, str[i], str[i]))
+			break;
+		present[i] = true;
+	}
+	ok1(i == NUM);
+	ok1(check_map(&map, str, present));
+
+	/* Delete in scattered order, leaving a few: nodes must shrink. */
+	for (i = 0; i < NUM; i++) {
+		unsigned int k = (i * 7919) % NUM;
+		if (k % 100 == 0)
+			continue;
+		if (strmap_del(&map, str[k], NULL) != str[k])
+			break;
+		present[k] = false;
+	}
+	ok1(i == NUM);
+	ok1(strmap_get(&map, "") == str[0]);
+	ok1(strmap_del(&map, "", NULL) != NULL);
+	ok1(check_map(&map, str, present));
+
+	/* Prefix of a single first byte. */
+	ok1(!strmap_empty_(strmap_prefix_(tcon_unwrap(&map), "a")));
+
+	strmap_clear(&map);
+	ok1(strmap_empty(&map));
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -1,92 +1,183 @@
-/* This code is based on the public domain code at
+/* This code was originally based on the public domain critbit code at
  * http://github.com/agl/critbit writtem by Adam Langley
- * <agl@imperialviolet.org>.
+ * <agl@imperialviolet.org>, but is now an adaptive radix tree:
  *
- * Here are the main implementation differences:
- * (1) We don't strdup the string on insert; we use the pointer we're given.
- * (2) We use a straight bit number rather than a mask; it's simpler.
- * (3) We don't use the bottom bit of the pointer, but instead use a leading
+ *  V. Leis, A. Kemper, T. Neumann: "The Adaptive Radix Tree: ARTful
+ *  Indexing for Main-Memory Databases" (ICDE 2013)
+ *
+ * Here are the main implementation details:
+ * (1) We don't strdup the string on insert; we use the pointer we're given,
+ *     and that pointer *is* the leaf: there's no per-member allocation.
+ * (2) Each node branches on a whole byte, and nodes come in four sizes
+ *     (4, 16, 48 and 256 children) so sparse nodes stay small.
+ * (3) We don't store prefixes in nodes: like critbit, we walk down to the
+ *     closest member and compare with that (so-called optimistic path
+ *     compression).
+ * (4) We don't use the bottom bit of the pointer, but instead use a leading
  *     zero to distinguish nodes from strings.
- * (4) The empty string (which would look like a node) is handled
- *     using a special "empty node".
- * (5) Delete returns the string, so you can free it if you want to.
- * (6) Unions instead of void *, bool instead of int.
+ * (5) The member which ends at a node's byte is its child under '\0': that
+ *     child is always a string (only the empty string could look like a
+ *     node, and that's handled by never placing it anywhere else).
+ * (6) Delete returns the string, so you can free it if you want to.
  */
 #include <ccan/strset/strset.h>
+#include <ccan/art/art.h>
 #include <ccan/short_types/short_types.h>
 #include <ccan/likely/likely.h>
 #include <ccan/str/str.h>
-#include <ccan/ilog/ilog.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
-struct node {
-	/* To differentiate us from strings. */
-	char nul_byte;
-	/* The bit where these children differ. */
-	u8 bit_num;
-	/* The byte number where first bit differs (-1 == empty string node). */
-	size_t byte_num;
-	/* These point to strings or nodes. */
-	struct strset child[2];
-};
+/* Children are struct strset: a node, or a member. */
+#define CSIZE sizeof(struct strset)
+
+/* Don't call this on a child under '\0': it might be the empty string. */
+static inline bool is_node(struct strset n)
+{
+	return !n.u.s[0];
+}
+
+static struct strset *find_child(const struct art_node *n, u8 c)
+{
+	return art_find_child(n, c, CSIZE);
+}
+
+/* First child with key greater than c (-1 for first), or NULL. */
+static const struct strset *next_child(const struct art_node *n, int c,
+				       u8 *key)
+{
+	return art_next_child(n, c, key, CSIZE);
+}
+
+/* Add a member under n (which is ref->u.n), growing it if required. */
+static bool add_child(struct strset *ref, u8 c, const char *member)
+{
+	struct strset child;
+
+	child.u.s = member;
+	if (!art_add_child(&ref->u.n, c, &child, CSIZE)) {
+		errno = ENOMEM;
+		return false;
+	}
+	return true;
+}
+
+/* Remove child c from n (which is ref->u.n), shrinking it if worthwhile. */
+static void remove_child(struct strset *ref, u8 c, struct strset *child)
+{
+	struct art_node *n;
+
+	art_remove_child(&ref->u.n, c, child, CSIZE);
+	n = ref->u.n;
+
+	/* We were the node holding a lone empty string. */
+	if (n->num == 0) {
+		free(n);
+		ref->u.n = NULL;
+		return;
+	}
+
+	if (n->num == 1) {
+		u8 key;
+		const struct strset *last = next_child(n, -1, &key);
+		/* The empty string can't stand alone: keep its node. */
+		if (key == '\0' && n->depth == 0)
+			return;
+		/* Last child can replace us (it only needs its own bytes). */
+		*ref = *last;
+		free(n);
+	}
+}
+
+/* Any member (the lowest one, in fact) in this non-empty set. */
+static const char *any_member(struct strset n)
+{
+	while (is_node(n)) {
+		const struct strset *child;
+		u8 c = 0;
+
+		child = next_child(n.u.n, -1, &c);
+		if (c == '\0')
+			return child->u.s;
+		n = *child;
+	}
+	return n.u.s;
+}
 
 /* Closest member to this in a non-empty set. */
-static const char *closest(struct strset n, const char *member)
+static const char *closest(struct strset n, const char *member, size_t len)
 {
-	size_t len = strlen(member);
 	const u8 *bytes = (const u8 *)member;
 
 	/* Anything with first byte 0 is a node. */
-	while (!n.u.s[0]) {
-		u8 direction = 0;
-
-		/* Special node which represents the empty string. */
-		if (unlikely(n.u.n->byte_num == (size_t)-1)) {
-			n = n.u.n->child[0];
-			break;
-		}
+	while (is_node(n)) {
+		const struct strset *child = NULL;
+		u8 c = 0;
 
-		if (n.u.n->byte_num < len) {
-			u8 c = bytes[n.u.n->byte_num];
-			direction = (c >> n.u.n->bit_num) & 1;
+		if (n.u.n->depth <= len) {
+			c = bytes[n.u.n->depth];
+			child = find_child(n.u.n, c);
 		}
-		n = n.u.n->child[direction];
+		/* If we can't follow, any member below here is as close. */
+		if (!child)
+			return any_member(n);
+		if (c == '\0')
+			return child->u.s;
+		n = *child;
 	}
 	return n.u.s;
 }
 
 char *strset_get(const struct strset *set, const char *member)
 {
-	const char *str;
+	size_t len = strlen(member);
+	const u8 *bytes = (const u8 *)member;
+	struct strset n;
 
-	/* Non-empty set? */
-	if (set->u.n) {
-		str = closest(*set, member);
-		if (streq(member, str))
-			return (char *)str;
+	/* Empty set? */
+	if (!set->u.n)
+		goto fail;
+
+	n = *set;
+	while (is_node(n)) {
+		const struct strset *child;
+		u8 c;
+
+		if (n.u.n->depth > len)
+			goto fail;
+		c = bytes[n.u.n->depth];
+		child = find_child(n.u.n, c);
+		if (!child)
+			goto fail;
+		n = *child;
+		if (c == '\0')
+			break;
 	}
+
+	if (streq(member, n.u.s))
+		return (char *)n.u.s;
+fail:
 	errno = ENOENT;
 	return NULL;
 }
 
-static bool set_string(struct strset *set,
-		       struct strset *n, const char *member)
+/* Replace *ref with a node4 holding it and member. */
+static bool split(struct strset *ref, size_t byte_num,
+		  u8 old_c, const char *member)
 {
-	/* Substitute magic empty node if this is the empty string */
-	if (unlikely(!member[0])) {
-		n->u.n = malloc(sizeof(*n->u.n));
-		if (unlikely(!n->u.n)) {
-			errno = ENOMEM;
-			return false;
-		}
-		n->u.n->nul_byte = '\0';
-		n->u.n->byte_num = (size_t)-1;
-		/* Attach the string to child[0] */
-		n = &n->u.n->child[0];
+	struct strset n;
+
+	n.u.n = art_new(byte_num, CSIZE);
+	if (!n.u.n) {
+		errno = ENOMEM;
+		return false;
 	}
-	n->u.s = member;
+	/* A node4 has room for both, so these can't fail. */
+	art_add_child(&n.u.n, old_c, ref, CSIZE);
+	add_child(&n, member[byte_num], member);
+	*ref = n;
 	return true;
 }
 
@@ -96,17 +187,25 @@ bool strset_add(struct strset *set, const char *member)
 	const u8 *bytes = (const u8 *)member;
 	struct strset *np;
 	const char *str;
-	struct node *newn;
 	size_t byte_num;
-	u8 bit_num, new_dir;
 
 	/* Empty set? */
 	if (!set->u.n) {
-		return set_string(set, set, member);
+		/* The empty string needs a node, so it doesn't look like one */
+		if (unlikely(!member[0])) {
+			set->u.n = art_new(0, CSIZE);
+			if (!set->u.n) {
+				errno = ENOMEM;
+				return false;
+			}
+			return add_child(set, '\0', member);
+		}
+		set->u.s = member;
+		return true;
 	}
 
 	/* Find closest existing member. */
-	str = closest(*set, member);
+	str = closest(*set, member, len);
 
 	/* Find where they differ. */
 	for (byte_num = 0; str[byte_num] == member[byte_num]; byte_num++) {
@@ -117,50 +216,17 @@ bool strset_add(struct strset *set, const char *member)
 		}
 	}
 
-	/* Find which bit differs (if we had ilog8, we'd use it) */
-	bit_num = ilog32_nz((u8)str[byte_num] ^ bytes[byte_num]) - 1;
-	assert(bit_num < CHAR_BIT);
-
-	/* Which direction do we go at this bit? */
-	new_dir = ((bytes[byte_num]) >> bit_num) & 1;
-
-	/* Allocate new node. */
-	newn = malloc(sizeof(*newn));
-	if (!newn) {
-		errno = ENOMEM;
-		return false;
-	}
-	newn->nul_byte = '\0';
-	newn->byte_num = byte_num;
-	newn->bit_num = bit_num;
-	if (unlikely(!set_string(set, &newn->child[new_dir], member))) {
-		free(newn);
-		return false;
-	}
-
-	/* Find where to insert: not closest, but first which differs! */
+	/* Find where to insert: first node which doesn't branch above that.
+	 * Bytes before byte_num are non-zero, so we never follow '\0'. */
 	np = set;
-	while (!np->u.s[0]) {
-		u8 direction = 0;
+	while (is_node(*np) && np->u.n->depth < byte_num)
+		np = find_child(np->u.n, bytes[np->u.n->depth]);
 
-		/* Special node which represents the empty string will
-		 * break here too! */
-		if (np->u.n->byte_num > byte_num)
-			break;
-		/* Subtle: bit numbers are "backwards" for comparison */
-		if (np->u.n->byte_num == byte_num && np->u.n->bit_num < bit_num)
-			break;
+	if (is_node(*np) && np->u.n->depth == byte_num)
+		return add_child(np, bytes[byte_num], member);
 
-		if (np->u.n->byte_num < len) {
-			u8 c = bytes[np->u.n->byte_num];
-			direction = (c >> np->u.n->bit_num) & 1;
-		}
-		np = &np->u.n->child[direction];
-	}
-
-	newn->child[!new_dir]= *np;
-	np->u.n = newn;
-	return true;
+	/* Everything under np shares str's bytes up to byte_num. */
+	return split(np, byte_num, str[byte_num], member);
 }
 
 char *strset_del(struct strset *set, const char *member)
@@ -169,7 +235,7 @@ char *strset_del(struct strset *set, const char *member)
 	const u8 *bytes = (const u8 *)member;
 	struct strset *parent = NULL, *n;
 	const char *ret = NULL;
-	u8 direction = 0; /* prevent bogus gcc warning. */
+	u8 c = 0;
 
 	/* Empty set? */
 	if (!set->u.n) {
@@ -177,67 +243,61 @@ char *strset_del(struct strset *set, const char *member)
 		return NULL;
 	}
 
-	/* Find closest, but keep track of parent. */
+	/* Find member, but keep track of parent. */
 	n = set;
-	/* Anything with first byte 0 is a node. */
-	while (!n->u.s[0]) {
-		u8 c = 0;
-
-		/* Special node which represents the empty string. */
-		if (unlikely(n->u.n->byte_num == (size_t)-1)) {
-			const char *empty_str = n->u.n->child[0].u.s;
-
-			if (member[0]) {
-				errno = ENOENT;
-				return NULL;
-			}
-
-			/* Sew empty string back so remaining logic works */
-			free(n->u.n);
-			n->u.s = empty_str;
-			break;
-		}
-
+	while (is_node(*n)) {
+		struct strset *child;
+
+		if (n->u.n->depth > len)
+			goto fail;
+		c = bytes[n->u.n->depth];
+		child = find_child(n->u.n, c);
+		if (!child)
+			goto fail;
 		parent = n;
-		if (n->u.n->byte_num < len) {
-			c = bytes[n->u.n->byte_num];
-			direction = (c >> n->u.n->bit_num) & 1;
-		} else
-			direction = 0;
-		n = &n->u.n->child[direction];
+		n = child;
+		if (c == '\0')
+			break;
 	}
 
 	/* Did we find it? */
-	if (!streq(member, n->u.s)) {
-		errno = ENOENT;
-		return NULL;
-	}
+	if (!streq(member, n->u.s))
+		goto fail;
 
 	ret = n->u.s;
 
 	if (!parent) {
 		/* We deleted last node. */
 		set->u.n = NULL;
-	} else {
-		struct node *old = parent->u.n;
-		/* Raise other node to parent. */
-		*parent = old->child[!direction];
-		free(old);
-	}
+	} else
+		remove_child(parent, c, n);
 
 	return (char *)ret;
+
+fail:
+	errno = ENOENT;
+	return NULL;
 }
 
 static bool iterate(struct strset n,
 		    bool (*handle)(const char *, void *), const void *data)
 {
-	if (n.u.s[0])
+	const struct strset *child;
+	int c = -1;
+	u8 key;
+
+	if (!is_node(n))
 		return handle(n.u.s, (void *)data);
-	if (unlikely(n.u.n->byte_num == (size_t)-1))
-		return handle(n.u.n->child[0].u.s, (void *)data);
 
-	return iterate(n.u.n->child[0], handle, data)
-		&& iterate(n.u.n->child[1], handle, data);
+	while ((child = next_child(n.u.n, c, &key)) != NULL) {
+		if (key == '\0') {
+			if (!handle(child->u.s, (void *)data))
+				return false;
+		} else if (!iterate(*child, handle, data))
+			return false;
+		c = key;
+	}
+	return true;
 }
 
 void strset_iterate_(const struct strset *set,
@@ -252,7 +312,9 @@ void strset_iterate_(const struct strset *set,
 
 const struct strset *strset_prefix(const struct strset *set, const char *prefix)
 {
-	const struct strset *n, *top;
+	/* Convenient return for prefixes which do not appear in set. */
+	static const struct strset empty_set;
+	const struct strset *n;
 	size_t len = strlen(prefix);
 	const u8 *bytes = (const u8 *)prefix;
 
@@ -260,45 +322,36 @@ const struct strset *strset_prefix(const struct strset *set, const char *prefix)
 	if (!set->u.n)
 		return set;
 
-	top = n = set;
-
-	/* We walk to find the top, but keep going to check prefix matches. */
-	while (!n->u.s[0]) {
-		u8 c = 0, direction;
-
-		/* Special node which represents the empty string. */
-		if (unlikely(n->u.n->byte_num == (size_t)-1)) {
-			n = &n->u.n->child[0];
-			break;
-		}
-
-		if (n->u.n->byte_num < len)
-			c = bytes[n->u.n->byte_num];
-
-		direction = (c >> n->u.n->bit_num) & 1;
-		n = &n->u.n->child[direction];
-		if (c)
-			top = n;
+	/* Walk until everything below shares the prefix bytes (if any do).
+	 * Bytes before len are non-zero, so we never follow '\0'. */
+	n = set;
+	while (is_node(*n) && n->u.n->depth < len) {
+		n = find_child(n->u.n, bytes[n->u.n->depth]);
+		if (!n)
+			return &empty_set;
 	}
 
-	if (!strstarts(n->u.s, prefix)) {
-		/* Convenient return for prefixes which do not appear in set. */
-		static const struct strset empty_set;
+	if (!strstarts(any_member(*n), prefix))
 		return &empty_set;
-	}
 
-	return top;
+	return n;
 }
 
 static void clear(struct strset n)
 {
-	if (!n.u.s[0]) {
-		if (likely(n.u.n->byte_num != (size_t)-1)) {
-			clear(n.u.n->child[0]);
-			clear(n.u.n->child[1]);
-		}
-		free(n.u.n);
+	const struct strset *child;
+	int c = -1;
+	u8 key;
+
+	if (!is_node(n))
+		return;
+
+	while ((child = next_child(n.u.n, c, &key)) != NULL) {
+		if (key != '\0')
+			clear(*child);
+		c = key;
 	}
+	free(n.u.n);
 }
 
 void strset_clear(struct strset *set)
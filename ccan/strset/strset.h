@@ -13,7 +13,7 @@
  */
 struct strset {
 	union {
-		struct node *n;
+		struct art_node *n;
 		const char *s;
 	} u;
 };
@@ -0,0 +1,92 @@
+/* Test growing and shrinking of wide nodes. */
+#include <ccan/strset/strset.h>
+#include <ccan/strset/strset.c>
+#include <ccan/tap/tap.h>
+
+#define NUM (255 * 20)
+
+static void encode(char template[4], unsigned int val)
+{
+	template[0] = 'a' + val % 20;
+	template[1] = (val / 20) % 255 + 1;
+	template[2] = 'z';
+	template[3] = '\0';
+}
+
+struct state {
+	unsigned int count;
+	bool ok;
+	char prev[4];
+};
+
+static bool check(const char *value, struct state *state)
+{
+	if (state->count && strcmp(state->prev, value) >= 0)
+		state->ok = false;
+	strcpy(state->prev, value);
+	state->count++;
+	return true;
+}
+
+static bool check_set(const struct strset *set, char str[][4],
+		      const bool *present)
+{
+	struct state state;
+	unsigned int i, expected = 0;
+
+	for (i = 0; i < NUM; i++) {
+		if (present[i]) {
+			expected++;
+			if (strset_get(set, str[i]) != str[i])
+				return false;
+		} else if (strset_get(set, str[i]))
+			return false;
+	}
+
+	state.count = 0;
+	state.ok = true;
+	strset_iterate(set, check, &state);
+	return state.ok && state.count == expected;
+}
+
+int main(void)
+{
+	struct strset set;
+	static char str[NUM][4];
+	static bool present[NUM];
+	unsigned int i;
+
+	plan_tests(7);
+	strset_init(&set);
+
+	for (i = 0; i < NUM; i++) {
+		encode(str[i], i);
+		if (!strset_add(&set, str[i]))
+			break;
+		present[i] = true;
+	}
+	ok1(i == NUM);
+	ok1(check_set(&set, str, present));
+
+	/* Delete in scattered order, leaving a few: nodes must shrink. */
+	for (i = 0; i < NUM; i++) {
+		unsigned int k = (i * 7919) % NUM;
+		if (k % 100 == 0)
+			continue;
+		if (strset_del(&set, str[k]) != str[k])
+			break;
+		present[k] = false;
+	}
+	ok1(i == NUM);
+	ok1(check_set(&set, str, present));
+
+	/* Prefix of a single first byte. */
+	ok1(!strset_empty(strset_prefix(&set, "a")));
+	ok1(strset_empty(strset_prefix(&set, "ab")));
+
+	strset_clear(&set);
+	ok1(strset_empty(&set));
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -23,6 +23,7 @@
 #include <ccan/tal/grab_file/grab_file.h>
 #include <ccan/tal/tal.h>
 #include <ccan/time/time.h>
+#include <ccan/short_types/short_types.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -388,6 +389,17 @@ static size_t normalize(const struct timeabs *start,
 	return time_to_nsec(time_divide(time_between(*stop, *start), num));
 }
 
+/* Print nanoseconds per operation, and operations per second */
+static void report(const struct timeabs *start,
+		   const struct timeabs *stop,
+		   unsigned int num)
+{
+	u64 total = time_to_nsec(time_between(*stop, *start));
+
+	printf(" %zu ns (%.0f ops/sec)\n", normalize(start, stop, num),
+	       total ? num * 1000000000.0 / total : 0.0);
+}
+
 int main(int argc, char *argv[])
 {
 	size_t i, j, num;
@@ -419,10 +431,11 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num; i++)
 		critbit0_insert(&ct, words[i]);
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
-	printf("Nodes allocated: %zu (%zu bytes)\n",
-	       allocated, allocated * sizeof(critbit0_node));
+	printf("Nodes allocated: %zu (%zu bytes, %.1f bytes/word)\n",
+	       allocated, allocated * sizeof(critbit0_node),
+	       (double)allocated * sizeof(critbit0_node) / num);
 
 	printf("#02: Initial lookup (match): ");
 	fflush(stdout);
@@ -431,7 +444,7 @@ int main(int argc, char *argv[])
 		if (!critbit0_contains(&ct, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#03: Initial lookup (miss): ");
 	fflush(stdout);
@@ -441,7 +454,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Lookups in order are very cache-friendly for judy; try random */
 	printf("#04: Initial lookup (random): ");
@@ -451,7 +464,7 @@ int main(int argc, char *argv[])
 		if (!critbit0_contains(&ct, words[j]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#05: Initial delete all: ");
 	fflush(stdout);
@@ -460,7 +473,7 @@ int main(int argc, char *argv[])
 		if (!critbit0_delete(&ct, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#06: Initial re-inserting: ");
 	fflush(stdout);
@@ -468,7 +481,7 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num; i++)
 		critbit0_insert(&ct, words[i]);
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#07: Deleting first half: ");
 	fflush(stdout);
@@ -477,7 +490,7 @@ int main(int argc, char *argv[])
 		if (!critbit0_delete(&ct, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#08: Adding (a different) half: ");
 	fflush(stdout);
@@ -486,7 +499,7 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num; i+=2)
 		critbit0_insert(&ct, misswords[i]);
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#09: Lookup after half-change (match): ");
 	fflush(stdout);
@@ -499,7 +512,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#10: Lookup after half-change (miss): ");
 	fflush(stdout);
@@ -512,7 +525,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Hashtables with delete markers can fill with markers over time.
 	 * so do some changes to see how it operates in long-term. */
@@ -525,7 +538,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#12: Churn 2: ");
 	start = time_now();
@@ -536,7 +549,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#13: Churn 3: ");
 	start = time_now();
@@ -547,7 +560,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Now it's back to normal... */
 	printf("#14: Post-Churn lookup (match): ");
@@ -557,7 +570,7 @@ int main(int argc, char *argv[])
 		if (!critbit0_contains(&ct, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#15: Post-Churn lookup (miss): ");
 	fflush(stdout);
@@ -567,7 +580,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Lookups in order are very cache-friendly for judy; try random */
 	printf("#16: Post-Churn lookup (random): ");
@@ -577,7 +590,7 @@ int main(int argc, char *argv[])
 		if (!critbit0_contains(&ct, words[j]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	return 0;
 }
@@ -39,6 +39,54 @@ static size_t normalize(const struct timeabs *start,
 	return time_to_nsec(time_divide(time_between(*stop, *start), num));
 }
 
+/* Print nanoseconds per operation, and operations per second */
+static void report(const struct timeabs *start,
+		   const struct timeabs *stop,
+		   unsigned int num)
+{
+	u64 total = time_to_nsec(time_between(*stop, *start));
+
+	printf(" %zu ns (%.0f ops/sec)\n", normalize(start, stop, num),
+	       total ? num * 1000000000.0 / total : 0.0);
+}
+
+/* Walk the nodes: members themselves are not copied, so cost nothing. */
+static void node_usage(struct strset n, size_t *count, size_t *bytes)
+{
+	static const size_t sizes[] = { sizeof(struct node4),
+					sizeof(struct node16),
+					sizeof(struct node48),
+					sizeof(struct node256) };
+	const struct strset *child;
+	int c = -1;
+	u8 key;
+
+	if (!n.u.n || !is_node(n))
+		return;
+
+	(*count)++;
+	*bytes += sizes[n.u.n->type];
+	while ((child = next_child(n.u.n, c, &key)) != NULL) {
+		if (key != '\0')
+			node_usage(*child, count, bytes);
+		c = key;
+	}
+}
+
+static size_t node_count(struct strset set)
+{
+	size_t count = 0, bytes = 0;
+	node_usage(set, &count, &bytes);
+	return count;
+}
+
+static size_t node_bytes(struct strset set)
+{
+	size_t count = 0, bytes = 0;
+	node_usage(set, &count, &bytes);
+	return bytes;
+}
+
 int main(int argc, char *argv[])
 {
 	size_t i, j, num;
@@ -71,12 +119,11 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num; i++)
 		strset_add(&set, words[i]);
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
-#if 0
-	printf("Nodes allocated: %zu (%zu bytes)\n",
-	       allocated, allocated * sizeof(critbit0_node));
-#endif
+	printf("Nodes allocated: %zu (%zu bytes, %.1f bytes/word)\n",
+	       node_count(set), node_bytes(set),
+	       (double)node_bytes(set) / num);
 
 	printf("#02: Initial lookup (match): ");
 	fflush(stdout);
@@ -85,7 +132,7 @@ int main(int argc, char *argv[])
 		if (!strset_get(&set, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#03: Initial lookup (miss): ");
 	fflush(stdout);
@@ -95,7 +142,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Lookups in order are very cache-friendly for judy; try random */
 	printf("#04: Initial lookup (random): ");
@@ -105,7 +152,7 @@ int main(int argc, char *argv[])
 		if (!strset_get(&set, words[j]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#05: Initial delete all: ");
 	fflush(stdout);
@@ -114,7 +161,7 @@ int main(int argc, char *argv[])
 		if (!strset_del(&set, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#06: Initial re-inserting: ");
 	fflush(stdout);
@@ -122,7 +169,7 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num; i++)
 		strset_add(&set, words[i]);
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#07: Deleting first half: ");
 	fflush(stdout);
@@ -131,7 +178,7 @@ int main(int argc, char *argv[])
 		if (!strset_del(&set, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#08: Adding (a different) half: ");
 	fflush(stdout);
@@ -140,7 +187,7 @@ int main(int argc, char *argv[])
 	for (i = 0; i < num; i+=2)
 		strset_add(&set, misswords[i]);
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#09: Lookup after half-change (match): ");
 	fflush(stdout);
@@ -153,7 +200,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#10: Lookup after half-change (miss): ");
 	fflush(stdout);
@@ -166,7 +213,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Hashtables with delete markers can fill with markers over time.
 	 * so do some changes to see how it operates in long-term. */
@@ -179,7 +226,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#12: Churn 2: ");
 	start = time_now();
@@ -190,7 +237,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#13: Churn 3: ");
 	start = time_now();
@@ -201,7 +248,11 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
+
+	printf("Nodes allocated: %zu (%zu bytes, %.1f bytes/word)\n",
+	       node_count(set), node_bytes(set),
+	       (double)node_bytes(set) / num);
 
 	/* Now it's back to normal... */
 	printf("#14: Post-Churn lookup (match): ");
@@ -211,7 +262,7 @@ int main(int argc, char *argv[])
 		if (!strset_get(&set, words[i]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	printf("#15: Post-Churn lookup (miss): ");
 	fflush(stdout);
@@ -221,7 +272,7 @@ int main(int argc, char *argv[])
 			abort();
 	}
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	/* Lookups in order are very cache-friendly for judy; try random */
 	printf("#16: Post-Churn lookup (random): ");
@@ -231,7 +282,7 @@ int main(int argc, char *argv[])
 		if (!strset_get(&set, words[j]))
 			abort();
 	stop = time_now();
-	printf(" %zu ns\n", normalize(&start, &stop, num));
+	report(&start, &stop, num);
 
 	return 0;
 }
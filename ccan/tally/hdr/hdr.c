@@ -0,0 +1,354 @@
+/* Licensed under LGPLv3+ - see LICENSE file for details */
+#include <ccan/tally/hdr/hdr.h>
+#include <ccan/ilog/ilog.h>
+#include <assert.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE 64
+
+struct tally_hdr {
+	uint64_t max_value;
+	unsigned int bits;
+	size_t buckets;
+	uint64_t num, sum;
+	uint64_t counts[];
+};
+
+/*
+ * Each recorder has one writer, so it updates its counters with a plain
+ * load and store (no locked instructions): they're atomic so readers
+ * can merge them while it does.  They only ever go up: a reset or an
+ * interval remembers what they were, and subtracts that later.
+ */
+struct tally_hdr_recorder {
+	struct tally_hdr_recorder *next;
+	struct tally_hdr_mt *mt;
+	_Atomic(bool) in_use;
+	_Atomic(uint64_t) sum;
+	_Atomic(uint64_t) counts[];
+};
+
+struct tally_hdr_mt {
+	uint64_t max_value;
+	unsigned int bits;
+	size_t buckets;
+	_Atomic(struct tally_hdr_recorder *) recorders;
+	/* Totals at the last reset, and the last interval. */
+	struct tally_hdr *reset_base, *interval_base;
+};
+
+/*
+ * Values below 2^bits have a bucket each.  Above that, the top bits+1
+ * bits of a value (the leading 1, and bits more) pick a bucket: each
+ * power of two from 2^bits up gets 2^bits buckets, each twice as wide as
+ * the last power of two's.
+ */
+static size_t bucket_of(unsigned int bits, uint64_t val)
+{
+	unsigned int shift;
+
+	if (val < (1ULL << bits))
+		return val;
+	shift = ilog64_nz(val) - 1 - bits;
+	return ((size_t)(shift + 1) << bits) + (val >> shift) - (1ULL << bits);
+}
+
+static uint64_t bucket_min(unsigned int bits, size_t i)
+{
+	unsigned int shift;
+
+	if (i < (1ULL << bits))
+		return i;
+	shift = (i >> bits) - 1;
+	return ((1ULL << bits) + (i & ((1ULL << bits) - 1))) << shift;
+}
+
+static uint64_t bucket_max(unsigned int bits, size_t i)
+{
+	unsigned int shift;
+
+	if (i < (1ULL << bits))
+		return i;
+	shift = (i >> bits) - 1;
+	return bucket_min(bits, i) + (1ULL << shift) - 1;
+}
+
+static size_t num_buckets(uint64_t max_value, unsigned int bits)
+{
+	return bucket_of(bits, max_value) + 1;
+}
+
+struct tally_hdr *tally_hdr_new(uint64_t max_value, unsigned int precision_bits)
+{
+	struct tally_hdr *hdr;
+	size_t buckets;
+
+	assert(precision_bits > 0 && precision_bits < 32);
+	buckets = num_buckets(max_value, precision_bits);
+	hdr = malloc(sizeof(*hdr) + buckets * sizeof(hdr->counts[0]));
+	if (hdr) {
+		hdr->max_value = max_value;
+		hdr->bits = precision_bits;
+		hdr->buckets = buckets;
+		tally_hdr_reset(hdr);
+	}
+	return hdr;
+}
+
+void tally_hdr_reset(struct tally_hdr *hdr)
+{
+	hdr->num = hdr->sum = 0;
+	memset(hdr->counts, 0, hdr->buckets * sizeof(hdr->counts[0]));
+}
+
+static size_t clamped_bucket(uint64_t max_value, unsigned int bits,
+			     uint64_t val)
+{
+	if (val > max_value)
+		val = max_value;
+	return bucket_of(bits, val);
+}
+
+void tally_hdr_add(struct tally_hdr *hdr, uint64_t val)
+{
+	hdr->counts[clamped_bucket(hdr->max_value, hdr->bits, val)]++;
+	hdr->num++;
+	hdr->sum += val;
+}
+
+uint64_t tally_hdr_num(const struct tally_hdr *hdr)
+{
+	return hdr->num;
+}
+
+uint64_t tally_hdr_min(const struct tally_hdr *hdr)
+{
+	size_t i;
+
+	for (i = 0; i < hdr->buckets; i++)
+		if (hdr->counts[i])
+			return bucket_min(hdr->bits, i);
+	return 0;
+}
+
+uint64_t tally_hdr_max(const struct tally_hdr *hdr)
+{
+	size_t i;
+
+	for (i = hdr->buckets; i > 0; i--)
+		if (hdr->counts[i-1])
+			return bucket_max(hdr->bits, i-1);
+	return 0;
+}
+
+uint64_t tally_hdr_mean(const struct tally_hdr *hdr)
+{
+	if (!hdr->num)
+		return 0;
+	return hdr->sum / hdr->num;
+}
+
+uint64_t tally_hdr_percentile(const struct tally_hdr *hdr, double percent)
+{
+	uint64_t rank, seen = 0;
+	size_t i;
+
+	if (!hdr->num)
+		return 0;
+	if (percent > 100)
+		percent = 100;
+	rank = ceil(percent / 100 * hdr->num);
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < hdr->buckets; i++) {
+		seen += hdr->counts[i];
+		if (seen >= rank)
+			return bucket_max(hdr->bits, i);
+	}
+	/* Can't happen, unless num is wrong. */
+	abort();
+}
+
+static bool same_shape(const struct tally_hdr *a, uint64_t max_value,
+		       unsigned int bits)
+{
+	return a->max_value == max_value && a->bits == bits;
+}
+
+bool tally_hdr_merge(struct tally_hdr *dst, const struct tally_hdr *src)
+{
+	size_t i;
+
+	if (!same_shape(dst, src->max_value, src->bits))
+		return false;
+	for (i = 0; i < dst->buckets; i++)
+		dst->counts[i] += src->counts[i];
+	dst->num += src->num;
+	dst->sum += src->sum;
+	return true;
+}
+
+size_t tally_hdr_buckets(const struct tally_hdr *hdr)
+{
+	return hdr->buckets;
+}
+
+uint64_t tally_hdr_bucket(const struct tally_hdr *hdr, size_t i,
+			  uint64_t *lo, uint64_t *hi)
+{
+	assert(i < hdr->buckets);
+	*lo = bucket_min(hdr->bits, i);
+	*hi = bucket_max(hdr->bits, i);
+	return hdr->counts[i];
+}
+
+struct tally_hdr_mt *tally_hdr_mt_new(uint64_t max_value,
+				      unsigned int precision_bits)
+{
+	struct tally_hdr_mt *mt = malloc(sizeof(*mt));
+
+	if (!mt)
+		return NULL;
+	mt->max_value = max_value;
+	mt->bits = precision_bits;
+	mt->buckets = num_buckets(max_value, precision_bits);
+	atomic_init(&mt->recorders, NULL);
+	mt->reset_base = tally_hdr_new(max_value, precision_bits);
+	mt->interval_base = tally_hdr_new(max_value, precision_bits);
+	if (!mt->reset_base || !mt->interval_base) {
+		free(mt->reset_base);
+		free(mt->interval_base);
+		free(mt);
+		return NULL;
+	}
+	return mt;
+}
+
+void tally_hdr_mt_free(struct tally_hdr_mt *mt)
+{
+	struct tally_hdr_recorder *r, *next;
+
+	for (r = atomic_load(&mt->recorders); r; r = next) {
+		next = r->next;
+		free(r);
+	}
+	free(mt->reset_base);
+	free(mt->interval_base);
+	free(mt);
+}
+
+struct tally_hdr_recorder *tally_hdr_mt_recorder(struct tally_hdr_mt *mt)
+{
+	struct tally_hdr_recorder *r;
+	void *mem;
+	size_t i, size;
+
+	/* Recorders are never freed until mt is, so walking is safe. */
+	for (r = atomic_load(&mt->recorders); r; r = r->next) {
+		bool unused = false;
+
+		if (atomic_compare_exchange_strong(&r->in_use, &unused, true))
+			return r;
+	}
+
+	/* Whole cache lines, so recorders don't share any. */
+	size = sizeof(*r) + mt->buckets * sizeof(r->counts[0]);
+	size = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+	if (posix_memalign(&mem, CACHE_LINE, size) != 0)
+		return NULL;
+	r = mem;
+	r->mt = mt;
+	atomic_init(&r->in_use, true);
+	atomic_init(&r->sum, 0);
+	for (i = 0; i < mt->buckets; i++)
+		atomic_init(&r->counts[i], 0);
+
+	r->next = atomic_load(&mt->recorders);
+	while (!atomic_compare_exchange_weak(&mt->recorders, &r->next, r));
+	return r;
+}
+
+/* Only one thread writes: so no need for an atomic increment. */
+static void single_writer_add(_Atomic(uint64_t) *v, uint64_t n)
+{
+	atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed)
+			      + n, memory_order_relaxed);
+}
+
+void tally_hdr_recorder_add(struct tally_hdr_recorder *r, uint64_t val)
+{
+	const struct tally_hdr_mt *mt = r->mt;
+
+	single_writer_add(&r->counts[clamped_bucket(mt->max_value, mt->bits,
+						    val)], 1);
+	single_writer_add(&r->sum, val);
+}
+
+void tally_hdr_recorder_release(struct tally_hdr_recorder *r)
+{
+	atomic_store(&r->in_use, false);
+}
+
+/* Totals so far, of every recorder. */
+static void read_totals(struct tally_hdr_mt *mt, struct tally_hdr *into)
+{
+	const struct tally_hdr_recorder *r;
+	size_t i;
+
+	assert(same_shape(into, mt->max_value, mt->bits));
+	tally_hdr_reset(into);
+	for (r = atomic_load(&mt->recorders); r; r = r->next) {
+		for (i = 0; i < mt->buckets; i++) {
+			uint64_t n = atomic_load_explicit(&r->counts[i],
+							  memory_order_relaxed);
+			into->counts[i] += n;
+			into->num += n;
+		}
+		into->sum += atomic_load_explicit(&r->sum,
+						  memory_order_relaxed);
+	}
+}
+
+/* into = into - base; base = old into */
+static void since(struct tally_hdr *into, struct tally_hdr *base, bool update)
+{
+	size_t i;
+
+	for (i = 0; i < into->buckets; i++) {
+		uint64_t now = into->counts[i];
+
+		into->counts[i] -= base->counts[i];
+		if (update)
+			base->counts[i] = now;
+	}
+	into->num -= base->num;
+	into->sum -= base->sum;
+	if (update) {
+		base->num += into->num;
+		base->sum += into->sum;
+	}
+}
+
+void tally_hdr_mt_snapshot(struct tally_hdr_mt *mt, struct tally_hdr *into)
+{
+	read_totals(mt, into);
+	since(into, mt->reset_base, false);
+}
+
+void tally_hdr_mt_interval(struct tally_hdr_mt *mt, struct tally_hdr *into)
+{
+	read_totals(mt, into);
+	since(into, mt->interval_base, true);
+}
+
+void tally_hdr_mt_reset(struct tally_hdr_mt *mt)
+{
+	read_totals(mt, mt->reset_base);
+	memcpy(mt->interval_base, mt->reset_base,
+	       sizeof(*mt->reset_base)
+	       + mt->buckets * sizeof(mt->reset_base->counts[0]));
+}
@@ -0,0 +1,208 @@
+/* Licensed under LGPLv3+ - see LICENSE file for details */
+#ifndef CCAN_TALLY_HDR_H
+#define CCAN_TALLY_HDR_H
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct tally_hdr;
+struct tally_hdr_mt;
+struct tally_hdr_recorder;
+
+/**
+ * tally_hdr_new - allocate a log-linear histogram.
+ * @max_value: the largest value to tell apart (larger ones count as this).
+ * @precision_bits: how many bits of each value to keep.
+ *
+ * This allocates a histogram using malloc(): free it with free().  Values
+ * below 2^(@precision_bits + 1) are counted exactly; above that, each
+ * power of two is split into 2^@precision_bits equal buckets, so every
+ * value is known to within a relative error of 2^-@precision_bits (7
+ * bits is better than 1%, 10 bits better than 0.1%), however large it
+ * is.  The number of buckets grows with @precision_bits, and with
+ * log2(@max_value): 7 bits up to 2^40 is 4353 buckets.
+ *
+ * Returns NULL on out of memory.
+ *
+ * Example:
+ *	// Request sizes up to 1GB, to within 1%.
+ *	struct tally_hdr *sizes = tally_hdr_new(1 << 30, 7);
+ *
+ *	tally_hdr_add(sizes, 4096);
+ *	printf("p99 is %llu\n", (long long)tally_hdr_percentile(sizes, 99));
+ *	free(sizes);
+ */
+struct tally_hdr *tally_hdr_new(uint64_t max_value, unsigned int precision_bits);
+
+/**
+ * tally_hdr_add - add a value.
+ * @hdr: the histogram.
+ * @val: the value to add.
+ *
+ * This is not thread-safe: see tally_hdr_recorder_add() for that.
+ */
+void tally_hdr_add(struct tally_hdr *hdr, uint64_t val);
+
+/**
+ * tally_hdr_num - how many values have been added?
+ * @hdr: the histogram.
+ */
+uint64_t tally_hdr_num(const struct tally_hdr *hdr);
+
+/**
+ * tally_hdr_min - the (approximate) minimum value added.
+ * @hdr: the histogram.
+ *
+ * This is the lowest value in the lowest bucket used, so it may be low
+ * by the histogram's precision.  Returns 0 if tally_hdr_num() == 0.
+ */
+uint64_t tally_hdr_min(const struct tally_hdr *hdr);
+
+/**
+ * tally_hdr_max - the (approximate) maximum value added.
+ * @hdr: the histogram.
+ *
+ * This is the highest value in the highest bucket used, so it may be high
+ * by the histogram's precision.  Returns 0 if tally_hdr_num() == 0.
+ */
+uint64_t tally_hdr_max(const struct tally_hdr *hdr);
+
+/**
+ * tally_hdr_mean - the mean value added.
+ * @hdr: the histogram.
+ *
+ * This is exact (values above max_value included), unless the total
+ * overflowed 64 bits.  Returns 0 if tally_hdr_num() == 0.
+ */
+uint64_t tally_hdr_mean(const struct tally_hdr *hdr);
+
+/**
+ * tally_hdr_percentile - the value below which a percentage of values fall.
+ * @hdr: the histogram.
+ * @percent: the percentile (eg. 50, 99 or 99.9).
+ *
+ * Returns the highest value in the bucket holding the value at this rank,
+ * so it is never less than the true percentile, and greater by no more
+ * than the histogram's precision.  Returns 0 if tally_hdr_num() == 0.
+ */
+uint64_t tally_hdr_percentile(const struct tally_hdr *hdr, double percent);
+
+/**
+ * tally_hdr_reset - forget all values.
+ * @hdr: the histogram.
+ */
+void tally_hdr_reset(struct tally_hdr *hdr);
+
+/**
+ * tally_hdr_merge - add all the values in one histogram to another.
+ * @dst: the histogram to add to.
+ * @src: the histogram to add from.
+ *
+ * Returns false (and does nothing) unless both were created with the same
+ * arguments to tally_hdr_new().
+ */
+bool tally_hdr_merge(struct tally_hdr *dst, const struct tally_hdr *src);
+
+/**
+ * tally_hdr_buckets - how many buckets in a histogram?
+ * @hdr: the histogram.
+ */
+size_t tally_hdr_buckets(const struct tally_hdr *hdr);
+
+/**
+ * tally_hdr_bucket - what's in one bucket?
+ * @hdr: the histogram.
+ * @i: the bucket number (less than tally_hdr_buckets()).
+ * @lo: set to the lowest value which goes in this bucket.
+ * @hi: set to the highest value which goes in this bucket.
+ *
+ * Returns how many values were added to this bucket; for exporting the
+ * whole distribution.
+ */
+uint64_t tally_hdr_bucket(const struct tally_hdr *hdr, size_t i,
+			  uint64_t *lo, uint64_t *hi);
+
+/**
+ * tally_hdr_mt_new - allocate a histogram which many threads can add to.
+ * @max_value: the largest value to tell apart (larger ones count as this).
+ * @precision_bits: how many bits of each value to keep.
+ *
+ * Each thread adds values through its own recorder (from
+ * tally_hdr_mt_recorder()), which takes no locks and no atomic
+ * read-modify-write operations.  Any thread can read the totals (or the
+ * values since it last looked) into a struct tally_hdr at any time: this
+ * merges every recorder's counts without stopping them.
+ *
+ * Free it with tally_hdr_mt_free().  Returns NULL on out of memory.
+ */
+struct tally_hdr_mt *tally_hdr_mt_new(uint64_t max_value,
+				      unsigned int precision_bits);
+
+/**
+ * tally_hdr_mt_free - free a histogram and all its recorders.
+ * @mt: the histogram from tally_hdr_mt_new().
+ *
+ * No thread may be using any of its recorders.
+ */
+void tally_hdr_mt_free(struct tally_hdr_mt *mt);
+
+/**
+ * tally_hdr_mt_recorder - get a recorder for this thread.
+ * @mt: the histogram from tally_hdr_mt_new().
+ *
+ * This reuses a recorder given back with tally_hdr_recorder_release() if
+ * it can, otherwise allocates one.  Returns NULL on out of memory.
+ */
+struct tally_hdr_recorder *tally_hdr_mt_recorder(struct tally_hdr_mt *mt);
+
+/**
+ * tally_hdr_recorder_add - add a value.
+ * @r: this thread's recorder.
+ * @val: the value to add.
+ *
+ * Only the thread which got @r may call this.
+ */
+void tally_hdr_recorder_add(struct tally_hdr_recorder *r, uint64_t val);
+
+/**
+ * tally_hdr_recorder_release - give back a recorder.
+ * @r: this thread's recorder.
+ *
+ * The values it recorded still count; another thread may reuse it.
+ */
+void tally_hdr_recorder_release(struct tally_hdr_recorder *r);
+
+/**
+ * tally_hdr_mt_snapshot - read all values since tally_hdr_mt_reset().
+ * @mt: the histogram from tally_hdr_mt_new().
+ * @into: a histogram created with the same arguments to tally_hdr_new().
+ *
+ * This overwrites @into with the merged counts of all the recorders.
+ * Values being added at the same time may or may not be included, but
+ * each will be in exactly one interval of tally_hdr_mt_interval().
+ *
+ * Only one thread at a time may call this, tally_hdr_mt_interval() or
+ * tally_hdr_mt_reset().
+ */
+void tally_hdr_mt_snapshot(struct tally_hdr_mt *mt, struct tally_hdr *into);
+
+/**
+ * tally_hdr_mt_interval - read all values since the last interval.
+ * @mt: the histogram from tally_hdr_mt_new().
+ * @into: a histogram created with the same arguments to tally_hdr_new().
+ *
+ * Like tally_hdr_mt_snapshot(), but only the values added since the last
+ * call (or tally_hdr_mt_reset()): for exporting every few seconds.
+ */
+void tally_hdr_mt_interval(struct tally_hdr_mt *mt, struct tally_hdr *into);
+
+/**
+ * tally_hdr_mt_reset - forget all values.
+ * @mt: the histogram from tally_hdr_mt_new().
+ *
+ * This doesn't touch the recorders: it just remembers where they are, so
+ * it doesn't race with them.
+ */
+void tally_hdr_mt_reset(struct tally_hdr_mt *mt);
+#endif /* CCAN_TALLY_HDR_H */
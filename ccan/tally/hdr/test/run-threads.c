@@ -0,0 +1,84 @@
+#include <ccan/tally/hdr/hdr.c>
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define NUM 100000
+
+static struct tally_hdr_mt *mt;
+static _Atomic(int) running = THREADS;
+
+static void *worker(void *arg)
+{
+	struct tally_hdr_recorder *r = tally_hdr_mt_recorder(mt);
+	uint64_t i;
+
+	for (i = 0; i < NUM; i++)
+		tally_hdr_recorder_add(r, i % 1000 + 1);
+	tally_hdr_recorder_release(r);
+	running--;
+	return arg;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	struct tally_hdr *snap, *sum, *interval;
+	struct tally_hdr_recorder *r;
+	unsigned int i, intervals = 0, bad = 0;
+
+	plan_tests(10);
+	mt = tally_hdr_mt_new(1000000, 7);
+	snap = tally_hdr_new(1000000, 7);
+	sum = tally_hdr_new(1000000, 7);
+	interval = tally_hdr_new(1000000, 7);
+
+	/* Values from before a reset don't count. */
+	r = tally_hdr_mt_recorder(mt);
+	tally_hdr_recorder_add(r, 500000);
+	tally_hdr_mt_snapshot(mt, snap);
+	ok1(tally_hdr_num(snap) == 1 && tally_hdr_max(snap) >= 500000);
+	tally_hdr_mt_reset(mt);
+	tally_hdr_mt_snapshot(mt, snap);
+	ok1(tally_hdr_num(snap) == 0);
+	tally_hdr_recorder_release(r);
+
+	/* Take intervals while they're recording: every value is in
+	 * exactly one. */
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	while (running) {
+		tally_hdr_mt_interval(mt, interval);
+		if (!tally_hdr_merge(sum, interval))
+			bad++;
+		intervals++;
+	}
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	tally_hdr_mt_interval(mt, interval);
+	tally_hdr_merge(sum, interval);
+	ok1(bad == 0);
+	diag("%u intervals", intervals);
+
+	tally_hdr_mt_snapshot(mt, snap);
+	ok1(tally_hdr_num(snap) == THREADS * NUM);
+	ok1(tally_hdr_num(sum) == THREADS * NUM);
+	ok1(tally_hdr_mean(snap) == 500);
+	ok1(tally_hdr_mean(sum) == 500);
+	ok1(tally_hdr_percentile(snap, 50) >= 500
+	    && tally_hdr_percentile(snap, 50) <= 500 + 500 / 128);
+	ok1(tally_hdr_percentile(sum, 99.9) >= 999
+	    && tally_hdr_percentile(sum, 99.9) <= 999 + 999 / 128);
+
+	/* The first thread's recorder was reused. */
+	i = 0;
+	for (r = atomic_load(&mt->recorders); r; r = r->next)
+		i++;
+	ok1(i <= THREADS);
+
+	free(snap);
+	free(sum);
+	free(interval);
+	tally_hdr_mt_free(mt);
+	return exit_status();
+}
@@ -0,0 +1,89 @@
+#include <ccan/tally/hdr/hdr.c>
+#include <ccan/tap/tap.h>
+
+int main(void)
+{
+	struct tally_hdr *hdr, *other;
+	uint64_t v, lo, hi, n, total;
+	size_t i, bad;
+
+	plan_tests(32);
+
+	/* Buckets are contiguous, and as narrow as the precision says. */
+	bad = 0;
+	for (i = 0; i < bucket_of(7, 1ULL << 40); i++) {
+		if (bucket_of(7, bucket_min(7, i)) != i
+		    || bucket_of(7, bucket_max(7, i)) != i
+		    || bucket_min(7, i + 1) != bucket_max(7, i) + 1)
+			bad++;
+		if ((bucket_max(7, i) - bucket_min(7, i)) * 128
+		    > bucket_min(7, i))
+			bad++;
+	}
+	ok1(bad == 0);
+	ok1(bucket_of(7, 255) == 255);
+	ok1(bucket_of(7, 256) == 256);
+	ok1(bucket_of(7, 257) == 256);
+	ok1(bucket_of(3, -1ULL) == num_buckets(-1ULL, 3) - 1);
+	ok1(bucket_max(3, num_buckets(-1ULL, 3) - 1) == -1ULL);
+
+	hdr = tally_hdr_new(1ULL << 40, 7);
+	ok1(tally_hdr_buckets(hdr) == 4353);
+	ok1(tally_hdr_num(hdr) == 0);
+	ok1(tally_hdr_min(hdr) == 0);
+	ok1(tally_hdr_max(hdr) == 0);
+	ok1(tally_hdr_percentile(hdr, 50) == 0);
+
+	/* Small values are exact. */
+	for (v = 1; v <= 100; v++)
+		tally_hdr_add(hdr, v);
+	ok1(tally_hdr_num(hdr) == 100);
+	ok1(tally_hdr_min(hdr) == 1);
+	ok1(tally_hdr_max(hdr) == 100);
+	ok1(tally_hdr_mean(hdr) == 50);
+	ok1(tally_hdr_percentile(hdr, 0) == 1);
+	ok1(tally_hdr_percentile(hdr, 50) == 50);
+	ok1(tally_hdr_percentile(hdr, 99) == 99);
+	ok1(tally_hdr_percentile(hdr, 100) == 100);
+
+	/* Large ones to within 1/128 (and never under). */
+	tally_hdr_reset(hdr);
+	ok1(tally_hdr_num(hdr) == 0);
+	for (v = 1; v <= 100000; v++)
+		tally_hdr_add(hdr, v * 1000);
+	ok1(tally_hdr_percentile(hdr, 50) >= 50000000
+	    && tally_hdr_percentile(hdr, 50) <= 50000000 + 50000000 / 128);
+	ok1(tally_hdr_percentile(hdr, 99.9) >= 99900000
+	    && tally_hdr_percentile(hdr, 99.9) <= 99900000 + 99900000 / 128);
+	ok1(tally_hdr_min(hdr) <= 1000 && tally_hdr_min(hdr) >= 1000 - 1000 / 128);
+	ok1(tally_hdr_max(hdr) >= 100000000
+	    && tally_hdr_max(hdr) <= 100000000 + 100000000 / 128);
+	ok1(tally_hdr_mean(hdr) == 50000500);
+
+	/* Out of range values count as the maximum. */
+	tally_hdr_add(hdr, -1ULL);
+	ok1(tally_hdr_percentile(hdr, 100) >= 1ULL << 40);
+
+	/* Buckets add up. */
+	total = 0;
+	for (i = 0; i < tally_hdr_buckets(hdr); i++) {
+		n = tally_hdr_bucket(hdr, i, &lo, &hi);
+		total += n;
+	}
+	ok1(total == tally_hdr_num(hdr));
+	ok1(tally_hdr_bucket(hdr, 300, &lo, &hi) == 0 && lo == 344 && hi == 345);
+
+	/* Merging. */
+	other = tally_hdr_new(1ULL << 40, 7);
+	tally_hdr_add(other, 7);
+	ok1(tally_hdr_merge(hdr, other));
+	ok1(tally_hdr_num(hdr) == 100002 && tally_hdr_min(hdr) == 7);
+	free(other);
+	other = tally_hdr_new(1ULL << 40, 8);
+	ok1(!tally_hdr_merge(hdr, other));
+	ok1(tally_hdr_num(hdr) == 100002);
+	free(other);
+	free(hdr);
+
+	return exit_status();
+}
@@ -0,0 +1,137 @@
+/*
+ * Multi-threaded speed test: tally/hdr recorders against one tally/hdr,
+ * and one tally, behind a pthread mutex.
+ *
+ * Each thread adds latency-like values (mostly around 50us, with a long
+ * tail).  We also time a snapshot of all the recorders.
+ *
+ * Usage: speed [values-per-thread] [max-threads]
+ */
+#include <ccan/tally/hdr/hdr.h>
+#include <ccan/tally/tally.h>
+#include <ccan/time/time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_VALUE 60000000000ULL
+#define BITS 7
+
+enum kind { RECORDER, LOCKED_HDR, LOCKED_TALLY };
+
+static size_t num;
+static struct tally_hdr_mt *mt;
+static struct tally_hdr *locked_hdr;
+static struct tally *locked_tally;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct thread {
+	pthread_t id;
+	unsigned int t;
+	enum kind kind;
+};
+
+static uint64_t latency(uint64_t *r)
+{
+	*r = *r * 6364136223846793005ULL + 1442695040888963407ULL;
+	/* 1 in 1024 is up to 1000 times slower. */
+	if ((*r >> 54) == 0)
+		return 50000 * ((*r >> 20) % 1000 + 1);
+	return 40000 + (*r >> 33) % 20000;
+}
+
+static void *run(void *arg)
+{
+	struct thread *me = arg;
+	struct tally_hdr_recorder *rec = NULL;
+	uint64_t r = me->t;
+	size_t i;
+
+	if (me->kind == RECORDER)
+		rec = tally_hdr_mt_recorder(mt);
+	for (i = 0; i < num; i++) {
+		uint64_t v = latency(&r);
+
+		switch (me->kind) {
+		case RECORDER:
+			tally_hdr_recorder_add(rec, v);
+			break;
+		case LOCKED_HDR:
+			pthread_mutex_lock(&lock);
+			tally_hdr_add(locked_hdr, v);
+			pthread_mutex_unlock(&lock);
+			break;
+		case LOCKED_TALLY:
+			pthread_mutex_lock(&lock);
+			tally_add(locked_tally, v);
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+	}
+	if (rec)
+		tally_hdr_recorder_release(rec);
+	return NULL;
+}
+
+static double bench(enum kind kind, unsigned int nthreads)
+{
+	struct thread *threads = calloc(nthreads, sizeof(*threads));
+	struct timeabs start;
+	size_t i;
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].t = i + 1;
+		threads[i].kind = kind;
+		pthread_create(&threads[i].id, NULL, run, &threads[i]);
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i].id, NULL);
+	free(threads);
+
+	/* Millions of values per second. */
+	return (double)nthreads * num
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads, n;
+	struct tally_hdr *snap;
+	struct timemono start;
+	size_t err;
+
+	num = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	max_threads = argc > 2 ? atoi(argv[2]) : 64;
+
+	mt = tally_hdr_mt_new(MAX_VALUE, BITS);
+	locked_hdr = tally_hdr_new(MAX_VALUE, BITS);
+	locked_tally = tally_new(1000);
+	snap = tally_hdr_new(MAX_VALUE, BITS);
+
+	printf("%zu values per thread (Mvalues/sec)\n", num);
+	printf("threads\trecorder\tmutex+hdr\tmutex+tally\n");
+	for (n = 1; n <= max_threads; n *= 2) {
+		double r = bench(RECORDER, n);
+		double h = bench(LOCKED_HDR, n);
+		double t = bench(LOCKED_TALLY, n);
+		printf("%u\t%.2f\t\t%.2f\t\t%.2f\n", n, r, h, t);
+	}
+
+	start = time_mono();
+	tally_hdr_mt_snapshot(mt, snap);
+	printf("Snapshot of %u recorders: %lluus\n", max_threads,
+	       (long long)time_to_usec(timemono_since(start)));
+	printf("recorders: p50 %llu p99 %llu p99.9 %llu\n",
+	       (long long)tally_hdr_percentile(snap, 50),
+	       (long long)tally_hdr_percentile(snap, 99),
+	       (long long)tally_hdr_percentile(snap, 99.9));
+	printf("tally: median %zi (+/- %zu)\n",
+	       tally_approx_median(locked_tally, &err), err);
+
+	free(snap);
+	free(locked_tally);
+	free(locked_hdr);
+	tally_hdr_mt_free(mt);
+	return 0;
+}
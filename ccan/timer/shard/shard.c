@@ -0,0 +1,274 @@
+/* LGPL (v2.1 or any later version) - see LICENSE file for details */
+#include <ccan/timer/shard/shard.h>
+#include <ccan/container_of/container_of.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Where a timer is.  Only the thread which adds a timer moves it out of
+ * IDLE, and only the owner of its shard moves it back: everyone else can
+ * only cancel it, which takes one compare-and-swap, so a cancel and an
+ * expiry can't both win.
+ */
+enum timer_shard_state {
+	/* In no shard: the user's to free, or add. */
+	TIMER_SHARD_IDLE,
+	/* Posted to a shard's inbox, not yet in its wheel. */
+	TIMER_SHARD_QUEUED,
+	/* In a shard's wheel. */
+	TIMER_SHARD_ARMED,
+	/* Cancelled while QUEUED: the owner drops it from the inbox. */
+	TIMER_SHARD_CANCELLED,
+	/* Cancelled while ARMED: it was sent to the inbox too, so the owner
+	 * takes it out of the wheel. */
+	TIMER_SHARD_CANCELLING,
+};
+
+static uint64_t mono_to_nsec(struct timemono t)
+{
+	return (uint64_t)t.ts.tv_sec * 1000000000 + t.ts.tv_nsec;
+}
+
+static struct timemono nsec_to_mono(uint64_t nsec)
+{
+	struct timemono t;
+
+	t.ts.tv_sec = nsec / 1000000000;
+	t.ts.tv_nsec = nsec % 1000000000;
+	return t;
+}
+
+static bool change_state(struct timer_shard_timer *t,
+			 enum timer_shard_state from, enum timer_shard_state to)
+{
+	unsigned int old = from;
+
+	return atomic_compare_exchange_strong(&t->state, &old, to);
+}
+
+/* Anyone can bring the published time forward. */
+static void lower_next(struct timer_shard *shard, struct timemono when)
+{
+	uint64_t nsec = mono_to_nsec(when);
+	uint64_t old = atomic_load_explicit(&shard->next, memory_order_relaxed);
+
+	while (nsec < old
+	       && !atomic_compare_exchange_weak(&shard->next, &old, nsec));
+}
+
+bool timer_shards_init(struct timer_shards *shards, unsigned int num,
+		       struct timemono start)
+{
+	void *mem;
+	unsigned int i;
+
+	if (posix_memalign(&mem, TIMER_SHARD_CACHE_LINE,
+			   num * sizeof(*shards->shard)) != 0)
+		return false;
+
+	shards->num = num;
+	shards->shard = mem;
+	for (i = 0; i < num; i++) {
+		struct timer_shard *shard = &shards->shard[i];
+
+		timers_init(&shard->timers, start);
+		lqueue_mpsc_init(&shard->inbox);
+		atomic_init(&shard->next, -1ULL);
+	}
+	return true;
+}
+
+void timer_shards_cleanup(struct timer_shards *shards)
+{
+	unsigned int i;
+
+	for (i = 0; i < shards->num; i++)
+		timers_cleanup(&shards->shard[i].timers);
+	free(shards->shard);
+}
+
+struct timer_shard *timer_shards_get(struct timer_shards *shards,
+				     unsigned int n)
+{
+	assert(n < shards->num);
+	return &shards->shard[n];
+}
+
+void timer_shard_timer_init(struct timer_shard_timer *t)
+{
+	timer_init(&t->timer);
+	atomic_init(&t->shard, NULL);
+	atomic_init(&t->state, TIMER_SHARD_IDLE);
+}
+
+bool timer_shard_timer_idle(const struct timer_shard_timer *t)
+{
+	return atomic_load(&t->state) == TIMER_SHARD_IDLE;
+}
+
+void timer_shard_addmono(struct timer_shard *shard,
+			 struct timer_shard_timer *t, struct timemono when)
+{
+	assert(timer_shard_timer_idle(t));
+
+	t->when = when;
+	atomic_store_explicit(&t->shard, shard, memory_order_relaxed);
+	atomic_store(&t->state, TIMER_SHARD_ARMED);
+	timer_addmono(&shard->timers, &t->timer, when);
+	lower_next(shard, when);
+}
+
+void timer_shard_addrel(struct timer_shard *shard,
+			struct timer_shard_timer *t, struct timerel rel)
+{
+	timer_shard_addmono(shard, t, timemono_add(time_mono(), rel));
+}
+
+void timer_shard_post(struct timer_shard *shard,
+		      struct timer_shard_timer *t, struct timemono when)
+{
+	assert(timer_shard_timer_idle(t));
+
+	t->when = when;
+	atomic_store_explicit(&t->shard, shard, memory_order_relaxed);
+	atomic_store(&t->state, TIMER_SHARD_QUEUED);
+	lqueue_mpsc_enqueue(&shard->inbox, t);
+	lower_next(shard, when);
+}
+
+bool timer_shard_cancel(struct timer_shard_timer *t)
+{
+	if (change_state(t, TIMER_SHARD_QUEUED, TIMER_SHARD_CANCELLED))
+		return true;
+
+	/* Once it's CANCELLING, only the owner can move it, so its shard
+	 * can't change under us. */
+	if (change_state(t, TIMER_SHARD_ARMED, TIMER_SHARD_CANCELLING)) {
+		lqueue_mpsc_enqueue(&atomic_load(&t->shard)->inbox, t);
+		return true;
+	}
+	return false;
+}
+
+bool timer_shard_del(struct timer_shard *shard, struct timer_shard_timer *t)
+{
+	if (atomic_load_explicit(&t->shard, memory_order_relaxed) == shard
+	    && change_state(t, TIMER_SHARD_ARMED, TIMER_SHARD_IDLE)) {
+		timer_del(&shard->timers, &t->timer);
+		return true;
+	}
+	return timer_shard_cancel(t);
+}
+
+/* Move posted timers into the wheel, and finish cancelling others. */
+static void empty_inbox(struct timer_shard *shard)
+{
+	struct timer_shard_timer *t, *next;
+
+	for (t = lqueue_mpsc_drain(&shard->inbox); t; t = next) {
+		/* Once it's IDLE, it's not ours to touch. */
+		next = lqueue_mpsc_next(&shard->inbox, t);
+		switch (atomic_load(&t->state)) {
+		case TIMER_SHARD_QUEUED:
+			/* A cancel after this comes back through the inbox,
+			 * which only we empty: so it's in the wheel by then. */
+			if (change_state(t, TIMER_SHARD_QUEUED,
+					 TIMER_SHARD_ARMED)) {
+				timer_addmono(&shard->timers, &t->timer,
+					      t->when);
+				break;
+			}
+			/* Cancelled since we loaded it. */
+			atomic_store(&t->state, TIMER_SHARD_IDLE);
+			break;
+		case TIMER_SHARD_CANCELLING:
+			/* It may have expired already: that's harmless. */
+			timer_del(&shard->timers, &t->timer);
+			/* fall thru */
+		case TIMER_SHARD_CANCELLED:
+			atomic_store(&t->state, TIMER_SHARD_IDLE);
+			break;
+		default:
+			abort();
+		}
+	}
+}
+
+/*
+ * A post which lands after we looked at the inbox lowers next after we
+ * set it, so it isn't lost; one which landed before, we see in the inbox
+ * and go around again.
+ */
+static void publish(struct timer_shard *shard)
+{
+	struct timemono first;
+
+	do {
+		empty_inbox(shard);
+		atomic_store(&shard->next,
+			     timer_earliest(&shard->timers, &first)
+			     ? mono_to_nsec(first) : -1ULL);
+	} while (!lqueue_mpsc_empty(&shard->inbox));
+}
+
+bool timer_shard_move(struct timer_shard *from, struct timer_shard_timer *t,
+		      struct timer_shard *to)
+{
+	/* If it was posted to us, it's in the wheel after this. */
+	empty_inbox(from);
+
+	if (atomic_load_explicit(&t->shard, memory_order_relaxed) != from
+	    || !change_state(t, TIMER_SHARD_ARMED, TIMER_SHARD_IDLE))
+		return false;
+	timer_del(&from->timers, &t->timer);
+	timer_shard_post(to, t, t->when);
+	return true;
+}
+
+struct timer_shard_timer *timer_shard_expire(struct timer_shard *shard,
+					     struct timemono expire)
+{
+	struct timer *timer;
+
+	empty_inbox(shard);
+	while ((timer = timers_expire(&shard->timers, expire)) != NULL) {
+		struct timer_shard_timer *t;
+
+		t = container_of(timer, struct timer_shard_timer, timer);
+		/* If this fails, it's CANCELLING: the inbox has it. */
+		if (change_state(t, TIMER_SHARD_ARMED, TIMER_SHARD_IDLE))
+			return t;
+	}
+	publish(shard);
+	return NULL;
+}
+
+bool timer_shard_earliest(const struct timer_shard *shard,
+			  struct timemono *first)
+{
+	uint64_t next = atomic_load(&shard->next);
+
+	if (next == -1ULL)
+		return false;
+	*first = nsec_to_mono(next);
+	return true;
+}
+
+bool timer_shards_earliest(const struct timer_shards *shards,
+			   struct timemono *first)
+{
+	uint64_t next = -1ULL;
+	unsigned int i;
+
+	for (i = 0; i < shards->num; i++) {
+		uint64_t n = atomic_load(&shards->shard[i].next);
+
+		if (n < next)
+			next = n;
+	}
+	if (next == -1ULL)
+		return false;
+	*first = nsec_to_mono(next);
+	return true;
+}
@@ -0,0 +1,322 @@
+/* LGPL (v2.1 or any later version) - see LICENSE file for details */
+#ifndef CCAN_TIMER_SHARD_H
+#define CCAN_TIMER_SHARD_H
+#include "config.h"
+#include <ccan/timer/timer.h>
+#include <ccan/lqueue/mpsc/mpsc.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_SHARD_CACHE_LINE 64
+
+struct timer_shards;
+struct timer_shard;
+struct timer_shard_timer;
+
+/**
+ * timer_shards_init - set up one timer wheel per thread.
+ * @shards: the struct timer_shards
+ * @num: the number of shards (usually one per worker thread).
+ * @start: the minimum time which will ever be added.
+ *
+ * Each shard is a struct timers, owned by one thread: only that thread
+ * may add timers to it directly, expire them or delete them.  Any thread
+ * can post a timer to any shard (it goes into a lock-free inbox, which
+ * the owner empties into its wheel), or cancel a timer wherever it is.
+ *
+ * Returns false if out of memory.
+ *
+ * Example:
+ *	static struct timer_shards conn_timers;
+ *
+ *	static void setup(void)
+ *	{
+ *		if (!timer_shards_init(&conn_timers, 4, time_mono()))
+ *			err(1, "Allocating timer shards");
+ *	}
+ */
+bool timer_shards_init(struct timer_shards *shards, unsigned int num,
+		       struct timemono start);
+
+/**
+ * timer_shards_cleanup - free allocations within timer_shards struct.
+ * @shards: the struct timer_shards
+ *
+ * No thread may be using any shard.  Timers still in a shard are simply
+ * forgotten.
+ *
+ * Example:
+ *	static void shutdown_timers(void)
+ *	{
+ *		timer_shards_cleanup(&conn_timers);
+ *	}
+ */
+void timer_shards_cleanup(struct timer_shards *shards);
+
+/**
+ * timer_shards_get - get one shard.
+ * @shards: the struct timer_shards
+ * @n: the shard number (less than the number given to timer_shards_init())
+ *
+ * Example:
+ *	struct conn {
+ *		unsigned int thread;
+ *		struct timer_shard_timer timeout;
+ *	};
+ *
+ *	static struct timer_shard *conn_shard(const struct conn *c)
+ *	{
+ *		return timer_shards_get(&conn_timers, c->thread);
+ *	}
+ */
+struct timer_shard *timer_shards_get(struct timer_shards *shards,
+				     unsigned int n);
+
+/**
+ * timer_shard_timer_init - initialize a timer.
+ * @t: the timer to initialize
+ *
+ * Example:
+ *	static void init_conn(struct conn *c, unsigned int thread)
+ *	{
+ *		c->thread = thread;
+ *		timer_shard_timer_init(&c->timeout);
+ *	}
+ */
+void timer_shard_timer_init(struct timer_shard_timer *t);
+
+/**
+ * timer_shard_addmono - insert an absolute timer into your own shard.
+ * @shard: the shard, which the calling thread owns
+ * @t: the (initialized, and idle) timer to add
+ * @when: when @t expires (absolute).
+ *
+ * This is timer_addmono() on the shard's wheel, with no atomic
+ * operations beyond marking the timer as armed.
+ *
+ * Example:
+ *	// Called by the conn's own thread.
+ *	static void start_timeout(struct conn *c)
+ *	{
+ *		timer_shard_addmono(conn_shard(c), &c->timeout,
+ *				    timemono_add(time_mono(),
+ *						 time_from_msec(100)));
+ *	}
+ */
+void timer_shard_addmono(struct timer_shard *shard,
+			 struct timer_shard_timer *t, struct timemono when);
+
+/**
+ * timer_shard_addrel - insert a relative timer into your own shard.
+ * @shard: the shard, which the calling thread owns
+ * @t: the (initialized, and idle) timer to add
+ * @rel: when @t expires (relative).
+ *
+ * A convenient wrapper around timer_shard_addmono().
+ */
+void timer_shard_addrel(struct timer_shard *shard,
+			struct timer_shard_timer *t, struct timerel rel);
+
+/**
+ * timer_shard_post - insert a timer into any thread's shard.
+ * @shard: the shard
+ * @t: the (initialized, and idle) timer to add
+ * @when: when @t expires (absolute).
+ *
+ * This is safe to call from any thread: the timer goes into the shard's
+ * inbox, and its owner moves it into its wheel the next time it calls
+ * timer_shard_expire().  The shard's published earliest time is lowered
+ * at once, so a thread sleeping until timer_shard_earliest() should be
+ * woken if it was sleeping past @when.
+ *
+ * Example:
+ *	// Called by any thread.
+ *	static void start_timeout_remote(struct conn *c)
+ *	{
+ *		timer_shard_post(conn_shard(c), &c->timeout,
+ *				 timemono_add(time_mono(),
+ *					      time_from_msec(100)));
+ *	}
+ */
+void timer_shard_post(struct timer_shard *shard,
+		      struct timer_shard_timer *t, struct timemono when);
+
+/**
+ * timer_shard_cancel - stop a timer from expiring, from any thread.
+ * @t: the timer
+ *
+ * Returns true if @t was waiting to expire, and now never will; false if
+ * it wasn't (it has already been returned by timer_shard_expire(), or
+ * never added, or was already cancelled).  If a timer races with its own
+ * expiry, exactly one of these wins: either this returns true, or
+ * timer_shard_expire() returns it.
+ *
+ * The shard it was in may still hold it until its owner next calls
+ * timer_shard_expire(): don't free or re-add it until
+ * timer_shard_timer_idle() says so.
+ *
+ * Example:
+ *	static void conn_replied(struct conn *c)
+ *	{
+ *		if (timer_shard_cancel(&c->timeout))
+ *			printf("Cancelled before it went off\n");
+ *	}
+ */
+bool timer_shard_cancel(struct timer_shard_timer *t);
+
+/**
+ * timer_shard_del - remove a timer from your own shard.
+ * @shard: the shard, which the calling thread owns
+ * @t: the timer
+ *
+ * Like timer_shard_cancel(), but if @t is in @shard's wheel it is removed
+ * at once, and is idle again as soon as this returns.  Returns true if
+ * @t was waiting to expire.
+ *
+ * Example:
+ *	// Called by the conn's own thread.
+ *	static void conn_replied_here(struct conn *c)
+ *	{
+ *		timer_shard_del(conn_shard(c), &c->timeout);
+ *	}
+ */
+bool timer_shard_del(struct timer_shard *shard, struct timer_shard_timer *t);
+
+/**
+ * timer_shard_move - move a timer from your own shard to another.
+ * @from: the shard, which the calling thread owns
+ * @t: the timer
+ * @to: the shard to move it to.
+ *
+ * This keeps @t's expiry time, for when a connection moves to another
+ * thread and its timeouts should follow it.  Returns false (and does
+ * nothing) if @t was not waiting to expire in @from.
+ *
+ * Example:
+ *	// Called by the conn's own thread: hand it to another.
+ *	static void migrate_conn(struct conn *c, unsigned int to)
+ *	{
+ *		timer_shard_move(conn_shard(c), &c->timeout,
+ *				 timer_shards_get(&conn_timers, to));
+ *		c->thread = to;
+ *	}
+ */
+bool timer_shard_move(struct timer_shard *from, struct timer_shard_timer *t,
+		      struct timer_shard *to);
+
+/**
+ * timer_shard_timer_idle - is a timer no longer held by any shard?
+ * @t: the timer
+ *
+ * Once this returns true, after timer_shard_expire() returned it or it
+ * was cancelled, @t may be freed or added again.
+ */
+bool timer_shard_timer_idle(const struct timer_shard_timer *t);
+
+/**
+ * timer_shard_expire - remove one expired timer from your own shard.
+ * @shard: the shard, which the calling thread owns
+ * @expire: the current time
+ *
+ * This first moves any timers posted by other threads into the wheel,
+ * and finishes off any which were cancelled; then it is timers_expire().
+ * When there are no more timers due to expire, it returns NULL, and
+ * publishes the shard's earliest time for timer_shard_earliest().
+ *
+ * Example:
+ *	static void expire_conns(unsigned int thread)
+ *	{
+ *		struct timer_shard *mine = timer_shards_get(&conn_timers,
+ *							    thread);
+ *		struct timer_shard_timer *expired;
+ *
+ *		while ((expired = timer_shard_expire(mine, time_mono())))
+ *			printf("Timer expired!\n");
+ *	}
+ */
+struct timer_shard_timer *timer_shard_expire(struct timer_shard *shard,
+					     struct timemono expire);
+
+/**
+ * timer_shard_earliest - when a shard's first timer will expire
+ * @shard: the shard
+ * @first: the expiry time, only set if there is a timer.
+ *
+ * This may be called from any thread.  It reads the time published by
+ * the shard's owner when its timer_shard_expire() last returned NULL,
+ * lowered by any timer_shard_post() since: so it may be earlier than
+ * any timer (if one was cancelled, or has just been expired), but is
+ * never later.  Returns false if there are no timers.
+ *
+ * Example:
+ *	static void print_next(unsigned int thread)
+ *	{
+ *		struct timemono next;
+ *
+ *		if (timer_shard_earliest(timer_shards_get(&conn_timers, thread),
+ *					 &next))
+ *			printf("Next timeout at %li\n", (long)next.ts.tv_sec);
+ *	}
+ */
+bool timer_shard_earliest(const struct timer_shard *shard,
+			  struct timemono *first);
+
+/**
+ * timer_shards_earliest - when any shard's first timer will expire
+ * @shards: the struct timer_shards
+ * @first: the expiry time, only set if there is a timer.
+ *
+ * The earliest of timer_shard_earliest() over every shard, for a thread
+ * which sleeps on behalf of all of them.
+ *
+ * Example:
+ *	static bool any_timeouts(void)
+ *	{
+ *		struct timemono next;
+ *
+ *		return timer_shards_earliest(&conn_timers, &next);
+ *	}
+ */
+bool timer_shards_earliest(const struct timer_shards *shards,
+			   struct timemono *first);
+
+/**
+ * struct timer_shard_timer - a single timer, which can move between shards.
+ *
+ * This is usually contained within an application-specific structure.
+ * Only the timer_shard functions should touch its fields.
+ */
+struct timer_shard_timer {
+	struct timer timer;
+	struct lqueue_mpsc_link ql;
+	struct timemono when;
+	_Atomic(struct timer_shard *) shard;
+	_Atomic(unsigned int) state;
+};
+
+/**
+ * struct timer_shard - one thread's timers.
+ *
+ * The wheel is only touched by the owner; other threads add to the
+ * inbox, and lower the published earliest time.  Each is aligned to a
+ * cache line, so shards don't slow each other down.
+ */
+struct timer_shard {
+	_Alignas(TIMER_SHARD_CACHE_LINE) struct timers timers;
+	LQUEUE_MPSC(struct timer_shard_timer, ql) inbox;
+	/* Published earliest expiry, in nsec (-1ULL if none). */
+	_Alignas(TIMER_SHARD_CACHE_LINE) _Atomic(uint64_t) next;
+};
+
+/**
+ * struct timer_shards - a set of per-thread timer wheels.
+ *
+ * See Also:
+ *	timer_shards_init(), timer_shards_cleanup()
+ */
+struct timer_shards {
+	unsigned int num;
+	struct timer_shard *shard;
+};
+#endif /* CCAN_TIMER_SHARD_H */
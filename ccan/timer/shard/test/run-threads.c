@@ -0,0 +1,107 @@
+#include <ccan/timer/shard/shard.h>
+/* Include the C files directly. */
+#include <ccan/timer/shard/shard.c>
+#include <ccan/tap/tap.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define NUM 5000
+
+struct req {
+	struct timer_shard_timer timer;
+	_Atomic(int) fired, cancelled;
+};
+
+static struct timer_shards shards;
+static struct req reqs[THREADS][NUM];
+static _Atomic(unsigned int) remaining = THREADS * NUM, moved;
+
+/* Add everything (locally, posted, or moved), cancel a third, and expire
+ * whatever lands here until every timer is accounted for. */
+static void *worker(void *arg)
+{
+	long me = (long)arg;
+	struct timer_shard *mine = timer_shards_get(&shards, me);
+	struct timer_shard_timer *t;
+	unsigned int i, r = me * 2654435761U;
+
+	for (i = 0; i < NUM; i++) {
+		struct req *req = &reqs[me][i];
+		struct timemono when;
+
+		r = r * 1103515245 + 12345;
+		when = timemono_add(time_mono(),
+				    time_from_usec((r >> 8) % 2000));
+		timer_shard_timer_init(&req->timer);
+		switch (i % 3) {
+		case 0:
+			timer_shard_addmono(mine, &req->timer, when);
+			break;
+		case 1:
+			timer_shard_post(timer_shards_get(&shards,
+							  (r >> 4) % THREADS),
+					 &req->timer, when);
+			break;
+		case 2:
+			timer_shard_addmono(mine, &req->timer, when);
+			if (timer_shard_move(mine, &req->timer,
+					     timer_shards_get(&shards,
+							      (me + 1)
+							      % THREADS)))
+				moved++;
+			break;
+		}
+		if (i >= 2 && (r >> 12) % 3 == 0
+		    && timer_shard_cancel(&reqs[me][i - 2].timer)) {
+			reqs[me][i - 2].cancelled++;
+			remaining--;
+		}
+	}
+
+	while (remaining) {
+		while ((t = timer_shard_expire(mine, time_mono())) != NULL) {
+			struct req *req = container_of(t, struct req, timer);
+			req->fired++;
+			remaining--;
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[THREADS];
+	unsigned int bad = 0, cancelled = 0;
+	long i, j;
+
+	plan_tests(5);
+	ok1(timer_shards_init(&shards, THREADS, time_mono()));
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Each one either expired or was cancelled, never both. */
+	for (i = 0; i < THREADS; i++) {
+		for (j = 0; j < NUM; j++) {
+			if (reqs[i][j].fired + reqs[i][j].cancelled != 1)
+				bad++;
+			cancelled += reqs[i][j].cancelled;
+		}
+	}
+	ok1(bad == 0);
+	ok1(cancelled > 0);
+	ok1(moved == THREADS * (NUM / 3));
+
+	/* The last cancels may still be in inboxes. */
+	for (i = 0; i < THREADS; i++)
+		timer_shard_expire(timer_shards_get(&shards, i), time_mono());
+	for (i = 0; i < THREADS; i++)
+		for (j = 0; j < NUM; j++)
+			if (!timer_shard_timer_idle(&reqs[i][j].timer))
+				bad++;
+	ok1(bad == 0);
+	timer_shards_cleanup(&shards);
+
+	return exit_status();
+}
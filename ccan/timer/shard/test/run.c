@@ -0,0 +1,100 @@
+#include <ccan/timer/shard/shard.h>
+/* Include the C files directly. */
+#include <ccan/timer/shard/shard.c>
+#include <ccan/tap/tap.h>
+
+static struct timemono at(unsigned int msec)
+{
+	struct timemono t = { { 1000, 0 } };
+
+	return timemono_add(t, time_from_msec(msec));
+}
+
+int main(void)
+{
+	struct timer_shards shards;
+	struct timer_shard *s0, *s1;
+	struct timer_shard_timer t[4];
+	struct timemono first;
+	unsigned int i;
+
+	/* This is how many tests you plan to run */
+	plan_tests(42);
+
+	ok1(timer_shards_init(&shards, 2, at(0)));
+	s0 = timer_shards_get(&shards, 0);
+	s1 = timer_shards_get(&shards, 1);
+	ok1((uintptr_t)s1 % TIMER_SHARD_CACHE_LINE == 0);
+	ok1(!timer_shards_earliest(&shards, &first));
+	for (i = 0; i < 4; i++)
+		timer_shard_timer_init(&t[i]);
+
+	/* Local add, and expiry. */
+	timer_shard_addmono(s0, &t[0], at(10));
+	ok1(!timer_shard_timer_idle(&t[0]));
+	ok1(timer_shard_earliest(s0, &first) && timemono_eq(first, at(10)));
+	ok1(!timer_shard_earliest(s1, &first));
+	ok1(timer_shard_expire(s0, at(5)) == NULL);
+	ok1(timer_shard_expire(s0, at(10)) == &t[0]);
+	ok1(timer_shard_timer_idle(&t[0]));
+	ok1(timer_shard_expire(s0, at(10)) == NULL);
+	ok1(!timer_shard_earliest(s0, &first));
+	/* Too late to cancel. */
+	ok1(!timer_shard_cancel(&t[0]));
+
+	/* Post to the other shard: its earliest is lowered at once. */
+	timer_shard_post(s1, &t[1], at(20));
+	timer_shard_post(s1, &t[2], at(15));
+	ok1(timer_shard_earliest(s1, &first) && timemono_eq(first, at(15)));
+	ok1(timer_shards_earliest(&shards, &first) && timemono_eq(first, at(15)));
+	/* Cancel one while it's still in the inbox. */
+	ok1(timer_shard_cancel(&t[2]));
+	ok1(!timer_shard_cancel(&t[2]));
+	ok1(!timer_shard_timer_idle(&t[2]));
+	ok1(timer_shard_expire(s1, at(15)) == NULL);
+	ok1(timer_shard_timer_idle(&t[2]));
+	ok1(timer_shard_earliest(s1, &first) && timemono_eq(first, at(20)));
+	ok1(timers_check(&s1->timers, NULL));
+
+	/* Cancel one in the wheel: it's taken out on the next expire. */
+	ok1(timer_shard_cancel(&t[1]));
+	ok1(!timer_shard_timer_idle(&t[1]));
+	ok1(timer_shard_expire(s1, at(30)) == NULL);
+	ok1(timer_shard_timer_idle(&t[1]));
+	ok1(!timer_shard_earliest(s1, &first));
+
+	/* Cancelled after it expired in the wheel, but before the owner
+	 * got to it: the expiry loses. */
+	timer_shard_addmono(s0, &t[1], at(40));
+	ok1(timer_shard_expire(s0, at(35)) == NULL);
+	ok1(timer_shard_cancel(&t[1]));
+	ok1(timer_shard_expire(s0, at(50)) == NULL);
+	ok1(timer_shard_timer_idle(&t[1]));
+
+	/* Local delete is immediate. */
+	timer_shard_addmono(s0, &t[3], at(60));
+	ok1(timer_shard_del(s0, &t[3]));
+	ok1(timer_shard_timer_idle(&t[3]));
+	ok1(!timer_shard_del(s0, &t[3]));
+	ok1(timer_shard_expire(s0, at(70)) == NULL);
+
+	/* Move keeps the expiry time. */
+	timer_shard_addmono(s0, &t[3], at(80));
+	ok1(!timer_shard_move(s1, &t[3], s0));
+	ok1(timer_shard_move(s0, &t[3], s1));
+	ok1(timer_shard_expire(s0, at(80)) == NULL);
+	ok1(timer_shard_expire(s1, at(79)) == NULL);
+	ok1(timer_shard_earliest(s1, &first) && timemono_eq(first, at(80)));
+	ok1(timer_shard_expire(s1, at(80)) == &t[3]);
+	ok1(timer_shard_expire(s1, at(80)) == NULL);
+
+	/* Move one which was posted, and not yet in the wheel. */
+	timer_shard_post(s1, &t[0], at(90));
+	ok1(timer_shard_move(s1, &t[0], s0)
+	    && timer_shard_expire(s0, at(90)) == &t[0]);
+
+	timer_shards_cleanup(&shards);
+
+	/* This exits depending on whether all tests passed */
+	return exit_status();
+}
@@ -0,0 +1,171 @@
+/*
+ * Multi-threaded speed test: timer/shard against one struct timers
+ * behind a pthread mutex.
+ *
+ * Each thread keeps a window of timers, like connection timeouts: it
+ * cycles through them, adding each one which is idle (a quarter of them
+ * to the next thread's shard) and deleting each one which isn't, and
+ * checks for expiries every 64 operations.  Timeouts are up to 1ms
+ * away, so some of them do expire.
+ *
+ * Usage: speed [timers-per-thread] [ops-per-thread] [max-threads]
+ */
+#include <ccan/timer/shard/shard.h>
+#include <ccan/container_of/container_of.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct conn {
+	struct timer_shard_timer st;
+	struct timer t;
+	bool armed;
+};
+
+static size_t live, ops;
+static unsigned int nthreads;
+static struct timer_shards shards;
+static struct timers locked;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct thread {
+	pthread_t id;
+	unsigned int t;
+	bool sharded;
+	struct conn *conns;
+	size_t expired;
+};
+
+static void run_sharded(struct thread *me)
+{
+	struct timer_shard *mine = timer_shards_get(&shards, me->t);
+	struct timer_shard *next = timer_shards_get(&shards,
+						    (me->t + 1) % nthreads);
+	size_t i, r = me->t;
+
+	for (i = 0; i < ops; i++) {
+		struct conn *c = &me->conns[i % live];
+
+		r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+		if (timer_shard_timer_idle(&c->st)) {
+			struct timemono when;
+
+			when = timemono_add(time_mono(),
+					    time_from_usec((r >> 33) % 1000));
+			if (i % 4 == 3)
+				timer_shard_post(next, &c->st, when);
+			else
+				timer_shard_addmono(mine, &c->st, when);
+		} else
+			timer_shard_del(mine, &c->st);
+
+		if (i % 64 == 0) {
+			while (timer_shard_expire(mine, time_mono()))
+				me->expired++;
+		}
+	}
+}
+
+static void run_locked(struct thread *me)
+{
+	size_t i, r = me->t;
+
+	for (i = 0; i < ops; i++) {
+		struct conn *c = &me->conns[i % live];
+
+		r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+		pthread_mutex_lock(&lock);
+		if (!c->armed) {
+			timer_addrel(&locked, &c->t,
+				     time_from_usec((r >> 33) % 1000));
+			c->armed = true;
+		} else {
+			timer_del(&locked, &c->t);
+			c->armed = false;
+		}
+		pthread_mutex_unlock(&lock);
+
+		if (i % 64 == 0) {
+			struct timer *t;
+
+			pthread_mutex_lock(&lock);
+			while ((t = timers_expire(&locked, time_mono()))) {
+				container_of(t, struct conn, t)->armed = false;
+				me->expired++;
+			}
+			pthread_mutex_unlock(&lock);
+		}
+	}
+}
+
+static void *run(void *arg)
+{
+	struct thread *me = arg;
+
+	if (me->sharded)
+		run_sharded(me);
+	else
+		run_locked(me);
+	return NULL;
+}
+
+static double bench(bool sharded, size_t *expired)
+{
+	struct thread *threads = calloc(nthreads, sizeof(*threads));
+	struct timeabs start;
+	size_t i, j;
+
+	if (sharded)
+		timer_shards_init(&shards, nthreads, time_mono());
+	else
+		timers_init(&locked, time_mono());
+
+	start = time_now();
+	for (i = 0; i < nthreads; i++) {
+		threads[i].t = i;
+		threads[i].sharded = sharded;
+		threads[i].conns = calloc(live, sizeof(struct conn));
+		for (j = 0; j < live; j++) {
+			timer_shard_timer_init(&threads[i].conns[j].st);
+			timer_init(&threads[i].conns[j].t);
+		}
+		pthread_create(&threads[i].id, NULL, run, &threads[i]);
+	}
+	*expired = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].id, NULL);
+		*expired += threads[i].expired;
+	}
+
+	if (sharded)
+		timer_shards_cleanup(&shards);
+	else
+		timers_cleanup(&locked);
+	for (i = 0; i < nthreads; i++)
+		free(threads[i].conns);
+	free(threads);
+
+	/* Millions of adds and deletes (plus expiries) per second. */
+	return (double)(nthreads * ops + *expired)
+		/ time_to_usec(time_between(time_now(), start));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads;
+
+	live = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+	ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+	max_threads = argc > 3 ? atoi(argv[3]) : 32;
+
+	printf("%zu timers, %zu adds/deletes per thread (Mops/sec)\n",
+	       live, ops);
+	printf("threads\tsharded\t(expired)\tmutex\t(expired)\n");
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		size_t se, le;
+		double s = bench(true, &se);
+		double l = bench(false, &le);
+		printf("%u\t%.2f\t(%zu)\t%.2f\t(%zu)\n", nthreads, s, se, l, le);
+	}
+	return 0;
+}
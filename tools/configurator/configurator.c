@@ -161,6 +161,9 @@ static struct test tests[] = {
 	  "return __builtin_ffsll(0LL) == 0 ? 0 : 1;" },
 	{ "HAVE_BUILTIN_POPCOUNTL", INSIDE_MAIN, NULL, NULL,
 	  "return __builtin_popcountl(255L) == 8 ? 0 : 1;" },
+	{ "HAVE_BUILTIN_PREFETCH", INSIDE_MAIN, NULL, NULL,
+	  "__builtin_prefetch(argv, 0, 3);\n"
+	  "return 0;" },
 	{ "HAVE_BUILTIN_TYPES_COMPATIBLE_P", INSIDE_MAIN, NULL, NULL,
 	  "return __builtin_types_compatible_p(char *, int) ? 1 : 0;" },
 	{ "HAVE_ICCARM_INTRINSICS", DEFINES_FUNC, NULL, NULL,
@@ -214,6 +217,11 @@ static struct test tests[] = {
 	  "	if (arg == 4)\n"
 	  "		warnx(\"warn %u\", arg);\n"
 	  "}\n" },
+	{ "HAVE_EVENTFD", DEFINES_FUNC, NULL, NULL,
+	  "#include <sys/eventfd.h>\n"
+	  "static int func(void) {\n"
+	  "	return eventfd(0, EFD_SEMAPHORE|EFD_CLOEXEC);\n"
+	  "}" },
 	{ "HAVE_FILE_OFFSET_BITS", DEFINES_EVERYTHING|EXECUTE|MAY_NOT_COMPILE,
 	  "HAVE_32BIT_OFF_T", NULL,
 	  "#define _FILE_OFFSET_BITS 64\n"
@@ -261,6 +269,12 @@ static struct test tests[] = {
 	  "static void *func(int fd) {\n"
 	  "	return mmap(0, 65536, PROT_READ, MAP_SHARED, fd, 0);\n"
 	  "}" },
+	{ "HAVE_POSIX_MEMALIGN", DEFINES_FUNC, NULL, NULL,
+	  "#include <stdlib.h>\n"
+	  "static void *func(size_t size) {\n"
+	  "	void *p;\n"
+	  "	return posix_memalign(&p, 64, size) == 0 ? p : NULL;\n"
+	  "}" },
 	{ "HAVE_PROC_SELF_MAPS", DEFINES_EVERYTHING|EXECUTE|MAY_NOT_COMPILE, NULL, NULL,
 	  "#include <sys/types.h>\n"
 	  "#include <sys/stat.h>\n"